@@ -129,6 +129,11 @@ adminServerGetThreadPoolParameters(virNetServerPtr srv,
                               jobQueueDepth) < 0)
         goto cleanup;
 
+    if (virTypedParamsAddUInt(&tmpparams, nparams,
+                              &maxparams, VIR_THREADPOOL_IO_THREADS,
+                              virNetServerGetIOThreads(srv)) < 0)
+        goto cleanup;
+
     *params = tmpparams;
     tmpparams = NULL;
     ret = 0;
@@ -158,6 +163,8 @@ adminServerSetThreadPoolParameters(virNetServerPtr srv,
                                VIR_TYPED_PARAM_UINT,
                                VIR_THREADPOOL_WORKERS_PRIORITY,
                                VIR_TYPED_PARAM_UINT,
+                               VIR_THREADPOOL_IO_THREADS,
+                               VIR_TYPED_PARAM_UINT,
                                NULL) < 0)
         return -1;
 
@@ -177,6 +184,11 @@ adminServerSetThreadPoolParameters(virNetServerPtr srv,
                                             maxWorkers, prioWorkers) < 0)
         return -1;
 
+    if ((param = virTypedParamsGet(params, nparams,
+                                   VIR_THREADPOOL_IO_THREADS)) &&
+        virNetServerSetIOThreads(srv, param->value.ui) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -388,3 +400,47 @@ adminServerSetClientLimits(virNetServerPtr srv,
 
     return 0;
 }
+
+int
+adminServerGetMessagePoolStats(virNetServerPtr srv,
+                               virTypedParameterPtr *params,
+                               int *nparams,
+                               unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virTypedParameterPtr tmpparams = NULL;
+    virNetMessagePoolStats stats;
+
+    virCheckFlags(0, -1);
+
+    virNetServerGetMessagePoolStats(srv, &stats);
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MSGPOOL_HITS,
+                                stats.hits) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MSGPOOL_MISSES,
+                                stats.misses) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MSGPOOL_DISCARDS,
+                                stats.discards) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_MSGPOOL_FREE,
+                              stats.nfree) < 0)
+        goto cleanup;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    return ret;
+}
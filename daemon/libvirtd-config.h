@@ -74,6 +74,8 @@ struct daemonConfig {
     unsigned int max_requests;
     unsigned int max_client_requests;
 
+    unsigned int io_threads;
+
     unsigned int log_level;
     char *log_filters;
     char *log_outputs;
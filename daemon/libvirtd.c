@@ -1344,6 +1344,11 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    if (virNetServerSetIOThreads(srv, config->io_threads) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
     if (!(dmn = virNetDaemonNew()) ||
         virNetDaemonAddServer(dmn, srv) < 0) {
         ret = VIR_DAEMON_ERR_INIT;
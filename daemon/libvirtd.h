@@ -33,6 +33,7 @@
 # include "admin_protocol.h"
 # include "lxc_protocol.h"
 # include "qemu_protocol.h"
+# include "virhash.h"
 # include "virthread.h"
 
 # if WITH_SASL
@@ -48,6 +49,8 @@ typedef struct daemonAdmClientPrivate daemonAdmClientPrivate;
 typedef daemonAdmClientPrivate *daemonAdmClientPrivatePtr;
 typedef struct daemonClientEventCallback daemonClientEventCallback;
 typedef daemonClientEventCallback *daemonClientEventCallbackPtr;
+typedef struct daemonClientEventBatch daemonClientEventBatch;
+typedef daemonClientEventBatch *daemonClientEventBatchPtr;
 
 /* Stores the per-client connection state */
 struct daemonClientPrivate {
@@ -60,6 +63,8 @@ struct daemonClientPrivate {
     size_t nnetworkEventCallbacks;
     daemonClientEventCallbackPtr *qemuEventCallbacks;
     size_t nqemuEventCallbacks;
+    daemonClientEventCallbackPtr *domainStatsEventCallbacks;
+    size_t ndomainStatsEventCallbacks;
     daemonClientEventCallbackPtr *storageEventCallbacks;
     size_t nstorageEventCallbacks;
     daemonClientEventCallbackPtr *nodeDeviceEventCallbacks;
@@ -68,6 +73,22 @@ struct daemonClientPrivate {
     size_t nsecretEventCallbacks;
     bool closeRegistered;
 
+    /* Whether the client accepts stream packets larger than
+     * VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX */
+    bool streamLargePayload;
+
+    /* Events waiting to be sent in one REMOTE_PROC_EVENT_BATCH
+     * message, NULL unless the client negotiated
+     * VIR_DRV_FEATURE_REMOTE_EVENT_BATCH */
+    daemonClientEventBatchPtr eventBatch;
+
+    /* Dictionary of the domain stats keys sent to the client with
+     * REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS_COLUMNS, it only ever
+     * grows. @statsKeyIndex maps a field to its latest index + 1 */
+    remote_domain_stats_key *statsKeys;
+    size_t nstatsKeys;
+    virHashTablePtr statsKeyIndex;
+
 # if WITH_SASL
     virNetSASLSessionPtr sasl;
 # endif
@@ -83,6 +83,32 @@ struct daemonClientEventCallback {
     bool legacy;
 };
 
+/* Flush a pending event batch once it grows past this many bytes, so
+ * that it always fits into a message older peers can receive */
+#define REMOTE_EVENT_BATCH_SIZE_MAX (VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX / 2)
+
+typedef struct daemonClientEventBatchEntry daemonClientEventBatchEntry;
+typedef daemonClientEventBatchEntry *daemonClientEventBatchEntryPtr;
+struct daemonClientEventBatchEntry {
+    int procedure;
+    char *data;
+    size_t len;
+    /* Events with the same non-NULL key supersede each other */
+    char *key;
+};
+
+struct daemonClientEventBatch {
+    daemonClientEventBatchEntryPtr entries;
+    size_t nentries;
+    size_t size;
+
+    /* Scratch buffer to encode events into */
+    char *buf;
+
+    /* Fires once per event loop iteration while events are pending */
+    int timer;
+};
+
 static virDomainPtr get_nonnull_domain(virConnectPtr conn, remote_nonnull_domain domain);
 static virNetworkPtr get_nonnull_network(virConnectPtr conn, remote_nonnull_network network);
 static virInterfacePtr get_nonnull_interface(virConnectPtr conn, remote_nonnull_interface iface);
@@ -120,6 +146,10 @@ remoteDispatchObjectEventSend(virNetServerClientPtr client,
                               int procnr,
                               xdrproc_t proc,
                               void *data);
+static daemonClientEventBatchPtr
+remoteEventBatchNew(virNetServerClientPtr client);
+static void
+remoteEventBatchFree(daemonClientEventBatchPtr batch);
 
 static void
 remoteEventCallbackFree(void *opaque)
@@ -1609,6 +1639,82 @@ remoteRelayDomainQemuMonitorEvent(virConnectPtr conn,
     VIR_FREE(details_p);
 }
 
+static void
+remoteRelayDomainStatsEvent(virConnectPtr conn,
+                            virDomainStatsRecordPtr *stats,
+                            int nstats,
+                            void *opaque)
+{
+    daemonClientEventCallbackPtr callback = opaque;
+    remote_domain_event_stats_msg data;
+    virIdentityPtr identity = NULL;
+    size_t i;
+
+    if (callback->callbackID < 0)
+        return;
+
+    if (nstats > REMOTE_DOMAIN_LIST_MAX) {
+        VIR_WARN("Dropping stats of %d domains, more than %d can't be sent",
+                 nstats, REMOTE_DOMAIN_LIST_MAX);
+        return;
+    }
+
+    VIR_DEBUG("Relaying stats of %d domains, callback %d",
+              nstats, callback->callbackID);
+
+    /* build return data */
+    memset(&data, 0, sizeof(data));
+    data.callbackID = callback->callbackID;
+    if (nstats &&
+        VIR_ALLOC_N(data.records.records_val, nstats) < 0)
+        return;
+
+    /* The client may be allowed to see only some of the domains, check
+     * them all under its identity at once */
+    if (!(identity = virNetServerClientGetIdentity(callback->client)))
+        goto cleanup;
+    if (virIdentitySetCurrent(identity) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nstats; i++) {
+        remote_domain_stats_record *dst;
+        virDomainDef def;
+
+        /* For now, we just create a virDomainDef with enough contents to
+         * satisfy what viraccessdriverpolkit.c references. */
+        def.name = stats[i]->dom->name;
+        memcpy(def.uuid, stats[i]->dom->uuid, VIR_UUID_BUFLEN);
+        if (!virConnectDomainStatsEventRegisterCheckACL(conn, &def))
+            continue;
+
+        dst = data.records.records_val + data.records.records_len++;
+        make_nonnull_domain(&dst->dom, stats[i]->dom);
+        if (virTypedParamsSerialize(stats[i]->params, stats[i]->nparams,
+                                    (virTypedParameterRemotePtr *) &dst->params.params_val,
+                                    &dst->params.params_len,
+                                    VIR_TYPED_PARAM_STRING_OKAY) < 0)
+            goto cleanup;
+    }
+
+    ignore_value(virIdentitySetCurrent(NULL));
+
+    /* Nothing the client may see has changed */
+    if (nstats && !data.records.records_len)
+        goto cleanup;
+
+    remoteDispatchObjectEventSend(callback->client, remoteProgram,
+                                  REMOTE_PROC_DOMAIN_EVENT_STATS,
+                                  (xdrproc_t)xdr_remote_domain_event_stats_msg,
+                                  &data);
+    virObjectUnref(identity);
+    return;
+
+ cleanup:
+    ignore_value(virIdentitySetCurrent(NULL));
+    virObjectUnref(identity);
+    xdr_free((xdrproc_t)xdr_remote_domain_event_stats_msg, (char *) &data);
+}
+
 static
 void remoteRelayConnectionClosedEvent(virConnectPtr conn ATTRIBUTE_UNUSED, int reason, void *opaque)
 {
@@ -1633,11 +1739,11 @@ void remoteRelayConnectionClosedEvent(virConnectPtr conn ATTRIBUTE_UNUSED, int r
 void remoteClientFreeFunc(void *data)
 {
     struct daemonClientPrivate *priv = data;
+    size_t i;
 
     /* Deregister event delivery callback */
     if (priv->conn) {
         virIdentityPtr sysident = virIdentityGetSystem();
-        size_t i;
 
         virIdentitySetCurrent(sysident);
 
@@ -1730,6 +1836,21 @@ void remoteClientFreeFunc(void *data)
         }
         VIR_FREE(priv->qemuEventCallbacks);
 
+        for (i = 0; i < priv->ndomainStatsEventCallbacks; i++) {
+            int callbackID = priv->domainStatsEventCallbacks[i]->callbackID;
+            if (callbackID < 0) {
+                VIR_WARN("unexpected incomplete domain stats callback %zu", i);
+                continue;
+            }
+            VIR_DEBUG("Deregistering remote domain stats event relay %d",
+                      callbackID);
+            priv->domainStatsEventCallbacks[i]->callbackID = -1;
+            if (virConnectDomainStatsEventDeregister(priv->conn,
+                                                     callbackID) < 0)
+                VIR_WARN("unexpected domain stats event deregister failure");
+        }
+        VIR_FREE(priv->domainStatsEventCallbacks);
+
         if (priv->closeRegistered) {
             if (virConnectUnregisterCloseCallback(priv->conn,
                                                   remoteRelayConnectionClosedEvent) < 0)
@@ -1742,6 +1863,11 @@ void remoteClientFreeFunc(void *data)
         virObjectUnref(sysident);
     }
 
+    for (i = 0; i < priv->nstatsKeys; i++)
+        VIR_FREE(priv->statsKeys[i].field);
+    VIR_FREE(priv->statsKeys);
+    virHashFree(priv->statsKeyIndex);
+
     VIR_FREE(priv);
 }
 
@@ -1751,6 +1877,11 @@ static void remoteClientCloseFunc(virNetServerClientPtr client)
     struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
 
     daemonRemoveAllClientStreams(priv->streams);
+
+    virMutexLock(&priv->lock);
+    remoteEventBatchFree(priv->eventBatch);
+    priv->eventBatch = NULL;
+    virMutexUnlock(&priv->lock);
 }
 
 
@@ -3986,17 +4117,17 @@ remoteDispatchConnectDomainEventDeregister(virNetServerPtr server ATTRIBUTE_UNUS
     return rv;
 }
 
-static void
-remoteDispatchObjectEventSend(virNetServerClientPtr client,
-                              virNetServerProgramPtr program,
-                              int procnr,
-                              xdrproc_t proc,
-                              void *data)
+static int
+remoteDispatchObjectEventSendMessage(virNetServerClientPtr client,
+                                     virNetServerProgramPtr program,
+                                     int procnr,
+                                     xdrproc_t proc,
+                                     void *data)
 {
     virNetMessagePtr msg;
 
     if (!(msg = virNetMessageNew(false)))
-        goto cleanup;
+        goto error;
 
     msg->header.prog = virNetServerProgramGetID(program);
     msg->header.vers = virNetServerProgramGetVersion(program);
@@ -4006,19 +4137,276 @@ remoteDispatchObjectEventSend(virNetServerClientPtr client,
     msg->header.status = VIR_NET_OK;
 
     if (virNetMessageEncodeHeader(msg) < 0)
-        goto cleanup;
+        goto error;
 
     if (virNetMessageEncodePayload(msg, proc, data) < 0)
-        goto cleanup;
+        goto error;
 
     VIR_DEBUG("Queue event %d %zu", procnr, msg->bufferLength);
-    virNetServerClientSendMessage(client, msg);
+    return virNetServerClientSendMessage(client, msg);
 
-    xdr_free(proc, data);
-    return;
+ error:
+    virNetMessageFree(msg);
+    return -1;
+}
+
+
+static void
+remoteEventBatchClear(daemonClientEventBatchPtr batch)
+{
+    size_t i;
+
+    for (i = 0; i < batch->nentries; i++) {
+        VIR_FREE(batch->entries[i].data);
+        VIR_FREE(batch->entries[i].key);
+    }
+    VIR_FREE(batch->entries);
+    batch->nentries = 0;
+    batch->size = 0;
+}
+
+
+static void
+remoteEventBatchFree(daemonClientEventBatchPtr batch)
+{
+    if (!batch)
+        return;
+
+    if (batch->timer != -1)
+        virEventRemoveTimeout(batch->timer);
+    remoteEventBatchClear(batch);
+    VIR_FREE(batch->buf);
+    VIR_FREE(batch);
+}
+
+
+/*
+ * Sends the pending events of @client, if any. Must be called with
+ * the client private data lock held.
+ */
+static void
+remoteEventBatchFlushLocked(virNetServerClientPtr client,
+                            daemonClientEventBatchPtr batch)
+{
+    remote_event_batch_msg msg;
+    size_t i;
+
+    if (batch->nentries == 0)
+        return;
+
+    memset(&msg, 0, sizeof(msg));
+    if (VIR_ALLOC_N(msg.events.events_val, batch->nentries) < 0)
+        goto cleanup;
+    msg.events.events_len = batch->nentries;
+
+    for (i = 0; i < batch->nentries; i++) {
+        msg.events.events_val[i].procedure = batch->entries[i].procedure;
+        msg.events.events_val[i].data.data_val = batch->entries[i].data;
+        msg.events.events_val[i].data.data_len = batch->entries[i].len;
+    }
+
+    VIR_DEBUG("Sending batch of %zu events, %zu bytes",
+              batch->nentries, batch->size);
+    remoteDispatchObjectEventSendMessage(client, remoteProgram,
+                                         REMOTE_PROC_EVENT_BATCH,
+                                         (xdrproc_t)xdr_remote_event_batch_msg,
+                                         &msg);
+
+ cleanup:
+    /* The event data is owned by the batch entries */
+    VIR_FREE(msg.events.events_val);
+    remoteEventBatchClear(batch);
+    virEventUpdateTimeout(batch->timer, -1);
+}
+
+
+static void
+remoteEventBatchTimer(int timer ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    virNetServerClientPtr client = opaque;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    virMutexLock(&priv->lock);
+    if (priv->eventBatch)
+        remoteEventBatchFlushLocked(client, priv->eventBatch);
+    virMutexUnlock(&priv->lock);
+}
+
+
+static daemonClientEventBatchPtr
+remoteEventBatchNew(virNetServerClientPtr client)
+{
+    daemonClientEventBatchPtr batch;
+
+    if (VIR_ALLOC(batch) < 0)
+        return NULL;
+
+    if (VIR_ALLOC_N(batch->buf, REMOTE_EVENT_BATCH_EVENT_MAX) < 0)
+        goto error;
+
+    if ((batch->timer = virEventAddTimeout(-1, remoteEventBatchTimer,
+                                           virObjectRef(client),
+                                           virObjectFreeCallback)) < 0) {
+        virObjectUnref(client);
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unable to add event batch timer"));
+        goto error;
+    }
+
+    return batch;
+
+ error:
+    VIR_FREE(batch->buf);
+    VIR_FREE(batch);
+    return NULL;
+}
+
+
+/*
+ * Returns the key identifying the state an event reports, if a
+ * newer event of the same kind makes an older one pointless, or NULL
+ * if every event has to be delivered.
+ */
+static char *
+remoteEventBatchKey(int procnr,
+                    void *data)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    char *key = NULL;
+
+    switch (procnr) {
+    case REMOTE_PROC_DOMAIN_EVENT_BALLOON_CHANGE: {
+        remote_domain_event_balloon_change_msg *msg = data;
+
+        virUUIDFormat((unsigned char *) msg->dom.uuid, uuidstr);
+        ignore_value(virAsprintf(&key, "%d:%s", procnr, uuidstr));
+        break;
+    }
+
+    case REMOTE_PROC_DOMAIN_EVENT_CALLBACK_BALLOON_CHANGE: {
+        remote_domain_event_callback_balloon_change_msg *msg = data;
+
+        virUUIDFormat((unsigned char *) msg->msg.dom.uuid, uuidstr);
+        ignore_value(virAsprintf(&key, "%d:%d:%s", procnr,
+                                 msg->callbackID, uuidstr));
+        break;
+    }
+
+    case REMOTE_PROC_DOMAIN_EVENT_CALLBACK_METADATA_CHANGE: {
+        remote_domain_event_callback_metadata_change_msg *msg = data;
+
+        virUUIDFormat((unsigned char *) msg->dom.uuid, uuidstr);
+        ignore_value(virAsprintf(&key, "%d:%d:%s:%d:%s", procnr,
+                                 msg->callbackID, uuidstr, msg->type,
+                                 msg->nsuri ? *msg->nsuri : ""));
+        break;
+    }
+
+    case REMOTE_PROC_STORAGE_POOL_EVENT_REFRESH: {
+        remote_storage_pool_event_refresh_msg *msg = data;
+
+        virUUIDFormat((unsigned char *) msg->pool.uuid, uuidstr);
+        ignore_value(virAsprintf(&key, "%d:%d:%s", procnr,
+                                 msg->callbackID, uuidstr));
+        break;
+    }
+    }
+
+    return key;
+}
+
+
+/*
+ * Adds the event to the pending batch of the client, dropping any
+ * pending event it supersedes. Returns 0 on success, -1 if the event
+ * has to be sent on its own. Must be called with the client private
+ * data lock held.
+ */
+static int
+remoteEventBatchAppendLocked(virNetServerClientPtr client,
+                             daemonClientEventBatchPtr batch,
+                             int procnr,
+                             xdrproc_t proc,
+                             void *data)
+{
+    daemonClientEventBatchEntry entry = { .procedure = procnr };
+    XDR xdr;
+    size_t i;
+
+    xdrmem_create(&xdr, batch->buf, REMOTE_EVENT_BATCH_EVENT_MAX, XDR_ENCODE);
+    if (!(*proc)(&xdr, data)) {
+        xdr_destroy(&xdr);
+        return -1;
+    }
+    entry.len = xdr_getpos(&xdr);
+    xdr_destroy(&xdr);
+
+    if (VIR_ALLOC_N(entry.data, entry.len) < 0)
+        return -1;
+    memcpy(entry.data, batch->buf, entry.len);
+
+    entry.key = remoteEventBatchKey(procnr, data);
+    if (entry.key) {
+        for (i = 0; i < batch->nentries; i++) {
+            if (STRNEQ_NULLABLE(batch->entries[i].key, entry.key))
+                continue;
+
+            VIR_DEBUG("Coalescing event %d", procnr);
+            batch->size -= batch->entries[i].len;
+            VIR_FREE(batch->entries[i].data);
+            VIR_FREE(batch->entries[i].key);
+            VIR_DELETE_ELEMENT(batch->entries, i, batch->nentries);
+            break;
+        }
+    }
+
+    if (batch->size + entry.len > REMOTE_EVENT_BATCH_SIZE_MAX ||
+        batch->nentries == REMOTE_EVENT_BATCH_MAX)
+        remoteEventBatchFlushLocked(client, batch);
+
+    batch->size += entry.len;
+    if (VIR_APPEND_ELEMENT(batch->entries, batch->nentries, entry) < 0) {
+        batch->size -= entry.len;
+        VIR_FREE(entry.data);
+        VIR_FREE(entry.key);
+        return -1;
+    }
+
+    virEventUpdateTimeout(batch->timer, 0);
+    return 0;
+}
+
+
+static void
+remoteDispatchObjectEventSend(virNetServerClientPtr client,
+                              virNetServerProgramPtr program,
+                              int procnr,
+                              xdrproc_t proc,
+                              void *data)
+{
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    virMutexLock(&priv->lock);
+    if (priv->eventBatch) {
+        /* Events which can't be batched must not overtake the ones
+         * which are already pending */
+        if (program == remoteProgram &&
+            remoteEventBatchAppendLocked(client, priv->eventBatch,
+                                         procnr, proc, data) == 0) {
+            virMutexUnlock(&priv->lock);
+            goto cleanup;
+        }
+        virResetLastError();
+        remoteEventBatchFlushLocked(client, priv->eventBatch);
+    }
+    virMutexUnlock(&priv->lock);
+
+    remoteDispatchObjectEventSendMessage(client, program, procnr, proc, data);
 
  cleanup:
-    virNetMessageFree(msg);
     xdr_free(proc, data);
 }
 
@@ -4674,6 +5062,18 @@ static int remoteDispatchConnectSupportsFeature(virNetServerPtr server ATTRIBUTE
         supported = 1;
         break;
 
+    case VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_PAYLOAD:
+        supported = 1;
+        break;
+
+    case VIR_DRV_FEATURE_REMOTE_EVENT_BATCH:
+        supported = 1;
+        break;
+
+    case VIR_DRV_FEATURE_REMOTE_DOMAIN_STATS_COLUMNS:
+        supported = 1;
+        break;
+
     default:
         if ((supported = virConnectSupportsFeature(priv->conn, args->feature)) < 0)
             goto cleanup;
@@ -4691,6 +5091,53 @@ static int remoteDispatchConnectSupportsFeature(virNetServerPtr server ATTRIBUTE
 }
 
 
+/* Turns on a feature which changes what the daemon sends to the
+ * client, and which the client must therefore opt into */
+static int
+remoteDispatchConnectEnableFeature(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                   virNetServerClientPtr client,
+                                   virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                   virNetMessageErrorPtr rerr,
+                                   remote_connect_enable_feature_args *args)
+{
+    int rv = -1;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    virMutexLock(&priv->lock);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    switch (args->feature) {
+    case VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_PAYLOAD:
+        priv->streamLargePayload = true;
+        break;
+
+    case VIR_DRV_FEATURE_REMOTE_EVENT_BATCH:
+        if (!priv->eventBatch &&
+            !(priv->eventBatch = remoteEventBatchNew(client)))
+            goto cleanup;
+        break;
+
+    default:
+        virReportError(VIR_ERR_NO_SUPPORT,
+                       _("feature %d cannot be enabled"), args->feature);
+        goto cleanup;
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    return rv;
+}
+
+
 static int
 remoteDispatchDomainOpenGraphics(virNetServerPtr server ATTRIBUTE_UNUSED,
                                  virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -5328,7 +5775,7 @@ remoteDispatchDomainMigratePrepareTunnel3Params(virNetServerPtr server ATTRIBUTE
 
     if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)) ||
         !(stream = daemonCreateClientStream(client, st, remoteProgram,
-                                            &msg->header)))
+                                            &msg->header, false)))
         goto cleanup;
 
     if (virDomainMigratePrepareTunnel3Params(priv->conn, st, params, nparams,
@@ -6591,6 +7038,290 @@ remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
 }
 
 
+/* Returns in @key the index of @field of @type in the dictionary of
+ * stats keys of the client, adding it there if it's not known yet */
+static int
+remoteStatsKeyLookupLocked(struct daemonClientPrivate *priv,
+                           const char *field,
+                           int type,
+                           unsigned int *key)
+{
+    remote_domain_stats_key entry;
+    size_t idx;
+
+    if (!priv->statsKeyIndex &&
+        !(priv->statsKeyIndex = virHashCreate(64, NULL)))
+        return -1;
+
+    idx = (uintptr_t) virHashLookup(priv->statsKeyIndex, field);
+    if (idx && priv->statsKeys[idx - 1].type == type) {
+        *key = idx - 1;
+        return 0;
+    }
+
+    /* Either a new field, or one whose type has changed */
+    if (priv->nstatsKeys >= REMOTE_DOMAIN_STATS_KEYS_MAX) {
+        virReportError(VIR_ERR_RPC,
+                       _("too many domain stats keys, limit is %d"),
+                       REMOTE_DOMAIN_STATS_KEYS_MAX);
+        return -1;
+    }
+
+    entry.type = type;
+    if (VIR_STRDUP(entry.field, field) < 0)
+        return -1;
+
+    if (VIR_APPEND_ELEMENT(priv->statsKeys, priv->nstatsKeys, entry) < 0) {
+        VIR_FREE(entry.field);
+        return -1;
+    }
+
+    if (virHashUpdateEntry(priv->statsKeyIndex, field,
+                           (void *) (uintptr_t) priv->nstatsKeys) < 0)
+        return -1;
+
+    *key = priv->nstatsKeys - 1;
+    return 0;
+}
+
+
+static int
+remoteDispatchConnectGetAllDomainStatsColumns(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                              virNetServerClientPtr client,
+                                              virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                              virNetMessageErrorPtr rerr,
+                                              remote_connect_get_all_domain_stats_columns_args *args,
+                                              remote_connect_get_all_domain_stats_columns_ret *ret)
+{
+    int rv = -1;
+    size_t i;
+    struct daemonClientPrivate *priv = virNetServerClientGetPrivateData(client);
+    virDomainStatsColumnsPtr columns = NULL;
+    virDomainPtr *doms = NULL;
+    bool locked = false;
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if (args->doms.doms_len) {
+        if (VIR_ALLOC_N(doms, args->doms.doms_len + 1) < 0)
+            goto cleanup;
+
+        for (i = 0; i < args->doms.doms_len; i++) {
+            if (!(doms[i] = get_nonnull_domain(priv->conn, args->doms.doms_val[i])))
+                goto cleanup;
+        }
+
+        if (virDomainListGetStatsColumns(doms, args->stats,
+                                         &columns, args->flags) < 0)
+            goto cleanup;
+    } else {
+        if (virConnectGetAllDomainStatsColumns(priv->conn, args->stats,
+                                               &columns, args->flags) < 0)
+            goto cleanup;
+    }
+
+    if (columns->ndoms > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of domains is %d, "
+                         "which exceeds max limit: %d"),
+                       columns->ndoms, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (columns->ndoms) {
+        if (VIR_ALLOC_N(ret->doms.doms_val, columns->ndoms) < 0)
+            goto cleanup;
+        ret->doms.doms_len = columns->ndoms;
+
+        for (i = 0; i < columns->ndoms; i++)
+            make_nonnull_domain(ret->doms.doms_val + i, columns->doms[i]);
+    }
+
+    if (columns->ncolumns &&
+        VIR_ALLOC_N(ret->columns.columns_val, columns->ncolumns) < 0)
+        goto cleanup;
+    ret->columns.columns_len = columns->ncolumns;
+
+    virMutexLock(&priv->lock);
+    locked = true;
+
+    if (args->nkeys > priv->nstatsKeys) {
+        virReportError(VIR_ERR_RPC,
+                       _("client knows %u domain stats keys, only %zu "
+                         "were sent"), args->nkeys, priv->nstatsKeys);
+        goto cleanup;
+    }
+
+    for (i = 0; i < columns->ncolumns; i++) {
+        virDomainStatsColumnPtr column = columns->columns + i;
+        remote_domain_stats_column *dst = ret->columns.columns_val + i;
+
+        if (remoteStatsKeyLookupLocked(priv, column->field, column->type,
+                                       &dst->key) < 0 ||
+            virTypedParamsColumnPack(column, columns->ndoms,
+                                     &dst->present.present_val,
+                                     &dst->present.present_len,
+                                     &dst->values.values_val,
+                                     &dst->values.values_len,
+                                     &dst->strings.strings_val,
+                                     &dst->strings.strings_len) < 0)
+            goto cleanup;
+
+        if (dst->values.values_len > REMOTE_DOMAIN_STATS_VALUES_MAX) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Packed values of '%s' take %u bytes, "
+                             "which exceeds max limit: %d"),
+                           column->field, dst->values.values_len,
+                           REMOTE_DOMAIN_STATS_VALUES_MAX);
+            goto cleanup;
+        }
+    }
+
+    /* Send the part of the dictionary the client doesn't know yet,
+     * which may include keys added by its concurrent calls */
+    if (priv->nstatsKeys > args->nkeys) {
+        size_t nkeys = priv->nstatsKeys - args->nkeys;
+
+        if (VIR_ALLOC_N(ret->keys.keys_val, nkeys) < 0)
+            goto cleanup;
+        ret->keys.keys_len = nkeys;
+
+        for (i = 0; i < nkeys; i++) {
+            remote_domain_stats_key *key = priv->statsKeys + args->nkeys + i;
+
+            ret->keys.keys_val[i].type = key->type;
+            if (VIR_STRDUP(ret->keys.keys_val[i].field, key->field) < 0)
+                goto cleanup;
+        }
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (locked)
+        virMutexUnlock(&priv->lock);
+    if (rv < 0) {
+        virNetMessageSaveError(rerr);
+        xdr_free((xdrproc_t) xdr_remote_connect_get_all_domain_stats_columns_ret,
+                 (char *) ret);
+    }
+
+    virDomainStatsColumnsFree(columns);
+    virObjectListFree(doms);
+
+    return rv;
+}
+
+
+static int
+remoteDispatchConnectDomainStatsEventRegister(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                              virNetServerClientPtr client,
+                                              virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                              virNetMessageErrorPtr rerr ATTRIBUTE_UNUSED,
+                                              remote_connect_domain_stats_event_register_args *args,
+                                              remote_connect_domain_stats_event_register_ret *ret)
+{
+    int callbackID;
+    int rv = -1;
+    daemonClientEventCallbackPtr callback = NULL;
+    daemonClientEventCallbackPtr ref;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    virMutexLock(&priv->lock);
+
+    /* See qemuDispatchConnectDomainMonitorEventRegister for why the
+     * incomplete callback is appended first */
+    if (VIR_ALLOC(callback) < 0)
+        goto cleanup;
+    callback->client = client;
+    callback->callbackID = -1;
+    ref = callback;
+    if (VIR_APPEND_ELEMENT(priv->domainStatsEventCallbacks,
+                           priv->ndomainStatsEventCallbacks,
+                           callback) < 0)
+        goto cleanup;
+
+    if ((callbackID = virConnectDomainStatsEventRegister(priv->conn,
+                                                         args->stats,
+                                                         remoteRelayDomainStatsEvent,
+                                                         ref,
+                                                         remoteEventCallbackFree,
+                                                         args->flags)) < 0) {
+        VIR_SHRINK_N(priv->domainStatsEventCallbacks,
+                     priv->ndomainStatsEventCallbacks, 1);
+        callback = ref;
+        goto cleanup;
+    }
+
+    ref->callbackID = callbackID;
+    ret->callbackID = callbackID;
+
+    rv = 0;
+
+ cleanup:
+    VIR_FREE(callback);
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    return rv;
+}
+
+
+static int
+remoteDispatchConnectDomainStatsEventDeregister(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                                virNetServerClientPtr client,
+                                                virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                                virNetMessageErrorPtr rerr ATTRIBUTE_UNUSED,
+                                                remote_connect_domain_stats_event_deregister_args *args)
+{
+    int rv = -1;
+    size_t i;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+
+    if (!priv->conn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    virMutexLock(&priv->lock);
+
+    for (i = 0; i < priv->ndomainStatsEventCallbacks; i++) {
+        if (priv->domainStatsEventCallbacks[i]->callbackID == args->callbackID)
+            break;
+    }
+    if (i == priv->ndomainStatsEventCallbacks) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("domain stats event callback %d not registered"),
+                       args->callbackID);
+        goto cleanup;
+    }
+
+    if (virConnectDomainStatsEventDeregister(priv->conn,
+                                             args->callbackID) < 0)
+        goto cleanup;
+
+    VIR_DELETE_ELEMENT(priv->domainStatsEventCallbacks, i,
+                       priv->ndomainStatsEventCallbacks);
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virMutexUnlock(&priv->lock);
+    return rv;
+}
+
 static int
 remoteDispatchNodeAllocPages(virNetServerPtr server ATTRIBUTE_UNUSED,
                              virNetServerClientPtr client,
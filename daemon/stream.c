@@ -29,6 +29,7 @@
 #include "virlog.h"
 #include "virnetserverclient.h"
 #include "virerror.h"
+#include "libvirt_internal.h"
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
 
@@ -49,6 +50,16 @@ struct daemonClientStream {
 
     int filterID;
 
+    bool allowSkip;
+
+    /* Max amount of data sent to the client in one packet */
+    size_t bufferLen;
+    /* Scratch buffer stream data is read into */
+    char *buffer;
+    /* Buffer of the last fully sent data packet, kept around
+     * to be reused for the next one */
+    char *msgBuffer;
+
     virNetMessagePtr rx;
     bool tx;
 
@@ -72,6 +83,10 @@ daemonStreamHandleAbort(virNetServerClientPtr client,
 
 
 
+/* Size of a message buffer able to hold a full data packet */
+#define DAEMON_STREAM_MSG_BUFFER_LEN(stream) \
+    (VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX + (stream)->bufferLen)
+
 static void
 daemonStreamUpdateEvents(daemonClientStream *stream)
 {
@@ -88,7 +103,8 @@ daemonStreamUpdateEvents(daemonClientStream *stream)
 
 /*
  * Invoked when an outgoing data packet message has been fully sent.
- * This simply re-enables TX of further data.
+ * This re-enables TX of further data and keeps the message buffer
+ * around for the next data packet.
  *
  * The idea is to stop the daemon growing without bound due to
  * fast stream, but slow client
@@ -101,6 +117,16 @@ daemonStreamMessageFinished(virNetMessagePtr msg,
     VIR_DEBUG("stream=%p proc=%d serial=%u",
               stream, msg->header.proc, msg->header.serial);
 
+    /* Keep the buffer for the next data packet */
+    if (!stream->msgBuffer && msg->buffer &&
+        msg->bufferCapacity >= DAEMON_STREAM_MSG_BUFFER_LEN(stream)) {
+        stream->msgBuffer = msg->buffer;
+        msg->buffer = NULL;
+        msg->bufferLength = 0;
+        msg->bufferOffset = 0;
+        msg->bufferCapacity = 0;
+    }
+
     stream->tx = true;
     daemonStreamUpdateEvents(stream);
 
@@ -285,7 +311,8 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 
     virMutexLock(&stream->priv->lock);
 
-    if (msg->header.type != VIR_NET_STREAM)
+    if (msg->header.type != VIR_NET_STREAM &&
+        msg->header.type != VIR_NET_STREAM_HOLE)
         goto cleanup;
 
     if (!virNetServerProgramMatches(stream->prog, msg))
@@ -312,6 +339,7 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 /*
  * @conn: a connection object to associate the stream with
  * @header: the method call to associate with the stream
+ * @allowSkip: whether to transfer holes via VIR_NET_STREAM_HOLE
  *
  * Creates a new stream for this conn
  *
@@ -321,13 +349,14 @@ daemonClientStream *
 daemonCreateClientStream(virNetServerClientPtr client,
                          virStreamPtr st,
                          virNetServerProgramPtr prog,
-                         virNetMessageHeaderPtr header)
+                         virNetMessageHeaderPtr header,
+                         bool allowSkip)
 {
     daemonClientStream *stream;
     daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
 
-    VIR_DEBUG("client=%p, proc=%d, serial=%u, st=%p",
-              client, header->proc, header->serial, st);
+    VIR_DEBUG("client=%p, proc=%d, serial=%u, st=%p, allowSkip=%d",
+              client, header->proc, header->serial, st, allowSkip);
 
     if (VIR_ALLOC(stream) < 0)
         return NULL;
@@ -339,6 +368,16 @@ daemonCreateClientStream(virNetServerClientPtr client,
     stream->serial = header->serial;
     stream->filterID = -1;
     stream->st = st;
+    stream->allowSkip = allowSkip;
+
+    /* Use large data packets only with clients that told us
+     * they can cope with them */
+    virMutexLock(&priv->lock);
+    if (priv->streamLargePayload)
+        stream->bufferLen = VIR_NET_MESSAGE_STREAM_PAYLOAD_MAX;
+    else
+        stream->bufferLen = VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+    virMutexUnlock(&priv->lock);
 
     return stream;
 }
@@ -386,6 +425,8 @@ int daemonFreeClientStream(virNetServerClientPtr client,
     }
 
     virObjectUnref(stream->st);
+    VIR_FREE(stream->buffer);
+    VIR_FREE(stream->msgBuffer);
     VIR_FREE(stream);
 
     return ret;
@@ -557,6 +598,69 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 }
 
 
+/*
+ * Process a hole packet from the client, creating the hole in
+ * the stream.
+ *
+ * Returns:
+ *   -1  if fatal error occurred
+ *    0  if message was fully processed
+ *    1  if message is still being processed
+ */
+static int
+daemonStreamHandleHole(virNetServerClientPtr client,
+                       daemonClientStream *stream,
+                       virNetMessagePtr msg)
+{
+    size_t bufferOffset = msg->bufferOffset;
+    virNetStreamHole data;
+    virNetMessageError rerr;
+    int ret;
+
+    VIR_DEBUG("client=%p, stream=%p, proc=%d, serial=%u",
+              client, stream, msg->header.proc, msg->header.serial);
+
+    memset(&data, 0, sizeof(data));
+
+    if (!stream->allowSkip) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unexpected stream hole"));
+        goto error;
+    }
+
+    if (virNetMessageDecodePayload(msg,
+                                   (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto error;
+
+    ret = virStreamSendHole(stream->st, data.length, data.flags);
+    if (ret == -2) {
+        /* Blocking, so rewind and retry decoding later */
+        msg->bufferOffset = bufferOffset;
+        return 1;
+    }
+
+    if (ret < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    memset(&rerr, 0, sizeof(rerr));
+
+    VIR_INFO("Stream hole failed");
+    stream->closed = true;
+    virStreamEventRemoveCallback(stream->st);
+    virStreamAbort(stream->st);
+
+    return virNetServerProgramSendReplyError(stream->prog,
+                                             client,
+                                             msg,
+                                             &rerr,
+                                             &msg->header);
+}
+
+
 /*
  * Process a finish handshake from the client.
  *
@@ -672,7 +776,10 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
             break;
 
         case VIR_NET_CONTINUE:
-            ret = daemonStreamHandleWriteData(client, stream, msg);
+            if (msg->header.type == VIR_NET_STREAM_HOLE)
+                ret = daemonStreamHandleHole(client, stream, msg);
+            else
+                ret = daemonStreamHandleWriteData(client, stream, msg);
             break;
 
         case VIR_NET_ERROR:
@@ -712,12 +819,44 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
 }
 
 
+/*
+ * @stream: the stream to send a data packet for
+ *
+ * Creates a new message for a data packet of @stream, reusing
+ * the buffer of the previously sent one if there is any.
+ *
+ * Returns the new message, or NULL upon OOM
+ */
+static virNetMessagePtr
+daemonStreamMessageNew(daemonClientStream *stream)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(false)))
+        return NULL;
+
+    if (stream->msgBuffer) {
+        msg->buffer = stream->msgBuffer;
+        stream->msgBuffer = NULL;
+    } else if (VIR_ALLOC_N(msg->buffer,
+                           DAEMON_STREAM_MSG_BUFFER_LEN(stream)) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+    msg->bufferLength = DAEMON_STREAM_MSG_BUFFER_LEN(stream);
+    msg->bufferCapacity = msg->bufferLength;
+
+    return msg;
+}
+
 
 /*
  * Invoked when a stream is signalled as having data
  * available to read. This reads up to one message
  * worth of data, and then queues that for transmission
- * to the client.
+ * to the client. If the stream allows skipping and it
+ * is positioned at a hole, the size of the hole is
+ * sent instead.
  *
  * Returns 0 if data was queued for TX, or an error RPC
  * was sent, or -1 on fatal error, indicating client should
@@ -729,8 +868,7 @@ daemonStreamHandleRead(virNetServerClientPtr client,
 {
     virNetMessagePtr msg = NULL;
     virNetMessageError rerr;
-    char *buffer;
-    size_t bufferLen = VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+    size_t bufferLen = stream->bufferLen;
     int ret = -1;
     int rv;
 
@@ -751,13 +889,53 @@ daemonStreamHandleRead(virNetServerClientPtr client,
 
     memset(&rerr, 0, sizeof(rerr));
 
-    if (VIR_ALLOC_N(buffer, bufferLen) < 0)
+    if (!stream->buffer &&
+        VIR_ALLOC_N(stream->buffer, stream->bufferLen) < 0)
         return -1;
 
-    if (!(msg = virNetMessageNew(false)))
-        goto cleanup;
+    if (!(msg = daemonStreamMessageNew(stream)))
+        return -1;
+
+ retry:
+    if (stream->allowSkip) {
+        int inData = 0;
+        long long length = 0;
+
+        if (virStreamInData(stream->st, &inData, &length) < 0) {
+            rv = -1;
+        } else if (!inData && length) {
+            /* The stream is a read stream here, so this merely
+             * skips the hole locally */
+            if ((rv = virStreamSendHole(stream->st, length, 0)) == 0) {
+                stream->tx = false;
+                msg->cb = daemonStreamMessageFinished;
+                msg->opaque = stream;
+                stream->refs++;
+                if (virNetServerProgramSendStreamHole(remoteProgram,
+                                                      client,
+                                                      msg,
+                                                      stream->procedure,
+                                                      stream->serial,
+                                                      length,
+                                                      0) < 0)
+                    goto cleanup;
+                msg = NULL;
+                ret = 0;
+                goto cleanup;
+            }
+        } else {
+            if (inData && length && length < bufferLen)
+                bufferLen = length;
+
+            rv = virStreamRecvFlags(stream->st, stream->buffer, bufferLen,
+                                    VIR_STREAM_RECV_STOP_AT_HOLE);
+            if (rv == -3)
+                goto retry;
+        }
+    } else {
+        rv = virStreamRecv(stream->st, stream->buffer, bufferLen);
+    }
 
-    rv = virStreamRecv(stream->st, buffer, bufferLen);
     if (rv == -2) {
         /* Should never get this, since we're only called when we know
          * we're readable, but hey things change... */
@@ -783,14 +961,13 @@ daemonStreamHandleRead(virNetServerClientPtr client,
                                               msg,
                                               stream->procedure,
                                               stream->serial,
-                                              buffer, rv) < 0)
+                                              stream->buffer, rv) < 0)
             goto cleanup;
         msg = NULL;
     }
 
     ret = 0;
  cleanup:
-    VIR_FREE(buffer);
     virNetMessageFree(msg);
     return ret;
 }
@@ -189,6 +189,16 @@ virAdmServerPtr virAdmConnectLookupServer(virAdmConnectPtr conn,
 
 # define VIR_THREADPOOL_JOB_QUEUE_DEPTH "jobQueueDepth"
 
+/**
+ * VIR_THREADPOOL_IO_THREADS:
+ * Macro for the server ioThreads attribute: represents the number of event
+ * loop threads new client connections are spread over for socket I/O, as
+ * VIR_TYPED_PARAM_UINT. Zero means client I/O is handled by the main event
+ * loop. Changing it does not affect clients already connected.
+ */
+
+# define VIR_THREADPOOL_IO_THREADS "ioThreads"
+
 /* Tunables for a server workerpool */
 int virAdmServerGetThreadPoolParameters(virAdmServerPtr srv,
                                         virTypedParameterPtr *params,
@@ -404,6 +414,49 @@ int virAdmServerSetClientLimits(virAdmServerPtr srv,
                                 int nparams,
                                 unsigned int flags);
 
+/* Per-server message pool statistics */
+
+/**
+ * VIR_SERVER_MSGPOOL_HITS:
+ * Macro for per-server msgpool_hits attribute: represents the number of
+ * RPC messages which were recycled from the server's message pool instead
+ * of being allocated, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MSGPOOL_HITS "msgpool_hits"
+
+/**
+ * VIR_SERVER_MSGPOOL_MISSES:
+ * Macro for per-server msgpool_misses attribute: represents the number of
+ * RPC messages which had to be allocated because the server's message pool
+ * was empty, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MSGPOOL_MISSES "msgpool_misses"
+
+/**
+ * VIR_SERVER_MSGPOOL_DISCARDS:
+ * Macro for per-server msgpool_discards attribute: represents the number
+ * of released RPC messages which were freed rather than kept in the
+ * server's message pool, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MSGPOOL_DISCARDS "msgpool_discards"
+
+/**
+ * VIR_SERVER_MSGPOOL_FREE:
+ * Macro for per-server msgpool_free attribute: represents the number of
+ * RPC messages currently kept in the server's message pool, as
+ * VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_MSGPOOL_FREE "msgpool_free"
+
+int virAdmServerGetMessagePoolStats(virAdmServerPtr srv,
+                                    virTypedParameterPtr *params,
+                                    int *nparams,
+                                    unsigned int flags);
+
 int virAdmConnectGetLoggingOutputs(virAdmConnectPtr conn,
                                    char **outputs,
                                    unsigned int flags);
@@ -2034,6 +2034,7 @@ typedef enum {
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_SHUTOFF = VIR_CONNECT_LIST_DOMAINS_SHUTOFF,
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_OTHER = VIR_CONNECT_LIST_DOMAINS_OTHER,
 
+    VIR_CONNECT_GET_ALL_DOMAINS_STATS_PARALLEL = 1 << 29, /* collect stats of domains in parallel */
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING = 1 << 30, /* include backing chain for block stats */
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS = 1U << 31, /* enforce requested stats */
 } virConnectGetAllDomainStatsFlags;
@@ -2050,6 +2051,89 @@ int virDomainListGetStats(virDomainPtr *doms,
 
 void virDomainStatsRecordListFree(virDomainStatsRecordPtr *stats);
 
+/**
+ * virDomainStatsColumn:
+ *
+ * All values of a single statistic, e.g. "block.0.rd.bytes", reported
+ * by the domains of a virDomainStatsColumns structure. Both @present and
+ * the array selected from @values by @type have one entry per domain.
+ */
+typedef struct _virDomainStatsColumn virDomainStatsColumn;
+typedef virDomainStatsColumn *virDomainStatsColumnPtr;
+struct _virDomainStatsColumn {
+    char *field;                /* name of the statistic */
+    int type;                   /* virTypedParameterType of its values */
+    unsigned char *present;     /* non-zero if the domain reports it */
+    union {
+        long long int *l;       /* type is INT or LLONG */
+        unsigned long long int *ul; /* type is UINT, ULLONG or BOOLEAN */
+        double *d;              /* type is DOUBLE */
+        char **s;               /* type is STRING, NULL if not present */
+    } values;
+};
+
+/**
+ * virDomainStatsColumns:
+ *
+ * The statistics of several domains arranged by statistic rather than
+ * by domain. The columns are ordered the same way the fields of the
+ * corresponding virDomainStatsRecord structures are.
+ */
+typedef struct _virDomainStatsColumns virDomainStatsColumns;
+typedef virDomainStatsColumns *virDomainStatsColumnsPtr;
+struct _virDomainStatsColumns {
+    virDomainPtr *doms;
+    int ndoms;
+    virDomainStatsColumnPtr columns;
+    int ncolumns;
+};
+
+int virConnectGetAllDomainStatsColumns(virConnectPtr conn,
+                                       unsigned int stats,
+                                       virDomainStatsColumnsPtr *retColumns,
+                                       unsigned int flags);
+
+int virDomainListGetStatsColumns(virDomainPtr *doms,
+                                 unsigned int stats,
+                                 virDomainStatsColumnsPtr *retColumns,
+                                 unsigned int flags);
+
+void virDomainStatsColumnsFree(virDomainStatsColumnsPtr columns);
+
+typedef enum {
+    VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA = (1 << 0), /* report only the
+                                                        parameters that
+                                                        changed since the
+                                                        previous sample */
+} virConnectDomainStatsEventRegisterFlags;
+
+/**
+ * virConnectDomainStatsEventCallback:
+ * @conn: connection object
+ * @stats: array of statistics records, one per domain
+ * @nstats: number of records in @stats
+ * @opaque: application specified data
+ *
+ * The callback signature to use when registering for periodic domain
+ * statistics with virConnectDomainStatsEventRegister(). The records are
+ * owned by libvirt and must not be freed or kept after the callback
+ * returns.
+ */
+typedef void (*virConnectDomainStatsEventCallback)(virConnectPtr conn,
+                                                   virDomainStatsRecordPtr *stats,
+                                                   int nstats,
+                                                   void *opaque);
+
+int virConnectDomainStatsEventRegister(virConnectPtr conn,
+                                       unsigned int stats,
+                                       virConnectDomainStatsEventCallback cb,
+                                       void *opaque,
+                                       virFreeCallback freecb,
+                                       unsigned int flags);
+
+int virConnectDomainStatsEventDeregister(virConnectPtr conn,
+                                         int callbackID);
+
 /*
  * Perf Event API
  */
@@ -3290,6 +3374,62 @@ int virDomainAbortJob(virDomainPtr dom);
  */
 # define VIR_DOMAIN_JOB_AUTO_CONVERGE_THROTTLE  "auto_converge_throttle"
 
+/**
+ * VIR_DOMAIN_JOB_IMAGE_COMPRESS_THREADS:
+ *
+ * virDomainGetJobStats field: number of threads compressing the image
+ * written by a save, snapshot or dump job when it is compressed in
+ * parallel, as VIR_TYPED_PARAM_UINT. The other VIR_DOMAIN_JOB_IMAGE_*
+ * fields are only present together with this one.
+ */
+# define VIR_DOMAIN_JOB_IMAGE_COMPRESS_THREADS  "image_compress_threads"
+
+/**
+ * VIR_DOMAIN_JOB_IMAGE_READ_BYTES:
+ *
+ * virDomainGetJobStats field: number of uncompressed bytes received
+ * from the hypervisor, as VIR_TYPED_PARAM_ULLONG.
+ */
+# define VIR_DOMAIN_JOB_IMAGE_READ_BYTES        "image_read_bytes"
+
+/**
+ * VIR_DOMAIN_JOB_IMAGE_READ_BPS:
+ *
+ * virDomainGetJobStats field: rate at which the hypervisor produced
+ * the data while it was waited for, in bytes per second, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+# define VIR_DOMAIN_JOB_IMAGE_READ_BPS          "image_read_bps"
+
+/**
+ * VIR_DOMAIN_JOB_IMAGE_COMPRESS_BPS:
+ *
+ * virDomainGetJobStats field: rate at which the compression threads
+ * together compress the data while they are busy, in uncompressed
+ * bytes per second, as VIR_TYPED_PARAM_ULLONG.
+ */
+# define VIR_DOMAIN_JOB_IMAGE_COMPRESS_BPS      "image_compress_bps"
+
+/**
+ * VIR_DOMAIN_JOB_IMAGE_WRITE_BYTES:
+ *
+ * virDomainGetJobStats field: number of compressed bytes written to the
+ * image, as VIR_TYPED_PARAM_ULLONG.
+ */
+# define VIR_DOMAIN_JOB_IMAGE_WRITE_BYTES       "image_write_bytes"
+
+/**
+ * VIR_DOMAIN_JOB_IMAGE_WRITE_BPS:
+ *
+ * virDomainGetJobStats field: rate at which the compressed data is
+ * written to the image, in bytes per second, as VIR_TYPED_PARAM_ULLONG.
+ *
+ * Comparing VIR_DOMAIN_JOB_IMAGE_READ_BPS,
+ * VIR_DOMAIN_JOB_IMAGE_COMPRESS_BPS and this field shows which stage
+ * limits the speed of the job.
+ */
+# define VIR_DOMAIN_JOB_IMAGE_WRITE_BPS         "image_write_bps"
+
 
 /**
  * virConnectDomainEventGenericCallback:
@@ -55,6 +55,7 @@
 #include "virtpm.h"
 #include "virstring.h"
 #include "virnetdev.h"
+#include "virhashcode.h"
 #include "virhostdev.h"
 #include "virresctrl.h"
 
@@ -2831,6 +2832,7 @@ static void virDomainObjDispose(void *obj)
         (dom->privateDataFreeFunc)(dom->privateData);
 
     virDomainSnapshotObjListFree(dom->snapshots);
+    VIR_FREE(dom->statusXML);
 }
 
 virDomainObjPtr
@@ -2859,6 +2861,8 @@ virDomainObjNew(virDomainXMLOptionPtr xmlopt)
     if (!(domain->snapshots = virDomainSnapshotObjListNew()))
         goto error;
 
+    domain->indexedID = -1;
+
     virObjectLock(domain);
     virDomainObjSetState(domain, VIR_DOMAIN_SHUTOFF,
                                  VIR_DOMAIN_SHUTOFF_UNKNOWN);
@@ -24944,6 +24948,375 @@ virDomainSaveConfig(const char *configDir,
     return ret;
 }
 
+/*
+ * Status journal
+ *
+ * Rewriting the whole status XML on every state change of a running
+ * domain is expensive for domains with many devices. If the driver
+ * enables VIR_DOMAIN_DEF_FEATURE_STATUS_JOURNAL, only the first status
+ * save writes the full document. Subsequent saves append a record
+ * describing the changed byte range to "<name>.journal" next to the
+ * status file. The journal is folded back into the status file
+ * (compacted) once it grows too large, on a failed append and via
+ * virDomainCompactStatus().
+ *
+ * The journal starts with a header identifying the status document it
+ * applies to:
+ *
+ *   libvirt-status-journal 1 <length> <hash>\n
+ *
+ * followed by records replacing @dellen bytes at @offset with the
+ * @inslen bytes following the record line:
+ *
+ *   @<offset> <dellen> <inslen> <length> <hash>\n<data>\n
+ *
+ * where <length> and <hash> describe the document after the record is
+ * applied. Replay stops at the first record that is truncated or does
+ * not produce the expected document, so a record torn by a crash is
+ * simply dropped. Records are not synced to disk: status files live
+ * in a runtime directory and only need to survive a daemon restart.
+ */
+#define VIR_DOMAIN_STATUS_JOURNAL_MAGIC "libvirt-status-journal 1"
+#define VIR_DOMAIN_STATUS_JOURNAL_MAX_RECORDS 128
+#define VIR_DOMAIN_STATUS_MAX_SIZE (64 * 1024 * 1024)
+
+char *
+virDomainStatusJournalFile(const char *dir,
+                           const char *name)
+{
+    char *ret;
+
+    ignore_value(virAsprintf(&ret, "%s/%s.journal", dir, name));
+    return ret;
+}
+
+
+static uint32_t
+virDomainStatusJournalHash(const char *xml,
+                           size_t len)
+{
+    return virHashCodeGen(xml, len, 0);
+}
+
+
+static void
+virDomainStatusJournalReset(const char *statusDir,
+                            virDomainObjPtr obj)
+{
+    char *journalFile;
+
+    if (obj->statusJournalSize &&
+        (journalFile = virDomainStatusJournalFile(statusDir, obj->def->name))) {
+        if (unlink(journalFile) < 0 && errno != ENOENT)
+            VIR_WARN("Failed to remove status journal '%s'", journalFile);
+        VIR_FREE(journalFile);
+    }
+
+    obj->statusJournalRecords = 0;
+    obj->statusJournalSize = 0;
+}
+
+
+/*
+ * Writes @xml as the complete status document and drops the journal,
+ * which no longer applies to it. On success @xml is remembered as the
+ * base for further journal records if @journal is true, otherwise it
+ * is left to the caller.
+ */
+static int
+virDomainStatusWrite(const char *statusDir,
+                     virDomainObjPtr obj,
+                     char **xml,
+                     bool journal)
+{
+    if (virDomainSaveXML(statusDir, obj->def, *xml) < 0)
+        return -1;
+
+    virDomainStatusJournalReset(statusDir, obj);
+
+    VIR_FREE(obj->statusXML);
+    if (journal)
+        VIR_STEAL_PTR(obj->statusXML, *xml);
+
+    return 0;
+}
+
+
+/*
+ * Appends the difference between the last saved status document and
+ * @xml to the journal. Returns 1 if there was nothing to record, 0 on
+ * success and -1 if the journal could not be written.
+ */
+static int
+virDomainStatusJournalAppend(const char *statusDir,
+                             virDomainObjPtr obj,
+                             const char *xml)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const char *old = obj->statusXML;
+    size_t oldlen = strlen(old);
+    size_t newlen = strlen(xml);
+    size_t prefix = 0;
+    size_t suffix = 0;
+    char *journalFile = NULL;
+    char *record = NULL;
+    size_t len;
+    int fd = -1;
+    int ret = -1;
+
+    while (prefix < oldlen && prefix < newlen && old[prefix] == xml[prefix])
+        prefix++;
+
+    if (prefix == oldlen && prefix == newlen)
+        return 1;
+
+    while (suffix < oldlen - prefix && suffix < newlen - prefix &&
+           old[oldlen - suffix - 1] == xml[newlen - suffix - 1])
+        suffix++;
+
+    if (obj->statusJournalSize == 0)
+        virBufferAsprintf(&buf, VIR_DOMAIN_STATUS_JOURNAL_MAGIC " %zu %u\n",
+                          oldlen, virDomainStatusJournalHash(old, oldlen));
+
+    virBufferAsprintf(&buf, "@%zu %zu %zu %zu %u\n",
+                      prefix, oldlen - prefix - suffix,
+                      newlen - prefix - suffix,
+                      newlen, virDomainStatusJournalHash(xml, newlen));
+    virBufferAdd(&buf, xml + prefix, newlen - prefix - suffix);
+    virBufferAddChar(&buf, '\n');
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    len = virBufferUse(&buf);
+    record = virBufferContentAndReset(&buf);
+
+    if (!(journalFile = virDomainStatusJournalFile(statusDir, obj->def->name)))
+        goto cleanup;
+
+    if ((fd = open(journalFile,
+                   O_WRONLY | O_CREAT | O_CLOEXEC |
+                   (obj->statusJournalSize ? O_APPEND : O_TRUNC),
+                   S_IRUSR | S_IWUSR)) < 0) {
+        virReportSystemError(errno,
+                             _("cannot open status journal '%s'"),
+                             journalFile);
+        goto cleanup;
+    }
+
+    if (safewrite(fd, record, len) != len) {
+        virReportSystemError(errno,
+                             _("cannot write status journal '%s'"),
+                             journalFile);
+        goto cleanup;
+    }
+
+    if (VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno,
+                             _("cannot save status journal '%s'"),
+                             journalFile);
+        goto cleanup;
+    }
+
+    obj->statusJournalRecords++;
+    obj->statusJournalSize += len;
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(journalFile);
+    VIR_FREE(record);
+    return ret;
+}
+
+
+/*
+ * Applies the journal @journal to the status document @xml of length
+ * *@len in place. Returns the number of records applied, or -1 on
+ * error. @complete is set if every record of the journal was applied.
+ */
+static int
+virDomainStatusJournalReplay(const char *journalFile,
+                             char **xml,
+                             size_t *len,
+                             const char *journal,
+                             bool *complete)
+{
+    const char *cur = journal;
+    unsigned long long baselen;
+    unsigned int basehash;
+    int nrecords = 0;
+    char *end;
+
+    *complete = false;
+
+    if (!STRPREFIX(cur, VIR_DOMAIN_STATUS_JOURNAL_MAGIC " "))
+        goto mismatch;
+    cur += strlen(VIR_DOMAIN_STATUS_JOURNAL_MAGIC " ");
+
+    if (virStrToLong_ullp(cur, &end, 10, &baselen) < 0 || *end != ' ' ||
+        virStrToLong_uip(end + 1, &end, 10, &basehash) < 0 || *end != '\n')
+        goto mismatch;
+    cur = end + 1;
+
+    if (baselen != *len ||
+        basehash != virDomainStatusJournalHash(*xml, *len))
+        goto mismatch;
+
+    while (*cur == '@') {
+        unsigned long long offset;
+        unsigned long long dellen;
+        unsigned long long inslen;
+        unsigned long long newlen;
+        unsigned int newhash;
+        const char *data;
+        char *newxml = NULL;
+
+        if (virStrToLong_ullp(cur + 1, &end, 10, &offset) < 0 || *end != ' ' ||
+            virStrToLong_ullp(end + 1, &end, 10, &dellen) < 0 || *end != ' ' ||
+            virStrToLong_ullp(end + 1, &end, 10, &inslen) < 0 || *end != ' ' ||
+            virStrToLong_ullp(end + 1, &end, 10, &newlen) < 0 || *end != ' ' ||
+            virStrToLong_uip(end + 1, &end, 10, &newhash) < 0 || *end != '\n')
+            break;
+        data = end + 1;
+
+        if (offset > *len || dellen > *len - offset ||
+            newlen != *len - dellen + inslen ||
+            strnlen(data, inslen + 1) < inslen + 1 || data[inslen] != '\n')
+            break;
+
+        if (VIR_ALLOC_N(newxml, newlen + 1) < 0)
+            return -1;
+
+        memcpy(newxml, *xml, offset);
+        memcpy(newxml + offset, data, inslen);
+        memcpy(newxml + offset + inslen, *xml + offset + dellen,
+               *len - offset - dellen);
+
+        if (virDomainStatusJournalHash(newxml, newlen) != newhash) {
+            VIR_FREE(newxml);
+            break;
+        }
+
+        VIR_FREE(*xml);
+        *xml = newxml;
+        *len = newlen;
+        cur = data + inslen + 1;
+        nrecords++;
+    }
+
+    if (*cur)
+        VIR_WARN("Ignoring incomplete record %d in status journal '%s'",
+                 nrecords + 1, journalFile);
+    else
+        *complete = true;
+
+    return nrecords;
+
+ mismatch:
+    VIR_WARN("Status journal '%s' does not match the status file, ignoring it",
+             journalFile);
+    return 0;
+}
+
+
+/**
+ * virDomainObjParseStatus:
+ * @statusDir: directory holding status files
+ * @name: name of the domain
+ * @caps: capabilities
+ * @xmlopt: XML parser configuration
+ * @flags: bitwise-OR of virDomainDefParseFlags
+ *
+ * Parses the status file of domain @name including any changes recorded
+ * in its status journal. The object remembers the replayed document so
+ * that further status saves can keep appending to the journal.
+ *
+ * Returns the domain object on success, NULL on error.
+ */
+virDomainObjPtr
+virDomainObjParseStatus(const char *statusDir,
+                        const char *name,
+                        virCapsPtr caps,
+                        virDomainXMLOptionPtr xmlopt,
+                        unsigned int flags)
+{
+    char *statusFile = NULL;
+    char *journalFile = NULL;
+    char *content = NULL;
+    char *journal = NULL;
+    char *xml = NULL;
+    const char *start;
+    xmlDocPtr doc = NULL;
+    virDomainObjPtr obj = NULL;
+    int keepBlanksDefault = xmlKeepBlanksDefault(0);
+    int journalSize = 0;
+    int nrecords = 0;
+    bool complete;
+    size_t len;
+
+    if (!(statusFile = virDomainConfigFile(statusDir, name)) ||
+        !(journalFile = virDomainStatusJournalFile(statusDir, name)))
+        goto cleanup;
+
+    if (!virFileExists(journalFile)) {
+        obj = virDomainObjParseFile(statusFile, caps, xmlopt, flags);
+        goto cleanup;
+    }
+
+    if (virFileReadAll(statusFile, VIR_DOMAIN_STATUS_MAX_SIZE, &content) < 0 ||
+        (journalSize = virFileReadAll(journalFile, VIR_DOMAIN_STATUS_MAX_SIZE,
+                                      &journal)) < 0)
+        goto cleanup;
+
+    /* The journal applies to the document only, not to the warning
+     * comment virXMLSaveFile() puts in front of it */
+    start = content;
+    if (STRPREFIX(start, "<!--") && (start = strstr(start, "-->\n\n")))
+        start += strlen("-->\n\n");
+    else
+        start = content;
+
+    if (VIR_STRDUP(xml, start) < 0)
+        goto cleanup;
+    len = strlen(xml);
+
+    if ((nrecords = virDomainStatusJournalReplay(journalFile, &xml,
+                                                 &len, journal,
+                                                 &complete)) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Replayed %d records from status journal '%s'",
+              nrecords, journalFile);
+
+    if (!(doc = virXMLParse(NULL, xml, statusFile)))
+        goto cleanup;
+
+    if (!(obj = virDomainObjParseNode(doc, xmlDocGetRootElement(doc),
+                                      caps, xmlopt, flags)))
+        goto cleanup;
+
+    /* Keep appending to a journal that replayed cleanly. Anything else
+     * is compacted, and the journal removed, on the next save. */
+    if (complete) {
+        VIR_STEAL_PTR(obj->statusXML, xml);
+        obj->statusJournalRecords = nrecords;
+    }
+    obj->statusJournalSize = journalSize;
+
+ cleanup:
+    xmlKeepBlanksDefault(keepBlanksDefault);
+    xmlFreeDoc(doc);
+    VIR_FREE(statusFile);
+    VIR_FREE(journalFile);
+    VIR_FREE(content);
+    VIR_FREE(journal);
+    VIR_FREE(xml);
+    return obj;
+}
+
+
 int
 virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
                     const char *statusDir,
@@ -24956,13 +25329,41 @@ virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
                           VIR_DOMAIN_DEF_FORMAT_PCI_ORIG_STATES |
                           VIR_DOMAIN_DEF_FORMAT_CLOCK_ADJUST);
 
+    bool journal = !!(xmlopt->config.features &
+                      VIR_DOMAIN_DEF_FEATURE_STATUS_JOURNAL);
     int ret = -1;
     char *xml;
 
+    if (obj->statusDeferred) {
+        obj->statusPending = true;
+        return 0;
+    }
+
     if (!(xml = virDomainObjFormat(xmlopt, obj, caps, flags)))
         goto cleanup;
 
-    if (virDomainSaveXML(statusDir, obj->def, xml))
+    if (journal && obj->statusXML &&
+        obj->statusJournalRecords < VIR_DOMAIN_STATUS_JOURNAL_MAX_RECORDS &&
+        obj->statusJournalSize < strlen(obj->statusXML)) {
+        int rc;
+
+        if ((rc = virDomainStatusJournalAppend(statusDir, obj, xml)) == 0) {
+            VIR_FREE(obj->statusXML);
+            VIR_STEAL_PTR(obj->statusXML, xml);
+        }
+
+        if (rc >= 0) {
+            ret = 0;
+            goto cleanup;
+        }
+
+        VIR_WARN("Failed to append to status journal of domain %s, "
+                 "rewriting status: %s",
+                 obj->def->name, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    if (virDomainStatusWrite(statusDir, obj, &xml, journal) < 0)
         goto cleanup;
 
     ret = 0;
@@ -24972,6 +25373,96 @@ virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
 }
 
 
+/**
+ * virDomainCompactStatus:
+ * @statusDir: directory holding status files
+ * @obj: domain object
+ *
+ * Folds the status journal of @obj into its status file, for instance
+ * when the daemon shuts down.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virDomainCompactStatus(const char *statusDir,
+                       virDomainObjPtr obj)
+{
+    char *xml = NULL;
+    int ret;
+
+    if (!obj->statusXML || obj->statusJournalSize == 0)
+        return 0;
+
+    if (VIR_STRDUP(xml, obj->statusXML) < 0)
+        return -1;
+
+    ret = virDomainStatusWrite(statusDir, obj, &xml, true);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+/**
+ * virDomainRemoveStatusJournal:
+ * @statusDir: directory holding status files
+ * @obj: domain object
+ *
+ * Removes the status journal of @obj along with the status document it
+ * remembers. To be called whenever the status file itself is removed.
+ */
+void
+virDomainRemoveStatusJournal(const char *statusDir,
+                             virDomainObjPtr obj)
+{
+    char *journalFile;
+
+    if ((journalFile = virDomainStatusJournalFile(statusDir, obj->def->name))) {
+        if (unlink(journalFile) < 0 && errno != ENOENT)
+            VIR_WARN("Failed to remove status journal '%s'", journalFile);
+        VIR_FREE(journalFile);
+    }
+
+    VIR_FREE(obj->statusXML);
+    obj->statusJournalRecords = 0;
+    obj->statusJournalSize = 0;
+}
+
+
+/**
+ * virDomainObjDeferStatus:
+ * @obj: domain object
+ *
+ * Postpones status saves of @obj until virDomainObjEndDeferStatus() is
+ * called, so that a series of changes made in one go costs a single
+ * save rather than formatting the whole status document each time.
+ */
+void
+virDomainObjDeferStatus(virDomainObjPtr obj)
+{
+    obj->statusDeferred = true;
+}
+
+
+/**
+ * virDomainObjEndDeferStatus:
+ * @obj: domain object
+ *
+ * Stops postponing status saves of @obj.
+ *
+ * Returns true if a save was postponed and the caller has to save the
+ * status now, false otherwise.
+ */
+bool
+virDomainObjEndDeferStatus(virDomainObjPtr obj)
+{
+    bool pending = obj->statusPending;
+
+    obj->statusDeferred = false;
+    obj->statusPending = false;
+    return pending;
+}
+
+
 int
 virDomainDeleteConfig(const char *configDir,
                       const char *autostartDir,
@@ -2401,6 +2401,7 @@ struct _virDomainObj {
     unsigned int persistent : 1;
     unsigned int updated : 1;
     unsigned int removing : 1;
+    int indexedID; /* ID the virDomainObjList indexes us by, -1 if none */
 
     virDomainDefPtr def; /* The current definition */
     virDomainDefPtr newDef; /* New definition to activate at shutdown */
@@ -2417,6 +2418,12 @@ struct _virDomainObj {
 
     unsigned long long original_memlock; /* Original RLIMIT_MEMLOCK, zero if no
                                           * restore will be required later */
+
+    char *statusXML; /* Last saved status document if journaled */
+    size_t statusJournalRecords; /* Records in the status journal */
+    size_t statusJournalSize; /* Size of the status journal in bytes */
+    bool statusDeferred; /* Status saves are postponed by the caller */
+    bool statusPending; /* A status save was postponed */
 };
 
 typedef bool (*virDomainObjListACLFilter)(virConnectPtr conn,
@@ -2429,6 +2436,7 @@ typedef enum {
     VIR_DOMAIN_DEF_FEATURE_OFFLINE_VCPUPIN = (1 << 2),
     VIR_DOMAIN_DEF_FEATURE_NAME_SLASH = (1 << 3),
     VIR_DOMAIN_DEF_FEATURE_INDIVIDUAL_VCPUS = (1 << 4),
+    VIR_DOMAIN_DEF_FEATURE_STATUS_JOURNAL = (1 << 5),
 } virDomainDefFeatures;
 
 
@@ -2789,6 +2797,11 @@ virDomainObjPtr virDomainObjParseFile(const char *filename,
                                       virCapsPtr caps,
                                       virDomainXMLOptionPtr xmlopt,
                                       unsigned int flags);
+virDomainObjPtr virDomainObjParseStatus(const char *statusDir,
+                                        const char *name,
+                                        virCapsPtr caps,
+                                        virDomainXMLOptionPtr xmlopt,
+                                        unsigned int flags);
 
 bool virDomainDefCheckABIStability(virDomainDefPtr src,
                                    virDomainDefPtr dst);
@@ -2981,6 +2994,12 @@ int virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
                         const char *statusDir,
                         virDomainObjPtr obj,
                         virCapsPtr caps) ATTRIBUTE_RETURN_CHECK;
+int virDomainCompactStatus(const char *statusDir,
+                           virDomainObjPtr obj);
+void virDomainRemoveStatusJournal(const char *statusDir,
+                                  virDomainObjPtr obj);
+void virDomainObjDeferStatus(virDomainObjPtr obj);
+bool virDomainObjEndDeferStatus(virDomainObjPtr obj);
 
 typedef void (*virDomainLoadConfigNotify)(virDomainObjPtr dom,
                                           int newDomain,
@@ -2992,6 +3011,8 @@ int virDomainDeleteConfig(const char *configDir,
 
 char *virDomainConfigFile(const char *dir,
                           const char *name);
+char *virDomainStatusJournalFile(const char *dir,
+                                 const char *name);
 
 int virDiskNameToBusDeviceIndex(virDomainDiskDefPtr disk,
                                 int *busIdx,
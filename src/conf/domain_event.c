@@ -60,6 +60,7 @@ static virClassPtr virDomainEventMigrationIterationClass;
 static virClassPtr virDomainEventJobCompletedClass;
 static virClassPtr virDomainEventDeviceRemovalFailedClass;
 static virClassPtr virDomainEventMetadataChangeClass;
+static virClassPtr virDomainStatsEventClass;
 
 static void virDomainEventDispose(void *obj);
 static void virDomainEventLifecycleDispose(void *obj);
@@ -81,6 +82,7 @@ static void virDomainEventMigrationIterationDispose(void *obj);
 static void virDomainEventJobCompletedDispose(void *obj);
 static void virDomainEventDeviceRemovalFailedDispose(void *obj);
 static void virDomainEventMetadataChangeDispose(void *obj);
+static void virDomainStatsEventDispose(void *obj);
 
 static void
 virDomainEventDispatchDefaultFunc(virConnectPtr conn,
@@ -94,6 +96,12 @@ virDomainQemuMonitorEventDispatchFunc(virConnectPtr conn,
                                       virConnectObjectEventGenericCallback cb,
                                       void *cbopaque);
 
+static void
+virDomainStatsEventDispatchFunc(virConnectPtr conn,
+                                virObjectEventPtr event,
+                                virConnectObjectEventGenericCallback cb,
+                                void *cbopaque);
+
 struct _virDomainEvent {
     virObjectEvent parent;
 
@@ -225,6 +233,16 @@ struct _virDomainQemuMonitorEvent {
 typedef struct _virDomainQemuMonitorEvent virDomainQemuMonitorEvent;
 typedef virDomainQemuMonitorEvent *virDomainQemuMonitorEventPtr;
 
+struct _virDomainStatsEvent {
+    virObjectEvent parent;
+
+    int callbackID; /* subscription the sample is meant for */
+    virDomainStatsEventRecordPtr records;
+    size_t nrecords;
+};
+typedef struct _virDomainStatsEvent virDomainStatsEvent;
+typedef virDomainStatsEvent *virDomainStatsEventPtr;
+
 struct _virDomainEventTunable {
     virDomainEvent parent;
 
@@ -366,6 +384,12 @@ virDomainEventsOnceInit(void)
                       sizeof(virDomainQemuMonitorEvent),
                       virDomainQemuMonitorEventDispose)))
         return -1;
+    if (!(virDomainStatsEventClass =
+          virClassNew(virClassForObjectEvent(),
+                      "virDomainStatsEvent",
+                      sizeof(virDomainStatsEvent),
+                      virDomainStatsEventDispose)))
+        return -1;
     if (!(virDomainEventTunableClass =
           virClassNew(virDomainEventClass,
                       "virDomainEventTunable",
@@ -557,6 +581,19 @@ virDomainQemuMonitorEventDispose(void *obj)
     VIR_FREE(event->details);
 }
 
+static void
+virDomainStatsEventDispose(void *obj)
+{
+    virDomainStatsEventPtr event = obj;
+    size_t i;
+
+    VIR_DEBUG("obj=%p", event);
+
+    for (i = 0; i < event->nrecords; i++)
+        virDomainStatsEventRecordClear(&event->records[i]);
+    VIR_FREE(event->records);
+}
+
 static void
 virDomainEventTunableDispose(void *obj)
 {
@@ -2331,3 +2368,206 @@ virDomainQemuMonitorEventStateRegisterID(virConnectPtr conn,
                                          data, freecb,
                                          false, callbackID, false);
 }
+
+
+void
+virDomainStatsEventRecordClear(virDomainStatsEventRecordPtr record)
+{
+    if (!record)
+        return;
+
+    VIR_FREE(record->name);
+    virTypedParamsFree(record->params, record->nparams);
+    record->params = NULL;
+    record->nparams = 0;
+}
+
+
+/**
+ * virDomainStatsEventNew:
+ * @callbackID: ID of the subscription the event is meant for, -1 for any
+ * @records: pointer to the array of per-domain statistics
+ * @nrecords: pointer to the number of items in @records
+ *
+ * Creates an event carrying one sample of domain statistics. On success
+ * the event takes over @records, and both @records and @nrecords are
+ * cleared.
+ */
+virObjectEventPtr
+virDomainStatsEventNew(int callbackID,
+                       virDomainStatsEventRecordPtr *records,
+                       size_t *nrecords)
+{
+    virDomainStatsEventPtr ev;
+
+    if (virDomainEventsInitialize() < 0)
+        return NULL;
+
+    /* The event is not about any single domain, so it has no key */
+    if (!(ev = virObjectEventNew(virDomainStatsEventClass,
+                                 virDomainStatsEventDispatchFunc,
+                                 0, -1, NULL, NULL, NULL)))
+        return NULL;
+
+    ev->callbackID = callbackID;
+    ev->records = *records;
+    ev->nrecords = *nrecords;
+    *records = NULL;
+    *nrecords = 0;
+
+    return (virObjectEventPtr)ev;
+}
+
+
+/* The server side filters samples by the subscription they were
+ * collected for, which is only known after the callback is registered. */
+struct virDomainStatsEventData {
+    int callbackID;
+    unsigned int stats;
+    unsigned int flags;
+    void *opaque;
+    virFreeCallback freecb;
+};
+typedef struct virDomainStatsEventData virDomainStatsEventData;
+
+
+static void
+virDomainStatsEventDispatchFunc(virConnectPtr conn,
+                                virObjectEventPtr event,
+                                virConnectObjectEventGenericCallback cb,
+                                void *cbopaque)
+{
+    virDomainStatsEventPtr statsEvent = (virDomainStatsEventPtr)event;
+    virDomainStatsEventData *data = cbopaque;
+    virDomainStatsRecordPtr *stats = NULL;
+    size_t nstats = 0;
+    size_t i;
+
+    /* NULL terminated, like the list virConnectGetAllDomainStats returns */
+    if (VIR_ALLOC_N(stats, statsEvent->nrecords + 1) < 0)
+        return;
+
+    for (i = 0; i < statsEvent->nrecords; i++) {
+        virDomainStatsEventRecordPtr record = &statsEvent->records[i];
+        virDomainStatsRecordPtr tmp;
+
+        if (VIR_ALLOC(tmp) < 0)
+            goto cleanup;
+
+        if (!(tmp->dom = virGetDomain(conn, record->name, record->uuid))) {
+            VIR_FREE(tmp);
+            goto cleanup;
+        }
+        tmp->dom->id = record->id;
+
+        /* borrowed from the event, the callback must not free them */
+        tmp->params = record->params;
+        tmp->nparams = record->nparams;
+        stats[nstats++] = tmp;
+    }
+
+    ((virConnectDomainStatsEventCallback)cb)(conn, stats, nstats,
+                                             data->opaque);
+
+ cleanup:
+    for (i = 0; i < nstats; i++) {
+        virObjectUnref(stats[i]->dom);
+        VIR_FREE(stats[i]);
+    }
+    VIR_FREE(stats);
+}
+
+
+/**
+ * virDomainStatsEventFilter:
+ * @conn: the connection pointer
+ * @event: the event about to be dispatched
+ * @opaque: the opaque data registered with the filter
+ *
+ * Callback for delivering a sample to the subscription it was collected
+ * for only.  Returns true if the event should be dispatched.
+ */
+static bool
+virDomainStatsEventFilter(virConnectPtr conn ATTRIBUTE_UNUSED,
+                          virObjectEventPtr event,
+                          void *opaque)
+{
+    virDomainStatsEventData *data = opaque;
+    virDomainStatsEventPtr statsEvent = (virDomainStatsEventPtr) event;
+
+    if (data->flags == -1 || statsEvent->callbackID < 0)
+        return true;
+    return statsEvent->callbackID == data->callbackID;
+}
+
+
+static void
+virDomainStatsEventCleanup(void *opaque)
+{
+    virDomainStatsEventData *data = opaque;
+
+    if (data->freecb)
+        (data->freecb)(data->opaque);
+    VIR_FREE(data);
+}
+
+
+/**
+ * virDomainStatsEventStateRegisterID:
+ * @conn: connection to associate with callback
+ * @state: object event state
+ * @stats: stats groups requested, binary-OR of virDomainStatsTypes
+ * @cb: function to invoke when a sample is available
+ * @opaque: data blob to pass to callback
+ * @freecb: callback to free @opaque
+ * @flags: -1 for client, valid virConnectDomainStatsEventRegisterFlags
+ *         for server
+ * @callbackID: filled with callback ID
+ *
+ * Register the function @cb with connection @conn, from @state, for
+ * samples of domain statistics.
+ *
+ * Returns: the number of callbacks now registered, or -1 on error
+ */
+int
+virDomainStatsEventStateRegisterID(virConnectPtr conn,
+                                   virObjectEventStatePtr state,
+                                   unsigned int stats,
+                                   virConnectDomainStatsEventCallback cb,
+                                   void *opaque,
+                                   virFreeCallback freecb,
+                                   unsigned int flags,
+                                   int *callbackID)
+{
+    virDomainStatsEventData *data = NULL;
+    int ret;
+
+    if (virDomainEventsInitialize() < 0)
+        return -1;
+
+    if (flags != -1)
+        virCheckFlags(VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA, -1);
+    if (VIR_ALLOC(data) < 0)
+        return -1;
+    data->callbackID = -1;
+    data->stats = stats;
+    data->flags = flags;
+    data->opaque = opaque;
+    data->freecb = freecb;
+
+    /* With a filter every registration gets a callback of its own, even
+     * if the same @cb is used several times */
+    ret = virObjectEventStateRegisterID(conn, state, NULL,
+                                        virDomainStatsEventFilter, data,
+                                        virDomainStatsEventClass, 0,
+                                        VIR_OBJECT_EVENT_CALLBACK(cb),
+                                        data, virDomainStatsEventCleanup,
+                                        false, callbackID, false);
+    if (ret < 0) {
+        VIR_FREE(data);
+        return -1;
+    }
+
+    data->callbackID = *callbackID;
+    return ret;
+}
@@ -312,4 +312,36 @@ virDomainQemuMonitorEventNew(int id,
                              const char *details)
     ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3) ATTRIBUTE_NONNULL(4);
 
+/* Statistics of a single domain, not tied to any connection */
+typedef struct _virDomainStatsEventRecord virDomainStatsEventRecord;
+typedef virDomainStatsEventRecord *virDomainStatsEventRecordPtr;
+struct _virDomainStatsEventRecord {
+    int id;
+    char *name;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    virTypedParameterPtr params;
+    int nparams;
+};
+
+void
+virDomainStatsEventRecordClear(virDomainStatsEventRecordPtr record);
+
+virObjectEventPtr
+virDomainStatsEventNew(int callbackID,
+                       virDomainStatsEventRecordPtr *records,
+                       size_t *nrecords)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
+int
+virDomainStatsEventStateRegisterID(virConnectPtr conn,
+                                   virObjectEventStatePtr state,
+                                   unsigned int stats,
+                                   virConnectDomainStatsEventCallback cb,
+                                   void *opaque,
+                                   virFreeCallback freecb,
+                                   unsigned int flags,
+                                   int *callbackID)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4)
+    ATTRIBUTE_NONNULL(8);
+
 #endif
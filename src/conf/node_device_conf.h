@@ -29,6 +29,7 @@
 # include "virbitmap.h"
 # include "virutil.h"
 # include "virpci.h"
+# include "virhash.h"
 # include "device_conf.h"
 
 # include <libxml/tree.h>
@@ -301,6 +302,11 @@ typedef virNodeDeviceObjList *virNodeDeviceObjListPtr;
 struct _virNodeDeviceObjList {
     size_t count;
     virNodeDeviceObjPtr *objs;
+
+    /* Indexes of @objs, created with the first device. A sysfs path
+     * shared by several devices refers to the first of them. */
+    virHashTablePtr objsName;
+    virHashMultiPtr objsSysfsPath;
 };
 
 char *
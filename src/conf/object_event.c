@@ -32,6 +32,8 @@
 #include "datatypes.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "virhash.h"
+#include "virhashcode.h"
 #include "virobject.h"
 #include "virstring.h"
 
@@ -58,10 +60,21 @@ struct _virObjectEventCallback {
 typedef struct _virObjectEventCallback virObjectEventCallback;
 typedef virObjectEventCallback *virObjectEventCallbackPtr;
 
+/* Callbacks registered for the same class, event ID and object key
+ * (or for all objects), in the order they were registered in */
+struct _virObjectEventCallbackBucket {
+    size_t count;
+    virObjectEventCallbackPtr *callbacks;
+};
+typedef struct _virObjectEventCallbackBucket virObjectEventCallbackBucket;
+typedef virObjectEventCallbackBucket *virObjectEventCallbackBucketPtr;
+
 struct _virObjectEventCallbackList {
     unsigned int nextID;
     size_t count;
     virObjectEventCallbackPtr *callbacks;
+    /* Buckets of @callbacks, keyed by virObjectEventCallbackIndexKey */
+    virHashTablePtr index;
 };
 
 struct _virObjectEventQueue {
@@ -154,6 +167,182 @@ virObjectEventCallbackFree(virObjectEventCallbackPtr cb)
     VIR_FREE(cb);
 }
 
+static void
+virObjectEventCallbackBucketFree(void *payload,
+                                 const void *name ATTRIBUTE_UNUSED)
+{
+    virObjectEventCallbackBucketPtr bucket = payload;
+
+    VIR_FREE(bucket->callbacks);
+    VIR_FREE(bucket);
+}
+
+
+/* Identifies the bucket holding the callbacks for @klass, @eventID and
+ * @key, which is NULL for callbacks on all objects */
+struct _virObjectEventCallbackIndexKey {
+    virClassPtr klass;
+    int eventID;
+    char *key;
+};
+typedef struct _virObjectEventCallbackIndexKey virObjectEventCallbackIndexKey;
+typedef virObjectEventCallbackIndexKey *virObjectEventCallbackIndexKeyPtr;
+
+
+static uint32_t
+virObjectEventCallbackIndexCode(const void *name,
+                                uint32_t seed)
+{
+    const virObjectEventCallbackIndexKey *ikey = name;
+    uint32_t code;
+
+    code = virHashCodeGen(&ikey->klass, sizeof(ikey->klass), seed);
+    code = virHashCodeGen(&ikey->eventID, sizeof(ikey->eventID), code);
+    if (ikey->key)
+        code = virHashCodeGen(ikey->key, strlen(ikey->key), code);
+
+    return code;
+}
+
+
+static bool
+virObjectEventCallbackIndexEqual(const void *namea,
+                                 const void *nameb)
+{
+    const virObjectEventCallbackIndexKey *a = namea;
+    const virObjectEventCallbackIndexKey *b = nameb;
+
+    return a->klass == b->klass &&
+           a->eventID == b->eventID &&
+           STREQ_NULLABLE(a->key, b->key);
+}
+
+
+static void *
+virObjectEventCallbackIndexCopy(const void *name)
+{
+    const virObjectEventCallbackIndexKey *ikey = name;
+    virObjectEventCallbackIndexKeyPtr copy;
+
+    if (VIR_ALLOC(copy) < 0)
+        return NULL;
+
+    copy->klass = ikey->klass;
+    copy->eventID = ikey->eventID;
+    if (VIR_STRDUP(copy->key, ikey->key) < 0) {
+        VIR_FREE(copy);
+        return NULL;
+    }
+
+    return copy;
+}
+
+
+static void
+virObjectEventCallbackIndexKeyFree(void *name)
+{
+    virObjectEventCallbackIndexKeyPtr ikey = name;
+
+    if (!ikey)
+        return;
+
+    VIR_FREE(ikey->key);
+    VIR_FREE(ikey);
+}
+
+
+static virObjectEventCallbackBucketPtr
+virObjectEventCallbackIndexLookup(virObjectEventCallbackListPtr cbList,
+                                  virClassPtr klass,
+                                  int eventID,
+                                  const char *key)
+{
+    virObjectEventCallbackIndexKey ikey = {
+        .klass = klass, .eventID = eventID, .key = (char *) key,
+    };
+
+    return virHashLookup(cbList->index, &ikey);
+}
+
+
+static int
+virObjectEventCallbackIndexAdd(virObjectEventCallbackListPtr cbList,
+                               virObjectEventCallbackPtr cb)
+{
+    virObjectEventCallbackIndexKey ikey = {
+        .klass = cb->klass, .eventID = cb->eventID,
+        .key = cb->key_filter ? cb->key : NULL,
+    };
+    virObjectEventCallbackBucketPtr bucket;
+
+    if (!(bucket = virHashLookup(cbList->index, &ikey))) {
+        if (VIR_ALLOC(bucket) < 0)
+            return -1;
+
+        if (virHashAddEntry(cbList->index, &ikey, bucket) < 0) {
+            VIR_FREE(bucket);
+            return -1;
+        }
+    }
+
+    if (VIR_APPEND_ELEMENT(bucket->callbacks, bucket->count, cb) < 0) {
+        if (bucket->count == 0)
+            virHashRemoveEntry(cbList->index, &ikey);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+virObjectEventCallbackIndexRemove(virObjectEventCallbackListPtr cbList,
+                                  virObjectEventCallbackPtr cb)
+{
+    virObjectEventCallbackIndexKey ikey = {
+        .klass = cb->klass, .eventID = cb->eventID,
+        .key = cb->key_filter ? cb->key : NULL,
+    };
+    virObjectEventCallbackBucketPtr bucket;
+    size_t i;
+
+    if (!(bucket = virHashLookup(cbList->index, &ikey)))
+        return;
+
+    for (i = 0; i < bucket->count; i++) {
+        if (bucket->callbacks[i] == cb) {
+            VIR_DELETE_ELEMENT(bucket->callbacks, i, bucket->count);
+            break;
+        }
+    }
+
+    if (bucket->count == 0)
+        virHashRemoveEntry(cbList->index, &ikey);
+}
+
+
+static virObjectEventCallbackListPtr
+virObjectEventCallbackListNew(void)
+{
+    virObjectEventCallbackListPtr list;
+
+    if (VIR_ALLOC(list) < 0)
+        return NULL;
+
+    if (!(list->index = virHashCreateFull(32,
+                                          virObjectEventCallbackBucketFree,
+                                          virObjectEventCallbackIndexCode,
+                                          virObjectEventCallbackIndexEqual,
+                                          virObjectEventCallbackIndexCopy,
+                                          virObjectEventCallbackIndexKeyFree))) {
+        VIR_FREE(list);
+        return NULL;
+    }
+
+    return list;
+}
+
+
 /**
  * virObjectEventCallbackListFree:
  * @list: event callback list head
@@ -174,6 +363,7 @@ virObjectEventCallbackListFree(virObjectEventCallbackListPtr list)
         VIR_FREE(list->callbacks[i]);
     }
     VIR_FREE(list->callbacks);
+    virHashFree(list->index);
     VIR_FREE(list);
 }
 
@@ -258,6 +448,7 @@ virObjectEventCallbackListRemoveID(virConnectPtr conn,
 
             if (cb->freecb)
                 (*cb->freecb)(cb->opaque);
+            virObjectEventCallbackIndexRemove(cbList, cb);
             virObjectEventCallbackFree(cb);
             VIR_DELETE_ELEMENT(cbList->callbacks, i, cbList->count);
             return ret;
@@ -307,6 +498,7 @@ virObjectEventCallbackListPurgeMarked(virObjectEventCallbackListPtr cbList)
             virFreeCallback freecb = cbList->callbacks[n]->freecb;
             if (freecb)
                 (*freecb)(cbList->callbacks[n]->opaque);
+            virObjectEventCallbackIndexRemove(cbList, cbList->callbacks[n]);
             virObjectEventCallbackFree(cbList->callbacks[n]);
 
             VIR_DELETE_ELEMENT(cbList->callbacks, n, cbList->count);
@@ -345,21 +537,22 @@ virObjectEventCallbackLookup(virConnectPtr conn,
                              bool legacy,
                              int *remoteID)
 {
+    virObjectEventCallbackBucketPtr bucket;
     size_t i;
 
     if (remoteID)
         *remoteID = -1;
 
-    for (i = 0; i < cbList->count; i++) {
-        virObjectEventCallbackPtr cb = cbList->callbacks[i];
+    if (!(bucket = virObjectEventCallbackIndexLookup(cbList, klass,
+                                                     eventID, key)))
+        return -1;
+
+    for (i = 0; i < bucket->count; i++) {
+        virObjectEventCallbackPtr cb = bucket->callbacks[i];
 
         if (cb->deleted)
             continue;
-        if (cb->klass == klass &&
-            cb->eventID == eventID &&
-            cb->conn == conn &&
-            ((key && cb->key_filter && STREQ(cb->key, key)) ||
-             (!key && !cb->key_filter))) {
+        if (cb->conn == conn) {
             if (remoteID)
                 *remoteID = cb->remoteID;
             if (cb->legacy == legacy &&
@@ -449,9 +642,14 @@ virObjectEventCallbackListAddID(virConnectPtr conn,
     cb->filter_opaque = filter_opaque;
     cb->legacy = legacy;
 
-    if (VIR_APPEND_ELEMENT(cbList->callbacks, cbList->count, cb) < 0)
+    if (virObjectEventCallbackIndexAdd(cbList, cb) < 0)
         goto cleanup;
 
+    if (VIR_APPEND_ELEMENT(cbList->callbacks, cbList->count, cb) < 0) {
+        virObjectEventCallbackIndexRemove(cbList, cb);
+        goto cleanup;
+    }
+
     /* When additional filtering is being done, every client callback
      * is matched to exactly one server callback.  */
     if (filter) {
@@ -572,7 +770,7 @@ virObjectEventStateNew(void)
     if (!(state = virObjectLockableNew(virObjectEventStateClass)))
         return NULL;
 
-    if (VIR_ALLOC(state->callbacks) < 0)
+    if (!(state->callbacks = virObjectEventCallbackListNew()))
         goto error;
 
     if (!(state->queue = virObjectEventQueueNew()))
@@ -688,19 +886,104 @@ virObjectEventDispatchMatchCallback(virObjectEventPtr event,
 }
 
 
+static int
+virObjectEventCallbackCompare(const void *a,
+                              const void *b)
+{
+    const virObjectEventCallback *cba = *(virObjectEventCallbackPtr *)a;
+    const virObjectEventCallback *cbb = *(virObjectEventCallbackPtr *)b;
+
+    return cba->callbackID - cbb->callbackID;
+}
+
+
+/**
+ * virObjectEventCallbackListCandidates:
+ * @callbacks: the list
+ * @event: the event to dispatch
+ * @candidates: filled with the callbacks possibly interested in @event
+ * @ncandidates: number of @candidates
+ *
+ * Collects the callbacks registered for the event ID of @event on
+ * the class of @event or any of its parent classes, both for all
+ * objects and for the object @event is about. The candidates are
+ * sorted in the order the callbacks were registered in.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virObjectEventCallbackListCandidates(virObjectEventCallbackListPtr callbacks,
+                                     virObjectEventPtr event,
+                                     virObjectEventCallbackPtr **candidates,
+                                     size_t *ncandidates)
+{
+    virClassPtr klass;
+    size_t alloc = 0;
+    size_t nbuckets = 0;
+    size_t i;
+
+    *candidates = NULL;
+    *ncandidates = 0;
+
+    for (klass = event->parent.klass; klass; klass = virClassParent(klass)) {
+        virObjectEventCallbackBucketPtr buckets[2];
+
+        buckets[0] = virObjectEventCallbackIndexLookup(callbacks, klass,
+                                                       event->eventID, NULL);
+        buckets[1] = NULL;
+        if (event->meta.key)
+            buckets[1] = virObjectEventCallbackIndexLookup(callbacks, klass,
+                                                           event->eventID,
+                                                           event->meta.key);
+
+        for (i = 0; i < ARRAY_CARDINALITY(buckets); i++) {
+            if (!buckets[i])
+                continue;
+
+            if (VIR_RESIZE_N(*candidates, alloc, *ncandidates,
+                             buckets[i]->count) < 0) {
+                VIR_FREE(*candidates);
+                *ncandidates = 0;
+                return -1;
+            }
+
+            memcpy(*candidates + *ncandidates, buckets[i]->callbacks,
+                   buckets[i]->count * sizeof(**candidates));
+            *ncandidates += buckets[i]->count;
+            nbuckets++;
+        }
+    }
+
+    if (nbuckets > 1)
+        qsort(*candidates, *ncandidates, sizeof(**candidates),
+              virObjectEventCallbackCompare);
+
+    return 0;
+}
+
+
 static void
 virObjectEventStateDispatchCallbacks(virObjectEventStatePtr state,
                                      virObjectEventPtr event,
                                      virObjectEventCallbackListPtr callbacks)
 {
+    virObjectEventCallbackPtr *candidates = NULL;
+    size_t ncandidates = 0;
     size_t i;
-    /* Cache this now, since we may be dropping the lock,
+
+    /* Collect the candidates now, since we may be dropping the lock,
        and have more callbacks added. We're guaranteed not
        to have any removed */
-    size_t cbCount = callbacks->count;
+    if (virObjectEventCallbackListCandidates(callbacks, event,
+                                             &candidates, &ncandidates) < 0) {
+        /* Fall back to checking every callback */
+        virResetLastError();
+        ncandidates = callbacks->count;
+    }
 
-    for (i = 0; i < cbCount; i++) {
-        virObjectEventCallbackPtr cb = callbacks->callbacks[i];
+    for (i = 0; i < ncandidates; i++) {
+        virObjectEventCallbackPtr cb = candidates ? candidates[i] :
+                                                    callbacks->callbacks[i];
 
         if (!virObjectEventDispatchMatchCallback(event, cb))
             continue;
@@ -710,6 +993,8 @@ virObjectEventStateDispatchCallbacks(virObjectEventStatePtr state,
         event->dispatch(cb->conn, event, cb->cb, cb->opaque);
         virObjectLock(state);
     }
+
+    VIR_FREE(candidates);
 }
 
 
@@ -44,6 +44,7 @@
 #include "virbuffer.h"
 #include "viralloc.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virscsihost.h"
 #include "virstring.h"
 #include "virlog.h"
@@ -1707,6 +1708,17 @@ virStorageVolDefFormat(virStoragePoolDefPtr pool,
         virBufferAsprintf(&buf, "<physical unit='bytes'>%llu</physical>\n",
                           def->target.physical);
 
+    if (def->wipeTotal) {
+        virBufferAddLit(&buf, "<wipe>\n");
+        virBufferAdjustIndent(&buf, 2);
+        virBufferAsprintf(&buf, "<total unit='bytes'>%llu</total>\n",
+                          def->wipeTotal);
+        virBufferAsprintf(&buf, "<done unit='bytes'>%llu</done>\n",
+                          def->wipeDone);
+        virBufferAdjustIndent(&buf, -2);
+        virBufferAddLit(&buf, "</wipe>\n");
+    }
+
     if (virStorageVolTargetDefFormat(options, &buf,
                                      &def->target, "target") < 0)
         goto cleanup;
@@ -1788,45 +1800,132 @@ virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 
     VIR_FREE(pool->volumes.objs);
     pool->volumes.count = 0;
+
+    virHashMultiFree(pool->volumes.objsName);
+    virHashMultiFree(pool->volumes.objsKey);
+    virHashMultiFree(pool->volumes.objsPath);
+    pool->volumes.objsName = NULL;
+    pool->volumes.objsKey = NULL;
+    pool->volumes.objsPath = NULL;
 }
 
-virStorageVolDefPtr
-virStorageVolDefFindByKey(virStoragePoolObjPtr pool,
-                          const char *key)
+
+static int
+virStorageVolDefListIndex(virHashMultiPtr table,
+                          const char *str,
+                          virStorageVolDefPtr vol)
+{
+    if (!str)
+        return 0;
+
+    return virHashMultiAddEntry(table, str, vol);
+}
+
+
+static void
+virStorageVolDefListUnindex(virHashMultiPtr table,
+                            const char *str,
+                            virStorageVolDefPtr vol)
+{
+    if (!str)
+        return;
+
+    virHashMultiRemoveEntry(table, str, vol);
+}
+
+
+/*
+ * virStoragePoolObjAddVol:
+ * @pool: the pool
+ * @vol: the volume
+ *
+ * Adds @vol to the volumes of @pool, which takes it over on success.
+ * The name, key and target path of @vol must not change while it is
+ * in the pool, they are indexed.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr list = &pool->volumes;
+
+    if (!list->objsName) {
+        if (!(list->objsName = virHashMultiNew(32)) ||
+            !(list->objsKey = virHashMultiNew(32)) ||
+            !(list->objsPath = virHashMultiNew(32))) {
+            virHashMultiFree(list->objsName);
+            virHashMultiFree(list->objsKey);
+            list->objsName = NULL;
+            list->objsKey = NULL;
+            return -1;
+        }
+    }
+
+    if (VIR_APPEND_ELEMENT_COPY(list->objs, list->count, vol) < 0)
+        return -1;
+
+    if (virStorageVolDefListIndex(list->objsName, vol->name, vol) < 0 ||
+        virStorageVolDefListIndex(list->objsKey, vol->key, vol) < 0 ||
+        virStorageVolDefListIndex(list->objsPath, vol->target.path, vol) < 0) {
+        virStoragePoolObjRemoveVol(pool, vol);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * virStoragePoolObjRemoveVol:
+ * @pool: the pool
+ * @vol: a volume of @pool
+ *
+ * Removes @vol from the volumes of @pool, the caller is responsible
+ * for freeing it.
+ */
+void
+virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                           virStorageVolDefPtr vol)
 {
+    virStorageVolDefListPtr list = &pool->volumes;
     size_t i;
 
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->key, key))
-            return pool->volumes.objs[i];
+    for (i = 0; i < list->count; i++) {
+        if (list->objs[i] == vol)
+            break;
+    }
+    if (i == list->count)
+        return;
 
-    return NULL;
+    VIR_DELETE_ELEMENT(list->objs, i, list->count);
+
+    virStorageVolDefListUnindex(list->objsName, vol->name, vol);
+    virStorageVolDefListUnindex(list->objsKey, vol->key, vol);
+    virStorageVolDefListUnindex(list->objsPath, vol->target.path, vol);
+}
+
+
+virStorageVolDefPtr
+virStorageVolDefFindByKey(virStoragePoolObjPtr pool,
+                          const char *key)
+{
+    return virHashMultiLookup(pool->volumes.objsKey, key);
 }
 
 virStorageVolDefPtr
 virStorageVolDefFindByPath(virStoragePoolObjPtr pool,
                            const char *path)
 {
-    size_t i;
-
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->target.path, path))
-            return pool->volumes.objs[i];
-
-    return NULL;
+    return virHashMultiLookup(pool->volumes.objsPath, path);
 }
 
 virStorageVolDefPtr
 virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                            const char *name)
 {
-    size_t i;
-
-    for (i = 0; i < pool->volumes.count; i++)
-        if (STREQ(pool->volumes.objs[i]->name, name))
-            return pool->volumes.objs[i];
-
-    return NULL;
+    return virHashMultiLookup(pool->volumes.objsName, name);
 }
 
 virStoragePoolObjPtr
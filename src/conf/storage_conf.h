@@ -29,6 +29,7 @@
 # include "virstoragefile.h"
 # include "virbitmap.h"
 # include "virthread.h"
+# include "virhash.h"
 # include "device_conf.h"
 # include "object_event.h"
 
@@ -68,6 +69,10 @@ struct _virStorageVolDef {
     bool building;
     unsigned int in_use;
 
+    /* Progress of a running wipe, output only */
+    unsigned long long wipeDone;
+    unsigned long long wipeTotal;
+
     virStorageVolSource source;
     virStorageSource target;
 };
@@ -77,6 +82,12 @@ typedef virStorageVolDefList *virStorageVolDefListPtr;
 struct _virStorageVolDefList {
     size_t count;
     virStorageVolDefPtr *objs;
+
+    /* Indexes of @objs, created with the first volume. A name, key or
+     * path shared by several volumes refers to the first of them. */
+    virHashMultiPtr objsName;
+    virHashMultiPtr objsKey;
+    virHashMultiPtr objsPath;
 };
 
 VIR_ENUM_DECL(virStorageVol)
@@ -279,6 +290,10 @@ struct _virStoragePoolObj {
     virStoragePoolDefPtr newDef;
 
     virStorageVolDefList volumes;
+
+    /* Event loop watch of changes of the pool's target directory, 0 if
+     * the pool is not watched */
+    int inotifyWatch;
 };
 
 typedef struct _virStoragePoolObjList virStoragePoolObjList;
@@ -299,10 +314,30 @@ struct _virStorageDriverState {
     char *configDir;
     char *autostartDir;
     char *stateDir;
+    char *cacheDir; /* NULL if volumes of local pools are not cached */
     bool privileged;
 
     /* Immutable pointer, self-locking APIs */
     virObjectEventStatePtr storageEventState;
+
+    /* UUIDs of the pools which held volumes by their target path or
+     * key, to look them up without searching every pool. This is only
+     * a hint: backends change the volumes of a pool holding just its
+     * lock, so the pool is checked before use and every pool searched
+     * if it doesn't hold the volume. Guarded by @volIndexLock, which
+     * is taken last. */
+    virMutex volIndexLock;
+    virHashTablePtr volPaths;
+    virHashTablePtr volKeys;
+
+    /* Changes of watched pools by UUID, waiting to be applied by
+     * @changesThread. Guarded by @changesLock. */
+    virMutex changesLock;
+    virCond changesCond;
+    virHashTablePtr changes;
+    virThread changesThread;
+    bool changesRunning;
+    bool changesQuit;
 };
 
 typedef struct _virStoragePoolSourceList virStoragePoolSourceList;
@@ -355,6 +390,12 @@ virStorageVolDefFindByName(virStoragePoolObjPtr pool,
 
 void virStoragePoolObjClearVols(virStoragePoolObjPtr pool);
 
+int virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                            virStorageVolDefPtr vol);
+
+void virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                                virStorageVolDefPtr vol);
+
 virStoragePoolDefPtr virStoragePoolDefParseString(const char *xml);
 virStoragePoolDefPtr virStoragePoolDefParseFile(const char *filename);
 virStoragePoolDefPtr virStoragePoolDefParseNode(xmlDocPtr xml,
@@ -27,11 +27,15 @@
 #include "internal.h"
 #include "datatypes.h"
 #include "virdomainobjlist.h"
+#include "intprops.h"
 #include "snapshot_conf.h"
 #include "viralloc.h"
 #include "virfile.h"
+#include "virhostcpu.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virthreadpool.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -51,6 +55,17 @@ struct _virDomainObjList {
     /* name -> virDomainObj mapping for O(1),
      * lockless lookup-by-name */
     virHashTable *objsName;
+
+    /* id -> virDomainObj mapping for O(1) lookup-by-id of
+     * active domains, kept up to date by virDomainObjListSetID.
+     * Protected by @idLock rather than the list lock so that it
+     * can be updated by callers holding just the domain object
+     * lock: the list lock is taken before domain locks, so it
+     * cannot be taken by them. Nothing else is locked while
+     * holding @idLock, making it the innermost lock. Entries are
+     * revalidated against obj->def->id on lookup. */
+    virMutex idLock;
+    virHashTable *objsID;
 };
 
 
@@ -77,8 +92,16 @@ virDomainObjListPtr virDomainObjListNew(void)
     if (!(doms = virObjectLockableNew(virDomainObjListClass)))
         return NULL;
 
+    if (virMutexInit(&doms->idLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        virObjectUnref(doms);
+        return NULL;
+    }
+
     if (!(doms->objs = virHashCreate(50, virObjectFreeHashData)) ||
-        !(doms->objsName = virHashCreate(50, virObjectFreeHashData))) {
+        !(doms->objsName = virHashCreate(50, virObjectFreeHashData)) ||
+        !(doms->objsID = virHashCreate(50, virObjectFreeHashData))) {
         virObjectUnref(doms);
         return NULL;
     }
@@ -93,6 +116,110 @@ static void virDomainObjListDispose(void *obj)
 
     virHashFree(doms->objs);
     virHashFree(doms->objsName);
+    virHashFree(doms->objsID);
+    virMutexDestroy(&doms->idLock);
+}
+
+
+static void
+virDomainObjListFormatID(int id,
+                         char *idstr)
+{
+    snprintf(idstr, INT_BUFSIZE_BOUND(id), "%d", id);
+}
+
+
+/* Drops the entry of @dom, found by the ID it was indexed by rather
+ * than its current one. The caller must hold @doms->idLock. */
+static void
+virDomainObjListUnindexIDLocked(virDomainObjListPtr doms,
+                                virDomainObjPtr dom)
+{
+    char idstr[INT_BUFSIZE_BOUND(dom->indexedID)];
+
+    if (dom->indexedID == -1)
+        return;
+
+    virDomainObjListFormatID(dom->indexedID, idstr);
+    if (virHashLookup(doms->objsID, idstr) == dom)
+        virHashRemoveEntry(doms->objsID, idstr);
+    dom->indexedID = -1;
+}
+
+
+/* The caller must hold @doms->idLock */
+static void
+virDomainObjListIndexIDLocked(virDomainObjListPtr doms,
+                              virDomainObjPtr dom,
+                              int id)
+{
+    char idstr[INT_BUFSIZE_BOUND(id)];
+    virDomainObjPtr old;
+
+    virDomainObjListUnindexIDLocked(doms, dom);
+
+    if (id == -1)
+        return;
+
+    virDomainObjListFormatID(id, idstr);
+
+    /* An active domain can't have the ID of another one, but the
+     * other one may not have dropped it yet */
+    if ((old = virHashLookup(doms->objsID, idstr)))
+        old->indexedID = -1;
+
+    if (virHashUpdateEntry(doms->objsID, idstr, dom) < 0)
+        return;
+
+    virObjectRef(dom);
+    dom->indexedID = id;
+}
+
+
+/* Indexes @dom by its current ID. The caller must hold the lock
+ * on @dom */
+static void
+virDomainObjListIndexID(virDomainObjListPtr doms,
+                        virDomainObjPtr dom)
+{
+    virMutexLock(&doms->idLock);
+    virDomainObjListIndexIDLocked(doms, dom, dom->def->id);
+    virMutexUnlock(&doms->idLock);
+}
+
+
+/* The caller must hold the lock on @dom */
+static void
+virDomainObjListUnindexID(virDomainObjListPtr doms,
+                          virDomainObjPtr dom)
+{
+    virMutexLock(&doms->idLock);
+    virDomainObjListUnindexIDLocked(doms, dom);
+    virMutexUnlock(&doms->idLock);
+}
+
+
+/**
+ * virDomainObjListSetID:
+ * @doms: list of domain objects
+ * @dom: domain object in @doms
+ * @id: new ID of @dom, or -1 when the domain becomes inactive
+ *
+ * Sets the ID of the active domain @dom and updates the
+ * lookup-by-id index of @doms accordingly. Drivers must not
+ * change dom->def->id of domains in a list in any other way.
+ * The caller must hold the lock on @dom, but not the list
+ * lock which would have to be acquired first.
+ */
+void
+virDomainObjListSetID(virDomainObjListPtr doms,
+                      virDomainObjPtr dom,
+                      int id)
+{
+    virMutexLock(&doms->idLock);
+    dom->def->id = id;
+    virDomainObjListIndexIDLocked(doms, dom, id);
+    virMutexUnlock(&doms->idLock);
 }
 
 
@@ -112,10 +239,13 @@ static int virDomainObjListSearchID(const void *payload,
     return want;
 }
 
+/* Slow path of lookup-by-id used when the ID index doesn't know
+ * about the domain, which is the case only if the index could not
+ * be updated for lack of memory. Repairs the index on success. */
 static virDomainObjPtr
-virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
-                                 int id,
-                                 bool ref)
+virDomainObjListFindByIDSearch(virDomainObjListPtr doms,
+                               int id,
+                               bool ref)
 {
     virDomainObjPtr obj;
     virObjectLock(doms);
@@ -131,6 +261,8 @@ virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
             if (ref)
                 virObjectUnref(obj);
             obj = NULL;
+        } else if (obj->def->id == id) {
+            virDomainObjListIndexID(doms, obj);
         }
     }
     if (!ref)
@@ -138,6 +270,40 @@ virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
     return obj;
 }
 
+
+static virDomainObjPtr
+virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
+                                 int id,
+                                 bool ref)
+{
+    char idstr[INT_BUFSIZE_BOUND(id)];
+    virDomainObjPtr obj;
+
+    virDomainObjListFormatID(id, idstr);
+
+    virMutexLock(&doms->idLock);
+    obj = virObjectRef(virHashLookup(doms->objsID, idstr));
+    virMutexUnlock(&doms->idLock);
+
+    if (obj) {
+        virObjectLock(obj);
+        if (!obj->removing &&
+            virDomainObjIsActive(obj) &&
+            obj->def->id == id) {
+            /* The object is still referenced by the hash tables as
+             * long as it is not being removed, so it's safe to drop
+             * our temporary reference while holding its lock. */
+            if (!ref)
+                virObjectUnref(obj);
+            return obj;
+        }
+        virObjectUnlock(obj);
+        virObjectUnref(obj);
+    }
+
+    return virDomainObjListFindByIDSearch(doms, id, ref);
+}
+
 virDomainObjPtr
 virDomainObjListFindByID(virDomainObjListPtr doms,
                          int id)
@@ -279,6 +445,8 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
                               def,
                               !!(flags & VIR_DOMAIN_OBJ_LIST_ADD_LIVE),
                               oldDef);
+        /* The new live definition may carry a different ID */
+        virDomainObjListIndexID(doms, vm);
     } else {
         /* UUID does not match, but if a name matches, refuse it */
         if ((vm = virHashLookup(doms->objsName, def->name))) {
@@ -308,6 +476,8 @@ virDomainObjListAddLocked(virDomainObjListPtr doms,
         /* Since domain is in two hash tables, increment the
          * reference counter */
         virObjectRef(vm);
+
+        virDomainObjListIndexID(doms, vm);
     }
  cleanup:
     return vm;
@@ -351,6 +521,7 @@ void virDomainObjListRemove(virDomainObjListPtr doms,
 
     virObjectLock(doms);
     virObjectLock(dom);
+    virDomainObjListUnindexID(doms, dom);
     virHashRemoveEntry(doms->objs, uuidstr);
     virHashRemoveEntry(doms->objsName, dom->def->name);
     virObjectUnlock(dom);
@@ -438,15 +609,59 @@ void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
 
     virUUIDFormat(dom->def->uuid, uuidstr);
 
+    virDomainObjListUnindexID(doms, dom);
     virHashRemoveEntry(doms->objs, uuidstr);
     virHashRemoveEntry(doms->objsName, dom->def->name);
     virObjectUnlock(dom);
 }
 
 
+/* Upper limit on threads parsing domain XML files at startup */
+#define VIR_DOMAIN_OBJ_LIST_LOAD_WORKERS_MAX 8
+
+static virDomainDefPtr
+virDomainObjListParseConfig(virCapsPtr caps,
+                            virDomainXMLOptionPtr xmlopt,
+                            const char *configDir,
+                            const char *name)
+{
+    char *configFile = NULL;
+    virDomainDefPtr def = NULL;
+
+    if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
+        return NULL;
+
+    def = virDomainDefParseFile(configFile, caps, xmlopt, NULL,
+                                VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                                VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE);
+
+    VIR_FREE(configFile);
+    return def;
+}
+
+
+static virDomainObjPtr
+virDomainObjListParseStatus(virCapsPtr caps,
+                            virDomainXMLOptionPtr xmlopt,
+                            const char *statusDir,
+                            const char *name)
+{
+    return virDomainObjParseStatus(statusDir, name, caps, xmlopt,
+                                   VIR_DOMAIN_DEF_PARSE_STATUS |
+                                   VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
+                                   VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
+                                   VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                   VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE);
+}
+
+
+/*
+ * Takes over @def, which is freed on error
+ */
 static virDomainObjPtr
 virDomainObjListLoadConfig(virDomainObjListPtr doms,
-                           virCapsPtr caps,
+                           virDomainDefPtr def,
                            virDomainXMLOptionPtr xmlopt,
                            const char *configDir,
                            const char *autostartDir,
@@ -455,18 +670,12 @@ virDomainObjListLoadConfig(virDomainObjListPtr doms,
                            void *opaque)
 {
     char *configFile = NULL, *autostartLink = NULL;
-    virDomainDefPtr def = NULL;
     virDomainObjPtr dom;
     int autostart;
     virDomainDefPtr oldDef = NULL;
 
     if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
         goto error;
-    if (!(def = virDomainDefParseFile(configFile, caps, xmlopt, NULL,
-                                      VIR_DOMAIN_DEF_PARSE_INACTIVE |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
-        goto error;
 
     if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
         goto error;
@@ -495,30 +704,17 @@ virDomainObjListLoadConfig(virDomainObjListPtr doms,
 }
 
 
+/*
+ * Takes over @obj, which is released on error
+ */
 static virDomainObjPtr
 virDomainObjListLoadStatus(virDomainObjListPtr doms,
-                           const char *statusDir,
-                           const char *name,
-                           virCapsPtr caps,
-                           virDomainXMLOptionPtr xmlopt,
+                           virDomainObjPtr obj,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
 {
-    char *statusFile = NULL;
-    virDomainObjPtr obj = NULL;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
-    if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
-
-    if (!(obj = virDomainObjParseFile(statusFile, caps, xmlopt,
-                                      VIR_DOMAIN_DEF_PARSE_STATUS |
-                                      VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
-                                      VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
-        goto error;
-
     virUUIDFormat(obj->def->uuid, uuidstr);
 
     if (virHashLookup(doms->objs, uuidstr) != NULL) {
@@ -540,19 +736,129 @@ virDomainObjListLoadStatus(virDomainObjListPtr doms,
      * reference counter */
     virObjectRef(obj);
 
+    virDomainObjListIndexID(doms, obj);
+
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
 
  error:
     virObjectUnref(obj);
-    VIR_FREE(statusFile);
     return NULL;
 }
 
 
+typedef struct _virDomainObjListLoadJob virDomainObjListLoadJob;
+typedef virDomainObjListLoadJob *virDomainObjListLoadJobPtr;
+struct _virDomainObjListLoadJob {
+    char *name;
+
+    /* Result of parsing, depending on whether status
+     * or config files are loaded */
+    virDomainDefPtr def;
+    virDomainObjPtr obj;
+};
+
+typedef struct _virDomainObjListLoadData virDomainObjListLoadData;
+typedef virDomainObjListLoadData *virDomainObjListLoadDataPtr;
+struct _virDomainObjListLoadData {
+    const char *configDir;
+    int liveStatus;
+    virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
+
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+};
+
+
+static void
+virDomainObjListLoadParse(virDomainObjListLoadDataPtr data,
+                          virDomainObjListLoadJobPtr job)
+{
+    /* NB: ignoring errors, so one malformed config doesn't
+       kill the whole process */
+    VIR_INFO("Loading config file '%s.xml'", job->name);
+    if (data->liveStatus)
+        job->obj = virDomainObjListParseStatus(data->caps, data->xmlopt,
+                                               data->configDir, job->name);
+    else
+        job->def = virDomainObjListParseConfig(data->caps, data->xmlopt,
+                                               data->configDir, job->name);
+}
+
+
+static void
+virDomainObjListLoadWorker(void *jobdata,
+                           void *opaque)
+{
+    virDomainObjListLoadDataPtr data = opaque;
+
+    virDomainObjListLoadParse(data, jobdata);
+
+    virMutexLock(&data->lock);
+    if (--data->pending == 0)
+        virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+/*
+ * Parse the files named by @jobs, using a few threads if there are
+ * enough of them to make it worthwhile. Parsing does not touch the
+ * domain list, so it can run without holding its lock.
+ */
+static void
+virDomainObjListLoadParseAll(virDomainObjListLoadDataPtr data,
+                             virDomainObjListLoadJobPtr jobs,
+                             size_t njobs)
+{
+    virThreadPoolPtr pool = NULL;
+    size_t nworkers = 0;
+    size_t i = 0;
+    int ncpus;
+
+    if (njobs > 1 && (ncpus = virHostCPUGetCount()) > 1)
+        nworkers = MIN(MIN(ncpus, njobs), VIR_DOMAIN_OBJ_LIST_LOAD_WORKERS_MAX);
+
+    if (nworkers < 2 ||
+        virMutexInit(&data->lock) < 0)
+        goto serial;
+
+    if (virCondInit(&data->cond) < 0) {
+        virMutexDestroy(&data->lock);
+        goto serial;
+    }
+
+    if (!(pool = virThreadPoolNew(nworkers, nworkers, 0,
+                                  virDomainObjListLoadWorker, data)))
+        goto cleanup;
+
+    virMutexLock(&data->lock);
+    for (; i < njobs; i++) {
+        if (virThreadPoolSendJob(pool, 0, &jobs[i]) < 0)
+            break;
+        data->pending++;
+    }
+    while (data->pending > 0)
+        ignore_value(virCondWait(&data->cond, &data->lock));
+    virMutexUnlock(&data->lock);
+
+    virThreadPoolFree(pool);
+
+ cleanup:
+    virCondDestroy(&data->cond);
+    virMutexDestroy(&data->lock);
+
+ serial:
+    /* Whatever could not be handed over to the pool */
+    for (; i < njobs; i++)
+        virDomainObjListLoadParse(data, &jobs[i]);
+}
+
+
 int
 virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                const char *configDir,
@@ -563,8 +869,19 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                virDomainLoadConfigNotify notify,
                                void *opaque)
 {
+    virDomainObjListLoadData data = {
+        .configDir = configDir,
+        .liveStatus = liveStatus,
+        .caps = caps,
+        .xmlopt = xmlopt,
+    };
+    virDomainObjListLoadJobPtr jobs = NULL;
+    size_t njobs = 0;
+    unsigned long long then = 0;
+    unsigned long long now = 0;
     DIR *dir;
     struct dirent *entry;
+    size_t i;
     int ret = -1;
     int rc;
 
@@ -573,34 +890,54 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
     if ((rc = virDirOpenIfExists(&dir, configDir)) <= 0)
         return rc;
 
-    virObjectLock(doms);
+    ignore_value(virTimeMillisNow(&then));
 
     while ((ret = virDirRead(dir, &entry, configDir)) > 0) {
-        virDomainObjPtr dom;
+        virDomainObjListLoadJob job = { 0 };
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
-        if (liveStatus)
-            dom = virDomainObjListLoadStatus(doms,
-                                             configDir,
-                                             entry->d_name,
-                                             caps,
-                                             xmlopt,
-                                             notify,
-                                             opaque);
-        else
+        if (VIR_STRDUP(job.name, entry->d_name) < 0 ||
+            VIR_APPEND_ELEMENT(jobs, njobs, job) < 0) {
+            VIR_FREE(job.name);
+            ret = -1;
+            break;
+        }
+    }
+
+    VIR_DIR_CLOSE(dir);
+
+    if (ret < 0)
+        goto cleanup;
+
+    virDomainObjListLoadParseAll(&data, jobs, njobs);
+
+    virObjectLock(doms);
+
+    for (i = 0; i < njobs; i++) {
+        virDomainObjPtr dom;
+
+        if (liveStatus) {
+            if (!jobs[i].obj)
+                continue;
+            dom = virDomainObjListLoadStatus(doms, jobs[i].obj,
+                                             notify, opaque);
+            jobs[i].obj = NULL;
+        } else {
+            if (!jobs[i].def)
+                continue;
             dom = virDomainObjListLoadConfig(doms,
-                                             caps,
+                                             jobs[i].def,
                                              xmlopt,
                                              configDir,
                                              autostartDir,
-                                             entry->d_name,
+                                             jobs[i].name,
                                              notify,
                                              opaque);
+            jobs[i].def = NULL;
+        }
+
         if (dom) {
             if (!liveStatus)
                 dom->persistent = 1;
@@ -608,8 +945,16 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
         }
     }
 
-    VIR_DIR_CLOSE(dir);
     virObjectUnlock(doms);
+
+    ignore_value(virTimeMillisNow(&now));
+    VIR_INFO("Loaded %zu configs from %s in %llu ms",
+             njobs, configDir, now - then);
+
+ cleanup:
+    for (i = 0; i < njobs; i++)
+        VIR_FREE(jobs[i].name);
+    VIR_FREE(jobs);
     return ret;
 }
 
@@ -108,22 +108,40 @@ virNodeDeviceFindVPORTCapDef(const virNodeDeviceObj *dev)
 }
 
 
+static int
+virNodeDeviceObjListIndexSysfsPath(virNodeDeviceObjListPtr devs,
+                                   virNodeDeviceObjPtr dev,
+                                   const char *sysfs_path)
+{
+    if (!sysfs_path)
+        return 0;
+
+    return virHashMultiAddEntry(devs->objsSysfsPath, sysfs_path, dev);
+}
+
+
+static void
+virNodeDeviceObjListUnindexSysfsPath(virNodeDeviceObjListPtr devs,
+                                     virNodeDeviceObjPtr dev,
+                                     const char *sysfs_path)
+{
+    if (!sysfs_path)
+        return;
+
+    virHashMultiRemoveEntry(devs->objsSysfsPath, sysfs_path, dev);
+}
+
+
 virNodeDeviceObjPtr
 virNodeDeviceObjFindBySysfsPath(virNodeDeviceObjListPtr devs,
                                 const char *sysfs_path)
 {
-    size_t i;
+    virNodeDeviceObjPtr dev;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if ((devs->objs[i]->def->sysfs_path != NULL) &&
-            (STREQ(devs->objs[i]->def->sysfs_path, sysfs_path))) {
-            return devs->objs[i];
-        }
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
+    if ((dev = virHashMultiLookup(devs->objsSysfsPath, sysfs_path)))
+        virNodeDeviceObjLock(dev);
 
-    return NULL;
+    return dev;
 }
 
 
@@ -131,16 +149,12 @@ virNodeDeviceObjPtr
 virNodeDeviceObjFindByName(virNodeDeviceObjListPtr devs,
                            const char *name)
 {
-    size_t i;
+    virNodeDeviceObjPtr dev;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if (STREQ(devs->objs[i]->def->name, name))
-            return devs->objs[i];
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
+    if ((dev = virHashLookup(devs->objsName, name)))
+        virNodeDeviceObjLock(dev);
 
-    return NULL;
+    return dev;
 }
 
 
@@ -225,6 +239,10 @@ virNodeDeviceObjListFree(virNodeDeviceObjListPtr devs)
         virNodeDeviceObjFree(devs->objs[i]);
     VIR_FREE(devs->objs);
     devs->count = 0;
+    virHashFree(devs->objsName);
+    virHashMultiFree(devs->objsSysfsPath);
+    devs->objsName = NULL;
+    devs->objsSysfsPath = NULL;
 }
 
 
@@ -235,11 +253,32 @@ virNodeDeviceObjAssignDef(virNodeDeviceObjListPtr devs,
     virNodeDeviceObjPtr device;
 
     if ((device = virNodeDeviceObjFindByName(devs, def->name))) {
-        virNodeDeviceDefFree(device->def);
+        virNodeDeviceDefPtr olddef = device->def;
+        bool moved = STRNEQ_NULLABLE(olddef->sysfs_path, def->sysfs_path);
+
+        if (moved &&
+            virNodeDeviceObjListIndexSysfsPath(devs, device,
+                                               def->sysfs_path) < 0) {
+            virNodeDeviceObjUnlock(device);
+            return NULL;
+        }
+
         device->def = def;
+        if (moved)
+            virNodeDeviceObjListUnindexSysfsPath(devs, device,
+                                                 olddef->sysfs_path);
+        virNodeDeviceDefFree(olddef);
         return device;
     }
 
+    if (!devs->objsName &&
+        !(devs->objsName = virHashCreate(50, NULL)))
+        return NULL;
+
+    if (!devs->objsSysfsPath &&
+        !(devs->objsSysfsPath = virHashMultiNew(50)))
+        return NULL;
+
     if (VIR_ALLOC(device) < 0)
         return NULL;
 
@@ -251,15 +290,28 @@ virNodeDeviceObjAssignDef(virNodeDeviceObjListPtr devs,
     }
     virNodeDeviceObjLock(device);
 
-    if (VIR_APPEND_ELEMENT_COPY(devs->objs, devs->count, device) < 0) {
-        virNodeDeviceObjUnlock(device);
-        virNodeDeviceObjFree(device);
-        return NULL;
+    if (VIR_APPEND_ELEMENT_COPY(devs->objs, devs->count, device) < 0)
+        goto error;
+
+    if (virHashAddEntry(devs->objsName, def->name, device) < 0) {
+        VIR_DELETE_ELEMENT(devs->objs, devs->count - 1, devs->count);
+        goto error;
+    }
+
+    if (virNodeDeviceObjListIndexSysfsPath(devs, device,
+                                           def->sysfs_path) < 0) {
+        ignore_value(virHashRemoveEntry(devs->objsName, def->name));
+        VIR_DELETE_ELEMENT(devs->objs, devs->count - 1, devs->count);
+        goto error;
     }
     device->def = def;
 
     return device;
 
+ error:
+    virNodeDeviceObjUnlock(device);
+    virNodeDeviceObjFree(device);
+    return NULL;
 }
 
 
@@ -272,16 +324,17 @@ virNodeDeviceObjRemove(virNodeDeviceObjListPtr devs,
     virNodeDeviceObjUnlock(*dev);
 
     for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(*dev);
         if (devs->objs[i] == *dev) {
-            virNodeDeviceObjUnlock(*dev);
-            virNodeDeviceObjFree(devs->objs[i]);
-            *dev = NULL;
+            ignore_value(virHashRemoveEntry(devs->objsName,
+                                            (*dev)->def->name));
+            virNodeDeviceObjListUnindexSysfsPath(devs, *dev,
+                                                 (*dev)->def->sysfs_path);
 
             VIR_DELETE_ELEMENT(devs->objs, i, devs->count);
+            virNodeDeviceObjFree(*dev);
+            *dev = NULL;
             break;
         }
-        virNodeDeviceObjUnlock(*dev);
     }
 }
 
@@ -32,6 +32,11 @@ typedef virNodeDeviceDriverState *virNodeDeviceDriverStatePtr;
 struct _virNodeDeviceDriverState {
     virMutex lock;
 
+    /* Whether the devices present at startup are known, backends may
+     * enumerate them in the background and signal @initCond once done */
+    bool initialized;
+    virCond initCond;
+
     virNodeDeviceObjList devs;		/* currently-known devices */
     void *privateData;			/* driver-specific private data */
 
@@ -1263,6 +1263,26 @@ typedef int
                        int state,
                        unsigned int flags);
 
+typedef int
+(*virDrvConnectGetAllDomainStatsColumns)(virConnectPtr conn,
+                                         virDomainPtr *doms,
+                                         unsigned int ndoms,
+                                         unsigned int stats,
+                                         virDomainStatsColumnsPtr *retColumns,
+                                         unsigned int flags);
+
+typedef int
+(*virDrvConnectDomainStatsEventRegister)(virConnectPtr conn,
+                                         unsigned int stats,
+                                         virConnectDomainStatsEventCallback cb,
+                                         void *opaque,
+                                         virFreeCallback freecb,
+                                         unsigned int flags);
+
+typedef int
+(*virDrvConnectDomainStatsEventDeregister)(virConnectPtr conn,
+                                           int callbackID);
+
 typedef struct _virHypervisorDriver virHypervisorDriver;
 typedef virHypervisorDriver *virHypervisorDriverPtr;
 
@@ -1503,6 +1523,9 @@ struct _virHypervisorDriver {
     virDrvDomainGetGuestVcpus domainGetGuestVcpus;
     virDrvDomainSetGuestVcpus domainSetGuestVcpus;
     virDrvDomainSetVcpu domainSetVcpu;
+    virDrvConnectGetAllDomainStatsColumns connectGetAllDomainStatsColumns;
+    virDrvConnectDomainStatsEventRegister connectDomainStatsEventRegister;
+    virDrvConnectDomainStatsEventDeregister connectDomainStatsEventDeregister;
 };
 
 
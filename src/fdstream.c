@@ -57,6 +57,15 @@ struct virFDStreamData {
     unsigned long long offset;
     unsigned long long length;
 
+    /* Sparse streams talk to the I/O helper using virFileSparseRecord
+     * headers, each followed by the data in case of a data record. */
+    bool sparse;
+    bool sparseWrite;
+    virFileSparseRecord rec;    /* record currently being read */
+    size_t recOffset;           /* bytes of @rec header read so far */
+    unsigned long long recRemaining; /* bytes of @rec not consumed yet */
+    unsigned long long outRemaining; /* data bytes announced but not written */
+
     int watch;
     int events;         /* events the stream callback is subscribed for */
     bool cbRemoved;
@@ -376,6 +385,98 @@ virFDStreamAbort(virStreamPtr st)
     return virFDStreamCloseInt(st, true);
 }
 
+/* Writes a sparse record header. Being smaller than PIPE_BUF, the
+ * header is either written as a whole or not at all.
+ * Called with fdst->lock held. */
+static int
+virFDStreamWriteRecord(struct virFDStreamData *fdst,
+                       virFileSparseRecordType type,
+                       unsigned long long length)
+{
+    virFileSparseRecord rec = { .type = type, .length = length };
+    ssize_t ret;
+
+ retry:
+    ret = write(fdst->fd, &rec, sizeof(rec));
+    if (ret < 0) {
+        VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        VIR_WARNINGS_RESET
+            return -2;
+        } else if (errno == EINTR) {
+            goto retry;
+        }
+        virReportSystemError(errno, "%s",
+                             _("cannot write to stream"));
+        return -1;
+    }
+
+    if (ret != sizeof(rec)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("short write of sparse stream record"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Makes sure there is a sparse record with some bytes left in
+ * fdst->rec, reading the next header from the I/O helper if needed.
+ * Called with fdst->lock held.
+ *
+ * Returns 1 if a record is available, 0 on end of stream,
+ * -2 if the header is not fully available yet, -1 on error. */
+static int
+virFDStreamReadRecord(struct virFDStreamData *fdst)
+{
+    char *rec = (char *) &fdst->rec;
+    ssize_t got;
+
+    while (!fdst->recRemaining) {
+        got = read(fdst->fd, rec + fdst->recOffset,
+                   sizeof(fdst->rec) - fdst->recOffset);
+        if (got < 0) {
+            VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            VIR_WARNINGS_RESET
+                return -2;
+            } else if (errno == EINTR) {
+                continue;
+            }
+            virReportSystemError(errno, "%s",
+                                 _("cannot read from stream"));
+            return -1;
+        }
+
+        if (got == 0) {
+            if (fdst->recOffset) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("truncated sparse stream record"));
+                return -1;
+            }
+            return 0;
+        }
+
+        fdst->recOffset += got;
+        if (fdst->recOffset < sizeof(fdst->rec))
+            continue;
+
+        fdst->recOffset = 0;
+        if (fdst->rec.type != VIR_FILE_SPARSE_RECORD_DATA &&
+            fdst->rec.type != VIR_FILE_SPARSE_RECORD_HOLE) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("unknown sparse stream record type %llu"),
+                           fdst->rec.type);
+            return -1;
+        }
+        fdst->recRemaining = fdst->rec.length;
+    }
+
+    return 1;
+}
+
+
 static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
 {
     struct virFDStreamData *fdst = st->privateData;
@@ -407,6 +508,20 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->sparse) {
+        if (!fdst->outRemaining) {
+            if ((ret = virFDStreamWriteRecord(fdst, VIR_FILE_SPARSE_RECORD_DATA,
+                                              nbytes)) < 0) {
+                virMutexUnlock(&fdst->lock);
+                return ret;
+            }
+            fdst->outRemaining = nbytes;
+        }
+
+        if (fdst->outRemaining < nbytes)
+            nbytes = fdst->outRemaining;
+    }
+
  retry:
     ret = write(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -421,8 +536,11 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             virReportSystemError(errno, "%s",
                                  _("cannot write to stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->sparse)
+            fdst->outRemaining -= ret;
+        if (fdst->length)
+            fdst->offset += ret;
     }
 
     virMutexUnlock(&fdst->lock);
@@ -430,11 +548,17 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
 }
 
 
-static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+static int
+virFDStreamReadFlags(virStreamPtr st,
+                     char *bytes,
+                     size_t nbytes,
+                     unsigned int flags)
 {
     struct virFDStreamData *fdst = st->privateData;
     int ret;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (nbytes > INT_MAX) {
         virReportSystemError(ERANGE, "%s",
                              _("Too many bytes to read from stream"));
@@ -459,6 +583,28 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->sparse) {
+        if ((ret = virFDStreamReadRecord(fdst)) <= 0)
+            goto cleanup;
+
+        if (fdst->recRemaining < nbytes)
+            nbytes = fdst->recRemaining;
+
+        if (fdst->rec.type == VIR_FILE_SPARSE_RECORD_HOLE) {
+            if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+                ret = -3;
+                goto cleanup;
+            }
+
+            memset(bytes, 0, nbytes);
+            ret = nbytes;
+            fdst->recRemaining -= ret;
+            if (fdst->length)
+                fdst->offset += ret;
+            goto cleanup;
+        }
+    }
+
  retry:
     ret = read(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -473,10 +619,165 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             virReportSystemError(errno, "%s",
                                  _("cannot read from stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->sparse) {
+            if (ret == 0 && nbytes) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("truncated sparse stream data"));
+                ret = -1;
+                goto cleanup;
+            }
+            fdst->recRemaining -= ret;
+        }
+        if (fdst->length)
+            fdst->offset += ret;
     }
 
+ cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+{
+    return virFDStreamReadFlags(st, bytes, nbytes, 0);
+}
+
+
+static int
+virFDStreamSendHole(virStreamPtr st,
+                    long long length,
+                    unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (!fdst->sparse) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("stream is not sparse"));
+        goto cleanup;
+    }
+
+    if (fdst->sparseWrite) {
+        if (fdst->outRemaining) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("cannot send a hole in the middle of data"));
+            goto cleanup;
+        }
+
+        if (length &&
+            (ret = virFDStreamWriteRecord(fdst, VIR_FILE_SPARSE_RECORD_HOLE,
+                                          length)) < 0)
+            goto cleanup;
+    } else {
+        /* On the reading side this skips a hole that was
+         * already transferred by other means */
+        if (fdst->rec.type != VIR_FILE_SPARSE_RECORD_HOLE ||
+            fdst->recRemaining < length) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("cannot skip %lld bytes of data in stream"),
+                           length);
+            goto cleanup;
+        }
+        fdst->recRemaining -= length;
+    }
+
+    if (fdst->length)
+        fdst->offset += length;
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int
+virFDStreamRecvHole(virStreamPtr st,
+                    long long *length,
+                    unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    *length = 0;
+    if (fdst->sparse && !fdst->sparseWrite &&
+        fdst->rec.type == VIR_FILE_SPARSE_RECORD_HOLE &&
+        fdst->recRemaining) {
+        *length = fdst->recRemaining;
+        fdst->recRemaining = 0;
+        if (fdst->length)
+            fdst->offset += *length;
+    }
+
+    virMutexUnlock(&fdst->lock);
+    return 0;
+}
+
+
+static int
+virFDStreamInData(virStreamPtr st,
+                  int *inData,
+                  long long *length)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int ret = -1;
+    int rc;
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    /* Non-sparse streams are a single data section of unknown
+     * length, and so is a sparse one whose next record hasn't
+     * arrived yet. */
+    *inData = 1;
+    *length = 0;
+
+    if (fdst->length && fdst->length == fdst->offset) {
+        *inData = 0;
+    } else if (fdst->sparse && !fdst->sparseWrite) {
+        if ((rc = virFDStreamReadRecord(fdst)) == -1)
+            goto cleanup;
+
+        if (rc == 0) {
+            *inData = 0;
+        } else if (rc == 1) {
+            *inData = fdst->rec.type == VIR_FILE_SPARSE_RECORD_DATA;
+            *length = fdst->recRemaining;
+            if (fdst->length && fdst->length - fdst->offset < *length)
+                *length = fdst->length - fdst->offset;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
@@ -485,6 +786,10 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
 static virStreamDriver virFDStreamDrv = {
     .streamSend = virFDStreamWrite,
     .streamRecv = virFDStreamRead,
+    .streamRecvFlags = virFDStreamReadFlags,
+    .streamSendHole = virFDStreamSendHole,
+    .streamRecvHole = virFDStreamRecvHole,
+    .streamInData = virFDStreamInData,
     .streamFinish = virFDStreamClose,
     .streamAbort = virFDStreamAbort,
     .streamEventAddCallback = virFDStreamAddCallback,
@@ -605,7 +910,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                             unsigned long long length,
                             int oflags,
                             int mode,
-                            bool forceIOHelper)
+                            bool forceIOHelper,
+                            bool sparse)
 {
     int fd = -1;
     int childfd = -1;
@@ -614,8 +920,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     int errfd = -1;
     char *iohelper_path = NULL;
 
-    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o",
-              st, path, oflags, offset, length, mode);
+    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o "
+              "sparse=%d", st, path, oflags, offset, length, mode, sparse);
 
     oflags |= O_NOCTTY | O_BINARY;
 
@@ -649,10 +955,13 @@ virFDStreamOpenFileInternal(virStreamPtr st,
      * non-blocking I/O on block devs/regular files. To
      * support those we need to fork a helper process to do
      * the I/O so we just have a fifo. Or use AIO :-(
+     * Sparse streams always go through the helper, which is what
+     * detects and recreates the holes.
      */
-    if ((st->flags & VIR_STREAM_NONBLOCK) &&
-        ((!S_ISCHR(sb.st_mode) &&
-          !S_ISFIFO(sb.st_mode)) || forceIOHelper)) {
+    if (sparse ||
+        ((st->flags & VIR_STREAM_NONBLOCK) &&
+         ((!S_ISCHR(sb.st_mode) &&
+           !S_ISFIFO(sb.st_mode)) || forceIOHelper))) {
         int fds[2] = { -1, -1 };
 
         if ((oflags & O_ACCMODE) == O_RDWR) {
@@ -683,6 +992,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         virCommandPassFD(cmd, fd,
                          VIR_COMMAND_PASS_FD_CLOSE_PARENT);
         virCommandAddArgFormat(cmd, "%d", fd);
+        if (sparse)
+            virCommandAddArg(cmd, "--sparse");
 
         if ((oflags & O_ACCMODE) == O_RDONLY) {
             childfd = fds[1];
@@ -704,6 +1015,13 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     if (virFDStreamOpenInternal(st, fd, cmd, errfd, length) < 0)
         goto error;
 
+    if (sparse) {
+        struct virFDStreamData *fdst = st->privateData;
+
+        fdst->sparse = true;
+        fdst->sparseWrite = (oflags & O_ACCMODE) == O_WRONLY;
+    }
+
     return 0;
 
  error:
@@ -731,7 +1049,7 @@ int virFDStreamOpenFile(virStreamPtr st,
     }
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0, false);
+                                       oflags, 0, false, false);
 }
 
 int virFDStreamCreateFile(virStreamPtr st,
@@ -744,7 +1062,7 @@ int virFDStreamCreateFile(virStreamPtr st,
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
                                        oflags | O_CREAT, mode,
-                                       false);
+                                       false, false);
 }
 
 #ifdef HAVE_CFMAKERAW
@@ -760,7 +1078,7 @@ int virFDStreamOpenPTY(virStreamPtr st,
     if (virFDStreamOpenFileInternal(st, path,
                                     offset, length,
                                     oflags | O_CREAT, 0,
-                                    false) < 0)
+                                    false, false) < 0)
         return -1;
 
     fdst = st->privateData;
@@ -797,7 +1115,7 @@ int virFDStreamOpenPTY(virStreamPtr st,
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
                                        oflags | O_CREAT, 0,
-                                       false);
+                                       false, false);
 }
 #endif /* !HAVE_CFMAKERAW */
 
@@ -805,11 +1123,12 @@ int virFDStreamOpenBlockDevice(virStreamPtr st,
                                const char *path,
                                unsigned long long offset,
                                unsigned long long length,
-                               int oflags)
+                               int oflags,
+                               bool sparse)
 {
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0, true);
+                                       oflags, 0, true, sparse);
 }
 
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
@@ -1085,6 +1085,50 @@ virAdmServerSetClientLimits(virAdmServerPtr srv,
     return ret;
 }
 
+/**
+ * virAdmServerGetMessagePoolStats:
+ * @srv: a valid server object reference
+ * @params: pointer to message pool statistics object
+ *          (return value, allocated automatically)
+ * @nparams: pointer to number of parameters returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieve statistics of the pool of RPC messages server @srv recycles
+ * across calls. These include:
+ *  - number of messages taken from the pool,
+ *  - number of messages which had to be allocated,
+ *  - number of released messages which did not fit into the pool,
+ *  - number of messages currently kept in the pool.
+ *
+ * See 'Per-server message pool statistics' in libvirt-admin.h for the
+ * parameters returned in @params.
+ *
+ * Returns 0 on success, allocating @params to size returned in @nparams, or
+ * -1 in case of an error. Caller is responsible for deallocating @params.
+ */
+int
+virAdmServerGetMessagePoolStats(virAdmServerPtr srv,
+                                virTypedParameterPtr *params,
+                                int *nparams,
+                                unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("srv=%p, flags=%x", srv, flags);
+    virResetLastError();
+
+    virCheckAdmServerGoto(srv, error);
+
+    if ((ret = remoteAdminServerGetMessagePoolStats(srv, params,
+                                                    nparams, flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
 /**
  * virAdmConnectGetLoggingOutputs:
  * @conn: pointer to an active admin connection
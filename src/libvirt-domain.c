@@ -11283,6 +11283,14 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * VIR_CONNECT_GET_ALL_DOMAINS_STATS_SHUTOFF and/or
  * VIR_CONNECT_GET_ALL_DOMAINS_STATS_OTHER for all other states.
  *
+ * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_PARALLEL as @flags allows the
+ * hypervisor driver to gather the statistics of individual domains
+ * concurrently.  The returned records are still ordered as if they were
+ * collected sequentially, however a domain whose statistics could not be
+ * collected within a driver specific timeout is omitted from the output
+ * rather than delaying the whole call.  Drivers which don't support parallel
+ * collection simply process the domains one after another.
+ *
  * Returns the count of returned statistics structures on success, -1 on error.
  * The requested data are returned in the @retStats parameter. The returned
  * array should be freed by the caller. See virDomainStatsRecordListFree.
@@ -11445,6 +11453,290 @@ virDomainStatsRecordListFree(virDomainStatsRecordPtr *stats)
 }
 
 
+/*
+ * Queries the statistics as records from drivers which can't arrange
+ * them in columns themselves.
+ */
+static int
+virDomainGetStatsColumnsFromRecords(virConnectPtr conn,
+                                    virDomainPtr *doms,
+                                    unsigned int ndoms,
+                                    unsigned int stats,
+                                    virDomainStatsColumnsPtr *retColumns,
+                                    unsigned int flags)
+{
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainStatsColumnsPtr columns;
+    int nrecords;
+
+    if (!conn->driver->connectGetAllDomainStats) {
+        virReportUnsupportedError();
+        return -1;
+    }
+
+    if ((nrecords = conn->driver->connectGetAllDomainStats(conn, doms, ndoms,
+                                                           stats, &records,
+                                                           flags)) < 0)
+        return -1;
+
+    columns = virTypedParamsRecordsToColumns(records, nrecords);
+    virDomainStatsRecordListFree(records);
+    if (!columns)
+        return -1;
+
+    *retColumns = columns;
+    return nrecords;
+}
+
+
+/**
+ * virConnectGetAllDomainStatsColumns:
+ * @conn: pointer to the hypervisor connection
+ * @stats: stats to return, binary-OR of virDomainStatsTypes
+ * @retColumns: Pointer that will be filled with the returned stats
+ * @flags: extra flags; binary-OR of virConnectGetAllDomainStatsFlags
+ *
+ * Query the same statistics as virConnectGetAllDomainStats does, but
+ * return them arranged by statistic: @retColumns holds the list of
+ * domains and one virDomainStatsColumn for each statistic reported by
+ * any of them, with the values of all the domains packed in arrays.
+ * This is meant for monitoring tools which process the same few
+ * statistics of many domains. Over a remote connection the statistics
+ * are transferred in this form too, which is a lot more compact.
+ *
+ * The @stats and @flags arguments are interpreted as described in
+ * virConnectGetAllDomainStats.
+ *
+ * Returns the count of domains in @retColumns on success, -1 on error.
+ * The returned structure should be freed by the caller with
+ * virDomainStatsColumnsFree.
+ */
+int
+virConnectGetAllDomainStatsColumns(virConnectPtr conn,
+                                   unsigned int stats,
+                                   virDomainStatsColumnsPtr *retColumns,
+                                   unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("conn=%p, stats=0x%x, retColumns=%p, flags=0x%x",
+              conn, stats, retColumns, flags);
+
+    virResetLastError();
+
+    virCheckConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(retColumns, cleanup);
+
+    if (conn->driver->connectGetAllDomainStatsColumns)
+        ret = conn->driver->connectGetAllDomainStatsColumns(conn, NULL, 0,
+                                                            stats, retColumns,
+                                                            flags);
+    else
+        ret = virDomainGetStatsColumnsFromRecords(conn, NULL, 0, stats,
+                                                  retColumns, flags);
+
+ cleanup:
+    if (ret < 0)
+        virDispatchError(conn);
+
+    return ret;
+}
+
+
+/**
+ * virDomainListGetStatsColumns:
+ * @doms: NULL terminated array of domains
+ * @stats: stats to return, binary-OR of virDomainStatsTypes
+ * @retColumns: Pointer that will be filled with the returned stats
+ * @flags: extra flags; binary-OR of virConnectGetAllDomainStatsFlags
+ *
+ * Query statistics for domains provided by @doms like
+ * virDomainListGetStats does, but return them arranged by statistic as
+ * described in virConnectGetAllDomainStatsColumns. Note that all
+ * domains in @doms must share the same connection.
+ *
+ * Returns the count of domains in @retColumns on success, -1 on error.
+ * The returned structure should be freed by the caller with
+ * virDomainStatsColumnsFree. Note that the count of domains may be less
+ * than the domain count provided via @doms.
+ */
+int
+virDomainListGetStatsColumns(virDomainPtr *doms,
+                             unsigned int stats,
+                             virDomainStatsColumnsPtr *retColumns,
+                             unsigned int flags)
+{
+    virConnectPtr conn = NULL;
+    virDomainPtr *nextdom = doms;
+    unsigned int ndoms = 0;
+    int ret = -1;
+
+    VIR_DEBUG("doms=%p, stats=0x%x, retColumns=%p, flags=0x%x",
+              doms, stats, retColumns, flags);
+
+    virResetLastError();
+
+    virCheckNonNullArgGoto(doms, cleanup);
+    virCheckNonNullArgGoto(retColumns, cleanup);
+
+    if (!*doms) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("doms array in %s must contain at least one domain"),
+                       __FUNCTION__);
+        goto cleanup;
+    }
+
+    conn = doms[0]->conn;
+    virCheckConnectReturn(conn, -1);
+
+    if (!conn->driver->connectGetAllDomainStatsColumns &&
+        !conn->driver->connectGetAllDomainStats) {
+        virReportUnsupportedError();
+        goto cleanup;
+    }
+
+    while (*nextdom) {
+        virDomainPtr dom = *nextdom;
+
+        virCheckDomainGoto(dom, cleanup);
+
+        if (dom->conn != conn) {
+            virReportError(VIR_ERR_INVALID_ARG, "%s",
+                           _("domains in 'doms' array must belong to a "
+                             "single connection"));
+            goto cleanup;
+        }
+
+        ndoms++;
+        nextdom++;
+    }
+
+    if (conn->driver->connectGetAllDomainStatsColumns)
+        ret = conn->driver->connectGetAllDomainStatsColumns(conn, doms, ndoms,
+                                                            stats, retColumns,
+                                                            flags);
+    else
+        ret = virDomainGetStatsColumnsFromRecords(conn, doms, ndoms, stats,
+                                                  retColumns, flags);
+
+ cleanup:
+    if (ret < 0)
+        virDispatchError(conn);
+    return ret;
+}
+
+
+/**
+ * virDomainStatsColumnsFree:
+ * @columns: domain stats to free
+ *
+ * Convenience function to free domain stats returned by
+ * virConnectGetAllDomainStatsColumns and virDomainListGetStatsColumns.
+ */
+void
+virDomainStatsColumnsFree(virDomainStatsColumnsPtr columns)
+{
+    virTypedParamsColumnsFree(columns);
+}
+
+
+/**
+ * virConnectDomainStatsEventRegister:
+ * @conn: pointer to the hypervisor connection
+ * @stats: stats to report, binary-OR of virDomainStatsTypes
+ * @cb: callback to the function handling the statistics
+ * @opaque: opaque data to pass on to the callback
+ * @freecb: optional function to deallocate opaque when not used anymore
+ * @flags: extra flags; binary-OR of virConnectDomainStatsEventRegisterFlags
+ *
+ * Subscribe to statistics of all domains sampled periodically by the
+ * hypervisor driver, instead of polling them with
+ * virConnectGetAllDomainStats. The driver collects the union of the
+ * groups requested by all subscribers once per sampling interval and
+ * shares the sample among them, so several monitoring applications cost
+ * no more than a single one. @stats selects the groups as described in
+ * virConnectGetAllDomainStats; 0 requests all groups supported by the
+ * driver. The interval is a property of the driver's configuration.
+ *
+ * If @flags contains VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA, only the
+ * parameters whose value changed since the previous sample are reported
+ * and domains without any change are left out. The first sample after
+ * registration is always reported in full.
+ *
+ * The callback is invoked from the event loop, see
+ * virConnectDomainEventRegisterAny for the requirements that apply.
+ *
+ * Returns a callback identifier on success, -1 on failure. The
+ * identifier should be passed to virConnectDomainStatsEventDeregister.
+ */
+int
+virConnectDomainStatsEventRegister(virConnectPtr conn,
+                                   unsigned int stats,
+                                   virConnectDomainStatsEventCallback cb,
+                                   void *opaque,
+                                   virFreeCallback freecb,
+                                   unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, stats=0x%x, cb=%p, opaque=%p, freecb=%p, flags=0x%x",
+              conn, stats, cb, opaque, freecb, flags);
+
+    virResetLastError();
+
+    virCheckConnectReturn(conn, -1);
+    virCheckNonNullArgGoto(cb, error);
+
+    if (conn->driver && conn->driver->connectDomainStatsEventRegister) {
+        int ret;
+        ret = conn->driver->connectDomainStatsEventRegister(conn, stats, cb,
+                                                            opaque, freecb,
+                                                            flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
+/**
+ * virConnectDomainStatsEventDeregister:
+ * @conn: pointer to the hypervisor connection
+ * @callbackID: the callback identifier
+ *
+ * Cancel a subscription made with virConnectDomainStatsEventRegister.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+virConnectDomainStatsEventDeregister(virConnectPtr conn,
+                                     int callbackID)
+{
+    VIR_DEBUG("conn=%p, callbackID=%d", conn, callbackID);
+
+    virResetLastError();
+
+    virCheckConnectReturn(conn, -1);
+    virCheckNonNegativeArgGoto(callbackID, error);
+
+    if (conn->driver && conn->driver->connectDomainStatsEventDeregister) {
+        int ret;
+        ret = conn->driver->connectDomainStatsEventDeregister(conn, callbackID);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+ error:
+    virDispatchError(conn);
+    return -1;
+}
+
+
 /**
  * virDomainGetFSInfo:
  * @dom: a domain object
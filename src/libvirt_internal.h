@@ -123,6 +123,23 @@ enum {
      * Support for driver close callback rpc
      */
     VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK = 15,
+
+    /*
+     * Support for stream data packets larger than
+     * VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX, which the server sends
+     * once enabled by REMOTE_PROC_CONNECT_ENABLE_FEATURE
+     */
+    VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_PAYLOAD = 16,
+
+    /*
+     * Support for receiving events in REMOTE_PROC_EVENT_BATCH messages
+     */
+    VIR_DRV_FEATURE_REMOTE_EVENT_BATCH = 17,
+
+    /*
+     * Support for REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS_COLUMNS
+     */
+    VIR_DRV_FEATURE_REMOTE_DOMAIN_STATS_COLUMNS = 18,
 };
 
 
@@ -289,6 +306,10 @@ int virDomainMigrateConfirm3Params(virDomainPtr domain,
                                    unsigned int flags,
                                    int cancelled);
 
+int virStreamInData(virStreamPtr stream,
+                    int *data,
+                    long long *length);
+
 int
 virTypedParameterValidateSet(virConnectPtr conn,
                              virTypedParameterPtr params,
@@ -169,3 +169,33 @@ virLogManagerProtocolDispatchDomainAppendLogFile(virNetServerPtr server ATTRIBUT
     ret->ret = rv;
     return 0;
 }
+
+
+static int
+virLogManagerProtocolDispatchDomainGetLogFileStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                                   virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                                                   virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                                   virNetMessageErrorPtr rerr,
+                                                   virLogManagerProtocolDomainGetLogFileStatsArgs *args,
+                                                   virLogManagerProtocolDomainGetLogFileStatsRet *ret)
+{
+    int rv = -1;
+    unsigned long long bytes;
+    unsigned long long dropped;
+
+    if (virLogHandlerDomainGetLogFileStats(virLogDaemonGetHandler(logDaemon),
+                                           args->path,
+                                           args->flags,
+                                           &bytes, &dropped) < 0)
+        goto cleanup;
+
+    ret->bytes = bytes;
+    ret->dropped = dropped;
+
+    rv = 0;
+ cleanup:
+
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    return rv;
+}
@@ -43,14 +43,35 @@ VIR_LOG_INIT("logging.log_handler");
 
 #define DEFAULT_MODE 0600
 
+/* Reads from the pipe start small and double in size for as long as
+ * the guest keeps filling them, up to the pipe's default capacity */
+#define VIR_LOG_HANDLER_READ_MIN 4096
+#define VIR_LOG_HANDLER_READ_MAX (64 * 1024)
+
+/* Data read from the pipe is collected and written to the log file
+ * once this much is pending, or after VIR_LOG_HANDLER_FLUSH_DELAY
+ * milliseconds at the latest */
+#define VIR_LOG_HANDLER_FLUSH_SIZE (64 * 1024)
+#define VIR_LOG_HANDLER_FLUSH_DELAY 100
+
 typedef struct _virLogHandlerLogFile virLogHandlerLogFile;
 typedef virLogHandlerLogFile *virLogHandlerLogFilePtr;
 
 struct _virLogHandlerLogFile {
     virRotatingFileWriterPtr file;
     int watch;
+    int timer; /* Flushes @buf after VIR_LOG_HANDLER_FLUSH_DELAY */
     int pipefd; /* Read from QEMU via this */
 
+    char *buf; /* Data read from @pipefd, not yet written */
+    size_t bufalloc;
+    size_t buflen;
+    size_t readlen; /* Size of the next read from @pipefd */
+
+    unsigned long long bytes; /* Read from @pipefd in total */
+    unsigned long long dropped; /* Lost on errors writing the file */
+    bool dropping;
+
     char *driver;
     unsigned char domuuid[VIR_UUID_BUFLEN];
     char *domname;
@@ -99,13 +120,61 @@ virLogHandlerLogFileFree(virLogHandlerLogFilePtr file)
 
     if (file->watch != -1)
         virEventRemoveHandle(file->watch);
+    if (file->timer != -1)
+        virEventRemoveTimeout(file->timer);
 
+    VIR_FREE(file->buf);
     VIR_FREE(file->driver);
     VIR_FREE(file->domname);
     VIR_FREE(file);
 }
 
 
+static void
+virLogHandlerLogFileFlush(virLogHandlerLogFilePtr file)
+{
+    ssize_t written;
+
+    if (file->timer != -1)
+        virEventUpdateTimeout(file->timer, -1);
+
+    if (!file->buflen)
+        return;
+
+    /* Don't give up on the log file if the disk is full for a while,
+     * rather drop the data and try again with the next chunk */
+    if ((written = virRotatingFileWriterAppend(file->file, file->buf,
+                                               file->buflen)) != file->buflen) {
+        if (!file->dropping)
+            VIR_WARN("Dropping output of domain %s: %s",
+                     file->domname, virGetLastErrorMessage());
+        virResetLastError();
+        file->dropping = true;
+        file->dropped += file->buflen - MAX(written, 0);
+    } else {
+        file->dropping = false;
+    }
+
+    file->buflen = 0;
+}
+
+
+static virLogHandlerLogFilePtr
+virLogHandlerGetLogFileFromPath(virLogHandlerPtr handler,
+                                const char *path)
+{
+    size_t i;
+
+    for (i = 0; i < handler->nfiles; i++) {
+        if (STREQ(virRotatingFileWriterGetPath(handler->files[i]->file),
+                  path))
+            return handler->files[i];
+    }
+
+    return NULL;
+}
+
+
 static void
 virLogHandlerLogFileClose(virLogHandlerPtr handler,
                           virLogHandlerLogFilePtr file)
@@ -137,6 +206,34 @@ virLogHandlerGetLogFileFromWatch(virLogHandlerPtr handler,
 }
 
 
+static void
+virLogHandlerDomainLogFileTimer(int timer,
+                                void *opaque)
+{
+    virLogHandlerPtr handler = opaque;
+    size_t i;
+
+    virObjectLock(handler);
+
+    for (i = 0; i < handler->nfiles; i++) {
+        virLogHandlerLogFilePtr logfile = handler->files[i];
+
+        if (logfile->timer != timer)
+            continue;
+
+        virLogHandlerLogFileFlush(logfile);
+
+        /* The guest went quiet, don't hold on to a large buffer */
+        VIR_FREE(logfile->buf);
+        logfile->bufalloc = 0;
+        logfile->readlen = VIR_LOG_HANDLER_READ_MIN;
+        break;
+    }
+
+    virObjectUnlock(handler);
+}
+
+
 static void
 virLogHandlerDomainLogFileEvent(int watch,
                                 int fd,
@@ -145,7 +242,7 @@ virLogHandlerDomainLogFileEvent(int watch,
 {
     virLogHandlerPtr handler = opaque;
     virLogHandlerLogFilePtr logfile;
-    char buf[1024];
+    size_t pending;
     ssize_t len;
 
     virObjectLock(handler);
@@ -156,8 +253,14 @@ virLogHandlerDomainLogFileEvent(int watch,
         return;
     }
 
+    if (VIR_RESIZE_N(logfile->buf, logfile->bufalloc,
+                     logfile->buflen, logfile->readlen) < 0)
+        goto error;
+
+    pending = logfile->buflen;
+
  reread:
-    len = read(fd, buf, sizeof(buf));
+    len = read(fd, logfile->buf + logfile->buflen, logfile->readlen);
     if (len < 0) {
         if (errno == EINTR)
             goto reread;
@@ -167,22 +270,62 @@ virLogHandlerDomainLogFileEvent(int watch,
         goto error;
     }
 
-    if (virRotatingFileWriterAppend(logfile->file, buf, len) != len)
-        goto error;
+    logfile->buflen += len;
+    logfile->bytes += len;
+
+    if (len == logfile->readlen &&
+        logfile->readlen < VIR_LOG_HANDLER_READ_MAX)
+        logfile->readlen *= 2;
 
     if (events & VIR_EVENT_HANDLE_HANGUP)
         goto error;
 
+    /* The timer runs from the first byte pending, restarting it on
+     * every read would never let a chatty guest's output be flushed */
+    if (logfile->buflen >= VIR_LOG_HANDLER_FLUSH_SIZE)
+        virLogHandlerLogFileFlush(logfile);
+    else if (logfile->buflen && !pending)
+        virEventUpdateTimeout(logfile->timer, VIR_LOG_HANDLER_FLUSH_DELAY);
+
     virObjectUnlock(handler);
     return;
 
  error:
+    virLogHandlerLogFileFlush(logfile);
     handler->inhibitor(false, handler->opaque);
     virLogHandlerLogFileClose(handler, logfile);
     virObjectUnlock(handler);
 }
 
 
+/*
+ * Registers @file's pipe with the event loop along with the timer
+ * flushing the data read from it
+ */
+static int
+virLogHandlerLogFileWatch(virLogHandlerPtr handler,
+                          virLogHandlerLogFilePtr file)
+{
+    if ((file->timer = virEventAddTimeout(-1,
+                                          virLogHandlerDomainLogFileTimer,
+                                          handler,
+                                          NULL)) < 0)
+        return -1;
+
+    if ((file->watch = virEventAddHandle(file->pipefd,
+                                         VIR_EVENT_HANDLE_READABLE,
+                                         virLogHandlerDomainLogFileEvent,
+                                         handler,
+                                         NULL)) < 0) {
+        virEventRemoveTimeout(file->timer);
+        file->timer = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+
 virLogHandlerPtr
 virLogHandlerNew(bool privileged,
                  size_t max_size,
@@ -223,6 +366,10 @@ virLogHandlerLogFilePostExecRestart(virLogHandlerPtr handler,
     if (VIR_ALLOC(file) < 0)
         return NULL;
 
+    file->watch = -1;
+    file->timer = -1;
+    file->readlen = VIR_LOG_HANDLER_READ_MIN;
+
     handler->inhibitor(true, handler->opaque);
 
     if ((path = virJSONValueObjectGetString(object, "path")) == NULL) {
@@ -276,6 +423,12 @@ virLogHandlerLogFilePostExecRestart(virLogHandlerPtr handler,
         goto error;
     }
 
+    /* Not present if the previous daemon didn't track them yet */
+    ignore_value(virJSONValueObjectGetNumberUlong(object, "bytes",
+                                                  &file->bytes));
+    ignore_value(virJSONValueObjectGetNumberUlong(object, "dropped",
+                                                  &file->dropped));
+
     return file;
 
  error:
@@ -327,11 +480,7 @@ virLogHandlerNewPostExecRestart(virJSONValuePtr object,
         if (VIR_APPEND_ELEMENT_COPY(handler->files, handler->nfiles, file) < 0)
             goto error;
 
-        if ((file->watch = virEventAddHandle(file->pipefd,
-                                             VIR_EVENT_HANDLE_READABLE,
-                                             virLogHandlerDomainLogFileEvent,
-                                             handler,
-                                             NULL)) < 0) {
+        if (virLogHandlerLogFileWatch(handler, file) < 0) {
             VIR_DELETE_ELEMENT(handler->files, handler->nfiles - 1, handler->nfiles);
             goto error;
         }
@@ -354,6 +503,7 @@ virLogHandlerDispose(void *obj)
 
     for (i = 0; i < handler->nfiles; i++) {
         handler->inhibitor(false, handler->opaque);
+        virLogHandlerLogFileFlush(handler->files[i]);
         virLogHandlerLogFileFree(handler->files[i]);
     }
     VIR_FREE(handler->files);
@@ -370,7 +520,6 @@ virLogHandlerDomainOpenLogFile(virLogHandlerPtr handler,
                                ino_t *inode,
                                off_t *offset)
 {
-    size_t i;
     virLogHandlerLogFilePtr file = NULL;
     int pipefd[2] = { -1, -1 };
 
@@ -378,14 +527,11 @@ virLogHandlerDomainOpenLogFile(virLogHandlerPtr handler,
 
     handler->inhibitor(true, handler->opaque);
 
-    for (i = 0; i < handler->nfiles; i++) {
-        if (STREQ(virRotatingFileWriterGetPath(handler->files[i]->file),
-                  path)) {
-            virReportSystemError(EBUSY,
-                                 _("Cannot open log file: '%s'"),
-                                 path);
-            goto error;
-        }
+    if (virLogHandlerGetLogFileFromPath(handler, path)) {
+        virReportSystemError(EBUSY,
+                             _("Cannot open log file: '%s'"),
+                             path);
+        goto error;
     }
 
     if (pipe(pipefd) < 0) {
@@ -397,6 +543,8 @@ virLogHandlerDomainOpenLogFile(virLogHandlerPtr handler,
         goto error;
 
     file->watch = -1;
+    file->timer = -1;
+    file->readlen = VIR_LOG_HANDLER_READ_MIN;
     file->pipefd = pipefd[0];
     pipefd[0] = -1;
     memcpy(file->domuuid, domuuid, VIR_UUID_BUFLEN);
@@ -414,11 +562,7 @@ virLogHandlerDomainOpenLogFile(virLogHandlerPtr handler,
     if (VIR_APPEND_ELEMENT_COPY(handler->files, handler->nfiles, file) < 0)
         goto error;
 
-    if ((file->watch = virEventAddHandle(file->pipefd,
-                                         VIR_EVENT_HANDLE_READABLE,
-                                         virLogHandlerDomainLogFileEvent,
-                                         handler,
-                                         NULL)) < 0) {
+    if (virLogHandlerLogFileWatch(handler, file) < 0) {
         VIR_DELETE_ELEMENT(handler->files, handler->nfiles - 1, handler->nfiles);
         goto error;
     }
@@ -448,27 +592,20 @@ virLogHandlerDomainGetLogFilePosition(virLogHandlerPtr handler,
 {
     virLogHandlerLogFilePtr file = NULL;
     int ret = -1;
-    size_t i;
 
     virCheckFlags(0, -1);
 
     virObjectLock(handler);
 
-    for (i = 0; i < handler->nfiles; i++) {
-        if (STREQ(virRotatingFileWriterGetPath(handler->files[i]->file),
-                  path)) {
-            file = handler->files[i];
-            break;
-        }
-    }
-
-    if (!file) {
+    if (!(file = virLogHandlerGetLogFileFromPath(handler, path))) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("No open log file %s"),
                        path);
         goto cleanup;
     }
 
+    virLogHandlerLogFileFlush(file);
+
     *inode = virRotatingFileWriterGetINode(file->file);
     *offset = virRotatingFileWriterGetOffset(file->file);
 
@@ -489,6 +626,7 @@ virLogHandlerDomainReadLogFile(virLogHandlerPtr handler,
                                unsigned int flags)
 {
     virRotatingFileReaderPtr file = NULL;
+    virLogHandlerLogFilePtr logfile;
     char *data = NULL;
     ssize_t got;
 
@@ -496,6 +634,9 @@ virLogHandlerDomainReadLogFile(virLogHandlerPtr handler,
 
     virObjectLock(handler);
 
+    if ((logfile = virLogHandlerGetLogFileFromPath(handler, path)))
+        virLogHandlerLogFileFlush(logfile);
+
     if (!(file = virRotatingFileReaderNew(path, handler->max_backups)))
         goto error;
 
@@ -531,7 +672,7 @@ virLogHandlerDomainAppendLogFile(virLogHandlerPtr handler,
                                  const char *message,
                                  unsigned int flags)
 {
-    size_t i;
+    virLogHandlerLogFilePtr logfile;
     virRotatingFileWriterPtr writer = NULL;
     virRotatingFileWriterPtr newwriter = NULL;
     int ret = -1;
@@ -542,11 +683,10 @@ virLogHandlerDomainAppendLogFile(virLogHandlerPtr handler,
 
     virObjectLock(handler);
 
-    for (i = 0; i < handler->nfiles; i++) {
-        if (STREQ(virRotatingFileWriterGetPath(handler->files[i]->file), path)) {
-            writer = handler->files[i]->file;
-            break;
-        }
+    /* Keep the message in order with the output already read */
+    if ((logfile = virLogHandlerGetLogFileFromPath(handler, path))) {
+        virLogHandlerLogFileFlush(logfile);
+        writer = logfile->file;
     }
 
     if (!writer) {
@@ -560,7 +700,8 @@ virLogHandlerDomainAppendLogFile(virLogHandlerPtr handler,
         writer = newwriter;
     }
 
-    if (virRotatingFileWriterAppend(writer, message, strlen(message)) < 0)
+    if (virRotatingFileWriterAppend(writer, message,
+                                    strlen(message)) != strlen(message))
         goto cleanup;
 
     ret = 0;
@@ -572,6 +713,38 @@ virLogHandlerDomainAppendLogFile(virLogHandlerPtr handler,
 }
 
 
+int
+virLogHandlerDomainGetLogFileStats(virLogHandlerPtr handler,
+                                   const char *path,
+                                   unsigned int flags,
+                                   unsigned long long *bytes,
+                                   unsigned long long *dropped)
+{
+    virLogHandlerLogFilePtr file;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    virObjectLock(handler);
+
+    if (!(file = virLogHandlerGetLogFileFromPath(handler, path))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("No open log file %s"),
+                       path);
+        goto cleanup;
+    }
+
+    *bytes = file->bytes;
+    *dropped = file->dropped;
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(handler);
+    return ret;
+}
+
+
 virJSONValuePtr
 virLogHandlerPreExecRestart(virLogHandlerPtr handler)
 {
@@ -596,6 +769,9 @@ virLogHandlerPreExecRestart(virLogHandlerPtr handler)
         if (!file)
             goto error;
 
+        /* Whatever is still buffered would be lost across exec */
+        virLogHandlerLogFileFlush(handler->files[i]);
+
         if (virJSONValueArrayAppend(files, file) < 0) {
             virJSONValueFree(file);
             goto error;
@@ -621,6 +797,12 @@ virLogHandlerPreExecRestart(virLogHandlerPtr handler)
         if (virJSONValueObjectAppendString(file, "domuuid", domuuid) < 0)
             goto error;
 
+        if (virJSONValueObjectAppendNumberUlong(file, "bytes",
+                                                handler->files[i]->bytes) < 0 ||
+            virJSONValueObjectAppendNumberUlong(file, "dropped",
+                                                handler->files[i]->dropped) < 0)
+            goto error;
+
         if (virSetInherit(handler->files[i]->pipefd, true) < 0) {
             virReportSystemError(errno, "%s",
                                  _("Cannot disable close-on-exec flag"));
@@ -77,6 +77,12 @@ int virLogHandlerDomainAppendLogFile(virLogHandlerPtr handler,
                                      const char *message,
                                      unsigned int flags);
 
+int virLogHandlerDomainGetLogFileStats(virLogHandlerPtr handler,
+                                       const char *path,
+                                       unsigned int flags,
+                                       unsigned long long *bytes,
+                                       unsigned long long *dropped);
+
 virJSONValuePtr virLogHandlerPreExecRestart(virLogHandlerPtr handler);
 
 #endif /** __VIR_LOG_HANDLER_H__ */
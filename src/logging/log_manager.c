@@ -316,3 +316,38 @@ virLogManagerDomainAppendMessage(virLogManagerPtr mgr,
 
     return ret.ret;
 }
+
+
+int
+virLogManagerDomainGetLogFileStats(virLogManagerPtr mgr,
+                                   const char *path,
+                                   unsigned int flags,
+                                   unsigned long long *bytes,
+                                   unsigned long long *dropped)
+{
+    struct virLogManagerProtocolDomainGetLogFileStatsArgs args;
+    struct virLogManagerProtocolDomainGetLogFileStatsRet ret;
+    int rv = -1;
+
+    memset(&args, 0, sizeof(args));
+    memset(&ret, 0, sizeof(ret));
+
+    args.path = (char *)path;
+    args.flags = flags;
+
+    if (virNetClientProgramCall(mgr->program,
+                                mgr->client,
+                                mgr->serial++,
+                                VIR_LOG_MANAGER_PROTOCOL_PROC_DOMAIN_GET_LOG_FILE_STATS,
+                                0, NULL, NULL, NULL,
+                                (xdrproc_t)xdr_virLogManagerProtocolDomainGetLogFileStatsArgs, &args,
+                                (xdrproc_t)xdr_virLogManagerProtocolDomainGetLogFileStatsRet, &ret) < 0)
+        goto cleanup;
+
+    *bytes = ret.bytes;
+    *dropped = ret.dropped;
+
+    rv = 0;
+ cleanup:
+    return rv;
+}
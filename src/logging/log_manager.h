@@ -65,4 +65,10 @@ int virLogManagerDomainAppendMessage(virLogManagerPtr mgr,
                                      const char *message,
                                      unsigned int flags);
 
+int virLogManagerDomainGetLogFileStats(virLogManagerPtr mgr,
+                                       const char *path,
+                                       unsigned int flags,
+                                       unsigned long long *bytes,
+                                       unsigned long long *dropped);
+
 #endif /* __VIR_LOG_MANAGER_H__ */
@@ -80,6 +80,16 @@ struct virLogManagerProtocolDomainAppendLogFileRet {
     int ret;
 };
 
+struct virLogManagerProtocolDomainGetLogFileStatsArgs {
+    virLogManagerProtocolNonNullString path;
+    unsigned int flags;
+};
+
+struct virLogManagerProtocolDomainGetLogFileStatsRet {
+    unsigned hyper bytes;
+    unsigned hyper dropped;
+};
+
 /* Define the program number, protocol version and procedure numbers here. */
 const VIR_LOG_MANAGER_PROTOCOL_PROGRAM = 0x87539319;
 const VIR_LOG_MANAGER_PROTOCOL_PROGRAM_VERSION = 1;
@@ -133,5 +143,11 @@ enum virLogManagerProtocolProcedure {
      * @generate: none
      * @acl: none
      */
-    VIR_LOG_MANAGER_PROTOCOL_PROC_DOMAIN_APPEND_LOG_FILE = 4
+    VIR_LOG_MANAGER_PROTOCOL_PROC_DOMAIN_APPEND_LOG_FILE = 4,
+
+    /**
+     * @generate: none
+     * @acl: none
+     */
+    VIR_LOG_MANAGER_PROTOCOL_PROC_DOMAIN_GET_LOG_FILE_STATS = 5
 };
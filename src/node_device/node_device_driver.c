@@ -154,6 +154,25 @@ void nodeDeviceUnlock(void)
     virMutexUnlock(&driver->lock);
 }
 
+
+/* Waits until the backend knows the devices present at startup, so
+ * that listing them does not return a partial result */
+static int
+nodeDeviceWaitInit(void)
+{
+    nodeDeviceLock();
+    while (!driver->initialized) {
+        if (virCondWait(&driver->initCond, &driver->lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait on condition"));
+            nodeDeviceUnlock();
+            return -1;
+        }
+    }
+    nodeDeviceUnlock();
+    return 0;
+}
+
 int
 nodeNumOfDevices(virConnectPtr conn,
                  const char *cap,
@@ -167,6 +186,9 @@ nodeNumOfDevices(virConnectPtr conn,
 
     virCheckFlags(0, -1);
 
+    if (nodeDeviceWaitInit() < 0)
+        return -1;
+
     nodeDeviceLock();
     for (i = 0; i < driver->devs.count; i++) {
         virNodeDeviceObjPtr obj = driver->devs.objs[i];
@@ -196,6 +218,9 @@ nodeListDevices(virConnectPtr conn,
 
     virCheckFlags(0, -1);
 
+    if (nodeDeviceWaitInit() < 0)
+        return -1;
+
     nodeDeviceLock();
     for (i = 0; i < driver->devs.count && ndevs < maxnames; i++) {
         virNodeDeviceObjPtr obj = driver->devs.objs[i];
@@ -234,6 +259,9 @@ nodeConnectListAllNodeDevices(virConnectPtr conn,
     if (virConnectListAllNodeDevicesEnsureACL(conn) < 0)
         return -1;
 
+    if (nodeDeviceWaitInit() < 0)
+        return -1;
+
     nodeDeviceLock();
     ret = virNodeDeviceObjListExport(conn, driver->devs, devices,
                                      virConnectListAllNodeDevicesCheckACL,
@@ -248,6 +276,9 @@ nodeDeviceLookupByName(virConnectPtr conn, const char *name)
     virNodeDeviceObjPtr obj;
     virNodeDevicePtr ret = NULL;
 
+    if (nodeDeviceWaitInit() < 0)
+        return NULL;
+
     nodeDeviceLock();
     obj = virNodeDeviceObjFindByName(&driver->devs, name);
     nodeDeviceUnlock();
@@ -288,6 +319,9 @@ nodeDeviceLookupSCSIHostByWWN(virConnectPtr conn,
 
     virCheckFlags(0, NULL);
 
+    if (nodeDeviceWaitInit() < 0)
+        return NULL;
+
     nodeDeviceLock();
 
     for (i = 0; i < devs->count; i++) {
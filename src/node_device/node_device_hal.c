@@ -493,15 +493,15 @@ dev_create(const char *udi)
     /* Some devices don't have a path in sysfs, so ignore failure */
     (void)get_str_prop(ctx, udi, "linux.sysfs_path", &devicePath);
 
+    /* The sysfs path is indexed, so it must be set before assigning */
+    def->sysfs_path = devicePath;
+
     dev = virNodeDeviceObjAssignDef(&driver->devs, def);
-    if (!dev) {
-        VIR_FREE(devicePath);
+    if (!dev)
         goto failure;
-    }
 
     dev->privateData = privData;
     dev->privateFree = free_udi;
-    dev->def->sysfs_path = devicePath;
 
     virNodeDeviceObjUnlock(dev);
 
@@ -635,6 +635,13 @@ nodeStateInitialize(bool privileged ATTRIBUTE_UNUSED,
         VIR_FREE(driver);
         return -1;
     }
+    if (virCondInit(&driver->initCond) < 0) {
+        virMutexDestroy(&driver->lock);
+        VIR_FREE(driver);
+        return -1;
+    }
+    /* HAL devices are enumerated before this function returns */
+    driver->initialized = true;
     nodeDeviceLock();
 
     dbus_error_init(&err);
@@ -715,6 +722,7 @@ nodeStateInitialize(bool privileged ATTRIBUTE_UNUSED,
     if (hal_ctx)
         (void)libhal_ctx_free(hal_ctx);
     nodeDeviceUnlock();
+    virCondDestroy(&driver->initCond);
     VIR_FREE(driver);
 
     return ret;
@@ -731,6 +739,7 @@ nodeStateCleanup(void)
         (void)libhal_ctx_shutdown(hal_ctx, NULL);
         (void)libhal_ctx_free(hal_ctx);
         nodeDeviceUnlock();
+        virCondDestroy(&driver->initCond);
         virMutexDestroy(&driver->lock);
         VIR_FREE(driver);
         return 0;
@@ -56,6 +56,11 @@ struct _udevPrivate {
     struct udev_monitor *udev_monitor;
     int watch;
     bool privileged;
+
+    /* Enumeration of the devices present at startup */
+    virThread enumerateThread;
+    bool enumerateStarted;
+    bool enumerateQuit;     /* asks the enumeration to stop early */
 };
 
 
@@ -1170,7 +1175,10 @@ static int udevSetParent(struct udev_device *device,
 }
 
 
-static int udevAddOneDevice(struct udev_device *device)
+/* @enumerated is true for devices found by the enumeration of those
+ * present at startup, which were not created but there already */
+static int udevAddOneDevice(struct udev_device *device,
+                            bool enumerated)
 {
     virNodeDeviceDefPtr def = NULL;
     virNodeDeviceObjPtr dev = NULL;
@@ -1214,12 +1222,14 @@ static int udevAddOneDevice(struct udev_device *device)
     if (dev == NULL)
         goto cleanup;
 
-    if (new_device)
-        event = virNodeDeviceEventLifecycleNew(dev->def->name,
-                                               VIR_NODE_DEVICE_EVENT_CREATED,
-                                               0);
-    else
-        event = virNodeDeviceEventUpdateNew(dev->def->name);
+    if (!enumerated) {
+        if (new_device)
+            event = virNodeDeviceEventLifecycleNew(dev->def->name,
+                                                   VIR_NODE_DEVICE_EVENT_CREATED,
+                                                   0);
+        else
+            event = virNodeDeviceEventUpdateNew(dev->def->name);
+    }
 
     virNodeDeviceObjUnlock(dev);
 
@@ -1251,7 +1261,7 @@ static int udevProcessDeviceListEntry(struct udev *udev,
     device = udev_device_new_from_syspath(udev, name);
 
     if (device != NULL) {
-        if (udevAddOneDevice(device) != 0) {
+        if (udevAddOneDevice(device, true) != 0) {
             VIR_DEBUG("Failed to create node device for udev device '%s'",
                       name);
         }
@@ -1289,6 +1299,7 @@ static int udevEnumerateAddMatches(struct udev_enumerate *udev_enumerate)
 
 static int udevEnumerateDevices(struct udev *udev)
 {
+    udevPrivate *priv = driver->privateData;
     struct udev_enumerate *udev_enumerate = NULL;
     struct udev_list_entry *list_entry = NULL;
     int ret = -1;
@@ -1305,10 +1316,17 @@ static int udevEnumerateDevices(struct udev *udev)
         goto cleanup;
     }
 
+    /* The driver is locked per device only, so that udev events and
+     * API calls are served while the enumeration is going on */
     udev_list_entry_foreach(list_entry,
                             udev_enumerate_get_list_entry(udev_enumerate)) {
-
+        nodeDeviceLock();
+        if (priv->enumerateQuit) {
+            nodeDeviceUnlock();
+            break;
+        }
         udevProcessDeviceListEntry(udev, list_entry);
+        nodeDeviceUnlock();
     }
 
  cleanup:
@@ -1317,6 +1335,26 @@ static int udevEnumerateDevices(struct udev *udev)
 }
 
 
+/* Adds the devices present at startup in the background, so that
+ * the daemon initialization does not wait for them. @opaque is the
+ * udev context to use, which is released once done. */
+static void udevEnumerateDevicesThread(void *opaque)
+{
+    struct udev *udev = opaque;
+
+    if (udevEnumerateDevices(udev) != 0)
+        VIR_ERROR(_("Failed to enumerate node devices: %s"),
+                  virGetLastErrorMessage());
+
+    udev_unref(udev);
+
+    nodeDeviceLock();
+    driver->initialized = true;
+    virCondBroadcast(&driver->initCond);
+    nodeDeviceUnlock();
+}
+
+
 static void udevPCITranslateDeinit(void)
 {
 #if defined __s390__ || defined __s390x_
@@ -1338,12 +1376,19 @@ static int nodeStateCleanup(void)
     if (!driver)
         return -1;
 
+    priv = driver->privateData;
+
+    if (priv && priv->enumerateStarted) {
+        nodeDeviceLock();
+        priv->enumerateQuit = true;
+        nodeDeviceUnlock();
+        virThreadJoin(&priv->enumerateThread);
+    }
+
     nodeDeviceLock();
 
     virObjectUnref(driver->nodeDeviceEventState);
 
-    priv = driver->privateData;
-
     if (priv) {
         if (priv->watch != -1)
             virEventRemoveHandle(priv->watch);
@@ -1361,6 +1406,7 @@ static int nodeStateCleanup(void)
 
     virNodeDeviceObjListFree(&driver->devs);
     nodeDeviceUnlock();
+    virCondDestroy(&driver->initCond);
     virMutexDestroy(&driver->lock);
     VIR_FREE(driver);
     VIR_FREE(priv);
@@ -1401,7 +1447,7 @@ static void udevEventHandleCallback(int watch ATTRIBUTE_UNUSED,
     VIR_DEBUG("udev action: '%s'", action);
 
     if (STREQ(action, "add") || STREQ(action, "change")) {
-        udevAddOneDevice(device);
+        udevAddOneDevice(device, false);
         goto cleanup;
     }
 
@@ -1536,6 +1582,7 @@ static int nodeStateInitialize(bool privileged,
 {
     udevPrivate *priv = NULL;
     struct udev *udev = NULL;
+    struct udev *enumerate_udev = NULL;
     int ret = -1;
 
     if (VIR_ALLOC(priv) < 0)
@@ -1557,6 +1604,15 @@ static int nodeStateInitialize(bool privileged,
         return -1;
     }
 
+    if (virCondInit(&driver->initCond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        virMutexDestroy(&driver->lock);
+        VIR_FREE(priv);
+        VIR_FREE(driver);
+        return -1;
+    }
+
     driver->privateData = priv;
     nodeDeviceLock();
     driver->nodeDeviceEventState = virObjectEventStateNew();
@@ -1602,10 +1658,26 @@ static int nodeStateInitialize(bool privileged,
     if (udevSetupSystemDev() != 0)
         goto cleanup;
 
-    /* Populate with known devices */
+    /* Populate with known devices in the background. The enumeration
+     * gets a udev context of its own, they are not thread safe. */
+    enumerate_udev = udev_new();
+    if (!enumerate_udev) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("failed to create udev context"));
+        goto cleanup;
+    }
+#if HAVE_UDEV_LOGGING
+    udev_set_log_fn(enumerate_udev, (udevLogFunctionPtr) udevLogFunction);
+#endif
 
-    if (udevEnumerateDevices(udev) != 0)
+    if (virThreadCreate(&priv->enumerateThread, true,
+                        udevEnumerateDevicesThread, enumerate_udev) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to create udev enumeration thread"));
+        udev_unref(enumerate_udev);
         goto cleanup;
+    }
+    priv->enumerateStarted = true;
 
     ret = 0;
 
@@ -42,6 +42,8 @@
 #include "virhostcpu.h"
 #include "qemu_monitor.h"
 #include "virstring.h"
+#include "virtime.h"
+#include "viratomic.h"
 #include "qemu_hostdev.h"
 #include "qemu_domain.h"
 #define __QEMU_CAPSRIV_H_ALLOW__
@@ -411,6 +413,24 @@ struct _virQEMUCaps {
      */
     virCPUDefPtr kvmCPUModel;
     virCPUDefPtr tcgCPUModel;
+
+    /* Modification time of @binary, checked together with @ctime */
+    time_t mtime;
+
+    /* Whether /dev/kvm was usable by runUid:runGid when
+     * virQEMUCapsIsValid last checked it and the identity of /dev/kvm
+     * at that time. Checking the access may require forking a process
+     * running as runUid, so the result is reused until /dev/kvm is
+     * replaced or its permissions change. */
+    bool kvmChecked;
+    bool kvmUsable;
+    bool kvmExists;
+    ino_t kvmIno;
+    time_t kvmCtime;
+
+    /* When virQEMUCapsIsValid last found the capabilities valid after
+     * checking @binary and /dev/kvm, see VIR_QEMU_CAPS_VALID_INTERVAL */
+    unsigned long long validChecked;
 };
 
 struct virQEMUCapsSearchData {
@@ -866,6 +886,37 @@ virQEMUCapsFindBinaryForArch(virArch hostarch,
     return ret;
 }
 
+#define VIR_QEMU_CAPS_KVM_BINARIES 4
+
+/* Fills @kvmbins with the names of qemu-kvm/kvm binaries to look for
+ * when @guestarch is native to @hostarch. Unused items are NULL. */
+static void
+virQEMUCapsGetKVMBinaries(virArch hostarch,
+                          virArch guestarch,
+                          const char **kvmbins)
+{
+    kvmbins[0] = "/usr/libexec/qemu-kvm"; /* RHEL */
+    kvmbins[1] = "qemu-kvm"; /* Fedora */
+    kvmbins[2] = "kvm"; /* Debian/Ubuntu */
+    kvmbins[3] = NULL;
+
+    /* x86 32-on-64 can be used with qemu-system-i386 and
+     * qemu-system-x86_64, so if we don't find a specific kvm binary,
+     * we can just fall back to the host arch native binary and
+     * everything works fine.
+     *
+     * arm is different in that 32-on-64 _only_ works with
+     * qemu-system-aarch64. So we have to add it to the kvmbins list
+     */
+    if (hostarch == VIR_ARCH_AARCH64 && guestarch == VIR_ARCH_ARMV7L)
+        kvmbins[3] = "qemu-system-aarch64";
+}
+
+static void
+virQEMUCapsCachePrefetch(virCapsPtr caps,
+                         virQEMUCapsCachePtr cache,
+                         virArch hostarch);
+
 static int
 virQEMUCapsInitGuest(virCapsPtr caps,
                      virQEMUCapsCachePtr cache,
@@ -899,23 +950,9 @@ virQEMUCapsInitGuest(virCapsPtr caps,
      *  - hostarch and guestarch are both ppc64*
      */
     if (virQEMUCapsGuestIsNative(hostarch, guestarch)) {
-        const char *kvmbins[] = {
-            "/usr/libexec/qemu-kvm", /* RHEL */
-            "qemu-kvm", /* Fedora */
-            "kvm", /* Debian/Ubuntu */
-            NULL,
-        };
-
-        /* x86 32-on-64 can be used with qemu-system-i386 and
-         * qemu-system-x86_64, so if we don't find a specific kvm binary,
-         * we can just fall back to the host arch native binary and
-         * everything works fine.
-         *
-         * arm is different in that 32-on-64 _only_ works with
-         * qemu-system-aarch64. So we have to add it to the kvmbins list
-         */
-        if (hostarch == VIR_ARCH_AARCH64 && guestarch == VIR_ARCH_ARMV7L)
-            kvmbins[3] = "qemu-system-aarch64";
+        const char *kvmbins[VIR_QEMU_CAPS_KVM_BINARIES];
+
+        virQEMUCapsGetKVMBinaries(hostarch, guestarch, kvmbins);
 
         for (i = 0; i < ARRAY_CARDINALITY(kvmbins); ++i) {
             if (!kvmbins[i])
@@ -1166,6 +1203,11 @@ virCapsPtr virQEMUCapsInit(virQEMUCapsCachePtr cache)
     virCapabilitiesAddHostMigrateTransport(caps, "tcp");
     virCapabilitiesAddHostMigrateTransport(caps, "rdma");
 
+    /* Probing a binary means running it, so probe all the binaries
+     * which are not cached yet at once. The lookups below then only
+     * need to find them in the cache. */
+    virQEMUCapsCachePrefetch(caps, cache, hostarch);
+
     /* QEMU can support pretty much every arch that exists,
      * so just probe for them all - we gracefully fail
      * if a qemu-system-$ARCH binary can't be found
@@ -2137,6 +2179,7 @@ virQEMUCapsPtr virQEMUCapsNewCopy(virQEMUCapsPtr qemuCaps)
         goto error;
 
     ret->ctime = qemuCaps->ctime;
+    ret->mtime = qemuCaps->mtime;
 
     virBitmapCopy(ret->flags, qemuCaps->flags);
 
@@ -4651,6 +4694,8 @@ virQEMUCapsInitQMPCommandFree(virQEMUCapsInitQMPCommandPtr cmd)
 }
 
 
+static int virQEMUCapsProbeID;
+
 static virQEMUCapsInitQMPCommandPtr
 virQEMUCapsInitQMPCommandNew(char *binary,
                              const char *libDir,
@@ -4659,6 +4704,7 @@ virQEMUCapsInitQMPCommandNew(char *binary,
                              char **qmperr)
 {
     virQEMUCapsInitQMPCommandPtr cmd = NULL;
+    int id;
 
     if (VIR_ALLOC(cmd) < 0)
         goto error;
@@ -4670,11 +4716,15 @@ virQEMUCapsInitQMPCommandNew(char *binary,
     cmd->runGid = runGid;
     cmd->qmperr = qmperr;
 
+    /* Several binaries may be probed at the same time, each needs its
+     * own monitor socket and pidfile */
+    id = virAtomicIntInc(&virQEMUCapsProbeID);
+
     /* the ".sock" sufix is important to avoid a possible clash with a qemu
      * domain called "capabilities"
      */
-    if (virAsprintf(&cmd->monpath, "%s/%s", libDir,
-                    "capabilities.monitor.sock") < 0)
+    if (virAsprintf(&cmd->monpath, "%s/capabilities-%d.monitor.sock",
+                    libDir, id) < 0)
         goto error;
     if (virAsprintf(&cmd->monarg, "unix:%s,server,nowait", cmd->monpath) < 0)
         goto error;
@@ -4685,7 +4735,8 @@ virQEMUCapsInitQMPCommandNew(char *binary,
      * -daemonize we need QEMU to be allowed to create them, rather
      * than libvirtd. So we're using libDir which QEMU can write to
      */
-    if (virAsprintf(&cmd->pidfile, "%s/%s", libDir, "capabilities.pidfile") < 0)
+    if (virAsprintf(&cmd->pidfile, "%s/capabilities-%d.pidfile",
+                    libDir, id) < 0)
         goto error;
 
     virPidFileForceCleanupPath(cmd->pidfile);
@@ -4881,6 +4932,7 @@ virQEMUCapsNewForBinaryInternal(virCapsPtr caps,
         goto error;
     }
     qemuCaps->ctime = sb.st_ctime;
+    qemuCaps->mtime = sb.st_mtime;
 
     /* Make sure the binary we are about to try exec'ing exists.
      * Technically we could catch the exec() failure, but that's
@@ -4949,12 +5001,47 @@ virQEMUCapsNewForBinary(virCapsPtr caps,
 }
 
 
+/* Checks whether /dev/kvm can be used by runUid:runGid, reusing the
+ * result of the previous check if /dev/kvm didn't change since then */
+static bool
+virQEMUCapsKVMUsable(virQEMUCapsPtr qemuCaps,
+                     uid_t runUid,
+                     gid_t runGid)
+{
+    struct stat sb;
+    bool exists = stat("/dev/kvm", &sb) == 0;
+
+    if (qemuCaps->kvmChecked &&
+        qemuCaps->kvmExists == exists &&
+        (!exists ||
+         (qemuCaps->kvmIno == sb.st_ino &&
+          qemuCaps->kvmCtime == sb.st_ctime)))
+        return qemuCaps->kvmUsable;
+
+    qemuCaps->kvmUsable = exists &&
+        virFileAccessibleAs("/dev/kvm", R_OK | W_OK, runUid, runGid) == 0;
+    qemuCaps->kvmExists = exists;
+    qemuCaps->kvmIno = exists ? sb.st_ino : 0;
+    qemuCaps->kvmCtime = exists ? sb.st_ctime : 0;
+    qemuCaps->kvmChecked = true;
+
+    return qemuCaps->kvmUsable;
+}
+
+
+/* Capabilities found valid are trusted for this long (in milliseconds)
+ * without checking the binary and /dev/kvm again, since domain startup
+ * looks them up several times in a row */
+#define VIR_QEMU_CAPS_VALID_INTERVAL 1000
+
 bool
 virQEMUCapsIsValid(virQEMUCapsPtr qemuCaps,
                    time_t qemuctime,
                    uid_t runUid,
                    gid_t runGid)
 {
+    time_t qemumtime = 0;
+    unsigned long long now = 0;
     bool kvmUsable;
 
     if (!qemuCaps->binary)
@@ -4963,6 +5050,12 @@ virQEMUCapsIsValid(virQEMUCapsPtr qemuCaps,
     if (!qemuctime) {
         struct stat sb;
 
+        if (virTimeMillisNowRaw(&now) == 0 &&
+            qemuCaps->validChecked &&
+            now >= qemuCaps->validChecked &&
+            now - qemuCaps->validChecked < VIR_QEMU_CAPS_VALID_INTERVAL)
+            return true;
+
         if (stat(qemuCaps->binary, &sb) < 0) {
             char ebuf[1024];
             VIR_DEBUG("Failed to stat QEMU binary '%s': %s",
@@ -4971,9 +5064,11 @@ virQEMUCapsIsValid(virQEMUCapsPtr qemuCaps,
             return false;
         }
         qemuctime = sb.st_ctime;
+        qemumtime = sb.st_mtime;
     }
 
-    if (qemuctime != qemuCaps->ctime) {
+    if (qemuctime != qemuCaps->ctime ||
+        (qemumtime && qemuCaps->mtime && qemumtime != qemuCaps->mtime)) {
         VIR_DEBUG("Outdated capabilities for '%s': QEMU binary changed "
                   "(%lld vs %lld)",
                   qemuCaps->binary,
@@ -4981,8 +5076,7 @@ virQEMUCapsIsValid(virQEMUCapsPtr qemuCaps,
         return false;
     }
 
-    kvmUsable = virFileAccessibleAs("/dev/kvm", R_OK | W_OK,
-                                    runUid, runGid) == 0;
+    kvmUsable = virQEMUCapsKVMUsable(qemuCaps, runUid, runGid);
 
     if (!virQEMUCapsGet(qemuCaps, QEMU_CAPS_KVM) &&
         virQEMUCapsGet(qemuCaps, QEMU_CAPS_ENABLE_KVM) &&
@@ -5001,6 +5095,7 @@ virQEMUCapsIsValid(virQEMUCapsPtr qemuCaps,
         return false;
     }
 
+    qemuCaps->validChecked = now;
     return true;
 }
 
@@ -5111,6 +5206,233 @@ virQEMUCapsCacheValidate(virQEMUCapsCachePtr cache,
 
 const char *qemuTestCapsName;
 
+
+struct virQEMUCapsProbeData {
+    virMutex lock;
+    virQEMUCapsCachePtr cache;
+    virQEMUCapsProbeFunc probe;
+    void *opaque;
+    char **binaries;
+    virQEMUCapsPtr *results;
+    size_t nbinaries;
+    size_t next;
+};
+
+
+static void
+virQEMUCapsProbeWorker(void *opaque)
+{
+    struct virQEMUCapsProbeData *data = opaque;
+
+    for (;;) {
+        size_t i;
+
+        virMutexLock(&data->lock);
+        i = data->next++;
+        virMutexUnlock(&data->lock);
+
+        if (i >= data->nbinaries)
+            break;
+
+        VIR_DEBUG("Probing capabilities of %s", data->binaries[i]);
+        if (!(data->results[i] = data->probe(data->cache, data->binaries[i],
+                                             data->opaque)))
+            virResetLastError();
+    }
+}
+
+
+/**
+ * virQEMUCapsCacheProbe:
+ * @cache: the capabilities cache
+ * @binaries: QEMU binaries to probe
+ * @nbinaries: number of items in @binaries
+ * @probe: callback probing a single binary
+ * @opaque: data passed to @probe
+ *
+ * Probes those of @binaries which don't have valid capabilities in
+ * @cache concurrently, using at most VIR_QEMU_CAPS_PROBE_WORKERS threads,
+ * and puts the results into @cache. A single binary is left to the
+ * lookup. Failures are ignored here, they are reported when the binary
+ * is looked up.
+ */
+void
+virQEMUCapsCacheProbe(virQEMUCapsCachePtr cache,
+                      char **binaries,
+                      size_t nbinaries,
+                      virQEMUCapsProbeFunc probe,
+                      void *opaque)
+{
+    struct virQEMUCapsProbeData data = {
+        .cache = cache, .probe = probe, .opaque = opaque,
+    };
+    virThread *threads = NULL;
+    size_t nthreads = 0;
+    bool locked = false;
+    size_t i;
+
+    if (nbinaries < 2)
+        return;
+
+    if (VIR_ALLOC_N_QUIET(data.binaries, nbinaries) < 0)
+        goto cleanup;
+
+    virMutexLock(&cache->lock);
+    for (i = 0; i < nbinaries; i++) {
+        virQEMUCapsPtr qemuCaps = virHashLookup(cache->binaries, binaries[i]);
+
+        if (qemuCaps &&
+            virQEMUCapsIsValid(qemuCaps, 0, cache->runUid, cache->runGid))
+            continue;
+
+        data.binaries[data.nbinaries++] = binaries[i];
+    }
+    virMutexUnlock(&cache->lock);
+
+    /* A single probe is done by the lookup itself */
+    if (data.nbinaries < 2)
+        goto cleanup;
+
+    if (VIR_ALLOC_N_QUIET(data.results, data.nbinaries) < 0 ||
+        VIR_ALLOC_N_QUIET(threads, VIR_QEMU_CAPS_PROBE_WORKERS - 1) < 0)
+        goto cleanup;
+
+    if (virMutexInit(&data.lock) < 0)
+        goto cleanup;
+    locked = true;
+
+    VIR_DEBUG("Probing %zu QEMU binaries", data.nbinaries);
+
+    /* The current thread is one of the workers */
+    while (nthreads < VIR_QEMU_CAPS_PROBE_WORKERS - 1 &&
+           nthreads < data.nbinaries - 1) {
+        if (virThreadCreate(&threads[nthreads], true,
+                            virQEMUCapsProbeWorker, &data) < 0) {
+            VIR_WARN("Failed to create QEMU capabilities probing thread");
+            break;
+        }
+        nthreads++;
+    }
+
+    virQEMUCapsProbeWorker(&data);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    virMutexLock(&cache->lock);
+    for (i = 0; i < data.nbinaries; i++) {
+        virQEMUCapsPtr qemuCaps;
+
+        if (!data.results[i])
+            continue;
+
+        /* Replace stale capabilities, but not ones somebody looked up
+         * while we were probing */
+        qemuCaps = virHashLookup(cache->binaries, data.binaries[i]);
+        if (qemuCaps &&
+            virQEMUCapsIsValid(qemuCaps, 0, cache->runUid, cache->runGid))
+            continue;
+
+        VIR_DEBUG("Caching capabilities %p for %s",
+                  data.results[i], data.binaries[i]);
+        if (virHashUpdateEntry(cache->binaries, data.binaries[i],
+                               data.results[i]) < 0) {
+            virResetLastError();
+            continue;
+        }
+        data.results[i] = NULL;
+    }
+    virMutexUnlock(&cache->lock);
+
+ cleanup:
+    if (locked)
+        virMutexDestroy(&data.lock);
+    for (i = 0; data.results && i < data.nbinaries; i++)
+        virObjectUnref(data.results[i]);
+    VIR_FREE(data.results);
+    VIR_FREE(data.binaries);
+    VIR_FREE(threads);
+}
+
+
+static virQEMUCapsPtr
+virQEMUCapsCacheProbeBinary(virQEMUCapsCachePtr cache,
+                            const char *binary,
+                            void *opaque)
+{
+    virCapsPtr caps = opaque;
+
+    return virQEMUCapsNewForBinary(caps, binary, cache->libDir,
+                                   cache->cacheDir, cache->runUid,
+                                   cache->runGid);
+}
+
+
+/* Appends @binary to @binaries unless it's there already */
+static void
+virQEMUCapsAddBinary(char ***binaries,
+                     size_t *nbinaries,
+                     char *binary)
+{
+    size_t i;
+
+    for (i = 0; i < *nbinaries; i++) {
+        if (STREQ((*binaries)[i], binary)) {
+            VIR_FREE(binary);
+            return;
+        }
+    }
+
+    if (VIR_APPEND_ELEMENT_QUIET(*binaries, *nbinaries, binary) < 0)
+        VIR_FREE(binary);
+}
+
+
+/**
+ * virQEMUCapsCachePrefetch:
+ *
+ * Finds every binary virQEMUCapsInitGuest may look up and probes them
+ * all at once using virQEMUCapsCacheProbe.
+ */
+static void
+virQEMUCapsCachePrefetch(virCapsPtr caps,
+                         virQEMUCapsCachePtr cache,
+                         virArch hostarch)
+{
+    char **binaries = NULL;
+    size_t nbinaries = 0;
+    size_t i;
+    size_t j;
+
+    /* This is used only by test suite!!! */
+    if (qemuTestCapsName)
+        return;
+
+    for (i = 0; i < VIR_ARCH_LAST; i++) {
+        char *binary;
+
+        if ((binary = virQEMUCapsFindBinaryForArch(hostarch, i)))
+            virQEMUCapsAddBinary(&binaries, &nbinaries, binary);
+
+        if (virQEMUCapsGuestIsNative(hostarch, i)) {
+            const char *kvmbins[VIR_QEMU_CAPS_KVM_BINARIES];
+
+            virQEMUCapsGetKVMBinaries(hostarch, i, kvmbins);
+            for (j = 0; j < ARRAY_CARDINALITY(kvmbins); j++) {
+                if (kvmbins[j] && (binary = virFindFileInPath(kvmbins[j])))
+                    virQEMUCapsAddBinary(&binaries, &nbinaries, binary);
+            }
+        }
+    }
+
+    virQEMUCapsCacheProbe(cache, binaries, nbinaries,
+                          virQEMUCapsCacheProbeBinary, caps);
+
+    for (i = 0; i < nbinaries; i++)
+        VIR_FREE(binaries[i]);
+    VIR_FREE(binaries);
+}
+
 virQEMUCapsPtr
 virQEMUCapsCacheLookup(virCapsPtr caps,
                        virQEMUCapsCachePtr cache,
@@ -37,6 +37,20 @@ struct _virQEMUCapsCache {
     gid_t runGid;
 };
 
+/* Maximum number of binaries probed at the same time */
+# define VIR_QEMU_CAPS_PROBE_WORKERS 4
+
+typedef virQEMUCapsPtr (*virQEMUCapsProbeFunc)(virQEMUCapsCachePtr cache,
+                                               const char *binary,
+                                               void *opaque);
+
+void
+virQEMUCapsCacheProbe(virQEMUCapsCachePtr cache,
+                      char **binaries,
+                      size_t nbinaries,
+                      virQEMUCapsProbeFunc probe,
+                      void *opaque);
+
 virQEMUCapsPtr virQEMUCapsNewCopy(virQEMUCapsPtr qemuCaps);
 
 virQEMUCapsPtr
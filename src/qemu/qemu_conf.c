@@ -318,6 +318,12 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
     cfg->glusterDebugLevel = 4;
     cfg->stdioLogD = true;
 
+    cfg->statsParallelWorkers = 4;
+    cfg->statsParallelTimeout = 5;
+    cfg->statsSampleInterval = 10;
+
+    cfg->reconnectWorkers = 8;
+
     if (!(cfg->namespaces = virBitmapNew(QEMU_DOMAIN_NS_LAST)))
         goto error;
 
@@ -669,6 +675,9 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         goto cleanup;
     if (virConfGetValueString(conf, "snapshot_image_format", &cfg->snapshotImageFormat) < 0)
         goto cleanup;
+    if (virConfGetValueUInt(conf, "image_compression_threads",
+                            &cfg->imageCompressionThreads) < 0)
+        goto cleanup;
 
     if (virConfGetValueString(conf, "auto_dump_path", &cfg->autoDumpPath) < 0)
         goto cleanup;
@@ -856,6 +865,33 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     if (virConfGetValueString(conf, "memory_backing_dir", &cfg->memoryBackingDir) < 0)
         goto cleanup;
 
+    if (virConfGetValueUInt(conf, "stats_parallel_workers",
+                            &cfg->statsParallelWorkers) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "stats_parallel_timeout",
+                            &cfg->statsParallelTimeout) < 0)
+        goto cleanup;
+    if (cfg->statsParallelWorkers && !cfg->statsParallelTimeout) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("stats_parallel_timeout must be greater than 0"));
+        goto cleanup;
+    }
+    if (virConfGetValueUInt(conf, "stats_sample_interval",
+                            &cfg->statsSampleInterval) < 0)
+        goto cleanup;
+
+    if (virConfGetValueUInt(conf, "reconnect_workers",
+                            &cfg->reconnectWorkers) < 0)
+        goto cleanup;
+    if (!cfg->reconnectWorkers) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("reconnect_workers must be greater than 0"));
+        goto cleanup;
+    }
+
+    if (virConfGetValueBool(conf, "status_journal", &cfg->statusJournal) < 0)
+        goto cleanup;
+
     ret = 0;
 
  cleanup:
@@ -887,8 +923,19 @@ virQEMUDriverIsPrivileged(virQEMUDriverPtr driver)
 virDomainXMLOptionPtr
 virQEMUDriverCreateXMLConf(virQEMUDriverPtr driver)
 {
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    virDomainDefParserConfig config;
+
     virQEMUDriverDomainDefParserConfig.priv = driver;
-    return virDomainXMLOptionNew(&virQEMUDriverDomainDefParserConfig,
+
+    /* The journal is a per-driver setting, keep it out of the shared
+     * parser config */
+    config = virQEMUDriverDomainDefParserConfig;
+    if (cfg->statusJournal)
+        config.features |= VIR_DOMAIN_DEF_FEATURE_STATUS_JOURNAL;
+    virObjectUnref(cfg);
+
+    return virDomainXMLOptionNew(&config,
                                  &virQEMUDriverPrivateDataCallbacks,
                                  &virQEMUDriverDomainXMLNamespace);
 }
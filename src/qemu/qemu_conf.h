@@ -45,6 +45,7 @@
 # include "virthreadpool.h"
 # include "locking/lock_manager.h"
 # include "qemu_capabilities.h"
+# include "qemu_stats_sampler.h"
 # include "virclosecallbacks.h"
 # include "virhostdev.h"
 # include "virfile.h"
@@ -171,6 +172,7 @@ struct _virQEMUDriverConfig {
     char *saveImageFormat;
     char *dumpImageFormat;
     char *snapshotImageFormat;
+    unsigned int imageCompressionThreads;
 
     char *autoDumpPath;
     bool autoDumpBypassCache;
@@ -197,6 +199,14 @@ struct _virQEMUDriverConfig {
     unsigned int glusterDebugLevel;
 
     char *memoryBackingDir;
+
+    unsigned int statsParallelWorkers;
+    unsigned int statsParallelTimeout;
+    unsigned int statsSampleInterval;
+
+    unsigned int reconnectWorkers;
+
+    bool statusJournal;
 };
 
 /* Main driver state */
@@ -210,6 +220,14 @@ struct _virQEMUDriver {
     /* Immutable pointer, self-locking APIs */
     virThreadPoolPtr workerPool;
 
+    /* Immutable pointer, self-locking APIs. NULL if parallel
+     * stats collection is disabled */
+    virThreadPoolPtr statsPool;
+
+    /* Immutable pointer, self-locking APIs. Periodic sampling of
+     * domain stats for virConnectDomainStatsEventRegister */
+    qemuStatsSamplerPtr statsSampler;
+
     /* Atomic increment only */
     int lastvmid;
 
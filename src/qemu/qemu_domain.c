@@ -378,6 +378,53 @@ qemuDomainJobInfoToInfo(qemuDomainJobInfoPtr jobInfo,
     return 0;
 }
 
+/* Bytes per second from @bytes transferred in @ms milliseconds */
+static unsigned long long
+qemuDomainJobInfoBPS(unsigned long long bytes,
+                     unsigned long long ms)
+{
+    if (!ms)
+        return 0;
+    return bytes * 1000 / ms;
+}
+
+
+static int
+qemuDomainJobInfoCompressToParams(virCompressStatsPtr stats,
+                                  virTypedParameterPtr *par,
+                                  int *npar,
+                                  int *maxpar)
+{
+    /* The workers run in parallel, their time is summed up */
+    unsigned long long compressTime = stats->processTime / stats->workers;
+
+    if (virTypedParamsAddUInt(par, npar, maxpar,
+                              VIR_DOMAIN_JOB_IMAGE_COMPRESS_THREADS,
+                              stats->workers) < 0 ||
+        virTypedParamsAddULLong(par, npar, maxpar,
+                                VIR_DOMAIN_JOB_IMAGE_READ_BYTES,
+                                stats->readBytes) < 0 ||
+        virTypedParamsAddULLong(par, npar, maxpar,
+                                VIR_DOMAIN_JOB_IMAGE_READ_BPS,
+                                qemuDomainJobInfoBPS(stats->readBytes,
+                                                     stats->readTime)) < 0 ||
+        virTypedParamsAddULLong(par, npar, maxpar,
+                                VIR_DOMAIN_JOB_IMAGE_COMPRESS_BPS,
+                                qemuDomainJobInfoBPS(stats->processBytes,
+                                                     compressTime)) < 0 ||
+        virTypedParamsAddULLong(par, npar, maxpar,
+                                VIR_DOMAIN_JOB_IMAGE_WRITE_BYTES,
+                                stats->writeBytes) < 0 ||
+        virTypedParamsAddULLong(par, npar, maxpar,
+                                VIR_DOMAIN_JOB_IMAGE_WRITE_BPS,
+                                qemuDomainJobInfoBPS(stats->writeBytes,
+                                                     stats->writeTime)) < 0)
+        return -1;
+
+    return 0;
+}
+
+
 int
 qemuDomainJobInfoToParams(qemuDomainJobInfoPtr jobInfo,
                           int *type,
@@ -521,6 +568,11 @@ qemuDomainJobInfoToParams(qemuDomainJobInfoPtr jobInfo,
                              stats->cpu_throttle_percentage) < 0)
         goto error;
 
+    if (jobInfo->compressStatsSet &&
+        qemuDomainJobInfoCompressToParams(&jobInfo->compressStats,
+                                          &par, &npar, &maxpar) < 0)
+        goto error;
+
     *type = jobInfo->type;
     *params = par;
     *nparams = npar;
@@ -3343,8 +3395,10 @@ qemuDomainObjDiscardAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
 {
     qemuDomainObjPrivatePtr priv = obj->privateData;
 
-    if (priv->job.active == QEMU_JOB_ASYNC_NESTED)
+    if (priv->job.active == QEMU_JOB_ASYNC_NESTED) {
         qemuDomainObjResetJob(priv);
+        ignore_value(virDomainObjEndDeferStatus(obj));
+    }
     qemuDomainObjResetAsyncJob(priv);
     qemuDomainObjSaveJob(driver, obj);
 }
@@ -3472,6 +3526,10 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     if (qemuDomainTrackJob(job))
         qemuDomainObjSaveJob(driver, obj);
 
+    /* Everything a job changes is saved once when it ends */
+    if (job != QEMU_JOB_ASYNC)
+        virDomainObjDeferStatus(obj);
+
     virObjectUnref(cfg);
     return 0;
 
@@ -3607,7 +3665,7 @@ qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
               obj, obj->def->name);
 
     qemuDomainObjResetJob(priv);
-    if (qemuDomainTrackJob(job))
+    if (virDomainObjEndDeferStatus(obj) || qemuDomainTrackJob(job))
         qemuDomainObjSaveJob(driver, obj);
     virCondSignal(&priv->job.cond);
 }
@@ -35,6 +35,7 @@
 # include "qemu_conf.h"
 # include "qemu_capabilities.h"
 # include "virchrdev.h"
+# include "vircompress.h"
 # include "virobject.h"
 # include "logging/log_manager.h"
 
@@ -119,6 +120,9 @@ struct _qemuDomainJobInfo {
     bool timeDeltaSet;
     /* Raw values from QEMU */
     qemuMonitorMigrationStats stats;
+    /* Progress of parallel compression of a saved image */
+    bool compressStatsSet;
+    virCompressStats compressStats;
 };
 
 struct qemuDomainJobObj {
@@ -143,6 +147,8 @@ struct qemuDomainJobObj {
                                          * should wait for it to finish */
     bool spiceMigrated;                 /* spice migration completed */
     bool postcopyEnabled;               /* post-copy migration was enabled */
+    virCompressStreamPtr compressStream; /* compresses the image written
+                                          * by the async job */
 };
 
 typedef void (*qemuDomainCleanupCallback)(virQEMUDriverPtr driver,
@@ -147,6 +147,10 @@ static void processGuestPanicEvent(virQEMUDriverPtr driver,
 
 static void qemuProcessEventHandler(void *data, void *opaque);
 
+static void qemuConnectGetAllDomainStatsWorker(void *data, void *opaque);
+
+static qemuStatsSamplerPtr qemuDomainStatsSamplerNew(virQEMUDriverPtr driver);
+
 static int qemuStateCleanup(void);
 
 static int qemuDomainObjStart(virConnectPtr conn,
@@ -626,6 +630,22 @@ qemuDomainFindMaxID(virDomainObjPtr vm,
 }
 
 
+/* Log how long a phase of the driver startup took, so that the
+ * time it takes to become ready can be followed over upgrades */
+static void
+qemuStateInitializeTiming(const char *phase,
+                          unsigned long long *last)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return;
+
+    VIR_INFO("Startup phase '%s' took %llu ms", phase, now - *last);
+    *last = now;
+}
+
+
 /**
  * qemuStateInitialize:
  *
@@ -642,8 +662,13 @@ qemuStateInitialize(bool privileged,
     uid_t run_uid = -1;
     gid_t run_gid = -1;
     char *hugepagePath = NULL;
+    unsigned long long start = 0;
+    unsigned long long last = 0;
     size_t i;
 
+    ignore_value(virTimeMillisNow(&start));
+    last = start;
+
     if (VIR_ALLOC(qemu_driver) < 0)
         return -1;
 
@@ -893,6 +918,8 @@ qemuStateInitialize(bool privileged,
     if (!(qemu_driver->closeCallbacks = virCloseCallbacksNew()))
         goto error;
 
+    qemuStateInitializeTiming("setup", &last);
+
     /* Get all the running persistent or transient configs first */
     if (virDomainObjListLoadAllConfigs(qemu_driver->domains,
                                        cfg->stateDir,
@@ -913,6 +940,8 @@ qemuStateInitialize(bool privileged,
                             qemuDomainNetsRestart,
                             NULL);
 
+    qemuStateInitializeTiming("status", &last);
+
     conn = virConnectOpen(cfg->uri);
 
     /* Then inactive persistent configs */
@@ -924,6 +953,8 @@ qemuStateInitialize(bool privileged,
                                        NULL, NULL) < 0)
         goto error;
 
+    qemuStateInitializeTiming("configs", &last);
+
     virDomainObjListForEach(qemu_driver->domains,
                             qemuDomainSnapshotLoad,
                             cfg->snapshotDir);
@@ -932,15 +963,29 @@ qemuStateInitialize(bool privileged,
                             qemuDomainManagedSaveLoad,
                             qemu_driver);
 
+    qemuStateInitializeTiming("snapshots", &last);
+
     qemuProcessReconnectAll(conn, qemu_driver);
 
     qemu_driver->workerPool = virThreadPoolNew(0, 1, 0, qemuProcessEventHandler, qemu_driver);
     if (!qemu_driver->workerPool)
         goto error;
 
+    if (cfg->statsParallelWorkers &&
+        !(qemu_driver->statsPool = virThreadPoolNew(0, cfg->statsParallelWorkers, 0,
+                                                    qemuConnectGetAllDomainStatsWorker,
+                                                    qemu_driver)))
+        goto error;
+
+    if (!(qemu_driver->statsSampler = qemuDomainStatsSamplerNew(qemu_driver)))
+        goto error;
+
     virObjectUnref(conn);
 
     virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
+
+    VIR_INFO("QEMU driver initialized in %llu ms, reconnecting to running "
+             "domains in the background", last - start);
     return 0;
 
  error:
@@ -1069,6 +1114,21 @@ qemuStateStop(void)
     return ret;
 }
 
+static int
+qemuStateCompactStatus(virDomainObjPtr vm,
+                       void *opaque)
+{
+    const char *stateDir = opaque;
+    int ret;
+
+    virObjectLock(vm);
+    ret = virDomainCompactStatus(stateDir, vm);
+    virObjectUnlock(vm);
+
+    return ret;
+}
+
+
 /**
  * qemuStateCleanup:
  *
@@ -1082,6 +1142,16 @@ qemuStateCleanup(void)
 
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
     virThreadPoolFree(qemu_driver->workerPool);
+    virThreadPoolFree(qemu_driver->statsPool);
+    qemuStatsSamplerFree(qemu_driver->statsSampler);
+
+    /* Leave complete status files behind for the next daemon */
+    if (qemu_driver->domains && qemu_driver->config &&
+        virDomainObjListForEach(qemu_driver->domains, qemuStateCompactStatus,
+                                qemu_driver->config->stateDir) < 0)
+        VIR_WARN("Failed to compact status journal of some domains: %s",
+                 virGetLastErrorMessage());
+
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->hostdevMgr);
     virHashFree(qemu_driver->sharedDevices);
@@ -2777,7 +2847,11 @@ qemuDomainGetControlInfo(virDomainPtr dom,
  */
 #define QEMU_SAVE_MAGIC   "LibvirtQemudSave"
 #define QEMU_SAVE_PARTIAL "LibvirtQemudPart"
-#define QEMU_SAVE_VERSION 2
+/* Version 3 images are written by virCompressStream in chunks. The
+ * others are still written as version 2, so that older releases can
+ * restore them */
+#define QEMU_SAVE_VERSION 3
+#define QEMU_SAVE_VERSION_STREAM 2
 
 verify(sizeof(QEMU_SAVE_MAGIC) == sizeof(QEMU_SAVE_PARTIAL));
 
@@ -2821,7 +2895,8 @@ struct _virQEMUSaveHeader {
     uint32_t xml_len;
     uint32_t was_running;
     uint32_t compressed;
-    uint32_t unused[15];
+    uint32_t chunked;
+    uint32_t unused[14];
 };
 
 static inline void
@@ -2831,6 +2906,7 @@ bswap_header(virQEMUSaveHeaderPtr hdr)
     hdr->xml_len = bswap_32(hdr->xml_len);
     hdr->was_running = bswap_32(hdr->was_running);
     hdr->compressed = bswap_32(hdr->compressed);
+    hdr->chunked = bswap_32(hdr->chunked);
 }
 
 
@@ -2860,6 +2936,49 @@ qemuDomainSaveHeader(int fd, const char *path, const char *xml,
 }
 
 
+/* Starts decompressing a chunked image read from @fd in @nthreads
+ * threads, setting @outfd to a pipe the result can be read from */
+static virCompressStreamPtr
+qemuCompressGetStream(virQEMUSaveFormat compression,
+                      int fd,
+                      int *outfd,
+                      unsigned int nthreads)
+{
+    virCompressStreamPtr ret = NULL;
+    const char *prog = qemuSaveCompressionTypeToString(compression);
+    const char *args[] = { prog, "-dc", NULL, NULL };
+    int pipeFD[2] = { -1, -1 };
+
+    if (!prog || compression == QEMU_SAVE_FORMAT_RAW) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("Invalid compressed save format %d"),
+                       compression);
+        return NULL;
+    }
+
+    if (compression == QEMU_SAVE_FORMAT_LZOP)
+        args[2] = "--ignore-warn";
+
+    if (pipe(pipeFD) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Failed to create pipe for restore"));
+        return NULL;
+    }
+
+    if (!(ret = virCompressStreamNew(args, fd, pipeFD[1], nthreads, 0,
+                                     VIR_COMPRESS_STREAM_DECOMPRESS |
+                                     VIR_COMPRESS_STREAM_CHUNKED))) {
+        VIR_FORCE_CLOSE(pipeFD[0]);
+        VIR_FORCE_CLOSE(pipeFD[1]);
+        return NULL;
+    }
+
+    VIR_FORCE_CLOSE(pipeFD[1]);
+    *outfd = pipeFD[0];
+    return ret;
+}
+
+
 static virCommandPtr
 qemuCompressGetCommand(virQEMUSaveFormat compression)
 {
@@ -3070,14 +3189,23 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
     int directFlag = 0;
     virFileWrapperFdPtr wrapperFd = NULL;
     unsigned int wrapperFlags = VIR_FILE_WRAPPER_NON_BLOCKING;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    unsigned int compressThreads = 0;
 
     memset(&header, 0, sizeof(header));
     memcpy(header.magic, QEMU_SAVE_PARTIAL, sizeof(header.magic));
-    header.version = QEMU_SAVE_VERSION;
+    header.version = QEMU_SAVE_VERSION_STREAM;
     header.was_running = was_running ? 1 : 0;
     header.compressed = compressed;
     header.xml_len = strlen(domXML) + 1;
 
+    if (compressed != QEMU_SAVE_FORMAT_RAW &&
+        cfg->imageCompressionThreads > 1) {
+        compressThreads = cfg->imageCompressionThreads;
+        header.version = QEMU_SAVE_VERSION;
+        header.chunked = 1;
+    }
+
     /* Obtain the file handle.  */
     if ((flags & VIR_DOMAIN_SAVE_BYPASS_CACHE)) {
         wrapperFlags |= VIR_FILE_WRAPPER_BYPASS_CACHE;
@@ -3105,7 +3233,8 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
         goto cleanup;
 
     /* Perform the migration */
-    if (qemuMigrationToFile(driver, vm, fd, compressedpath, asyncJob) < 0)
+    if (qemuMigrationToFile(driver, vm, fd, compressedpath, compressThreads,
+                            VIR_COMPRESS_STREAM_CHUNKED, asyncJob) < 0)
         goto cleanup;
 
     /* Touch up file header to mark image complete. */
@@ -3146,6 +3275,7 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
     if (ret < 0 && needUnlink)
         unlink(path);
 
+    virObjectUnref(cfg);
     return ret;
 }
 
@@ -3605,14 +3735,21 @@ doCoreDump(virQEMUDriverPtr driver,
     const char *memory_dump_format = NULL;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     char *compressedpath = NULL;
+    int compressed;
+    unsigned int compressThreads = 0;
 
     /* We reuse "save" flag for "dump" here. Then, we can support the same
      * format in "save" and "dump". This path doesn't need the compression
-     * program to exist and can ignore the return value - it only cares to
+     * program to exist and falls back to raw - it only cares to
      * get the compressedpath */
-    ignore_value(qemuGetCompressionProgram(cfg->dumpImageFormat,
+    compressed = qemuGetCompressionProgram(cfg->dumpImageFormat,
                                            &compressedpath,
-                                           "dump", true));
+                                           "dump", true);
+
+    /* Unlike the others, lzop can't decompress concatenated streams, so
+     * a dump compressed in chunks would not be usable */
+    if (compressed != QEMU_SAVE_FORMAT_LZOP)
+        compressThreads = cfg->imageCompressionThreads;
 
     /* Create an empty file with appropriate ownership.  */
     if (dump_flags & VIR_DUMP_BYPASS_CACHE) {
@@ -3660,7 +3797,7 @@ doCoreDump(virQEMUDriverPtr driver,
             goto cleanup;
 
         ret = qemuMigrationToFile(driver, vm, fd, compressedpath,
-                                  QEMU_ASYNC_JOB_DUMP);
+                                  compressThreads, 0, QEMU_ASYNC_JOB_DUMP);
     }
 
     if (ret < 0)
@@ -6301,11 +6438,22 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     virObjectEventPtr event;
     int intermediatefd = -1;
     virCommandPtr cmd = NULL;
+    virCompressStreamPtr stream = NULL;
     char *errbuf = NULL;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
-    if ((header->version == 2) &&
-        (header->compressed != QEMU_SAVE_FORMAT_RAW)) {
+    if (header->version >= 2 && header->chunked) {
+        if (!(stream = qemuCompressGetStream(header->compressed, *fd,
+                                             &intermediatefd,
+                                             cfg->imageCompressionThreads)))
+            goto cleanup;
+
+        /* QEMU reads from the pipe the stream writes to */
+        VIR_FORCE_CLOSE(*fd);
+        *fd = intermediatefd;
+        intermediatefd = -1;
+    } else if ((header->version >= 2) &&
+               (header->compressed != QEMU_SAVE_FORMAT_RAW)) {
         if (!(cmd = qemuCompressGetCommand(header->compressed)))
             goto cleanup;
 
@@ -6347,6 +6495,28 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     }
     VIR_FORCE_CLOSE(intermediatefd);
 
+    if (stream) {
+        virCompressStats stats;
+
+        /* Nobody is going to read the rest, closing our end of the
+         * pipe makes sure the stream doesn't wait for that */
+        if (!restored) {
+            VIR_FORCE_CLOSE(*fd);
+            virCompressStreamAbort(stream);
+        }
+
+        if (virCompressStreamWait(stream) < 0 && restored) {
+            qemuProcessStop(driver, vm, VIR_DOMAIN_SHUTOFF_FAILED, asyncJob, 0);
+            restored = false;
+        }
+
+        virCompressStreamGetStats(stream, &stats);
+        VIR_DEBUG("Decompressed %llu bytes into %llu bytes with %zu threads, "
+                  "read %llu ms, decompress %llu ms, write %llu ms",
+                  stats.readBytes, stats.writeBytes, stats.workers,
+                  stats.readTime, stats.processTime, stats.writeTime);
+    }
+
     if (VIR_CLOSE(*fd) < 0) {
         virReportSystemError(errno, _("cannot close file: %s"), path);
         restored = false;
@@ -6394,6 +6564,7 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
 
  cleanup:
     virCommandFree(cmd);
+    virCompressStreamFree(stream);
     VIR_FREE(errbuf);
     if (virSecurityManagerRestoreSavedStateLabel(driver->securityManager,
                                                  vm->def, path) < 0)
@@ -12781,6 +12952,12 @@ qemuDomainGetJobStatsInternal(virQEMUDriverPtr driver,
     }
     *jobInfo = *info;
 
+    if (!completed && priv->job.compressStream) {
+        virCompressStreamGetStats(priv->job.compressStream,
+                                  &jobInfo->compressStats);
+        jobInfo->compressStatsSet = true;
+    }
+
     if (jobInfo->type == VIR_DOMAIN_JOB_BOUNDED ||
         jobInfo->type == VIR_DOMAIN_JOB_UNBOUNDED) {
         if (fetch)
@@ -19301,11 +19478,8 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
 
     if (HAVE_JOB(privflags) && virDomainObjIsActive(dom)) {
         qemuDomainObjEnterMonitor(driver, dom);
-        rc = qemuMonitorGetAllBlockStatsInfo(priv->mon, &stats,
-                                             visitBacking);
-        if (rc >= 0)
-            ignore_value(qemuMonitorBlockStatsUpdateCapacity(priv->mon, stats,
-                                                             visitBacking));
+        rc = qemuMonitorGetAllBlockStatsCapacity(priv->mon, &stats,
+                                                 visitBacking);
         if (qemuDomainObjExitMonitor(driver, dom) < 0)
             goto cleanup;
 
@@ -19471,6 +19645,39 @@ qemuDomainGetStatsNeedMonitor(unsigned int stats)
 }
 
 
+/**
+ * qemuDomainGetStatsCollect:
+ *
+ * Runs the workers selected by @stats on @dom, adding their parameters
+ * to @record. If @ends is not NULL, the number of parameters in @record
+ * after each item of qemuDomainGetStatsWorkers is stored in it, so that
+ * the parameters of every group can be told apart later.
+ */
+static int
+qemuDomainGetStatsCollect(virQEMUDriverPtr driver,
+                          virDomainObjPtr dom,
+                          unsigned int stats,
+                          virDomainStatsRecordPtr record,
+                          int *ends,
+                          unsigned int flags)
+{
+    int maxparams = 0;
+    size_t i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        if (stats & qemuDomainGetStatsWorkers[i].stats) {
+            if (qemuDomainGetStatsWorkers[i].func(driver, dom, record,
+                                                  &maxparams, flags) < 0)
+                return -1;
+        }
+        if (ends)
+            ends[i] = record->nparams;
+    }
+
+    return 0;
+}
+
+
 static int
 qemuDomainGetStats(virConnectPtr conn,
                    virDomainObjPtr dom,
@@ -19478,21 +19685,15 @@ qemuDomainGetStats(virConnectPtr conn,
                    virDomainStatsRecordPtr *record,
                    unsigned int flags)
 {
-    int maxparams = 0;
     virDomainStatsRecordPtr tmp;
-    size_t i;
     int ret = -1;
 
     if (VIR_ALLOC(tmp) < 0)
         goto cleanup;
 
-    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
-        if (stats & qemuDomainGetStatsWorkers[i].stats) {
-            if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, tmp,
-                                                  &maxparams, flags) < 0)
-                goto cleanup;
-        }
-    }
+    if (qemuDomainGetStatsCollect(conn->privateData, dom, stats, tmp,
+                                  NULL, flags) < 0)
+        goto cleanup;
 
     if (!(tmp->dom = virGetDomain(conn, dom->def->name, dom->def->uuid)))
         goto cleanup;
@@ -19511,17 +19712,380 @@ qemuDomainGetStats(virConnectPtr conn,
 }
 
 
+/**
+ * qemuConnectGetAllDomainStatsOne:
+ *
+ * Collects @stats of a single domain @vm. The domain object must be
+ * unlocked and the caller must hold a reference on it.
+ */
 static int
-qemuConnectGetAllDomainStats(virConnectPtr conn,
-                             virDomainPtr *doms,
-                             unsigned int ndoms,
-                             unsigned int stats,
-                             virDomainStatsRecordPtr **retStats,
-                             unsigned int flags)
+qemuConnectGetAllDomainStatsOne(virConnectPtr conn,
+                                virDomainObjPtr vm,
+                                unsigned int stats,
+                                unsigned int privflags,
+                                unsigned int flags,
+                                virDomainStatsRecordPtr *record)
 {
     virQEMUDriverPtr driver = conn->privateData;
-    virDomainObjPtr *vms = NULL;
+    unsigned int domflags = 0;
+    int ret;
+
+    virObjectLock(vm);
+
+    if (HAVE_JOB(privflags) &&
+        qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
+        domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+    /* else: without a job it's still possible to gather some data */
+
+    if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
+        domflags |= QEMU_DOMAIN_STATS_BACKING;
+
+    ret = qemuDomainGetStats(conn, vm, stats, record, domflags);
+
+    if (HAVE_JOB(domflags))
+        qemuDomainObjEndJob(driver, vm);
+
+    virObjectUnlock(vm);
+    return ret;
+}
+
+
+typedef enum {
+    QEMU_DOMAIN_STATS_JOB_QUEUED = 0,
+    QEMU_DOMAIN_STATS_JOB_RUNNING,
+    QEMU_DOMAIN_STATS_JOB_DONE,
+    QEMU_DOMAIN_STATS_JOB_FAILED,
+    QEMU_DOMAIN_STATS_JOB_ABANDONED,
+} qemuDomainStatsJobState;
+
+typedef struct _qemuDomainStatsParallel qemuDomainStatsParallel;
+typedef qemuDomainStatsParallel *qemuDomainStatsParallelPtr;
+
+typedef struct _qemuDomainStatsJob qemuDomainStatsJob;
+typedef qemuDomainStatsJob *qemuDomainStatsJobPtr;
+struct _qemuDomainStatsJob {
+    qemuDomainStatsParallelPtr parallel;
     virDomainObjPtr vm;
+    qemuDomainStatsJobState state;
+    unsigned long long deadline;
+
+    virDomainStatsRecordPtr record;
+    virErrorPtr error;
+};
+
+/* Shared between the thread calling virConnectGetAllDomainStats and the
+ * workers of the stats pool. Each worker holds a reference so that a
+ * domain which is abandoned after its timeout can finish (and release its
+ * data) long after the API call returned. */
+struct _qemuDomainStatsParallel {
+    virObjectLockable parent;
+
+    virCond cond;
+    size_t npending;
+
+    virConnectPtr conn;
+    unsigned int stats;
+    unsigned int privflags;
+    unsigned int flags;
+    unsigned long long timeout; /* in milliseconds */
+
+    qemuDomainStatsJobPtr jobs;
+    size_t njobs;
+};
+
+static virClassPtr qemuDomainStatsParallelClass;
+
+static void
+qemuDomainStatsRecordFree(virDomainStatsRecordPtr record)
+{
+    if (!record)
+        return;
+
+    virObjectUnref(record->dom);
+    virTypedParamsFree(record->params, record->nparams);
+    VIR_FREE(record);
+}
+
+static void
+qemuDomainStatsParallelDispose(void *obj)
+{
+    qemuDomainStatsParallelPtr parallel = obj;
+    size_t i;
+
+    for (i = 0; i < parallel->njobs; i++) {
+        virObjectUnref(parallel->jobs[i].vm);
+        qemuDomainStatsRecordFree(parallel->jobs[i].record);
+        virFreeError(parallel->jobs[i].error);
+    }
+    VIR_FREE(parallel->jobs);
+
+    virObjectUnref(parallel->conn);
+    ignore_value(virCondDestroy(&parallel->cond));
+}
+
+static int
+qemuDomainStatsParallelOnceInit(void)
+{
+    if (!(qemuDomainStatsParallelClass = virClassNew(virClassForObjectLockable(),
+                                                     "qemuDomainStatsParallel",
+                                                     sizeof(qemuDomainStatsParallel),
+                                                     qemuDomainStatsParallelDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(qemuDomainStatsParallel)
+
+
+static qemuDomainStatsParallelPtr
+qemuDomainStatsParallelNew(virConnectPtr conn,
+                           virDomainObjPtr *vms,
+                           size_t nvms,
+                           unsigned int stats,
+                           unsigned int privflags,
+                           unsigned int flags,
+                           unsigned int timeout)
+{
+    qemuDomainStatsParallelPtr parallel;
+    size_t i;
+
+    if (qemuDomainStatsParallelInitialize() < 0)
+        return NULL;
+
+    if (!(parallel = virObjectLockableNew(qemuDomainStatsParallelClass)))
+        return NULL;
+
+    if (virCondInit(&parallel->cond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize condition variable"));
+        virObjectUnref(parallel);
+        return NULL;
+    }
+
+    if (VIR_ALLOC_N(parallel->jobs, nvms) < 0) {
+        virObjectUnref(parallel);
+        return NULL;
+    }
+    parallel->njobs = nvms;
+
+    for (i = 0; i < nvms; i++) {
+        parallel->jobs[i].parallel = parallel;
+        parallel->jobs[i].vm = virObjectRef(vms[i]);
+    }
+
+    parallel->conn = virObjectRef(conn);
+    parallel->stats = stats;
+    parallel->privflags = privflags;
+    parallel->flags = flags;
+    parallel->timeout = timeout * 1000ull;
+
+    return parallel;
+}
+
+
+static void
+qemuConnectGetAllDomainStatsWorker(void *data,
+                                   void *opaque ATTRIBUTE_UNUSED)
+{
+    qemuDomainStatsJobPtr job = data;
+    qemuDomainStatsParallelPtr parallel = job->parallel;
+    virDomainStatsRecordPtr record = NULL;
+    unsigned long long now;
+    int rc;
+
+    virObjectLock(parallel);
+    if (job->state != QEMU_DOMAIN_STATS_JOB_QUEUED ||
+        virTimeMillisNow(&now) < 0) {
+        if (job->state == QEMU_DOMAIN_STATS_JOB_QUEUED) {
+            job->state = QEMU_DOMAIN_STATS_JOB_FAILED;
+            job->error = virSaveLastError();
+            parallel->npending--;
+            virCondSignal(&parallel->cond);
+        }
+        goto cleanup;
+    }
+    job->state = QEMU_DOMAIN_STATS_JOB_RUNNING;
+    job->deadline = now + parallel->timeout;
+    virObjectUnlock(parallel);
+
+    rc = qemuConnectGetAllDomainStatsOne(parallel->conn, job->vm,
+                                         parallel->stats, parallel->privflags,
+                                         parallel->flags, &record);
+
+    virObjectLock(parallel);
+    if (job->state != QEMU_DOMAIN_STATS_JOB_RUNNING) {
+        VIR_DEBUG("Dropping late statistics of domain '%s'",
+                  job->vm->def->name);
+        goto cleanup;
+    }
+
+    if (rc < 0) {
+        job->state = QEMU_DOMAIN_STATS_JOB_FAILED;
+        job->error = virSaveLastError();
+    } else {
+        job->state = QEMU_DOMAIN_STATS_JOB_DONE;
+        job->record = record;
+        record = NULL;
+    }
+    parallel->npending--;
+    virCondSignal(&parallel->cond);
+
+ cleanup:
+    virObjectUnlock(parallel);
+    qemuDomainStatsRecordFree(record);
+    virObjectUnref(parallel);
+}
+
+
+/**
+ * qemuConnectGetAllDomainStatsParallel:
+ *
+ * Distributes collection of stats of @vms across the driver's stats pool
+ * and waits for the results. A domain which doesn't finish within its
+ * timeout is abandoned and its record is omitted from the output. The
+ * records are returned in the order of @vms.
+ *
+ * Returns the number of records stored in @retStats, or -1 on error.
+ */
+static int
+qemuConnectGetAllDomainStatsParallel(virConnectPtr conn,
+                                     virDomainObjPtr *vms,
+                                     size_t nvms,
+                                     unsigned int stats,
+                                     unsigned int privflags,
+                                     unsigned int flags,
+                                     virDomainStatsRecordPtr *retStats)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainStatsParallelPtr parallel;
+    size_t nworkers = virThreadPoolGetMaxWorkers(driver->statsPool);
+    unsigned long long now;
+    size_t nstats = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!(parallel = qemuDomainStatsParallelNew(conn, vms, nvms, stats,
+                                                privflags, flags,
+                                                cfg->statsParallelTimeout)))
+        goto cleanup;
+
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+
+    virObjectLock(parallel);
+    for (i = 0; i < nvms; i++) {
+        qemuDomainStatsJobPtr job = &parallel->jobs[i];
+
+        /* A job waiting in the queue can't start before the jobs in front
+         * of it either finish or time out, so give it one timeout period
+         * for each round of workers ahead of it. Once started, the domain
+         * has a full timeout period of its own. */
+        job->deadline = now + parallel->timeout * (1 + i / nworkers);
+
+        virObjectRef(parallel);
+        if (virThreadPoolSendJob(driver->statsPool, 0, job) < 0) {
+            size_t j;
+
+            virObjectUnref(parallel);
+            job->state = QEMU_DOMAIN_STATS_JOB_FAILED;
+            job->error = virSaveLastError();
+            for (j = i + 1; j < nvms; j++)
+                parallel->jobs[j].state = QEMU_DOMAIN_STATS_JOB_ABANDONED;
+            break;
+        }
+        parallel->npending++;
+    }
+
+    while (parallel->npending) {
+        unsigned long long then = 0;
+
+        if (virTimeMillisNow(&now) < 0)
+            break;
+
+        for (i = 0; i < parallel->njobs; i++) {
+            qemuDomainStatsJobPtr job = &parallel->jobs[i];
+
+            if (job->state != QEMU_DOMAIN_STATS_JOB_QUEUED &&
+                job->state != QEMU_DOMAIN_STATS_JOB_RUNNING)
+                continue;
+
+            if (job->deadline <= now) {
+                VIR_WARN("Timed out collecting statistics of domain '%s'",
+                         job->vm->def->name);
+                job->state = QEMU_DOMAIN_STATS_JOB_ABANDONED;
+                parallel->npending--;
+                continue;
+            }
+
+            if (!then || job->deadline < then)
+                then = job->deadline;
+        }
+
+        if (!parallel->npending)
+            break;
+
+        if (virCondWaitUntil(&parallel->cond, &parallel->parent.lock, then) < 0 &&
+            errno != ETIMEDOUT) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait for domain statistics"));
+            break;
+        }
+    }
+
+    /* Abandon whatever is left in case we bailed out of the loop early */
+    for (i = 0; i < parallel->njobs; i++) {
+        if (parallel->jobs[i].state == QEMU_DOMAIN_STATS_JOB_QUEUED ||
+            parallel->jobs[i].state == QEMU_DOMAIN_STATS_JOB_RUNNING)
+            parallel->jobs[i].state = QEMU_DOMAIN_STATS_JOB_ABANDONED;
+    }
+
+    if (parallel->npending) {
+        virObjectUnlock(parallel);
+        goto cleanup;
+    }
+
+    for (i = 0; i < parallel->njobs; i++) {
+        if (parallel->jobs[i].state == QEMU_DOMAIN_STATS_JOB_FAILED) {
+            virSetError(parallel->jobs[i].error);
+            virObjectUnlock(parallel);
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < parallel->njobs; i++) {
+        if (parallel->jobs[i].state != QEMU_DOMAIN_STATS_JOB_DONE ||
+            !parallel->jobs[i].record)
+            continue;
+
+        retStats[nstats++] = parallel->jobs[i].record;
+        parallel->jobs[i].record = NULL;
+    }
+    virObjectUnlock(parallel);
+
+    ret = nstats;
+
+ cleanup:
+    virObjectUnref(parallel);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+/* Collects the stats of the domains passing @filter, the caller is
+ * responsible for the ACL check of the API */
+static int
+qemuConnectGetAllDomainStatsImpl(virConnectPtr conn,
+                                 virDomainPtr *doms,
+                                 unsigned int ndoms,
+                                 unsigned int stats,
+                                 virDomainStatsRecordPtr **retStats,
+                                 unsigned int flags,
+                                 virDomainObjListACLFilter filter)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virDomainObjPtr *vms = NULL;
     size_t nvms;
     virDomainStatsRecordPtr *tmpstats = NULL;
     bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
@@ -19529,7 +20093,6 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     size_t i;
     int ret = -1;
     unsigned int privflags = 0;
-    unsigned int domflags = 0;
     unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
                                    VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
                                    VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
@@ -19537,24 +20100,20 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_PARALLEL |
                   VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING |
                   VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
 
-    if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
-        return -1;
-
     if (qemuDomainGetStatsCheckSupport(&stats, enforce) < 0)
         return -1;
 
     if (ndoms) {
         if (virDomainObjListConvert(driver->domains, conn, doms, ndoms, &vms,
-                                    &nvms, virConnectGetAllDomainStatsCheckACL,
-                                    lflags, true) < 0)
+                                    &nvms, filter, lflags, true) < 0)
             return -1;
     } else {
         if (virDomainObjListCollect(driver->domains, conn, &vms, &nvms,
-                                    virConnectGetAllDomainStatsCheckACL,
-                                    lflags) < 0)
+                                    filter, lflags) < 0)
             return -1;
     }
 
@@ -19564,50 +20123,273 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     if (qemuDomainGetStatsNeedMonitor(stats))
         privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
 
+    if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_PARALLEL &&
+        driver->statsPool && nvms > 1) {
+        if ((nstats = qemuConnectGetAllDomainStatsParallel(conn, vms, nvms,
+                                                           stats, privflags,
+                                                           flags,
+                                                           tmpstats)) < 0)
+            goto cleanup;
+    } else {
+        for (i = 0; i < nvms; i++) {
+            virDomainStatsRecordPtr tmp = NULL;
+
+            if (qemuConnectGetAllDomainStatsOne(conn, vms[i], stats,
+                                                privflags, flags, &tmp) < 0)
+                goto cleanup;
+
+            if (tmp)
+                tmpstats[nstats++] = tmp;
+        }
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+
+    ret = nstats;
+
+ cleanup:
+    virDomainStatsRecordListFree(tmpstats);
+    virObjectListFreeCount(vms, nvms);
+
+    return ret;
+}
+
+
+static int
+qemuConnectGetAllDomainStats(virConnectPtr conn,
+                             virDomainPtr *doms,
+                             unsigned int ndoms,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
+        return -1;
+
+    return qemuConnectGetAllDomainStatsImpl(conn, doms, ndoms, stats,
+                                            retStats, flags,
+                                            virConnectGetAllDomainStatsCheckACL);
+}
+
+
+static int
+qemuConnectGetAllDomainStatsColumns(virConnectPtr conn,
+                                    virDomainPtr *doms,
+                                    unsigned int ndoms,
+                                    unsigned int stats,
+                                    virDomainStatsColumnsPtr *retColumns,
+                                    unsigned int flags)
+{
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainStatsColumnsPtr columns;
+    int nrecords;
+
+    if (virConnectGetAllDomainStatsColumnsEnsureACL(conn) < 0)
+        return -1;
+
+    if ((nrecords = qemuConnectGetAllDomainStatsImpl(conn, doms, ndoms, stats,
+                                                     &records, flags,
+                                                     virConnectGetAllDomainStatsColumnsCheckACL)) < 0)
+        return -1;
+
+    columns = virTypedParamsRecordsToColumns(records, nrecords);
+    virDomainStatsRecordListFree(records);
+    if (!columns)
+        return -1;
+
+    *retColumns = columns;
+    return nrecords;
+}
+
+
+/* Callbacks of the domain stats sampler, see qemu_stats_sampler.c */
+static size_t
+qemuDomainStatsSamplerCollect(unsigned int stats,
+                              qemuStatsSamplePtr *samples,
+                              void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    size_t nsamples = 0;
+    bool needJob = qemuDomainGetStatsNeedMonitor(stats);
+    size_t i;
+
+    *samples = NULL;
+
+    if (virDomainObjListCollect(driver->domains, NULL, &vms, &nvms,
+                                NULL, 0) < 0 ||
+        (nvms && VIR_ALLOC_N(*samples, nvms) < 0)) {
+        VIR_WARN("Failed to sample domain statistics: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+        goto cleanup;
+    }
+
     for (i = 0; i < nvms; i++) {
-        virDomainStatsRecordPtr tmp = NULL;
-        domflags = 0;
-        vm = vms[i];
+        virDomainObjPtr vm = vms[i];
+        qemuStatsSamplePtr sample = *samples + nsamples;
+        virDomainStatsRecord record = { 0 };
+        unsigned int domflags = 0;
+        int rc = -1;
 
         virObjectLock(vm);
 
-        if (HAVE_JOB(privflags) &&
-            qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
-            domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
-        /* else: without a job it's still possible to gather some data */
+        if (VIR_ALLOC_N(sample->ends,
+                        ARRAY_CARDINALITY(qemuDomainGetStatsWorkers)) == 0) {
+            if (needJob &&
+                qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
+                domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+
+            rc = qemuDomainGetStatsCollect(driver, vm, stats, &record,
+                                           sample->ends, domflags);
 
-        if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
-            domflags |= QEMU_DOMAIN_STATS_BACKING;
-        if (qemuDomainGetStats(conn, vm, stats, &tmp, domflags) < 0) {
-            if (HAVE_JOB(domflags) && vm)
+            if (HAVE_JOB(domflags))
                 qemuDomainObjEndJob(driver, vm);
+        }
 
+        if (rc == 0 &&
+            VIR_STRDUP(sample->record.name, vm->def->name) < 0)
+            rc = -1;
+
+        if (rc < 0) {
+            VIR_WARN("Failed to sample statistics of domain '%s': %s",
+                     vm->def->name, virGetLastErrorMessage());
+            virResetLastError();
+            virTypedParamsFree(record.params, record.nparams);
+            VIR_FREE(sample->ends);
             virObjectUnlock(vm);
-            goto cleanup;
+            continue;
         }
 
-        if (tmp)
-            tmpstats[nstats++] = tmp;
-
-        if (HAVE_JOB(domflags))
-            qemuDomainObjEndJob(driver, vm);
+        sample->record.id = vm->def->id;
+        memcpy(sample->record.uuid, vm->def->uuid, VIR_UUID_BUFLEN);
+        sample->record.params = record.params;
+        sample->record.nparams = record.nparams;
+        nsamples++;
 
         virObjectUnlock(vm);
     }
 
-    *retStats = tmpstats;
-    tmpstats = NULL;
-
-    ret = nstats;
-
  cleanup:
-    virDomainStatsRecordListFree(tmpstats);
     virObjectListFreeCount(vms, nvms);
+    return nsamples;
+}
+
+
+static int
+qemuDomainStatsSamplerEmit(int callbackID,
+                           virDomainStatsEventRecordPtr *records,
+                           size_t *nrecords,
+                           void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    virObjectEventPtr event;
+
+    if (!(event = virDomainStatsEventNew(callbackID, records, nrecords)))
+        return -1;
+
+    virObjectEventStateQueue(driver->domainEventState, event);
+    return 0;
+}
+
+
+static qemuStatsSamplerPtr
+qemuDomainStatsSamplerNew(virQEMUDriverPtr driver)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    unsigned int groups[ARRAY_CARDINALITY(qemuDomainGetStatsWorkers) - 1];
+    qemuStatsSamplerPtr sampler;
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(groups); i++)
+        groups[i] = qemuDomainGetStatsWorkers[i].stats;
+
+    sampler = qemuStatsSamplerNew(groups, ARRAY_CARDINALITY(groups),
+                                  cfg->statsSampleInterval * 1000ull,
+                                  qemuDomainStatsSamplerCollect,
+                                  qemuDomainStatsSamplerEmit,
+                                  driver);
+    virObjectUnref(cfg);
+    return sampler;
+}
+
+
+static int
+qemuConnectDomainStatsEventRegister(virConnectPtr conn,
+                                    unsigned int stats,
+                                    virConnectDomainStatsEventCallback callback,
+                                    void *opaque,
+                                    virFreeCallback freecb,
+                                    unsigned int flags)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virQEMUDriverConfigPtr cfg = NULL;
+    int callbackID = -1;
+    int ret = -1;
 
+    virCheckFlags(VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA, -1);
+
+    if (virConnectDomainStatsEventRegisterEnsureACL(conn) < 0)
+        return -1;
+
+    cfg = virQEMUDriverGetConfig(driver);
+    if (!cfg->statsSampleInterval) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("domain stats sampling is disabled"));
+        goto cleanup;
+    }
+
+    if (qemuDomainGetStatsCheckSupport(&stats, false) < 0)
+        goto cleanup;
+
+    if (virDomainStatsEventStateRegisterID(conn, driver->domainEventState,
+                                           stats, callback, opaque, freecb,
+                                           flags, &callbackID) < 0)
+        goto cleanup;
+
+    if (qemuStatsSamplerStart(driver->statsSampler) < 0 ||
+        qemuStatsSamplerSubscribe(driver->statsSampler, callbackID,
+                                  stats, flags) < 0) {
+        virObjectEventStateDeregisterID(conn, driver->domainEventState,
+                                        callbackID);
+        goto cleanup;
+    }
+
+    ret = callbackID;
+
+ cleanup:
+    virObjectUnref(cfg);
     return ret;
 }
 
 
+static int
+qemuConnectDomainStatsEventDeregister(virConnectPtr conn,
+                                      int callbackID)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+
+    if (virConnectDomainStatsEventDeregisterEnsureACL(conn) < 0)
+        return -1;
+
+    if (!qemuStatsSamplerHasSubscriber(driver->statsSampler, callbackID)) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("no domain stats callback with ID %d"),
+                       callbackID);
+        return -1;
+    }
+
+    if (virObjectEventStateDeregisterID(conn, driver->domainEventState,
+                                        callbackID) < 0)
+        return -1;
+
+    qemuStatsSamplerUnsubscribe(driver->statsSampler, callbackID);
+    return 0;
+}
+
+
 static int
 qemuNodeAllocPages(virConnectPtr conn,
                    unsigned int npages,
@@ -20518,6 +21300,9 @@ static virHypervisorDriver qemuHypervisorDriver = {
     .domainGetGuestVcpus = qemuDomainGetGuestVcpus, /* 2.0.0 */
     .domainSetGuestVcpus = qemuDomainSetGuestVcpus, /* 2.0.0 */
     .domainSetVcpu = qemuDomainSetVcpu, /* 3.1.0 */
+    .connectGetAllDomainStatsColumns = qemuConnectGetAllDomainStatsColumns, /* 3.2.0 */
+    .connectDomainStatsEventRegister = qemuConnectDomainStatsEventRegister, /* 3.2.0 */
+    .connectDomainStatsEventDeregister = qemuConnectDomainStatsEventDeregister, /* 3.2.0 */
 };
 
 
@@ -29,9 +29,9 @@
 # include <gnutls/x509.h>
 #endif
 #include <fcntl.h>
-#include <poll.h>
 
 #include "qemu_migration.h"
+#include "qemu_migration_tunnel.h"
 #include "qemu_monitor.h"
 #include "qemu_domain.h"
 #include "qemu_process.h"
@@ -3752,7 +3752,7 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
     qemuMigrationJobSetPhase(driver, vm, QEMU_MIGRATION_PHASE_PREPARE);
 
     /* Domain starts inactive, even if the domain XML had an id field. */
-    vm->def->id = -1;
+    virDomainObjListSetID(driver->domains, vm, -1);
 
     if (flags & VIR_MIGRATE_OFFLINE)
         goto done;
@@ -4386,200 +4386,6 @@ struct _qemuMigrationSpec {
     } fwd;
 };
 
-#define TUNNEL_SEND_BUF_SIZE 65536
-
-typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
-typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
-struct _qemuMigrationIOThread {
-    virThread thread;
-    virStreamPtr st;
-    int sock;
-    virError err;
-    int wakeupRecvFD;
-    int wakeupSendFD;
-};
-
-static void qemuMigrationIOFunc(void *arg)
-{
-    qemuMigrationIOThreadPtr data = arg;
-    char *buffer = NULL;
-    struct pollfd fds[2];
-    int timeout = -1;
-    virErrorPtr err = NULL;
-
-    VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d",
-              data->st, data->sock);
-
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0)
-        goto abrt;
-
-    fds[0].fd = data->sock;
-    fds[1].fd = data->wakeupRecvFD;
-
-    for (;;) {
-        int ret;
-
-        fds[0].events = fds[1].events = POLLIN;
-        fds[0].revents = fds[1].revents = 0;
-
-        ret = poll(fds, ARRAY_CARDINALITY(fds), timeout);
-
-        if (ret < 0) {
-            if (errno == EAGAIN || errno == EINTR)
-                continue;
-            virReportSystemError(errno, "%s",
-                                 _("poll failed in migration tunnel"));
-            goto abrt;
-        }
-
-        if (ret == 0) {
-            /* We were asked to gracefully stop but reading would block. This
-             * can only happen if qemu told us migration finished but didn't
-             * close the migration fd. We handle this in the same way as EOF.
-             */
-            VIR_DEBUG("QEMU forgot to close migration fd");
-            break;
-        }
-
-        if (fds[1].revents & (POLLIN | POLLERR | POLLHUP)) {
-            char stop = 0;
-
-            if (saferead(data->wakeupRecvFD, &stop, 1) != 1) {
-                virReportSystemError(errno, "%s",
-                                     _("failed to read from wakeup fd"));
-                goto abrt;
-            }
-
-            VIR_DEBUG("Migration tunnel was asked to %s",
-                      stop ? "abort" : "finish");
-            if (stop) {
-                goto abrt;
-            } else {
-                timeout = 0;
-            }
-        }
-
-        if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
-            int nbytes;
-
-            nbytes = saferead(data->sock, buffer, TUNNEL_SEND_BUF_SIZE);
-            if (nbytes > 0) {
-                if (virStreamSend(data->st, buffer, nbytes) < 0)
-                    goto error;
-            } else if (nbytes < 0) {
-                virReportSystemError(errno, "%s",
-                        _("tunnelled migration failed to read from qemu"));
-                goto abrt;
-            } else {
-                /* EOF; get out of here */
-                break;
-            }
-        }
-    }
-
-    if (virStreamFinish(data->st) < 0)
-        goto error;
-
-    VIR_FORCE_CLOSE(data->sock);
-    VIR_FREE(buffer);
-
-    return;
-
- abrt:
-    err = virSaveLastError();
-    if (err && err->code == VIR_ERR_OK) {
-        virFreeError(err);
-        err = NULL;
-    }
-    virStreamAbort(data->st);
-    if (err) {
-        virSetError(err);
-        virFreeError(err);
-    }
-
- error:
-    /* Let the source qemu know that the transfer cant continue anymore.
-     * Don't copy the error for EPIPE as destination has the actual error. */
-    VIR_FORCE_CLOSE(data->sock);
-    if (!virLastErrorIsSystemErrno(EPIPE))
-        virCopyLastError(&data->err);
-    virResetLastError();
-    VIR_FREE(buffer);
-}
-
-
-static qemuMigrationIOThreadPtr
-qemuMigrationStartTunnel(virStreamPtr st,
-                         int sock)
-{
-    qemuMigrationIOThreadPtr io = NULL;
-    int wakeupFD[2] = { -1, -1 };
-
-    if (pipe2(wakeupFD, O_CLOEXEC) < 0) {
-        virReportSystemError(errno, "%s",
-                             _("Unable to make pipe"));
-        goto error;
-    }
-
-    if (VIR_ALLOC(io) < 0)
-        goto error;
-
-    io->st = st;
-    io->sock = sock;
-    io->wakeupRecvFD = wakeupFD[0];
-    io->wakeupSendFD = wakeupFD[1];
-
-    if (virThreadCreate(&io->thread, true,
-                        qemuMigrationIOFunc,
-                        io) < 0) {
-        virReportSystemError(errno, "%s",
-                             _("Unable to create migration thread"));
-        goto error;
-    }
-
-    return io;
-
- error:
-    VIR_FORCE_CLOSE(wakeupFD[0]);
-    VIR_FORCE_CLOSE(wakeupFD[1]);
-    VIR_FREE(io);
-    return NULL;
-}
-
-static int
-qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
-{
-    int rv = -1;
-    char stop = error ? 1 : 0;
-
-    /* make sure the thread finishes its job and is joinable */
-    if (safewrite(io->wakeupSendFD, &stop, 1) != 1) {
-        virReportSystemError(errno, "%s",
-                             _("failed to wakeup migration tunnel"));
-        goto cleanup;
-    }
-
-    virThreadJoin(&io->thread);
-
-    /* Forward error from the IO thread, to this thread */
-    if (io->err.code != VIR_ERR_OK) {
-        if (error)
-            rv = 0;
-        else
-            virSetError(&io->err);
-        virResetError(&io->err);
-        goto cleanup;
-    }
-
-    rv = 0;
-
- cleanup:
-    VIR_FORCE_CLOSE(io->wakeupSendFD);
-    VIR_FORCE_CLOSE(io->wakeupRecvFD);
-    VIR_FREE(io);
-    return rv;
-}
-
 static int
 qemuMigrationConnect(virQEMUDriverPtr driver,
                      virDomainObjPtr vm,
@@ -4647,7 +4453,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     unsigned int migrate_flags = QEMU_MONITOR_MIGRATE_BACKGROUND;
     qemuDomainObjPrivatePtr priv = vm->privateData;
     qemuMigrationCookiePtr mig = NULL;
-    qemuMigrationIOThreadPtr iothread = NULL;
+    qemuMigrationTunnelPtr tunnel = NULL;
     int fd = -1;
     unsigned long migrate_speed = resource ? resource : priv->migMaxBandwidth;
     virErrorPtr orig_err = NULL;
@@ -4830,10 +4636,10 @@ qemuMigrationRun(virQEMUDriverPtr driver,
      * migration on source if anything goes wrong */
 
     if (spec->fwdType != MIGRATION_FWD_DIRECT) {
-        if (!(iothread = qemuMigrationStartTunnel(spec->fwd.stream, fd)))
+        if (!(tunnel = qemuMigrationTunnelStart(spec->fwd.stream, fd)))
             goto cancel;
-        /* If we've created a tunnel, then the 'fd' will be closed in the
-         * qemuMigrationIOFunc as data->sock.
+        /* If we've created a tunnel, then the 'fd' will be closed by the
+         * tunnel once it is done reading from it.
          */
         fd = -1;
     }
@@ -4891,7 +4697,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     }
 
     if (spec->fwdType != MIGRATION_FWD_DIRECT) {
-        if (iothread && qemuMigrationStopTunnel(iothread, ret < 0) < 0)
+        if (tunnel && qemuMigrationTunnelStop(tunnel, ret < 0) < 0)
             ret = -1;
     }
     VIR_FORCE_CLOSE(fd);
@@ -6425,12 +6231,15 @@ int
 qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
                     int fd,
                     const char *compressor,
+                    unsigned int compressThreads,
+                    unsigned int compressFlags,
                     qemuDomainAsyncJob asyncJob)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     int rc;
     int ret = -1;
     virCommandPtr cmd = NULL;
+    virCompressStreamPtr stream = NULL;
     int pipeFD[2] = { -1, -1 };
     unsigned long saveMigBandwidth = priv->migMaxBandwidth;
     char *errbuf = NULL;
@@ -6467,6 +6276,18 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
                                           compressor ? pipeFD[1] : fd) < 0)
         goto cleanup;
 
+    /* With several threads the stream is compressed in chunks by
+     * separate compressor processes */
+    if (compressor && compressThreads > 1) {
+        const char *args[] = { compressor, "-c", NULL };
+
+        if (!(stream = virCompressStreamNew(args, pipeFD[0], fd,
+                                            compressThreads, 0,
+                                            compressFlags)))
+            goto cleanup;
+        priv->job.compressStream = stream;
+    }
+
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
         goto cleanup;
 
@@ -6482,20 +6303,22 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
             NULL
         };
 
-        cmd = virCommandNewArgs(args);
-        virCommandSetInputFD(cmd, pipeFD[0]);
-        virCommandSetOutputFD(cmd, &fd);
-        virCommandSetErrorBuffer(cmd, &errbuf);
-        virCommandDoAsyncIO(cmd);
         if (virSetCloseExec(pipeFD[1]) < 0) {
             virReportSystemError(errno, "%s",
                                  _("Unable to set cloexec flag"));
             ignore_value(qemuDomainObjExitMonitor(driver, vm));
             goto cleanup;
         }
-        if (virCommandRunAsync(cmd, NULL) < 0) {
-            ignore_value(qemuDomainObjExitMonitor(driver, vm));
-            goto cleanup;
+        if (!stream) {
+            cmd = virCommandNewArgs(args);
+            virCommandSetInputFD(cmd, pipeFD[0]);
+            virCommandSetOutputFD(cmd, &fd);
+            virCommandSetErrorBuffer(cmd, &errbuf);
+            virCommandDoAsyncIO(cmd);
+            if (virCommandRunAsync(cmd, NULL) < 0) {
+                ignore_value(qemuDomainObjExitMonitor(driver, vm));
+                goto cleanup;
+            }
         }
         rc = qemuMonitorMigrateToFd(priv->mon,
                                     QEMU_MONITOR_MIGRATE_BACKGROUND,
@@ -6515,6 +6338,7 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
         if (rc == -2) {
             orig_err = virSaveLastError();
             virCommandAbort(cmd);
+            virCompressStreamAbort(stream);
             if (virDomainObjIsActive(vm) &&
                 qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) == 0) {
                 qemuMonitorMigrateCancel(priv->mon);
@@ -6527,6 +6351,17 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     if (cmd && virCommandWait(cmd, NULL) < 0)
         goto cleanup;
 
+    if (stream) {
+        if (virCompressStreamWait(stream) < 0)
+            goto cleanup;
+
+        if (priv->job.completed) {
+            virCompressStreamGetStats(stream,
+                                      &priv->job.completed->compressStats);
+            priv->job.completed->compressStatsSet = true;
+        }
+    }
+
     qemuDomainEventEmitJobCompleted(driver, vm);
     ret = 0;
 
@@ -6544,6 +6379,10 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
 
     VIR_FORCE_CLOSE(pipeFD[0]);
     VIR_FORCE_CLOSE(pipeFD[1]);
+    if (stream) {
+        priv->job.compressStream = NULL;
+        virCompressStreamFree(stream);
+    }
     if (cmd) {
         VIR_DEBUG("Compression binary stderr: %s", NULLSTR(errbuf));
         VIR_FREE(errbuf);
@@ -239,6 +239,8 @@ int qemuMigrationToFile(virQEMUDriverPtr driver,
                         virDomainObjPtr vm,
                         int fd,
                         const char *compressor,
+                        unsigned int compressThreads,
+                        unsigned int compressFlags,
                         qemuDomainAsyncJob asyncJob)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
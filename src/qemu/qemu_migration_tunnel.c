@@ -0,0 +1,493 @@
+/*
+ * qemu_migration_tunnel.c: forwarding migration data through a stream
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "qemu_migration_tunnel.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_QEMU
+
+VIR_LOG_INIT("qemu.qemu_migration_tunnel");
+
+/* Matches the largest stream packet a server may negotiate, so that a
+ * full buffer is sent as one packet; older servers split it */
+#define TUNNEL_SEND_BUF_SIZE (4 * 1024 * 1024)
+
+/* How long (ms) to wait for more data to fill a partial buffer */
+#define TUNNEL_FILL_WAIT 1
+
+/* Number of buffers QEMU can fill while the previous ones are sent */
+#define TUNNEL_SEND_BUF_COUNT 4
+
+typedef struct _qemuMigrationTunnelBuffer qemuMigrationTunnelBuffer;
+typedef qemuMigrationTunnelBuffer *qemuMigrationTunnelBufferPtr;
+struct _qemuMigrationTunnelBuffer {
+    char *data;
+    size_t len;
+};
+
+/*
+ * Data flows from the migration socket through a ring of buffers to the
+ * stream: the reader thread fills buffers from QEMU, while the sender
+ * thread pushes the filled ones to the stream, so that neither side
+ * waits for the other as long as there is a free buffer.
+ */
+struct _qemuMigrationTunnel {
+    virMutex lock;
+    virCond cond;
+
+    virThread reader;
+    virThread sender;
+
+    virStreamPtr st;
+    int sock;
+    int wakeupRecvFD;
+    int wakeupSendFD;
+
+    qemuMigrationTunnelBuffer bufs[TUNNEL_SEND_BUF_COUNT];
+    size_t head;            /* next buffer to fill */
+    size_t tail;            /* next buffer to send */
+    size_t filled;          /* number of buffers waiting to be sent */
+
+    bool eof;               /* reader saw the end of migration data */
+    bool readFailed;        /* reader failed or was asked to abort */
+    bool sendFailed;        /* sender could not write to the stream */
+
+    unsigned long long bytes;
+    virError err;
+};
+
+
+/* Remembers the first error reported by either thread. EPIPE is ignored
+ * since destination has the actual error in that case. Call with the
+ * tunnel locked. */
+static void
+qemuMigrationTunnelSaveError(qemuMigrationTunnelPtr tunnel)
+{
+    if (tunnel->err.code == VIR_ERR_OK &&
+        !virLastErrorIsSystemErrno(EPIPE))
+        virCopyLastError(&tunnel->err);
+    virResetLastError();
+}
+
+
+/* Hands the buffer being filled over to the sender */
+static void
+qemuMigrationTunnelPushBuffer(qemuMigrationTunnelPtr tunnel)
+{
+    virMutexLock(&tunnel->lock);
+    tunnel->head = (tunnel->head + 1) % TUNNEL_SEND_BUF_COUNT;
+    tunnel->filled++;
+    virCondBroadcast(&tunnel->cond);
+    virMutexUnlock(&tunnel->lock);
+}
+
+
+/* Whether there is still data waiting to be sent */
+static bool
+qemuMigrationTunnelSenderBusy(qemuMigrationTunnelPtr tunnel)
+{
+    bool ret;
+
+    virMutexLock(&tunnel->lock);
+    ret = tunnel->filled > 0;
+    virMutexUnlock(&tunnel->lock);
+
+    return ret;
+}
+
+
+/* Waits for a free buffer, returns NULL if the sender gave up */
+static qemuMigrationTunnelBufferPtr
+qemuMigrationTunnelGetFreeBuffer(qemuMigrationTunnelPtr tunnel)
+{
+    qemuMigrationTunnelBufferPtr buf = NULL;
+
+    virMutexLock(&tunnel->lock);
+    while (tunnel->filled == TUNNEL_SEND_BUF_COUNT && !tunnel->sendFailed)
+        ignore_value(virCondWait(&tunnel->cond, &tunnel->lock));
+
+    if (!tunnel->sendFailed) {
+        buf = &tunnel->bufs[tunnel->head];
+        buf->len = 0;
+    }
+    virMutexUnlock(&tunnel->lock);
+
+    return buf;
+}
+
+
+static void
+qemuMigrationTunnelReader(void *opaque)
+{
+    qemuMigrationTunnelPtr tunnel = opaque;
+    qemuMigrationTunnelBufferPtr buf;
+    struct pollfd fds[2];
+    int timeout = -1;
+
+    VIR_DEBUG("Running migration tunnel reader; stream=%p, sock=%d",
+              tunnel->st, tunnel->sock);
+
+    if (!(buf = qemuMigrationTunnelGetFreeBuffer(tunnel)))
+        goto cleanup;
+
+    fds[0].fd = tunnel->sock;
+    fds[1].fd = tunnel->wakeupRecvFD;
+
+    for (;;) {
+        int pollTimeout = timeout;
+        int ret;
+
+        fds[0].events = fds[1].events = POLLIN;
+        fds[0].revents = fds[1].revents = 0;
+
+        /* A partial buffer is only worth holding back while the sender
+         * is busy anyway; larger buffers mean fewer packets */
+        if (buf->len) {
+            if (timeout != 0 && qemuMigrationTunnelSenderBusy(tunnel))
+                pollTimeout = TUNNEL_FILL_WAIT;
+            else
+                pollTimeout = 0;
+        }
+
+        ret = poll(fds, ARRAY_CARDINALITY(fds), pollTimeout);
+
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            virReportSystemError(errno, "%s",
+                                 _("poll failed in migration tunnel"));
+            goto abrt;
+        }
+
+        if (ret == 0) {
+            if (pollTimeout > 0)
+                continue;
+
+            if (buf->len) {
+                qemuMigrationTunnelPushBuffer(tunnel);
+                if (!(buf = qemuMigrationTunnelGetFreeBuffer(tunnel)))
+                    goto cleanup;
+                continue;
+            }
+
+            /* We were asked to gracefully stop but reading would block. This
+             * can only happen if qemu told us migration finished but didn't
+             * close the migration fd. We handle this in the same way as EOF.
+             */
+            VIR_DEBUG("QEMU forgot to close migration fd");
+            break;
+        }
+
+        if (fds[1].revents & (POLLIN | POLLERR | POLLHUP)) {
+            char stop = 0;
+
+            if (saferead(tunnel->wakeupRecvFD, &stop, 1) != 1) {
+                virReportSystemError(errno, "%s",
+                                     _("failed to read from wakeup fd"));
+                goto abrt;
+            }
+
+            VIR_DEBUG("Migration tunnel was asked to %s",
+                      stop ? "abort" : "finish");
+            if (stop) {
+                goto abrt;
+            } else {
+                timeout = 0;
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            ssize_t nbytes;
+
+            nbytes = read(tunnel->sock, buf->data + buf->len,
+                          TUNNEL_SEND_BUF_SIZE - buf->len);
+            if (nbytes > 0) {
+                buf->len += nbytes;
+                if (buf->len == TUNNEL_SEND_BUF_SIZE) {
+                    qemuMigrationTunnelPushBuffer(tunnel);
+                    if (!(buf = qemuMigrationTunnelGetFreeBuffer(tunnel)))
+                        goto cleanup;
+                }
+            } else if (nbytes < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                    continue;
+                virReportSystemError(errno, "%s",
+                        _("tunnelled migration failed to read from qemu"));
+                goto abrt;
+            } else {
+                /* EOF; get out of here */
+                break;
+            }
+        }
+    }
+
+    virMutexLock(&tunnel->lock);
+    if (buf->len) {
+        tunnel->head = (tunnel->head + 1) % TUNNEL_SEND_BUF_COUNT;
+        tunnel->filled++;
+    }
+    tunnel->eof = true;
+    virCondBroadcast(&tunnel->cond);
+    virMutexUnlock(&tunnel->lock);
+
+    VIR_FORCE_CLOSE(tunnel->sock);
+    return;
+
+ abrt:
+    virMutexLock(&tunnel->lock);
+    qemuMigrationTunnelSaveError(tunnel);
+    tunnel->readFailed = true;
+    virCondBroadcast(&tunnel->cond);
+    virMutexUnlock(&tunnel->lock);
+
+ cleanup:
+    /* Let the source qemu know that the transfer cant continue anymore. */
+    VIR_FORCE_CLOSE(tunnel->sock);
+}
+
+
+static void
+qemuMigrationTunnelSender(void *opaque)
+{
+    qemuMigrationTunnelPtr tunnel = opaque;
+    qemuMigrationTunnelBufferPtr buf;
+    char stop = 1;
+
+    VIR_DEBUG("Running migration tunnel sender; stream=%p", tunnel->st);
+
+    for (;;) {
+        size_t off = 0;
+
+        virMutexLock(&tunnel->lock);
+        while (!tunnel->filled && !tunnel->eof && !tunnel->readFailed)
+            ignore_value(virCondWait(&tunnel->cond, &tunnel->lock));
+
+        if (tunnel->readFailed) {
+            virMutexUnlock(&tunnel->lock);
+            goto abrt;
+        }
+
+        if (!tunnel->filled) {
+            virMutexUnlock(&tunnel->lock);
+            break;
+        }
+
+        buf = &tunnel->bufs[tunnel->tail];
+        virMutexUnlock(&tunnel->lock);
+
+        /* The stream may accept less than the whole buffer at once, e.g.
+         * when the server only supports small packets */
+        while (off < buf->len) {
+            int nbytes;
+
+            if ((nbytes = virStreamSend(tunnel->st, buf->data + off,
+                                        buf->len - off)) < 0)
+                goto error;
+            off += nbytes;
+        }
+
+        virMutexLock(&tunnel->lock);
+        tunnel->bytes += buf->len;
+        tunnel->tail = (tunnel->tail + 1) % TUNNEL_SEND_BUF_COUNT;
+        tunnel->filled--;
+        virCondBroadcast(&tunnel->cond);
+        virMutexUnlock(&tunnel->lock);
+    }
+
+    if (virStreamFinish(tunnel->st) < 0)
+        goto error;
+
+    return;
+
+ abrt:
+    /* The reader has already recorded why */
+    virStreamAbort(tunnel->st);
+    virResetLastError();
+    return;
+
+ error:
+    virMutexLock(&tunnel->lock);
+    qemuMigrationTunnelSaveError(tunnel);
+    tunnel->sendFailed = true;
+    virCondBroadcast(&tunnel->cond);
+    virMutexUnlock(&tunnel->lock);
+
+    /* Make the reader stop polling and close the migration socket */
+    ignore_value(safewrite(tunnel->wakeupSendFD, &stop, 1));
+}
+
+
+static void
+qemuMigrationTunnelFree(qemuMigrationTunnelPtr tunnel)
+{
+    size_t i;
+
+    if (!tunnel)
+        return;
+
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++)
+        VIR_FREE(tunnel->bufs[i].data);
+    VIR_FORCE_CLOSE(tunnel->wakeupSendFD);
+    VIR_FORCE_CLOSE(tunnel->wakeupRecvFD);
+    virResetError(&tunnel->err);
+    virCondDestroy(&tunnel->cond);
+    virMutexDestroy(&tunnel->lock);
+    VIR_FREE(tunnel);
+}
+
+
+/**
+ * qemuMigrationTunnelStart:
+ * @st: stream to send migration data to
+ * @sock: socket QEMU writes migration data to
+ *
+ * Starts forwarding data from @sock to @st. On success, @sock is owned
+ * by the tunnel and will be closed once the tunnel is done with it.
+ *
+ * Returns the tunnel on success, NULL on error.
+ */
+qemuMigrationTunnelPtr
+qemuMigrationTunnelStart(virStreamPtr st,
+                         int sock)
+{
+    qemuMigrationTunnelPtr tunnel = NULL;
+    int wakeupFD[2] = { -1, -1 };
+    size_t i;
+
+    if (VIR_ALLOC(tunnel) < 0)
+        return NULL;
+
+    if (virMutexInit(&tunnel->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        VIR_FREE(tunnel);
+        return NULL;
+    }
+
+    if (virCondInit(&tunnel->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        virMutexDestroy(&tunnel->lock);
+        VIR_FREE(tunnel);
+        return NULL;
+    }
+
+    tunnel->st = st;
+    tunnel->sock = -1;
+
+    if (pipe2(wakeupFD, O_CLOEXEC) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to make pipe"));
+        tunnel->wakeupRecvFD = tunnel->wakeupSendFD = -1;
+        goto error;
+    }
+    tunnel->wakeupRecvFD = wakeupFD[0];
+    tunnel->wakeupSendFD = wakeupFD[1];
+
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++) {
+        if (VIR_ALLOC_N(tunnel->bufs[i].data, TUNNEL_SEND_BUF_SIZE) < 0)
+            goto error;
+    }
+
+    tunnel->sock = sock;
+
+    if (virThreadCreate(&tunnel->sender, true,
+                        qemuMigrationTunnelSender, tunnel) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration thread"));
+        goto error;
+    }
+
+    if (virThreadCreate(&tunnel->reader, true,
+                        qemuMigrationTunnelReader, tunnel) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration thread"));
+        /* Let the sender abort the stream and exit */
+        virMutexLock(&tunnel->lock);
+        tunnel->readFailed = true;
+        virCondBroadcast(&tunnel->cond);
+        virMutexUnlock(&tunnel->lock);
+        virThreadJoin(&tunnel->sender);
+        goto error;
+    }
+
+    return tunnel;
+
+ error:
+    qemuMigrationTunnelFree(tunnel);
+    return NULL;
+}
+
+
+/**
+ * qemuMigrationTunnelStop:
+ * @tunnel: the tunnel
+ * @error: whether migration failed
+ *
+ * Waits until all data QEMU wrote to the migration socket are sent and
+ * finishes the stream, or aborts the stream immediately if @error is
+ * true. The tunnel is freed in either case.
+ *
+ * Returns 0 on success, -1 if the data could not be forwarded.
+ */
+int
+qemuMigrationTunnelStop(qemuMigrationTunnelPtr tunnel,
+                        bool error)
+{
+    int rv = -1;
+    char stop = error ? 1 : 0;
+
+    /* make sure the threads finish their job and are joinable */
+    if (safewrite(tunnel->wakeupSendFD, &stop, 1) != 1) {
+        virReportSystemError(errno, "%s",
+                             _("failed to wakeup migration tunnel"));
+        goto cleanup;
+    }
+
+    virThreadJoin(&tunnel->reader);
+    virThreadJoin(&tunnel->sender);
+
+    VIR_DEBUG("Migration tunnel sent %llu bytes", tunnel->bytes);
+
+    /* Forward error from the IO threads, to this thread */
+    if (tunnel->err.code != VIR_ERR_OK) {
+        if (error)
+            rv = 0;
+        else
+            virSetError(&tunnel->err);
+        goto cleanup;
+    }
+
+    rv = 0;
+
+ cleanup:
+    qemuMigrationTunnelFree(tunnel);
+    return rv;
+}
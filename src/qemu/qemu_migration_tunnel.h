@@ -0,0 +1,35 @@
+/*
+ * qemu_migration_tunnel.h: forwarding migration data through a stream
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __QEMU_MIGRATION_TUNNEL_H__
+# define __QEMU_MIGRATION_TUNNEL_H__
+
+# include "internal.h"
+
+typedef struct _qemuMigrationTunnel qemuMigrationTunnel;
+typedef qemuMigrationTunnel *qemuMigrationTunnelPtr;
+
+qemuMigrationTunnelPtr qemuMigrationTunnelStart(virStreamPtr st,
+                                                int sock);
+
+int qemuMigrationTunnelStop(qemuMigrationTunnelPtr tunnel,
+                            bool error);
+
+#endif /* __QEMU_MIGRATION_TUNNEL_H__ */
@@ -55,6 +55,10 @@ VIR_LOG_INIT("qemu.qemu_monitor");
 #define DEBUG_IO 0
 #define DEBUG_RAW_IO 0
 
+/* Size of the incoming data buffer which is kept allocated between
+ * monitor messages */
+#define QEMU_MONITOR_MAX_KEEP_BUFFER (64 * 1024)
+
 struct _qemuMonitor {
     virObjectLockable parent;
 
@@ -69,15 +73,25 @@ struct _qemuMonitor {
     qemuMonitorCallbacksPtr cb;
     void *callbackOpaque;
 
-    /* If there's a command being processed this will be
-     * non-NULL */
-    qemuMonitorMessagePtr msg;
+    /* Commands being processed in the order they were submitted.
+     * The JSON monitor matches replies by command ID and thus may
+     * have several commands in flight, the text monitor transmits
+     * a command only after the previous one finished. */
+    qemuMonitorMessagePtr *msgs;
+    size_t nmsgs;
 
     /* Buffer incoming data ready for Text/QMP monitor
-     * code to process & find message boundaries */
+     * code to process & find message boundaries. Data
+     * between bufferStart and bufferOffset is yet to be
+     * processed, the already processed data in front of it
+     * is reclaimed lazily once we run out of space. */
+    size_t bufferStart;
     size_t bufferOffset;
     size_t bufferLength;
     char *buffer;
+    /* Position up to which the unprocessed data is known
+     * not to contain a line ending (QMP only) */
+    size_t bufferScanned;
 
     /* If anything went wrong, this will be fed back
      * the next monitor msg */
@@ -320,6 +334,7 @@ qemuMonitorDispose(void *obj)
 
     virResetError(&mon->lastError);
     virCondDestroy(&mon->notify);
+    VIR_FREE(mon->msgs);
     VIR_FREE(mon->buffer);
     virJSONValueFree(mon->options);
     VIR_FREE(mon->balloonpath);
@@ -398,6 +413,127 @@ qemuMonitorOpenPty(const char *monitor)
 }
 
 
+/* Returns the message which should be transmitted next, or NULL
+ * if there's nothing to send. */
+static qemuMonitorMessagePtr
+qemuMonitorTxMessage(qemuMonitorPtr mon)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs; i++) {
+        qemuMonitorMessagePtr msg = mon->msgs[i];
+
+        if (msg->finished)
+            continue;
+
+        if (msg->txOffset < msg->txLength)
+            return msg;
+
+        /* The text monitor can't tell replies apart, so wait for
+         * the reply to the command sent last */
+        if (!mon->json)
+            return NULL;
+    }
+
+    return NULL;
+}
+
+
+/* Returns the oldest message which was fully transmitted and
+ * still waits for its reply, or NULL if there's none. */
+static qemuMonitorMessagePtr
+qemuMonitorRxMessage(qemuMonitorPtr mon)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs; i++) {
+        qemuMonitorMessagePtr msg = mon->msgs[i];
+
+        if (msg->finished)
+            continue;
+
+        if (msg->txOffset == msg->txLength)
+            return msg;
+
+        return NULL;
+    }
+
+    return NULL;
+}
+
+
+/* Marks all pending messages as finished, e.g. because of a fatal
+ * error on the monitor channel, and wakes up their senders */
+static void
+qemuMonitorFinishMessages(qemuMonitorPtr mon)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs; i++)
+        mon->msgs[i]->finished = true;
+
+    virCondBroadcast(&mon->notify);
+}
+
+
+/**
+ * qemuMonitorFindMessage:
+ * @mon: monitor object
+ * @id: command ID or NULL
+ *
+ * Looks up the pending command with ID @id which was already
+ * transmitted to QEMU so that a reply can be matched with it.
+ * If @id is NULL, the oldest such command is returned.
+ *
+ * Returns the message or NULL if there's no such command.
+ */
+qemuMonitorMessagePtr
+qemuMonitorFindMessage(qemuMonitorPtr mon,
+                       const char *id)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs; i++) {
+        qemuMonitorMessagePtr msg = mon->msgs[i];
+
+        if (!msg->finished &&
+            msg->txOffset == msg->txLength &&
+            (!id || STREQ_NULLABLE(msg->id, id)))
+            return msg;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * qemuMonitorSkipMessages:
+ * @mon: monitor object
+ * @msg: message which got its reply
+ *
+ * QEMU replies to commands in the order they were sent, so commands
+ * transmitted before @msg which are still waiting for their reply
+ * will never get it. Finish them without a reply rather than having
+ * their senders wait forever.
+ */
+void
+qemuMonitorSkipMessages(qemuMonitorPtr mon,
+                        qemuMonitorMessagePtr msg)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs && mon->msgs[i] != msg; i++) {
+        qemuMonitorMessagePtr other = mon->msgs[i];
+
+        if (!other->finished && other->txOffset == other->txLength) {
+            VIR_WARN("No reply received for monitor command '%s'",
+                     NULLSTR(other->id));
+            other->finished = true;
+        }
+    }
+}
+
+
 /* This method processes data that has been received
  * from the monitor. Looking for async events and
  * replies/errors.
@@ -410,14 +546,13 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
 
     /* See if there's a message & whether its ready for its reply
      * ie whether its completed writing all its data */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
-        msg = mon->msg;
+    msg = qemuMonitorRxMessage(mon);
 
 #if DEBUG_IO
 # if DEBUG_RAW_IO
     char *str1 = qemuMonitorEscapeNonPrintable(msg ? msg->txBuffer : "");
-    char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer);
-    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->msg, msg, str1, str2);
+    char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer + mon->bufferStart);
+    VIR_ERROR(_("Process %d %zu %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->nmsgs, msg, str1, str2);
     VIR_FREE(str1);
     VIR_FREE(str2);
 # else
@@ -426,16 +561,29 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
 #endif
 
     PROBE(QEMU_MONITOR_IO_PROCESS,
-          "mon=%p buf=%s len=%zu", mon, mon->buffer, mon->bufferOffset);
+          "mon=%p buf=%s len=%zu", mon, mon->buffer + mon->bufferStart,
+          mon->bufferOffset - mon->bufferStart);
+
+    if (mon->json) {
+        /* QMP messages are terminated by a line ending, so there's nothing
+         * to do until one arrives. This avoids rescanning a large reply
+         * from its beginning each time another chunk of it is read. */
+        if (!memchr(mon->buffer + mon->bufferScanned, '\n',
+                    mon->bufferOffset - mon->bufferScanned)) {
+            mon->bufferScanned = mon->bufferOffset;
+            return 0;
+        }
 
-    if (mon->json)
         len = qemuMonitorJSONIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
+                                       mon->buffer + mon->bufferStart,
+                                       mon->bufferOffset - mon->bufferStart,
                                        msg);
-    else
+    } else {
         len = qemuMonitorTextIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
+                                       mon->buffer + mon->bufferStart,
+                                       mon->bufferOffset - mon->bufferStart,
                                        msg);
+    }
 
     if (len < 0)
         return -1;
@@ -443,17 +591,25 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
     if (len && mon->waitGreeting)
         mon->waitGreeting = false;
 
-    if (len < mon->bufferOffset) {
-        memmove(mon->buffer, mon->buffer + len, mon->bufferOffset - len);
-        mon->bufferOffset -= len;
-    } else {
-        VIR_FREE(mon->buffer);
-        mon->bufferOffset = mon->bufferLength = 0;
+    /* Whatever is left is an incomplete message, all complete ones
+     * were consumed */
+    mon->bufferStart += len;
+    mon->bufferScanned = mon->bufferOffset;
+    if (mon->bufferStart == mon->bufferOffset) {
+        /* Keep a moderately sized buffer for reuse, but don't hold on
+         * to the memory after an exceptionally large reply */
+        if (mon->bufferLength > QEMU_MONITOR_MAX_KEEP_BUFFER) {
+            VIR_FREE(mon->buffer);
+            mon->bufferLength = 0;
+        }
+        mon->bufferStart = mon->bufferOffset = mon->bufferScanned = 0;
     }
 #if DEBUG_IO
     VIR_DEBUG("Process done %d used %d", (int)mon->bufferOffset, len);
 #endif
-    if (msg && msg->finished)
+    /* With pipelined commands the reply may belong to a message other
+     * than @msg, so wake up all senders to let them check */
+    if (len && mon->nmsgs)
         virCondBroadcast(&mon->notify);
     return len;
 }
@@ -508,47 +664,55 @@ qemuMonitorIOWriteWithFD(qemuMonitorPtr mon,
 static int
 qemuMonitorIOWrite(qemuMonitorPtr mon)
 {
+    qemuMonitorMessagePtr msg;
     int done;
+    int ret = 0;
     char *buf;
     size_t len;
 
-    /* If no active message, or fully transmitted, the no-op */
-    if (!mon->msg || mon->msg->txOffset == mon->msg->txLength)
-        return 0;
+    /* Keep writing queued messages until the socket blocks or there's
+     * nothing left we are allowed to send */
+    while ((msg = qemuMonitorTxMessage(mon))) {
+        if (msg->txFD != -1 && !mon->hasSendFD) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Monitor does not support sending of file descriptors"));
+            return -1;
+        }
 
-    if (mon->msg->txFD != -1 && !mon->hasSendFD) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Monitor does not support sending of file descriptors"));
-        return -1;
-    }
+        buf = msg->txBuffer + msg->txOffset;
+        len = msg->txLength - msg->txOffset;
+        if (msg->txFD == -1)
+            done = write(mon->fd, buf, len);
+        else
+            done = qemuMonitorIOWriteWithFD(mon, buf, len, msg->txFD);
 
-    buf = mon->msg->txBuffer + mon->msg->txOffset;
-    len = mon->msg->txLength - mon->msg->txOffset;
-    if (mon->msg->txFD == -1)
-        done = write(mon->fd, buf, len);
-    else
-        done = qemuMonitorIOWriteWithFD(mon, buf, len, mon->msg->txFD);
+        PROBE(QEMU_MONITOR_IO_WRITE,
+              "mon=%p buf=%s len=%zu ret=%d errno=%d",
+              mon, buf, len, done, done < 0 ? errno : 0);
 
-    PROBE(QEMU_MONITOR_IO_WRITE,
-          "mon=%p buf=%s len=%zu ret=%d errno=%d",
-          mon, buf, len, done, done < 0 ? errno : 0);
+        if (msg->txFD != -1) {
+            PROBE(QEMU_MONITOR_IO_SEND_FD,
+                  "mon=%p fd=%d ret=%d errno=%d",
+                  mon, msg->txFD, done, done < 0 ? errno : 0);
+        }
 
-    if (mon->msg->txFD != -1) {
-        PROBE(QEMU_MONITOR_IO_SEND_FD,
-              "mon=%p fd=%d ret=%d errno=%d",
-              mon, mon->msg->txFD, done, done < 0 ? errno : 0);
-    }
+        if (done < 0) {
+            if (errno == EAGAIN)
+                return ret;
 
-    if (done < 0) {
-        if (errno == EAGAIN)
-            return 0;
+            virReportSystemError(errno, "%s",
+                                 _("Unable to write to monitor"));
+            return -1;
+        }
+        msg->txOffset += done;
+        ret += done;
 
-        virReportSystemError(errno, "%s",
-                             _("Unable to write to monitor"));
-        return -1;
+        /* Partial write, the socket is full */
+        if (msg->txOffset < msg->txLength)
+            break;
     }
-    mon->msg->txOffset += done;
-    return done;
+
+    return ret;
 }
 
 
@@ -564,12 +728,25 @@ qemuMonitorIORead(qemuMonitorPtr mon)
     size_t avail = mon->bufferLength - mon->bufferOffset;
     int ret = 0;
 
+    if (avail < 1024 && mon->bufferStart) {
+        /* Reclaim the space taken by already processed data */
+        memmove(mon->buffer, mon->buffer + mon->bufferStart,
+                mon->bufferOffset - mon->bufferStart + 1);
+        mon->bufferOffset -= mon->bufferStart;
+        mon->bufferScanned -= mon->bufferStart;
+        mon->bufferStart = 0;
+        avail = mon->bufferLength - mon->bufferOffset;
+    }
+
     if (avail < 1024) {
-        if (VIR_REALLOC_N(mon->buffer,
-                          mon->bufferLength + 1024) < 0)
+        /* Grow exponentially so that large replies don't need a
+         * reallocation for each 1 KiB read */
+        size_t grow = MAX(1024, mon->bufferLength);
+
+        if (VIR_REALLOC_N(mon->buffer, mon->bufferLength + grow) < 0)
             return -1;
-        mon->bufferLength += 1024;
-        avail += 1024;
+        mon->bufferLength += grow;
+        avail += grow;
     }
 
     /* Read as much as we can get into our buffer,
@@ -617,7 +794,7 @@ qemuMonitorUpdateWatch(qemuMonitorPtr mon)
     if (mon->lastError.code == VIR_ERR_OK) {
         events |= VIR_EVENT_HANDLE_READABLE;
 
-        if ((mon->msg && mon->msg->txOffset < mon->msg->txLength) &&
+        if (qemuMonitorTxMessage(mon) &&
             !mon->waitGreeting)
             events |= VIR_EVENT_HANDLE_WRITABLE;
     }
@@ -741,12 +918,9 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         }
 
         VIR_DEBUG("Error on monitor %s", NULLSTR(mon->lastError.message));
-        /* If IO process resulted in an error & we have a message,
-         * then wakeup that waiter */
-        if (mon->msg && !mon->msg->finished) {
-            mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
-        }
+        /* If IO process resulted in an error & we have messages,
+         * then wakeup their waiters */
+        qemuMonitorFinishMessages(mon);
     }
 
     qemuMonitorUpdateWatch(mon);
@@ -945,10 +1119,10 @@ qemuMonitorClose(qemuMonitorPtr mon)
         VIR_FORCE_CLOSE(mon->fd);
     }
 
-    /* In case another thread is waiting for its monitor command to be
-     * processed, we need to wake it up with appropriate error set.
+    /* In case other threads are waiting for their monitor commands to be
+     * processed, we need to wake them up with appropriate error set.
      */
-    if (mon->msg) {
+    if (mon->nmsgs) {
         if (mon->lastError.code == VIR_ERR_OK) {
             virErrorPtr err = virSaveLastError();
 
@@ -962,8 +1136,7 @@ qemuMonitorClose(qemuMonitorPtr mon)
                 virResetLastError();
             }
         }
-        mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
+        qemuMonitorFinishMessages(mon);
     }
 
     /* Propagate existing monitor error in case the current thread has no
@@ -987,10 +1160,43 @@ qemuMonitorNextCommandID(qemuMonitorPtr mon)
 }
 
 
+static void
+qemuMonitorDequeueMessage(qemuMonitorPtr mon,
+                          qemuMonitorMessagePtr msg)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nmsgs; i++) {
+        if (mon->msgs[i] == msg) {
+            VIR_DELETE_ELEMENT(mon->msgs, i, mon->nmsgs);
+            return;
+        }
+    }
+}
+
+
+/**
+ * qemuMonitorSendBatch:
+ * @mon: monitor object
+ * @msgs: array of messages to send
+ * @nmsgs: number of messages in @msgs
+ *
+ * Queues all of @msgs for transmission and waits until every one of
+ * them got its reply. On the JSON monitor the commands are pipelined,
+ * i.e. they are all written to QEMU without waiting for the replies of
+ * the preceding ones, which are then matched by their command ID. The
+ * text monitor still processes them one by one.
+ *
+ * Returns 0 on success, -1 if the monitor failed before all replies
+ * were received.
+ */
 int
-qemuMonitorSend(qemuMonitorPtr mon,
-                qemuMonitorMessagePtr msg)
+qemuMonitorSendBatch(qemuMonitorPtr mon,
+                     qemuMonitorMessagePtr *msgs,
+                     size_t nmsgs)
 {
+    size_t i;
+    size_t queued = 0;
     int ret = -1;
 
     /* Check whether qemu quit unexpectedly */
@@ -1001,18 +1207,24 @@ qemuMonitorSend(qemuMonitorPtr mon,
         return -1;
     }
 
-    mon->msg = msg;
-    qemuMonitorUpdateWatch(mon);
-
-    PROBE(QEMU_MONITOR_SEND_MSG,
-          "mon=%p msg=%s fd=%d",
-          mon, mon->msg->txBuffer, mon->msg->txFD);
+    for (i = 0; i < nmsgs; i++) {
+        PROBE(QEMU_MONITOR_SEND_MSG,
+              "mon=%p msg=%s fd=%d",
+              mon, msgs[i]->txBuffer, msgs[i]->txFD);
 
-    while (!mon->msg->finished) {
-        if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Unable to wait on monitor condition"));
+        if (VIR_APPEND_ELEMENT_COPY(mon->msgs, mon->nmsgs, msgs[i]) < 0)
             goto cleanup;
+        queued++;
+    }
+    qemuMonitorUpdateWatch(mon);
+
+    for (i = 0; i < nmsgs; i++) {
+        while (!msgs[i]->finished) {
+            if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("Unable to wait on monitor condition"));
+                goto cleanup;
+            }
         }
     }
 
@@ -1026,13 +1238,22 @@ qemuMonitorSend(qemuMonitorPtr mon,
     ret = 0;
 
  cleanup:
-    mon->msg = NULL;
+    for (i = 0; i < queued; i++)
+        qemuMonitorDequeueMessage(mon, msgs[i]);
     qemuMonitorUpdateWatch(mon);
 
     return ret;
 }
 
 
+int
+qemuMonitorSend(qemuMonitorPtr mon,
+                qemuMonitorMessagePtr msg)
+{
+    return qemuMonitorSendBatch(mon, &msg, 1);
+}
+
+
 /**
  * This function returns a new virError object; the caller is responsible
  * for freeing it.
@@ -2206,6 +2427,44 @@ qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorGetAllBlockStatsCapacity:
+ * @mon: monitor object
+ * @ret_stats: pointer that is filled with a hash table containing the stats
+ * @backingChain: recurse into the backing chain of devices
+ *
+ * Same as qemuMonitorGetAllBlockStatsInfo followed by
+ * qemuMonitorBlockStatsUpdateCapacity, but the JSON monitor submits
+ * both queries at once. Failure to fetch the capacity is ignored.
+ *
+ * Returns < 0 on error, count of supported block stats fields on success.
+ */
+int
+qemuMonitorGetAllBlockStatsCapacity(qemuMonitorPtr mon,
+                                    virHashTablePtr *ret_stats,
+                                    bool backingChain)
+{
+    int ret;
+    VIR_DEBUG("ret_stats=%p, backing=%d", ret_stats, backingChain);
+
+    QEMU_CHECK_MONITOR(mon);
+
+    if (!mon->json)
+        return qemuMonitorGetAllBlockStatsInfo(mon, ret_stats, backingChain);
+
+    if (!(*ret_stats = virHashCreate(10, virHashValueFree)))
+        return -1;
+
+    if ((ret = qemuMonitorJSONGetAllBlockStatsCapacity(mon, *ret_stats,
+                                                       backingChain)) < 0) {
+        virHashFree(*ret_stats);
+        *ret_stats = NULL;
+    }
+
+    return ret;
+}
+
+
 /* Updates "stats" to fill virtual and physical size of the image */
 int
 qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
@@ -49,6 +49,10 @@ typedef int (*qemuMonitorPasswordHandler)(qemuMonitorPtr mon,
                                           void *opaque);
 
 struct _qemuMonitorMessage {
+    /* Command ID used to match the reply with the command
+     * (JSON monitor only) */
+    char *id;
+
     int txFD;
 
     char *txBuffer;
@@ -273,6 +277,13 @@ int qemuMonitorSetLink(qemuMonitorPtr mon,
 char *qemuMonitorNextCommandID(qemuMonitorPtr mon);
 int qemuMonitorSend(qemuMonitorPtr mon,
                     qemuMonitorMessagePtr msg);
+int qemuMonitorSendBatch(qemuMonitorPtr mon,
+                         qemuMonitorMessagePtr *msgs,
+                         size_t nmsgs);
+qemuMonitorMessagePtr qemuMonitorFindMessage(qemuMonitorPtr mon,
+                                             const char *id);
+void qemuMonitorSkipMessages(qemuMonitorPtr mon,
+                             qemuMonitorMessagePtr msg);
 virJSONValuePtr qemuMonitorGetOptions(qemuMonitorPtr mon)
     ATTRIBUTE_NONNULL(1);
 void qemuMonitorSetOptions(qemuMonitorPtr mon, virJSONValuePtr options)
@@ -503,6 +514,11 @@ int qemuMonitorBlockStatsUpdateCapacity(qemuMonitorPtr mon,
                                         bool backingChain)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
+int qemuMonitorGetAllBlockStatsCapacity(qemuMonitorPtr mon,
+                                        virHashTablePtr *ret_stats,
+                                        bool backingChain)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 int qemuMonitorBlockResize(qemuMonitorPtr mon,
                            const char *dev_name,
                            unsigned long long size);
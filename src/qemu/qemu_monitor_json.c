@@ -207,11 +207,28 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
         ret = qemuMonitorJSONIOProcessEvent(mon, obj);
     } else if (virJSONValueObjectHasKey(obj, "error") == 1 ||
                virJSONValueObjectHasKey(obj, "return") == 1) {
+        const char *id = virJSONValueObjectGetString(obj, "id");
+        qemuMonitorMessagePtr target = NULL;
+
         PROBE(QEMU_MONITOR_RECV_REPLY,
               "mon=%p reply=%s", mon, line);
-        if (msg) {
-            msg->rxObject = obj;
-            msg->finished = 1;
+
+        /* With several commands in flight the reply needs to be matched
+         * by its ID. Replies lacking the ID (e.g. errors for malformed
+         * commands) belong to the oldest command, as QEMU processes
+         * them in order. That one is looked up for every reply since a
+         * single read may carry several of them. */
+        if (id)
+            target = qemuMonitorFindMessage(mon, id);
+        if (!target)
+            target = qemuMonitorFindMessage(mon, NULL);
+        if (!target && msg && !msg->finished)
+            target = msg;
+
+        if (target) {
+            qemuMonitorSkipMessages(mon, target);
+            target->rxObject = obj;
+            target->finished = 1;
             obj = NULL;
             ret = 0;
         } else {
@@ -228,8 +245,10 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
     return ret;
 }
 
+/* Processes all complete lines in @data. The lines are parsed in place,
+ * i.e. the line endings in @data are overwritten with NUL bytes. */
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
+                             char *data,
                              size_t len,
                              qemuMonitorMessagePtr msg)
 {
@@ -237,24 +256,17 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
     /*VIR_DEBUG("Data %d bytes [%s]", len, data);*/
 
     while (used < len) {
-        char *nl = strstr(data + used, LINE_ENDING);
-
-        if (nl) {
-            int got = nl - (data + used);
-            char *line;
-            if (VIR_STRNDUP(line, data + used, got) < 0)
-                return -1;
-            used += got + strlen(LINE_ENDING);
-            line[got] = '\0'; /* kill \n */
-            if (qemuMonitorJSONIOProcessLine(mon, line, msg) < 0) {
-                VIR_FREE(line);
-                return -1;
-            }
+        char *line = data + used;
+        char *nl = memmem(line, len - used,
+                          LINE_ENDING, strlen(LINE_ENDING));
 
-            VIR_FREE(line);
-        } else {
+        if (!nl)
             break;
-        }
+
+        used += nl - line + strlen(LINE_ENDING);
+        *nl = '\0'; /* kill \r\n */
+        if (qemuMonitorJSONIOProcessLine(mon, line, msg) < 0)
+            return -1;
     }
 
     VIR_DEBUG("Total used %d bytes out of %zd available in buffer", used, len);
@@ -292,6 +304,7 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
         goto cleanup;
     msg.txLength = strlen(msg.txBuffer);
     msg.txFD = scm_fd;
+    msg.id = id;
 
     VIR_DEBUG("Send command '%s' for write with FD %d", cmdstr, scm_fd);
 
@@ -328,6 +341,90 @@ qemuMonitorJSONCommand(qemuMonitorPtr mon,
     return qemuMonitorJSONCommandWithFd(mon, cmd, -1, reply);
 }
 
+
+/**
+ * qemuMonitorJSONCommandBatch:
+ * @mon: monitor object
+ * @cmds: array of commands to execute
+ * @replies: array to be filled with the replies to @cmds
+ * @ncmds: number of commands in @cmds
+ *
+ * Submits all of @cmds at once without waiting for the reply of the
+ * previous command before sending the next one and waits until all the
+ * replies arrive. Reply i is stored in @replies[i] and the caller has to
+ * check each of them for errors, e.g. using qemuMonitorJSONCheckError.
+ *
+ * Returns 0 if all replies were received, -1 otherwise (in which case
+ * @replies is left untouched).
+ */
+int
+qemuMonitorJSONCommandBatch(qemuMonitorPtr mon,
+                            virJSONValuePtr *cmds,
+                            virJSONValuePtr *replies,
+                            size_t ncmds)
+{
+    qemuMonitorMessagePtr msgs = NULL;
+    qemuMonitorMessagePtr *msgptrs = NULL;
+    char *cmdstr = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(msgs, ncmds) < 0 ||
+        VIR_ALLOC_N(msgptrs, ncmds) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        msgs[i].txFD = -1;
+        msgptrs[i] = &msgs[i];
+
+        if (!(msgs[i].id = qemuMonitorNextCommandID(mon)))
+            goto cleanup;
+        if (virJSONValueObjectAppendString(cmds[i], "id", msgs[i].id) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to append command 'id' string"));
+            goto cleanup;
+        }
+
+        if (!(cmdstr = virJSONValueToString(cmds[i], false)))
+            goto cleanup;
+        if (virAsprintf(&msgs[i].txBuffer, "%s\r\n", cmdstr) < 0)
+            goto cleanup;
+        msgs[i].txLength = strlen(msgs[i].txBuffer);
+
+        VIR_DEBUG("Queue command '%s' in batch of %zu", cmdstr, ncmds);
+        VIR_FREE(cmdstr);
+    }
+
+    if (qemuMonitorSendBatch(mon, msgptrs, ncmds) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        if (!msgs[i].rxObject) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Missing monitor reply object"));
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < ncmds; i++) {
+        replies[i] = msgs[i].rxObject;
+        msgs[i].rxObject = NULL;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; msgs && i < ncmds; i++) {
+        VIR_FREE(msgs[i].id);
+        VIR_FREE(msgs[i].txBuffer);
+        virJSONValueFree(msgs[i].rxObject);
+    }
+    VIR_FREE(msgs);
+    VIR_FREE(msgptrs);
+    VIR_FREE(cmdstr);
+    return ret;
+}
+
 /* Ignoring OOM in this method, since we're already reporting
  * a more important error
  *
@@ -1971,32 +2068,24 @@ qemuMonitorJSONGetOneBlockStatsInfo(virJSONValuePtr dev,
 }
 
 
-int
-qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+static int
+qemuMonitorJSONParseBlockStatsReply(virJSONValuePtr cmd,
+                                    virJSONValuePtr reply,
                                     virHashTablePtr hash,
                                     bool backingChain)
 {
-    int ret = -1;
     int nstats = 0;
     int rc;
     size_t i;
-    virJSONValuePtr cmd;
-    virJSONValuePtr reply = NULL;
     virJSONValuePtr devices;
 
-    if (!(cmd = qemuMonitorJSONMakeCommand("query-blockstats", NULL)))
-        return -1;
-
-    if ((rc = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
-        goto cleanup;
-
     if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+        return -1;
 
     if (!(devices = virJSONValueObjectGetArray(reply, "return"))) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("blockstats reply was missing device list"));
-        goto cleanup;
+        return -1;
     }
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
@@ -2007,27 +2096,46 @@ qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("blockstats device entry was not "
                              "in expected format"));
-            goto cleanup;
+            return -1;
         }
 
         if (!(dev_name = virJSONValueObjectGetString(dev, "device"))) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("blockstats device entry was not "
                              "in expected format"));
-            goto cleanup;
+            return -1;
         }
 
         rc = qemuMonitorJSONGetOneBlockStatsInfo(dev, dev_name, 0, hash,
                                                  backingChain);
 
         if (rc < 0)
-            goto cleanup;
+            return -1;
 
         if (rc > nstats)
             nstats = rc;
     }
 
-    ret = nstats;
+    return nstats;
+}
+
+
+int
+qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                    virHashTablePtr hash,
+                                    bool backingChain)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-blockstats", NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+        goto cleanup;
+
+    ret = qemuMonitorJSONParseBlockStatsReply(cmd, reply, hash, backingChain);
 
  cleanup:
     virJSONValueFree(cmd);
@@ -2085,17 +2193,12 @@ qemuMonitorJSONBlockStatsUpdateCapacityOne(virJSONValuePtr image,
 }
 
 
-int
-qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
-                                        virHashTablePtr stats,
-                                        bool backingChain)
+static int
+qemuMonitorJSONBlockStatsUpdateCapacityDevices(virJSONValuePtr devices,
+                                               virHashTablePtr stats,
+                                               bool backingChain)
 {
-    int ret = -1;
     size_t i;
-    virJSONValuePtr devices;
-
-    if (!(devices = qemuMonitorJSONQueryBlock(mon)))
-        return -1;
 
     for (i = 0; i < virJSONValueArraySize(devices); i++) {
         virJSONValuePtr dev;
@@ -2104,10 +2207,10 @@ qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
         const char *dev_name;
 
         if (!(dev = qemuMonitorJSONGetBlockDev(devices, i)))
-            goto cleanup;
+            return -1;
 
         if (!(dev_name = qemuMonitorJSONGetBlockDevDevice(dev)))
-            goto cleanup;
+            return -1;
 
         /* drive may be empty */
         if (!(inserted = virJSONValueObjectGetObject(dev, "inserted")) ||
@@ -2117,17 +2220,83 @@ qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
         if (qemuMonitorJSONBlockStatsUpdateCapacityOne(image, dev_name, 0,
                                                        stats,
                                                        backingChain) < 0)
-            goto cleanup;
+            return -1;
     }
 
-    ret = 0;
+    return 0;
+}
+
+
+int
+qemuMonitorJSONBlockStatsUpdateCapacity(qemuMonitorPtr mon,
+                                        virHashTablePtr stats,
+                                        bool backingChain)
+{
+    int ret;
+    virJSONValuePtr devices;
+
+    if (!(devices = qemuMonitorJSONQueryBlock(mon)))
+        return -1;
+
+    ret = qemuMonitorJSONBlockStatsUpdateCapacityDevices(devices, stats,
+                                                         backingChain);
 
- cleanup:
     virJSONValueFree(devices);
     return ret;
 }
 
 
+/**
+ * qemuMonitorJSONGetAllBlockStatsCapacity:
+ *
+ * Combination of qemuMonitorJSONGetAllBlockStatsInfo and
+ * qemuMonitorJSONBlockStatsUpdateCapacity which submits both
+ * 'query-blockstats' and 'query-block' at once so that the round trip
+ * to QEMU is paid just once. Failure to fetch the capacity is not
+ * considered fatal, the capacity fields are left zeroed in that case.
+ *
+ * Returns the count of supported block stats fields, -1 on error.
+ */
+int
+qemuMonitorJSONGetAllBlockStatsCapacity(qemuMonitorPtr mon,
+                                        virHashTablePtr hash,
+                                        bool backingChain)
+{
+    int ret = -1;
+    virJSONValuePtr cmds[2] = { NULL, NULL };
+    virJSONValuePtr replies[2] = { NULL, NULL };
+    virJSONValuePtr devices;
+
+    if (!(cmds[0] = qemuMonitorJSONMakeCommand("query-blockstats", NULL)) ||
+        !(cmds[1] = qemuMonitorJSONMakeCommand("query-block", NULL)))
+        goto cleanup;
+
+    if (qemuMonitorJSONCommandBatch(mon, cmds, replies,
+                                    ARRAY_CARDINALITY(cmds)) < 0)
+        goto cleanup;
+
+    if ((ret = qemuMonitorJSONParseBlockStatsReply(cmds[0], replies[0],
+                                                   hash, backingChain)) < 0)
+        goto cleanup;
+
+    if (qemuMonitorJSONCheckError(cmds[1], replies[1]) < 0 ||
+        !(devices = virJSONValueObjectGetArray(replies[1], "return")) ||
+        qemuMonitorJSONBlockStatsUpdateCapacityDevices(devices, hash,
+                                                       backingChain) < 0) {
+        VIR_DEBUG("failed to update block capacity: %s",
+                  virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+ cleanup:
+    virJSONValueFree(cmds[0]);
+    virJSONValueFree(cmds[1]);
+    virJSONValueFree(replies[0]);
+    virJSONValueFree(replies[1]);
+    return ret;
+}
+
+
 /* Return 0 on success, -1 on failure, or -2 if not supported.  Size
  * is in bytes.  */
 int qemuMonitorJSONBlockResize(qemuMonitorPtr mon,
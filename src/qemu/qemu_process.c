@@ -77,6 +77,7 @@
 #include "nwfilter_conf.h"
 #include "netdev_bandwidth_conf.h"
 #include "virresctrl.h"
+#include "virthreadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -107,6 +108,8 @@ qemuProcessRemoveDomainStatus(virQEMUDriverPtr driver,
                  vm->def->name, virStrerror(errno, ebuf, sizeof(ebuf)));
     VIR_FREE(file);
 
+    virDomainRemoveStatusJournal(cfg->stateDir, vm);
+
     if (priv->pidfile &&
         unlink(priv->pidfile) < 0 &&
         errno != ENOENT)
@@ -3256,10 +3259,24 @@ qemuProcessBuildDestroyHugepagesPath(virQEMUDriverPtr driver,
 }
 
 
+typedef struct _qemuProcessReconnectPool qemuProcessReconnectPool;
+typedef qemuProcessReconnectPool *qemuProcessReconnectPoolPtr;
+struct _qemuProcessReconnectPool {
+    virThreadPoolPtr pool;
+
+    virMutex lock;
+    virCond cond;
+    size_t pending;     /* Reconnects queued or in progress */
+    size_t ndomains;    /* Reconnects queued in total */
+    unsigned long long start;
+};
+
 struct qemuProcessReconnectData {
     virConnectPtr conn;
     virQEMUDriverPtr driver;
     virDomainObjPtr obj;
+    qemuProcessReconnectPoolPtr pool;
+    struct qemuDomainJobObj oldjob;
 };
 /*
  * Open an existing VM's monitor, re-detect VCPU threads
@@ -3269,10 +3286,10 @@ struct qemuProcessReconnectData {
  * this thread function has increased the reference counter to it
  * so that we now have to close it.
  *
- * This function also inherits a locked and ref'd domain object.
+ * This function also inherits a ref'd domain object with the job
+ * already started, and locks it itself.
  *
  * This function needs to:
- * 1. Enter job
  * 1. just before monitor reconnect do lightweight MonitorEnter
  *    (increase VM refcount and unlock VM)
  * 2. reconnect to monitor
@@ -3291,18 +3308,18 @@ qemuProcessReconnect(void *opaque)
     virDomainObjPtr obj = data->obj;
     qemuDomainObjPrivatePtr priv;
     virConnectPtr conn = data->conn;
-    struct qemuDomainJobObj oldjob;
+    struct qemuDomainJobObj oldjob = data->oldjob;
     int state;
     int reason;
     virQEMUDriverConfigPtr cfg;
     size_t i;
     unsigned int stopFlags = 0;
-    bool jobStarted = false;
     virCapsPtr caps = NULL;
 
     VIR_FREE(data);
 
-    qemuDomainObjRestoreJob(obj, &oldjob);
+    virObjectLock(obj);
+
     if (oldjob.asyncJob == QEMU_ASYNC_JOB_MIGRATION_IN)
         stopFlags |= VIR_QEMU_PROCESS_STOP_MIGRATED;
 
@@ -3312,10 +3329,6 @@ qemuProcessReconnect(void *opaque)
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
         goto error;
 
-    if (qemuDomainObjBeginJob(driver, obj, QEMU_JOB_MODIFY) < 0)
-        goto error;
-    jobStarted = true;
-
     /* XXX If we ever gonna change pid file pattern, come up with
      * some intelligence here to deal with old paths. */
     if (!(priv->pidfile = virPidFileBuildPath(cfg->stateDir, obj->def->name)))
@@ -3474,8 +3487,7 @@ qemuProcessReconnect(void *opaque)
         driver->inhibitCallback(true, driver->inhibitOpaque);
 
  cleanup:
-    if (jobStarted)
-        qemuDomainObjEndJob(driver, obj);
+    qemuDomainObjEndJob(driver, obj);
     if (!virDomainObjIsActive(obj))
         qemuDomainRemoveInactive(driver, obj);
     virDomainObjEndAPI(&obj);
@@ -3501,15 +3513,104 @@ qemuProcessReconnect(void *opaque)
              * really is and FAILED means "failed to start" */
             state = VIR_DOMAIN_SHUTOFF_UNKNOWN;
         }
-        /* If BeginJob failed, we jumped here without a job, let's hope another
-         * thread didn't have a chance to start playing with the domain yet
-         * (it's all we can do anyway).
-         */
         qemuProcessStop(driver, obj, state, QEMU_ASYNC_JOB_NONE, stopFlags);
     }
     goto cleanup;
 }
 
+static void
+qemuProcessReconnectWorker(void *jobdata,
+                           void *opaque)
+{
+    qemuProcessReconnectPoolPtr pool = opaque;
+
+    qemuProcessReconnect(jobdata);
+
+    virMutexLock(&pool->lock);
+    if (--pool->pending == 0)
+        virCondSignal(&pool->cond);
+    virMutexUnlock(&pool->lock);
+}
+
+
+static void
+qemuProcessReconnectPoolFree(qemuProcessReconnectPoolPtr pool)
+{
+    if (!pool)
+        return;
+
+    virThreadPoolFree(pool->pool);
+    virCondDestroy(&pool->cond);
+    virMutexDestroy(&pool->lock);
+    VIR_FREE(pool);
+}
+
+
+static qemuProcessReconnectPoolPtr
+qemuProcessReconnectPoolNew(virQEMUDriverPtr driver)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuProcessReconnectPoolPtr pool;
+
+    if (VIR_ALLOC(pool) < 0)
+        goto error;
+
+    if (virMutexInit(&pool->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(pool);
+        goto error;
+    }
+
+    if (virCondInit(&pool->cond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize condition variable"));
+        virMutexDestroy(&pool->lock);
+        VIR_FREE(pool);
+        goto error;
+    }
+
+    if (!(pool->pool = virThreadPoolNew(0, cfg->reconnectWorkers, 0,
+                                        qemuProcessReconnectWorker,
+                                        pool))) {
+        qemuProcessReconnectPoolFree(pool);
+        goto error;
+    }
+
+    ignore_value(virTimeMillisNow(&pool->start));
+
+    virObjectUnref(cfg);
+    return pool;
+
+ error:
+    virObjectUnref(cfg);
+    return NULL;
+}
+
+
+/*
+ * Wait for all reconnects queued to @opaque to finish, then get
+ * rid of the pool and report how long it took.
+ */
+static void
+qemuProcessReconnectPoolWait(void *opaque)
+{
+    qemuProcessReconnectPoolPtr pool = opaque;
+    unsigned long long now;
+
+    virMutexLock(&pool->lock);
+    while (pool->pending > 0)
+        ignore_value(virCondWait(&pool->cond, &pool->lock));
+    virMutexUnlock(&pool->lock);
+
+    if (virTimeMillisNow(&now) == 0)
+        VIR_INFO("Reconnected to %zu running domains in %llu ms",
+                 pool->ndomains, now - pool->start);
+
+    qemuProcessReconnectPoolFree(pool);
+}
+
+
 static int
 qemuProcessReconnectHelper(virDomainObjPtr obj,
                            void *opaque)
@@ -3517,6 +3618,7 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
     virThread thread;
     struct qemuProcessReconnectData *src = opaque;
     struct qemuProcessReconnectData *data;
+    int rc;
 
     /* If the VM was inactive, we don't need to reconnect */
     if (!obj->pid)
@@ -3528,8 +3630,11 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
     memcpy(data, src, sizeof(*data));
     data->obj = obj;
 
-    /* this lock and reference will be eventually transferred to the thread
-     * that handles the reconnect */
+    /* This reference and the job will be eventually transferred to the
+     * thread that handles the reconnect. The job is started right away
+     * so that APIs wait for the reconnect, but the domain is not kept
+     * locked while the reconnect is queued, the thread locks it itself.
+     */
     virObjectLock(obj);
     virObjectRef(obj);
 
@@ -3539,17 +3644,43 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
      */
     virObjectRef(data->conn);
 
-    if (virThreadCreate(&thread, false, qemuProcessReconnect, data) < 0) {
+    qemuDomainObjRestoreJob(obj, &data->oldjob);
+    if (qemuDomainObjBeginJob(src->driver, obj, QEMU_JOB_MODIFY) < 0) {
+        /* We can't get the monitor back without a job, kill qemu to remove
+         * danger of it ending up running twice */
+        qemuProcessStop(src->driver, obj, VIR_DOMAIN_SHUTOFF_FAILED,
+                        QEMU_ASYNC_JOB_NONE, 0);
+        qemuDomainRemoveInactive(src->driver, obj);
+
+        virDomainObjEndAPI(&obj);
+        virObjectUnref(data->conn);
+        VIR_FREE(data);
+        return -1;
+    }
+    virObjectUnlock(obj);
+
+    if (src->pool) {
+        virMutexLock(&src->pool->lock);
+        if ((rc = virThreadPoolSendJob(src->pool->pool, 0, data)) == 0) {
+            src->pool->pending++;
+            src->pool->ndomains++;
+        }
+        virMutexUnlock(&src->pool->lock);
+    } else {
+        rc = virThreadCreate(&thread, false, qemuProcessReconnect, data);
+    }
+
+    if (rc < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Could not create thread. QEMU initialization "
                          "might be incomplete"));
-        /* We can't spawn a thread and thus connect to monitor. Kill qemu.
-         * It's safe to call qemuProcessStop without a job here since there
-         * is no thread that could be doing anything else with the same domain
-         * object.
+        /* We can't spawn a thread and thus connect to monitor. Kill qemu
+         * within the job started above.
          */
+        virObjectLock(obj);
         qemuProcessStop(src->driver, obj, VIR_DOMAIN_SHUTOFF_FAILED,
                         QEMU_ASYNC_JOB_NONE, 0);
+        qemuDomainObjEndJob(src->driver, obj);
         qemuDomainRemoveInactive(src->driver, obj);
 
         virDomainObjEndAPI(&obj);
@@ -3565,13 +3696,29 @@ qemuProcessReconnectHelper(virDomainObjPtr obj,
  * qemuProcessReconnectAll
  *
  * Try to re-open the resources for live VMs that we care
- * about.
+ * about. The reconnects run in the background, at most
+ * reconnect_workers of them at a time.
  */
 void
 qemuProcessReconnectAll(virConnectPtr conn, virQEMUDriverPtr driver)
 {
     struct qemuProcessReconnectData data = {.conn = conn, .driver = driver};
+    virThread thread;
+
+    /* Should the pool be unavailable, fall back to a thread per domain */
+    data.pool = qemuProcessReconnectPoolNew(driver);
+
     virDomainObjListForEach(driver->domains, qemuProcessReconnectHelper, &data);
+
+    if (!data.pool)
+        return;
+
+    if (virThreadCreate(&thread, false, qemuProcessReconnectPoolWait,
+                        data.pool) < 0) {
+        VIR_WARN("Unable to create thread to wait for reconnects, "
+                 "waiting in place");
+        qemuProcessReconnectPoolWait(data.pool);
+    }
 }
 
 static int
@@ -4763,7 +4910,7 @@ qemuProcessInit(virQEMUDriverPtr driver,
             goto cleanup;
         }
     } else {
-        vm->def->id = qemuDriverAllocateID(driver);
+        virDomainObjListSetID(driver->domains, vm, qemuDriverAllocateID(driver));
         qemuDomainSetFakeReboot(driver, vm, false);
         virDomainObjSetState(vm, VIR_DOMAIN_PAUSED, VIR_DOMAIN_PAUSED_STARTING_UP);
 
@@ -6114,7 +6261,7 @@ void qemuProcessStop(virQEMUDriverPtr driver,
 
     qemuProcessBuildDestroyHugepagesPath(driver, vm, false);
 
-    vm->def->id = -1;
+    virDomainObjListSetID(driver->domains, vm, -1);
 
     if (virAtomicIntDecAndTest(&driver->nactive) && driver->inhibitCallback)
         driver->inhibitCallback(false, driver->inhibitOpaque);
@@ -6435,7 +6582,7 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
     if (virDomainObjSetDefTransient(caps, driver->xmlopt, vm) < 0)
         goto error;
 
-    vm->def->id = qemuDriverAllocateID(driver);
+    virDomainObjListSetID(driver->domains, vm, qemuDriverAllocateID(driver));
 
     if (virAtomicIntInc(&driver->nactive) == 1 && driver->inhibitCallback)
         driver->inhibitCallback(true, driver->inhibitOpaque);
@@ -0,0 +1,589 @@
+/*
+ * qemu_stats_sampler.c: periodic sampling of domain stats
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "qemu_stats_sampler.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virhash.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "virtypedparam.h"
+#include "viruuid.h"
+
+#define VIR_FROM_THIS VIR_FROM_QEMU
+
+VIR_LOG_INIT("qemu.qemu_stats_sampler");
+
+/* Periodic sampling of domain stats for virConnectDomainStatsEventRegister.
+ * One thread collects the union of the groups requested by the
+ * subscribers and every subscriber gets its share of the same sample. */
+typedef struct _qemuStatsSubscriber qemuStatsSubscriber;
+typedef qemuStatsSubscriber *qemuStatsSubscriberPtr;
+struct _qemuStatsSubscriber {
+    int callbackID;
+    unsigned int stats;
+    unsigned int flags;
+    bool primed; /* a complete sample was delivered already */
+};
+
+struct _qemuStatsSampler {
+    virMutex lock;
+    virCond cond;
+
+    /* stats flag of each group, in the order samples store them */
+    unsigned int *groups;
+    size_t ngroups;
+    unsigned long long interval; /* milliseconds between samples */
+    qemuStatsSamplerCollectFunc collect;
+    qemuStatsSamplerEmitFunc emit;
+    void *opaque;
+
+    virThread thread;
+    bool running;
+    bool quit;
+    unsigned long long next; /* when the next sample is due */
+
+    qemuStatsSubscriberPtr subscribers;
+    size_t nsubscribers;
+
+    /* The previous sample, deltas are computed against it */
+    unsigned int prevStats;
+    qemuStatsSamplePtr prev;
+    size_t nprev;
+    virHashTablePtr prevIndex; /* UUID string -> item of @prev */
+};
+
+
+void
+qemuStatsSamplesFree(qemuStatsSamplePtr samples,
+                     size_t nsamples)
+{
+    size_t i;
+
+    for (i = 0; i < nsamples; i++) {
+        virDomainStatsEventRecordClear(&samples[i].record);
+        VIR_FREE(samples[i].ends);
+    }
+    VIR_FREE(samples);
+}
+
+
+static void
+qemuStatsSamplerClearPrev(qemuStatsSamplerPtr sampler)
+{
+    virHashRemoveAll(sampler->prevIndex);
+    qemuStatsSamplesFree(sampler->prev, sampler->nprev);
+    sampler->prev = NULL;
+    sampler->nprev = 0;
+    sampler->prevStats = 0;
+}
+
+
+static bool
+qemuStatsParamEqual(virTypedParameterPtr a,
+                    virTypedParameterPtr b)
+{
+    if (a->type != b->type)
+        return false;
+
+    switch ((virTypedParameterType) a->type) {
+    case VIR_TYPED_PARAM_INT:
+        return a->value.i == b->value.i;
+    case VIR_TYPED_PARAM_UINT:
+        return a->value.ui == b->value.ui;
+    case VIR_TYPED_PARAM_LLONG:
+        return a->value.l == b->value.l;
+    case VIR_TYPED_PARAM_ULLONG:
+        return a->value.ul == b->value.ul;
+    case VIR_TYPED_PARAM_DOUBLE:
+        return a->value.d == b->value.d;
+    case VIR_TYPED_PARAM_BOOLEAN:
+        return a->value.b == b->value.b;
+    case VIR_TYPED_PARAM_STRING:
+        return STREQ_NULLABLE(a->value.s, b->value.s);
+    case VIR_TYPED_PARAM_LAST:
+        break;
+    }
+
+    return false;
+}
+
+
+/* Returns true if @param, the @idx-th parameter of the current sample of
+ * a domain, has the same value in the domain's previous sample @prev */
+static bool
+qemuStatsParamUnchanged(qemuStatsSamplePtr prev,
+                        virTypedParameterPtr param,
+                        int idx)
+{
+    virTypedParameterPtr old = NULL;
+
+    /* The domain usually reports the same fields in the same order */
+    if (idx < prev->record.nparams &&
+        STREQ(prev->record.params[idx].field, param->field))
+        old = &prev->record.params[idx];
+    else
+        old = virTypedParamsGet(prev->record.params, prev->record.nparams,
+                                param->field);
+
+    return old && qemuStatsParamEqual(old, param);
+}
+
+
+/**
+ * qemuStatsSamplerBuild:
+ *
+ * Picks the groups @sub subscribed to from @samples, leaving out the
+ * parameters which didn't change if the subscriber asked for deltas.
+ * Must be called with the sampler lock held.
+ *
+ * Returns the number of items in @records, or -1 on error.
+ */
+static int
+qemuStatsSamplerBuild(qemuStatsSamplerPtr sampler,
+                      qemuStatsSubscriberPtr sub,
+                      qemuStatsSamplePtr samples,
+                      size_t nsamples,
+                      virDomainStatsEventRecordPtr *records)
+{
+    virDomainStatsEventRecordPtr tmp = NULL;
+    size_t ntmp = 0;
+    bool delta = sub->primed &&
+                 sub->flags & VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA &&
+                 !(sub->stats & ~sampler->prevStats);
+    size_t i;
+    size_t j;
+    int k;
+
+    if (nsamples && VIR_ALLOC_N(tmp, nsamples) < 0)
+        return -1;
+
+    for (i = 0; i < nsamples; i++) {
+        qemuStatsSamplePtr sample = &samples[i];
+        qemuStatsSamplePtr prev = NULL;
+        virDomainStatsEventRecordPtr dst = &tmp[ntmp++];
+        char uuidstr[VIR_UUID_STRING_BUFLEN];
+        int start = 0;
+
+        if (delta) {
+            virUUIDFormat(sample->record.uuid, uuidstr);
+            prev = virHashLookup(sampler->prevIndex, uuidstr);
+        }
+
+        dst->id = sample->record.id;
+        memcpy(dst->uuid, sample->record.uuid, VIR_UUID_BUFLEN);
+        if (VIR_STRDUP(dst->name, sample->record.name) < 0)
+            goto error;
+
+        if (sample->record.nparams &&
+            VIR_ALLOC_N(dst->params, sample->record.nparams) < 0)
+            goto error;
+
+        for (j = 0; j < sampler->ngroups; j++) {
+            int end = sample->ends[j];
+
+            if (!(sub->stats & sampler->groups[j])) {
+                start = end;
+                continue;
+            }
+
+            for (k = start; k < end; k++) {
+                virTypedParameterPtr param = &sample->record.params[k];
+                virTypedParameterPtr copy = &dst->params[dst->nparams];
+
+                if (prev && qemuStatsParamUnchanged(prev, param, k))
+                    continue;
+
+                *copy = *param;
+                if (param->type == VIR_TYPED_PARAM_STRING &&
+                    VIR_STRDUP(copy->value.s, param->value.s) < 0)
+                    goto error;
+                dst->nparams++;
+            }
+            start = end;
+        }
+
+        /* Nothing changed since the previous sample */
+        if (prev && !dst->nparams)
+            virDomainStatsEventRecordClear(&tmp[--ntmp]);
+    }
+
+    *records = tmp;
+    return ntmp;
+
+ error:
+    for (i = 0; i < ntmp; i++)
+        virDomainStatsEventRecordClear(&tmp[i]);
+    VIR_FREE(tmp);
+    return -1;
+}
+
+
+/**
+ * qemuStatsSamplerPublish:
+ *
+ * Emits its share of @samples to each subscriber and keeps @samples for
+ * computing the next deltas. Must be called with the sampler lock held.
+ */
+static void
+qemuStatsSamplerPublish(qemuStatsSamplerPtr sampler,
+                        unsigned int stats,
+                        qemuStatsSamplePtr samples,
+                        size_t nsamples)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    size_t i;
+
+    for (i = 0; i < sampler->nsubscribers; i++) {
+        qemuStatsSubscriberPtr sub = &sampler->subscribers[i];
+        virDomainStatsEventRecordPtr records = NULL;
+        size_t nrecords;
+        int rc;
+
+        /* Subscribed while the sample was being collected, the next one
+         * will have all the groups it asked for */
+        if (sub->stats & ~stats)
+            continue;
+
+        if ((rc = qemuStatsSamplerBuild(sampler, sub, samples,
+                                        nsamples, &records)) < 0) {
+            VIR_WARN("Failed to build domain stats event for callback %d: %s",
+                     sub->callbackID, virGetLastErrorMessage());
+            virResetLastError();
+            continue;
+        }
+        nrecords = rc;
+
+        if (sub->primed && !nrecords &&
+            sub->flags & VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA) {
+            VIR_FREE(records);
+            continue;
+        }
+
+        if (sampler->emit(sub->callbackID, &records, &nrecords,
+                          sampler->opaque) < 0) {
+            for (; nrecords; nrecords--)
+                virDomainStatsEventRecordClear(&records[nrecords - 1]);
+            VIR_FREE(records);
+            virResetLastError();
+            continue;
+        }
+
+        sub->primed = true;
+    }
+
+    qemuStatsSamplerClearPrev(sampler);
+    sampler->prev = samples;
+    sampler->nprev = nsamples;
+    sampler->prevStats = stats;
+
+    for (i = 0; i < nsamples; i++) {
+        virUUIDFormat(samples[i].record.uuid, uuidstr);
+        if (virHashAddEntry(sampler->prevIndex, uuidstr, &samples[i]) < 0) {
+            /* Without the index every subscriber gets a full sample */
+            virResetLastError();
+            virHashRemoveAll(sampler->prevIndex);
+            break;
+        }
+    }
+}
+
+
+/* Takes a sample and publishes it. Must be called with the sampler lock
+ * held, which is dropped while the domains are being sampled. */
+static void
+qemuStatsSamplerSample(qemuStatsSamplerPtr sampler,
+                       unsigned long long now)
+{
+    qemuStatsSamplePtr samples = NULL;
+    size_t nsamples;
+    unsigned int stats = 0;
+    size_t i;
+
+    sampler->next = now + sampler->interval;
+
+    for (i = 0; i < sampler->nsubscribers; i++)
+        stats |= sampler->subscribers[i].stats;
+
+    virMutexUnlock(&sampler->lock);
+    nsamples = sampler->collect(stats, &samples, sampler->opaque);
+    virMutexLock(&sampler->lock);
+
+    if (sampler->quit) {
+        qemuStatsSamplesFree(samples, nsamples);
+        return;
+    }
+
+    qemuStatsSamplerPublish(sampler, stats, samples, nsamples);
+}
+
+
+static void
+qemuStatsSamplerThread(void *opaque)
+{
+    qemuStatsSamplerPtr sampler = opaque;
+
+    virMutexLock(&sampler->lock);
+
+    while (!sampler->quit) {
+        unsigned long long now;
+
+        if (!sampler->nsubscribers) {
+            if (virCondWait(&sampler->cond, &sampler->lock) < 0) {
+                VIR_ERROR(_("failed to wait for domain stats subscribers"));
+                break;
+            }
+            continue;
+        }
+
+        if (virTimeMillisNow(&now) < 0)
+            break;
+
+        if (now < sampler->next) {
+            if (virCondWaitUntil(&sampler->cond, &sampler->lock,
+                                 sampler->next) < 0 &&
+                errno != ETIMEDOUT) {
+                VIR_ERROR(_("failed to wait for next domain stats sample"));
+                break;
+            }
+            continue;
+        }
+
+        qemuStatsSamplerSample(sampler, now);
+    }
+
+    virMutexUnlock(&sampler->lock);
+}
+
+
+/**
+ * qemuStatsSamplerNew:
+ * @groups: stats flag of each group a sample consists of
+ * @ngroups: number of items in @groups
+ * @interval: milliseconds between two samples
+ * @collect: callback collecting a sample
+ * @emit: callback delivering records to a subscriber
+ * @opaque: data passed to @collect and @emit
+ *
+ * Creates a sampler. No sample is taken until qemuStatsSamplerStart
+ * starts the sampling thread or qemuStatsSamplerRun is called.
+ *
+ * Returns the sampler, or NULL on error.
+ */
+qemuStatsSamplerPtr
+qemuStatsSamplerNew(const unsigned int *groups,
+                    size_t ngroups,
+                    unsigned long long interval,
+                    qemuStatsSamplerCollectFunc collect,
+                    qemuStatsSamplerEmitFunc emit,
+                    void *opaque)
+{
+    qemuStatsSamplerPtr sampler;
+
+    if (VIR_ALLOC(sampler) < 0)
+        return NULL;
+
+    if (virMutexInit(&sampler->lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        VIR_FREE(sampler);
+        return NULL;
+    }
+
+    if (virCondInit(&sampler->cond) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize condition variable"));
+        virMutexDestroy(&sampler->lock);
+        VIR_FREE(sampler);
+        return NULL;
+    }
+
+    if (!(sampler->prevIndex = virHashCreate(50, NULL)) ||
+        VIR_ALLOC_N(sampler->groups, ngroups) < 0) {
+        qemuStatsSamplerFree(sampler);
+        return NULL;
+    }
+
+    memcpy(sampler->groups, groups, ngroups * sizeof(*groups));
+    sampler->ngroups = ngroups;
+    sampler->interval = interval;
+    sampler->collect = collect;
+    sampler->emit = emit;
+    sampler->opaque = opaque;
+    return sampler;
+}
+
+
+void
+qemuStatsSamplerFree(qemuStatsSamplerPtr sampler)
+{
+    if (!sampler)
+        return;
+
+    virMutexLock(&sampler->lock);
+    sampler->quit = true;
+    virCondSignal(&sampler->cond);
+    virMutexUnlock(&sampler->lock);
+
+    if (sampler->running)
+        virThreadJoin(&sampler->thread);
+
+    qemuStatsSamplerClearPrev(sampler);
+    virHashFree(sampler->prevIndex);
+    VIR_FREE(sampler->subscribers);
+    VIR_FREE(sampler->groups);
+    ignore_value(virCondDestroy(&sampler->cond));
+    virMutexDestroy(&sampler->lock);
+    VIR_FREE(sampler);
+}
+
+
+/**
+ * qemuStatsSamplerStart:
+ *
+ * Starts the thread which takes a sample every interval while there
+ * are subscribers, unless it is running already.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuStatsSamplerStart(qemuStatsSamplerPtr sampler)
+{
+    int ret = -1;
+
+    virMutexLock(&sampler->lock);
+
+    if (!sampler->running) {
+        if (virThreadCreate(&sampler->thread, true,
+                            qemuStatsSamplerThread, sampler) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("cannot create domain stats sampler thread"));
+            goto cleanup;
+        }
+        sampler->running = true;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&sampler->lock);
+    return ret;
+}
+
+
+/**
+ * qemuStatsSamplerRun:
+ * @sampler: the sampler
+ * @now: current time in milliseconds
+ *
+ * Takes a sample if there are subscribers and the interval since the
+ * previous sample has passed by @now. Meant for driving a sampler whose
+ * thread was not started.
+ *
+ * Returns true if a sample was taken.
+ */
+bool
+qemuStatsSamplerRun(qemuStatsSamplerPtr sampler,
+                    unsigned long long now)
+{
+    bool ret = false;
+
+    virMutexLock(&sampler->lock);
+
+    if (!sampler->quit && sampler->nsubscribers && now >= sampler->next) {
+        qemuStatsSamplerSample(sampler, now);
+        ret = true;
+    }
+
+    virMutexUnlock(&sampler->lock);
+    return ret;
+}
+
+
+int
+qemuStatsSamplerSubscribe(qemuStatsSamplerPtr sampler,
+                          int callbackID,
+                          unsigned int stats,
+                          unsigned int flags)
+{
+    qemuStatsSubscriber sub = {
+        .callbackID = callbackID, .stats = stats, .flags = flags,
+    };
+    int ret = -1;
+
+    virMutexLock(&sampler->lock);
+
+    if (VIR_APPEND_ELEMENT(sampler->subscribers, sampler->nsubscribers,
+                           sub) < 0)
+        goto cleanup;
+
+    virCondSignal(&sampler->cond);
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&sampler->lock);
+    return ret;
+}
+
+
+bool
+qemuStatsSamplerHasSubscriber(qemuStatsSamplerPtr sampler,
+                              int callbackID)
+{
+    bool ret = false;
+    size_t i;
+
+    virMutexLock(&sampler->lock);
+    for (i = 0; i < sampler->nsubscribers; i++) {
+        if (sampler->subscribers[i].callbackID == callbackID) {
+            ret = true;
+            break;
+        }
+    }
+    virMutexUnlock(&sampler->lock);
+
+    return ret;
+}
+
+
+void
+qemuStatsSamplerUnsubscribe(qemuStatsSamplerPtr sampler,
+                            int callbackID)
+{
+    size_t i;
+
+    virMutexLock(&sampler->lock);
+    for (i = 0; i < sampler->nsubscribers; i++) {
+        if (sampler->subscribers[i].callbackID == callbackID) {
+            VIR_DELETE_ELEMENT(sampler->subscribers, i,
+                               sampler->nsubscribers);
+            break;
+        }
+    }
+
+    /* No point in keeping the last sample around */
+    if (!sampler->nsubscribers)
+        qemuStatsSamplerClearPrev(sampler);
+    virMutexUnlock(&sampler->lock);
+}
@@ -0,0 +1,97 @@
+/*
+ * qemu_stats_sampler.h: periodic sampling of domain stats
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __QEMU_STATS_SAMPLER_H__
+# define __QEMU_STATS_SAMPLER_H__
+
+# include "internal.h"
+# include "domain_event.h"
+
+typedef struct _qemuStatsSample qemuStatsSample;
+typedef qemuStatsSample *qemuStatsSamplePtr;
+struct _qemuStatsSample {
+    virDomainStatsEventRecord record;
+    /* number of params in @record after each group */
+    int *ends;
+};
+
+typedef struct _qemuStatsSampler qemuStatsSampler;
+typedef qemuStatsSampler *qemuStatsSamplerPtr;
+
+/**
+ * qemuStatsSamplerCollectFunc:
+ * @stats: union of the groups the subscribers asked for
+ * @samples: filled with one item per domain
+ * @opaque: opaque data passed to qemuStatsSamplerNew
+ *
+ * Collects @stats of all domains. The @ends of every sample must have
+ * an item for each group passed to qemuStatsSamplerNew.
+ *
+ * Returns the number of items in @samples.
+ */
+typedef size_t (*qemuStatsSamplerCollectFunc)(unsigned int stats,
+                                              qemuStatsSamplePtr *samples,
+                                              void *opaque);
+
+/**
+ * qemuStatsSamplerEmitFunc:
+ * @callbackID: subscriber the records are for
+ * @records: the records, the callback takes them on success
+ * @nrecords: number of items in @records
+ * @opaque: opaque data passed to qemuStatsSamplerNew
+ *
+ * Delivers @records to the subscriber registered as @callbackID.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+typedef int (*qemuStatsSamplerEmitFunc)(int callbackID,
+                                        virDomainStatsEventRecordPtr *records,
+                                        size_t *nrecords,
+                                        void *opaque);
+
+void qemuStatsSamplesFree(qemuStatsSamplePtr samples,
+                          size_t nsamples);
+
+qemuStatsSamplerPtr qemuStatsSamplerNew(const unsigned int *groups,
+                                        size_t ngroups,
+                                        unsigned long long interval,
+                                        qemuStatsSamplerCollectFunc collect,
+                                        qemuStatsSamplerEmitFunc emit,
+                                        void *opaque);
+
+void qemuStatsSamplerFree(qemuStatsSamplerPtr sampler);
+
+int qemuStatsSamplerStart(qemuStatsSamplerPtr sampler);
+
+bool qemuStatsSamplerRun(qemuStatsSamplerPtr sampler,
+                         unsigned long long now);
+
+int qemuStatsSamplerSubscribe(qemuStatsSamplerPtr sampler,
+                              int callbackID,
+                              unsigned int stats,
+                              unsigned int flags);
+
+bool qemuStatsSamplerHasSubscriber(qemuStatsSamplerPtr sampler,
+                                   int callbackID);
+
+void qemuStatsSamplerUnsubscribe(qemuStatsSamplerPtr sampler,
+                                 int callbackID);
+
+#endif /* __QEMU_STATS_SAMPLER_H__ */
@@ -98,6 +98,14 @@ struct private_data {
     bool serverKeepAlive;       /* Does server support keepalive protocol? */
     bool serverEventFilter;     /* Does server support modern event filtering */
     bool serverCloseCallback;   /* Does server support driver close callback */
+    bool serverStreamLargePayload; /* Does server support large stream packets */
+    bool serverEventBatch;      /* Does server send events in batches */
+    bool serverStatsColumns;    /* Does server send domain stats as columns */
+    bool statsColumns;          /* Use columns for virConnectGetAllDomainStats */
+
+    /* Dictionary of domain stats keys received from the server */
+    remote_domain_stats_key *statsKeys;
+    size_t nstatsKeys;
 
     virObjectEventStatePtr eventState;
     virConnectCloseCallbackDataPtr closeCallback;
@@ -360,6 +368,11 @@ remoteDomainBuildEventCallbackMetadataChange(virNetClientProgramPtr prog,
                                              virNetClientPtr client,
                                              void *evdata, void *opaque);
 
+static void
+remoteDomainBuildEventStats(virNetClientProgramPtr prog,
+                            virNetClientPtr client,
+                            void *evdata, void *opaque);
+
 static void
 remoteNetworkBuildEventLifecycle(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
                                  virNetClientPtr client ATTRIBUTE_UNUSED,
@@ -400,6 +413,11 @@ remoteConnectNotifyEventConnectionClosed(virNetClientProgramPtr prog ATTRIBUTE_U
                                          virNetClientPtr client ATTRIBUTE_UNUSED,
                                          void *evdata, void *opaque);
 
+static void
+remoteBuildEventBatch(virNetClientProgramPtr prog,
+                      virNetClientPtr client,
+                      void *evdata, void *opaque);
+
 static virNetClientProgramEvent remoteEvents[] = {
     { REMOTE_PROC_DOMAIN_EVENT_LIFECYCLE,
       remoteDomainBuildEventLifecycle,
@@ -602,6 +620,14 @@ static virNetClientProgramEvent remoteEvents[] = {
       remoteSecretBuildEventValueChanged,
       sizeof(remote_secret_event_value_changed_msg),
       (xdrproc_t)xdr_remote_secret_event_value_changed_msg },
+    { REMOTE_PROC_EVENT_BATCH,
+      remoteBuildEventBatch,
+      sizeof(remote_event_batch_msg),
+      (xdrproc_t)xdr_remote_event_batch_msg },
+    { REMOTE_PROC_DOMAIN_EVENT_STATS,
+      remoteDomainBuildEventStats,
+      sizeof(remote_domain_event_stats_msg),
+      (xdrproc_t)xdr_remote_domain_event_stats_msg },
 };
 
 static void
@@ -660,6 +686,24 @@ remoteConnectSupportsFeatureUnlocked(virConnectPtr conn,
     return rc != -1 && ret.supported;
 }
 
+/* Checks whether the server supports @feature and asks it to turn
+ * the feature on for this connection if so. Returns true if the
+ * feature is in use. */
+static bool
+remoteConnectEnableFeatureUnlocked(virConnectPtr conn,
+                                   struct private_data *priv,
+                                   int feature)
+{
+    remote_connect_enable_feature_args args = { feature };
+
+    if (!remoteConnectSupportsFeatureUnlocked(conn, priv, feature))
+        return false;
+
+    return call(conn, priv, 0, REMOTE_PROC_CONNECT_ENABLE_FEATURE,
+                (xdrproc_t)xdr_remote_connect_enable_feature_args, (char *) &args,
+                (xdrproc_t)xdr_void, (char *) NULL) != -1;
+}
+
 /* helper macro to ease extraction of arguments from the URI */
 #define EXTRACT_URI_ARG_STR(ARG_NAME, ARG_VAR)          \
     if (STRCASEEQ(var->name, ARG_NAME)) {               \
@@ -801,6 +845,8 @@ doRemoteOpen(virConnectPtr conn,
     char *name = NULL, *command = NULL, *sockname = NULL, *netcat = NULL;
     char *port = NULL, *authtype = NULL, *username = NULL;
     bool sanity = true, verify = true, tty ATTRIBUTE_UNUSED = true;
+    bool noEventBatch = true;
+    bool noStatsColumns = true;
     char *pkipath = NULL, *keyfile = NULL, *sshauth = NULL;
 
     char *knownHostsVerify = NULL,  *knownHosts = NULL;
@@ -853,6 +899,8 @@ doRemoteOpen(virConnectPtr conn,
             EXTRACT_URI_ARG_BOOL("no_sanity", sanity);
             EXTRACT_URI_ARG_BOOL("no_verify", verify);
             EXTRACT_URI_ARG_BOOL("no_tty", tty);
+            EXTRACT_URI_ARG_BOOL("event_batch", noEventBatch);
+            EXTRACT_URI_ARG_BOOL("stats_columns", noStatsColumns);
 
             if (STRCASEEQ(var->name, "authfile")) {
                 /* Strip this param, used by virauth.c */
@@ -1228,6 +1276,30 @@ doRemoteOpen(virConnectPtr conn,
                  "by the remote side.");
     }
 
+    priv->serverStreamLargePayload = remoteConnectEnableFeatureUnlocked(conn,
+                                    priv, VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_PAYLOAD);
+    if (!priv->serverStreamLargePayload) {
+        VIR_INFO("Limiting stream packets to legacy size since large "
+                 "packets are not supported by the remote side.");
+    }
+
+    if (!noEventBatch) {
+        priv->serverEventBatch = remoteConnectEnableFeatureUnlocked(conn,
+                                        priv, VIR_DRV_FEATURE_REMOTE_EVENT_BATCH);
+        if (!priv->serverEventBatch) {
+            VIR_INFO("Receiving events one by one since batching is not "
+                     "supported by the remote side.");
+        }
+    }
+
+    priv->serverStatsColumns = remoteConnectSupportsFeatureUnlocked(conn,
+                                    priv, VIR_DRV_FEATURE_REMOTE_DOMAIN_STATS_COLUMNS);
+    if (!priv->serverStatsColumns) {
+        VIR_INFO("Receiving domain stats as records since columns are "
+                 "not supported by the remote side.");
+    }
+    priv->statsColumns = priv->serverStatsColumns && !noStatsColumns;
+
     /* Successful. */
     retcode = VIR_DRV_OPEN_SUCCESS;
 
@@ -1381,6 +1453,7 @@ static int
 doRemoteClose(virConnectPtr conn, struct private_data *priv)
 {
     int ret = 0;
+    size_t i;
 
     if (call(conn, priv, 0, REMOTE_PROC_CONNECT_CLOSE,
              (xdrproc_t) xdr_void, (char *) NULL,
@@ -1415,6 +1488,11 @@ doRemoteClose(virConnectPtr conn, struct private_data *priv)
     virObjectUnref(priv->eventState);
     priv->eventState = NULL;
 
+    for (i = 0; i < priv->nstatsKeys; i++)
+        VIR_FREE(priv->statsKeys[i].field);
+    VIR_FREE(priv->statsKeys);
+    priv->nstatsKeys = 0;
+
     return ret;
 }
 
@@ -3548,6 +3626,86 @@ remoteConnectDomainQemuMonitorEventDeregister(virConnectPtr conn,
     return rv;
 }
 
+
+
+static int
+remoteConnectDomainStatsEventRegister(virConnectPtr conn,
+                                      unsigned int stats,
+                                      virConnectDomainStatsEventCallback callback,
+                                      void *opaque,
+                                      virFreeCallback freecb,
+                                      unsigned int flags)
+{
+    int rv = -1;
+    struct private_data *priv = conn->privateData;
+    remote_connect_domain_stats_event_register_args args;
+    remote_connect_domain_stats_event_register_ret ret;
+    int callbackID;
+
+    remoteDriverLock(priv);
+
+    if (virDomainStatsEventStateRegisterID(conn, priv->eventState, stats,
+                                           callback, opaque, freecb, -1,
+                                           &callbackID) < 0)
+        goto done;
+
+    /* Subscriptions differ in stats and flags, so each of them needs
+     * its own callback on the server */
+    args.stats = stats;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_DOMAIN_STATS_EVENT_REGISTER,
+             (xdrproc_t) xdr_remote_connect_domain_stats_event_register_args, (char *) &args,
+             (xdrproc_t) xdr_remote_connect_domain_stats_event_register_ret, (char *) &ret) == -1) {
+        virObjectEventStateDeregisterID(conn, priv->eventState,
+                                        callbackID);
+        goto done;
+    }
+    virObjectEventStateSetRemote(conn, priv->eventState, callbackID,
+                                 ret.callbackID);
+
+    rv = callbackID;
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteConnectDomainStatsEventDeregister(virConnectPtr conn,
+                                        int callbackID)
+{
+    struct private_data *priv = conn->privateData;
+    int rv = -1;
+    remote_connect_domain_stats_event_deregister_args args;
+    int remoteID;
+
+    remoteDriverLock(priv);
+
+    if (virObjectEventStateEventID(conn, priv->eventState,
+                                   callbackID, &remoteID) < 0)
+        goto done;
+
+    if (virObjectEventStateDeregisterID(conn, priv->eventState,
+                                        callbackID) < 0)
+        goto done;
+
+    args.callbackID = remoteID;
+
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_DOMAIN_STATS_EVENT_DEREGISTER,
+             (xdrproc_t) xdr_remote_connect_domain_stats_event_deregister_args, (char *) &args,
+             (xdrproc_t) xdr_void, (char *) NULL) == -1)
+        goto done;
+
+    rv = 0;
+
+ done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 /*----------------------------------------------------------------------*/
 
 static char *
@@ -5417,6 +5575,48 @@ remoteDomainBuildEventCallbackMetadataChange(virNetClientProgramPtr prog ATTRIBU
 }
 
 
+static void
+remoteDomainBuildEventStats(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                            virNetClientPtr client ATTRIBUTE_UNUSED,
+                            void *evdata, void *opaque)
+{
+    virConnectPtr conn = opaque;
+    remote_domain_event_stats_msg *msg = evdata;
+    struct private_data *priv = conn->privateData;
+    virDomainStatsEventRecordPtr records = NULL;
+    size_t nrecords = 0;
+    virObjectEventPtr event = NULL;
+    size_t i;
+
+    if (msg->records.records_len &&
+        VIR_ALLOC_N(records, msg->records.records_len) < 0)
+        return;
+
+    for (i = 0; i < msg->records.records_len; i++) {
+        remote_domain_stats_record *src = msg->records.records_val + i;
+        virDomainStatsEventRecordPtr dst = records + nrecords++;
+
+        dst->id = src->dom.id;
+        memcpy(dst->uuid, src->dom.uuid, VIR_UUID_BUFLEN);
+        if (VIR_STRDUP(dst->name, src->dom.name) < 0 ||
+            virTypedParamsDeserialize((virTypedParameterRemotePtr) src->params.params_val,
+                                      src->params.params_len,
+                                      REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX,
+                                      &dst->params, &dst->nparams) < 0)
+            goto cleanup;
+    }
+
+    event = virDomainStatsEventNew(-1, &records, &nrecords);
+
+    remoteEventQueue(priv, event, msg->callbackID);
+
+ cleanup:
+    for (i = 0; i < nrecords; i++)
+        virDomainStatsEventRecordClear(&records[i]);
+    VIR_FREE(records);
+}
+
+
 static void
 remoteNetworkBuildEventLifecycle(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
                                  virNetClientPtr client ATTRIBUTE_UNUSED,
@@ -5568,6 +5768,54 @@ remoteSecretBuildEventValueChanged(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
     remoteEventQueue(priv, event, msg->callbackID);
 }
 
+static void
+remoteBuildEventBatch(virNetClientProgramPtr prog,
+                      virNetClientPtr client,
+                      void *evdata, void *opaque)
+{
+    remote_event_batch_msg *msg = evdata;
+    size_t i;
+    size_t j;
+
+    VIR_DEBUG("Processing batch of %u events", msg->events.events_len);
+
+    for (i = 0; i < msg->events.events_len; i++) {
+        remote_event_batch_event *batched = &msg->events.events_val[i];
+        virNetClientProgramEventPtr event = NULL;
+        void *data = NULL;
+        XDR xdr;
+
+        for (j = 0; j < ARRAY_CARDINALITY(remoteEvents); j++) {
+            if (remoteEvents[j].proc == batched->procedure &&
+                remoteEvents[j].proc != REMOTE_PROC_EVENT_BATCH) {
+                event = &remoteEvents[j];
+                break;
+            }
+        }
+
+        if (!event) {
+            VIR_WARN("Ignoring unknown batched event %d", batched->procedure);
+            continue;
+        }
+
+        if (VIR_ALLOC_N(data, event->msg_len) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        xdrmem_create(&xdr, batched->data.data_val, batched->data.data_len,
+                      XDR_DECODE);
+        if ((*event->msg_filter)(&xdr, data))
+            event->func(prog, client, data, opaque);
+        else
+            VIR_WARN("Unable to decode batched event %d", batched->procedure);
+        xdr_destroy(&xdr);
+
+        xdr_free(event->msg_filter, data);
+        VIR_FREE(data);
+    }
+}
+
 static void
 remoteDomainBuildQemuMonitorEvent(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
                                   virNetClientPtr client ATTRIBUTE_UNUSED,
@@ -5643,6 +5891,13 @@ remoteStreamSend(virStreamPtr st,
 
     remoteDriverLock(priv);
     priv->localUses++;
+    /* Old servers expect at most this much data in a single packet.
+     * Sending less than requested is fine, callers loop anyway. */
+    if (!priv->serverStreamLargePayload &&
+        nbytes > VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX)
+        nbytes = VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+    else if (nbytes > VIR_NET_MESSAGE_STREAM_PAYLOAD_MAX)
+        nbytes = VIR_NET_MESSAGE_STREAM_PAYLOAD_MAX;
     remoteDriverUnlock(priv);
 
     rv = virNetClientStreamSendPacket(privst,
@@ -5679,7 +5934,45 @@ remoteStreamRecv(virStreamPtr st,
                                       priv->client,
                                       data,
                                       nbytes,
-                                      (st->flags & VIR_STREAM_NONBLOCK));
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      0);
+
+    VIR_DEBUG("Done %d", rv);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteStreamRecvFlags(virStreamPtr st,
+                      char *data,
+                      size_t nbytes,
+                      unsigned int flags)
+{
+    VIR_DEBUG("st=%p data=%p nbytes=%zu flags=%x",
+              st, data, nbytes, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamRecvPacket(privst,
+                                      priv->client,
+                                      data,
+                                      nbytes,
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      flags);
 
     VIR_DEBUG("Done %d", rv);
 
@@ -5689,6 +5982,66 @@ remoteStreamRecv(virStreamPtr st,
     return rv;
 }
 
+
+static int
+remoteStreamSendHole(virStreamPtr st,
+                     long long length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%lld flags=%x",
+              st, length, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamSendHole(privst,
+                                    priv->client,
+                                    length,
+                                    flags);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteStreamRecvHole(virStreamPtr st,
+                     long long *length,
+                     unsigned int flags)
+{
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    VIR_DEBUG("st=%p length=%p flags=%x",
+              st, length, flags);
+
+    virCheckFlags(0, -1);
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamRecvHole(priv->client, privst, length);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 struct remoteStreamCallbackData {
     virStreamPtr st;
     virStreamEventCallback cb;
@@ -5861,7 +6214,10 @@ remoteStreamAbort(virStreamPtr st)
 
 static virStreamDriver remoteStreamDrv = {
     .streamRecv = remoteStreamRecv,
+    .streamRecvFlags = remoteStreamRecvFlags,
     .streamSend = remoteStreamSend,
+    .streamSendHole = remoteStreamSendHole,
+    .streamRecvHole = remoteStreamRecvHole,
     .streamFinish = remoteStreamFinish,
     .streamAbort = remoteStreamAbort,
     .streamEventAddCallback = remoteStreamEventAddCallback,
@@ -6177,7 +6533,8 @@ remoteDomainMigratePrepareTunnel3(virConnectPtr dconn,
 
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3,
-                                        priv->counter)))
+                                        priv->counter,
+                                        false)))
         goto done;
 
     if (virNetClientAddStream(priv->client, netst) < 0) {
@@ -7101,7 +7458,8 @@ remoteDomainMigratePrepareTunnel3Params(virConnectPtr dconn,
 
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3_PARAMS,
-                                        priv->counter)))
+                                        priv->counter,
+                                        false)))
         goto cleanup;
 
     if (virNetClientAddStream(priv->client, netst) < 0) {
@@ -7620,6 +7978,128 @@ remoteNetworkGetDHCPLeases(virNetworkPtr net,
 }
 
 
+/* Fetches domain stats packed in columns, which requires the server to
+ * support VIR_DRV_FEATURE_REMOTE_DOMAIN_STATS_COLUMNS */
+static int
+remoteConnectGetAllDomainStatsPacked(virConnectPtr conn,
+                                     virDomainPtr *doms,
+                                     unsigned int ndoms,
+                                     unsigned int stats,
+                                     virDomainStatsColumnsPtr *retColumns,
+                                     unsigned int flags)
+{
+    struct private_data *priv = conn->privateData;
+    int rv = -1;
+    size_t i;
+    remote_connect_get_all_domain_stats_columns_args args;
+    remote_connect_get_all_domain_stats_columns_ret ret;
+    virDomainStatsColumnsPtr columns = NULL;
+
+    memset(&args, 0, sizeof(args));
+
+    if (ndoms) {
+        if (VIR_ALLOC_N(args.doms.doms_val, ndoms) < 0)
+            goto cleanup;
+
+        for (i = 0; i < ndoms; i++)
+            make_nonnull_domain(args.doms.doms_val + i, doms[i]);
+    }
+    args.doms.doms_len = ndoms;
+
+    args.stats = stats;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+
+    remoteDriverLock(priv);
+    args.nkeys = priv->nstatsKeys;
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS_COLUMNS,
+             (xdrproc_t)xdr_remote_connect_get_all_domain_stats_columns_args, (char *)&args,
+             (xdrproc_t)xdr_remote_connect_get_all_domain_stats_columns_ret, (char *)&ret) == -1) {
+        remoteDriverUnlock(priv);
+        goto cleanup;
+    }
+
+    /* Calls running concurrently may have learned some of the new keys
+     * already, the server always sends them in the same order */
+    for (i = 0; i < ret.keys.keys_len; i++) {
+        remote_domain_stats_key key;
+
+        if (args.nkeys + i < priv->nstatsKeys)
+            continue;
+
+        key.type = ret.keys.keys_val[i].type;
+        key.field = ret.keys.keys_val[i].field;
+        if (VIR_APPEND_ELEMENT(priv->statsKeys, priv->nstatsKeys, key) < 0) {
+            remoteDriverUnlock(priv);
+            goto cleanup;
+        }
+        ret.keys.keys_val[i].field = NULL;
+    }
+
+    if (ret.doms.doms_len > REMOTE_DOMAIN_LIST_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Number of stats entries is %d, which exceeds max limit: %d"),
+                       ret.doms.doms_len, REMOTE_DOMAIN_LIST_MAX);
+        remoteDriverUnlock(priv);
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC(columns) < 0 ||
+        VIR_ALLOC_N(columns->doms, ret.doms.doms_len) < 0) {
+        remoteDriverUnlock(priv);
+        goto cleanup;
+    }
+    columns->ndoms = ret.doms.doms_len;
+
+    for (i = 0; i < ret.doms.doms_len; i++) {
+        if (!(columns->doms[i] = get_nonnull_domain(conn,
+                                                    ret.doms.doms_val[i]))) {
+            remoteDriverUnlock(priv);
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < ret.columns.columns_len; i++) {
+        remote_domain_stats_column *src = ret.columns.columns_val + i;
+        remote_domain_stats_key *key;
+
+        if (src->key >= priv->nstatsKeys) {
+            virReportError(VIR_ERR_RPC,
+                           _("unknown domain stats key %u"), src->key);
+            remoteDriverUnlock(priv);
+            goto cleanup;
+        }
+        key = priv->statsKeys + src->key;
+
+        if (virTypedParamsColumnNew(columns, i, key->field, key->type) < 0 ||
+            virTypedParamsColumnUnpack(columns->columns + i, columns->ndoms,
+                                       src->present.present_val,
+                                       src->present.present_len,
+                                       src->values.values_val,
+                                       src->values.values_len,
+                                       src->strings.strings_val,
+                                       src->strings.strings_len) < 0) {
+            remoteDriverUnlock(priv);
+            goto cleanup;
+        }
+    }
+    remoteDriverUnlock(priv);
+
+    *retColumns = columns;
+    columns = NULL;
+    rv = ret.doms.doms_len;
+
+ cleanup:
+    virTypedParamsColumnsFree(columns);
+    VIR_FREE(args.doms.doms_val);
+    xdr_free((xdrproc_t)xdr_remote_connect_get_all_domain_stats_columns_ret,
+             (char *) &ret);
+
+    return rv;
+}
+
+
 static int
 remoteConnectGetAllDomainStats(virConnectPtr conn,
                                virDomainPtr *doms,
@@ -7636,6 +8116,18 @@ remoteConnectGetAllDomainStats(virConnectPtr conn,
     virDomainStatsRecordPtr elem = NULL;
     virDomainStatsRecordPtr *tmpret = NULL;
 
+    if (priv->statsColumns) {
+        virDomainStatsColumnsPtr columns = NULL;
+
+        if (remoteConnectGetAllDomainStatsPacked(conn, doms, ndoms, stats,
+                                                 &columns, flags) < 0)
+            return -1;
+
+        rv = virTypedParamsColumnsToRecords(columns, retStats);
+        virTypedParamsColumnsFree(columns);
+        return rv;
+    }
+
     memset(&args, 0, sizeof(args));
 
     if (ndoms) {
@@ -7711,6 +8203,37 @@ remoteConnectGetAllDomainStats(virConnectPtr conn,
 }
 
 
+static int
+remoteConnectGetAllDomainStatsColumns(virConnectPtr conn,
+                                      virDomainPtr *doms,
+                                      unsigned int ndoms,
+                                      unsigned int stats,
+                                      virDomainStatsColumnsPtr *retColumns,
+                                      unsigned int flags)
+{
+    struct private_data *priv = conn->privateData;
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainStatsColumnsPtr columns = NULL;
+    int nrecords;
+
+    if (priv->serverStatsColumns)
+        return remoteConnectGetAllDomainStatsPacked(conn, doms, ndoms, stats,
+                                                    retColumns, flags);
+
+    /* Older servers only know about records */
+    if ((nrecords = remoteConnectGetAllDomainStats(conn, doms, ndoms, stats,
+                                                   &records, flags)) < 0)
+        return -1;
+
+    columns = virTypedParamsRecordsToColumns(records, nrecords);
+    virDomainStatsRecordListFree(records);
+    if (!columns)
+        return -1;
+
+    *retColumns = columns;
+    return nrecords;
+}
+
 static int
 remoteNodeAllocPages(virConnectPtr conn,
                      unsigned int npages,
@@ -8455,6 +8978,9 @@ static virHypervisorDriver hypervisor_driver = {
     .domainGetGuestVcpus = remoteDomainGetGuestVcpus, /* 2.0.0 */
     .domainSetGuestVcpus = remoteDomainSetGuestVcpus, /* 2.0.0 */
     .domainSetVcpu = remoteDomainSetVcpu, /* 3.1.0 */
+    .connectGetAllDomainStatsColumns = remoteConnectGetAllDomainStatsColumns, /* 3.2.0 */
+    .connectDomainStatsEventRegister = remoteConnectDomainStatsEventRegister, /* 3.2.0 */
+    .connectDomainStatsEventDeregister = remoteConnectDomainStatsEventDeregister, /* 3.2.0 */
 };
 
 static virNetworkDriver network_driver = {
@@ -256,6 +256,22 @@ const REMOTE_DOMAIN_IP_ADDR_MAX = 2048;
 /* Upper limit on number of guest vcpu information entries */
 const REMOTE_DOMAIN_GUEST_VCPU_PARAMS_MAX = 64;
 
+/* Upper limit on number of events in a single event batch */
+const REMOTE_EVENT_BATCH_MAX = 4096;
+
+/* Upper limit on the size of a single event in an event batch */
+const REMOTE_EVENT_BATCH_EVENT_MAX = 65536;
+
+/* Upper limit on number of domain stats keys known to a connection */
+const REMOTE_DOMAIN_STATS_KEYS_MAX = 65536;
+
+/* Upper limit on size of the bitmap of domains reporting a statistic,
+ * which has one bit for each of up to REMOTE_DOMAIN_LIST_MAX domains */
+const REMOTE_DOMAIN_STATS_PRESENT_MAX = 2048;
+
+/* Upper limit on size of the packed values of a statistic */
+const REMOTE_DOMAIN_STATS_VALUES_MAX = 262144;
+
 /* UUID.  VIR_UUID_BUFLEN definition comes from libvirt.h */
 typedef opaque remote_uuid[VIR_UUID_BUFLEN];
 
@@ -450,6 +466,10 @@ struct remote_connect_supports_feature_ret {
     int supported;
 };
 
+struct remote_connect_enable_feature_args {
+    int feature;
+};
+
 struct remote_connect_get_type_ret {
     remote_nonnull_string type;
 };
@@ -3411,6 +3431,70 @@ struct remote_secret_event_value_changed_msg {
     remote_nonnull_secret secret;
 };
 
+/* An event message encoded as it would be sent on its own, with
+ * @procedure being the REMOTE_PROC_*_EVENT_* number it would be
+ * sent with. */
+struct remote_event_batch_event {
+    int procedure;
+    opaque data<REMOTE_EVENT_BATCH_EVENT_MAX>;
+};
+
+/* Sent instead of the individual event messages to clients which
+ * negotiated VIR_DRV_FEATURE_REMOTE_EVENT_BATCH. The events are to be
+ * processed in the order they appear in. */
+struct remote_event_batch_msg {
+    remote_event_batch_event events<REMOTE_EVENT_BATCH_MAX>;
+};
+
+/* An entry of the per connection dictionary of domain stats keys */
+struct remote_domain_stats_key {
+    remote_nonnull_string field;
+    int type;
+};
+
+/* The values of a single statistic packed by virTypedParamsColumnPack,
+ * @key being its index in the dictionary of the connection */
+struct remote_domain_stats_column {
+    unsigned int key;
+    opaque present<REMOTE_DOMAIN_STATS_PRESENT_MAX>;
+    opaque values<REMOTE_DOMAIN_STATS_VALUES_MAX>;
+    remote_nonnull_string strings<REMOTE_DOMAIN_LIST_MAX>;
+};
+
+/* @nkeys is the number of dictionary entries the client knows */
+struct remote_connect_get_all_domain_stats_columns_args {
+    remote_nonnull_domain doms<REMOTE_DOMAIN_LIST_MAX>;
+    unsigned int stats;
+    unsigned int flags;
+    unsigned int nkeys;
+};
+
+/* @keys are the dictionary entries from index @nkeys of the arguments
+ * on, which the client didn't know yet */
+struct remote_connect_get_all_domain_stats_columns_ret {
+    remote_domain_stats_key keys<REMOTE_DOMAIN_STATS_KEYS_MAX>;
+    remote_nonnull_domain doms<REMOTE_DOMAIN_LIST_MAX>;
+    remote_domain_stats_column columns<REMOTE_DOMAIN_STATS_KEYS_MAX>;
+};
+
+struct remote_connect_domain_stats_event_register_args {
+    unsigned int stats;
+    unsigned int flags;
+};
+
+struct remote_connect_domain_stats_event_register_ret {
+    int callbackID;
+};
+
+struct remote_connect_domain_stats_event_deregister_args {
+    int callbackID;
+};
+
+struct remote_domain_event_stats_msg {
+    int callbackID;
+    remote_domain_stats_record records<REMOTE_DOMAIN_LIST_MAX>;
+};
+
 /*----- Protocol. -----*/
 
 /* Define the program number, protocol version and procedure numbers here. */
@@ -3435,6 +3519,13 @@ enum remote_procedure {
      *   <paramnumber> specifies at which offset the stream parameter is inserted
      *   in the function parameter list.
      *
+     * - @sparseflag: <flagname>
+     *
+     *   Declares the flag which, if set in the API call, makes the
+     *   stream transfer holes via VIR_NET_STREAM_HOLE packets rather
+     *   than sending zeroes. Only valid together with @readstream or
+     *   @writestream.
+     *
      * - @priority: low|high
      *
      *   Each API that might eventually access hypervisor's monitor (and thus
@@ -4897,6 +4988,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @writestream: 1
+     * @sparseflag: VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM
      * @acl: storage_vol:data_write
      */
     REMOTE_PROC_STORAGE_VOL_UPLOAD = 208,
@@ -4904,6 +4996,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @readstream: 1
+     * @sparseflag: VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM
      * @acl: storage_vol:data_read
      */
     REMOTE_PROC_STORAGE_VOL_DOWNLOAD = 209,
@@ -6056,5 +6149,46 @@ enum remote_procedure {
      * @generate: none
      * @acl: connect:read
     */
-    REMOTE_PROC_NODE_GET_CACHE_STATS = 385
+    REMOTE_PROC_NODE_GET_CACHE_STATS = 385,
+
+    /**
+     * @generate: both
+     * @acl: none
+     */
+    REMOTE_PROC_EVENT_BATCH = 386,
+
+    /**
+     * @generate: none
+     * @acl: connect:search_domains
+     * @aclfilter: domain:read
+     */
+    REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS_COLUMNS = 387,
+
+    /**
+     * @generate: none
+     * @priority: high
+     * @acl: connect:search_domains
+     * @aclfilter: domain:read
+     */
+    REMOTE_PROC_CONNECT_DOMAIN_STATS_EVENT_REGISTER = 388,
+
+    /**
+     * @generate: none
+     * @priority: high
+     * @acl: connect:read
+     */
+    REMOTE_PROC_CONNECT_DOMAIN_STATS_EVENT_DEREGISTER = 389,
+
+    /**
+     * @generate: both
+     * @acl: none
+     */
+    REMOTE_PROC_DOMAIN_EVENT_STATS = 390,
+
+    /**
+     * @generate: none
+     * @priority: high
+     * @acl: connect:getattr
+     */
+    REMOTE_PROC_CONNECT_ENABLE_FEATURE = 391
 };
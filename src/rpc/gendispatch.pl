@@ -281,6 +281,11 @@ while (<PROTOCOL>) {
             $calls{$name}->{streamflag} = "none";
         }
 
+        if (exists $opts{sparseflag}) {
+            die "\@sparseflag requires stream" if $calls{$name}->{streamflag} eq "none";
+            $calls{$name}->{sparseflag} = $opts{sparseflag};
+        }
+
         $calls{$name}->{acl} = $opts{acl};
         $calls{$name}->{aclfilter} = $opts{aclfilter};
 
@@ -1024,7 +1029,13 @@ elsif ($mode eq "server") {
             print "    if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)))\n";
             print "        goto cleanup;\n";
             print "\n";
-            print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header)))\n";
+            print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header, ";
+            if (exists $call->{sparseflag}) {
+                print "!!(args->flags & $call->{sparseflag})";
+            } else {
+                print "false";
+            }
+            print ")))\n";
             print "        goto cleanup;\n";
             print "\n";
         }
@@ -1738,7 +1749,13 @@ elsif ($mode eq "client") {
 
         if ($call->{streamflag} ne "none") {
             print "\n";
-            print "    if (!(netst = virNetClientStreamNew(priv->remoteProgram, $call->{constname}, priv->counter)))\n";
+            print "    if (!(netst = virNetClientStreamNew(priv->remoteProgram, $call->{constname}, priv->counter, ";
+            if (exists $call->{sparseflag}) {
+                print "!!(flags & $call->{sparseflag})";
+            } else {
+                print "false";
+            }
+            print ")))\n";
             print "        goto done;\n";
             print "\n";
             print "    if (virNetClientAddStream(priv->client, netst) < 0) {\n";
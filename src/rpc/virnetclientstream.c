@@ -52,6 +52,9 @@ struct _virNetClientStream {
     virNetMessagePtr rx;
     bool incomingEOF;
 
+    bool allowSkip;
+    long long holeLength;  /* Size of incoming hole in stream. */
+
     virNetClientStreamEventCallback cb;
     void *cbOpaque;
     virFreeCallback cbFree;
@@ -86,7 +89,7 @@ virNetClientStreamEventTimerUpdate(virNetClientStreamPtr st)
 
     VIR_DEBUG("Check timer rx=%p cbEvents=%d", st->rx, st->cbEvents);
 
-    if (((st->rx || st->incomingEOF) &&
+    if (((st->rx || st->incomingEOF || st->holeLength) &&
          (st->cbEvents & VIR_STREAM_EVENT_READABLE)) ||
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE)) {
         VIR_DEBUG("Enabling event timer");
@@ -108,7 +111,7 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_READABLE) &&
-        (st->rx || st->incomingEOF))
+        (st->rx || st->incomingEOF || st->holeLength))
         events |= VIR_STREAM_EVENT_READABLE;
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE))
@@ -135,7 +138,8 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
 virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
                                             int proc,
-                                            unsigned serial)
+                                            unsigned serial,
+                                            bool allowSkip)
 {
     virNetClientStreamPtr st;
 
@@ -148,6 +152,7 @@ virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
     st->prog = prog;
     st->proc = proc;
     st->serial = serial;
+    st->allowSkip = allowSkip;
 
     virObjectRef(prog);
 
@@ -283,8 +288,9 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
     tmp_msg->buffer = msg->buffer;
     tmp_msg->bufferLength = msg->bufferLength;
     tmp_msg->bufferOffset = msg->bufferOffset;
+    tmp_msg->bufferCapacity = msg->bufferCapacity;
     msg->buffer = NULL;
-    msg->bufferLength = msg->bufferOffset = 0;
+    msg->bufferLength = msg->bufferOffset = msg->bufferCapacity = 0;
 
     virObjectLock(st);
 
@@ -350,19 +356,67 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
     return -1;
 }
 
+/* Consumes the hole packet at the head of the incoming queue,
+ * if there's any. Called with @st locked. */
+static int
+virNetClientStreamHandleHole(virNetClientStreamPtr st)
+{
+    virNetMessagePtr msg = st->rx;
+    virNetStreamHole data;
+    int ret = -1;
+
+    if (!msg || msg->header.type != VIR_NET_STREAM_HOLE)
+        return 0;
+
+    VIR_DEBUG("st=%p msg=%p", st, msg);
+
+    memset(&data, 0, sizeof(data));
+    virNetMessageQueueServe(&st->rx);
+
+    if (!st->allowSkip) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unexpected stream hole"));
+        goto cleanup;
+    }
+
+    if (virNetMessageDecodePayload(msg,
+                                   (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto cleanup;
+
+    if (data.flags != 0 || data.length < 0) {
+        virReportError(VIR_ERR_RPC,
+                       _("Malformed stream hole length=%lld flags=%x"),
+                       (long long) data.length, data.flags);
+        goto cleanup;
+    }
+
+    st->holeLength += data.length;
+    ret = 0;
+
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
 int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock)
+                                 bool nonblock,
+                                 unsigned int flags)
 {
     int rv = -1;
     size_t want;
 
-    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d",
-              st, client, data, nbytes, nonblock);
+    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d flags=%x",
+              st, client, data, nbytes, nonblock, flags);
+
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     virObjectLock(st);
-    if (!st->rx && !st->incomingEOF) {
+    if (!st->rx && !st->incomingEOF && !st->holeLength) {
         virNetMessagePtr msg;
         int ret;
 
@@ -393,11 +447,34 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
     }
 
     VIR_DEBUG("After IO rx=%p", st->rx);
+
+    if (!st->holeLength &&
+        virNetClientStreamHandleHole(st) < 0)
+        goto cleanup;
+
+    if (st->holeLength) {
+        if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+            rv = -3;
+            goto cleanup;
+        }
+
+        /* Caller doesn't care about holes, read them back as zeroes */
+        want = MIN(nbytes, st->holeLength);
+        memset(data, 0, want);
+        st->holeLength -= want;
+        rv = want;
+        virNetClientStreamEventTimerUpdate(st);
+        goto cleanup;
+    }
+
     want = nbytes;
     while (want && st->rx) {
         virNetMessagePtr msg = st->rx;
         size_t len = want;
 
+        if (msg->header.type == VIR_NET_STREAM_HOLE)
+            break;
+
         if (len > msg->bufferLength - msg->bufferOffset)
             len = msg->bufferLength - msg->bufferOffset;
 
@@ -423,6 +500,84 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
 }
 
 
+int virNetClientStreamRecvHole(virNetClientPtr client ATTRIBUTE_UNUSED,
+                               virNetClientStreamPtr st,
+                               long long *length)
+{
+    int ret = -1;
+
+    virObjectLock(st);
+
+    if (!st->holeLength &&
+        virNetClientStreamHandleHole(st) < 0)
+        goto cleanup;
+
+    *length = st->holeLength;
+    st->holeLength = 0;
+
+    virNetClientStreamEventTimerUpdate(st);
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(st);
+    return ret;
+}
+
+
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags)
+{
+    virNetMessagePtr msg = NULL;
+    virNetStreamHole data;
+    int ret = -1;
+
+    VIR_DEBUG("st=%p length=%lld", st, length);
+
+    if (!st->allowSkip) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Skipping is not supported with this stream"));
+        return -1;
+    }
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    virObjectLock(st);
+
+    msg->header.prog = virNetClientProgramGetProgram(st->prog);
+    msg->header.vers = virNetClientProgramGetVersion(st->prog);
+    msg->header.status = VIR_NET_CONTINUE;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = st->serial;
+    msg->header.proc = st->proc;
+
+    virObjectUnlock(st);
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg,
+                                   (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto cleanup;
+
+    if (virNetClientSendNoReply(client, msg) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
 int virNetClientStreamEventAddCallback(virNetClientStreamPtr st,
                                        int events,
                                        virNetClientStreamEventCallback cb,
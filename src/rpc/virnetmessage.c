@@ -30,6 +30,7 @@
 #include "virfile.h"
 #include "virutil.h"
 #include "virstring.h"
+#include "virobject.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
@@ -63,10 +64,35 @@ virNetMessageClearPayload(virNetMessagePtr msg)
 
     msg->bufferOffset = 0;
     msg->bufferLength = 0;
+    msg->bufferCapacity = 0;
     VIR_FREE(msg->buffer);
 }
 
 
+/*
+ * @msg: the message whose buffer to grow
+ * @len: the number of bytes needed
+ *
+ * Makes sure the message buffer can hold at least @len bytes.
+ * A buffer which is known to be large enough is left untouched.
+ *
+ * returns 0 on success, -1 on OOM
+ */
+static int
+virNetMessageReserveBuffer(virNetMessagePtr msg,
+                           size_t len)
+{
+    if (msg->buffer && msg->bufferCapacity >= len)
+        return 0;
+
+    if (VIR_REALLOC_N(msg->buffer, len) < 0)
+        return -1;
+    msg->bufferCapacity = len;
+
+    return 0;
+}
+
+
 void virNetMessageClear(virNetMessagePtr msg)
 {
     bool tracked = msg->tracked;
@@ -154,7 +180,7 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
     /* Extend our declared buffer length and carry
        on reading the header + payload */
     msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
         goto cleanup;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
@@ -220,7 +246,10 @@ int virNetMessageDecodeHeader(virNetMessagePtr msg)
  * message offset ready to encode the payload. Leaves space
  * for the length field later. Upon return bufferLength will
  * refer to the total available space for message, while
- * bufferOffset will refer to current space used by header
+ * bufferOffset will refer to current space used by header.
+ * A buffer already known to be larger than the initial size
+ * is kept as is, so that callers can recycle buffers across
+ * messages.
  *
  * returns 0 if successfully encoded, -1 upon fatal error
  */
@@ -230,9 +259,10 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     int ret = -1;
     unsigned int len = 0;
 
-    msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageReserveBuffer(msg, VIR_NET_MESSAGE_INITIAL +
+                                   VIR_NET_MESSAGE_LEN_MAX) < 0)
         return ret;
+    msg->bufferLength = msg->bufferCapacity;
     msg->bufferOffset = 0;
 
     /* Format the header. */
@@ -369,7 +399,7 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 
         msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
 
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
             goto error;
 
         xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
@@ -453,7 +483,7 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
 
         msg->bufferLength = msg->bufferOffset + len;
 
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageReserveBuffer(msg, msg->bufferLength) < 0)
             return -1;
 
         VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
@@ -600,3 +630,236 @@ int virNetMessageAddFD(virNetMessagePtr msg,
     VIR_FORCE_CLOSE(newfd);
     return -1;
 }
+
+
+/*
+ * Messages released to the pool are sorted into size classes by
+ * the capacity of their buffer. Class @i holds buffers of exactly
+ * VIR_NET_MESSAGE_INITIAL * 4^i + VIR_NET_MESSAGE_LEN_MAX bytes,
+ * which matches how virNetMessageEncodePayload grows them. Other
+ * buffers, e.g. those sized to fit a large incoming message, are
+ * freed: keeping them would make a class hold far more memory than
+ * its limit accounts for.
+ */
+#define VIR_NET_MESSAGE_POOL_CLASSES 3
+
+struct _virNetMessagePool {
+    virObjectLockable parent;
+
+    virNetMessagePtr free[VIR_NET_MESSAGE_POOL_CLASSES];
+    size_t nfree[VIR_NET_MESSAGE_POOL_CLASSES];
+    size_t maxFree[VIR_NET_MESSAGE_POOL_CLASSES];
+
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long discards;
+};
+
+static virClassPtr virNetMessagePoolClass;
+static void virNetMessagePoolDispose(void *obj);
+
+static int virNetMessagePoolOnceInit(void)
+{
+    if (!(virNetMessagePoolClass = virClassNew(virClassForObjectLockable(),
+                                               "virNetMessagePool",
+                                               sizeof(virNetMessagePool),
+                                               virNetMessagePoolDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetMessagePool)
+
+
+static size_t
+virNetMessagePoolClassSize(size_t idx)
+{
+    return (VIR_NET_MESSAGE_INITIAL << (2 * idx)) + VIR_NET_MESSAGE_LEN_MAX;
+}
+
+
+/*
+ * @maxFree: the number of messages with the smallest buffers to keep
+ *
+ * Creates a pool of messages to be recycled instead of being freed
+ * and allocated again. Classes with larger buffers keep a quarter
+ * of the messages of the previous class, so that memory held by
+ * each class stays the same.
+ *
+ * Returns the new pool, or NULL upon OOM
+ */
+virNetMessagePoolPtr
+virNetMessagePoolNew(size_t maxFree)
+{
+    virNetMessagePoolPtr pool;
+    size_t i;
+
+    if (virNetMessagePoolInitialize() < 0)
+        return NULL;
+
+    if (!(pool = virObjectLockableNew(virNetMessagePoolClass)))
+        return NULL;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++)
+        pool->maxFree[i] = MAX(maxFree >> (2 * i), maxFree ? 1 : 0);
+
+    VIR_DEBUG("pool=%p maxFree=%zu", pool, maxFree);
+
+    return pool;
+}
+
+
+static void
+virNetMessagePoolDispose(void *obj)
+{
+    virNetMessagePoolPtr pool = obj;
+    size_t i;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++) {
+        while (pool->free[i]) {
+            virNetMessagePtr msg = virNetMessageQueueServe(&pool->free[i]);
+            virNetMessageFree(msg);
+        }
+    }
+}
+
+
+/*
+ * @pool: the pool to take the message from, or NULL
+ * @tracked: whether the message is tracked
+ * @len: the amount of data the message has to be able to hold
+ *
+ * Hands out a message whose buffer can hold at least @len bytes
+ * with bufferLength set to @len. A message recycled from @pool
+ * is preferred, otherwise a new one is allocated.
+ *
+ * Returns the message, or NULL upon OOM
+ */
+virNetMessagePtr
+virNetMessagePoolGet(virNetMessagePoolPtr pool,
+                     bool tracked,
+                     size_t len)
+{
+    virNetMessagePtr msg = NULL;
+    size_t i;
+
+    if (pool) {
+        virObjectLock(pool);
+        for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES && !msg; i++) {
+            if (i < VIR_NET_MESSAGE_POOL_CLASSES - 1 &&
+                virNetMessagePoolClassSize(i) < len)
+                continue;
+            if (pool->free[i]) {
+                msg = virNetMessageQueueServe(&pool->free[i]);
+                pool->nfree[i]--;
+            }
+        }
+        if (msg)
+            pool->hits++;
+        else
+            pool->misses++;
+        virObjectUnlock(pool);
+    }
+
+    if (msg)
+        msg->tracked = tracked;
+    else if (!(msg = virNetMessageNew(tracked)))
+        return NULL;
+
+    if (virNetMessageReserveBuffer(msg, len) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+    msg->bufferLength = len;
+
+    VIR_DEBUG("pool=%p msg=%p tracked=%d len=%zu", pool, msg, tracked, len);
+
+    return msg;
+}
+
+
+/*
+ * @pool: the pool to release the message to, or NULL
+ * @msg: the message to release
+ *
+ * Releases a message which is no longer used. Like with
+ * virNetMessageFree the message's free callback is invoked
+ * and its file descriptors are closed, but the message and its
+ * buffer are kept in @pool for reuse if the buffer's capacity is
+ * exactly the size of one of the classes and there's room left in it.
+ */
+void
+virNetMessagePoolPut(virNetMessagePoolPtr pool,
+                     virNetMessagePtr msg)
+{
+    char *buffer;
+    size_t capacity;
+    size_t i;
+
+    if (!msg)
+        return;
+
+    if (!pool) {
+        virNetMessageFree(msg);
+        return;
+    }
+
+    if (msg->cb) {
+        msg->cb(msg, msg->opaque);
+        msg->cb = NULL;
+    }
+
+    /* Drop everything but the buffer */
+    buffer = msg->buffer;
+    capacity = buffer ? msg->bufferCapacity : 0;
+    msg->buffer = NULL;
+    virNetMessageClear(msg);
+    msg->buffer = buffer;
+    msg->bufferCapacity = capacity;
+
+    for (i = VIR_NET_MESSAGE_POOL_CLASSES; i > 0; i--) {
+        if (capacity >= virNetMessagePoolClassSize(i - 1))
+            break;
+    }
+
+    /* The buffer must not exceed the size of its class */
+    if (i > 0 && capacity > virNetMessagePoolClassSize(i - 1))
+        i = 0;
+
+    virObjectLock(pool);
+    if (i > 0 && pool->nfree[i - 1] < pool->maxFree[i - 1]) {
+        msg->next = pool->free[i - 1];
+        pool->free[i - 1] = msg;
+        pool->nfree[i - 1]++;
+        msg = NULL;
+    } else {
+        pool->discards++;
+    }
+    virObjectUnlock(pool);
+
+    VIR_DEBUG("pool=%p capacity=%zu kept=%d", pool, capacity, !msg);
+
+    virNetMessageFree(msg);
+}
+
+
+/*
+ * @pool: the pool to query
+ * @stats: filled with the pool's counters
+ */
+void
+virNetMessagePoolGetStats(virNetMessagePoolPtr pool,
+                          virNetMessagePoolStatsPtr stats)
+{
+    size_t i;
+
+    virObjectLock(pool);
+    stats->hits = pool->hits;
+    stats->misses = pool->misses;
+    stats->discards = pool->discards;
+    stats->nfree = 0;
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++)
+        stats->nfree += pool->nfree[i];
+    virObjectUnlock(pool);
+}
@@ -38,6 +38,7 @@ struct _virNetMessage {
                   /* Maximum   VIR_NET_MESSAGE_MAX     + VIR_NET_MESSAGE_LEN_MAX */
     size_t bufferLength;
     size_t bufferOffset;
+    size_t bufferCapacity; /* Allocated size of @buffer, 0 if unknown */
 
     virNetMessageHeader header;
 
@@ -101,4 +102,30 @@ int virNetMessageDupFD(virNetMessagePtr msg,
 int virNetMessageAddFD(virNetMessagePtr msg,
                        int fd);
 
+typedef struct _virNetMessagePool virNetMessagePool;
+typedef virNetMessagePool *virNetMessagePoolPtr;
+
+typedef struct _virNetMessagePoolStats virNetMessagePoolStats;
+typedef virNetMessagePoolStats *virNetMessagePoolStatsPtr;
+
+struct _virNetMessagePoolStats {
+    unsigned long long hits;     /* Messages handed out from the pool */
+    unsigned long long misses;   /* Messages allocated from scratch */
+    unsigned long long discards; /* Released messages not kept in the pool */
+    size_t nfree;                /* Messages currently kept in the pool */
+};
+
+virNetMessagePoolPtr virNetMessagePoolNew(size_t maxFree);
+
+virNetMessagePtr virNetMessagePoolGet(virNetMessagePoolPtr pool,
+                                      bool tracked,
+                                      size_t len);
+
+void virNetMessagePoolPut(virNetMessagePoolPtr pool,
+                          virNetMessagePtr msg);
+
+void virNetMessagePoolGetStats(virNetMessagePoolPtr pool,
+                               virNetMessagePoolStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 #endif /* __VIR_NET_MESSAGE_H__ */
@@ -73,6 +73,18 @@ struct _virNetServer {
     int keepaliveInterval;
     unsigned int keepaliveCount;
 
+    /* Messages recycled across calls of all clients */
+    virNetMessagePoolPtr msgpool;
+
+    /* Event loop threads dispatching client socket I/O. Only the
+     * first nioThreadsActive get new clients, the rest are idle
+     * after the count was lowered and just serve their existing
+     * clients. With none active, the default event loop is used */
+    virEventThreadPtr *ioThreads;
+    size_t nioThreads;
+    size_t nioThreadsActive;
+    size_t ioThreadNext;
+
 #ifdef WITH_GNUTLS
     virNetTLSContextPtr tls;
 #endif
@@ -84,6 +96,13 @@ struct _virNetServer {
 };
 
 
+/* Number of released messages with default sized buffers the server
+ * keeps around for reuse */
+#define VIR_NET_SERVER_MESSAGE_POOL_MAX 64
+
+/* Upper limit on event loop threads for client I/O */
+#define VIR_NET_SERVER_IO_THREADS_MAX 64
+
 static virClassPtr virNetServerClass;
 static void virNetServerDispose(void *obj);
 static void virNetServerUpdateServicesLocked(virNetServerPtr srv,
@@ -279,6 +298,26 @@ int virNetServerAddClient(virNetServerPtr srv,
 {
     virObjectLock(srv);
 
+    if (srv->nioThreadsActive > 0) {
+        virEventThreadPtr evt = srv->ioThreads[srv->ioThreadNext];
+
+        srv->ioThreadNext = (srv->ioThreadNext + 1) % srv->nioThreadsActive;
+        if (virNetServerClientSetEventThread(client, evt) < 0)
+            goto error;
+    }
+
+    /* With an event thread of its own the client may start processing
+     * incoming messages as soon as it is initialized, so it has to be
+     * fully set up by then */
+    virNetServerClientSetDispatcher(client,
+                                    virNetServerDispatchNewMessage,
+                                    srv);
+
+    virNetServerClientSetMessagePool(client, srv->msgpool);
+
+    virNetServerClientInitKeepAlive(client, srv->keepaliveInterval,
+                                    srv->keepaliveCount);
+
     if (virNetServerClientInit(client) < 0)
         goto error;
 
@@ -292,13 +331,6 @@ int virNetServerAddClient(virNetServerPtr srv,
 
     virNetServerCheckLimits(srv);
 
-    virNetServerClientSetDispatcher(client,
-                                    virNetServerDispatchNewMessage,
-                                    srv);
-
-    virNetServerClientInitKeepAlive(client, srv->keepaliveInterval,
-                                    srv->keepaliveCount);
-
     virObjectUnlock(srv);
     return 0;
 
@@ -371,6 +403,9 @@ virNetServerPtr virNetServerNew(const char *name,
     if (VIR_STRDUP(srv->name, name) < 0)
         goto error;
 
+    if (!(srv->msgpool = virNetMessagePoolNew(VIR_NET_SERVER_MESSAGE_POOL_MAX)))
+        goto error;
+
     srv->next_client_id = next_client_id;
     srv->nclients_max = max_clients;
     srv->nclients_unauth_max = max_anonymous_clients;
@@ -783,6 +818,14 @@ void virNetServerDispose(void *obj)
     }
     VIR_FREE(srv->clients);
 
+    virObjectUnref(srv->msgpool);
+
+    for (i = 0; i < srv->nioThreads; i++) {
+        virEventThreadStop(srv->ioThreads[i]);
+        virObjectUnref(srv->ioThreads[i]);
+    }
+    VIR_FREE(srv->ioThreads);
+
     VIR_FREE(srv->mdnsGroupName);
     virNetServerMDNSFree(srv->mdns);
 }
@@ -936,6 +979,77 @@ virNetServerSetThreadPoolParameters(virNetServerPtr srv,
     return ret;
 }
 
+size_t
+virNetServerGetIOThreads(virNetServerPtr srv)
+{
+    size_t ret;
+
+    virObjectLock(srv);
+    ret = srv->nioThreadsActive;
+    virObjectUnlock(srv);
+
+    return ret;
+}
+
+/**
+ * virNetServerSetIOThreads:
+ * @srv: the server
+ * @nthreads: number of event loop threads
+ *
+ * Spread socket I/O of clients added from now on over @nthreads
+ * event loop threads of their own, or handle it in the default
+ * event loop if @nthreads is 0. Already connected clients stay
+ * with the loop they are in, so threads are never torn down
+ * while the server exists, only left without new clients.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virNetServerSetIOThreads(virNetServerPtr srv,
+                         size_t nthreads)
+{
+    virEventThreadPtr evt = NULL;
+    char *name = NULL;
+    int ret = -1;
+
+    virObjectLock(srv);
+
+    if (nthreads > VIR_NET_SERVER_IO_THREADS_MAX) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("I/O thread count %zu exceeds the limit of %d"),
+                       nthreads, VIR_NET_SERVER_IO_THREADS_MAX);
+        goto cleanup;
+    }
+
+    while (srv->nioThreads < nthreads) {
+        if (virAsprintf(&name, "%s-io-%zu", srv->name, srv->nioThreads) < 0)
+            goto cleanup;
+
+        if (!(evt = virEventThreadNew(name)))
+            goto cleanup;
+
+        if (VIR_APPEND_ELEMENT(srv->ioThreads, srv->nioThreads, evt) < 0)
+            goto cleanup;
+
+        VIR_FREE(name);
+    }
+
+    srv->nioThreadsActive = nthreads;
+    if (srv->ioThreadNext >= nthreads)
+        srv->ioThreadNext = 0;
+
+    ret = 0;
+
+ cleanup:
+    if (evt) {
+        virEventThreadStop(evt);
+        virObjectUnref(evt);
+    }
+    VIR_FREE(name);
+    virObjectUnlock(srv);
+    return ret;
+}
+
 size_t
 virNetServerGetMaxClients(virNetServerPtr srv)
 {
@@ -984,6 +1098,13 @@ virNetServerGetCurrentUnauthClients(virNetServerPtr srv)
     return ret;
 }
 
+void
+virNetServerGetMessagePoolStats(virNetServerPtr srv,
+                                virNetMessagePoolStatsPtr stats)
+{
+    virNetMessagePoolGetStats(srv->msgpool, stats);
+}
+
 int
 virNetServerGetClients(virNetServerPtr srv,
                        virNetServerClientPtr **clts)
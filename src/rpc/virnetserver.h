@@ -103,6 +103,10 @@ int virNetServerSetThreadPoolParameters(virNetServerPtr srv,
                                         long long int maxWorkers,
                                         long long int prioWorkers);
 
+size_t virNetServerGetIOThreads(virNetServerPtr srv);
+int virNetServerSetIOThreads(virNetServerPtr srv,
+                             size_t nthreads);
+
 unsigned long long virNetServerNextClientID(virNetServerPtr srv);
 
 virNetServerClientPtr virNetServerGetClient(virNetServerPtr srv,
@@ -115,6 +119,8 @@ size_t virNetServerGetMaxClients(virNetServerPtr srv);
 size_t virNetServerGetCurrentClients(virNetServerPtr srv);
 size_t virNetServerGetMaxUnauthClients(virNetServerPtr srv);
 size_t virNetServerGetCurrentUnauthClients(virNetServerPtr srv);
+void virNetServerGetMessagePoolStats(virNetServerPtr srv,
+                                     virNetMessagePoolStatsPtr stats);
 
 int virNetServerSetClientLimits(virNetServerPtr srv,
                                 long long int maxClients,
@@ -114,6 +114,9 @@ struct _virNetServerClient
     virNetServerClientDispatchFunc dispatchFunc;
     void *dispatchOpaque;
 
+    /* Recycles messages once they are sent or dropped */
+    virNetMessagePoolPtr msgpool;
+
     void *privateData;
     virFreeCallback privateDataFreeFunc;
     virNetServerClientPrivPreExecRestart privateDataPreExecRestart;
@@ -347,8 +350,9 @@ static void virNetServerClientSockTimerFunc(int timer,
     virObjectLock(client);
     virEventUpdateTimeout(timer, -1);
     /* Although client->rx != NULL when this timer is enabled, it might have
-     * changed since the client was unlocked in the meantime. */
-    if (client->rx)
+     * changed since the client was unlocked in the meantime. The timer
+     * is also fired just to wake up the main loop for closing the client. */
+    if (client->rx && !client->wantClose)
         virNetServerClientDispatchRead(client);
     virObjectUnlock(client);
 }
@@ -903,6 +907,36 @@ void virNetServerClientSetDispatcher(virNetServerClientPtr client,
 }
 
 
+void virNetServerClientSetMessagePool(virNetServerClientPtr client,
+                                      virNetMessagePoolPtr pool)
+{
+    virObjectLock(client);
+    virObjectUnref(client->msgpool);
+    client->msgpool = virObjectRef(pool);
+    virObjectUnlock(client);
+}
+
+
+/*
+ * Must be called before virNetServerClientInit, as the socket
+ * watch cannot be moved to another event loop once registered.
+ */
+int virNetServerClientSetEventThread(virNetServerClientPtr client,
+                                     virEventThreadPtr evt)
+{
+    int ret = -1;
+
+    virObjectLock(client);
+    if (client->sock)
+        ret = virNetSocketSetEventThread(client->sock, evt);
+    else
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("client has no socket"));
+    virObjectUnlock(client);
+    return ret;
+}
+
+
 const char *virNetServerClientLocalAddrStringSASL(virNetServerClientPtr client)
 {
     if (!client->sock)
@@ -948,6 +982,7 @@ void virNetServerClientDispose(void *obj)
     virObjectUnref(client->tlsCtxt);
 #endif
     virObjectUnref(client->sock);
+    virObjectUnref(client->msgpool);
 }
 
 
@@ -1231,7 +1266,7 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
               msg->header.type, msg->header.status, msg->header.serial);
 
         if (virKeepAliveCheckMessage(client->keepalive, msg, &response)) {
-            virNetMessageFree(msg);
+            virNetMessagePoolPut(client->msgpool, msg);
             client->nrequests--;
             msg = NULL;
 
@@ -1275,25 +1310,23 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
 
         /* Possibly need to create another receive buffer */
         if (client->nrequests < client->nrequests_max) {
-            if (!(client->rx = virNetMessageNew(true))) {
+            if (!(client->rx = virNetMessagePoolGet(client->msgpool, true,
+                                                    VIR_NET_MESSAGE_LEN_MAX)))
                 client->wantClose = true;
-            } else {
-                client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                if (VIR_ALLOC_N(client->rx->buffer,
-                                client->rx->bufferLength) < 0) {
-                    client->wantClose = true;
-                } else {
-                    client->nrequests++;
-                }
-            }
+            else
+                client->nrequests++;
         }
         virNetServerClientUpdateEvent(client);
     }
 }
 
 
+/* Upper limit on queued messages passed to a single write */
+#define VIR_NET_SERVER_CLIENT_TX_BATCH 32
+
 /*
- * Send client->tx using no encoding
+ * Send client->tx using no encoding. Messages queued behind the
+ * head are sent along in the same syscall where possible.
  *
  * Returns:
  *   -1 on error or EOF
@@ -1302,6 +1335,10 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
  */
 static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
 {
+    struct iovec iov[VIR_NET_SERVER_CLIENT_TX_BATCH];
+    virNetMessagePtr msg;
+    int niov = 0;
+    size_t done;
     ssize_t ret;
 
     if (client->tx->bufferLength < client->tx->bufferOffset) {
@@ -1315,13 +1352,39 @@ static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
     if (client->tx->bufferLength == client->tx->bufferOffset)
         return 1;
 
-    ret = virNetSocketWrite(client->sock,
-                            client->tx->buffer + client->tx->bufferOffset,
-                            client->tx->bufferLength - client->tx->bufferOffset);
+    for (msg = client->tx;
+         msg && niov < VIR_NET_SERVER_CLIENT_TX_BATCH;
+         msg = msg->next) {
+        if (msg->bufferOffset >= msg->bufferLength)
+            break;
+
+        iov[niov].iov_base = msg->buffer + msg->bufferOffset;
+        iov[niov].iov_len = msg->bufferLength - msg->bufferOffset;
+        niov++;
+
+        /* File descriptors have to follow right after the data of
+         * their message, and a pending SASL session applies to any
+         * data after the current message */
+        if (msg->nfds > 0)
+            break;
+#if WITH_SASL
+        if (client->sasl)
+            break;
+#endif
+    }
+
+    ret = virNetSocketWritev(client->sock, iov, niov);
     if (ret <= 0)
         return ret; /* -1 error, 0 = egain */
 
-    client->tx->bufferOffset += ret;
+    done = ret;
+    for (msg = client->tx; msg && done > 0; msg = msg->next) {
+        size_t len = MIN(done, msg->bufferLength - msg->bufferOffset);
+
+        msg->bufferOffset += len;
+        done -= len;
+    }
+
     return ret;
 }
 
@@ -1380,19 +1443,17 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                 if (!client->rx &&
                     client->nrequests < client->nrequests_max) {
                     /* Ready to recv more messages */
-                    virNetMessageClear(msg);
-                    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
-                        virNetMessageFree(msg);
-                        return;
-                    }
-                    client->rx = msg;
+                    virNetMessagePoolPut(client->msgpool, msg);
                     msg = NULL;
+                    if (!(client->rx = virNetMessagePoolGet(client->msgpool,
+                                                            true,
+                                                            VIR_NET_MESSAGE_LEN_MAX)))
+                        return;
                     client->nrequests++;
                 }
             }
 
-            virNetMessageFree(msg);
+            virNetMessagePoolPut(client->msgpool, msg);
 
             virNetServerClientUpdateEvent(client);
 
@@ -1466,6 +1527,15 @@ virNetServerClientDispatchEvent(virNetSocketPtr sock, int events, void *opaque)
                   VIR_EVENT_HANDLE_HANGUP))
         client->wantClose = true;
 
+    /* The client is closed by virNetServerProcessClients, which runs
+     * in the main loop. This may be an event thread of its own, so
+     * stop watching the socket lest a hung up one keeps waking us up,
+     * and fire the timer to have the main loop come round. */
+    if (client->wantClose) {
+        virNetServerClientUpdateEvent(client);
+        virEventUpdateTimeout(client->sockTimer, 0);
+    }
+
     virObjectUnlock(client);
 }
 
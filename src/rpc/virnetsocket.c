@@ -29,6 +29,7 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <limits.h>
 #ifdef HAVE_IFADDRS_H
 # include <ifaddrs.h>
 #endif
@@ -73,11 +74,20 @@
 
 VIR_LOG_INIT("rpc.netsocket");
 
+#ifndef IOV_MAX
+# define IOV_MAX 16
+#endif
+
+/* Small buffers passed to virNetSocketWritev on a TLS session are
+ * gathered into one record of at most this size */
+#define VIR_NET_SOCKET_TLS_GATHER_MAX (16 * 1024)
+
 struct _virNetSocket {
     virObjectLockable parent;
 
     int fd;
     int watch;
+    virEventThreadPtr evthread;
     pid_t pid;
     int errfd;
     bool client;
@@ -96,6 +106,7 @@ struct _virNetSocket {
 
 #if WITH_GNUTLS
     virNetTLSSessionPtr tlsSession;
+    char *tlsGather;
 #endif
 #if WITH_SASL
     virNetSASLSessionPtr saslSession;
@@ -1322,9 +1333,13 @@ void virNetSocketDispose(void *obj)
           "sock=%p", sock);
 
     if (sock->watch >= 0) {
-        virEventRemoveHandle(sock->watch);
+        if (sock->evthread)
+            virEventThreadRemoveHandle(sock->evthread, sock->watch);
+        else
+            virEventRemoveHandle(sock->watch);
         sock->watch = -1;
     }
+    virObjectUnref(sock->evthread);
 
 #ifdef HAVE_SYS_UN_H
     /* If a server socket, then unlink UNIX path */
@@ -1339,6 +1354,7 @@ void virNetSocketDispose(void *obj)
     if (sock->tlsSession)
         virNetTLSSessionSetIOCallbacks(sock->tlsSession, NULL, NULL, NULL);
     virObjectUnref(sock->tlsSession);
+    VIR_FREE(sock->tlsGather);
 #endif
 #if WITH_SASL
     virObjectUnref(sock->saslSession);
@@ -1852,6 +1868,97 @@ static ssize_t virNetSocketWriteWire(virNetSocketPtr sock, const char *buf, size
 }
 
 
+#if WITH_GNUTLS
+/*
+ * Each write to a TLS session produces at least one record, so
+ * send small buffers coalesced. Should the write block, the next
+ * attempt gathers the same leading bytes again, which is what
+ * gnutls expects when retrying.
+ */
+static ssize_t virNetSocketWritevTLS(virNetSocketPtr sock,
+                                     const struct iovec *iov,
+                                     int iovcnt)
+{
+    size_t len = 0;
+    size_t i;
+
+    if (iov[0].iov_len >= VIR_NET_SOCKET_TLS_GATHER_MAX)
+        return virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+
+    if (!sock->tlsGather &&
+        VIR_ALLOC_N(sock->tlsGather, VIR_NET_SOCKET_TLS_GATHER_MAX) < 0)
+        return -1;
+
+    for (i = 0; i < iovcnt && len < VIR_NET_SOCKET_TLS_GATHER_MAX; i++) {
+        size_t n = MIN(iov[i].iov_len, VIR_NET_SOCKET_TLS_GATHER_MAX - len);
+
+        memcpy(sock->tlsGather + len, iov[i].iov_base, n);
+        len += n;
+    }
+
+    return virNetSocketWriteWire(sock, sock->tlsGather, len);
+}
+#endif
+
+
+static ssize_t virNetSocketWritevWire(virNetSocketPtr sock,
+                                      const struct iovec *iov,
+                                      int iovcnt)
+{
+#ifndef WIN32
+    ssize_t ret;
+#endif
+
+    if (iovcnt == 1)
+        return virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+
+#if WITH_SSH2
+    if (sock->sshSession)
+        return virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+#endif
+
+#if WITH_LIBSSH
+    if (sock->libsshSession)
+        return virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+#endif
+
+#if WITH_GNUTLS
+    if (sock->tlsSession &&
+        virNetTLSSessionGetHandshakeStatus(sock->tlsSession) ==
+        VIR_NET_TLS_HANDSHAKE_COMPLETE)
+        return virNetSocketWritevTLS(sock, iov, iovcnt);
+#endif
+
+#ifdef WIN32
+    return virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+#else
+    if (iovcnt > IOV_MAX)
+        iovcnt = IOV_MAX;
+
+ rewrite:
+    ret = writev(sock->fd, iov, iovcnt);
+
+    if (ret < 0) {
+        if (errno == EINTR)
+            goto rewrite;
+        if (errno == EAGAIN)
+            return 0;
+
+        virReportSystemError(errno, "%s",
+                             _("Cannot write data"));
+        return -1;
+    }
+    if (ret == 0) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while writing data"));
+        return -1;
+    }
+
+    return ret;
+#endif
+}
+
+
 #if WITH_SASL
 static ssize_t virNetSocketReadSASL(virNetSocketPtr sock, char *buf, size_t len)
 {
@@ -1978,6 +2085,35 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
     return ret;
 }
 
+/*
+ * Write data from several buffers with as few syscalls as
+ * possible, with the same return values as virNetSocketWrite.
+ * Layers which cannot take them at once, such as SASL, only
+ * get the first buffer.
+ */
+ssize_t virNetSocketWritev(virNetSocketPtr sock,
+                           const struct iovec *iov,
+                           int iovcnt)
+{
+    ssize_t ret;
+
+    if (iovcnt <= 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("No data to write"));
+        return -1;
+    }
+
+    virObjectLock(sock);
+#if WITH_SASL
+    if (sock->saslSession)
+        ret = virNetSocketWriteSASL(sock, iov[0].iov_base, iov[0].iov_len);
+    else
+#endif
+        ret = virNetSocketWritevWire(sock, iov, iovcnt);
+    virObjectUnlock(sock);
+    return ret;
+}
+
 
 /*
  * Returns 1 if an FD was sent, 0 if it would block, -1 on error
@@ -2159,11 +2295,20 @@ int virNetSocketAddIOCallback(virNetSocketPtr sock,
         goto cleanup;
     }
 
-    if ((sock->watch = virEventAddHandle(sock->fd,
-                                         events,
-                                         virNetSocketEventHandle,
-                                         sock,
-                                         virNetSocketEventFree)) < 0) {
+    if (sock->evthread)
+        sock->watch = virEventThreadAddHandle(sock->evthread,
+                                              sock->fd,
+                                              events,
+                                              virNetSocketEventHandle,
+                                              sock,
+                                              virNetSocketEventFree);
+    else
+        sock->watch = virEventAddHandle(sock->fd,
+                                        events,
+                                        virNetSocketEventHandle,
+                                        sock,
+                                        virNetSocketEventFree);
+    if (sock->watch < 0) {
         VIR_DEBUG("Failed to register watch on socket %p", sock);
         goto cleanup;
     }
@@ -2180,6 +2325,40 @@ int virNetSocketAddIOCallback(virNetSocketPtr sock,
     return ret;
 }
 
+/**
+ * virNetSocketSetEventThread:
+ * @sock: the socket
+ * @evt: event thread to dispatch I/O events from
+ *
+ * Make the callback registered by virNetSocketAddIOCallback run
+ * in the event loop of @evt instead of the default one. Passing
+ * NULL reverts to the default event loop. This can only be done
+ * while no callback is registered.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetSocketSetEventThread(virNetSocketPtr sock,
+                               virEventThreadPtr evt)
+{
+    int ret = -1;
+
+    virObjectLock(sock);
+    if (sock->watch >= 0) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Cannot change event thread of a socket "
+                         "with a registered watch"));
+        goto cleanup;
+    }
+
+    virObjectUnref(sock->evthread);
+    sock->evthread = virObjectRef(evt);
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(sock);
+    return ret;
+}
+
 void virNetSocketUpdateIOCallback(virNetSocketPtr sock,
                                   int events)
 {
@@ -2190,13 +2369,19 @@ void virNetSocketUpdateIOCallback(virNetSocketPtr sock,
         return;
     }
 
-    virEventUpdateHandle(sock->watch, events);
+    if (sock->evthread)
+        virEventThreadUpdateHandle(sock->evthread, sock->watch, events);
+    else
+        virEventUpdateHandle(sock->watch, events);
 
     virObjectUnlock(sock);
 }
 
 void virNetSocketRemoveIOCallback(virNetSocketPtr sock)
 {
+    virEventThreadPtr evthread;
+    int watch;
+
     virObjectLock(sock);
 
     if (sock->watch < 0) {
@@ -2205,11 +2390,23 @@ void virNetSocketRemoveIOCallback(virNetSocketPtr sock)
         return;
     }
 
-    virEventRemoveHandle(sock->watch);
-    /* Don't unref @sock, it's done via eventloop callback. */
+    watch = sock->watch;
     sock->watch = -1;
 
+    if (!sock->evthread) {
+        virEventRemoveHandle(watch);
+        /* Don't unref @sock, it's done via eventloop callback. */
+        virObjectUnlock(sock);
+        return;
+    }
+
+    /* An event thread that is not running anymore invokes the free
+     * callback, which locks @sock, right away */
+    evthread = virObjectRef(sock->evthread);
     virObjectUnlock(sock);
+
+    virEventThreadRemoveHandle(evthread, watch);
+    virObjectUnref(evthread);
 }
 
 void virNetSocketClose(virNetSocketPtr sock)
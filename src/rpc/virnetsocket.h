@@ -24,6 +24,8 @@
 #ifndef __VIR_NET_SOCKET_H__
 # define __VIR_NET_SOCKET_H__
 
+# include <sys/uio.h>
+
 # include "virsocketaddr.h"
 # include "vircommand.h"
 # ifdef WITH_GNUTLS
@@ -35,6 +37,7 @@
 # endif
 # include "virjson.h"
 # include "viruri.h"
+# include "vireventthread.h"
 
 typedef struct _virNetSocket virNetSocket;
 typedef virNetSocket *virNetSocketPtr;
@@ -145,6 +148,9 @@ int virNetSocketSetBlocking(virNetSocketPtr sock,
 
 ssize_t virNetSocketRead(virNetSocketPtr sock, char *buf, size_t len);
 ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len);
+ssize_t virNetSocketWritev(virNetSocketPtr sock,
+                           const struct iovec *iov,
+                           int iovcnt);
 
 int virNetSocketSendFD(virNetSocketPtr sock, int fd);
 int virNetSocketRecvFD(virNetSocketPtr sock, int *fd);
@@ -175,6 +181,9 @@ int virNetSocketAddIOCallback(virNetSocketPtr sock,
                               void *opaque,
                               virFreeCallback ff);
 
+int virNetSocketSetEventThread(virNetSocketPtr sock,
+                               virEventThreadPtr evt);
+
 void virNetSocketUpdateIOCallback(virNetSocketPtr sock,
                                   int events);
 
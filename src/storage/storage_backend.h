@@ -37,6 +37,8 @@ typedef int (*virStorageBackendBuildPool)(virConnectPtr conn,
                                           unsigned int flags);
 typedef int (*virStorageBackendRefreshPool)(virConnectPtr conn,
                                             virStoragePoolObjPtr pool);
+typedef int (*virStorageBackendRefreshPoolEntry)(virStoragePoolObjPtr pool,
+                                                 const char *name);
 typedef int (*virStorageBackendStopPool)(virConnectPtr conn,
                                          virStoragePoolObjPtr pool);
 typedef int (*virStorageBackendDeletePool)(virConnectPtr conn,
@@ -109,6 +111,9 @@ struct _virStorageBackend {
     virStorageBackendStartPool startPool;
     virStorageBackendBuildPool buildPool;
     virStorageBackendRefreshPool refreshPool; /* Must be non-NULL */
+    /* Updates a single volume after a change of the pool's target
+     * directory; pools implementing it are watched for changes */
+    virStorageBackendRefreshPoolEntry refreshPoolEntry;
     virStorageBackendStopPool stopPool;
     virStorageBackendDeletePool deletePool;
 
@@ -64,9 +64,12 @@ virStorageBackendDiskMakeDataVol(virStoragePoolObjPtr pool,
          */
         if (VIR_ALLOC(vol) < 0)
             return -1;
+        /* The pool indexes the path and key, so set them first */
         if (VIR_STRDUP(vol->name, partname) < 0 ||
-            VIR_APPEND_ELEMENT_COPY(pool->volumes.objs,
-                                    pool->volumes.count, vol) < 0) {
+            !(vol->target.path = virStorageBackendStablePath(pool, groups[0],
+                                                             true)) ||
+            VIR_STRDUP(vol->key, vol->target.path) < 0 ||
+            virStoragePoolObjAddVol(pool, vol) < 0) {
             virStorageVolDefFree(vol);
             return -1;
         }
@@ -35,6 +35,9 @@
 #endif
 #include <errno.h>
 #include <string.h>
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
 
 #include "virerror.h"
 #include "datatypes.h"
@@ -52,6 +55,7 @@
 #include "viraccessapicheck.h"
 #include "dirname.h"
 #include "storage_util.h"
+#include "virevent.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -77,6 +81,607 @@ static void storageDriverUnlock(void)
     virMutexUnlock(&driver->lock);
 }
 
+
+static int
+storageVolIndexMatchPool(const void *payload,
+                         const void *name ATTRIBUTE_UNUSED,
+                         const void *opaque)
+{
+    return memcmp(payload, opaque, VIR_UUID_BUFLEN) == 0;
+}
+
+
+/* Remembers that @str is found in the pool @uuid. Failing to is not an
+ * error, the volume is then looked up in every pool. */
+static void
+storageVolIndexAddLocked(virHashTablePtr table,
+                         const char *str,
+                         const unsigned char *uuid)
+{
+    unsigned char *copy;
+
+    if (!str || VIR_ALLOC_N_QUIET(copy, VIR_UUID_BUFLEN) < 0)
+        return;
+
+    memcpy(copy, uuid, VIR_UUID_BUFLEN);
+    if (virHashUpdateEntry(table, str, copy) < 0) {
+        virResetLastError();
+        VIR_FREE(copy);
+    }
+}
+
+
+static void
+storageVolIndexRemovePoolLocked(virStoragePoolObjPtr pool)
+{
+    virHashRemoveSet(driver->volPaths, storageVolIndexMatchPool,
+                     pool->def->uuid);
+    virHashRemoveSet(driver->volKeys, storageVolIndexMatchPool,
+                     pool->def->uuid);
+}
+
+
+/* Forgets all volumes of @pool */
+static void
+storageVolIndexRemovePool(virStoragePoolObjPtr pool)
+{
+    virMutexLock(&driver->volIndexLock);
+    storageVolIndexRemovePoolLocked(pool);
+    virMutexUnlock(&driver->volIndexLock);
+}
+
+
+/* Indexes the volumes of @pool, after it was refreshed */
+static void
+storageVolIndexPool(virStoragePoolObjPtr pool)
+{
+    size_t i;
+
+    virMutexLock(&driver->volIndexLock);
+    storageVolIndexRemovePoolLocked(pool);
+    for (i = 0; i < pool->volumes.count; i++) {
+        virStorageVolDefPtr vol = pool->volumes.objs[i];
+
+        storageVolIndexAddLocked(driver->volPaths, vol->target.path,
+                                 pool->def->uuid);
+        storageVolIndexAddLocked(driver->volKeys, vol->key,
+                                 pool->def->uuid);
+    }
+    virMutexUnlock(&driver->volIndexLock);
+}
+
+
+static void
+storageVolIndexAdd(virHashTablePtr table,
+                   const char *str,
+                   virStoragePoolObjPtr pool)
+{
+    virMutexLock(&driver->volIndexLock);
+    storageVolIndexAddLocked(table, str, pool->def->uuid);
+    virMutexUnlock(&driver->volIndexLock);
+}
+
+
+/*
+ * Returns the locked pool which last held @str according to @table,
+ * NULL if there is none. The caller must hold the driver lock and check
+ * the pool still holds @str.
+ */
+static virStoragePoolObjPtr
+storageVolIndexFindPool(virHashTablePtr table,
+                        const char *str)
+{
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    unsigned char *found;
+
+    virMutexLock(&driver->volIndexLock);
+    if ((found = virHashLookup(table, str)))
+        memcpy(uuid, found, VIR_UUID_BUFLEN);
+    virMutexUnlock(&driver->volIndexLock);
+
+    if (!found)
+        return NULL;
+
+    return virStoragePoolObjFindByUUID(&driver->pools, uuid);
+}
+
+
+#if HAVE_SYS_INOTIFY_H
+/* Changes of a pool's directory which may affect its volumes */
+# define STORAGE_POOL_INOTIFY_EVENTS \
+    (IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | \
+     IN_MOVED_FROM | IN_MOVED_TO)
+
+/* Changed entries of a pool remembered before refreshing it instead */
+# define STORAGE_POOL_CHANGES_MAX 1024
+
+typedef struct _virStoragePoolWatchData virStoragePoolWatchData;
+typedef virStoragePoolWatchData *virStoragePoolWatchDataPtr;
+struct _virStoragePoolWatchData {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    int fd;
+};
+
+
+static void
+storagePoolWatchDataFree(void *opaque)
+{
+    virStoragePoolWatchDataPtr data = opaque;
+
+    VIR_FORCE_CLOSE(data->fd);
+    VIR_FREE(data);
+}
+
+
+/* Applies the changes of the entries @names to @pool, falling back to a
+ * full refresh if some changes were lost */
+static bool
+storagePoolApplyChanges(virStoragePoolObjPtr pool,
+                        char **names,
+                        size_t nnames,
+                        bool overflow)
+{
+    virStorageBackendPtr backend;
+    bool changed = false;
+    size_t i;
+    int rc;
+
+    if (!(backend = virStorageBackendForType(pool->def->type)))
+        return false;
+
+    if (overflow) {
+        if (pool->asyncjobs > 0) {
+            VIR_WARN("Missed changes of storage pool '%s', refresh it "
+                     "once its jobs finish", pool->def->name);
+            return false;
+        }
+
+        VIR_DEBUG("Missed changes of storage pool '%s', refreshing it",
+                  pool->def->name);
+        virStoragePoolObjClearVols(pool);
+        if (backend->refreshPool(NULL, pool) < 0) {
+            VIR_WARN("Failed to refresh storage pool '%s': %s",
+                     pool->def->name, virGetLastErrorMessage());
+            virResetLastError();
+        }
+        storageVolIndexPool(pool);
+        return true;
+    }
+
+    for (i = 0; i < nnames; i++) {
+        /* Several changes of one file often come in a row */
+        if (i > 0 && STREQ(names[i], names[i - 1]))
+            continue;
+
+        if ((rc = backend->refreshPoolEntry(pool, names[i])) < 0) {
+            VIR_WARN("Failed to update volume '%s' of storage pool '%s': %s",
+                     names[i], pool->def->name, virGetLastErrorMessage());
+            virResetLastError();
+        } else if (rc > 0) {
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+
+typedef struct _virStoragePoolChangesData virStoragePoolChangesData;
+typedef virStoragePoolChangesData *virStoragePoolChangesDataPtr;
+struct _virStoragePoolChangesData {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    int watch;
+    char **names;
+    size_t nnames;
+    bool overflow;
+};
+
+
+static void
+storagePoolChangesDataFree(virStoragePoolChangesDataPtr data)
+{
+    size_t i;
+
+    for (i = 0; i < data->nnames; i++)
+        VIR_FREE(data->names[i]);
+    VIR_FREE(data->names);
+    VIR_FREE(data);
+}
+
+
+static void
+storagePoolChangesDataHashFree(void *payload,
+                               const void *name ATTRIBUTE_UNUSED)
+{
+    storagePoolChangesDataFree(payload);
+}
+
+
+/* Adds the changes of @src to those of @dst, of the same watch */
+static void
+storagePoolChangesMerge(virStoragePoolChangesDataPtr dst,
+                        virStoragePoolChangesDataPtr src)
+{
+    size_t i;
+
+    dst->overflow |= src->overflow;
+
+    for (i = 0; i < src->nnames && !dst->overflow; i++) {
+        if (VIR_APPEND_ELEMENT_QUIET(dst->names, dst->nnames,
+                                     src->names[i]) < 0)
+            dst->overflow = true;
+    }
+
+    /* Refreshing the whole pool beats probing this many volumes */
+    if (dst->nnames > STORAGE_POOL_CHANGES_MAX)
+        dst->overflow = true;
+
+    if (dst->overflow) {
+        for (i = 0; i < dst->nnames; i++)
+            VIR_FREE(dst->names[i]);
+        VIR_FREE(dst->names);
+        dst->nnames = 0;
+    }
+}
+
+
+static void
+storagePoolChangesApply(virStoragePoolChangesDataPtr data)
+{
+    virStoragePoolObjPtr pool = NULL;
+    virObjectEventPtr event = NULL;
+
+    storageDriverLock();
+    pool = virStoragePoolObjFindByUUID(&driver->pools, data->uuid);
+    storageDriverUnlock();
+
+    if (!pool)
+        goto cleanup;
+
+    if (pool->inotifyWatch != data->watch ||
+        !virStoragePoolObjIsActive(pool))
+        goto cleanup;
+
+    if (storagePoolApplyChanges(pool, data->names, data->nnames,
+                                data->overflow))
+        event = virStoragePoolEventRefreshNew(pool->def->name,
+                                              pool->def->uuid);
+
+ cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
+    if (event)
+        virObjectEventStateQueue(driver->storageEventState, event);
+    storagePoolChangesDataFree(data);
+}
+
+
+static int
+storagePoolChangesAny(const void *payload ATTRIBUTE_UNUSED,
+                      const void *name ATTRIBUTE_UNUSED,
+                      const void *opaque ATTRIBUTE_UNUSED)
+{
+    return 1;
+}
+
+
+/* Probing the changed volumes, let alone refreshing the whole pool,
+ * takes too long for the event loop; it is done by this thread */
+static void
+storagePoolChangesThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    virMutexLock(&driver->changesLock);
+
+    for (;;) {
+        virStoragePoolChangesDataPtr data;
+        char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+        while (!driver->changesQuit && virHashSize(driver->changes) == 0) {
+            if (virCondWait(&driver->changesCond, &driver->changesLock) < 0) {
+                VIR_WARN("Unable to wait for changes of storage pools");
+                goto cleanup;
+            }
+        }
+
+        if (driver->changesQuit)
+            break;
+
+        data = virHashSearch(driver->changes, storagePoolChangesAny, NULL);
+        virUUIDFormat(data->uuid, uuidstr);
+        ignore_value(virHashSteal(driver->changes, uuidstr));
+        virMutexUnlock(&driver->changesLock);
+
+        storagePoolChangesApply(data);
+
+        virMutexLock(&driver->changesLock);
+    }
+
+ cleanup:
+    virMutexUnlock(&driver->changesLock);
+}
+
+
+/* Hands @changes over to storagePoolChangesThread, merging them with
+ * those of the pool still waiting to be applied */
+static void
+storagePoolChangesQueue(virStoragePoolChangesDataPtr changes)
+{
+    virStoragePoolChangesDataPtr queued;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(changes->uuid, uuidstr);
+
+    virMutexLock(&driver->changesLock);
+
+    if ((queued = virHashLookup(driver->changes, uuidstr)) &&
+        queued->watch == changes->watch) {
+        storagePoolChangesMerge(queued, changes);
+        storagePoolChangesDataFree(changes);
+    } else if (virHashUpdateEntry(driver->changes, uuidstr, changes) < 0) {
+        VIR_WARN("Missed changes of storage pool: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+        storagePoolChangesDataFree(changes);
+    } else {
+        virCondSignal(&driver->changesCond);
+    }
+
+    virMutexUnlock(&driver->changesLock);
+}
+
+
+static void
+storagePoolInotifyEvent(int watch,
+                        int fd,
+                        int events ATTRIBUTE_UNUSED,
+                        void *opaque)
+{
+    virStoragePoolWatchDataPtr data = opaque;
+    virStoragePoolChangesDataPtr changes = NULL;
+    char buf[4096];
+    char **names = NULL;
+    size_t nnames = 0;
+    bool overflow = false;
+    size_t i;
+
+    for (;;) {
+        ssize_t got = read(fd, buf, sizeof(buf));
+        char *tmp = buf;
+
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        while (got >= (ssize_t)sizeof(struct inotify_event)) {
+            struct inotify_event *e = (struct inotify_event *) tmp;
+            size_t len = sizeof(*e) + e->len;
+            char *name;
+
+            if (got < (ssize_t)len)
+                break;
+
+            if (e->mask & IN_Q_OVERFLOW)
+                overflow = true;
+
+            if (e->len && e->name[0]) {
+                if (VIR_STRDUP(name, e->name) < 0 ||
+                    VIR_APPEND_ELEMENT(names, nnames, name) < 0) {
+                    VIR_FREE(name);
+                    overflow = true;
+                }
+            }
+
+            tmp += len;
+            got -= len;
+        }
+    }
+
+    if (!nnames && !overflow)
+        return;
+
+    if (VIR_ALLOC(changes) < 0)
+        goto error;
+
+    memcpy(changes->uuid, data->uuid, VIR_UUID_BUFLEN);
+    changes->watch = watch;
+    changes->names = names;
+    changes->nnames = nnames;
+    changes->overflow = overflow;
+
+    storagePoolChangesQueue(changes);
+    return;
+
+ error:
+    VIR_WARN("Missed changes of storage pool: %s",
+             virGetLastErrorMessage());
+    virResetLastError();
+    for (i = 0; i < nnames; i++)
+        VIR_FREE(names[i]);
+    VIR_FREE(names);
+}
+
+
+/*
+ * storagePoolWatch:
+ * @pool: active pool
+ *
+ * Starts watching the target directory of @pool, if its backend can
+ * update single volumes, so that volumes created, changed or removed
+ * outside of libvirt show up without refreshing the pool. Only changes
+ * made by this host are seen, a network file system does not report
+ * changes made by other hosts. Failing to watch the pool is not an
+ * error.
+ */
+static void
+storagePoolWatch(virStoragePoolObjPtr pool)
+{
+    virStorageBackendPtr backend;
+    virStoragePoolWatchDataPtr data = NULL;
+
+    if (pool->inotifyWatch > 0 ||
+        !(backend = virStorageBackendForType(pool->def->type)) ||
+        !backend->refreshPoolEntry)
+        return;
+
+    if (VIR_ALLOC(data) < 0)
+        goto error;
+    memcpy(data->uuid, pool->def->uuid, VIR_UUID_BUFLEN);
+
+    if ((data->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize inotify"));
+        goto error;
+    }
+
+    if (inotify_add_watch(data->fd, pool->def->target.path,
+                          STORAGE_POOL_INOTIFY_EVENTS | IN_ONLYDIR) < 0) {
+        virReportSystemError(errno, _("cannot watch directory '%s'"),
+                             pool->def->target.path);
+        goto error;
+    }
+
+    if ((pool->inotifyWatch = virEventAddHandle(data->fd,
+                                                VIR_EVENT_HANDLE_READABLE,
+                                                storagePoolInotifyEvent,
+                                                data,
+                                                storagePoolWatchDataFree)) < 0) {
+        pool->inotifyWatch = 0;
+        goto error;
+    }
+
+    VIR_DEBUG("Watching storage pool '%s'", pool->def->name);
+    return;
+
+ error:
+    VIR_WARN("Changes of storage pool '%s' will only be seen by refreshing "
+             "it: %s", pool->def->name, virGetLastErrorMessage());
+    virResetLastError();
+    if (data) {
+        VIR_FORCE_CLOSE(data->fd);
+        VIR_FREE(data);
+    }
+}
+
+
+static void
+storagePoolUnwatch(virStoragePoolObjPtr pool)
+{
+    if (pool->inotifyWatch <= 0)
+        return;
+
+    /* The inotify FD is closed once the event loop releases it */
+    virEventRemoveHandle(pool->inotifyWatch);
+    pool->inotifyWatch = 0;
+}
+
+
+/* Starts the thread applying changes of watched pools */
+static int
+storagePoolChangesStart(void)
+{
+    if (virMutexInit(&driver->changesLock) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        return -1;
+    }
+
+    if (virCondInit(&driver->changesCond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition variable"));
+        virMutexDestroy(&driver->changesLock);
+        return -1;
+    }
+
+    if (!(driver->changes = virHashCreate(16, storagePoolChangesDataHashFree)))
+        goto error;
+
+    if (virThreadCreate(&driver->changesThread, true,
+                        storagePoolChangesThread, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Failed to create thread to handle pool changes"));
+        goto error;
+    }
+
+    driver->changesRunning = true;
+    return 0;
+
+ error:
+    virHashFree(driver->changes);
+    driver->changes = NULL;
+    ignore_value(virCondDestroy(&driver->changesCond));
+    virMutexDestroy(&driver->changesLock);
+    return -1;
+}
+
+
+/* Waits for the changes being applied and drops the queued ones. Pools
+ * must not be watched anymore. */
+static void
+storagePoolChangesStop(void)
+{
+    if (!driver->changesRunning)
+        return;
+
+    virMutexLock(&driver->changesLock);
+    driver->changesQuit = true;
+    virCondSignal(&driver->changesCond);
+    virMutexUnlock(&driver->changesLock);
+
+    virThreadJoin(&driver->changesThread);
+    driver->changesRunning = false;
+
+    virHashFree(driver->changes);
+    driver->changes = NULL;
+    ignore_value(virCondDestroy(&driver->changesCond));
+    virMutexDestroy(&driver->changesLock);
+}
+
+#else /* !HAVE_SYS_INOTIFY_H */
+
+static void
+storagePoolWatch(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED)
+{
+}
+
+
+static void
+storagePoolUnwatch(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED)
+{
+}
+
+
+static int
+storagePoolChangesStart(void)
+{
+    return 0;
+}
+
+
+static void
+storagePoolChangesStop(void)
+{
+}
+#endif /* !HAVE_SYS_INOTIFY_H */
+
+
+static void
+storagePoolRemoveVolCache(virStoragePoolObjPtr pool)
+{
+    char *path;
+
+    if (!(path = virStoragePoolObjBuildVolCachePath(pool))) {
+        virResetLastError();
+        return;
+    }
+
+    if (unlink(path) < 0 && errno != ENOENT) {
+        char ebuf[1024];
+        VIR_WARN("Failed to remove volume cache '%s': %s",
+                 path, virStrerror(errno, ebuf, sizeof(ebuf)));
+    }
+    VIR_FREE(path);
+}
+
 static void
 storagePoolUpdateState(virStoragePoolObjPtr pool)
 {
@@ -124,6 +729,10 @@ storagePoolUpdateState(virStoragePoolObjPtr pool)
     }
 
     pool->active = active;
+    if (active) {
+        storageVolIndexPool(pool);
+        storagePoolWatch(pool);
+    }
     ret = 0;
  error:
     if (ret < 0) {
@@ -204,6 +813,8 @@ storageDriverAutostart(void)
                                pool->def->name, virGetLastErrorMessage());
             } else {
                 pool->active = true;
+                storageVolIndexPool(pool);
+                storagePoolWatch(pool);
             }
             VIR_FREE(stateFile);
         }
@@ -226,6 +837,7 @@ storageStateInitialize(bool privileged,
     int ret = -1;
     char *configdir = NULL;
     char *rundir = NULL;
+    char *cachedir = NULL;
 
     if (VIR_ALLOC(driver) < 0)
         return ret;
@@ -234,20 +846,35 @@ storageStateInitialize(bool privileged,
         VIR_FREE(driver);
         return ret;
     }
+    if (virMutexInit(&driver->volIndexLock) < 0) {
+        virMutexDestroy(&driver->lock);
+        VIR_FREE(driver);
+        return ret;
+    }
     storageDriverLock();
 
+    if (!(driver->volPaths = virHashCreate(1024, virHashValueFree)) ||
+        !(driver->volKeys = virHashCreate(1024, virHashValueFree)))
+        goto error;
+
+    if (storagePoolChangesStart() < 0)
+        goto error;
+
     if (privileged) {
         if (VIR_STRDUP(driver->configDir,
                        SYSCONFDIR "/libvirt/storage") < 0 ||
             VIR_STRDUP(driver->autostartDir,
                        SYSCONFDIR "/libvirt/storage/autostart") < 0 ||
             VIR_STRDUP(driver->stateDir,
-                       LOCALSTATEDIR "/run/libvirt/storage") < 0)
+                       LOCALSTATEDIR "/run/libvirt/storage") < 0 ||
+            VIR_STRDUP(driver->cacheDir,
+                       LOCALSTATEDIR "/cache/libvirt/storage") < 0)
             goto error;
     } else {
         configdir = virGetUserConfigDirectory();
         rundir = virGetUserRuntimeDirectory();
-        if (!(configdir && rundir))
+        cachedir = virGetUserCacheDirectory();
+        if (!(configdir && rundir && cachedir))
             goto error;
 
         if ((virAsprintf(&driver->configDir,
@@ -255,7 +882,9 @@ storageStateInitialize(bool privileged,
             (virAsprintf(&driver->autostartDir,
                         "%s/storage/autostart", configdir) < 0) ||
             (virAsprintf(&driver->stateDir,
-                         "%s/storage/run", rundir) < 0))
+                         "%s/storage/run", rundir) < 0) ||
+            (virAsprintf(&driver->cacheDir,
+                         "%s/storage", cachedir) < 0))
             goto error;
     }
     driver->privileged = privileged;
@@ -267,6 +896,14 @@ storageStateInitialize(bool privileged,
         goto error;
     }
 
+    /* Pools work just as well without the volume cache */
+    if (virFileMakePath(driver->cacheDir) < 0) {
+        char ebuf[1024];
+        VIR_WARN("Not caching volumes, cannot create directory %s: %s",
+                 driver->cacheDir, virStrerror(errno, ebuf, sizeof(ebuf)));
+        VIR_FREE(driver->cacheDir);
+    }
+
     if (virStoragePoolLoadAllState(&driver->pools,
                                    driver->stateDir) < 0)
         goto error;
@@ -286,6 +923,7 @@ storageStateInitialize(bool privileged,
  cleanup:
     VIR_FREE(configdir);
     VIR_FREE(rundir);
+    VIR_FREE(cachedir);
     return ret;
 
  error:
@@ -343,11 +981,26 @@ storageStateReload(void)
 static int
 storageStateCleanup(void)
 {
+    size_t i;
+
     if (!driver)
         return -1;
 
     storageDriverLock();
 
+    for (i = 0; i < driver->pools.count; i++) {
+        virStoragePoolObjPtr pool = driver->pools.objs[i];
+
+        virStoragePoolObjLock(pool);
+        storagePoolUnwatch(pool);
+        virStoragePoolObjUnlock(pool);
+    }
+
+    /* The changes thread needs the driver lock to finish */
+    storageDriverUnlock();
+    storagePoolChangesStop();
+    storageDriverLock();
+
     virObjectUnref(driver->storageEventState);
 
     /* free inactive pools */
@@ -356,7 +1009,11 @@ storageStateCleanup(void)
     VIR_FREE(driver->configDir);
     VIR_FREE(driver->autostartDir);
     VIR_FREE(driver->stateDir);
+    VIR_FREE(driver->cacheDir);
+    virHashFree(driver->volPaths);
+    virHashFree(driver->volKeys);
     storageDriverUnlock();
+    virMutexDestroy(&driver->volIndexLock);
     virMutexDestroy(&driver->lock);
     VIR_FREE(driver);
 
@@ -750,6 +1407,8 @@ storagePoolCreateXML(virConnectPtr conn,
 
     VIR_INFO("Creating storage pool '%s'", pool->def->name);
     pool->active = true;
+    storageVolIndexPool(pool);
+    storagePoolWatch(pool);
 
     ret = virGetStoragePool(conn, pool->def->name, pool->def->uuid,
                             NULL, NULL);
@@ -874,6 +1533,8 @@ storagePoolUndefine(virStoragePoolPtr obj)
     VIR_FREE(pool->configFile);
     VIR_FREE(pool->autostartLink);
 
+    storagePoolRemoveVolCache(pool);
+
     event = virStoragePoolEventLifecycleNew(pool->def->name,
                                             pool->def->uuid,
                                             VIR_STORAGE_POOL_EVENT_UNDEFINED,
@@ -964,6 +1625,8 @@ storagePoolCreate(virStoragePoolPtr obj,
                                             0);
 
     pool->active = true;
+    storageVolIndexPool(pool);
+    storagePoolWatch(pool);
     ret = 0;
 
  cleanup:
@@ -1058,11 +1721,16 @@ storagePoolDestroy(virStoragePoolPtr obj)
     unlink(stateFile);
     VIR_FREE(stateFile);
 
+    storagePoolUnwatch(pool);
+
     if (backend->stopPool &&
-        backend->stopPool(obj->conn, pool) < 0)
+        backend->stopPool(obj->conn, pool) < 0) {
+        storagePoolWatch(pool);
         goto cleanup;
+    }
 
     virStoragePoolObjClearVols(pool);
+    storageVolIndexRemovePool(pool);
 
     event = virStoragePoolEventLifecycleNew(pool->def->name,
                                             pool->def->uuid,
@@ -1072,6 +1740,7 @@ storagePoolDestroy(virStoragePoolPtr obj)
     pool->active = false;
 
     if (pool->configFile == NULL) {
+        storagePoolRemoveVolCache(pool);
         virStoragePoolObjRemove(&driver->pools, pool);
         pool = NULL;
     } else if (pool->newDef) {
@@ -1191,6 +1860,8 @@ storagePoolRefresh(virStoragePoolPtr obj,
 
     virStoragePoolObjClearVols(pool);
     if (backend->refreshPool(obj->conn, pool) < 0) {
+        storagePoolUnwatch(pool);
+        storageVolIndexRemovePool(pool);
         if (backend->stopPool)
             backend->stopPool(obj->conn, pool);
 
@@ -1207,6 +1878,8 @@ storagePoolRefresh(virStoragePoolPtr obj,
         goto cleanup;
     }
 
+    storageVolIndexPool(pool);
+
     event = virStoragePoolEventRefreshNew(pool->def->name,
                                           pool->def->uuid);
     ret = 0;
@@ -1550,46 +2223,122 @@ storageVolLookupByKey(virConnectPtr conn,
                       const char *key)
 {
     size_t i;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol = NULL;
     virStorageVolPtr ret = NULL;
 
     storageDriverLock();
-    for (i = 0; i < driver->pools.count && !ret; i++) {
-        virStoragePoolObjLock(driver->pools.objs[i]);
-        if (virStoragePoolObjIsActive(driver->pools.objs[i])) {
-            virStorageVolDefPtr vol =
-                virStorageVolDefFindByKey(driver->pools.objs[i], key);
-
-            if (vol) {
-                virStoragePoolDefPtr def = driver->pools.objs[i]->def;
-                if (virStorageVolLookupByKeyEnsureACL(conn, def, vol) < 0) {
-                    virStoragePoolObjUnlock(driver->pools.objs[i]);
-                    goto cleanup;
-                }
 
-                ret = virGetStorageVol(conn,
-                                       def->name,
-                                       vol->name,
-                                       vol->key,
-                                       NULL, NULL);
-            }
+    /* Try the pool which held the key last time first. Should several
+     * pools hold the key, this may return the one indexed last rather
+     * than the first one in the list of pools, which is fine since keys
+     * are meant to be unique anyway. */
+    if ((pool = storageVolIndexFindPool(driver->volKeys, key))) {
+        if (virStoragePoolObjIsActive(pool))
+            vol = virStorageVolDefFindByKey(pool, key);
+        if (!vol) {
+            virStoragePoolObjUnlock(pool);
+            pool = NULL;
         }
-        virStoragePoolObjUnlock(driver->pools.objs[i]);
     }
 
-    if (!ret)
+    for (i = 0; i < driver->pools.count && !vol; i++) {
+        pool = driver->pools.objs[i];
+
+        virStoragePoolObjLock(pool);
+        if (virStoragePoolObjIsActive(pool) &&
+            (vol = virStorageVolDefFindByKey(pool, key))) {
+            storageVolIndexAdd(driver->volKeys, key, pool);
+            break;
+        }
+        virStoragePoolObjUnlock(pool);
+        pool = NULL;
+    }
+
+    if (!vol) {
         virReportError(VIR_ERR_NO_STORAGE_VOL,
                        _("no storage vol with matching key %s"), key);
+        goto cleanup;
+    }
+
+    if (virStorageVolLookupByKeyEnsureACL(conn, pool->def, vol) < 0)
+        goto cleanup;
+
+    ret = virGetStorageVol(conn, pool->def->name, vol->name, vol->key,
+                           NULL, NULL);
 
  cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
     storageDriverUnlock();
     return ret;
 }
 
+
+/*
+ * Looks up the volume of the active @pool with the path @path, given
+ * as @cleanpath by the user. Returns 0 with *@vol set to the volume or
+ * NULL, -1 on error.
+ */
+static int
+storageVolLookupByPathInPool(virStoragePoolObjPtr pool,
+                             const char *path,
+                             const char *cleanpath,
+                             virStorageVolDefPtr *vol)
+{
+    char *stable_path = NULL;
+
+    *vol = NULL;
+
+    if (!virStoragePoolObjIsActive(pool))
+        return 0;
+
+    switch ((virStoragePoolType) pool->def->type) {
+        case VIR_STORAGE_POOL_DIR:
+        case VIR_STORAGE_POOL_FS:
+        case VIR_STORAGE_POOL_NETFS:
+        case VIR_STORAGE_POOL_LOGICAL:
+        case VIR_STORAGE_POOL_DISK:
+        case VIR_STORAGE_POOL_ISCSI:
+        case VIR_STORAGE_POOL_SCSI:
+        case VIR_STORAGE_POOL_MPATH:
+        case VIR_STORAGE_POOL_VSTORAGE:
+            stable_path = virStorageBackendStablePath(pool,
+                                                      cleanpath,
+                                                      false);
+            if (stable_path == NULL) {
+                /* Don't break the whole lookup process if it fails on
+                 * getting the stable path for some of the pools.
+                 */
+                VIR_WARN("Failed to get stable path for pool '%s'",
+                         pool->def->name);
+                return 0;
+            }
+            break;
+
+        case VIR_STORAGE_POOL_GLUSTER:
+        case VIR_STORAGE_POOL_RBD:
+        case VIR_STORAGE_POOL_SHEEPDOG:
+        case VIR_STORAGE_POOL_ZFS:
+        case VIR_STORAGE_POOL_LAST:
+            if (VIR_STRDUP(stable_path, path) < 0)
+                return -1;
+            break;
+    }
+
+    *vol = virStorageVolDefFindByPath(pool, stable_path);
+    VIR_FREE(stable_path);
+    return 0;
+}
+
+
 static virStorageVolPtr
 storageVolLookupByPath(virConnectPtr conn,
                        const char *path)
 {
     size_t i;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol = NULL;
     virStorageVolPtr ret = NULL;
     char *cleanpath;
 
@@ -1598,72 +2347,33 @@ storageVolLookupByPath(virConnectPtr conn,
         return NULL;
 
     storageDriverLock();
-    for (i = 0; i < driver->pools.count && !ret; i++) {
-        virStoragePoolObjPtr pool = driver->pools.objs[i];
-        virStorageVolDefPtr vol;
-        char *stable_path = NULL;
 
-        virStoragePoolObjLock(pool);
-
-        if (!virStoragePoolObjIsActive(pool)) {
-           virStoragePoolObjUnlock(pool);
-           continue;
-        }
-
-        switch ((virStoragePoolType) pool->def->type) {
-            case VIR_STORAGE_POOL_DIR:
-            case VIR_STORAGE_POOL_FS:
-            case VIR_STORAGE_POOL_NETFS:
-            case VIR_STORAGE_POOL_LOGICAL:
-            case VIR_STORAGE_POOL_DISK:
-            case VIR_STORAGE_POOL_ISCSI:
-            case VIR_STORAGE_POOL_SCSI:
-            case VIR_STORAGE_POOL_MPATH:
-            case VIR_STORAGE_POOL_VSTORAGE:
-                stable_path = virStorageBackendStablePath(pool,
-                                                          cleanpath,
-                                                          false);
-                if (stable_path == NULL) {
-                    /* Don't break the whole lookup process if it fails on
-                     * getting the stable path for some of the pools.
-                     */
-                    VIR_WARN("Failed to get stable path for pool '%s'",
-                             pool->def->name);
-                    virStoragePoolObjUnlock(pool);
-                    continue;
-                }
-                break;
-
-            case VIR_STORAGE_POOL_GLUSTER:
-            case VIR_STORAGE_POOL_RBD:
-            case VIR_STORAGE_POOL_SHEEPDOG:
-            case VIR_STORAGE_POOL_ZFS:
-            case VIR_STORAGE_POOL_LAST:
-                if (VIR_STRDUP(stable_path, path) < 0) {
-                     virStoragePoolObjUnlock(pool);
-                    goto cleanup;
-                }
-                break;
+    /* Try the pool which held the path last time first, which need not
+     * be the first pool holding it, see storageVolLookupByKey() */
+    if ((pool = storageVolIndexFindPool(driver->volPaths, cleanpath))) {
+        if (storageVolLookupByPathInPool(pool, path, cleanpath, &vol) < 0)
+            goto cleanup;
+        if (!vol) {
+            virStoragePoolObjUnlock(pool);
+            pool = NULL;
         }
+    }
 
-        vol = virStorageVolDefFindByPath(pool, stable_path);
-        VIR_FREE(stable_path);
+    for (i = 0; i < driver->pools.count && !vol; i++) {
+        pool = driver->pools.objs[i];
 
+        virStoragePoolObjLock(pool);
+        if (storageVolLookupByPathInPool(pool, path, cleanpath, &vol) < 0)
+            goto cleanup;
         if (vol) {
-            if (virStorageVolLookupByPathEnsureACL(conn, pool->def, vol) < 0) {
-                virStoragePoolObjUnlock(pool);
-                goto cleanup;
-            }
-
-            ret = virGetStorageVol(conn, pool->def->name,
-                                   vol->name, vol->key,
-                                   NULL, NULL);
+            storageVolIndexAdd(driver->volPaths, cleanpath, pool);
+            break;
         }
-
         virStoragePoolObjUnlock(pool);
+        pool = NULL;
     }
 
-    if (!ret) {
+    if (!vol) {
         if (STREQ(path, cleanpath)) {
             virReportError(VIR_ERR_NO_STORAGE_VOL,
                            _("no storage vol with matching path '%s'"), path);
@@ -1672,9 +2382,18 @@ storageVolLookupByPath(virConnectPtr conn,
                            _("no storage vol with matching path '%s' (%s)"),
                            path, cleanpath);
         }
+        goto cleanup;
     }
 
+    if (virStorageVolLookupByPathEnsureACL(conn, pool->def, vol) < 0)
+        goto cleanup;
+
+    ret = virGetStorageVol(conn, pool->def->name, vol->name, vol->key,
+                           NULL, NULL);
+
  cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
     VIR_FREE(cleanpath);
     storageDriverUnlock();
     return ret;
@@ -1727,18 +2446,10 @@ static void
 storageVolRemoveFromPool(virStoragePoolObjPtr pool,
                          virStorageVolDefPtr vol)
 {
-    size_t i;
-
-    for (i = 0; i < pool->volumes.count; i++) {
-        if (pool->volumes.objs[i] == vol) {
-            VIR_INFO("Deleting volume '%s' from storage pool '%s'",
-                     vol->name, pool->def->name);
-            virStorageVolDefFree(vol);
-
-            VIR_DELETE_ELEMENT(pool->volumes.objs, i, pool->volumes.count);
-            break;
-        }
-    }
+    VIR_INFO("Deleting volume '%s' from storage pool '%s'",
+             vol->name, pool->def->name);
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
 }
 
 
@@ -1922,21 +2633,19 @@ storageVolCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0)
-        goto cleanup;
-
     /* Wipe any key the user may have suggested, as volume creation
      * will generate the canonical key.  */
     VIR_FREE(voldef->key);
     if (backend->createVol(obj->conn, pool, voldef) < 0)
         goto cleanup;
 
-    pool->volumes.objs[pool->volumes.count++] = voldef;
+    if (virStoragePoolObjAddVol(pool, voldef) < 0)
+        goto cleanup;
+
     volobj = virGetStorageVol(obj->conn, pool->def->name, voldef->name,
                               voldef->key, NULL, NULL);
     if (!volobj) {
-        pool->volumes.count--;
+        virStoragePoolObjRemoveVol(pool, voldef);
         goto cleanup;
     }
 
@@ -2121,10 +2830,6 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
         backend->refreshVol(obj->conn, pool, origvol) < 0)
         goto cleanup;
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0)
-        goto cleanup;
-
     /* 'Define' the new volume so we get async progress reporting.
      * Wipe any key the user may have suggested, as volume creation
      * will generate the canonical key.  */
@@ -2141,11 +2846,13 @@ storageVolCreateXMLFrom(virStoragePoolPtr obj,
 
     memcpy(shadowvol, newvol, sizeof(*newvol));
 
-    pool->volumes.objs[pool->volumes.count++] = newvol;
+    if (virStoragePoolObjAddVol(pool, newvol) < 0)
+        goto cleanup;
+
     volobj = virGetStorageVol(obj->conn, pool->def->name, newvol->name,
                               newvol->key, NULL, NULL);
     if (!volobj) {
-        pool->volumes.count--;
+        virStoragePoolObjRemoveVol(pool, newvol);
         goto cleanup;
     }
 
@@ -2224,7 +2931,7 @@ storageVolDownload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
 
     if (!(vol = virStorageVolDefFromVol(obj, &pool, &backend)))
         return -1;
@@ -2341,6 +3048,7 @@ virStorageVolPoolRefreshThread(void *opaque)
     virStoragePoolObjClearVols(pool);
     if (backend->refreshPool(NULL, pool) < 0)
         VIR_DEBUG("Failed to refresh storage pool");
+    storageVolIndexPool(pool);
 
     event = virStoragePoolEventRefreshNew(pool->def->name,
                                           pool->def->uuid);
@@ -2392,7 +3100,7 @@ storageVolUpload(virStorageVolPtr obj,
     virStorageVolStreamInfoPtr cbdata = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
 
     if (!(vol = virStorageVolDefFromVol(obj, &pool, &backend)))
         return -1;
@@ -2560,6 +3268,7 @@ storageVolWipePattern(virStorageVolPtr obj,
     virStorageBackendPtr backend;
     virStoragePoolObjPtr pool = NULL;
     virStorageVolDefPtr vol = NULL;
+    int wiperet;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -2598,7 +3307,24 @@ storageVolWipePattern(virStorageVolPtr obj,
         goto cleanup;
     }
 
-    if (backend->wipeVol(obj->conn, pool, vol, algorithm, flags) < 0)
+    /* Drop the pool lock while wiping, the volume reports the
+     * progress in its XML meanwhile */
+    pool->asyncjobs++;
+    vol->in_use++;
+    virStoragePoolObjUnlock(pool);
+
+    wiperet = backend->wipeVol(obj->conn, pool, vol, algorithm, flags);
+
+    storageDriverLock();
+    virStoragePoolObjLock(pool);
+    storageDriverUnlock();
+
+    vol->in_use--;
+    vol->wipeDone = 0;
+    vol->wipeTotal = 0;
+    pool->asyncjobs--;
+
+    if (wiperet < 0)
         goto cleanup;
 
     if (backend->refreshVol &&
@@ -3669,3 +4395,24 @@ virStoragePoolObjBuildTempFilePath(virStoragePoolObjPtr pool,
                              driver->stateDir, pool->def->name, vol->name));
     return tmp;
 }
+
+
+/*
+ * virStoragePoolObjBuildVolCachePath
+ * @pool: pool object pointer
+ *
+ * Generate the path of the file caching the probed volumes of @pool,
+ * kept in the driver cacheDir so that it survives a reboot.
+ *
+ * Returns a string pointer on success, NULL on failure or if the
+ * storage driver is not running or caching volumes, in which case no
+ * error is reported
+ */
+char *
+virStoragePoolObjBuildVolCachePath(virStoragePoolObjPtr pool)
+{
+    if (!driver || !driver->cacheDir)
+        return NULL;
+
+    return virFileBuildPath(driver->cacheDir, pool->def->name, ".volcache");
+}
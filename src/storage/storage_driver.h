@@ -69,6 +69,9 @@ char *virStoragePoolObjBuildTempFilePath(virStoragePoolObjPtr pool,
                                          virStorageVolDefPtr vol)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
+char *virStoragePoolObjBuildVolCachePath(virStoragePoolObjPtr pool)
+    ATTRIBUTE_NONNULL(1);
+
 int storageRegister(void);
 int storageRegisterAll(void);
 
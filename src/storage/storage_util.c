@@ -67,6 +67,9 @@
 #include "stat-time.h"
 #include "virstring.h"
 #include "virxml.h"
+#include "virthread.h"
+#include "virthreadpool.h"
+#include "virhash.h"
 #include "fdstream.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
@@ -76,132 +79,483 @@ VIR_LOG_INIT("storage.storage_util");
 #define READ_BLOCK_SIZE_DEFAULT  (1024 * 1024)
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
 
+/* Volumes are zeroed in requests of this size, progress is reported
+ * after each of them */
+#define WIPE_CHUNK_SIZE (1024 * 1024 * 1024ULL)
+/* When zeroes have to be written, use this many threads, each with
+ * its own buffer of the given size and alignment */
+#define WIPE_WRITE_THREADS 4
+#define WIPE_WRITE_BUFFER_SIZE (4 * 1024 * 1024)
+#define WIPE_WRITE_ALIGN 4096
+
+/* Volumes are copied by this many threads, each of them copying
+ * chunks of the given size */
+#define COPY_THREADS 4
+#define COPY_CHUNK_SIZE (64 * 1024 * 1024)
+
+/* Volumes of local pools missing from the volume cache are probed by
+ * up to this many threads */
+#define REFRESH_PROBE_THREADS 8
+
+static int
+storageBackendWriteAt(int fd,
+                      const char *buf,
+                      size_t len,
+                      unsigned long long offset)
+{
+    size_t written = 0;
+
+    while (written < len) {
+        ssize_t rc = pwrite(fd, buf + written, len - written, offset + written);
+
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return rc < 0 ? errno : EIO;
+
+        written += rc;
+    }
+
+    return 0;
+}
+
+
 /*
- * Perform the O(1) btrfs clone operation, if possible.
+ * Clone the whole of @src_fd into @dest_fd, sharing its extents.
  * Upon success, return 0.  Otherwise, return -1 and set errno.
  */
-#if HAVE_LINUX_BTRFS_H
-static inline int
-btrfsCloneFile(int dest_fd, int src_fd)
+static int
+storageBackendCloneFile(int dest_fd, int src_fd)
 {
+#if defined(__linux__) && defined(FICLONE)
+    return ioctl(dest_fd, FICLONE, src_fd);
+#elif HAVE_LINUX_BTRFS_H
     return ioctl(dest_fd, BTRFS_IOC_CLONE, src_fd);
-}
 #else
-static inline int
-btrfsCloneFile(int dest_fd ATTRIBUTE_UNUSED,
-               int src_fd ATTRIBUTE_UNUSED)
-{
     errno = ENOTSUP;
     return -1;
+#endif
+}
+
+
+/* Errors which mean an offload mechanism can't be used with the given
+ * pair of files, rather than that the copy has failed */
+static bool
+storageBackendCopyOffloadUnsupported(int err)
+{
+    return err == EXDEV || err == EINVAL || err == ENOSYS ||
+        err == EOPNOTSUPP || err == ENOTSUP || err == ENOTTY ||
+        err == EBADF || err == ETXTBSY;
 }
+
+
+typedef struct _storageBackendCopier storageBackendCopier;
+typedef storageBackendCopier *storageBackendCopierPtr;
+struct _storageBackendCopier {
+    virMutex lock;
+
+    int inputfd;
+    int fd;
+    unsigned long long end;     /* the threads copy data up to here */
+    unsigned long long next;    /* offset to be handed out next */
+    unsigned long long dataEnd; /* end of the data extent @next is in */
+    bool seekData;              /* skip holes found by SEEK_DATA/SEEK_HOLE */
+    bool copyRange;             /* copy_file_range is worth trying */
+    bool sparse;                /* zero blocks need not be written */
+    const char *zerobuf;
+    size_t wbytes;              /* granularity of zero block detection */
+    int err;                    /* errno of the first failure */
+    bool errWrite;              /* whether it happened while writing */
+};
+
+
+/*
+ * Hand out the next chunk to be copied. Holes in the input are skipped
+ * if the output doesn't need them to be written.
+ *
+ * Returns true if there's a chunk at @offset of @len bytes to copy.
+ * Must be called with @copier locked.
+ */
+static bool
+storageBackendCopierNext(storageBackendCopierPtr copier,
+                         unsigned long long *offset,
+                         size_t *len)
+{
+    if (copier->err)
+        return false;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    if (copier->seekData &&
+        copier->next < copier->end &&
+        copier->next >= copier->dataEnd) {
+        off_t data;
+        off_t hole;
+
+        if ((data = lseek(copier->inputfd, copier->next, SEEK_DATA)) < 0) {
+            if (errno == ENXIO) {
+                /* Only the trailing hole is left */
+                copier->next = copier->end;
+                return false;
+            }
+            VIR_DEBUG("Unable to find data extents: %s",
+                      virStrerror(errno, NULL, 0));
+            copier->seekData = false;
+            copier->dataEnd = copier->end;
+        } else {
+            if ((hole = lseek(copier->inputfd, data, SEEK_HOLE)) <= data)
+                hole = copier->end;
+            copier->next = data;
+            copier->dataEnd = MIN((unsigned long long) hole, copier->end);
+        }
+    }
 #endif
 
-static int ATTRIBUTE_NONNULL(2)
-virStorageBackendCopyToFD(virStorageVolDefPtr vol,
-                          virStorageVolDefPtr inputvol,
-                          int fd,
-                          unsigned long long *total,
-                          bool want_sparse,
-                          bool reflink_copy)
+    if (copier->next >= copier->end)
+        return false;
+
+    *offset = copier->next;
+    *len = MIN(COPY_CHUNK_SIZE, copier->dataEnd - copier->next);
+    copier->next += *len;
+    return true;
+}
+
+
+static void
+storageBackendCopierFail(storageBackendCopierPtr copier,
+                         int err,
+                         bool write)
 {
-    int inputfd = -1;
-    int amtread = -1;
-    int ret = 0;
-    size_t rbytes = READ_BLOCK_SIZE_DEFAULT;
-    int wbytes = 0;
-    int interval;
-    char *zerobuf = NULL;
+    virMutexLock(&copier->lock);
+    if (!copier->err) {
+        copier->err = err;
+        copier->errWrite = write;
+    }
+    virMutexUnlock(&copier->lock);
+}
+
+
+/*
+ * Copy a chunk within the kernel. Returns the number of bytes copied,
+ * which is less than @len if copy_file_range turned out not to work
+ * for these files, or -1 on error.
+ */
+static ssize_t
+storageBackendCopyRange(storageBackendCopierPtr copier,
+                        unsigned long long offset,
+                        size_t len)
+{
+#if HAVE_COPY_FILE_RANGE
+    size_t copied = 0;
+
+    while (copied < len) {
+        loff_t inoff = offset + copied;
+        loff_t outoff = offset + copied;
+        ssize_t rc = copy_file_range(copier->inputfd, &inoff,
+                                     copier->fd, &outoff,
+                                     len - copied, 0);
+
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc == 0)
+            return len; /* the input got shorter */
+        if (rc < 0) {
+            if (copied == 0 && storageBackendCopyOffloadUnsupported(errno)) {
+                VIR_DEBUG("copy_file_range not usable: %s",
+                          virStrerror(errno, NULL, 0));
+                virMutexLock(&copier->lock);
+                copier->copyRange = false;
+                virMutexUnlock(&copier->lock);
+                return 0;
+            }
+            storageBackendCopierFail(copier, errno, true);
+            return -1;
+        }
+
+        copied += rc;
+    }
+
+    return copied;
+#else
+    virMutexLock(&copier->lock);
+    copier->copyRange = false;
+    virMutexUnlock(&copier->lock);
+    return 0;
+#endif
+}
+
+
+/*
+ * Copy a chunk through @buf, skipping blocks of zeroes if allowed.
+ */
+static int
+storageBackendCopyBuffered(storageBackendCopierPtr copier,
+                           char *buf,
+                           unsigned long long offset,
+                           size_t len)
+{
+    while (len > 0) {
+        size_t rbytes = MIN(READ_BLOCK_SIZE_DEFAULT, len);
+        size_t pos;
+        ssize_t amtread;
+
+        if ((amtread = pread(copier->inputfd, buf, rbytes, offset)) < 0) {
+            if (errno == EINTR)
+                continue;
+            storageBackendCopierFail(copier, errno, false);
+            return -1;
+        }
+        if (amtread == 0)
+            return 0; /* the input got shorter */
+
+        for (pos = 0; pos < (size_t) amtread; pos += copier->wbytes) {
+            size_t interval = MIN(copier->wbytes, amtread - pos);
+            int err;
+
+            if (copier->sparse &&
+                memcmp(buf + pos, copier->zerobuf, interval) == 0)
+                continue;
+
+            if ((err = storageBackendWriteAt(copier->fd, buf + pos,
+                                             interval, offset + pos))) {
+                storageBackendCopierFail(copier, err, true);
+                return -1;
+            }
+        }
+
+        offset += amtread;
+        len -= amtread;
+    }
+
+    return 0;
+}
+
+
+static void
+storageBackendCopierThread(void *opaque)
+{
+    storageBackendCopierPtr copier = opaque;
     char *buf = NULL;
+
+    if (VIR_ALLOC_N_QUIET(buf, READ_BLOCK_SIZE_DEFAULT) < 0) {
+        storageBackendCopierFail(copier, ENOMEM, false);
+        return;
+    }
+
+    for (;;) {
+        unsigned long long offset;
+        size_t len;
+        ssize_t copied = 0;
+        bool copyRange;
+
+        virMutexLock(&copier->lock);
+        if (!storageBackendCopierNext(copier, &offset, &len)) {
+            virMutexUnlock(&copier->lock);
+            break;
+        }
+        copyRange = copier->copyRange;
+        virMutexUnlock(&copier->lock);
+
+        if (copyRange &&
+            (copied = storageBackendCopyRange(copier, offset, len)) < 0)
+            break;
+
+        if ((size_t) copied < len &&
+            storageBackendCopyBuffered(copier, buf, offset + copied,
+                                       len - copied) < 0)
+            break;
+    }
+
+    VIR_FREE(buf);
+}
+
+
+/**
+ * virStorageBackendCopyFD:
+ * @inputfd: file descriptor to copy from
+ * @inputpath: path of @inputfd, for error messages
+ * @fd: file descriptor to copy to
+ * @path: path of @fd, for error messages
+ * @total: maximum number of bytes to copy, decreased by the amount copied
+ * @flags: bitwise-OR of virStorageBackendCopyFlags
+ *
+ * Copy the start of @inputfd to the start of @fd. With
+ * VIR_STORAGE_BACKEND_COPY_REFLINK the copy is made by cloning the
+ * input, failing if that's not possible. Otherwise, with
+ * VIR_STORAGE_BACKEND_COPY_SHARE cloning the input and then letting
+ * copy_file_range copy it within the kernel is tried first. Whatever
+ * is left is copied through userspace buffers by a few threads in
+ * parallel. With VIR_STORAGE_BACKEND_COPY_SPARSE holes in the input and
+ * blocks of zeroes are not written to @fd.
+ *
+ * Returns 0 on success, -errno on error.
+ */
+int
+virStorageBackendCopyFD(int inputfd,
+                        const char *inputpath,
+                        int fd,
+                        const char *path,
+                        unsigned long long *total,
+                        unsigned int flags)
+{
+    storageBackendCopier copier;
+    virThread threads[COPY_THREADS];
+    size_t nthreads = 0;
+    struct stat inst;
     struct stat st;
+    unsigned long long len = *total;
+    char *zerobuf = NULL;
+    int wbytes = 0;
+    int ret = -1;
+    size_t i;
 
-    if ((inputfd = open(inputvol->target.path, O_RDONLY)) < 0) {
+    virCheckFlags(VIR_STORAGE_BACKEND_COPY_SPARSE |
+                  VIR_STORAGE_BACKEND_COPY_SHARE |
+                  VIR_STORAGE_BACKEND_COPY_REFLINK, -EINVAL);
+
+    if (fstat(inputfd, &inst) < 0 || fstat(fd, &st) < 0) {
         ret = -errno;
-        virReportSystemError(errno,
-                             _("could not open input path '%s'"),
-                             inputvol->target.path);
-        goto cleanup;
+        virReportSystemError(errno, _("cannot stat file '%s'"), inputpath);
+        return ret;
+    }
+
+    if (flags & VIR_STORAGE_BACKEND_COPY_REFLINK) {
+        if (storageBackendCloneFile(fd, inputfd) < 0) {
+            ret = -errno;
+            virReportSystemError(errno,
+                                 _("failed to clone files from '%s'"),
+                                 inputpath);
+            return ret;
+        }
+        VIR_DEBUG("clone of '%s' finished", inputpath);
+        return 0;
+    }
+
+    /* Don't read beyond the end of the input */
+    if (S_ISREG(inst.st_mode)) {
+        len = MIN(len, (unsigned long long) inst.st_size);
+    } else {
+        off_t end = lseek(inputfd, 0, SEEK_END);
+
+        if (end >= 0)
+            len = MIN(len, (unsigned long long) end);
+    }
+
+    if ((flags & VIR_STORAGE_BACKEND_COPY_SHARE) &&
+        S_ISREG(inst.st_mode) && S_ISREG(st.st_mode) &&
+        len == (unsigned long long) inst.st_size) {
+        if (storageBackendCloneFile(fd, inputfd) == 0) {
+            VIR_DEBUG("cloned '%s' to '%s'", inputpath, path);
+            *total -= len;
+            return 0;
+        }
+        VIR_DEBUG("Unable to clone '%s' to '%s': %s",
+                  inputpath, path, virStrerror(errno, NULL, 0));
     }
 
 #ifdef __linux__
     if (ioctl(fd, BLKBSZGET, &wbytes) < 0)
         wbytes = 0;
 #endif
-    if ((wbytes == 0) && fstat(fd, &st) == 0)
+    if (wbytes == 0)
         wbytes = st.st_blksize;
     if (wbytes < WRITE_BLOCK_SIZE_DEFAULT)
         wbytes = WRITE_BLOCK_SIZE_DEFAULT;
 
-    if (VIR_ALLOC_N(zerobuf, wbytes) < 0) {
-        ret = -errno;
-        goto cleanup;
-    }
+    if (VIR_ALLOC_N(zerobuf, wbytes) < 0)
+        return -ENOMEM;
 
-    if (VIR_ALLOC_N(buf, rbytes) < 0) {
+    memset(&copier, 0, sizeof(copier));
+    if (virMutexInit(&copier.lock) < 0) {
         ret = -errno;
-        goto cleanup;
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        VIR_FREE(zerobuf);
+        return ret;
     }
 
-    if (reflink_copy) {
-        if (btrfsCloneFile(fd, inputfd) < 0) {
+    copier.inputfd = inputfd;
+    copier.fd = fd;
+    copier.end = len;
+    copier.sparse = !!(flags & VIR_STORAGE_BACKEND_COPY_SPARSE);
+    copier.seekData = copier.sparse && S_ISREG(inst.st_mode);
+    /* Without looking for holes, everything is data */
+    copier.dataEnd = copier.seekData ? 0 : len;
+    copier.copyRange = (flags & VIR_STORAGE_BACKEND_COPY_SHARE) &&
+        S_ISREG(inst.st_mode) && S_ISREG(st.st_mode);
+    copier.zerobuf = zerobuf;
+    copier.wbytes = wbytes;
+
+    for (i = 0; i < COPY_THREADS; i++) {
+        if (i * COPY_CHUNK_SIZE >= len)
+            break;
+
+        if (virThreadCreate(&threads[nthreads], true,
+                            storageBackendCopierThread, &copier) < 0) {
+            if (nthreads > 0)
+                break;
             ret = -errno;
-            virReportSystemError(errno,
-                                 _("failed to clone files from '%s'"),
-                                 inputvol->target.path);
-            goto cleanup;
-        } else {
-            VIR_DEBUG("btrfs clone finished.");
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create copy thread"));
             goto cleanup;
         }
+        nthreads++;
     }
 
-    while (amtread != 0) {
-        int amtleft;
-
-        if (*total < rbytes)
-            rbytes = *total;
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
 
-        if ((amtread = saferead(inputfd, buf, rbytes)) < 0) {
-            ret = -errno;
-            virReportSystemError(errno,
+    if (copier.err) {
+        ret = -copier.err;
+        if (copier.errWrite)
+            virReportSystemError(copier.err,
+                                 _("failed writing to file '%s'"), path);
+        else
+            virReportSystemError(copier.err,
                                  _("failed reading from file '%s'"),
-                                 inputvol->target.path);
-            goto cleanup;
-        }
-        *total -= amtread;
+                                 inputpath);
+        goto cleanup;
+    }
 
-        /* Loop over amt read in 512 byte increments, looking for sparse
-         * blocks */
-        amtleft = amtread;
-        do {
-            interval = ((wbytes > amtleft) ? amtleft : wbytes);
-            int offset = amtread - amtleft;
+    if (fdatasync(fd) < 0) {
+        ret = -errno;
+        virReportSystemError(errno, _("cannot sync data to file '%s'"), path);
+        goto cleanup;
+    }
 
-            if (want_sparse && memcmp(buf+offset, zerobuf, interval) == 0) {
-                if (lseek(fd, interval, SEEK_CUR) < 0) {
-                    ret = -errno;
-                    virReportSystemError(errno,
-                                         _("cannot extend file '%s'"),
-                                         vol->target.path);
-                    goto cleanup;
-                }
-            } else if (safewrite(fd, buf+offset, interval) < 0) {
-                ret = -errno;
-                virReportSystemError(errno,
-                                     _("failed writing to file '%s'"),
-                                     vol->target.path);
-                goto cleanup;
+    VIR_DEBUG("copied %llu bytes from '%s' to '%s' with %zu threads%s",
+              len, inputpath, path, nthreads,
+              copier.copyRange ? " using copy_file_range" : "");
+    *total -= len;
+    ret = 0;
 
-            }
-        } while ((amtleft -= interval) > 0);
-    }
+ cleanup:
+    virMutexDestroy(&copier.lock);
+    VIR_FREE(zerobuf);
+    return ret;
+}
 
-    if (fdatasync(fd) < 0) {
+
+static int ATTRIBUTE_NONNULL(2)
+virStorageBackendCopyToFD(virStorageVolDefPtr vol,
+                          virStorageVolDefPtr inputvol,
+                          int fd,
+                          unsigned long long *total,
+                          unsigned int flags)
+{
+    int inputfd = -1;
+    int ret = 0;
+
+    if ((inputfd = open(inputvol->target.path, O_RDONLY)) < 0) {
         ret = -errno;
-        virReportSystemError(errno, _("cannot sync data to file '%s'"),
-                             vol->target.path);
+        virReportSystemError(errno,
+                             _("could not open input path '%s'"),
+                             inputvol->target.path);
         goto cleanup;
     }
 
+    if ((ret = virStorageBackendCopyFD(inputfd, inputvol->target.path,
+                                       fd, vol->target.path,
+                                       total, flags)) < 0)
+        goto cleanup;
 
     if (VIR_CLOSE(inputfd) < 0) {
         ret = -errno;
@@ -215,9 +569,6 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
  cleanup:
     VIR_FORCE_CLOSE(inputfd);
 
-    VIR_FREE(zerobuf);
-    VIR_FREE(buf);
-
     return ret;
 }
 
@@ -262,7 +613,8 @@ storageBackendCreateBlockFrom(virConnectPtr conn ATTRIBUTE_UNUSED,
 
     if (inputvol) {
         if (virStorageBackendCopyToFD(vol, inputvol, fd, &remain,
-                                      false, reflink_copy) < 0)
+                                      reflink_copy ?
+                                      VIR_STORAGE_BACKEND_COPY_REFLINK : 0) < 0)
             goto cleanup;
     }
 
@@ -315,12 +667,19 @@ createRawFile(int fd, virStorageVolDefPtr vol,
     bool need_alloc = true;
     int ret = 0;
     unsigned long long pos = 0;
+    unsigned int copy_flags = 0;
+
+    if (reflink_copy)
+        copy_flags |= VIR_STORAGE_BACKEND_COPY_REFLINK;
 
     /* If the new allocation is lower than the capacity of the original file,
-     * the cloned volume will be sparse */
+     * the cloned volume will be sparse, so it may as well share its
+     * extents with the original */
     if (inputvol &&
-        vol->target.allocation < inputvol->target.capacity)
+        vol->target.allocation < inputvol->target.capacity) {
         need_alloc = false;
+        copy_flags |= VIR_STORAGE_BACKEND_COPY_SHARE;
+    }
 
     /* Seek to the final size, so the capacity is available upfront
      * for progress reporting */
@@ -359,8 +718,11 @@ createRawFile(int fd, virStorageVolDefPtr vol,
         /* allow zero blocks to be skipped if we've requested sparse
          * allocation (allocation < capacity) or we have already
          * been able to allocate the required space. */
+        if (!need_alloc)
+            copy_flags |= VIR_STORAGE_BACKEND_COPY_SPARSE;
+
         if ((ret = virStorageBackendCopyToFD(vol, inputvol, fd, &remain,
-                                             !need_alloc, reflink_copy)) < 0)
+                                             copy_flags)) < 0)
             goto cleanup;
 
         /* If the new allocation is greater than the original capacity,
@@ -2396,8 +2758,9 @@ virStorageBackendVolUploadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     char *target_path = vol->target.path;
     int ret = -1;
     int has_snap = 0;
+    bool sparse = flags & VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
     /* if volume has target format VIR_STORAGE_FILE_PLOOP
      * we need to restore DiskDescriptor.xml, according to
      * new contents of volume. This operation will be perfomed
@@ -2422,7 +2785,7 @@ virStorageBackendVolUploadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     /* Not using O_CREAT because the file is required to already exist at
      * this point */
     ret = virFDStreamOpenBlockDevice(stream, target_path,
-                                     offset, len, O_WRONLY);
+                                     offset, len, O_WRONLY, sparse);
 
  cleanup:
     VIR_FREE(path);
@@ -2442,8 +2805,9 @@ virStorageBackendVolDownloadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     char *target_path = vol->target.path;
     int ret = -1;
     int has_snap = 0;
+    bool sparse = flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
     if (vol->target.format == VIR_STORAGE_FILE_PLOOP) {
         has_snap = storageBackendPloopHasSnapshots(vol->target.path);
         if (has_snap < 0) {
@@ -2460,7 +2824,7 @@ virStorageBackendVolDownloadLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     }
 
     ret = virFDStreamOpenBlockDevice(stream, target_path,
-                                     offset, len, O_RDONLY);
+                                     offset, len, O_RDONLY, sparse);
 
  cleanup:
     VIR_FREE(path);
@@ -2507,60 +2871,347 @@ storageBackendVolZeroSparseFileLocal(const char *path,
 }
 
 
-static int
-storageBackendWipeLocal(const char *path,
-                        int fd,
-                        unsigned long long wipe_len,
-                        size_t writebuf_length)
+typedef struct _storageBackendWipeProgress storageBackendWipeProgress;
+typedef storageBackendWipeProgress *storageBackendWipeProgressPtr;
+struct _storageBackendWipeProgress {
+    /* The pool is unlocked while wiping, it's only locked to update
+     * the progress in @vol */
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+};
+
+
+static void
+storageBackendWipeReportProgress(storageBackendWipeProgressPtr progress,
+                                 unsigned long long done,
+                                 unsigned long long total)
 {
-    int ret = -1, written = 0;
-    unsigned long long remaining = 0;
-    size_t write_size = 0;
-    char *writebuf = NULL;
+    if (!progress)
+        return;
 
-    VIR_DEBUG("wiping start: 0 len: %llu", wipe_len);
+    virStoragePoolObjLock(progress->pool);
+    progress->vol->wipeDone = done;
+    progress->vol->wipeTotal = total;
+    virStoragePoolObjUnlock(progress->pool);
+}
 
-    if (VIR_ALLOC_N(writebuf, writebuf_length) < 0)
-        goto cleanup;
 
-    if (lseek(fd, 0, SEEK_SET) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to seek to the start in volume "
-                               "with path '%s'"),
-                             path);
-        goto cleanup;
+/*
+ * Zero a block device using the kernel, which can pass the request
+ * on to the device instead of transferring zeroes to it. A discard
+ * is used if the device guarantees discarded blocks read as zeroes.
+ *
+ * Returns 1 if the device was zeroed, 0 if this is not supported and
+ * the zeroes have to be written, -1 on error.
+ */
+static int
+storageBackendWipeBlockOffload(const char *path,
+                               int fd,
+                               unsigned long long wipe_len,
+                               storageBackendWipeProgressPtr progress)
+{
+#if defined(__linux__) && defined(BLKZEROOUT)
+    unsigned long request = BLKZEROOUT;
+    const char *reqname = "BLKZEROOUT";
+    unsigned long long offset = 0;
+    uint64_t range[2];
+    int sectorSize = 512;
+# ifdef BLKDISCARDZEROES
+    unsigned int discardZeroes = 0;
+
+    if (ioctl(fd, BLKDISCARDZEROES, &discardZeroes) == 0 && discardZeroes) {
+        request = BLKDISCARD;
+        reqname = "BLKDISCARD";
     }
+# endif
 
-    remaining = wipe_len;
-    while (remaining > 0) {
+    if (ioctl(fd, BLKSSZGET, &sectorSize) < 0 || sectorSize <= 0)
+        sectorSize = 512;
 
-        write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
-        written = safewrite(fd, writebuf, write_size);
-        if (written < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to write %zu bytes to "
-                                   "storage volume with path '%s'"),
-                                 write_size, path);
+    if (wipe_len % sectorSize) {
+        VIR_DEBUG("Length %llu of '%s' is not a multiple of %d",
+                  wipe_len, path, sectorSize);
+        return 0;
+    }
 
-            goto cleanup;
-        }
+    while (offset < wipe_len) {
+        range[0] = offset;
+        range[1] = MIN(WIPE_CHUNK_SIZE, wipe_len - offset);
 
-        remaining -= written;
-    }
+        if (ioctl(fd, request, range) < 0) {
+            if (offset == 0 &&
+                (errno == ENOTTY || errno == EOPNOTSUPP || errno == EINVAL)) {
+                VIR_DEBUG("%s not supported by '%s'", reqname, path);
+                if (request == BLKZEROOUT)
+                    return 0;
 
-    if (fdatasync(fd) < 0) {
-        virReportSystemError(errno,
-                             _("cannot sync data to volume with path '%s'"),
-                             path);
-        goto cleanup;
-    }
+                request = BLKZEROOUT;
+                reqname = "BLKZEROOUT";
+                continue;
+            }
 
-    VIR_DEBUG("Wrote %llu bytes to volume with path '%s'", wipe_len, path);
+            virReportSystemError(errno,
+                                 _("Failed to zero %llu bytes at offset %llu "
+                                   "of storage volume with path '%s'"),
+                                 (unsigned long long) range[1],
+                                 (unsigned long long) range[0], path);
+            return -1;
+        }
 
-    ret = 0;
+        offset += range[1];
+        storageBackendWipeReportProgress(progress, offset, wipe_len);
+    }
 
- cleanup:
-    VIR_FREE(writebuf);
+    VIR_DEBUG("Zeroed %llu bytes of '%s' with %s", wipe_len, path, reqname);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+/*
+ * Zero a file by letting the file system turn its blocks into
+ * unwritten extents, or by punching holes and allocating them again.
+ *
+ * Returns 1 if the file was zeroed, 0 if this is not supported and
+ * the zeroes have to be written, -1 on error.
+ */
+static int
+storageBackendWipeFileOffload(const char *path,
+                              int fd,
+                              unsigned long long wipe_len,
+                              storageBackendWipeProgressPtr progress)
+{
+/* Avoid issues with older kernel's <linux/fs.h> namespace pollution. */
+#if HAVE_FALLOCATE - 0 && defined(FALLOC_FL_PUNCH_HOLE) && \
+    defined(FALLOC_FL_KEEP_SIZE)
+    unsigned long long offset = 0;
+    bool punch = false;
+
+# ifndef FALLOC_FL_ZERO_RANGE
+    punch = true;
+# endif
+
+    while (offset < wipe_len) {
+        off_t len = MIN(WIPE_CHUNK_SIZE, wipe_len - offset);
+        int rc;
+
+# ifdef FALLOC_FL_ZERO_RANGE
+        if (!punch)
+            rc = fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+                           offset, len);
+        else
+# endif
+            rc = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                           offset, len);
+
+        if (rc < 0) {
+            if (offset == 0 && (errno == ENOSYS || errno == EOPNOTSUPP)) {
+                if (punch) {
+                    VIR_DEBUG("Unable to punch holes in '%s'", path);
+                    return 0;
+                }
+                punch = true;
+                continue;
+            }
+
+            virReportSystemError(errno,
+                                 _("Failed to zero %llu bytes at offset %llu "
+                                   "of storage volume with path '%s'"),
+                                 (unsigned long long) len, offset, path);
+            return -1;
+        }
+
+        /* Keep the volume allocated as it was before */
+        if (punch)
+            ignore_value(fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, len));
+
+        offset += len;
+        storageBackendWipeReportProgress(progress, offset, wipe_len);
+    }
+
+    if (fdatasync(fd) < 0) {
+        virReportSystemError(errno,
+                             _("cannot sync data to volume with path '%s'"),
+                             path);
+        return -1;
+    }
+
+    VIR_DEBUG("Zeroed %llu bytes of '%s' using %s", wipe_len, path,
+              punch ? "FALLOC_FL_PUNCH_HOLE" : "FALLOC_FL_ZERO_RANGE");
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+typedef struct _storageBackendWipeWriter storageBackendWipeWriter;
+typedef storageBackendWipeWriter *storageBackendWipeWriterPtr;
+struct _storageBackendWipeWriter {
+    virMutex lock;
+
+    int fd;
+    unsigned long long end;     /* the threads write zeroes up to here */
+    unsigned long long next;    /* offset to be handed out next */
+    unsigned long long done;    /* bytes written so far */
+    unsigned long long reported;
+    unsigned long long total;   /* the whole length being wiped */
+    int err;                    /* errno of the first failed write */
+
+    storageBackendWipeProgressPtr progress;
+};
+
+
+static void
+storageBackendWipeWriterThread(void *opaque)
+{
+    storageBackendWipeWriterPtr writer = opaque;
+    void *buf = NULL;
+
+    if (posix_memalign(&buf, WIPE_WRITE_ALIGN, WIPE_WRITE_BUFFER_SIZE)) {
+        virMutexLock(&writer->lock);
+        if (!writer->err)
+            writer->err = ENOMEM;
+        virMutexUnlock(&writer->lock);
+        return;
+    }
+    memset(buf, 0, WIPE_WRITE_BUFFER_SIZE);
+
+    for (;;) {
+        unsigned long long offset;
+        size_t len;
+        int err;
+
+        virMutexLock(&writer->lock);
+        if (writer->err || writer->next >= writer->end) {
+            virMutexUnlock(&writer->lock);
+            break;
+        }
+        offset = writer->next;
+        len = MIN(WIPE_WRITE_BUFFER_SIZE, writer->end - offset);
+        writer->next += len;
+        virMutexUnlock(&writer->lock);
+
+        err = storageBackendWriteAt(writer->fd, buf, len, offset);
+
+        virMutexLock(&writer->lock);
+        if (err) {
+            if (!writer->err)
+                writer->err = err;
+        } else {
+            writer->done += len;
+            if (writer->done - writer->reported >= WIPE_CHUNK_SIZE) {
+                writer->reported = writer->done;
+                storageBackendWipeReportProgress(writer->progress,
+                                                 writer->done, writer->total);
+            }
+        }
+        virMutexUnlock(&writer->lock);
+    }
+
+    VIR_FREE(buf);
+}
+
+
+/*
+ * Write zeroes over the first @wipe_len bytes of @path. The bulk is
+ * written by a few threads in parallel, bypassing the host page
+ * cache if possible.
+ */
+static int
+storageBackendWipeLocal(const char *path,
+                        int fd,
+                        unsigned long long wipe_len,
+                        storageBackendWipeProgressPtr progress)
+{
+    storageBackendWipeWriter writer;
+    virThread threads[WIPE_WRITE_THREADS];
+    size_t nthreads = 0;
+    int directFd = -1;
+    int ret = -1;
+    size_t i;
+
+    VIR_DEBUG("wiping start: 0 len: %llu", wipe_len);
+
+    memset(&writer, 0, sizeof(writer));
+    if (virMutexInit(&writer.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
+
+    writer.fd = fd;
+    writer.end = wipe_len;
+    writer.total = wipe_len;
+    writer.progress = progress;
+
+    if (virFileDirectFdFlag() > 0) {
+        if ((directFd = open(path, O_WRONLY | virFileDirectFdFlag())) >= 0) {
+            writer.fd = directFd;
+            writer.end = wipe_len - wipe_len % WIPE_WRITE_ALIGN;
+        } else {
+            VIR_DEBUG("Writing zeroes to '%s' through the page cache: %s",
+                      path, virStrerror(errno, NULL, 0));
+        }
+    }
+
+    for (i = 0; i < WIPE_WRITE_THREADS; i++) {
+        if (i * WIPE_WRITE_BUFFER_SIZE >= writer.end)
+            break;
+
+        if (virThreadCreate(&threads[nthreads], true,
+                            storageBackendWipeWriterThread, &writer) < 0) {
+            if (nthreads > 0)
+                break;
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create wipe thread"));
+            goto cleanup;
+        }
+        nthreads++;
+    }
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+
+    if (writer.err) {
+        virReportSystemError(writer.err,
+                             _("Failed to write zeroes to storage volume "
+                               "with path '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    /* The unaligned tail can't be written with O_DIRECT */
+    if (writer.end < wipe_len) {
+        char tail[WIPE_WRITE_ALIGN] = { 0 };
+        int err;
+
+        if ((err = storageBackendWriteAt(fd, tail, wipe_len - writer.end,
+                                         writer.end))) {
+            virReportSystemError(err,
+                                 _("Failed to write zeroes to storage volume "
+                                   "with path '%s'"),
+                                 path);
+            goto cleanup;
+        }
+    }
+
+    if (fdatasync(fd) < 0) {
+        virReportSystemError(errno,
+                             _("cannot sync data to volume with path '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    storageBackendWipeReportProgress(progress, wipe_len, wipe_len);
+    VIR_DEBUG("Wrote %llu bytes to volume with path '%s'", wipe_len, path);
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(directFd);
+    virMutexDestroy(&writer.lock);
     return ret;
 }
 
@@ -2568,7 +3219,8 @@ storageBackendWipeLocal(const char *path,
 static int
 storageBackendVolWipeLocalFile(const char *path,
                                unsigned int algorithm,
-                               unsigned long long allocation)
+                               unsigned long long allocation,
+                               storageBackendWipeProgressPtr progress)
 {
     int ret = -1, fd = -1;
     const char *alg_char = NULL;
@@ -2643,7 +3295,23 @@ storageBackendVolWipeLocalFile(const char *path,
         if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
             ret = storageBackendVolZeroSparseFileLocal(path, st.st_size, fd);
         } else {
-            ret = storageBackendWipeLocal(path, fd, allocation, st.st_blksize);
+            /* Zeroing past the end of a file would just extend it */
+            if (S_ISREG(st.st_mode))
+                allocation = MIN(allocation, st.st_size);
+
+            if (S_ISBLK(st.st_mode))
+                ret = storageBackendWipeBlockOffload(path, fd, allocation,
+                                                     progress);
+            else if (S_ISREG(st.st_mode))
+                ret = storageBackendWipeFileOffload(path, fd, allocation,
+                                                    progress);
+            else
+                ret = 0;
+
+            if (ret == 0)
+                ret = storageBackendWipeLocal(path, fd, allocation, progress);
+            else if (ret > 0)
+                ret = 0;
         }
         if (ret < 0)
             goto cleanup;
@@ -2658,7 +3326,8 @@ storageBackendVolWipeLocalFile(const char *path,
 
 static int
 storageBackendVolWipePloop(virStorageVolDefPtr vol,
-                           unsigned int algorithm)
+                           unsigned int algorithm,
+                           storageBackendWipeProgressPtr progress)
 {
     virCommandPtr cmd = NULL;
     char *target_path = NULL;
@@ -2681,7 +3350,7 @@ storageBackendVolWipePloop(virStorageVolDefPtr vol,
         goto cleanup;
 
     if (storageBackendVolWipeLocalFile(target_path, algorithm,
-                                       vol->target.allocation) < 0)
+                                       vol->target.allocation, progress) < 0)
         goto cleanup;
 
     if (virFileRemove(disk_desc, 0, 0) < 0) {
@@ -2712,13 +3381,18 @@ storageBackendVolWipePloop(virStorageVolDefPtr vol,
 }
 
 
+/*
+ * The pool must not be locked by the caller, it is locked briefly to
+ * report the progress of the wipe in @vol.
+ */
 int
 virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
-                              virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
+                              virStoragePoolObjPtr pool,
                               virStorageVolDefPtr vol,
                               unsigned int algorithm,
                               unsigned int flags)
 {
+    storageBackendWipeProgress progress = { pool, vol };
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -2727,10 +3401,11 @@ virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
               vol->target.path, algorithm);
 
     if (vol->target.format == VIR_STORAGE_FILE_PLOOP) {
-        ret = storageBackendVolWipePloop(vol, algorithm);
+        ret = storageBackendVolWipePloop(vol, algorithm, &progress);
     } else {
         ret = storageBackendVolWipeLocalFile(vol->target.path, algorithm,
-                                             vol->target.allocation);
+                                             vol->target.allocation,
+                                             &progress);
     }
 
     return ret;
@@ -3351,6 +4026,7 @@ storageBackendProbeTarget(virStorageSourcePtr target,
     int fd = -1;
     int ret = -1;
     int rc;
+    bool backingFaked = false;
     virStorageSourcePtr meta = NULL;
     struct stat sb;
 
@@ -3413,6 +4089,7 @@ storageBackendProbeTarget(virStorageSourcePtr target,
                  * disable the whole storage pool, making it unavailable for
                  * even maintenance. */
                 target->backingStore->format = VIR_STORAGE_FILE_RAW;
+                backingFaked = true;
                 virReportError(VIR_ERR_INTERNAL_ERROR,
                                _("cannot probe backing volume format: %s"),
                                target->backingStore->path);
@@ -3424,8 +4101,9 @@ storageBackendProbeTarget(virStorageSourcePtr target,
 
     target->format = meta->format;
 
-    /* Default to success below this point */
-    ret = 0;
+    /* Default to success below this point, -3 tells the caller the
+     * backing store format is made up */
+    ret = backingFaked ? -3 : 0;
 
     if (meta->capacity)
         target->capacity = meta->capacity;
@@ -3458,28 +4136,630 @@ storageBackendProbeTarget(virStorageSourcePtr target,
 }
 
 
+/*
+ * Cache of probed volumes of local pools. Probing a volume opens it and
+ * reads its header, which adds up for pools with many volumes, especially
+ * on network file systems. The cache file keeps the definitions of the
+ * volumes found by the previous refresh, each keyed by the inode, size,
+ * modification and change time of the file it was probed from. A
+ * definition is reused as long as all of them match, which also covers
+ * changes of ownership, permissions and security labels.
+ *
+ *   <volcache>
+ *     <entry ino='...' size='...' mtime='...' ctime='...'>
+ *       <volume type='file'>...</volume>
+ *     </entry>
+ *   </volcache>
+ */
+typedef struct _virStorageBackendVolCache virStorageBackendVolCache;
+typedef virStorageBackendVolCache *virStorageBackendVolCachePtr;
+struct _virStorageBackendVolCache {
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt;
+    virHashTablePtr entries;    /* volume name -> <entry> node in @doc */
+    virBuffer buf;              /* entries of the cache being written */
+};
+
+
+static void
+virStorageBackendVolCacheFree(virStorageBackendVolCachePtr cache)
+{
+    if (!cache)
+        return;
+
+    virHashFree(cache->entries);
+    xmlXPathFreeContext(cache->ctxt);
+    xmlFreeDoc(cache->doc);
+    virBufferFreeAndReset(&cache->buf);
+    VIR_FREE(cache);
+}
+
+
+/* Returns the first child element of @node called @name */
+static xmlNodePtr
+virStorageBackendVolCacheChild(xmlNodePtr node,
+                               const char *name)
+{
+    for (node = node->children; node; node = node->next) {
+        if (node->type == XML_ELEMENT_NODE &&
+            xmlStrEqual(node->name, BAD_CAST name))
+            return node;
+    }
+
+    return NULL;
+}
+
+
+static int
+virStorageBackendVolCacheParse(virStorageBackendVolCachePtr cache,
+                               const char *path)
+{
+    xmlNodePtr root;
+    xmlNodePtr node;
+
+    if (!(cache->doc = virXMLParseFileCtxt(path, &cache->ctxt)))
+        return -1;
+
+    root = cache->ctxt->node;
+    if (!xmlStrEqual(root->name, BAD_CAST "volcache")) {
+        virReportError(VIR_ERR_XML_ERROR,
+                       _("unexpected root element <%s> in '%s'"),
+                       root->name, path);
+        return -1;
+    }
+
+    /* Walked directly rather than with XPath, the cache may hold many
+     * thousands of volumes */
+    for (node = root->children; node; node = node->next) {
+        xmlNodePtr child;
+        char *name;
+        int rc;
+
+        if (node->type != XML_ELEMENT_NODE ||
+            !xmlStrEqual(node->name, BAD_CAST "entry") ||
+            !(child = virStorageBackendVolCacheChild(node, "volume")) ||
+            !(child = virStorageBackendVolCacheChild(child, "name")) ||
+            !(name = (char *) xmlNodeGetContent(child)))
+            continue;
+
+        rc = virHashAddEntry(cache->entries, name, node);
+        xmlFree(name);
+        if (rc < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * virStorageBackendVolCacheLoad:
+ * @path: cache file, or NULL
+ *
+ * Loads the cache written by a previous refresh. A missing or broken
+ * cache file is not an error, every volume is probed then.
+ *
+ * Returns the cache, NULL on OOM.
+ */
+static virStorageBackendVolCachePtr
+virStorageBackendVolCacheLoad(const char *path)
+{
+    virStorageBackendVolCachePtr cache;
+
+    if (VIR_ALLOC(cache) < 0)
+        return NULL;
+
+    if (!(cache->entries = virHashCreate(64, NULL))) {
+        VIR_FREE(cache);
+        return NULL;
+    }
+
+    if (path && virFileExists(path) &&
+        virStorageBackendVolCacheParse(cache, path) < 0) {
+        VIR_WARN("Ignoring volume cache '%s': %s",
+                 path, virGetLastErrorMessage());
+        virResetLastError();
+        virHashRemoveAll(cache->entries);
+    }
+
+    return cache;
+}
+
+
+#define VIR_STORAGE_BACKEND_VOL_CACHE_KEYS 4
+
+static const char *virStorageBackendVolCacheKeyAttrs[] = {
+    "ino", "size", "mtime", "ctime",
+};
+verify(ARRAY_CARDINALITY(virStorageBackendVolCacheKeyAttrs) ==
+       VIR_STORAGE_BACKEND_VOL_CACHE_KEYS);
+
+
+static void
+virStorageBackendVolCacheKeyFree(char **key)
+{
+    size_t i;
+
+    for (i = 0; i < VIR_STORAGE_BACKEND_VOL_CACHE_KEYS; i++)
+        VIR_FREE(key[i]);
+}
+
+
+/* Fills @key with the values of the cache key attributes for @sb */
+static int
+virStorageBackendVolCacheKey(const struct stat *sb,
+                             char **key)
+{
+    struct timespec mtime = get_stat_mtime(sb);
+    struct timespec ctime = get_stat_ctime(sb);
+
+    if (virAsprintf(&key[0], "%llu", (unsigned long long)sb->st_ino) < 0 ||
+        virAsprintf(&key[1], "%llu", (unsigned long long)sb->st_size) < 0 ||
+        virAsprintf(&key[2], "%lld.%09ld",
+                    (long long)mtime.tv_sec, mtime.tv_nsec) < 0 ||
+        virAsprintf(&key[3], "%lld.%09ld",
+                    (long long)ctime.tv_sec, ctime.tv_nsec) < 0) {
+        virStorageBackendVolCacheKeyFree(key);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * virStorageBackendVolCacheLookup:
+ * @cache: the cache
+ * @def: pool the volume belongs to
+ * @name: name of the volume
+ * @path: path of the volume
+ * @sb: current details of @path
+ *
+ * Returns the volume probed by the previous refresh if @path has not
+ * changed since, NULL otherwise.
+ */
+static virStorageVolDefPtr
+virStorageBackendVolCacheLookup(virStorageBackendVolCachePtr cache,
+                                virStoragePoolDefPtr def,
+                                const char *name,
+                                const char *path,
+                                const struct stat *sb)
+{
+    char *key[VIR_STORAGE_BACKEND_VOL_CACHE_KEYS] = { NULL };
+    virStorageVolDefPtr vol = NULL;
+    xmlNodePtr node;
+    xmlNodePtr volnode;
+    char *backingType = NULL;
+    size_t i;
+
+    if (!(node = virHashLookup(cache->entries, name)))
+        return NULL;
+
+    if (virStorageBackendVolCacheKey(sb, key) < 0)
+        goto error;
+
+    for (i = 0; i < VIR_STORAGE_BACKEND_VOL_CACHE_KEYS; i++) {
+        char *val = virXMLPropString(node,
+                                     virStorageBackendVolCacheKeyAttrs[i]);
+        bool match = STREQ_NULLABLE(val, key[i]);
+
+        VIR_FREE(val);
+        if (!match)
+            goto cleanup;
+    }
+
+    if (!(volnode = virStorageBackendVolCacheChild(node, "volume")) ||
+        !(vol = virStorageVolDefParseNode(def, cache->doc, volnode, 0)))
+        goto error;
+
+    if (STRNEQ_NULLABLE(vol->target.path, path))
+        goto error;
+
+    if (vol->target.backingStore &&
+        (backingType = virXMLPropString(node, "backingType"))) {
+        int type;
+
+        if ((type = virStorageTypeFromString(backingType)) <= 0)
+            goto error;
+        vol->target.backingStore->type = type;
+    }
+
+ cleanup:
+    virStorageBackendVolCacheKeyFree(key);
+    VIR_FREE(backingType);
+    return vol;
+
+ error:
+    /* Just probe the volume again */
+    VIR_DEBUG("Ignoring cached volume '%s'", name);
+    virResetLastError();
+    virStorageVolDefFree(vol);
+    vol = NULL;
+    goto cleanup;
+}
+
+
+/* Remembers @vol, probed from a file described by @sb */
+static int
+virStorageBackendVolCacheAdd(virStorageBackendVolCachePtr cache,
+                             virStoragePoolDefPtr def,
+                             virStorageVolDefPtr vol,
+                             const struct stat *sb)
+{
+    char *key[VIR_STORAGE_BACKEND_VOL_CACHE_KEYS] = { NULL };
+    char *xml = NULL;
+    size_t i;
+
+    if (virStorageBackendVolCacheKey(sb, key) < 0 ||
+        !(xml = virStorageVolDefFormat(def, vol))) {
+        virStorageBackendVolCacheKeyFree(key);
+        return -1;
+    }
+
+    virBufferAddLit(&cache->buf, "<entry");
+    for (i = 0; i < VIR_STORAGE_BACKEND_VOL_CACHE_KEYS; i++)
+        virBufferAsprintf(&cache->buf, " %s='%s'",
+                          virStorageBackendVolCacheKeyAttrs[i], key[i]);
+    if (vol->target.backingStore)
+        virBufferAsprintf(&cache->buf, " backingType='%s'",
+                          virStorageTypeToString(vol->target.backingStore->type));
+    virBufferAddLit(&cache->buf, ">\n");
+    virBufferAdjustIndent(&cache->buf, 2);
+    virBufferAdd(&cache->buf, xml, -1);
+    virBufferAdjustIndent(&cache->buf, -2);
+    virBufferAddLit(&cache->buf, "</entry>\n");
+
+    virStorageBackendVolCacheKeyFree(key);
+    VIR_FREE(xml);
+    return 0;
+}
+
+
+/* Replaces the cache file with the volumes added to @cache */
+static int
+virStorageBackendVolCacheSave(virStorageBackendVolCachePtr cache,
+                              const char *path)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *entries = NULL;
+    char *xml = NULL;
+    int ret = -1;
+
+    if (virBufferCheckError(&cache->buf) < 0)
+        goto cleanup;
+    entries = virBufferContentAndReset(&cache->buf);
+
+    virBufferAddLit(&buf, "<volcache>\n");
+    virBufferAdjustIndent(&buf, 2);
+    virBufferAdd(&buf, entries, -1);
+    virBufferAdjustIndent(&buf, -2);
+    virBufferAddLit(&buf, "</volcache>\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    xml = virBufferContentAndReset(&buf);
+
+    ret = virFileRewriteStr(path, S_IRUSR | S_IWUSR, xml);
+
+ cleanup:
+    VIR_FREE(entries);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+/*
+ * Probes the entry @name of the pool directory @dir. Returns 0 with
+ * *@volret set to the volume, or NULL if the entry is not a volume;
+ * -1 on error. *@cacheable is cleared if the volume depends on more
+ * than the file itself, i.e. the format of its backing store could
+ * not be probed.
+ */
+static int
+storageBackendRefreshLocalProbe(const char *dir,
+                                const char *name,
+                                virStorageVolDefPtr *volret,
+                                bool *cacheable)
+{
+    virStorageVolDefPtr vol = NULL;
+    int err;
+
+    *volret = NULL;
+
+    if (VIR_ALLOC(vol) < 0)
+        goto error;
+
+    if (VIR_STRDUP(vol->name, name) < 0)
+        goto error;
+
+    vol->type = VIR_STORAGE_VOL_FILE;
+    vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
+    if (virAsprintf(&vol->target.path, "%s/%s", dir, vol->name) == -1)
+        goto error;
+
+    if (VIR_STRDUP(vol->key, vol->target.path) < 0)
+        goto error;
+
+    if ((err = storageBackendProbeTarget(&vol->target,
+                                         &vol->target.encryption)) < 0) {
+        if (err == -2) {
+            /* Silently ignore non-regular files,
+             * eg 'lost+found', dangling symbolic link */
+            virStorageVolDefFree(vol);
+            return 0;
+        } else if (err == -3) {
+            /* The backing file is currently unavailable, its format is not
+             * explicitly specified, the probe to auto detect the format
+             * failed: continue with faked RAW format, since AUTO will
+             * break virStorageVolTargetDefFormat() generating the line
+             * <format type='...'/>. Don't cache the made up format,
+             * the backing file may show up before the volume changes. */
+            if (cacheable)
+                *cacheable = false;
+        } else {
+            goto error;
+        }
+    }
+
+    /* directory based volume */
+    if (vol->target.format == VIR_STORAGE_FILE_DIR)
+        vol->type = VIR_STORAGE_VOL_DIR;
+
+    if (vol->target.format == VIR_STORAGE_FILE_PLOOP)
+        vol->type = VIR_STORAGE_VOL_PLOOP;
+
+    *volret = vol;
+    return 0;
+
+ error:
+    virStorageVolDefFree(vol);
+    return -1;
+}
+
+
+/* Refreshes the details of a cached volume which only come from stat */
+static int
+storageBackendRefreshLocalCached(virStorageVolDefPtr vol,
+                                 const struct stat *sb)
+{
+    vol->target.allocation = (unsigned long long)sb->st_blocks *
+        (unsigned long long)DEV_BSIZE;
+    vol->target.physical = sb->st_size;
+
+    if (!vol->target.timestamps && VIR_ALLOC(vol->target.timestamps) < 0)
+        return -1;
+    vol->target.timestamps->atime = get_stat_atime(sb);
+    vol->target.timestamps->btime = get_stat_birthtime(sb);
+    vol->target.timestamps->ctime = get_stat_ctime(sb);
+    vol->target.timestamps->mtime = get_stat_mtime(sb);
+
+    return 0;
+}
+
+
+/*
+ * Fills in the details of the backing store of @vol. Many volumes are
+ * often backed by the same few images, @seen remembers the backing
+ * stores updated already so that each of them is only opened once.
+ */
+static int
+storageBackendRefreshLocalBacking(virStorageVolDefPtr vol,
+                                  virHashTablePtr seen)
+{
+    virStorageSourcePtr backing = vol->target.backingStore;
+    virStorageSourcePtr prev;
+
+    if (!backing)
+        return 0;
+
+    if (!seen || !backing->path ||
+        !(prev = virHashLookup(seen, backing->path))) {
+        ignore_value(storageBackendUpdateVolTargetInfo(VIR_STORAGE_VOL_FILE,
+                                                       backing,
+                                                       false,
+                                                       VIR_STORAGE_VOL_OPEN_DEFAULT, 0));
+        /* If this failed, the backing file is currently unavailable,
+         * the capacity, allocation, owner, group and mode are unknown.
+         * An error message was raised, but we just continue. */
+
+        if (seen && backing->path &&
+            virHashAddEntry(seen, backing->path, backing) < 0)
+            return -1;
+        return 0;
+    }
+
+    backing->allocation = prev->allocation;
+    backing->capacity = prev->capacity;
+    backing->physical = prev->physical;
+
+    if (prev->perms) {
+        if (!backing->perms && VIR_ALLOC(backing->perms) < 0)
+            return -1;
+        backing->perms->mode = prev->perms->mode;
+        backing->perms->uid = prev->perms->uid;
+        backing->perms->gid = prev->perms->gid;
+        VIR_FREE(backing->perms->label);
+        if (VIR_STRDUP(backing->perms->label, prev->perms->label) < 0)
+            return -1;
+    }
+
+    if (prev->timestamps) {
+        if (!backing->timestamps && VIR_ALLOC(backing->timestamps) < 0)
+            return -1;
+        *backing->timestamps = *prev->timestamps;
+    }
+
+    return 0;
+}
+
+
+typedef struct _virStorageBackendRefreshJob virStorageBackendRefreshJob;
+typedef virStorageBackendRefreshJob *virStorageBackendRefreshJobPtr;
+struct _virStorageBackendRefreshJob {
+    char *name;
+    struct stat sb;         /* taken before probing the volume */
+    bool cacheable;         /* whether @sb describes a regular file */
+    bool cached;            /* whether @vol came from the cache */
+    virStorageVolDefPtr vol;
+    int rc;
+    virErrorPtr err;
+};
+
+typedef struct _virStorageBackendRefreshData virStorageBackendRefreshData;
+typedef virStorageBackendRefreshData *virStorageBackendRefreshDataPtr;
+struct _virStorageBackendRefreshData {
+    virStoragePoolDefPtr def;
+    virStorageBackendVolCachePtr cache;
+
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+};
+
+
+/* Takes the volume of @job from the cache, or probes it if it changed */
+static void
+storageBackendRefreshLocalJob(virStorageBackendRefreshDataPtr data,
+                              virStorageBackendRefreshJobPtr job)
+{
+    char *path = NULL;
+
+    if (virAsprintf(&path, "%s/%s", data->def->target.path, job->name) < 0)
+        goto error;
+
+    /* Only regular files are cached, directories and devices are
+     * always probed again */
+    if (stat(path, &job->sb) == 0 && S_ISREG(job->sb.st_mode)) {
+        job->cacheable = true;
+        if ((job->vol = virStorageBackendVolCacheLookup(data->cache,
+                                                        data->def,
+                                                        job->name, path,
+                                                        &job->sb))) {
+            job->cached = true;
+            goto cleanup;
+        }
+    }
+
+    if (storageBackendRefreshLocalProbe(data->def->target.path, job->name,
+                                        &job->vol, &job->cacheable) < 0)
+        goto error;
+
+ cleanup:
+    VIR_FREE(path);
+    return;
+
+ error:
+    job->rc = -1;
+    job->err = virSaveLastError();
+    goto cleanup;
+}
+
+
+static void
+storageBackendRefreshLocalWorker(void *jobdata,
+                                 void *opaque)
+{
+    virStorageBackendRefreshDataPtr data = opaque;
+
+    storageBackendRefreshLocalJob(data, jobdata);
+
+    virMutexLock(&data->lock);
+    if (--data->pending == 0)
+        virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+/*
+ * Looks up or probes the volumes of @jobs, with several threads if
+ * there are enough of them. Probing mostly waits for I/O, so the number
+ * of threads does not depend on the number of CPUs. The cache is only
+ * read meanwhile, which libxml2 allows from several threads.
+ */
+static void
+storageBackendRefreshLocalRunJobs(virStoragePoolDefPtr def,
+                                  virStorageBackendVolCachePtr cache,
+                                  virStorageBackendRefreshJobPtr jobs,
+                                  size_t njobs)
+{
+    virStorageBackendRefreshData data = { .def = def, .cache = cache };
+    virThreadPoolPtr pool = NULL;
+    size_t nworkers = MIN(njobs, REFRESH_PROBE_THREADS);
+    size_t i = 0;
+
+    if (nworkers < 2 ||
+        virMutexInit(&data.lock) < 0)
+        goto serial;
+
+    if (virCondInit(&data.cond) < 0) {
+        virMutexDestroy(&data.lock);
+        goto serial;
+    }
+
+    if (!(pool = virThreadPoolNew(nworkers, nworkers, 0,
+                                  storageBackendRefreshLocalWorker, &data)))
+        goto cleanup;
+
+    virMutexLock(&data.lock);
+    for (; i < njobs; i++) {
+        if (virThreadPoolSendJob(pool, 0, &jobs[i]) < 0)
+            break;
+        data.pending++;
+    }
+    while (data.pending > 0)
+        ignore_value(virCondWait(&data.cond, &data.lock));
+    virMutexUnlock(&data.lock);
+
+    virThreadPoolFree(pool);
+
+ cleanup:
+    virCondDestroy(&data.cond);
+    virMutexDestroy(&data.lock);
+
+ serial:
+    /* Whatever could not be handed over to the pool */
+    for (; i < njobs; i++)
+        storageBackendRefreshLocalJob(&data, &jobs[i]);
+}
+
+
 /**
+ * virStorageBackendRefreshLocalWithCache:
+ * @pool: the pool
+ * @cacheFile: path of the volume cache, or NULL
+ *
  * Iterate over the pool's directory and enumerate all disk images
- * within it. This is non-recursive.
+ * within it. This is non-recursive. Volumes which did not change since
+ * the cache in @cacheFile was written are taken from it rather than
+ * probed; the cache is rewritten afterwards.
  */
 int
-virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
-                              virStoragePoolObjPtr pool)
+virStorageBackendRefreshLocalWithCache(virStoragePoolObjPtr pool,
+                                       const char *cacheFile)
 {
-    DIR *dir;
+    DIR *dir = NULL;
     struct dirent *ent;
     struct statvfs sb;
     struct stat statbuf;
-    virStorageVolDefPtr vol = NULL;
+    virStorageBackendVolCachePtr cache = NULL;
+    virStorageBackendRefreshJobPtr jobs = NULL;
+    virHashTablePtr backings = NULL;
+    size_t njobs = 0;
+    size_t ncached = 0;
+    size_t i;
     virStorageSourcePtr target = NULL;
     int direrr;
     int fd = -1, ret = -1;
 
+    if (!(cache = virStorageBackendVolCacheLoad(cacheFile)) ||
+        !(backings = virHashCreate(32, NULL)))
+        goto cleanup;
+
     if (virDirOpen(&dir, pool->def->target.path) < 0)
         goto cleanup;
 
     while ((direrr = virDirRead(dir, &ent, pool->def->target.path)) > 0) {
-        int err;
+        virStorageBackendRefreshJob job = { 0 };
 
         if (virStringHasControlChars(ent->d_name)) {
             VIR_WARN("Ignoring file with control characters under '%s'",
@@ -3487,65 +4767,59 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
             continue;
         }
 
-        if (VIR_ALLOC(vol) < 0)
+        if (VIR_STRDUP(job.name, ent->d_name) < 0)
             goto cleanup;
 
-        if (VIR_STRDUP(vol->name, ent->d_name) < 0)
+        if (VIR_APPEND_ELEMENT(jobs, njobs, job) < 0) {
+            VIR_FREE(job.name);
             goto cleanup;
+        }
+    }
+    if (direrr < 0)
+        goto cleanup;
+    VIR_DIR_CLOSE(dir);
 
-        vol->type = VIR_STORAGE_VOL_FILE;
-        vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
-        if (virAsprintf(&vol->target.path, "%s/%s",
-                        pool->def->target.path,
-                        vol->name) == -1)
-            goto cleanup;
+    storageBackendRefreshLocalRunJobs(pool->def, cache, jobs, njobs);
+
+    for (i = 0; i < njobs; i++) {
+        virStorageBackendRefreshJobPtr job = &jobs[i];
 
-        if (VIR_STRDUP(vol->key, vol->target.path) < 0)
+        if (job->rc < 0) {
+            virSetError(job->err);
             goto cleanup;
+        }
 
-        if ((err = storageBackendProbeTarget(&vol->target,
-                                             &vol->target.encryption)) < 0) {
-            if (err == -2) {
-                /* Silently ignore non-regular files,
-                 * eg 'lost+found', dangling symbolic link */
-                virStorageVolDefFree(vol);
-                vol = NULL;
-                continue;
-            } else if (err == -3) {
-                /* The backing file is currently unavailable, its format is not
-                 * explicitly specified, the probe to auto detect the format
-                 * failed: continue with faked RAW format, since AUTO will
-                 * break virStorageVolTargetDefFormat() generating the line
-                 * <format type='...'/>. */
-            } else {
+        if (!job->vol)
+            continue;
+
+        if (job->cached) {
+            if (storageBackendRefreshLocalCached(job->vol, &job->sb) < 0)
                 goto cleanup;
-            }
+            ncached++;
         }
 
-        /* directory based volume */
-        if (vol->target.format == VIR_STORAGE_FILE_DIR)
-            vol->type = VIR_STORAGE_VOL_DIR;
-
-        if (vol->target.format == VIR_STORAGE_FILE_PLOOP)
-            vol->type = VIR_STORAGE_VOL_PLOOP;
+        if (storageBackendRefreshLocalBacking(job->vol, backings) < 0)
+            goto cleanup;
 
-        if (vol->target.backingStore) {
-            ignore_value(storageBackendUpdateVolTargetInfo(VIR_STORAGE_VOL_FILE,
-                                                           vol->target.backingStore,
-                                                           false,
-                                                           VIR_STORAGE_VOL_OPEN_DEFAULT, 0));
-            /* If this failed, the backing file is currently unavailable,
-             * the capacity, allocation, owner, group and mode are unknown.
-             * An error message was raised, but we just continue. */
-        }
+        if (job->cacheable &&
+            virStorageBackendVolCacheAdd(cache, pool->def,
+                                         job->vol, &job->sb) < 0)
+            goto cleanup;
 
-        if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0)
+        if (virStoragePoolObjAddVol(pool, job->vol) < 0)
             goto cleanup;
+        job->vol = NULL;
+    }
+
+    VIR_DEBUG("Pool '%s': %zu volumes, %zu of them cached",
+              pool->def->name, pool->volumes.count, ncached);
+
+    if (cacheFile &&
+        virStorageBackendVolCacheSave(cache, cacheFile) < 0) {
+        VIR_WARN("Unable to save volume cache '%s': %s",
+                 cacheFile, virGetLastErrorMessage());
+        virResetLastError();
     }
-    if (direrr < 0)
-        goto cleanup;
-    VIR_DIR_CLOSE(dir);
-    vol = NULL;
 
     if (VIR_ALLOC(target))
         goto cleanup;
@@ -3592,7 +4866,14 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
  cleanup:
     VIR_DIR_CLOSE(dir);
     VIR_FORCE_CLOSE(fd);
-    virStorageVolDefFree(vol);
+    for (i = 0; i < njobs; i++) {
+        VIR_FREE(jobs[i].name);
+        virStorageVolDefFree(jobs[i].vol);
+        virFreeError(jobs[i].err);
+    }
+    VIR_FREE(jobs);
+    virHashFree(backings);
+    virStorageBackendVolCacheFree(cache);
     virStorageSourceFree(target);
     if (ret < 0)
         virStoragePoolObjClearVols(pool);
@@ -3600,6 +4881,80 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
+int
+virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
+                              virStoragePoolObjPtr pool)
+{
+    char *cacheFile = virStoragePoolObjBuildVolCachePath(pool);
+    int ret;
+
+    ret = virStorageBackendRefreshLocalWithCache(pool, cacheFile);
+    VIR_FREE(cacheFile);
+    return ret;
+}
+
+
+/**
+ * virStorageBackendRefreshLocalEntry:
+ * @pool: the pool
+ * @name: name of an entry in the pool's directory
+ *
+ * Updates the volume list of @pool after the entry @name of its
+ * directory was created, changed or removed, without refreshing the
+ * whole pool. Volumes being built or used by a running job are left
+ * alone.
+ *
+ * Returns 1 if the volume list changed, 0 if it did not, -1 on error.
+ */
+int
+virStorageBackendRefreshLocalEntry(virStoragePoolObjPtr pool,
+                                   const char *name)
+{
+    virStorageVolDefPtr old;
+    virStorageVolDefPtr vol = NULL;
+
+    if (virStringHasControlChars(name))
+        return 0;
+
+    if ((old = virStorageVolDefFindByName(pool, name)) &&
+        (old->building || old->in_use)) {
+        VIR_DEBUG("Volume '%s' in pool '%s' is busy, not updating it",
+                  name, pool->def->name);
+        return 0;
+    }
+
+    if (storageBackendRefreshLocalProbe(pool->def->target.path,
+                                        name, &vol, NULL) < 0)
+        return -1;
+
+    if (!vol && !old)
+        return 0;
+
+    if (vol &&
+        storageBackendRefreshLocalBacking(vol, NULL) < 0) {
+        virStorageVolDefFree(vol);
+        return -1;
+    }
+
+    if (old) {
+        VIR_DEBUG("Removing volume '%s' from pool '%s'",
+                  name, pool->def->name);
+        virStoragePoolObjRemoveVol(pool, old);
+        virStorageVolDefFree(old);
+    }
+
+    if (vol) {
+        VIR_DEBUG("Adding volume '%s' to pool '%s'", name, pool->def->name);
+        if (virStoragePoolObjAddVol(pool, vol) < 0) {
+            virStorageVolDefFree(vol);
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+
 static char *
 virStorageBackendSCSISerial(const char *dev)
 {
@@ -3727,7 +5082,7 @@ virStorageBackendSCSINewLun(virStoragePoolObjPtr pool,
     pool->def->capacity += vol->target.capacity;
     pool->def->allocation += vol->target.allocation;
 
-    if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0)
+    if (virStoragePoolObjAddVol(pool, vol) < 0)
         goto cleanup;
 
     vol = NULL;
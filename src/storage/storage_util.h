@@ -27,6 +27,22 @@
 # include "storage_driver.h"
 # include "storage_backend.h"
 
+typedef enum {
+    /* Holes and blocks of zeroes need not be written */
+    VIR_STORAGE_BACKEND_COPY_SPARSE = 1 << 0,
+    /* The copy may share extents with the input */
+    VIR_STORAGE_BACKEND_COPY_SHARE = 1 << 1,
+    /* The copy must be made by cloning the input */
+    VIR_STORAGE_BACKEND_COPY_REFLINK = 1 << 2,
+} virStorageBackendCopyFlags;
+
+int virStorageBackendCopyFD(int inputfd,
+                            const char *inputpath,
+                            int fd,
+                            const char *path,
+                            unsigned long long *total,
+                            unsigned int flags);
+
 /* File creation/cloning functions used for cloning between backends */
 virStorageBackendBuildVolFrom
 virStorageBackendGetBuildVolFromFunction(virStorageVolDefPtr vol,
@@ -93,6 +109,10 @@ int virStorageBackendDeleteLocal(virConnectPtr conn,
 
 int virStorageBackendRefreshLocal(virConnectPtr conn,
                                   virStoragePoolObjPtr pool);
+int virStorageBackendRefreshLocalWithCache(virStoragePoolObjPtr pool,
+                                           const char *cacheFile);
+int virStorageBackendRefreshLocalEntry(virStoragePoolObjPtr pool,
+                                       const char *name);
 
 int virStorageBackendFindGlusterPoolSources(const char *host,
                                             int pooltype,
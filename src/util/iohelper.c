@@ -23,6 +23,7 @@
  *   - Read existing file
  *   - Write existing file
  *   - Create & write new file
+ *   - Read & write sparse files, see virFileSparseRecord
  */
 
 #include <config.h>
@@ -31,6 +32,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "virutil.h"
 #include "virthread.h"
@@ -72,8 +74,129 @@ prepare(const char *path, int oflags, int mode,
     return fd;
 }
 
+/* Read a single sparse record header from @fd. Returns 1 if a record
+ * was read, 0 on EOF, -1 on error. */
 static int
-runIO(const char *path, int fd, int oflags, unsigned long long length)
+runIOReadRecord(int fd, const char *fdname, virFileSparseRecordPtr rec)
+{
+    ssize_t got;
+
+    if ((got = saferead(fd, rec, sizeof(*rec))) < 0) {
+        virReportSystemError(errno, _("Unable to read %s"), fdname);
+        return -1;
+    }
+
+    if (got == 0)
+        return 0;
+
+    if (got != sizeof(*rec)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Truncated sparse record in %s"), fdname);
+        return -1;
+    }
+
+    if (rec->type != VIR_FILE_SPARSE_RECORD_DATA &&
+        rec->type != VIR_FILE_SPARSE_RECORD_HOLE) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unknown sparse record type %llu in %s"),
+                       rec->type, fdname);
+        return -1;
+    }
+
+    return 1;
+}
+
+
+static int
+runIOWriteRecord(int fd, const char *fdname,
+                 virFileSparseRecordType type, unsigned long long length)
+{
+    virFileSparseRecord rec = { .type = type, .length = length };
+
+    if (safewrite(fd, &rec, sizeof(rec)) < 0) {
+        virReportSystemError(errno, _("Unable to write %s"), fdname);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+runIOWriteZeroes(int fd, const char *fdname, unsigned long long length)
+{
+    char zeroes[64 * 1024] = { 0 };
+
+    while (length) {
+        size_t want = MIN(length, sizeof(zeroes));
+
+        if (safewrite(fd, zeroes, want) < 0) {
+            virReportSystemError(errno, _("Unable to write %s"), fdname);
+            return -1;
+        }
+        length -= want;
+    }
+
+    return 0;
+}
+
+
+/* Creates a hole of @length bytes at the current position of @fd.
+ * Regular files get the hole punched where they already contain data
+ * and are merely seeked over past their end, anything else is filled
+ * with zeroes. */
+static int
+runIOWriteHole(int fd, const char *fdname, unsigned long long length)
+{
+    struct stat sb;
+    off_t cur;
+    unsigned long long overlap = 0;
+
+    if (fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, _("Unable to access %s"), fdname);
+        return -1;
+    }
+
+    if (!S_ISREG(sb.st_mode))
+        return runIOWriteZeroes(fd, fdname, length);
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1) {
+        virReportSystemError(errno, _("Unable to seek %s"), fdname);
+        return -1;
+    }
+
+    if (cur < sb.st_size)
+        overlap = MIN(length, sb.st_size - cur);
+
+    if (overlap) {
+        bool punched = false;
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE) && \
+    defined(FALLOC_FL_KEEP_SIZE)
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      cur, overlap) == 0)
+            punched = true;
+#endif
+
+        if (!punched) {
+            if (runIOWriteZeroes(fd, fdname, overlap) < 0)
+                return -1;
+            length -= overlap;
+        }
+    }
+
+    if (length && lseek(fd, length, SEEK_CUR) == (off_t) -1) {
+        virReportSystemError(errno, _("Unable to seek %s"), fdname);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+runIO(const char *path, int fd, int oflags, unsigned long long length,
+      bool sparse)
 {
     void *base = NULL; /* Location to be freed */
     char *buf = NULL; /* Aligned location within base */
@@ -86,6 +209,8 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
     bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
     bool shortRead = false; /* true if we hit a short read */
     off_t end = 0;
+    bool detectHoles = sparse; /* false if the file can't tell holes */
+    unsigned long long dataLeft = 0; /* of the current sparse data section */
 
 #if HAVE_POSIX_MEMALIGN
     if (posix_memalign(&base, alignMask + 1, buflen)) {
@@ -136,8 +261,15 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         goto cleanup;
     }
 
+    if (sparse && direct) {
+        virReportSystemError(EINVAL, "%s",
+                             _("O_DIRECT is not supported for sparse files"));
+        goto cleanup;
+    }
+
     while (1) {
         ssize_t got;
+        size_t want;
 
         if (length &&
             (length - total) < buflen)
@@ -146,13 +278,91 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         if (buflen == 0)
             break; /* End of requested data from client */
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
+        if (sparse && !dataLeft) {
+            if (fdin == fd) {
+                int inData = 1;
+                long long sectionLen = 0;
+
+                if (detectHoles &&
+                    virFileInData(fd, &inData, &sectionLen) < 0) {
+                    /* E.g. block devices don't support SEEK_DATA,
+                     * transfer everything as data then */
+                    virResetLastError();
+                    detectHoles = false;
+                    inData = 1;
+                    sectionLen = 0;
+                }
+
+                if (length && sectionLen > length - total)
+                    sectionLen = length - total;
+
+                if (!inData) {
+                    if (sectionLen == 0)
+                        break; /* End of file */
+
+                    if (runIOWriteRecord(fdout, fdoutname,
+                                         VIR_FILE_SPARSE_RECORD_HOLE,
+                                         sectionLen) < 0)
+                        goto cleanup;
+
+                    if (lseek(fd, sectionLen, SEEK_CUR) == (off_t) -1) {
+                        virReportSystemError(errno, _("Unable to seek %s"),
+                                             fdinname);
+                        goto cleanup;
+                    }
+
+                    total += sectionLen;
+                    continue;
+                }
+
+                dataLeft = sectionLen;
+            } else {
+                virFileSparseRecord rec;
+                int rc;
+
+                if ((rc = runIOReadRecord(fdin, fdinname, &rec)) < 0)
+                    goto cleanup;
+                if (rc == 0)
+                    break; /* End of stream */
+
+                if (rec.type == VIR_FILE_SPARSE_RECORD_HOLE) {
+                    if (runIOWriteHole(fd, fdoutname, rec.length) < 0)
+                        goto cleanup;
+                    total += rec.length;
+                    continue;
+                }
+
+                if (rec.length == 0)
+                    continue;
+                dataLeft = rec.length;
+            }
+        }
+
+        want = buflen;
+        if (dataLeft && dataLeft < want)
+            want = dataLeft;
+
+        if ((got = saferead(fdin, buf, want)) < 0) {
             virReportSystemError(errno, _("Unable to read %s"), fdinname);
             goto cleanup;
         }
-        if (got == 0)
+        if (got == 0) {
+            if (sparse && fdout == fd && dataLeft) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Truncated sparse data in %s"), fdinname);
+                goto cleanup;
+            }
             break; /* End of file before end of requested data */
-        if (got < buflen || (buflen & alignMask)) {
+        }
+
+        if (dataLeft)
+            dataLeft -= got;
+
+        if (sparse && fdin == fd &&
+            runIOWriteRecord(fdout, fdoutname,
+                             VIR_FILE_SPARSE_RECORD_DATA, got) < 0)
+            goto cleanup;
+        if (got < want || (want & alignMask)) {
             /* O_DIRECT can handle at most one short read, at end of file */
             if (direct && shortRead) {
                 virReportSystemError(EINVAL, "%s",
@@ -164,7 +374,7 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         total += got;
         if (fdout == fd && direct && shortRead) {
             end = total;
-            memset(buf + got, 0, buflen - got);
+            memset(buf + got, 0, want - got);
             got = (got + alignMask) & ~alignMask;
         }
         if (safewrite(fdout, buf, got) < 0) {
@@ -177,6 +387,24 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         }
     }
 
+    /* A hole at the very end of the stream needs the file extended */
+    if (sparse && fdout == fd) {
+        struct stat sb;
+        off_t cur;
+
+        if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1 ||
+            fstat(fd, &sb) < 0) {
+            virReportSystemError(errno, _("Unable to access %s"), fdoutname);
+            goto cleanup;
+        }
+
+        if (S_ISREG(sb.st_mode) && cur > sb.st_size &&
+            ftruncate(fd, cur) < 0) {
+            virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
+            goto cleanup;
+        }
+    }
+
     /* Ensure all data is written */
     if (fdatasync(fdout) < 0) {
         if (errno != EINVAL && errno != EROFS) {
@@ -208,7 +436,7 @@ usage(int status)
         fprintf(stderr, _("%s: try --help for more details"), program_name);
     } else {
         printf(_("Usage: %s FILENAME OFLAGS MODE OFFSET LENGTH DELETE\n"
-                 "   or: %s FILENAME LENGTH FD\n"),
+                 "   or: %s FILENAME LENGTH FD [--sparse]\n"),
                program_name, program_name);
     }
     exit(status);
@@ -225,6 +453,7 @@ main(int argc, char **argv)
     unsigned int delete = 0;
     int fd = -1;
     int lengthIndex = 0;
+    bool sparse = false;
 
     program_name = argv[0];
 
@@ -262,8 +491,13 @@ main(int argc, char **argv)
             exit(EXIT_FAILURE);
         }
         fd = prepare(path, oflags, mode, offset);
-    } else if (argc == 4) { /* FILENAME LENGTH FD */
+    } else if (argc == 4 || argc == 5) { /* FILENAME LENGTH FD [--sparse] */
         lengthIndex = 2;
+        if (argc == 5) {
+            if (STRNEQ(argv[4], "--sparse"))
+                usage(EXIT_FAILURE);
+            sparse = true;
+        }
         if (virStrToLong_i(argv[3], NULL, 10, &fd) < 0) {
             fprintf(stderr, _("%s: malformed fd %s"),
                     program_name, argv[3]);
@@ -293,7 +527,7 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (fd < 0 || runIO(path, fd, oflags, length) < 0)
+    if (fd < 0 || runIO(path, fd, oflags, length, sparse) < 0)
         goto error;
 
     if (delete)
@@ -0,0 +1,1022 @@
+/*
+ * vircompress.c: parallel compression of a stream by external programs
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * The input is cut into chunks which are compressed (or decompressed)
+ * independently by running the given program on each of them, several
+ * chunks at a time. The results are written out in order.
+ *
+ * gzip, bzip2 and xz all accept concatenated streams, so plainly
+ * concatenated chunks can be decompressed by the program itself, just
+ * not in parallel. With VIR_COMPRESS_STREAM_CHUNKED the stream is
+ * framed instead, all numbers being big endian:
+ *
+ *   chunk:   "CHNK" | u32 raw length | u32 data length | u32 0 | data
+ *   ...
+ *   index:   "CIDX" | u32 chunk count | u64 0
+ *   entry:   u64 chunk offset | u32 raw length | u32 data length
+ *   ...
+ *   trailer: "CEND" | u32 chunk count | u64 index offset
+ *
+ * Offsets are relative to the start of the stream. The trailer allows
+ * a reader which can seek to find any chunk without scanning the
+ * stream, a sequential reader verifies the index against the chunks
+ * it has seen.
+ */
+
+#include <config.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "vircompress.h"
+#include "vircommand.h"
+#include "virthread.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "viralloc.h"
+#include "virstring.h"
+#include "virtime.h"
+#include "virutil.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.compress");
+
+#define VIR_COMPRESS_FRAME_LEN 16
+#define VIR_COMPRESS_CHUNK_MAGIC "CHNK"
+#define VIR_COMPRESS_INDEX_MAGIC "CIDX"
+#define VIR_COMPRESS_TRAILER_MAGIC "CEND"
+
+/* Upper bound of the lengths accepted from a chunk frame, so that a
+ * corrupted stream doesn't make us allocate gigabytes */
+#define VIR_COMPRESS_CHUNK_MAX (256 * 1024 * 1024)
+
+/* How many chunks per worker may be held in memory */
+#define VIR_COMPRESS_CHUNKS_PER_WORKER 2
+
+typedef struct _virCompressChunk virCompressChunk;
+typedef virCompressChunk *virCompressChunkPtr;
+struct _virCompressChunk {
+    char *in;
+    size_t inlen;
+    char *out;
+    size_t outlen;
+    size_t rawlen;  /* expected output length when decompressing */
+    bool done;
+};
+
+typedef struct _virCompressIndexEntry virCompressIndexEntry;
+struct _virCompressIndexEntry {
+    unsigned long long offset;
+    size_t rawlen;
+    size_t datalen;
+};
+
+struct _virCompressStream {
+    virMutex lock;
+    virCond cond;   /* broadcast on every change of the state below */
+
+    char **args;
+    unsigned int flags;
+    size_t chunkSize;
+
+    int infd;       /* owned by the reader */
+    int outfd;      /* owned by the writer */
+
+    virThread reader;
+    virThread writer;
+    virThread *workers;
+    size_t nworkers;
+    bool joined;
+
+    /* Chunks read but not written yet, chunk N is in slot N % nslots */
+    virCompressChunkPtr *slots;
+    size_t nslots;
+    size_t nread;       /* chunks read */
+    size_t nprocessed;  /* chunks taken by a worker */
+    size_t nwritten;    /* chunks written */
+    bool eof;
+
+    bool failed;
+    bool aborted;
+    virErrorPtr err;
+
+    virCompressStats stats;
+};
+
+
+static void
+virCompressPut32(unsigned char *buf, uint32_t val)
+{
+    buf[0] = val >> 24;
+    buf[1] = val >> 16;
+    buf[2] = val >> 8;
+    buf[3] = val;
+}
+
+
+static void
+virCompressPut64(unsigned char *buf, uint64_t val)
+{
+    virCompressPut32(buf, val >> 32);
+    virCompressPut32(buf + 4, val);
+}
+
+
+static uint32_t
+virCompressGet32(const unsigned char *buf)
+{
+    return ((uint32_t) buf[0] << 24) | ((uint32_t) buf[1] << 16) |
+        ((uint32_t) buf[2] << 8) | buf[3];
+}
+
+
+static uint64_t
+virCompressGet64(const unsigned char *buf)
+{
+    return ((uint64_t) virCompressGet32(buf) << 32) |
+        virCompressGet32(buf + 4);
+}
+
+
+static void
+virCompressChunkFree(virCompressChunkPtr chunk)
+{
+    if (!chunk)
+        return;
+
+    VIR_FREE(chunk->in);
+    VIR_FREE(chunk->out);
+    VIR_FREE(chunk);
+}
+
+
+/* Records the error of the calling thread as the error of @stream,
+ * unless it failed already. Called with @stream locked. */
+static void
+virCompressStreamFail(virCompressStreamPtr stream)
+{
+    if (!stream->failed) {
+        stream->failed = true;
+        stream->err = virSaveLastError();
+    }
+    virCondBroadcast(&stream->cond);
+}
+
+
+/* Runs the program on @chunk->in, collecting its output in @chunk->out */
+static int
+virCompressChunkRun(virCompressStreamPtr stream,
+                    virCompressChunkPtr chunk)
+{
+    virCommandPtr cmd = NULL;
+    int pipefd[2] = { -1, -1 };
+    int outfd = -1;
+    size_t written = 0;
+    size_t alloc = 0;
+    int ret = -1;
+
+    if (pipe(pipefd) < 0) {
+        virReportSystemError(errno, "%s", _("unable to create pipe"));
+        return -1;
+    }
+
+    cmd = virCommandNewArgs((const char **) stream->args);
+    virCommandSetInputFD(cmd, pipefd[0]);
+    virCommandSetOutputFD(cmd, &outfd);
+
+    if (virSetCloseExec(pipefd[1]) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to set cloexec flag"));
+        goto cleanup;
+    }
+
+    if (virCommandRunAsync(cmd, NULL) < 0)
+        goto cleanup;
+    VIR_FORCE_CLOSE(pipefd[0]);
+
+    if (virSetNonBlock(pipefd[1]) < 0 ||
+        virSetNonBlock(outfd) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to set non-blocking mode"));
+        goto abort;
+    }
+
+    /* Feed the input and collect the output at the same time, the
+     * program may well not consume all its input before producing
+     * some output */
+    while (outfd >= 0) {
+        struct pollfd fds[2];
+        nfds_t nfds = 0;
+
+        fds[nfds].fd = outfd;
+        fds[nfds].events = POLLIN;
+        fds[nfds++].revents = 0;
+        if (pipefd[1] >= 0) {
+            fds[nfds].fd = pipefd[1];
+            fds[nfds].events = POLLOUT;
+            fds[nfds++].revents = 0;
+        }
+
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            virReportSystemError(errno, "%s", _("unable to poll"));
+            goto abort;
+        }
+
+        if (pipefd[1] >= 0 && fds[1].revents) {
+            ssize_t done = write(pipefd[1], chunk->in + written,
+                                 chunk->inlen - written);
+
+            if (done < 0 && errno != EAGAIN && errno != EINTR) {
+                virReportSystemError(errno, _("unable to write to %s"),
+                                     stream->args[0]);
+                goto abort;
+            }
+            if (done > 0)
+                written += done;
+            if (written == chunk->inlen)
+                VIR_FORCE_CLOSE(pipefd[1]);
+        }
+
+        if (fds[0].revents) {
+            ssize_t done;
+
+            if (VIR_RESIZE_N(chunk->out, alloc, chunk->outlen,
+                             64 * 1024) < 0)
+                goto abort;
+
+            done = read(outfd, chunk->out + chunk->outlen,
+                        alloc - chunk->outlen);
+            if (done < 0 && errno != EAGAIN && errno != EINTR) {
+                virReportSystemError(errno, _("unable to read from %s"),
+                                     stream->args[0]);
+                goto abort;
+            }
+            if (done == 0)
+                VIR_FORCE_CLOSE(outfd);
+            if (done > 0)
+                chunk->outlen += done;
+        }
+    }
+
+    if (pipefd[1] >= 0) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("%s exited before reading all its input"),
+                       stream->args[0]);
+        goto abort;
+    }
+
+    if (virCommandWait(cmd, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    VIR_FORCE_CLOSE(outfd);
+    virCommandFree(cmd);
+    return ret;
+
+ abort:
+    virCommandAbort(cmd);
+    goto cleanup;
+}
+
+
+static void
+virCompressWorker(void *opaque)
+{
+    virCompressStreamPtr stream = opaque;
+    bool decompress = stream->flags & VIR_COMPRESS_STREAM_DECOMPRESS;
+
+    virMutexLock(&stream->lock);
+    while (!stream->failed) {
+        virCompressChunkPtr chunk;
+        unsigned long long start;
+        unsigned long long end;
+        size_t seq;
+        int rc;
+
+        if (stream->nprocessed == stream->nread) {
+            if (stream->eof)
+                break;
+            virCondWait(&stream->cond, &stream->lock);
+            continue;
+        }
+
+        seq = stream->nprocessed++;
+        chunk = stream->slots[seq % stream->nslots];
+        virMutexUnlock(&stream->lock);
+
+        ignore_value(virTimeMillisNowRaw(&start));
+        rc = virCompressChunkRun(stream, chunk);
+        ignore_value(virTimeMillisNowRaw(&end));
+
+        if (rc == 0 && decompress && chunk->outlen != chunk->rawlen) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("chunk %zu decompressed to %zu bytes, "
+                             "expected %zu"),
+                           seq, chunk->outlen, chunk->rawlen);
+            rc = -1;
+        }
+
+        virMutexLock(&stream->lock);
+        if (rc < 0) {
+            virCompressStreamFail(stream);
+            break;
+        }
+
+        VIR_FREE(chunk->in);
+        chunk->done = true;
+        stream->stats.processBytes += chunk->inlen;
+        stream->stats.processTime += end - start;
+        virCondBroadcast(&stream->cond);
+    }
+    virMutexUnlock(&stream->lock);
+}
+
+
+/* Reads exactly @len bytes, returns 0 on success, 1 if the input ended
+ * right away and -1 on error */
+static int
+virCompressRead(virCompressStreamPtr stream,
+                void *buf,
+                size_t len)
+{
+    unsigned long long start;
+    unsigned long long end;
+    ssize_t got;
+
+    ignore_value(virTimeMillisNowRaw(&start));
+    got = saferead(stream->infd, buf, len);
+    ignore_value(virTimeMillisNowRaw(&end));
+
+    if (got < 0) {
+        virReportSystemError(errno, "%s", _("unable to read input stream"));
+        return -1;
+    }
+
+    virMutexLock(&stream->lock);
+    stream->stats.readBytes += got;
+    stream->stats.readTime += end - start;
+    virMutexUnlock(&stream->lock);
+
+    if (got == 0 && len > 0)
+        return 1;
+
+    if (got != len) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("compressed stream is truncated"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Checks the index and trailer following the last chunk against the
+ * chunks seen */
+static int
+virCompressReadIndex(virCompressStreamPtr stream,
+                     const unsigned char *hdr,
+                     virCompressIndexEntry *entries,
+                     size_t nentries,
+                     unsigned long long offset)
+{
+    unsigned char frame[VIR_COMPRESS_FRAME_LEN];
+    size_t i;
+    char c;
+
+    if (virCompressGet32(hdr + 4) != nentries)
+        goto corrupt;
+
+    for (i = 0; i < nentries; i++) {
+        if (virCompressRead(stream, frame, sizeof(frame)) != 0)
+            goto corrupt;
+
+        if (virCompressGet64(frame) != entries[i].offset ||
+            virCompressGet32(frame + 8) != entries[i].rawlen ||
+            virCompressGet32(frame + 12) != entries[i].datalen)
+            goto corrupt;
+    }
+
+    if (virCompressRead(stream, frame, sizeof(frame)) != 0 ||
+        memcmp(frame, VIR_COMPRESS_TRAILER_MAGIC, 4) != 0 ||
+        virCompressGet32(frame + 4) != nentries ||
+        virCompressGet64(frame + 8) != offset)
+        goto corrupt;
+
+    /* Nothing may follow the trailer */
+    if (virCompressRead(stream, &c, 1) != 1)
+        goto corrupt;
+
+    return 0;
+
+ corrupt:
+    virResetLastError();
+    virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                   _("compressed stream index is corrupted"));
+    return -1;
+}
+
+
+/* Reads the next chunk of a framed stream. Returns 0 with @chunk set,
+ * 0 with @chunk NULL once the index was verified or -1 on error. */
+static int
+virCompressReadFrame(virCompressStreamPtr stream,
+                     virCompressIndexEntry **entries,
+                     size_t *nentries,
+                     unsigned long long *offset,
+                     virCompressChunkPtr *chunk)
+{
+    unsigned char hdr[VIR_COMPRESS_FRAME_LEN];
+    virCompressIndexEntry entry;
+    virCompressChunkPtr ret = NULL;
+    int rc;
+
+    *chunk = NULL;
+
+    if ((rc = virCompressRead(stream, hdr, sizeof(hdr))) != 0) {
+        if (rc > 0)
+            virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                           _("compressed stream is truncated"));
+        return -1;
+    }
+
+    if (memcmp(hdr, VIR_COMPRESS_INDEX_MAGIC, 4) == 0)
+        return virCompressReadIndex(stream, hdr, *entries, *nentries,
+                                    *offset);
+
+    entry.offset = *offset;
+    entry.rawlen = virCompressGet32(hdr + 4);
+    entry.datalen = virCompressGet32(hdr + 8);
+
+    if (memcmp(hdr, VIR_COMPRESS_CHUNK_MAGIC, 4) != 0 ||
+        entry.rawlen > VIR_COMPRESS_CHUNK_MAX ||
+        entry.datalen > VIR_COMPRESS_CHUNK_MAX) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("malformed chunk header at offset %llu"),
+                       *offset);
+        return -1;
+    }
+
+    if (VIR_ALLOC(ret) < 0 ||
+        VIR_ALLOC_N(ret->in, entry.datalen) < 0)
+        goto error;
+    ret->inlen = entry.datalen;
+    ret->rawlen = entry.rawlen;
+
+    if (virCompressRead(stream, ret->in, ret->inlen) != 0) {
+        virResetLastError();
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       _("compressed stream is truncated"));
+        goto error;
+    }
+
+    if (VIR_APPEND_ELEMENT_COPY(*entries, *nentries, entry) < 0)
+        goto error;
+
+    *offset += sizeof(hdr) + entry.datalen;
+    *chunk = ret;
+    return 0;
+
+ error:
+    virCompressChunkFree(ret);
+    return -1;
+}
+
+
+static void
+virCompressReader(void *opaque)
+{
+    virCompressStreamPtr stream = opaque;
+    bool decompress = stream->flags & VIR_COMPRESS_STREAM_DECOMPRESS;
+    virCompressIndexEntry *entries = NULL;
+    size_t nentries = 0;
+    unsigned long long offset = 0;
+
+    for (;;) {
+        virCompressChunkPtr chunk = NULL;
+        int rc;
+
+        virMutexLock(&stream->lock);
+        while (!stream->failed &&
+               stream->nread - stream->nwritten == stream->nslots)
+            virCondWait(&stream->cond, &stream->lock);
+        if (stream->failed) {
+            virMutexUnlock(&stream->lock);
+            break;
+        }
+        virMutexUnlock(&stream->lock);
+
+        if (decompress) {
+            rc = virCompressReadFrame(stream, &entries, &nentries,
+                                      &offset, &chunk);
+        } else if (VIR_ALLOC(chunk) < 0 ||
+                   VIR_ALLOC_N(chunk->in, stream->chunkSize) < 0) {
+            rc = -1;
+        } else {
+            ssize_t got;
+            unsigned long long start;
+            unsigned long long end;
+
+            ignore_value(virTimeMillisNowRaw(&start));
+            got = saferead(stream->infd, chunk->in, stream->chunkSize);
+            ignore_value(virTimeMillisNowRaw(&end));
+
+            if (got < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("unable to read input stream"));
+                rc = -1;
+            } else {
+                chunk->inlen = got;
+                rc = 0;
+
+                virMutexLock(&stream->lock);
+                stream->stats.readBytes += got;
+                stream->stats.readTime += end - start;
+                virMutexUnlock(&stream->lock);
+
+                if (got == 0)
+                    VIR_FREE(chunk->in);
+            }
+        }
+
+        if (chunk && !chunk->in) {
+            virCompressChunkFree(chunk);
+            chunk = NULL;
+        }
+
+        virMutexLock(&stream->lock);
+        if (rc < 0) {
+            virCompressStreamFail(stream);
+        } else if (!chunk) {
+            stream->eof = true;
+        } else {
+            stream->slots[stream->nread++ % stream->nslots] = chunk;
+            chunk = NULL;
+        }
+        virCondBroadcast(&stream->cond);
+        virMutexUnlock(&stream->lock);
+
+        virCompressChunkFree(chunk);
+        if (rc < 0 || stream->eof)
+            break;
+    }
+
+    /* Closing the input lets the producer know we are done, early */
+    VIR_FORCE_CLOSE(stream->infd);
+    VIR_FREE(entries);
+}
+
+
+static int
+virCompressWrite(virCompressStreamPtr stream,
+                 const void *buf,
+                 size_t len)
+{
+    unsigned long long start;
+    unsigned long long end;
+
+    ignore_value(virTimeMillisNowRaw(&start));
+    if (safewrite(stream->outfd, buf, len) != len) {
+        virReportSystemError(errno, "%s",
+                             _("unable to write output stream"));
+        return -1;
+    }
+    ignore_value(virTimeMillisNowRaw(&end));
+
+    virMutexLock(&stream->lock);
+    stream->stats.writeBytes += len;
+    stream->stats.writeTime += end - start;
+    virMutexUnlock(&stream->lock);
+
+    return 0;
+}
+
+
+static int
+virCompressWriteIndex(virCompressStreamPtr stream,
+                      virCompressIndexEntry *entries,
+                      size_t nentries,
+                      unsigned long long offset)
+{
+    unsigned char *buf = NULL;
+    unsigned char *p;
+    size_t len = (nentries + 2) * VIR_COMPRESS_FRAME_LEN;
+    size_t i;
+    int ret;
+
+    if (VIR_ALLOC_N(buf, len) < 0)
+        return -1;
+
+    p = buf;
+    memcpy(p, VIR_COMPRESS_INDEX_MAGIC, 4);
+    virCompressPut32(p + 4, nentries);
+    p += VIR_COMPRESS_FRAME_LEN;
+
+    for (i = 0; i < nentries; i++) {
+        virCompressPut64(p, entries[i].offset);
+        virCompressPut32(p + 8, entries[i].rawlen);
+        virCompressPut32(p + 12, entries[i].datalen);
+        p += VIR_COMPRESS_FRAME_LEN;
+    }
+
+    memcpy(p, VIR_COMPRESS_TRAILER_MAGIC, 4);
+    virCompressPut32(p + 4, nentries);
+    virCompressPut64(p + 8, offset);
+
+    ret = virCompressWrite(stream, buf, len);
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+static int
+virCompressWriteChunk(virCompressStreamPtr stream,
+                      virCompressChunkPtr chunk,
+                      virCompressIndexEntry **entries,
+                      size_t *nentries,
+                      unsigned long long *offset)
+{
+    if (stream->flags & VIR_COMPRESS_STREAM_CHUNKED &&
+        !(stream->flags & VIR_COMPRESS_STREAM_DECOMPRESS)) {
+        unsigned char hdr[VIR_COMPRESS_FRAME_LEN] = { 0 };
+        virCompressIndexEntry entry = {
+            .offset = *offset,
+            .rawlen = chunk->inlen,
+            .datalen = chunk->outlen,
+        };
+
+        if (chunk->outlen > VIR_COMPRESS_CHUNK_MAX) {
+            virReportError(VIR_ERR_OPERATION_FAILED,
+                           _("compressed chunk is too big: %zu bytes"),
+                           chunk->outlen);
+            return -1;
+        }
+
+        memcpy(hdr, VIR_COMPRESS_CHUNK_MAGIC, 4);
+        virCompressPut32(hdr + 4, chunk->inlen);
+        virCompressPut32(hdr + 8, chunk->outlen);
+
+        if (VIR_APPEND_ELEMENT_COPY(*entries, *nentries, entry) < 0 ||
+            virCompressWrite(stream, hdr, sizeof(hdr)) < 0)
+            return -1;
+
+        *offset += sizeof(hdr);
+    }
+
+    if (virCompressWrite(stream, chunk->out, chunk->outlen) < 0)
+        return -1;
+
+    *offset += chunk->outlen;
+    return 0;
+}
+
+
+static void
+virCompressWriter(void *opaque)
+{
+    virCompressStreamPtr stream = opaque;
+    virCompressIndexEntry *entries = NULL;
+    size_t nentries = 0;
+    unsigned long long offset = 0;
+
+    virMutexLock(&stream->lock);
+    while (!stream->failed) {
+        virCompressChunkPtr chunk;
+        int rc;
+
+        if (stream->nwritten == stream->nread) {
+            if (stream->eof)
+                break;
+            virCondWait(&stream->cond, &stream->lock);
+            continue;
+        }
+
+        chunk = stream->slots[stream->nwritten % stream->nslots];
+        if (!chunk->done) {
+            virCondWait(&stream->cond, &stream->lock);
+            continue;
+        }
+        virMutexUnlock(&stream->lock);
+
+        rc = virCompressWriteChunk(stream, chunk, &entries, &nentries,
+                                   &offset);
+
+        virMutexLock(&stream->lock);
+        if (rc < 0) {
+            virCompressStreamFail(stream);
+            break;
+        }
+
+        stream->slots[stream->nwritten++ % stream->nslots] = NULL;
+        virCompressChunkFree(chunk);
+        virCondBroadcast(&stream->cond);
+    }
+
+    if (!stream->failed &&
+        stream->flags & VIR_COMPRESS_STREAM_CHUNKED &&
+        !(stream->flags & VIR_COMPRESS_STREAM_DECOMPRESS)) {
+        virMutexUnlock(&stream->lock);
+        if (virCompressWriteIndex(stream, entries, nentries, offset) < 0) {
+            virMutexLock(&stream->lock);
+            virCompressStreamFail(stream);
+        } else {
+            virMutexLock(&stream->lock);
+        }
+    }
+    virMutexUnlock(&stream->lock);
+
+    /* Let the consumer know there's nothing more to come, even if we
+     * failed */
+    if (VIR_CLOSE(stream->outfd) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to close output stream"));
+        virMutexLock(&stream->lock);
+        virCompressStreamFail(stream);
+        virMutexUnlock(&stream->lock);
+    }
+    VIR_FREE(entries);
+}
+
+
+static void
+virCompressStreamJoin(virCompressStreamPtr stream)
+{
+    size_t i;
+
+    if (stream->joined)
+        return;
+
+    virThreadJoin(&stream->reader);
+    for (i = 0; i < stream->nworkers; i++)
+        virThreadJoin(&stream->workers[i]);
+    virThreadJoin(&stream->writer);
+    stream->joined = true;
+}
+
+
+/**
+ * virCompressStreamNew:
+ * @args: NULL terminated program and arguments (de)compressing stdin
+ *        to stdout
+ * @infd: file descriptor to read the data from
+ * @outfd: file descriptor to write the result to
+ * @nworkers: number of programs to run at the same time
+ * @chunkSize: amount of data to compress at once, 0 for the default
+ * @flags: bitwise-OR of virCompressStreamFlags
+ *
+ * Starts (de)compressing everything read from @infd into @outfd in
+ * background threads. The stream works on its own duplicates of @infd
+ * and @outfd, which it closes as soon as it is done with them, so the
+ * caller may close its copies right away.
+ *
+ * Returns the stream, which must be passed to virCompressStreamWait,
+ * or NULL on error.
+ */
+virCompressStreamPtr
+virCompressStreamNew(const char *const *args,
+                     int infd,
+                     int outfd,
+                     size_t nworkers,
+                     size_t chunkSize,
+                     unsigned int flags)
+{
+    virCompressStreamPtr stream = NULL;
+    size_t i;
+
+    virCheckFlags(VIR_COMPRESS_STREAM_DECOMPRESS |
+                  VIR_COMPRESS_STREAM_CHUNKED, NULL);
+
+    if (flags & VIR_COMPRESS_STREAM_DECOMPRESS &&
+        !(flags & VIR_COMPRESS_STREAM_CHUNKED)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("only chunked streams can be decompressed "
+                         "in parallel"));
+        return NULL;
+    }
+
+    if (VIR_ALLOC(stream) < 0)
+        return NULL;
+
+    stream->infd = -1;
+    stream->outfd = -1;
+    stream->flags = flags;
+    stream->chunkSize = chunkSize ? chunkSize : VIR_COMPRESS_CHUNK_SIZE;
+    stream->nworkers = nworkers ? nworkers : 1;
+    stream->nslots = stream->nworkers * VIR_COMPRESS_CHUNKS_PER_WORKER;
+    stream->stats.workers = stream->nworkers;
+
+    if (stream->chunkSize > VIR_COMPRESS_CHUNK_MAX) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("chunk size %zu is too big"), stream->chunkSize);
+        goto error;
+    }
+
+    for (i = 0; args[i]; i++)
+        ;
+    if (VIR_ALLOC_N(stream->args, i + 1) < 0)
+        goto error;
+    for (i = 0; args[i]; i++) {
+        if (VIR_STRDUP(stream->args[i], args[i]) < 0)
+            goto error;
+    }
+
+    if (VIR_ALLOC_N(stream->slots, stream->nslots) < 0 ||
+        VIR_ALLOC_N(stream->workers, stream->nworkers) < 0)
+        goto error;
+
+    if ((stream->infd = dup(infd)) < 0 ||
+        (stream->outfd = dup(outfd)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to duplicate file descriptor"));
+        goto error;
+    }
+
+    if (virSetCloseExec(stream->infd) < 0 ||
+        virSetCloseExec(stream->outfd) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to set cloexec flag"));
+        goto error;
+    }
+
+    if (virMutexInit(&stream->lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        goto error;
+    }
+
+    if (virCondInit(&stream->cond) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init cond"));
+        virMutexDestroy(&stream->lock);
+        goto error;
+    }
+
+    /* The reader goes last, it may block on reading the input until
+     * the caller makes the producer start, so it couldn't be joined if
+     * starting any other thread failed */
+    for (i = 0; i < stream->nworkers; i++) {
+        if (virThreadCreate(&stream->workers[i], true,
+                            virCompressWorker, stream) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("unable to create worker thread"));
+            goto error_threads;
+        }
+    }
+
+    if (virThreadCreate(&stream->writer, true,
+                        virCompressWriter, stream) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create writer thread"));
+        goto error_threads;
+    }
+
+    if (virThreadCreate(&stream->reader, true,
+                        virCompressReader, stream) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create reader thread"));
+        virMutexLock(&stream->lock);
+        virCompressStreamFail(stream);
+        virMutexUnlock(&stream->lock);
+        virThreadJoin(&stream->writer);
+        goto error_threads;
+    }
+
+    return stream;
+
+ error_threads:
+    virMutexLock(&stream->lock);
+    virCompressStreamFail(stream);
+    virMutexUnlock(&stream->lock);
+    while (i-- > 0)
+        virThreadJoin(&stream->workers[i]);
+    virCondDestroy(&stream->cond);
+    virMutexDestroy(&stream->lock);
+ error:
+    VIR_FORCE_CLOSE(stream->infd);
+    VIR_FORCE_CLOSE(stream->outfd);
+    virStringListFree(stream->args);
+    VIR_FREE(stream->slots);
+    VIR_FREE(stream->workers);
+    VIR_FREE(stream);
+    return NULL;
+}
+
+
+/**
+ * virCompressStreamAbort:
+ * @stream: the stream
+ *
+ * Makes all threads of @stream stop as soon as possible. Chunks being
+ * processed are finished first, the reader stops once its current read
+ * returns. virCompressStreamWait will report the stream as failed.
+ */
+void
+virCompressStreamAbort(virCompressStreamPtr stream)
+{
+    if (!stream)
+        return;
+
+    virMutexLock(&stream->lock);
+    if (!stream->failed) {
+        stream->failed = true;
+        stream->aborted = true;
+    }
+    virCondBroadcast(&stream->cond);
+    virMutexUnlock(&stream->lock);
+}
+
+
+/**
+ * virCompressStreamWait:
+ * @stream: the stream
+ *
+ * Waits until the whole input of @stream was processed and written.
+ *
+ * Returns 0 on success, -1 with an error reported if any stage of the
+ * stream failed or the stream was aborted.
+ */
+int
+virCompressStreamWait(virCompressStreamPtr stream)
+{
+    virCompressStreamJoin(stream);
+
+    if (stream->err) {
+        virSetError(stream->err);
+        return -1;
+    }
+
+    if (stream->failed) {
+        if (stream->aborted)
+            virReportError(VIR_ERR_OPERATION_ABORTED, "%s",
+                           _("compression was aborted"));
+        else
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("compression failed"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virCompressStreamGetStats:
+ * @stream: the stream
+ * @stats: filled with the progress of @stream
+ *
+ * May be called at any time from any thread.
+ */
+void
+virCompressStreamGetStats(virCompressStreamPtr stream,
+                          virCompressStatsPtr stats)
+{
+    virMutexLock(&stream->lock);
+    *stats = stream->stats;
+    virMutexUnlock(&stream->lock);
+}
+
+
+void
+virCompressStreamFree(virCompressStreamPtr stream)
+{
+    size_t i;
+
+    if (!stream)
+        return;
+
+    if (!stream->joined) {
+        virCompressStreamAbort(stream);
+        virCompressStreamJoin(stream);
+    }
+
+    for (i = 0; i < stream->nslots; i++)
+        virCompressChunkFree(stream->slots[i]);
+    VIR_FREE(stream->slots);
+    VIR_FREE(stream->workers);
+    virStringListFree(stream->args);
+    virFreeError(stream->err);
+    VIR_FORCE_CLOSE(stream->infd);
+    VIR_FORCE_CLOSE(stream->outfd);
+    virCondDestroy(&stream->cond);
+    virMutexDestroy(&stream->lock);
+    VIR_FREE(stream);
+}
@@ -0,0 +1,70 @@
+/*
+ * vircompress.h: parallel compression of a stream by external programs
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_COMPRESS_H__
+# define __VIR_COMPRESS_H__
+
+# include "internal.h"
+
+/* Default amount of uncompressed data compressed as one chunk */
+# define VIR_COMPRESS_CHUNK_SIZE (8 * 1024 * 1024)
+
+typedef enum {
+    /* Decompress a stream written with VIR_COMPRESS_STREAM_CHUNKED */
+    VIR_COMPRESS_STREAM_DECOMPRESS = (1 << 0),
+    /* Frame every compressed chunk and append an index of the chunks,
+     * rather than just concatenating the compressed chunks */
+    VIR_COMPRESS_STREAM_CHUNKED = (1 << 1),
+} virCompressStreamFlags;
+
+typedef struct _virCompressStream virCompressStream;
+typedef virCompressStream *virCompressStreamPtr;
+
+typedef struct _virCompressStats virCompressStats;
+typedef virCompressStats *virCompressStatsPtr;
+struct _virCompressStats {
+    size_t workers;                   /* number of worker threads */
+    unsigned long long readBytes;     /* bytes read from the input */
+    unsigned long long readTime;      /* ms spent waiting for the input */
+    unsigned long long processBytes;  /* bytes fed to the program */
+    unsigned long long processTime;   /* ms spent running the program,
+                                         summed over all workers */
+    unsigned long long writeBytes;    /* bytes written to the output */
+    unsigned long long writeTime;     /* ms spent writing the output */
+};
+
+virCompressStreamPtr virCompressStreamNew(const char *const *args,
+                                          int infd,
+                                          int outfd,
+                                          size_t nworkers,
+                                          size_t chunkSize,
+                                          unsigned int flags)
+    ATTRIBUTE_NONNULL(1);
+
+void virCompressStreamAbort(virCompressStreamPtr stream);
+
+int virCompressStreamWait(virCompressStreamPtr stream);
+
+void virCompressStreamGetStats(virCompressStreamPtr stream,
+                               virCompressStatsPtr stats);
+
+void virCompressStreamFree(virCompressStreamPtr stream);
+
+#endif /* __VIR_COMPRESS_H__ */
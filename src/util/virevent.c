@@ -260,6 +260,11 @@ void virEventRegisterImpl(virEventAddHandleFunc addHandle,
  * wakes up on events registered by libvirt API calls such as
  * virEventAddHandle() or virConnectDomainEventRegisterAny().
  *
+ * On Linux, setting the LIBVIRT_EVENT_LOOP environment variable to
+ * "epoll" selects an implementation based on epoll() instead, which
+ * scales better with large numbers of file handles. File handles must
+ * then be unregistered before they are closed.
+ *
  * Returns 0 on success, -1 on failure.
  */
 int virEventRegisterDefaultImpl(void)
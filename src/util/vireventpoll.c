@@ -30,6 +30,10 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+# include <sys/stat.h>
+#endif
 
 #include "virthread.h"
 #include "virlog.h"
@@ -40,6 +44,7 @@
 #include "virerror.h"
 #include "virprobe.h"
 #include "virtime.h"
+#include "viratomic.h"
 
 #define EVENT_DEBUG(fmt, ...) VIR_DEBUG(fmt, __VA_ARGS__)
 
@@ -47,7 +52,19 @@
 
 VIR_LOG_INIT("util.eventpoll");
 
-static int virEventPollInterruptLocked(void);
+static int virEventPollInterruptLocked(virEventPollLoopPtr loop);
+
+typedef enum {
+    VIR_EVENT_POLL_BACKEND_POLL = 0,
+    VIR_EVENT_POLL_BACKEND_EPOLL,
+
+    VIR_EVENT_POLL_BACKEND_LAST
+} virEventPollBackend;
+
+VIR_ENUM_DECL(virEventPollBackend)
+VIR_ENUM_IMPL(virEventPollBackend, VIR_EVENT_POLL_BACKEND_LAST,
+              "poll",
+              "epoll")
 
 /* State for a single file handle being monitored */
 struct virEventPollHandle {
@@ -58,6 +75,13 @@ struct virEventPollHandle {
     virFreeCallback ff;
     void *opaque;
     int deleted;
+
+    /* Only used by the epoll backend */
+    bool registered; /* fd is in the epoll set, keyed by this watch */
+    bool shared;     /* fd is in the epoll set, shared with other watches */
+    bool unpollable; /* fd refused by epoll, reported as always ready */
+    dev_t dev;       /* identity of the file @fd referred to when the */
+    ino_t ino;       /* handle was added */
 };
 
 /* State for a single timer being generated */
@@ -69,24 +93,52 @@ struct virEventPollTimeout {
     virFreeCallback ff;
     void *opaque;
     int deleted;
+    ssize_t heapIndex; /* position in the timeout heap, -1 if disarmed */
 };
 
 /* Allocate extra slots for virEventPollHandle/virEventPollTimeout
    records in this multiple */
 #define EVENT_ALLOC_EXTENT 10
 
-/* State for the main event loop */
+/* Maximum number of events fetched by a single epoll_wait() */
+#define EVENT_EPOLL_MAX_EVENTS 128
+
+/* epoll_event data of a fd watched by more than one handle. The
+ * lower bits carry the fd, rather than the watch */
+#define EVENT_EPOLL_SHARED (1ULL << 32)
+
+/* State for the main event loop
+ *
+ * Handles and timeouts are only ever appended, so both lists
+ * are sorted by their watch / timer id and can be searched by
+ * bisection. Armed timeouts are additionally kept in a binary
+ * min-heap ordered by expiry time.
+ */
 struct virEventPollLoop {
     virMutex lock;
     int running;
     virThread leader;
     int wakeupfd[2];
+    int backend;
     size_t handlesCount;
     size_t handlesAlloc;
+    size_t handlesDeleted;
     struct virEventPollHandle *handles;
     size_t timeoutsCount;
     size_t timeoutsAlloc;
-    struct virEventPollTimeout *timeouts;
+    size_t timeoutsDeleted;
+    struct virEventPollTimeout **timeouts;
+    size_t timeoutHeapCount;
+    size_t timeoutHeapAlloc;
+    struct virEventPollTimeout **timeoutHeap;
+    size_t timeoutsDueAlloc;
+    struct virEventPollTimeout **timeoutsDue;
+#ifdef HAVE_SYS_EPOLL_H
+    int epollfd;
+    bool epollStale; /* the epoll set may watch files already closed */
+    size_t handlesUnpollable;
+    struct epoll_event epollEvents[EVENT_EPOLL_MAX_EVENTS];
+#endif
 };
 
 /* Only have one event loop */
@@ -98,54 +150,474 @@ static int nextWatch = 1;
 /* Unique ID for the next timer to be registered */
 static int nextTimer = 1;
 
+
+static ssize_t
+virEventPollFindHandle(virEventPollLoopPtr loop, int watch)
+{
+    size_t lo = 0;
+    size_t hi = loop->handlesCount;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (loop->handles[mid].watch < watch)
+            lo = mid + 1;
+        else if (loop->handles[mid].watch > watch)
+            hi = mid;
+        else
+            return mid;
+    }
+
+    return -1;
+}
+
+
+static struct virEventPollTimeout *
+virEventPollFindTimeout(virEventPollLoopPtr loop, int timer)
+{
+    size_t lo = 0;
+    size_t hi = loop->timeoutsCount;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (loop->timeouts[mid]->timer < timer)
+            lo = mid + 1;
+        else if (loop->timeouts[mid]->timer > timer)
+            hi = mid;
+        else
+            return loop->timeouts[mid];
+    }
+
+    return NULL;
+}
+
+
+static bool
+virEventPollTimeoutBefore(const struct virEventPollTimeout *a,
+                          const struct virEventPollTimeout *b)
+{
+    if (a->expiresAt != b->expiresAt)
+        return a->expiresAt < b->expiresAt;
+    return a->timer < b->timer;
+}
+
+
+static void
+virEventPollTimeoutHeapSet(virEventPollLoopPtr loop,
+                           size_t pos,
+                           struct virEventPollTimeout *t)
+{
+    loop->timeoutHeap[pos] = t;
+    t->heapIndex = pos;
+}
+
+
+static void
+virEventPollTimeoutHeapSiftUp(virEventPollLoopPtr loop, size_t pos)
+{
+    struct virEventPollTimeout *t = loop->timeoutHeap[pos];
+
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+
+        if (!virEventPollTimeoutBefore(t, loop->timeoutHeap[parent]))
+            break;
+
+        virEventPollTimeoutHeapSet(loop, pos, loop->timeoutHeap[parent]);
+        pos = parent;
+    }
+
+    virEventPollTimeoutHeapSet(loop, pos, t);
+}
+
+
+static void
+virEventPollTimeoutHeapSiftDown(virEventPollLoopPtr loop, size_t pos)
+{
+    struct virEventPollTimeout *t = loop->timeoutHeap[pos];
+    size_t child;
+
+    while ((child = 2 * pos + 1) < loop->timeoutHeapCount) {
+        if (child + 1 < loop->timeoutHeapCount &&
+            virEventPollTimeoutBefore(loop->timeoutHeap[child + 1],
+                                      loop->timeoutHeap[child]))
+            child++;
+
+        if (!virEventPollTimeoutBefore(loop->timeoutHeap[child], t))
+            break;
+
+        virEventPollTimeoutHeapSet(loop, pos, loop->timeoutHeap[child]);
+        pos = child;
+    }
+
+    virEventPollTimeoutHeapSet(loop, pos, t);
+}
+
+
+/*
+ * Insert, move or remove @t in the timeout heap, so that the
+ * heap holds exactly the timers which are neither deleted nor
+ * disabled. The heap always has room for every registered timer
+ * so this can't fail.
+ */
+static void
+virEventPollTimeoutHeapUpdate(virEventPollLoopPtr loop,
+                              struct virEventPollTimeout *t)
+{
+    bool armed = !t->deleted && t->frequency >= 0;
+    struct virEventPollTimeout *last;
+    size_t pos;
+
+    if (t->heapIndex < 0) {
+        if (!armed)
+            return;
+
+        virEventPollTimeoutHeapSet(loop, loop->timeoutHeapCount++, t);
+        virEventPollTimeoutHeapSiftUp(loop, t->heapIndex);
+        return;
+    }
+
+    if (armed) {
+        virEventPollTimeoutHeapSiftUp(loop, t->heapIndex);
+        virEventPollTimeoutHeapSiftDown(loop, t->heapIndex);
+        return;
+    }
+
+    pos = t->heapIndex;
+    t->heapIndex = -1;
+    last = loop->timeoutHeap[--loop->timeoutHeapCount];
+    if (last == t)
+        return;
+
+    virEventPollTimeoutHeapSet(loop, pos, last);
+    virEventPollTimeoutHeapSiftUp(loop, pos);
+    virEventPollTimeoutHeapSiftDown(loop, last->heapIndex);
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+static int
+virEventPollToEpollEvents(int events)
+{
+    int ret = 0;
+    if (events & POLLIN)
+        ret |= EPOLLIN;
+    if (events & POLLOUT)
+        ret |= EPOLLOUT;
+    if (events & POLLERR)
+        ret |= EPOLLERR;
+    if (events & POLLHUP)
+        ret |= EPOLLHUP;
+    return ret;
+}
+
+
+static int
+virEventPollFromEpollEvents(int events)
+{
+    int ret = 0;
+    if (events & EPOLLIN)
+        ret |= POLLIN;
+    if (events & EPOLLOUT)
+        ret |= POLLOUT;
+    if (events & EPOLLERR)
+        ret |= POLLERR;
+    if (events & EPOLLHUP)
+        ret |= POLLHUP;
+    return ret;
+}
+
+
+static int
+virEventPollEpollCtl(virEventPollLoopPtr loop,
+                     int op, int fd, int events, uint64_t data)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = virEventPollToEpollEvents(events);
+    ev.data.u64 = data;
+
+    return epoll_ctl(loop->epollfd, op, fd, &ev);
+}
+
+
+static int
+virEventPollEpollDel(virEventPollLoopPtr loop, int fd)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    if (epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, fd, &ev) < 0 &&
+        errno != ENOENT && errno != EBADF) {
+        virReportSystemError(errno,
+                             _("Unable to remove fd %d from epoll set"), fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * epoll allows each fd to be registered only once, so when several
+ * handles watch the same fd it is registered with the union of their
+ * events and keyed by the fd itself. This is rare enough that it
+ * doesn't matter that it needs a scan of all handles.
+ */
+static int
+virEventPollEpollSyncShared(virEventPollLoopPtr loop, int fd)
+{
+    size_t i;
+    int events = 0;
+
+    for (i = 0; i < loop->handlesCount; i++) {
+        struct virEventPollHandle *h = &loop->handles[i];
+
+        if (h->fd != fd || h->deleted)
+            continue;
+
+        h->shared = true;
+        h->registered = false;
+        events |= h->events;
+    }
+
+    if (events == 0)
+        return virEventPollEpollDel(loop, fd);
+
+    if (virEventPollEpollCtl(loop, EPOLL_CTL_MOD, fd, events,
+                             EVENT_EPOLL_SHARED | (unsigned int) fd) < 0 &&
+        (errno != ENOENT ||
+         virEventPollEpollCtl(loop, EPOLL_CTL_ADD, fd, events,
+                              EVENT_EPOLL_SHARED | (unsigned int) fd) < 0)) {
+        virReportSystemError(errno,
+                             _("Unable to add fd %d to epoll set"), fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+virEventPollEpollSetFile(struct virEventPollHandle *h)
+{
+    struct stat sb;
+
+    if (fstat(h->fd, &sb) < 0)
+        return;
+
+    h->dev = sb.st_dev;
+    h->ino = sb.st_ino;
+}
+
+
+static bool
+virEventPollEpollSameFile(struct virEventPollHandle *h)
+{
+    struct stat sb;
+
+    return fstat(h->fd, &sb) == 0 &&
+        sb.st_dev == h->dev && sb.st_ino == h->ino;
+}
+
+
+/*
+ * The epoll set is keyed by files rather than fd numbers. If a fd
+ * was closed before its handle was removed, the kernel has dropped
+ * it from the set unless the file was still open elsewhere (e.g. a
+ * dup() or a forked child), in which case it stays in the set with
+ * no way to remove it, and its number may already be reused. Leave
+ * the set alone rather than remove someone else's file, and have it
+ * rebuilt from scratch before the next wait.
+ */
+static bool
+virEventPollEpollCheckStale(virEventPollLoopPtr loop,
+                            struct virEventPollHandle *h)
+{
+    if (!h->deleted || !(h->registered || h->shared) ||
+        virEventPollEpollSameFile(h))
+        return false;
+
+    VIR_WARN("fd %d of watch %d was closed before the watch was removed",
+             h->fd, h->watch);
+    h->registered = false;
+    h->shared = false;
+    loop->epollStale = true;
+    return true;
+}
+
+
+/*
+ * Bring the epoll set in line with the current events and deleted
+ * state of @h. Called with the event loop locked.
+ */
+static int
+virEventPollEpollUpdateHandle(virEventPollLoopPtr loop,
+                              struct virEventPollHandle *h)
+{
+    if (virEventPollEpollCheckStale(loop, h))
+        return 0;
+
+    if (h->shared)
+        return virEventPollEpollSyncShared(loop, h->fd);
+
+    /* Handles which don't want any events must not count as
+     * always ready, or they would keep the loop spinning. They
+     * are tried with epoll again once they are enabled. */
+    if (h->unpollable) {
+        if (h->deleted || h->events == 0) {
+            h->unpollable = false;
+            loop->handlesUnpollable--;
+        }
+        return 0;
+    }
+
+    if (h->deleted || h->events == 0) {
+        if (!h->registered)
+            return 0;
+        h->registered = false;
+        return virEventPollEpollDel(loop, h->fd);
+    }
+
+    if (virEventPollEpollCtl(loop, h->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                             h->fd, h->events, h->watch) < 0) {
+        /* Another handle already watches this fd */
+        if (errno == EEXIST)
+            return virEventPollEpollSyncShared(loop, h->fd);
+
+        /* Regular files and some character devices can't be used
+         * with epoll, but poll() always reports them ready */
+        if (errno == EPERM) {
+            VIR_DEBUG("fd %d can't be polled, treating as always ready",
+                      h->fd);
+            h->unpollable = true;
+            loop->handlesUnpollable++;
+            return 0;
+        }
+
+        /* The fd was closed and its number reused */
+        if (errno == ENOENT && h->registered) {
+            VIR_WARN("fd %d of watch %d was replaced while being watched",
+                     h->fd, h->watch);
+            loop->epollStale = true;
+            return 0;
+        }
+
+        virReportSystemError(errno,
+                             _("Unable to add fd %d to epoll set"), h->fd);
+        return -1;
+    }
+
+    h->registered = true;
+    return 0;
+}
+
+
+/*
+ * Replace the epoll set with a new one holding the handles which
+ * are still registered, dropping any stale entries.
+ */
+static int
+virEventPollEpollRebuild(virEventPollLoopPtr loop)
+{
+    int epollfd;
+    size_t i;
+
+    VIR_DEBUG("Rebuilding epoll set of %zu handles", loop->handlesCount);
+
+    if ((epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create epoll instance"));
+        return -1;
+    }
+
+    VIR_FORCE_CLOSE(loop->epollfd);
+    loop->epollfd = epollfd;
+    loop->epollStale = false;
+    loop->handlesUnpollable = 0;
+
+    for (i = 0; i < loop->handlesCount; i++) {
+        struct virEventPollHandle *h = &loop->handles[i];
+
+        h->registered = h->shared = h->unpollable = false;
+        if (h->deleted)
+            continue;
+
+        virEventPollEpollSetFile(h);
+        ignore_value(virEventPollEpollUpdateHandle(loop, h));
+    }
+
+    return 0;
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
 /*
  * Register a callback for monitoring file handle events.
  * NB, it *must* be safe to call this from within a callback
  * For this reason we only ever append to existing list.
  */
-int virEventPollAddHandle(int fd, int events,
-                          virEventHandleCallback cb,
-                          void *opaque,
-                          virFreeCallback ff)
+int virEventPollLoopAddHandle(virEventPollLoopPtr loop,
+                              int fd, int events,
+                              virEventHandleCallback cb,
+                              void *opaque,
+                              virFreeCallback ff)
 {
+    struct virEventPollHandle *h;
     int watch;
-    virMutexLock(&eventLoop.lock);
-    if (eventLoop.handlesCount == eventLoop.handlesAlloc) {
+    virMutexLock(&loop->lock);
+    if (loop->handlesCount == loop->handlesAlloc) {
         EVENT_DEBUG("Used %zu handle slots, adding at least %d more",
-                    eventLoop.handlesAlloc, EVENT_ALLOC_EXTENT);
-        if (VIR_RESIZE_N(eventLoop.handles, eventLoop.handlesAlloc,
-                         eventLoop.handlesCount, EVENT_ALLOC_EXTENT) < 0) {
-            virMutexUnlock(&eventLoop.lock);
+                    loop->handlesAlloc, EVENT_ALLOC_EXTENT);
+        if (VIR_RESIZE_N(loop->handles, loop->handlesAlloc,
+                         loop->handlesCount, EVENT_ALLOC_EXTENT) < 0) {
+            virMutexUnlock(&loop->lock);
             return -1;
         }
     }
 
-    watch = nextWatch++;
-
-    eventLoop.handles[eventLoop.handlesCount].watch = watch;
-    eventLoop.handles[eventLoop.handlesCount].fd = fd;
-    eventLoop.handles[eventLoop.handlesCount].events =
-                                         virEventPollToNativeEvents(events);
-    eventLoop.handles[eventLoop.handlesCount].cb = cb;
-    eventLoop.handles[eventLoop.handlesCount].ff = ff;
-    eventLoop.handles[eventLoop.handlesCount].opaque = opaque;
-    eventLoop.handles[eventLoop.handlesCount].deleted = 0;
-
-    eventLoop.handlesCount++;
+    /* Watches are unique across all loops, and still increasing
+     * within any one of them since we're holding its lock */
+    watch = virAtomicIntAdd(&nextWatch, 1);
+
+    h = &loop->handles[loop->handlesCount];
+    memset(h, 0, sizeof(*h));
+    h->watch = watch;
+    h->fd = fd;
+    h->events = virEventPollToNativeEvents(events);
+    h->cb = cb;
+    h->ff = ff;
+    h->opaque = opaque;
+    h->deleted = 0;
+
+    loop->handlesCount++;
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (loop->backend == VIR_EVENT_POLL_BACKEND_EPOLL)
+        virEventPollEpollSetFile(h);
+    if (loop->backend == VIR_EVENT_POLL_BACKEND_EPOLL &&
+        virEventPollEpollUpdateHandle(loop, h) < 0) {
+        loop->handlesCount--;
+        virMutexUnlock(&loop->lock);
+        return -1;
+    }
+#endif
 
-    virEventPollInterruptLocked();
+    virEventPollInterruptLocked(loop);
 
     PROBE(EVENT_POLL_ADD_HANDLE,
           "watch=%d fd=%d events=%d cb=%p opaque=%p ff=%p",
           watch, fd, events, cb, opaque, ff);
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
     return watch;
 }
 
-void virEventPollUpdateHandle(int watch, int events)
+void virEventPollLoopUpdateHandle(virEventPollLoopPtr loop,
+                                  int watch, int events)
 {
-    size_t i;
+    ssize_t i;
     bool found = false;
     PROBE(EVENT_POLL_UPDATE_HANDLE,
           "watch=%d events=%d",
@@ -156,17 +628,18 @@ void virEventPollUpdateHandle(int watch, int events)
         return;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].watch == watch) {
-            eventLoop.handles[i].events =
-                    virEventPollToNativeEvents(events);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+    virMutexLock(&loop->lock);
+    if ((i = virEventPollFindHandle(loop, watch)) >= 0) {
+        loop->handles[i].events =
+                virEventPollToNativeEvents(events);
+#ifdef HAVE_SYS_EPOLL_H
+        if (loop->backend == VIR_EVENT_POLL_BACKEND_EPOLL)
+            ignore_value(virEventPollEpollUpdateHandle(loop, &loop->handles[i]));
+#endif
+        virEventPollInterruptLocked(loop);
+        found = true;
     }
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
     if (!found)
         VIR_WARN("Got update for non-existent handle watch %d", watch);
@@ -178,9 +651,9 @@ void virEventPollUpdateHandle(int watch, int events)
  * For this reason we only ever set a flag in the existing list.
  * Actual deletion will be done out-of-band
  */
-int virEventPollRemoveHandle(int watch)
+int virEventPollLoopRemoveHandle(virEventPollLoopPtr loop, int watch)
 {
-    size_t i;
+    ssize_t i;
     PROBE(EVENT_POLL_REMOVE_HANDLE,
           "watch=%d",
           watch);
@@ -190,21 +663,25 @@ int virEventPollRemoveHandle(int watch)
         return -1;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].deleted)
-            continue;
-
-        if (eventLoop.handles[i].watch == watch) {
-            EVENT_DEBUG("mark delete %zu %d", i, eventLoop.handles[i].fd);
-            eventLoop.handles[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    virMutexLock(&loop->lock);
+    if ((i = virEventPollFindHandle(loop, watch)) < 0 ||
+        loop->handles[i].deleted) {
+        virMutexUnlock(&loop->lock);
+        return -1;
     }
-    virMutexUnlock(&eventLoop.lock);
-    return -1;
+
+    EVENT_DEBUG("mark delete %zd %d", i, loop->handles[i].fd);
+    loop->handles[i].deleted = 1;
+    loop->handlesDeleted++;
+#ifdef HAVE_SYS_EPOLL_H
+    /* Drop the fd from the epoll set right away, since the
+     * caller is free to close it as soon as we return */
+    if (loop->backend == VIR_EVENT_POLL_BACKEND_EPOLL)
+        ignore_value(virEventPollEpollUpdateHandle(loop, &loop->handles[i]));
+#endif
+    virEventPollInterruptLocked(loop);
+    virMutexUnlock(&loop->lock);
+    return 0;
 }
 
 
@@ -213,52 +690,69 @@ int virEventPollRemoveHandle(int watch)
  * NB, it *must* be safe to call this from within a callback
  * For this reason we only ever append to existing list.
  */
-int virEventPollAddTimeout(int frequency,
-                           virEventTimeoutCallback cb,
-                           void *opaque,
-                           virFreeCallback ff)
+int virEventPollLoopAddTimeout(virEventPollLoopPtr loop,
+                               int frequency,
+                               virEventTimeoutCallback cb,
+                               void *opaque,
+                               virFreeCallback ff)
 {
+    struct virEventPollTimeout *t;
     unsigned long long now;
     int ret;
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
 
-    virMutexLock(&eventLoop.lock);
-    if (eventLoop.timeoutsCount == eventLoop.timeoutsAlloc) {
+    if (VIR_ALLOC(t) < 0)
+        return -1;
+
+    virMutexLock(&loop->lock);
+    if (loop->timeoutsCount == loop->timeoutsAlloc) {
         EVENT_DEBUG("Used %zu timeout slots, adding at least %d more",
-                    eventLoop.timeoutsAlloc, EVENT_ALLOC_EXTENT);
-        if (VIR_RESIZE_N(eventLoop.timeouts, eventLoop.timeoutsAlloc,
-                         eventLoop.timeoutsCount, EVENT_ALLOC_EXTENT) < 0) {
-            virMutexUnlock(&eventLoop.lock);
+                    loop->timeoutsAlloc, EVENT_ALLOC_EXTENT);
+        if (VIR_RESIZE_N(loop->timeouts, loop->timeoutsAlloc,
+                         loop->timeoutsCount, EVENT_ALLOC_EXTENT) < 0) {
+            virMutexUnlock(&loop->lock);
+            VIR_FREE(t);
             return -1;
         }
     }
 
-    eventLoop.timeouts[eventLoop.timeoutsCount].timer = nextTimer++;
-    eventLoop.timeouts[eventLoop.timeoutsCount].frequency = frequency;
-    eventLoop.timeouts[eventLoop.timeoutsCount].cb = cb;
-    eventLoop.timeouts[eventLoop.timeoutsCount].ff = ff;
-    eventLoop.timeouts[eventLoop.timeoutsCount].opaque = opaque;
-    eventLoop.timeouts[eventLoop.timeoutsCount].deleted = 0;
-    eventLoop.timeouts[eventLoop.timeoutsCount].expiresAt =
-        frequency >= 0 ? frequency + now : 0;
+    /* Make sure the heap can take every timer, so that
+     * arming one later on can't fail */
+    if (VIR_RESIZE_N(loop->timeoutHeap, loop->timeoutHeapAlloc,
+                     loop->timeoutsCount, 1) < 0) {
+        virMutexUnlock(&loop->lock);
+        VIR_FREE(t);
+        return -1;
+    }
+
+    t->timer = virAtomicIntAdd(&nextTimer, 1);
+    t->frequency = frequency;
+    t->cb = cb;
+    t->ff = ff;
+    t->opaque = opaque;
+    t->deleted = 0;
+    t->expiresAt = frequency >= 0 ? frequency + now : 0;
+    t->heapIndex = -1;
 
-    eventLoop.timeoutsCount++;
-    ret = nextTimer-1;
-    virEventPollInterruptLocked();
+    loop->timeouts[loop->timeoutsCount++] = t;
+    virEventPollTimeoutHeapUpdate(loop, t);
+    ret = t->timer;
+    virEventPollInterruptLocked(loop);
 
     PROBE(EVENT_POLL_ADD_TIMEOUT,
           "timer=%d frequency=%d cb=%p opaque=%p ff=%p",
           ret, frequency, cb, opaque, ff);
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
     return ret;
 }
 
-void virEventPollUpdateTimeout(int timer, int frequency)
+void virEventPollLoopUpdateTimeout(virEventPollLoopPtr loop,
+                                   int timer, int frequency)
 {
+    struct virEventPollTimeout *t;
     unsigned long long now;
-    size_t i;
     bool found = false;
     PROBE(EVENT_POLL_UPDATE_TIMEOUT,
           "timer=%d frequency=%d",
@@ -272,20 +766,17 @@ void virEventPollUpdateTimeout(int timer, int frequency)
     if (virTimeMillisNow(&now) < 0)
         return;
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].frequency = frequency;
-            eventLoop.timeouts[i].expiresAt =
-                frequency >= 0 ? frequency + now : 0;
-            VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
-                      eventLoop.timeouts[i].expiresAt);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+    virMutexLock(&loop->lock);
+    if ((t = virEventPollFindTimeout(loop, timer))) {
+        t->frequency = frequency;
+        t->expiresAt = frequency >= 0 ? frequency + now : 0;
+        virEventPollTimeoutHeapUpdate(loop, t);
+        VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
+                  t->expiresAt);
+        virEventPollInterruptLocked(loop);
+        found = true;
     }
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
     if (!found)
         VIR_WARN("Got update for non-existent timer %d", timer);
@@ -297,9 +788,9 @@ void virEventPollUpdateTimeout(int timer, int frequency)
  * For this reason we only ever set a flag in the existing list.
  * Actual deletion will be done out-of-band
  */
-int virEventPollRemoveTimeout(int timer)
+int virEventPollLoopRemoveTimeout(virEventPollLoopPtr loop, int timer)
 {
-    size_t i;
+    struct virEventPollTimeout *t;
     PROBE(EVENT_POLL_REMOVE_TIMEOUT,
           "timer=%d",
           timer);
@@ -309,44 +800,34 @@ int virEventPollRemoveTimeout(int timer)
         return -1;
     }
 
-    virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    virMutexLock(&loop->lock);
+    if (!(t = virEventPollFindTimeout(loop, timer)) || t->deleted) {
+        virMutexUnlock(&loop->lock);
+        return -1;
     }
-    virMutexUnlock(&eventLoop.lock);
-    return -1;
+
+    t->deleted = 1;
+    loop->timeoutsDeleted++;
+    virEventPollTimeoutHeapUpdate(loop, t);
+    virEventPollInterruptLocked(loop);
+    virMutexUnlock(&loop->lock);
+    return 0;
 }
 
-/* Iterates over all registered timeouts and determine which
- * will be the first to expire.
+/* Determine which of the registered timeouts will be the
+ * first to expire, which is simply the top of the heap.
  * @timeout: filled with expiry time of soonest timer, or -1 if
  *           no timeout is pending
  * returns: 0 on success, -1 on error
  */
-static int virEventPollCalculateTimeout(int *timeout)
+static int virEventPollCalculateTimeout(virEventPollLoopPtr loop, int *timeout)
 {
     unsigned long long then = 0;
-    size_t i;
-    EVENT_DEBUG("Calculate expiry of %zu timers", eventLoop.timeoutsCount);
+    EVENT_DEBUG("Calculate expiry of %zu timers", loop->timeoutHeapCount);
     /* Figure out if we need a timeout */
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-        if (eventLoop.timeouts[i].frequency < 0)
-            continue;
-
-        EVENT_DEBUG("Got a timeout scheduled for %llu", eventLoop.timeouts[i].expiresAt);
-        if (then == 0 ||
-            eventLoop.timeouts[i].expiresAt < then)
-            then = eventLoop.timeouts[i].expiresAt;
+    if (loop->timeoutHeapCount > 0) {
+        then = loop->timeoutHeap[0]->expiresAt;
+        EVENT_DEBUG("Got a timeout scheduled for %llu", then);
     }
 
     /* Calculate how long we should wait for a timeout if needed */
@@ -378,13 +859,14 @@ static int virEventPollCalculateTimeout(int *timeout)
  * file handles. The caller must free the returned data struct
  * returns: the pollfd array, or NULL on error
  */
-static struct pollfd *virEventPollMakePollFDs(int *nfds) {
+static struct pollfd *virEventPollMakePollFDs(virEventPollLoopPtr loop,
+                                              int *nfds) {
     struct pollfd *fds;
     size_t i;
 
     *nfds = 0;
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].events && !eventLoop.handles[i].deleted)
+    for (i = 0; i < loop->handlesCount; i++) {
+        if (loop->handles[i].events && !loop->handles[i].deleted)
             (*nfds)++;
     }
 
@@ -393,16 +875,16 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
         return NULL;
 
     *nfds = 0;
-    for (i = 0; i < eventLoop.handlesCount; i++) {
+    for (i = 0; i < loop->handlesCount; i++) {
         EVENT_DEBUG("Prepare n=%zu w=%d, f=%d e=%d d=%d", i,
-                    eventLoop.handles[i].watch,
-                    eventLoop.handles[i].fd,
-                    eventLoop.handles[i].events,
-                    eventLoop.handles[i].deleted);
-        if (!eventLoop.handles[i].events || eventLoop.handles[i].deleted)
+                    loop->handles[i].watch,
+                    loop->handles[i].fd,
+                    loop->handles[i].events,
+                    loop->handles[i].deleted);
+        if (!loop->handles[i].events || loop->handles[i].deleted)
             continue;
-        fds[*nfds].fd = eventLoop.handles[i].fd;
-        fds[*nfds].events = eventLoop.handles[i].events;
+        fds[*nfds].fd = loop->handles[i].fd;
+        fds[*nfds].events = loop->handles[i].events;
         fds[*nfds].revents = 0;
         (*nfds)++;
     }
@@ -411,57 +893,134 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
 }
 
 
+static int
+virEventPollTimeoutCompareID(const void *a,
+                             const void *b)
+{
+    const struct virEventPollTimeout *ta = *(struct virEventPollTimeout **)a;
+    const struct virEventPollTimeout *tb = *(struct virEventPollTimeout **)b;
+
+    return ta->timer < tb->timer ? -1 : ta->timer > tb->timer;
+}
+
+
 /*
- * Iterate over all timers and determine if any have expired.
- * Invoke the user supplied callback for each timer whose
- * expiry time is met, and schedule the next timeout. Does
- * not try to 'catch up' on time if the actual expiry time
- * was later than the requested time.
+ * Determine which timers have expired, invoke the user
+ * supplied callback for each of them, and schedule the next
+ * timeout. Does not try to 'catch up' on time if the actual
+ * expiry time was later than the requested time.
  *
  * This method must cope with new timers being registered
  * by a callback, and must skip any timers marked as deleted.
  *
  * Returns 0 upon success, -1 if an error occurred
  */
-static int virEventPollDispatchTimeouts(void)
+static int virEventPollDispatchTimeouts(virEventPollLoopPtr loop)
 {
     unsigned long long now;
+    size_t ndue = 0;
     size_t i;
-    /* Save this now - it may be changed during dispatch */
-    int ntimeouts = eventLoop.timeoutsCount;
-    VIR_DEBUG("Dispatch %d", ntimeouts);
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
 
-    for (i = 0; i < ntimeouts; i++) {
-        if (eventLoop.timeouts[i].deleted || eventLoop.timeouts[i].frequency < 0)
-            continue;
+    /* Add 20ms fuzz so we don't pointlessly spin doing
+     * <10ms sleeps, particularly on kernels with low HZ
+     * it is fine that a timer expires 20ms earlier than
+     * requested
+     */
+    if (loop->timeoutHeapCount == 0 ||
+        loop->timeoutHeap[0]->expiresAt > (now+20)) {
+        VIR_DEBUG("Dispatch %zu", ndue);
+        return 0;
+    }
+
+    if (VIR_RESIZE_N(loop->timeoutsDue, loop->timeoutsDueAlloc,
+                     0, loop->timeoutHeapCount) < 0)
+        return -1;
 
-        /* Add 20ms fuzz so we don't pointlessly spin doing
-         * <10ms sleeps, particularly on kernels with low HZ
-         * it is fine that a timer expires 20ms earlier than
-         * requested
-         */
-        if (eventLoop.timeouts[i].expiresAt <= (now+20)) {
-            virEventTimeoutCallback cb = eventLoop.timeouts[i].cb;
-            int timer = eventLoop.timeouts[i].timer;
-            void *opaque = eventLoop.timeouts[i].opaque;
-            eventLoop.timeouts[i].expiresAt =
-                now + eventLoop.timeouts[i].frequency;
-
-            PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
-                  "timer=%d",
-                  timer);
-            virMutexUnlock(&eventLoop.lock);
-            (cb)(timer, opaque);
-            virMutexLock(&eventLoop.lock);
+    /* Collect the expired timers up front, walking only the part
+     * of the heap above the first timer which isn't due yet. New
+     * timers registered by a callback are left for the next run */
+    loop->timeoutsDue[ndue++] = loop->timeoutHeap[0];
+    for (i = 0; i < ndue; i++) {
+        size_t child = 2 * loop->timeoutsDue[i]->heapIndex + 1;
+        size_t j;
+
+        for (j = child; j < child + 2 && j < loop->timeoutHeapCount; j++) {
+            if (loop->timeoutHeap[j]->expiresAt <= (now+20))
+                loop->timeoutsDue[ndue++] = loop->timeoutHeap[j];
         }
     }
+
+    /* Dispatch in registration order, as callers may rely on it */
+    qsort(loop->timeoutsDue, ndue, sizeof(*loop->timeoutsDue),
+          virEventPollTimeoutCompareID);
+    VIR_DEBUG("Dispatch %zu", ndue);
+
+    for (i = 0; i < ndue; i++) {
+        struct virEventPollTimeout *t = loop->timeoutsDue[i];
+        virEventTimeoutCallback cb;
+        int timer;
+        void *opaque;
+
+        /* An earlier callback may have removed or rescheduled it.
+         * The record itself is only freed by the cleanup pass */
+        if (t->deleted || t->frequency < 0 ||
+            t->expiresAt > (now+20))
+            continue;
+
+        cb = t->cb;
+        timer = t->timer;
+        opaque = t->opaque;
+        t->expiresAt = now + t->frequency;
+        virEventPollTimeoutHeapUpdate(loop, t);
+
+        PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
+              "timer=%d",
+              timer);
+        virMutexUnlock(&loop->lock);
+        (cb)(timer, opaque);
+        virMutexLock(&loop->lock);
+    }
     return 0;
 }
 
 
+static void
+virEventPollDispatchHandle(virEventPollLoopPtr loop,
+                           size_t i, int revents)
+{
+    virEventHandleCallback cb;
+    int watch;
+    int fd;
+    void *opaque;
+    int hEvents;
+
+    VIR_DEBUG("i=%zu w=%d", i, loop->handles[i].watch);
+    if (loop->handles[i].deleted) {
+        EVENT_DEBUG("Skip deleted n=%zu w=%d f=%d", i,
+                    loop->handles[i].watch, loop->handles[i].fd);
+        return;
+    }
+
+    if (!revents)
+        return;
+
+    cb = loop->handles[i].cb;
+    watch = loop->handles[i].watch;
+    fd = loop->handles[i].fd;
+    opaque = loop->handles[i].opaque;
+    hEvents = virEventPollFromNativeEvents(revents);
+    PROBE(EVENT_POLL_DISPATCH_HANDLE,
+          "watch=%d events=%d",
+          watch, hEvents);
+    virMutexUnlock(&loop->lock);
+    (cb)(watch, fd, hEvents, opaque);
+    virMutexLock(&loop->lock);
+}
+
+
 /* Iterate over all file handles and dispatch any which
  * have pending events listed in the poll() data. Invoke
  * the user supplied callback for each handle which has
@@ -472,94 +1031,160 @@ static int virEventPollDispatchTimeouts(void)
  *
  * Returns 0 upon success, -1 if an error occurred
  */
-static int virEventPollDispatchHandles(int nfds, struct pollfd *fds)
+static int virEventPollDispatchHandles(virEventPollLoopPtr loop,
+                                       int nfds, struct pollfd *fds)
 {
     size_t i, n;
     VIR_DEBUG("Dispatch %d", nfds);
 
-    /* NB, use nfds not eventLoop.handlesCount, because new
+    /* NB, use nfds not loop->handlesCount, because new
      * fds might be added on end of list, and they're not
      * in the fds array we've got */
-    for (i = 0, n = 0; n < nfds && i < eventLoop.handlesCount; n++) {
-        while (i < eventLoop.handlesCount &&
-               (eventLoop.handles[i].fd != fds[n].fd ||
-                eventLoop.handles[i].events == 0)) {
+    for (i = 0, n = 0; n < nfds && i < loop->handlesCount; n++) {
+        while (i < loop->handlesCount &&
+               (loop->handles[i].fd != fds[n].fd ||
+                loop->handles[i].events == 0)) {
             i++;
         }
-        if (i == eventLoop.handlesCount)
+        if (i == loop->handlesCount)
             break;
 
-        VIR_DEBUG("i=%zu w=%d", i, eventLoop.handles[i].watch);
-        if (eventLoop.handles[i].deleted) {
-            EVENT_DEBUG("Skip deleted n=%zu w=%d f=%d", i,
-                        eventLoop.handles[i].watch, eventLoop.handles[i].fd);
+        virEventPollDispatchHandle(loop, i, fds[n].revents);
+    }
+
+    return 0;
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+static int
+virEventPollEpollCompare(const void *a,
+                         const void *b)
+{
+    const struct epoll_event *ea = a;
+    const struct epoll_event *eb = b;
+
+    return ea->data.u64 < eb->data.u64 ? -1 : ea->data.u64 > eb->data.u64;
+}
+
+
+/* Dispatch the handles reported by epoll_wait(), as well as
+ * any handle which epoll refused to watch.
+ *
+ * This method must cope with new handles being registered
+ * by a callback, and must skip any handles marked as deleted.
+ */
+static int virEventPollDispatchEpoll(virEventPollLoopPtr loop, int nevents)
+{
+    /* New handles might be added by a callback, but they
+     * can't be in the events we've got */
+    size_t nhandles = loop->handlesCount;
+    size_t i;
+    int n;
+    VIR_DEBUG("Dispatch %d", nevents);
+
+    /* Keep the registration order the poll() backend uses */
+    qsort(loop->epollEvents, nevents, sizeof(loop->epollEvents[0]),
+          virEventPollEpollCompare);
+
+    for (n = 0; n < nevents; n++) {
+        struct epoll_event *ev = &loop->epollEvents[n];
+        uint64_t data = ev->data.u64;
+        int revents = virEventPollFromEpollEvents(ev->events);
+        ssize_t idx;
+
+        if (!(data & EVENT_EPOLL_SHARED)) {
+            if ((idx = virEventPollFindHandle(loop, (int) data)) >= 0)
+                virEventPollDispatchHandle(loop, idx, revents);
+            else
+                loop->epollStale = true;
             continue;
         }
 
-        if (fds[n].revents) {
-            virEventHandleCallback cb = eventLoop.handles[i].cb;
-            int watch = eventLoop.handles[i].watch;
-            void *opaque = eventLoop.handles[i].opaque;
-            int hEvents = virEventPollFromNativeEvents(fds[n].revents);
-            PROBE(EVENT_POLL_DISPATCH_HANDLE,
-                  "watch=%d events=%d",
-                  watch, hEvents);
-            virMutexUnlock(&eventLoop.lock);
-            (cb)(watch, fds[n].fd, hEvents, opaque);
-            virMutexLock(&eventLoop.lock);
+        for (i = 0; i < nhandles; i++) {
+            struct virEventPollHandle *h = &loop->handles[i];
+
+            if (!h->shared || h->fd != (int) (data & ~EVENT_EPOLL_SHARED) ||
+                h->events == 0)
+                continue;
+
+            virEventPollDispatchHandle(loop, i, revents &
+                                       (h->events | POLLERR | POLLHUP));
         }
     }
 
+    if (loop->handlesUnpollable == 0)
+        return 0;
+
+    for (i = 0; i < nhandles; i++) {
+        if (!loop->handles[i].unpollable)
+            continue;
+
+        virEventPollDispatchHandle(loop, i, loop->handles[i].events &
+                                   (POLLIN | POLLOUT));
+    }
+
     return 0;
 }
+#endif /* HAVE_SYS_EPOLL_H */
 
 
 /* Used post dispatch to actually remove any timers that
  * were previously marked as deleted. This asynchronous
  * cleanup is needed to make dispatch re-entrant safe.
  */
-static void virEventPollCleanupTimeouts(void)
+static void virEventPollCleanupTimeouts(virEventPollLoopPtr loop)
 {
     size_t i;
     size_t gap;
-    VIR_DEBUG("Cleanup %zu", eventLoop.timeoutsCount);
+    VIR_DEBUG("Cleanup %zu", loop->timeoutsCount);
+
+    if (loop->timeoutsDeleted == 0)
+        return;
 
     /* Remove deleted entries, shuffling down remaining
      * entries as needed to form contiguous series
      */
-    for (i = 0; i < eventLoop.timeoutsCount;) {
-        if (!eventLoop.timeouts[i].deleted) {
+    for (i = 0; i < loop->timeoutsCount;) {
+        struct virEventPollTimeout *t = loop->timeouts[i];
+
+        if (!t->deleted) {
             i++;
             continue;
         }
 
         PROBE(EVENT_POLL_PURGE_TIMEOUT,
               "timer=%d",
-              eventLoop.timeouts[i].timer);
-        if (eventLoop.timeouts[i].ff) {
-            virFreeCallback ff = eventLoop.timeouts[i].ff;
-            void *opaque = eventLoop.timeouts[i].opaque;
-            virMutexUnlock(&eventLoop.lock);
-            ff(opaque);
-            virMutexLock(&eventLoop.lock);
+              t->timer);
+
+        /* Unlink first, so that the record can't be looked
+         * up while the lock is dropped for the free callback */
+        if ((i+1) < loop->timeoutsCount) {
+            memmove(loop->timeouts+i,
+                    loop->timeouts+i+1,
+                    sizeof(*loop->timeouts)*(loop->timeoutsCount
+                                                 -(i+1)));
         }
+        loop->timeoutsCount--;
+        loop->timeoutsDeleted--;
 
-        if ((i+1) < eventLoop.timeoutsCount) {
-            memmove(eventLoop.timeouts+i,
-                    eventLoop.timeouts+i+1,
-                    sizeof(struct virEventPollTimeout)*(eventLoop.timeoutsCount
-                                                    -(i+1)));
+        if (t->ff) {
+            virFreeCallback ff = t->ff;
+            void *opaque = t->opaque;
+            virMutexUnlock(&loop->lock);
+            ff(opaque);
+            virMutexLock(&loop->lock);
         }
-        eventLoop.timeoutsCount--;
+        VIR_FREE(t);
     }
 
     /* Release some memory if we've got a big chunk free */
-    gap = eventLoop.timeoutsAlloc - eventLoop.timeoutsCount;
-    if (eventLoop.timeoutsCount == 0 ||
-        (gap > eventLoop.timeoutsCount && gap > EVENT_ALLOC_EXTENT)) {
+    gap = loop->timeoutsAlloc - loop->timeoutsCount;
+    if (loop->timeoutsCount == 0 ||
+        (gap > loop->timeoutsCount && gap > EVENT_ALLOC_EXTENT)) {
         EVENT_DEBUG("Found %zu out of %zu timeout slots used, releasing %zu",
-                    eventLoop.timeoutsCount, eventLoop.timeoutsAlloc, gap);
-        VIR_SHRINK_N(eventLoop.timeouts, eventLoop.timeoutsAlloc, gap);
+                    loop->timeoutsCount, loop->timeoutsAlloc, gap);
+        VIR_SHRINK_N(loop->timeouts, loop->timeoutsAlloc, gap);
     }
 }
 
@@ -567,72 +1192,68 @@ static void virEventPollCleanupTimeouts(void)
  * were previously marked as deleted. This asynchronous
  * cleanup is needed to make dispatch re-entrant safe.
  */
-static void virEventPollCleanupHandles(void)
+static void virEventPollCleanupHandles(virEventPollLoopPtr loop)
 {
     size_t i;
     size_t gap;
-    VIR_DEBUG("Cleanup %zu", eventLoop.handlesCount);
+    VIR_DEBUG("Cleanup %zu", loop->handlesCount);
+
+    if (loop->handlesDeleted == 0)
+        return;
 
     /* Remove deleted entries, shuffling down remaining
      * entries as needed to form contiguous series
      */
-    for (i = 0; i < eventLoop.handlesCount;) {
-        if (!eventLoop.handles[i].deleted) {
+    for (i = 0; i < loop->handlesCount;) {
+        if (!loop->handles[i].deleted) {
             i++;
             continue;
         }
 
         PROBE(EVENT_POLL_PURGE_HANDLE,
               "watch=%d",
-              eventLoop.handles[i].watch);
-        if (eventLoop.handles[i].ff) {
-            virFreeCallback ff = eventLoop.handles[i].ff;
-            void *opaque = eventLoop.handles[i].opaque;
-            virMutexUnlock(&eventLoop.lock);
+              loop->handles[i].watch);
+        if (loop->handles[i].ff) {
+            virFreeCallback ff = loop->handles[i].ff;
+            void *opaque = loop->handles[i].opaque;
+            virMutexUnlock(&loop->lock);
             ff(opaque);
-            virMutexLock(&eventLoop.lock);
+            virMutexLock(&loop->lock);
         }
 
-        if ((i+1) < eventLoop.handlesCount) {
-            memmove(eventLoop.handles+i,
-                    eventLoop.handles+i+1,
-                    sizeof(struct virEventPollHandle)*(eventLoop.handlesCount
+        if ((i+1) < loop->handlesCount) {
+            memmove(loop->handles+i,
+                    loop->handles+i+1,
+                    sizeof(struct virEventPollHandle)*(loop->handlesCount
                                                    -(i+1)));
         }
-        eventLoop.handlesCount--;
+        loop->handlesCount--;
+        loop->handlesDeleted--;
     }
 
     /* Release some memory if we've got a big chunk free */
-    gap = eventLoop.handlesAlloc - eventLoop.handlesCount;
-    if (eventLoop.handlesCount == 0 ||
-        (gap > eventLoop.handlesCount && gap > EVENT_ALLOC_EXTENT)) {
+    gap = loop->handlesAlloc - loop->handlesCount;
+    if (loop->handlesCount == 0 ||
+        (gap > loop->handlesCount && gap > EVENT_ALLOC_EXTENT)) {
         EVENT_DEBUG("Found %zu out of %zu handles slots used, releasing %zu",
-                    eventLoop.handlesCount, eventLoop.handlesAlloc, gap);
-        VIR_SHRINK_N(eventLoop.handles, eventLoop.handlesAlloc, gap);
+                    loop->handlesCount, loop->handlesAlloc, gap);
+        VIR_SHRINK_N(loop->handles, loop->handlesAlloc, gap);
     }
 }
 
 /*
- * Run a single iteration of the event loop, blocking until
- * at least one file handle has an event, or a timer expires
+ * Wait for events with poll() and dispatch them. Called and
+ * returns with the event loop locked.
  */
-int virEventPollRunOnce(void)
+static int virEventPollWaitPoll(virEventPollLoopPtr loop, int timeout)
 {
     struct pollfd *fds = NULL;
-    int ret, timeout, nfds;
-
-    virMutexLock(&eventLoop.lock);
-    eventLoop.running = 1;
-    virThreadSelf(&eventLoop.leader);
+    int ret, nfds;
 
-    virEventPollCleanupTimeouts();
-    virEventPollCleanupHandles();
-
-    if (!(fds = virEventPollMakePollFDs(&nfds)) ||
-        virEventPollCalculateTimeout(&timeout) < 0)
-        goto error;
+    if (!(fds = virEventPollMakePollFDs(loop, &nfds)))
+        return -1;
 
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 
  retry:
     PROBE(EVENT_POLL_RUN,
@@ -645,30 +1266,112 @@ int virEventPollRunOnce(void)
             goto retry;
         virReportSystemError(errno, "%s",
                              _("Unable to poll on file handles"));
-        goto error_unlocked;
+        virMutexLock(&loop->lock);
+        goto cleanup;
+    }
+    EVENT_DEBUG("Poll got %d event(s)", ret);
+
+    virMutexLock(&loop->lock);
+    if (virEventPollDispatchTimeouts(loop) < 0 ||
+        (ret > 0 && virEventPollDispatchHandles(loop, nfds, fds) < 0)) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(fds);
+    return ret;
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ * Wait for events with epoll_wait() and dispatch them. The epoll
+ * set is kept up to date as handles change, so unlike poll() there
+ * is nothing to prepare here. Called and returns with the event
+ * loop locked.
+ */
+static int virEventPollWaitEpoll(virEventPollLoopPtr loop, int timeout)
+{
+    int nhandles = loop->handlesCount - loop->handlesDeleted;
+    int ret;
+
+    if (loop->epollStale &&
+        virEventPollEpollRebuild(loop) < 0)
+        return -1;
+
+    /* Handles epoll can't watch are always ready */
+    if (loop->handlesUnpollable > 0)
+        timeout = 0;
+
+    virMutexUnlock(&loop->lock);
+
+ retry:
+    PROBE(EVENT_POLL_RUN,
+          "nhandles=%d timeout=%d",
+          nhandles, timeout);
+    ret = epoll_wait(loop->epollfd, loop->epollEvents,
+                     EVENT_EPOLL_MAX_EVENTS, timeout);
+    if (ret < 0) {
+        EVENT_DEBUG("Poll got error event %d", errno);
+        if (errno == EINTR || errno == EAGAIN)
+            goto retry;
+        virReportSystemError(errno, "%s",
+                             _("Unable to poll on file handles"));
+        virMutexLock(&loop->lock);
+        return -1;
     }
     EVENT_DEBUG("Poll got %d event(s)", ret);
 
-    virMutexLock(&eventLoop.lock);
-    if (virEventPollDispatchTimeouts() < 0)
+    virMutexLock(&loop->lock);
+    if (virEventPollDispatchTimeouts(loop) < 0 ||
+        virEventPollDispatchEpoll(loop, ret) < 0)
+        return -1;
+
+    return 0;
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
+
+/*
+ * Run a single iteration of the event loop, blocking until
+ * at least one file handle has an event, or a timer expires
+ */
+int virEventPollLoopRunOnce(virEventPollLoopPtr loop)
+{
+    int ret, timeout;
+
+    virMutexLock(&loop->lock);
+    loop->running = 1;
+    virThreadSelf(&loop->leader);
+
+    virEventPollCleanupTimeouts(loop);
+    virEventPollCleanupHandles(loop);
+
+    if (virEventPollCalculateTimeout(loop, &timeout) < 0)
         goto error;
 
-    if (ret > 0 &&
-        virEventPollDispatchHandles(nfds, fds) < 0)
+#ifdef HAVE_SYS_EPOLL_H
+    if (loop->backend == VIR_EVENT_POLL_BACKEND_EPOLL)
+        ret = virEventPollWaitEpoll(loop, timeout);
+    else
+#endif
+        ret = virEventPollWaitPoll(loop, timeout);
+
+    if (ret < 0)
         goto error;
 
-    virEventPollCleanupTimeouts();
-    virEventPollCleanupHandles();
+    virEventPollCleanupTimeouts(loop);
+    virEventPollCleanupHandles(loop);
 
-    eventLoop.running = 0;
-    virMutexUnlock(&eventLoop.lock);
-    VIR_FREE(fds);
+    loop->running = 0;
+    virMutexUnlock(&loop->lock);
     return 0;
 
  error:
-    virMutexUnlock(&eventLoop.lock);
- error_unlocked:
-    VIR_FREE(fds);
+    virMutexUnlock(&loop->lock);
     return -1;
 }
 
@@ -676,68 +1379,235 @@ int virEventPollRunOnce(void)
 static void virEventPollHandleWakeup(int watch ATTRIBUTE_UNUSED,
                                      int fd,
                                      int events ATTRIBUTE_UNUSED,
-                                     void *opaque ATTRIBUTE_UNUSED)
+                                     void *opaque)
 {
+    virEventPollLoopPtr loop = opaque;
     char c;
-    virMutexLock(&eventLoop.lock);
+    virMutexLock(&loop->lock);
     ignore_value(saferead(fd, &c, sizeof(c)));
-    virMutexUnlock(&eventLoop.lock);
+    virMutexUnlock(&loop->lock);
 }
 
-int virEventPollInit(void)
+/*
+ * Pick the implementation used to wait for events. The poll()
+ * one remains the default; the epoll one scales better with
+ * large numbers of handles. It expects every fd to be removed from
+ * the loop before it is closed, but recovers if one is not.
+ */
+static int virEventPollInitBackend(virEventPollLoopPtr loop)
+{
+    const char *name = virGetEnvBlockSUID("LIBVIRT_EVENT_LOOP");
+    int backend = VIR_EVENT_POLL_BACKEND_POLL;
+
+    if (name && *name &&
+        (backend = virEventPollBackendTypeFromString(name)) < 0) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("unknown event loop implementation '%s'"), name);
+        return -1;
+    }
+
+    if (backend == VIR_EVENT_POLL_BACKEND_EPOLL) {
+#ifdef HAVE_SYS_EPOLL_H
+        if ((loop->epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create epoll instance"));
+            return -1;
+        }
+#else
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("epoll event loop is not supported on this platform"));
+        return -1;
+#endif
+    }
+
+    VIR_DEBUG("Using %s event loop",
+              virEventPollBackendTypeToString(backend));
+    loop->backend = backend;
+    return 0;
+}
+
+static int virEventPollLoopInit(virEventPollLoopPtr loop)
 {
-    if (virMutexInit(&eventLoop.lock) < 0) {
+    loop->wakeupfd[0] = loop->wakeupfd[1] = -1;
+#ifdef HAVE_SYS_EPOLL_H
+    loop->epollfd = -1;
+#endif
+
+    if (virMutexInit(&loop->lock) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to initialize mutex"));
         return -1;
     }
 
-    if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+    if (virEventPollInitBackend(loop) < 0)
+        goto error;
+
+    if (pipe2(loop->wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to setup wakeup pipe"));
-        return -1;
+        goto error;
     }
 
-    if (virEventPollAddHandle(eventLoop.wakeupfd[0],
-                              VIR_EVENT_HANDLE_READABLE,
-                              virEventPollHandleWakeup, NULL, NULL) < 0) {
+    if (virEventPollLoopAddHandle(loop, loop->wakeupfd[0],
+                                  VIR_EVENT_HANDLE_READABLE,
+                                  virEventPollHandleWakeup, loop, NULL) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Unable to add handle %d to event loop"),
-                       eventLoop.wakeupfd[0]);
-        VIR_FORCE_CLOSE(eventLoop.wakeupfd[0]);
-        VIR_FORCE_CLOSE(eventLoop.wakeupfd[1]);
-        return -1;
+                       loop->wakeupfd[0]);
+        goto error;
     }
 
     return 0;
+
+ error:
+    VIR_FORCE_CLOSE(loop->wakeupfd[0]);
+    VIR_FORCE_CLOSE(loop->wakeupfd[1]);
+#ifdef HAVE_SYS_EPOLL_H
+    VIR_FORCE_CLOSE(loop->epollfd);
+#endif
+    virMutexDestroy(&loop->lock);
+    return -1;
+}
+
+int virEventPollInit(void)
+{
+    return virEventPollLoopInit(&eventLoop);
+}
+
+virEventPollLoopPtr virEventPollLoopNew(void)
+{
+    virEventPollLoopPtr loop;
+
+    if (VIR_ALLOC(loop) < 0)
+        return NULL;
+
+    if (virEventPollLoopInit(loop) < 0) {
+        VIR_FREE(loop);
+        return NULL;
+    }
+
+    return loop;
+}
+
+void virEventPollLoopFree(virEventPollLoopPtr loop)
+{
+    size_t i;
+
+    if (!loop)
+        return;
+
+    /* Anything still registered is dropped, but its free
+     * callback must run all the same */
+    virMutexLock(&loop->lock);
+    for (i = 0; i < loop->handlesCount; i++) {
+        if (!loop->handles[i].deleted) {
+            loop->handles[i].deleted = 1;
+            loop->handlesDeleted++;
+        }
+    }
+    for (i = 0; i < loop->timeoutsCount; i++) {
+        if (!loop->timeouts[i]->deleted) {
+            loop->timeouts[i]->deleted = 1;
+            loop->timeoutsDeleted++;
+        }
+    }
+    virEventPollCleanupTimeouts(loop);
+    virEventPollCleanupHandles(loop);
+    virMutexUnlock(&loop->lock);
+
+    VIR_FREE(loop->handles);
+    VIR_FREE(loop->timeouts);
+    VIR_FREE(loop->timeoutHeap);
+    VIR_FREE(loop->timeoutsDue);
+    VIR_FORCE_CLOSE(loop->wakeupfd[0]);
+    VIR_FORCE_CLOSE(loop->wakeupfd[1]);
+#ifdef HAVE_SYS_EPOLL_H
+    VIR_FORCE_CLOSE(loop->epollfd);
+#endif
+    virMutexDestroy(&loop->lock);
+    VIR_FREE(loop);
+}
+
+void virEventPollLoopPurge(virEventPollLoopPtr loop)
+{
+    virMutexLock(&loop->lock);
+    virEventPollCleanupTimeouts(loop);
+    virEventPollCleanupHandles(loop);
+    virMutexUnlock(&loop->lock);
+}
+
+int virEventPollAddHandle(int fd, int events,
+                          virEventHandleCallback cb,
+                          void *opaque,
+                          virFreeCallback ff)
+{
+    return virEventPollLoopAddHandle(&eventLoop, fd, events, cb, opaque, ff);
+}
+
+void virEventPollUpdateHandle(int watch, int events)
+{
+    virEventPollLoopUpdateHandle(&eventLoop, watch, events);
 }
 
-static int virEventPollInterruptLocked(void)
+int virEventPollRemoveHandle(int watch)
+{
+    return virEventPollLoopRemoveHandle(&eventLoop, watch);
+}
+
+int virEventPollAddTimeout(int frequency,
+                           virEventTimeoutCallback cb,
+                           void *opaque,
+                           virFreeCallback ff)
+{
+    return virEventPollLoopAddTimeout(&eventLoop, frequency, cb, opaque, ff);
+}
+
+void virEventPollUpdateTimeout(int timer, int frequency)
+{
+    virEventPollLoopUpdateTimeout(&eventLoop, timer, frequency);
+}
+
+int virEventPollRemoveTimeout(int timer)
+{
+    return virEventPollLoopRemoveTimeout(&eventLoop, timer);
+}
+
+int virEventPollRunOnce(void)
+{
+    return virEventPollLoopRunOnce(&eventLoop);
+}
+
+static int virEventPollInterruptLocked(virEventPollLoopPtr loop)
 {
     char c = '\0';
 
-    if (!eventLoop.running ||
-        virThreadIsSelf(&eventLoop.leader)) {
-        VIR_DEBUG("Skip interrupt, %d %llu", eventLoop.running,
-                  virThreadID(&eventLoop.leader));
+    if (!loop->running ||
+        virThreadIsSelf(&loop->leader)) {
+        VIR_DEBUG("Skip interrupt, %d %llu", loop->running,
+                  virThreadID(&loop->leader));
         return 0;
     }
 
     VIR_DEBUG("Interrupting");
-    if (safewrite(eventLoop.wakeupfd[1], &c, sizeof(c)) != sizeof(c))
+    if (safewrite(loop->wakeupfd[1], &c, sizeof(c)) != sizeof(c))
         return -1;
     return 0;
 }
 
-int virEventPollInterrupt(void)
+int virEventPollLoopInterrupt(virEventPollLoopPtr loop)
 {
     int ret;
-    virMutexLock(&eventLoop.lock);
-    ret = virEventPollInterruptLocked();
-    virMutexUnlock(&eventLoop.lock);
+    virMutexLock(&loop->lock);
+    ret = virEventPollInterruptLocked(loop);
+    virMutexUnlock(&loop->lock);
     return ret;
 }
 
+int virEventPollInterrupt(void)
+{
+    return virEventPollLoopInterrupt(&eventLoop);
+}
+
 int
 virEventPollToNativeEvents(int events)
 {
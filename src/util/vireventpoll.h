@@ -26,6 +26,9 @@
 
 # include "internal.h"
 
+typedef struct virEventPollLoop virEventPollLoop;
+typedef virEventPollLoop *virEventPollLoopPtr;
+
 /**
  * virEventPollAddHandle: register a callback for monitoring file handle events
  *
@@ -117,6 +120,59 @@ int virEventPollInit(void);
  */
 int virEventPollRunOnce(void);
 
+/**
+ * virEventPollLoopNew: create a private event loop
+ *
+ * The functions below operate on such a loop just like their
+ * virEventPoll counterparts operate on the default one, which
+ * is set up by virEventPollInit. Watch and timer ids are unique
+ * across all loops. It is up to the caller to run the loop in
+ * a thread of its own.
+ *
+ * returns the new loop, or NULL on error
+ */
+virEventPollLoopPtr virEventPollLoopNew(void);
+
+/**
+ * virEventPollLoopFree: free a private event loop
+ *
+ * @loop: the loop to free
+ *
+ * The loop must not be running anymore. The free callbacks of
+ * anything still registered with it are invoked.
+ */
+void virEventPollLoopFree(virEventPollLoopPtr loop);
+
+/**
+ * virEventPollLoopPurge: drop removed handles and timers of a loop
+ *
+ * @loop: the loop to purge
+ *
+ * Invokes the free callbacks of handles and timers that were
+ * removed, which is otherwise done by the next iteration of the
+ * loop. Only to be called when the loop is not running anymore.
+ */
+void virEventPollLoopPurge(virEventPollLoopPtr loop);
+
+int virEventPollLoopAddHandle(virEventPollLoopPtr loop,
+                              int fd, int events,
+                              virEventHandleCallback cb,
+                              void *opaque,
+                              virFreeCallback ff);
+void virEventPollLoopUpdateHandle(virEventPollLoopPtr loop,
+                                  int watch, int events);
+int virEventPollLoopRemoveHandle(virEventPollLoopPtr loop, int watch);
+int virEventPollLoopAddTimeout(virEventPollLoopPtr loop,
+                               int frequency,
+                               virEventTimeoutCallback cb,
+                               void *opaque,
+                               virFreeCallback ff);
+void virEventPollLoopUpdateTimeout(virEventPollLoopPtr loop,
+                                   int timer, int frequency);
+int virEventPollLoopRemoveTimeout(virEventPollLoopPtr loop, int timer);
+int virEventPollLoopRunOnce(virEventPollLoopPtr loop);
+int virEventPollLoopInterrupt(virEventPollLoopPtr loop);
+
 int virEventPollFromNativeEvents(int events);
 int virEventPollToNativeEvents(int events);
 
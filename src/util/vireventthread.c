@@ -0,0 +1,224 @@
+/*
+ * vireventthread.c: an event loop running in a thread of its own
+ *
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "vireventthread.h"
+#include "vireventpoll.h"
+#include "viratomic.h"
+#include "virthread.h"
+#include "virerror.h"
+#include "virlog.h"
+#include "viralloc.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
+VIR_LOG_INIT("util.eventthread");
+
+struct _virEventThread {
+    virObjectLockable parent;
+
+    char *name;
+    virEventPollLoopPtr loop;
+    virThread thread;
+    int quit;
+    bool finished; /* the loop is not run anymore */
+};
+
+static virClassPtr virEventThreadClass;
+
+static void virEventThreadDispose(void *obj);
+
+static int virEventThreadOnceInit(void)
+{
+    if (!(virEventThreadClass = virClassNew(virClassForObjectLockable(),
+                                            "virEventThread",
+                                            sizeof(virEventThread),
+                                            virEventThreadDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virEventThread)
+
+
+static void
+virEventThreadDispose(void *obj)
+{
+    virEventThreadPtr evt = obj;
+
+    VIR_DEBUG("evt=%p name=%s", evt, NULLSTR(evt->name));
+
+    virEventPollLoopFree(evt->loop);
+    VIR_FREE(evt->name);
+}
+
+
+static void
+virEventThreadWorker(void *opaque)
+{
+    virEventThreadPtr evt = opaque;
+
+    VIR_DEBUG("Event thread %s running", evt->name);
+
+    while (!virAtomicIntGet(&evt->quit)) {
+        if (virEventPollLoopRunOnce(evt->loop) < 0) {
+            VIR_WARN("Event loop of thread %s failed, quitting", evt->name);
+            break;
+        }
+    }
+
+    /* Nobody is going to run the loop anymore, so handles removed
+     * from now on are purged by virEventThreadRemoveHandle. Purge
+     * the ones removed so far here, as their free callbacks may
+     * release objects holding a reference to us. */
+    virObjectLock(evt);
+    evt->finished = true;
+    virEventPollLoopPurge(evt->loop);
+    virObjectUnlock(evt);
+
+    VIR_DEBUG("Event thread %s exiting", evt->name);
+    virObjectUnref(evt);
+}
+
+
+/**
+ * virEventThreadNew:
+ * @name: name of the thread
+ *
+ * Create a new event loop and start a thread dispatching its
+ * events. The thread holds a reference of its own, which it
+ * releases once it has been told to quit with virEventThreadStop.
+ *
+ * Returns the event thread object, or NULL on error.
+ */
+virEventThreadPtr
+virEventThreadNew(const char *name)
+{
+    virEventThreadPtr evt;
+
+    if (virEventThreadInitialize() < 0)
+        return NULL;
+
+    if (!(evt = virObjectLockableNew(virEventThreadClass)))
+        return NULL;
+
+    if (VIR_STRDUP(evt->name, name) < 0)
+        goto error;
+
+    if (!(evt->loop = virEventPollLoopNew()))
+        goto error;
+
+    virObjectRef(evt);
+    if (virThreadCreateFull(&evt->thread, false, virEventThreadWorker,
+                            evt->name, false, evt) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to create event thread %s"), name);
+        virObjectUnref(evt);
+        goto error;
+    }
+
+    return evt;
+
+ error:
+    virObjectUnref(evt);
+    return NULL;
+}
+
+
+static void
+virEventThreadWakeup(int timer ATTRIBUTE_UNUSED,
+                     void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+
+/**
+ * virEventThreadStop:
+ * @evt: the event thread
+ *
+ * Ask the thread to quit once it is done with the events it is
+ * dispatching at the moment. This does not wait for the thread.
+ * Handles removed after the thread quit have their free callbacks
+ * invoked right away by virEventThreadRemoveHandle, and those
+ * still registered when the last reference goes away at that
+ * point.
+ */
+void
+virEventThreadStop(virEventThreadPtr evt)
+{
+    if (!evt)
+        return;
+
+    VIR_DEBUG("evt=%p name=%s", evt, evt->name);
+
+    virAtomicIntSet(&evt->quit, 1);
+
+    /* A timer firing on the next iteration wakes the thread up
+     * regardless of whether it is waiting in the loop already */
+    if (virEventPollLoopAddTimeout(evt->loop, 0, virEventThreadWakeup,
+                                   NULL, NULL) < 0)
+        VIR_WARN("Unable to wake up event thread %s", evt->name);
+}
+
+
+const char *
+virEventThreadGetName(virEventThreadPtr evt)
+{
+    return evt->name;
+}
+
+
+int
+virEventThreadAddHandle(virEventThreadPtr evt,
+                        int fd,
+                        int events,
+                        virEventHandleCallback cb,
+                        void *opaque,
+                        virFreeCallback ff)
+{
+    return virEventPollLoopAddHandle(evt->loop, fd, events, cb, opaque, ff);
+}
+
+
+void
+virEventThreadUpdateHandle(virEventThreadPtr evt,
+                           int watch,
+                           int events)
+{
+    virEventPollLoopUpdateHandle(evt->loop, watch, events);
+}
+
+
+int
+virEventThreadRemoveHandle(virEventThreadPtr evt,
+                           int watch)
+{
+    int ret = virEventPollLoopRemoveHandle(evt->loop, watch);
+
+    virObjectLock(evt);
+    if (evt->finished)
+        virEventPollLoopPurge(evt->loop);
+    virObjectUnlock(evt);
+
+    return ret;
+}
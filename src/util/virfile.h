@@ -336,4 +336,25 @@ int virFileCopyACLs(const char *src,
                     const char *dst);
 
 int virFileComparePaths(const char *p1, const char *p2);
+
+int virFileInData(int fd,
+                  int *inData,
+                  long long *length);
+
+/* Sparse files are passed through pipes, e.g. between the fd stream
+ * driver and libvirt_iohelper, as a sequence of records. A data record
+ * is immediately followed by @length bytes of data, a hole record
+ * stands for @length bytes of zeros on its own. */
+typedef enum {
+    VIR_FILE_SPARSE_RECORD_DATA = 0,
+    VIR_FILE_SPARSE_RECORD_HOLE,
+} virFileSparseRecordType;
+
+typedef struct _virFileSparseRecord virFileSparseRecord;
+typedef virFileSparseRecord *virFileSparseRecordPtr;
+struct _virFileSparseRecord {
+    unsigned long long type; /* virFileSparseRecordType */
+    unsigned long long length;
+};
+
 #endif /* __VIR_FILE_H */
@@ -82,6 +82,21 @@ struct _virHashAtomic {
     virHashTablePtr hash;
 };
 
+/*
+ * The objects sharing a name in a virHashMulti, in the order
+ * they were added
+ */
+typedef struct _virHashMultiEntry virHashMultiEntry;
+typedef virHashMultiEntry *virHashMultiEntryPtr;
+struct _virHashMultiEntry {
+    size_t ndata;
+    void **data;
+};
+
+struct _virHashMulti {
+    virHashTablePtr hash;
+};
+
 static virClassPtr virHashAtomicClass;
 static void virHashAtomicDispose(void *obj);
 
@@ -828,3 +843,150 @@ bool virHashEqual(const virHashTable *table1,
 
     return data.equal;
 }
+
+
+static void
+virHashMultiEntryFree(void *payload,
+                      const void *name ATTRIBUTE_UNUSED)
+{
+    virHashMultiEntryPtr entry = payload;
+
+    VIR_FREE(entry->data);
+    VIR_FREE(entry);
+}
+
+
+/**
+ * virHashMultiNew:
+ * @size: the size of the hash table
+ *
+ * Create a table indexing objects by a name which isn't necessarily
+ * unique among them.
+ *
+ * Returns the newly created table, or NULL if an error occurred.
+ */
+virHashMultiPtr
+virHashMultiNew(ssize_t size)
+{
+    virHashMultiPtr table;
+
+    if (VIR_ALLOC(table) < 0)
+        return NULL;
+
+    if (!(table->hash = virHashCreate(size, virHashMultiEntryFree))) {
+        VIR_FREE(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+
+/**
+ * virHashMultiFree:
+ * @table: the table
+ *
+ * Free the table. The indexed objects are left alone.
+ */
+void
+virHashMultiFree(virHashMultiPtr table)
+{
+    if (!table)
+        return;
+
+    virHashFree(table->hash);
+    VIR_FREE(table);
+}
+
+
+/**
+ * virHashMultiAddEntry:
+ * @table: the table
+ * @name: the name of @userdata
+ * @userdata: the object to index
+ *
+ * Index @userdata by @name. If other objects have the same name,
+ * @userdata is found only after they have been removed.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virHashMultiAddEntry(virHashMultiPtr table,
+                     const char *name,
+                     void *userdata)
+{
+    virHashMultiEntryPtr entry;
+
+    if (!(entry = virHashLookup(table->hash, name))) {
+        if (VIR_ALLOC(entry) < 0)
+            return -1;
+
+        if (virHashAddEntry(table->hash, name, entry) < 0) {
+            VIR_FREE(entry);
+            return -1;
+        }
+    }
+
+    if (VIR_APPEND_ELEMENT(entry->data, entry->ndata, userdata) < 0) {
+        if (entry->ndata == 0)
+            ignore_value(virHashRemoveEntry(table->hash, name));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virHashMultiRemoveEntry:
+ * @table: the table
+ * @name: the name @userdata was indexed by
+ * @userdata: the object to remove
+ *
+ * Remove @userdata from the objects indexed by @name. Nothing
+ * happens if it is not one of them.
+ */
+void
+virHashMultiRemoveEntry(virHashMultiPtr table,
+                        const char *name,
+                        const void *userdata)
+{
+    virHashMultiEntryPtr entry;
+    size_t i;
+
+    if (!(entry = virHashLookup(table->hash, name)))
+        return;
+
+    for (i = 0; i < entry->ndata; i++) {
+        if (entry->data[i] == userdata)
+            break;
+    }
+    if (i == entry->ndata)
+        return;
+
+    if (entry->ndata == 1)
+        ignore_value(virHashRemoveEntry(table->hash, name));
+    else
+        VIR_DELETE_ELEMENT(entry->data, i, entry->ndata);
+}
+
+
+/**
+ * virHashMultiLookup:
+ * @table: the table
+ * @name: the name to look up
+ *
+ * Returns the earliest added object indexed by @name which is
+ * still in @table, or NULL if there is none.
+ */
+void *
+virHashMultiLookup(virHashMultiPtr table,
+                   const char *name)
+{
+    virHashMultiEntryPtr entry;
+
+    if (!table || !(entry = virHashLookup(table->hash, name)))
+        return NULL;
+
+    return entry->data[0];
+}
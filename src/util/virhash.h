@@ -24,6 +24,9 @@ typedef virHashTable *virHashTablePtr;
 typedef struct _virHashAtomic virHashAtomic;
 typedef virHashAtomic *virHashAtomicPtr;
 
+typedef struct _virHashMulti virHashMulti;
+typedef virHashMulti *virHashMultiPtr;
+
 /*
  * function types:
  */
@@ -199,4 +202,20 @@ void *virHashSearch(const virHashTable *table, virHashSearcher iter,
 /* Convenience for when VIR_FREE(value) is sufficient as a data freer.  */
 void virHashValueFree(void *value, const void *name);
 
+/*
+ * Tables indexing objects by a string several of them may share.
+ * A lookup returns the earliest added object which is still there.
+ * The objects are not owned by the table.
+ */
+virHashMultiPtr virHashMultiNew(ssize_t size);
+void virHashMultiFree(virHashMultiPtr table);
+int virHashMultiAddEntry(virHashMultiPtr table,
+                         const char *name,
+                         void *userdata);
+void virHashMultiRemoveEntry(virHashMultiPtr table,
+                             const char *name,
+                             const void *userdata);
+void *virHashMultiLookup(virHashMultiPtr table,
+                         const char *name);
+
 #endif                          /* ! __VIR_HASH_H__ */
@@ -378,6 +378,18 @@ const char *virClassName(virClassPtr klass)
 }
 
 
+/**
+ * virClassParent:
+ * @klass: the object class
+ *
+ * Returns the parent class of @klass, or NULL for the root class
+ */
+virClassPtr virClassParent(virClassPtr klass)
+{
+    return klass->parent;
+}
+
+
 /**
  * virObjectFreeCallback:
  * @opaque: a pointer to a virObject instance
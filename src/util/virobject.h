@@ -75,6 +75,9 @@ virClassPtr virClassNew(virClassPtr parent,
 const char *virClassName(virClassPtr klass)
     ATTRIBUTE_NONNULL(1);
 
+virClassPtr virClassParent(virClassPtr klass)
+    ATTRIBUTE_NONNULL(1);
+
 bool virClassIsDerivedFrom(virClassPtr klass,
                            virClassPtr parent)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
@@ -57,6 +57,7 @@ struct virRotatingFileWriter {
     size_t maxbackup;
     mode_t mode;
     size_t maxlen;
+    bool reopen; /* @entry was rolled over, but the new file is not open yet */
 };
 
 
@@ -421,6 +422,22 @@ virRotatingFileWriterRollover(virRotatingFileWriterPtr file)
 }
 
 
+static int
+virRotatingFileWriterReopen(virRotatingFileWriterPtr file)
+{
+    virRotatingFileWriterEntryPtr entry;
+
+    if (!(entry = virRotatingFileWriterEntryNew(file->basepath,
+                                                file->mode)))
+        return -1;
+
+    virRotatingFileWriterEntryFree(file->entry);
+    file->entry = entry;
+    file->reopen = false;
+    return 0;
+}
+
+
 /**
  * virRotatingFileWriterAppend:
  * @file: the file context
@@ -430,7 +447,9 @@ virRotatingFileWriterRollover(virRotatingFileWriterPtr file)
  * Append the data in @buf to the file, performing rollover
  * of the files if their size would exceed the limit
  *
- * Returns the number of bytes written, or -1 on error
+ * Returns the number of bytes written, which is less than @len if an
+ * error occurred after writing some of them, or -1 if an error occurred
+ * before anything was written
  */
 ssize_t
 virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
@@ -439,6 +458,14 @@ virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
 {
     ssize_t ret = 0;
     size_t i;
+
+    /* The previous rollover could not open the new file. The old one
+     * is a backup already, so retry opening rather than rolling over
+     * once more and losing the oldest backup again. */
+    if (file->reopen &&
+        virRotatingFileWriterReopen(file) < 0)
+        return -1;
+
     while (len) {
         size_t towrite = len;
         bool forceRollover = false;
@@ -471,7 +498,7 @@ virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
                 virReportSystemError(errno,
                                      _("Unable to write to file %s"),
                                      file->basepath);
-                return -1;
+                goto error;
             }
 
             len -= towrite;
@@ -483,22 +510,24 @@ virRotatingFileWriterAppend(virRotatingFileWriterPtr file,
 
         if ((file->entry->pos == file->maxlen && len) ||
             forceRollover) {
-            virRotatingFileWriterEntryPtr tmp = file->entry;
             VIR_DEBUG("Hit max size %zu on %s (force=%d)\n",
                       file->maxlen, file->basepath, forceRollover);
 
             if (virRotatingFileWriterRollover(file) < 0)
-                return -1;
-
-            if (!(file->entry = virRotatingFileWriterEntryNew(file->basepath,
-                                                              file->mode)))
-                return -1;
+                goto error;
 
-            virRotatingFileWriterEntryFree(tmp);
+            /* Keep the old entry until the new file can be opened,
+             * so that the writer stays usable */
+            file->reopen = true;
+            if (virRotatingFileWriterReopen(file) < 0)
+                goto error;
         }
     }
 
     return ret;
+
+ error:
+    return ret ? ret : -1;
 }
 
 
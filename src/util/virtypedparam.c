@@ -25,8 +25,11 @@
 #include <stdarg.h>
 
 #include "viralloc.h"
+#include "virbuffer.h"
 #include "virutil.h"
 #include "virerror.h"
+#include "virhash.h"
+#include "virobject.h"
 #include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -1563,3 +1566,584 @@ virTypedParamsSerialize(virTypedParameterPtr params,
     virTypedParamsRemoteFree(params_val, nparams);
     return rv;
 }
+
+
+/**
+ * virTypedParamsColumnsFree:
+ * @columns: domain stats arranged in columns
+ *
+ * Frees @columns along with all the values and domains it holds.
+ */
+void
+virTypedParamsColumnsFree(virDomainStatsColumnsPtr columns)
+{
+    size_t i;
+    size_t j;
+
+    if (!columns)
+        return;
+
+    for (i = 0; i < columns->ncolumns; i++) {
+        virDomainStatsColumnPtr column = columns->columns + i;
+
+        if (column->type == VIR_TYPED_PARAM_STRING && column->values.s) {
+            for (j = 0; j < columns->ndoms; j++)
+                VIR_FREE(column->values.s[j]);
+        }
+        /* All members of the union are arrays of the same kind */
+        VIR_FREE(column->values.ul);
+        VIR_FREE(column->present);
+        VIR_FREE(column->field);
+    }
+    VIR_FREE(columns->columns);
+
+    for (i = 0; i < columns->ndoms; i++)
+        virObjectUnref(columns->doms[i]);
+    VIR_FREE(columns->doms);
+
+    VIR_FREE(columns);
+}
+
+
+/**
+ * virTypedParamsColumnNew:
+ * @columns: domain stats arranged in columns
+ * @pos: position of the new column
+ * @field: name of the statistic
+ * @type: type of its values
+ *
+ * Inserts a column for @field at @pos, with room for the values of all
+ * the domains in @columns.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virTypedParamsColumnNew(virDomainStatsColumnsPtr columns,
+                        size_t pos,
+                        const char *field,
+                        int type)
+{
+    virDomainStatsColumn column;
+    size_t ndoms = columns->ndoms;
+    size_t ncolumns = columns->ncolumns;
+
+    memset(&column, 0, sizeof(column));
+    column.type = type;
+
+    if (VIR_STRDUP(column.field, field) < 0 ||
+        VIR_ALLOC_N(column.present, ndoms) < 0)
+        goto error;
+
+    switch ((virTypedParameterType) type) {
+    case VIR_TYPED_PARAM_INT:
+    case VIR_TYPED_PARAM_LLONG:
+        if (VIR_ALLOC_N(column.values.l, ndoms) < 0)
+            goto error;
+        break;
+    case VIR_TYPED_PARAM_UINT:
+    case VIR_TYPED_PARAM_ULLONG:
+    case VIR_TYPED_PARAM_BOOLEAN:
+        if (VIR_ALLOC_N(column.values.ul, ndoms) < 0)
+            goto error;
+        break;
+    case VIR_TYPED_PARAM_DOUBLE:
+        if (VIR_ALLOC_N(column.values.d, ndoms) < 0)
+            goto error;
+        break;
+    case VIR_TYPED_PARAM_STRING:
+        if (VIR_ALLOC_N(column.values.s, ndoms) < 0)
+            goto error;
+        break;
+    case VIR_TYPED_PARAM_LAST:
+    default:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unexpected type %d for field %s"), type, field);
+        goto error;
+    }
+
+    if (VIR_INSERT_ELEMENT(columns->columns, pos, ncolumns, column) < 0)
+        goto error;
+    columns->ncolumns = ncolumns;
+
+    return 0;
+
+ error:
+    VIR_FREE(column.values.ul);
+    VIR_FREE(column.present);
+    VIR_FREE(column.field);
+    return -1;
+}
+
+
+/**
+ * virTypedParamsRecordsToColumns:
+ * @records: domain stats records
+ * @nrecords: number of elements in @records
+ *
+ * Arranges the statistics of @records in columns, one for each
+ * statistic reported by any of them. A statistic seen for the first
+ * time is placed right after the one which preceded it in its record,
+ * so the order of the fields in each record is kept as long as the
+ * records don't contradict each other.
+ *
+ * Returns the columns on success, NULL on error.
+ */
+virDomainStatsColumnsPtr
+virTypedParamsRecordsToColumns(virDomainStatsRecordPtr *records,
+                               int nrecords)
+{
+    virDomainStatsColumnsPtr columns = NULL;
+    virHashTablePtr index = NULL;
+    size_t i;
+    size_t j;
+    size_t k;
+
+    if (VIR_ALLOC(columns) < 0 ||
+        VIR_ALLOC_N(columns->doms, nrecords) < 0)
+        goto error;
+    columns->ndoms = nrecords;
+
+    if (!(index = virHashCreate(64, NULL)))
+        goto error;
+
+    /* Lay out the columns, @index maps fields to their position + 1 */
+    for (i = 0; i < nrecords; i++) {
+        virDomainStatsRecordPtr record = records[i];
+        size_t pos = 0;
+
+        columns->doms[i] = virObjectRef(record->dom);
+
+        for (j = 0; j < record->nparams; j++) {
+            virTypedParameterPtr param = record->params + j;
+            size_t found = (uintptr_t) virHashLookup(index, param->field);
+
+            if (found) {
+                pos = found;
+                continue;
+            }
+
+            if (virTypedParamsColumnNew(columns, pos,
+                                        param->field, param->type) < 0)
+                goto error;
+
+            /* Everything behind the new column has moved */
+            for (k = pos + 1; k < columns->ncolumns; k++) {
+                if (virHashUpdateEntry(index, columns->columns[k].field,
+                                       (void *) (uintptr_t) (k + 1)) < 0)
+                    goto error;
+            }
+
+            pos++;
+            if (virHashAddEntry(index, param->field, (void *) (uintptr_t) pos) < 0)
+                goto error;
+        }
+    }
+
+    /* Fill in the values */
+    for (i = 0; i < nrecords; i++) {
+        virDomainStatsRecordPtr record = records[i];
+
+        for (j = 0; j < record->nparams; j++) {
+            virTypedParameterPtr param = record->params + j;
+            size_t pos = (uintptr_t) virHashLookup(index, param->field) - 1;
+            virDomainStatsColumnPtr column = columns->columns + pos;
+
+            if (column->type != param->type) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("field %s reported with different types"),
+                               param->field);
+                goto error;
+            }
+
+            if (column->present[i]) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("field %s reported twice"), param->field);
+                goto error;
+            }
+            column->present[i] = 1;
+
+            switch ((virTypedParameterType) param->type) {
+            case VIR_TYPED_PARAM_INT:
+                column->values.l[i] = param->value.i;
+                break;
+            case VIR_TYPED_PARAM_UINT:
+                column->values.ul[i] = param->value.ui;
+                break;
+            case VIR_TYPED_PARAM_LLONG:
+                column->values.l[i] = param->value.l;
+                break;
+            case VIR_TYPED_PARAM_ULLONG:
+                column->values.ul[i] = param->value.ul;
+                break;
+            case VIR_TYPED_PARAM_DOUBLE:
+                column->values.d[i] = param->value.d;
+                break;
+            case VIR_TYPED_PARAM_BOOLEAN:
+                column->values.ul[i] = !!param->value.b;
+                break;
+            case VIR_TYPED_PARAM_STRING:
+                if (VIR_STRDUP(column->values.s[i], param->value.s) < 0)
+                    goto error;
+                break;
+            case VIR_TYPED_PARAM_LAST:
+            default:
+                break;
+            }
+        }
+    }
+
+    virHashFree(index);
+    return columns;
+
+ error:
+    virHashFree(index);
+    virTypedParamsColumnsFree(columns);
+    return NULL;
+}
+
+
+/**
+ * virTypedParamsColumnsToRecords:
+ * @columns: domain stats arranged in columns
+ * @records: filled with a NULL terminated array of records
+ *
+ * Turns @columns back into one record per domain. The fields of each
+ * record are ordered the same way the columns are.
+ *
+ * Returns the number of records on success, -1 on error.
+ */
+int
+virTypedParamsColumnsToRecords(virDomainStatsColumnsPtr columns,
+                               virDomainStatsRecordPtr **records)
+{
+    virDomainStatsRecordPtr *tmp = NULL;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(tmp, columns->ndoms + 1) < 0)
+        return -1;
+
+    for (i = 0; i < columns->ndoms; i++) {
+        virDomainStatsRecordPtr record;
+        size_t nparams = 0;
+
+        if (VIR_ALLOC(record) < 0)
+            goto cleanup;
+        tmp[i] = record;
+        record->dom = virObjectRef(columns->doms[i]);
+
+        for (j = 0; j < columns->ncolumns; j++) {
+            if (columns->columns[j].present[i])
+                nparams++;
+        }
+
+        if (VIR_ALLOC_N(record->params, nparams) < 0)
+            goto cleanup;
+
+        for (j = 0; j < columns->ncolumns; j++) {
+            virDomainStatsColumnPtr column = columns->columns + j;
+            virTypedParameterPtr param = record->params + record->nparams;
+
+            if (!column->present[i])
+                continue;
+
+            if (virStrcpyStatic(param->field, column->field) == NULL) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("field name '%s' too long"), column->field);
+                goto cleanup;
+            }
+            param->type = column->type;
+
+            switch ((virTypedParameterType) column->type) {
+            case VIR_TYPED_PARAM_INT:
+                param->value.i = column->values.l[i];
+                break;
+            case VIR_TYPED_PARAM_UINT:
+                param->value.ui = column->values.ul[i];
+                break;
+            case VIR_TYPED_PARAM_LLONG:
+                param->value.l = column->values.l[i];
+                break;
+            case VIR_TYPED_PARAM_ULLONG:
+                param->value.ul = column->values.ul[i];
+                break;
+            case VIR_TYPED_PARAM_DOUBLE:
+                param->value.d = column->values.d[i];
+                break;
+            case VIR_TYPED_PARAM_BOOLEAN:
+                param->value.b = !!column->values.ul[i];
+                break;
+            case VIR_TYPED_PARAM_STRING:
+                if (VIR_STRDUP(param->value.s, column->values.s[i]) < 0)
+                    goto cleanup;
+                break;
+            case VIR_TYPED_PARAM_LAST:
+            default:
+                break;
+            }
+            record->nparams++;
+        }
+    }
+
+    *records = tmp;
+    tmp = NULL;
+    ret = columns->ndoms;
+
+ cleanup:
+    if (tmp) {
+        for (i = 0; tmp[i]; i++) {
+            virTypedParamsFree(tmp[i]->params, tmp[i]->nparams);
+            virObjectUnref(tmp[i]->dom);
+            VIR_FREE(tmp[i]);
+        }
+        VIR_FREE(tmp);
+    }
+    return ret;
+}
+
+
+/* Values are packed as LEB128 variable length integers, signed ones
+ * zigzag encoded first so that small negative numbers stay short */
+static void
+virTypedParamsPackUInt(virBufferPtr buf,
+                       unsigned long long val)
+{
+    unsigned char bytes[10];
+    size_t len = 0;
+
+    do {
+        bytes[len] = val & 0x7f;
+        val >>= 7;
+        if (val)
+            bytes[len] |= 0x80;
+        len++;
+    } while (val);
+
+    virBufferAdd(buf, (const char *) bytes, len);
+}
+
+
+static int
+virTypedParamsUnpackUInt(const unsigned char **data,
+                         const unsigned char *end,
+                         unsigned long long *val)
+{
+    unsigned int shift = 0;
+
+    *val = 0;
+    while (*data < end && shift < 64) {
+        unsigned char byte = *(*data)++;
+
+        *val |= (unsigned long long) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return 0;
+        shift += 7;
+    }
+
+    return -1;
+}
+
+
+/**
+ * virTypedParamsColumnPack:
+ * @column: a column of domain stats
+ * @ndoms: number of domains in the column
+ * @present: filled with a bitmap of the domains reporting the statistic
+ * @npresent: filled with the size of @present in bytes
+ * @values: filled with the packed numeric values
+ * @nvalues: filled with the size of @values in bytes
+ * @strings: filled with the string values
+ * @nstrings: filled with the number of elements in @strings
+ *
+ * Packs the values of @column for transferring them to a remote side.
+ * Only the values of domains present in the bitmap are packed, in the
+ * order of the domains. Numeric values are stored as variable length
+ * integers, doubles as 8 bytes of their IEEE 754 representation in
+ * little endian byte order and strings are passed in @strings.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virTypedParamsColumnPack(virDomainStatsColumnPtr column,
+                         int ndoms,
+                         char **present,
+                         unsigned int *npresent,
+                         char **values,
+                         unsigned int *nvalues,
+                         char ***strings,
+                         unsigned int *nstrings)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *bitmap = NULL;
+    char **strs = NULL;
+    size_t nstrs = 0;
+    size_t i;
+    size_t j;
+
+    *values = NULL;
+    *nvalues = 0;
+
+    if (VIR_ALLOC_N(bitmap, (ndoms + 7) / 8) < 0)
+        goto error;
+
+    if (column->type == VIR_TYPED_PARAM_STRING &&
+        VIR_ALLOC_N(strs, ndoms) < 0)
+        goto error;
+
+    for (i = 0; i < ndoms; i++) {
+        long long l;
+        unsigned long long ul;
+        unsigned char bytes[8];
+        union {
+            double d;
+            unsigned long long ul;
+        } dbl;
+
+        if (!column->present[i])
+            continue;
+        bitmap[i / 8] |= 1 << (i % 8);
+
+        switch ((virTypedParameterType) column->type) {
+        case VIR_TYPED_PARAM_INT:
+        case VIR_TYPED_PARAM_LLONG:
+            l = column->values.l[i];
+            ul = ((unsigned long long) l << 1) ^ (l < 0 ? ~0ULL : 0);
+            virTypedParamsPackUInt(&buf, ul);
+            break;
+        case VIR_TYPED_PARAM_UINT:
+        case VIR_TYPED_PARAM_ULLONG:
+        case VIR_TYPED_PARAM_BOOLEAN:
+            virTypedParamsPackUInt(&buf, column->values.ul[i]);
+            break;
+        case VIR_TYPED_PARAM_DOUBLE:
+            dbl.d = column->values.d[i];
+            for (j = 0; j < 8; j++)
+                bytes[j] = (dbl.ul >> (j * 8)) & 0xff;
+            virBufferAdd(&buf, (const char *) bytes, 8);
+            break;
+        case VIR_TYPED_PARAM_STRING:
+            if (VIR_STRDUP(strs[nstrs], column->values.s[i]) < 0)
+                goto error;
+            nstrs++;
+            break;
+        case VIR_TYPED_PARAM_LAST:
+        default:
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("unexpected type %d for field %s"),
+                           column->type, column->field);
+            goto error;
+        }
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto error;
+
+    *nvalues = virBufferUse(&buf);
+    *values = virBufferContentAndReset(&buf);
+    *present = bitmap;
+    *npresent = (ndoms + 7) / 8;
+    *strings = strs;
+    *nstrings = nstrs;
+    return 0;
+
+ error:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(bitmap);
+    virStringListFreeCount(strs, nstrs);
+    return -1;
+}
+
+
+/**
+ * virTypedParamsColumnUnpack:
+ * @column: a column of domain stats with its type already set
+ * @ndoms: number of domains in the column
+ * @present: bitmap of the domains reporting the statistic
+ * @npresent: size of @present in bytes
+ * @values: values packed by virTypedParamsColumnPack
+ * @nvalues: size of @values in bytes
+ * @strings: string values
+ * @nstrings: number of elements in @strings
+ *
+ * Fills in the values of @column, which must have been allocated for
+ * @ndoms domains, from their packed representation.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virTypedParamsColumnUnpack(virDomainStatsColumnPtr column,
+                           int ndoms,
+                           const char *present,
+                           unsigned int npresent,
+                           const char *values,
+                           unsigned int nvalues,
+                           char **strings,
+                           unsigned int nstrings)
+{
+    const unsigned char *data = (const unsigned char *) values;
+    const unsigned char *end = data + nvalues;
+    size_t nstrs = 0;
+    size_t i;
+    size_t j;
+
+    if (npresent != (ndoms + 7) / 8)
+        goto malformed;
+
+    for (i = 0; i < ndoms; i++) {
+        unsigned long long ul;
+        union {
+            double d;
+            unsigned long long ul;
+        } dbl;
+
+        if (!(present[i / 8] & (1 << (i % 8))))
+            continue;
+        column->present[i] = 1;
+
+        switch ((virTypedParameterType) column->type) {
+        case VIR_TYPED_PARAM_INT:
+        case VIR_TYPED_PARAM_LLONG:
+            if (virTypedParamsUnpackUInt(&data, end, &ul) < 0)
+                goto malformed;
+            column->values.l[i] = (long long) (ul >> 1) ^ -(long long) (ul & 1);
+            break;
+        case VIR_TYPED_PARAM_UINT:
+        case VIR_TYPED_PARAM_ULLONG:
+        case VIR_TYPED_PARAM_BOOLEAN:
+            if (virTypedParamsUnpackUInt(&data, end,
+                                         &column->values.ul[i]) < 0)
+                goto malformed;
+            break;
+        case VIR_TYPED_PARAM_DOUBLE:
+            if (end - data < 8)
+                goto malformed;
+            dbl.ul = 0;
+            for (j = 0; j < 8; j++)
+                dbl.ul |= (unsigned long long) *data++ << (j * 8);
+            column->values.d[i] = dbl.d;
+            break;
+        case VIR_TYPED_PARAM_STRING:
+            if (nstrs >= nstrings)
+                goto malformed;
+            if (VIR_STRDUP(column->values.s[i], strings[nstrs]) < 0)
+                return -1;
+            nstrs++;
+            break;
+        case VIR_TYPED_PARAM_LAST:
+        default:
+            goto malformed;
+        }
+    }
+
+    if (data != end || nstrs != nstrings)
+        goto malformed;
+
+    return 0;
+
+ malformed:
+    virReportError(VIR_ERR_RPC,
+                   _("malformed values of domain stats field %s"),
+                   column->field);
+    return -1;
+}
@@ -119,6 +119,38 @@ int virTypedParamsSerialize(virTypedParameterPtr params,
                             unsigned int *remote_params_len,
                             unsigned int flags);
 
+void virTypedParamsColumnsFree(virDomainStatsColumnsPtr columns);
+
+int virTypedParamsColumnNew(virDomainStatsColumnsPtr columns,
+                            size_t pos,
+                            const char *field,
+                            int type);
+
+virDomainStatsColumnsPtr
+virTypedParamsRecordsToColumns(virDomainStatsRecordPtr *records,
+                               int nrecords);
+
+int virTypedParamsColumnsToRecords(virDomainStatsColumnsPtr columns,
+                                   virDomainStatsRecordPtr **records);
+
+int virTypedParamsColumnPack(virDomainStatsColumnPtr column,
+                             int ndoms,
+                             char **present,
+                             unsigned int *npresent,
+                             char **values,
+                             unsigned int *nvalues,
+                             char ***strings,
+                             unsigned int *nstrings);
+
+int virTypedParamsColumnUnpack(virDomainStatsColumnPtr column,
+                               int ndoms,
+                               const char *present,
+                               unsigned int npresent,
+                               const char *values,
+                               unsigned int nvalues,
+                               char **strings,
+                               unsigned int nstrings);
+
 VIR_ENUM_DECL(virTypedParameter)
 
 # define VIR_TYPED_PARAMS_DEBUG(params, nparams)                            \
@@ -25,6 +25,8 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <time.h>
+#include <sys/resource.h>
+#include <fcntl.h>
 
 #if HAVE_MACH_CLOCK_ROUTINES
 # include <mach/clock.h>
@@ -33,11 +35,16 @@
 
 #include "testutils.h"
 #include "internal.h"
+#include "viralloc.h"
 #include "virfile.h"
 #include "virthread.h"
 #include "virlog.h"
 #include "virutil.h"
+#include "virtime.h"
 #include "vireventpoll.h"
+#include "vireventthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
 
 VIR_LOG_INIT("tests.eventtest");
 
@@ -310,12 +317,445 @@ resetAll(void)
     }
 }
 
+
+#define TEST_WAKEUPS 1000
+
+struct testWakeupData {
+    size_t nhandles;
+};
+
+static void
+testWakeupIdle(int watch ATTRIBUTE_UNUSED,
+               int fd ATTRIBUTE_UNUSED,
+               int events ATTRIBUTE_UNUSED,
+               void *data)
+{
+    bool *idleFired = data;
+
+    *idleFired = true;
+}
+
+static void
+testWakeupReader(int watch ATTRIBUTE_UNUSED,
+                 int fd,
+                 int events ATTRIBUTE_UNUSED,
+                 void *data)
+{
+    size_t *fired = data;
+    char one;
+
+    if (saferead(fd, &one, 1) == 1)
+        (*fired)++;
+}
+
+/* Measure how long it takes the loop to notice a single
+ * active handle among lots of idle ones */
+static int
+testWakeupLatency(const void *opaque)
+{
+    const struct testWakeupData *data = opaque;
+    struct rlimit rlim;
+    int idleFD[2] = { -1, -1 };
+    int activeFD[2] = { -1, -1 };
+    int activeWatch = -1;
+    int *fds = NULL;
+    int *watches = NULL;
+    size_t nfds = 0;
+    size_t nwatches = 0;
+    size_t fired = 0;
+    bool idleFired = false;
+    unsigned long long start;
+    unsigned long long end;
+    char one = '1';
+    size_t i;
+    int ret = -1;
+
+    if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+        return -1;
+
+    if (rlim.rlim_cur != RLIM_INFINITY &&
+        rlim.rlim_cur < data->nhandles + 64) {
+        if (rlim.rlim_max != RLIM_INFINITY &&
+            rlim.rlim_max < data->nhandles + 64)
+            return EXIT_AM_SKIP;
+
+        rlim.rlim_cur = data->nhandles + 64;
+        if (setrlimit(RLIMIT_NOFILE, &rlim) < 0)
+            return EXIT_AM_SKIP;
+    }
+
+    if (VIR_ALLOC_N(fds, data->nhandles) < 0 ||
+        VIR_ALLOC_N(watches, data->nhandles) < 0)
+        goto cleanup;
+
+    if (pipe(idleFD) < 0 || pipe(activeFD) < 0) {
+        fprintf(stderr, "Cannot create pipe: %d\n", errno);
+        goto cleanup;
+    }
+
+    for (i = 0; i < data->nhandles; i++) {
+        if ((fds[nfds] = dup(idleFD[0])) < 0) {
+            fprintf(stderr, "Cannot duplicate fd: %d\n", errno);
+            goto cleanup;
+        }
+        nfds++;
+
+        if ((watches[nwatches] =
+             virEventPollAddHandle(fds[i], VIR_EVENT_HANDLE_READABLE,
+                                   testWakeupIdle, &idleFired, NULL)) < 0)
+            goto cleanup;
+        nwatches++;
+    }
+
+    if ((activeWatch = virEventPollAddHandle(activeFD[0],
+                                             VIR_EVENT_HANDLE_READABLE,
+                                             testWakeupReader,
+                                             &fired, NULL)) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_WAKEUPS; i++) {
+        if (safewrite(activeFD[1], &one, 1) != 1 ||
+            virEventPollRunOnce() < 0)
+            goto cleanup;
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    if (fired != TEST_WAKEUPS || idleFired) {
+        fprintf(stderr, "expected %d wakeups of the active handle only, "
+                "got %zu (idle handle fired: %d)\n",
+                TEST_WAKEUPS, fired, idleFired);
+        goto cleanup;
+    }
+
+    VIR_TEST_VERBOSE("\n%zu handles: %d wakeups took %llu ms\n",
+                     data->nhandles, TEST_WAKEUPS, end - start);
+
+    ret = 0;
+
+ cleanup:
+    if (activeWatch > 0)
+        virEventPollRemoveHandle(activeWatch);
+    for (i = 0; i < nwatches; i++)
+        virEventPollRemoveHandle(watches[i]);
+    for (i = 0; i < nfds; i++)
+        VIR_FORCE_CLOSE(fds[i]);
+    VIR_FORCE_CLOSE(idleFD[0]);
+    VIR_FORCE_CLOSE(idleFD[1]);
+    VIR_FORCE_CLOSE(activeFD[0]);
+    VIR_FORCE_CLOSE(activeFD[1]);
+    VIR_FREE(watches);
+    VIR_FREE(fds);
+    return ret;
+}
+
+struct testEventThreadData {
+    virMutex lock;
+    virCond cond;
+    unsigned long long mainThread;
+    size_t fired;
+    bool wrongThread;
+    bool freed;
+};
+
+static void
+testEventThreadReader(int watch ATTRIBUTE_UNUSED,
+                      int fd,
+                      int events ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    struct testEventThreadData *data = opaque;
+    char one;
+
+    if (saferead(fd, &one, 1) != 1)
+        return;
+
+    virMutexLock(&data->lock);
+    if (virThreadSelfID() == data->mainThread)
+        data->wrongThread = true;
+    data->fired++;
+    virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+static void
+testEventThreadFree(void *opaque)
+{
+    struct testEventThreadData *data = opaque;
+
+    virMutexLock(&data->lock);
+    data->freed = true;
+    virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+/* Handles registered with an event thread must be dispatched by
+ * that thread without anyone running the default loop, and be
+ * released once the thread goes away */
+static int
+testEventThread(const void *opaque ATTRIBUTE_UNUSED)
+{
+    static struct testEventThreadData data;
+    virEventThreadPtr evt = NULL;
+    int fd[2] = { -1, -1 };
+    unsigned long long then;
+    char one = '1';
+    size_t i;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+    if (virMutexInit(&data.lock) < 0 ||
+        virCondInit(&data.cond) < 0)
+        return -1;
+    data.mainThread = virThreadSelfID();
+
+    if (pipe(fd) < 0) {
+        fprintf(stderr, "Cannot create pipe: %d\n", errno);
+        goto cleanup;
+    }
+
+    if (!(evt = virEventThreadNew("test-event-thread")))
+        goto cleanup;
+
+    if (virEventThreadAddHandle(evt, fd[0], VIR_EVENT_HANDLE_READABLE,
+                                testEventThreadReader, &data,
+                                testEventThreadFree) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&then) < 0)
+        goto cleanup;
+    then += 5000;
+
+    virMutexLock(&data.lock);
+    for (i = 0; i < 10; i++) {
+        if (safewrite(fd[1], &one, 1) != 1)
+            break;
+        while (data.fired == i) {
+            if (virCondWaitUntil(&data.cond, &data.lock, then) < 0)
+                break;
+        }
+        if (data.fired != i + 1)
+            break;
+    }
+    virMutexUnlock(&data.lock);
+
+    if (i != 10 || data.wrongThread) {
+        fprintf(stderr, "expected 10 events in the event thread, got %zu "
+                "(dispatched by the main thread: %d)\n",
+                data.fired, data.wrongThread);
+        goto cleanup;
+    }
+
+    virEventThreadStop(evt);
+    virObjectUnref(evt);
+    evt = NULL;
+
+    virMutexLock(&data.lock);
+    while (!data.freed) {
+        if (virCondWaitUntil(&data.cond, &data.lock, then) < 0)
+            break;
+    }
+    virMutexUnlock(&data.lock);
+
+    if (!data.freed) {
+        fprintf(stderr, "handle not released after the thread quit\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (evt) {
+        virEventThreadStop(evt);
+        virObjectUnref(evt);
+    }
+    VIR_FORCE_CLOSE(fd[0]);
+    VIR_FORCE_CLOSE(fd[1]);
+    /* On failure the free callback may still be pending */
+    if (ret == 0) {
+        virCondDestroy(&data.cond);
+        virMutexDestroy(&data.lock);
+    }
+    return ret;
+}
+
+static void
+testLoopTimer(int timer ATTRIBUTE_UNUSED,
+              void *data)
+{
+    bool *fired = data;
+
+    *fired = true;
+}
+
+/* Runs @loop until a 50ms timer fires. A loop which has nothing
+ * but the timer to wait for does so in very few iterations, while
+ * one which busy loops needs a great many. */
+static int
+testLoopIdle(virEventPollLoopPtr loop,
+             const char *what)
+{
+    bool fired = false;
+    size_t iterations = 0;
+    int timer;
+
+    if ((timer = virEventPollLoopAddTimeout(loop, 50, testLoopTimer,
+                                            &fired, NULL)) < 0)
+        return -1;
+
+    while (!fired && iterations < 100) {
+        if (virEventPollLoopRunOnce(loop) < 0)
+            break;
+        iterations++;
+    }
+
+    virEventPollLoopRemoveTimeout(loop, timer);
+
+    if (!fired || iterations > 10) {
+        fprintf(stderr, "%s: timer fired %d after %zu iterations\n",
+                what, fired, iterations);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* A disabled handle must not keep the loop busy, even if its fd
+ * can't be waited for and is therefore always considered ready */
+static int
+testDisabledHandle(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virEventPollLoopPtr loop;
+    bool idleFired = false;
+    int fd;
+    int watch;
+    int ret = -1;
+
+    if ((fd = open("/dev/null", O_RDONLY)) < 0) {
+        fprintf(stderr, "Cannot open /dev/null: %d\n", errno);
+        return -1;
+    }
+
+    if (!(loop = virEventPollLoopNew()))
+        goto cleanup;
+
+    if ((watch = virEventPollLoopAddHandle(loop, fd, VIR_EVENT_HANDLE_READABLE,
+                                           testWakeupIdle, &idleFired,
+                                           NULL)) < 0)
+        goto cleanup;
+    virEventPollLoopUpdateHandle(loop, watch, 0);
+
+    if (testLoopIdle(loop, "disabled handle") < 0)
+        goto cleanup;
+
+    if (idleFired) {
+        fprintf(stderr, "disabled handle was dispatched\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virEventPollLoopFree(loop);
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+/* Closing a fd before its handle is removed is a bug in the
+ * caller, but must neither keep the loop busy with the closed
+ * file nor prevent a new handle for the reused fd number from
+ * being dispatched */
+static int
+testClosedBeforeRemoval(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virEventPollLoopPtr loop;
+    int oldfd[2] = { -1, -1 };
+    int newfd[2] = { -1, -1 };
+    int dupfd = -1;
+    int fd = -1;
+    int oldWatch;
+    size_t oldFired = 0;
+    size_t newFired = 0;
+    char one = '1';
+    int ret = -1;
+
+    if (!(loop = virEventPollLoopNew()))
+        return -1;
+
+    if (pipe(oldfd) < 0 || pipe(newfd) < 0) {
+        fprintf(stderr, "Cannot create pipe: %d\n", errno);
+        goto cleanup;
+    }
+
+    if ((oldWatch = virEventPollLoopAddHandle(loop, oldfd[0],
+                                              VIR_EVENT_HANDLE_READABLE,
+                                              testWakeupReader, &oldFired,
+                                              NULL)) < 0)
+        goto cleanup;
+
+    /* Keep the old pipe open elsewhere and readable, then put
+     * the new one in place of the fd which is still watched */
+    if ((dupfd = dup(oldfd[0])) < 0 ||
+        safewrite(oldfd[1], &one, 1) != 1 ||
+        dup2(newfd[0], oldfd[0]) < 0) {
+        fprintf(stderr, "Cannot replace fd: %d\n", errno);
+        goto cleanup;
+    }
+    fd = oldfd[0];
+    oldfd[0] = -1;
+
+    if (virEventPollLoopAddHandle(loop, fd, VIR_EVENT_HANDLE_READABLE,
+                                  testWakeupReader, &newFired, NULL) < 0)
+        goto cleanup;
+    virEventPollLoopRemoveHandle(loop, oldWatch);
+
+    if (safewrite(newfd[1], &one, 1) != 1)
+        goto cleanup;
+
+    if (virEventPollLoopRunOnce(loop) < 0)
+        goto cleanup;
+
+    if (newFired != 1 || oldFired != 0) {
+        fprintf(stderr, "expected the new handle to fire once, got %zu "
+                "(old handle: %zu)\n", newFired, oldFired);
+        goto cleanup;
+    }
+
+    if (testLoopIdle(loop, "closed fd") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virEventPollLoopFree(loop);
+    VIR_FORCE_CLOSE(oldfd[0]);
+    VIR_FORCE_CLOSE(oldfd[1]);
+    VIR_FORCE_CLOSE(newfd[0]);
+    VIR_FORCE_CLOSE(newfd[1]);
+    VIR_FORCE_CLOSE(dupfd);
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
 static int
 mymain(void)
 {
     size_t i;
     pthread_t eventThread;
     char one = '1';
+    int ret = 0;
+
+#ifdef EVENT_TEST_EPOLL
+# ifdef HAVE_SYS_EPOLL_H
+    setenv("LIBVIRT_EVENT_LOOP", "epoll", 1);
+# else
+    return EXIT_AM_SKIP;
+# endif
+#endif
 
     for (i = 0; i < NUM_FDS; i++) {
         if (pipe(handles[i].pipeFD) < 0) {
@@ -333,7 +773,8 @@ mymain(void)
         return EXIT_FAILURE;
     }
 
-    virEventPollInit();
+    if (virEventPollInit() < 0)
+        return EXIT_FAILURE;
 
     for (i = 0; i < NUM_FDS; i++) {
         handles[i].delete = -1;
@@ -523,9 +964,33 @@ mymain(void)
     if (finishJob("Write duplicate", 1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
+    /* The event thread is idle now, so we can drive the
+     * loop ourselves */
+#define DO_TEST_WAKEUP(n)                                               \
+    do {                                                                \
+        struct testWakeupData data = { .nhandles = n };                 \
+        if (virTestRun("Wakeup latency with " #n " handles",            \
+                       testWakeupLatency, &data) < 0)                   \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_WAKEUP(1000);
+
+    if (virTestGetExpensive())
+        DO_TEST_WAKEUP(10000);
+
+    if (virTestRun("Event thread", testEventThread, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Disabled handle", testDisabledHandle, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Closed before removal", testClosedBeforeRemoval, NULL) < 0)
+        ret = -1;
+
     //pthread_kill(eventThread, SIGTERM);
 
-    return EXIT_SUCCESS;
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 VIRT_TEST_MAIN(mymain)
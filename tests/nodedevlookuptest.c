@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "virnodedeviceobj.h"
+#include "viralloc.h"
+#include "virstring.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Adds the device @name with the sysfs path @sysfs_path to @devs */
+static virNodeDeviceObjPtr
+testAssignDev(virNodeDeviceObjListPtr devs,
+              const char *name,
+              const char *sysfs_path)
+{
+    virNodeDeviceDefPtr def;
+    virNodeDeviceObjPtr dev;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    if (VIR_STRDUP(def->name, name) < 0 ||
+        VIR_STRDUP(def->sysfs_path, sysfs_path) < 0 ||
+        !(dev = virNodeDeviceObjAssignDef(devs, def))) {
+        virNodeDeviceDefFree(def);
+        return NULL;
+    }
+
+    virNodeDeviceObjUnlock(dev);
+    return dev;
+}
+
+
+/* Checks that @name and @sysfs_path refer to @expect, if not NULL */
+static bool
+testFindDev(virNodeDeviceObjListPtr devs,
+            const char *name,
+            const char *sysfs_path,
+            virNodeDeviceObjPtr expect)
+{
+    virNodeDeviceObjPtr dev;
+    bool ret = true;
+
+    if (name) {
+        if ((dev = virNodeDeviceObjFindByName(devs, name)))
+            virNodeDeviceObjUnlock(dev);
+        ret &= dev == expect;
+    }
+
+    if (sysfs_path) {
+        if ((dev = virNodeDeviceObjFindBySysfsPath(devs, sysfs_path)))
+            virNodeDeviceObjUnlock(dev);
+        ret &= dev == expect;
+    }
+
+    return ret;
+}
+
+
+static void
+testRemoveDev(virNodeDeviceObjListPtr devs,
+              virNodeDeviceObjPtr dev)
+{
+    virNodeDeviceObjLock(dev);
+    virNodeDeviceObjRemove(devs, &dev);
+}
+
+
+/* A removed device is no longer found, the others still are */
+static int
+testRemove(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNodeDeviceObjList devs = { 0 };
+    virNodeDeviceObjPtr a;
+    virNodeDeviceObjPtr b;
+    virNodeDeviceObjPtr c;
+    int ret = -1;
+
+    if (!(a = testAssignDev(&devs, "a", "/sys/a")) ||
+        !(b = testAssignDev(&devs, "b", "/sys/b")) ||
+        !(c = testAssignDev(&devs, "c", "/sys/c")))
+        goto cleanup;
+
+    testRemoveDev(&devs, b);
+
+    if (devs.count != 2 ||
+        !testFindDev(&devs, "b", "/sys/b", NULL) ||
+        !testFindDev(&devs, "a", "/sys/a", a) ||
+        !testFindDev(&devs, "c", "/sys/c", c)) {
+        fprintf(stderr, "wrong devices found after removal\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virNodeDeviceObjListFree(&devs);
+    return ret;
+}
+
+
+/* A device changing its sysfs path is found by the new one only */
+static int
+testReassign(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNodeDeviceObjList devs = { 0 };
+    virNodeDeviceObjPtr dev;
+    int ret = -1;
+
+    if (!(dev = testAssignDev(&devs, "dev", "/sys/old")) ||
+        testAssignDev(&devs, "dev", "/sys/new") != dev)
+        goto cleanup;
+
+    if (devs.count != 1 ||
+        !testFindDev(&devs, "dev", "/sys/new", dev) ||
+        !testFindDev(&devs, NULL, "/sys/old", NULL)) {
+        fprintf(stderr, "device not found by its new sysfs path\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virNodeDeviceObjListFree(&devs);
+    return ret;
+}
+
+
+/* A sysfs path shared by several devices refers to the first one
+ * still in the list */
+static int
+testDuplicates(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNodeDeviceObjList devs = { 0 };
+    virNodeDeviceObjPtr first;
+    virNodeDeviceObjPtr second;
+    virNodeDeviceObjPtr third;
+    int ret = -1;
+
+    if (!(first = testAssignDev(&devs, "first", "/sys/dev")) ||
+        !(second = testAssignDev(&devs, "second", "/sys/dev")) ||
+        !(third = testAssignDev(&devs, "third", "/sys/dev")))
+        goto cleanup;
+
+    if (!testFindDev(&devs, NULL, "/sys/dev", first)) {
+        fprintf(stderr, "first device not found\n");
+        goto cleanup;
+    }
+
+    /* Removing one which is shadowed changes nothing */
+    testRemoveDev(&devs, second);
+
+    if (!testFindDev(&devs, "second", NULL, NULL) ||
+        !testFindDev(&devs, "first", "/sys/dev", first)) {
+        fprintf(stderr, "first device not found after removing second\n");
+        goto cleanup;
+    }
+
+    testRemoveDev(&devs, first);
+
+    if (!testFindDev(&devs, "first", NULL, NULL) ||
+        !testFindDev(&devs, "third", "/sys/dev", third)) {
+        fprintf(stderr, "third device not found\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virNodeDeviceObjListFree(&devs);
+    return ret;
+}
+
+
+/* A device moving away from a shared sysfs path hands it over to
+ * the other device */
+static int
+testReassignShared(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNodeDeviceObjList devs = { 0 };
+    virNodeDeviceObjPtr first;
+    virNodeDeviceObjPtr second;
+    int ret = -1;
+
+    if (!(first = testAssignDev(&devs, "first", "/sys/dev")) ||
+        !(second = testAssignDev(&devs, "second", "/sys/dev")) ||
+        testAssignDev(&devs, "first", "/sys/other") != first)
+        goto cleanup;
+
+    if (!testFindDev(&devs, "second", "/sys/dev", second) ||
+        !testFindDev(&devs, "first", "/sys/other", first)) {
+        fprintf(stderr, "devices not found by their sysfs paths\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virNodeDeviceObjListFree(&devs);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virTestRun("Remove", testRemove, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Reassign", testReassign, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Duplicates", testDuplicates, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Reassign shared", testReassignShared, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -23,7 +23,9 @@
 
 #include "testutils.h"
 
+#include "viralloc.h"
 #include "virerror.h"
+#include "virtime.h"
 #include "virxml.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -194,6 +196,16 @@ nodeDeviceLifecycleCb(virConnectPtr conn ATTRIBUTE_UNUSED,
         counter->deletedEvents++;
 }
 
+static void
+domainGenericCb(virConnectPtr conn ATTRIBUTE_UNUSED,
+                virDomainPtr dom ATTRIBUTE_UNUSED,
+                void *opaque)
+{
+    int *counter = opaque;
+
+    (*counter)++;
+}
+
 static int
 testDomainCreateXMLOld(const void *data)
 {
@@ -468,6 +480,148 @@ testDomainStartStopEvent(const void *data)
     return ret;
 }
 
+struct testManyCallbacksData {
+    const objecteventTest *test;
+    size_t ncallbacks;
+};
+
+/* A connection can register a callback only once for each event and
+ * domain, so spread the callbacks over as many connections as needed */
+#define TEST_CALLBACKS_PER_CONN \
+    (2 * (VIR_DOMAIN_EVENT_ID_LAST - VIR_DOMAIN_EVENT_ID_REBOOT))
+
+static int
+testDomainManyCallbacks(const void *opaque)
+{
+    const struct testManyCallbacksData *data = opaque;
+    const objecteventTest *test = data->test;
+    lifecycleEventCounter counter;
+    lifecycleEventCounter otherCounter;
+    virConnectPtr *conns = NULL;
+    virDomainPtr *doms = NULL;
+    int *unexpected = NULL;
+    int *ids = NULL;
+    int id = -1;
+    int otherID = -1;
+    int ret = -1;
+    virDomainPtr dom = NULL;
+    virDomainPtr other = NULL;
+    size_t nconns = 0;
+    size_t nids = 0;
+    size_t i;
+    unsigned long long start;
+    unsigned long long end;
+
+    lifecycleEventCounter_reset(&counter);
+    lifecycleEventCounter_reset(&otherCounter);
+
+    if (VIR_ALLOC_N(unexpected, data->ncallbacks) < 0 ||
+        VIR_ALLOC_N(ids, data->ncallbacks) < 0 ||
+        VIR_ALLOC_N(conns, data->ncallbacks / TEST_CALLBACKS_PER_CONN + 1) < 0 ||
+        VIR_ALLOC_N(doms, data->ncallbacks / TEST_CALLBACKS_PER_CONN + 1) < 0)
+        goto cleanup;
+
+    if (!(dom = virDomainLookupByName(test->conn, "test")) ||
+        !(other = virDomainDefineXML(test->conn, domainDef)))
+        goto cleanup;
+
+    /* Lots of callbacks for events which are never emitted here, half
+     * of them for any domain and half of them for the test domain */
+    for (i = 0; i < data->ncallbacks; i++) {
+        size_t slot = i % TEST_CALLBACKS_PER_CONN;
+        int eventID = VIR_DOMAIN_EVENT_ID_REBOOT + slot / 2;
+
+        if (slot == 0) {
+            if (!(conns[nconns] = virConnectOpen("test:///default")) ||
+                !(doms[nconns] = virDomainLookupByName(conns[nconns], "test")))
+                goto cleanup;
+            nconns++;
+        }
+
+        if ((ids[nids] = virConnectDomainEventRegisterAny(conns[nconns - 1],
+                                                          slot % 2 ? doms[nconns - 1] : NULL,
+                                                          eventID,
+                                                          VIR_DOMAIN_EVENT_CALLBACK(&domainGenericCb),
+                                                          &unexpected[i],
+                                                          NULL)) < 0)
+            goto cleanup;
+        nids++;
+    }
+
+    /* The lifecycle callback for the other domain must not be called */
+    if ((otherID = virConnectDomainEventRegisterAny(test->conn, other,
+                                                    VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                    VIR_DOMAIN_EVENT_CALLBACK(&domainLifecycleCb),
+                                                    &otherCounter, NULL)) < 0)
+        goto cleanup;
+
+    if ((id = virConnectDomainEventRegisterAny(test->conn, dom,
+                                               VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                               VIR_DOMAIN_EVENT_CALLBACK(&domainLifecycleCb),
+                                               &counter, NULL)) < 0)
+        goto cleanup;
+
+    for (i = 0; i < 10; i++) {
+        if (virDomainDestroy(dom) < 0 ||
+            virDomainCreate(dom) < 0)
+            goto cleanup;
+    }
+
+    /* The events queued meanwhile are all dispatched in one go */
+    if (virTimeMillisNow(&start) < 0 ||
+        virEventRunDefaultImpl() < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    VIR_TEST_VERBOSE("\n%zu callbacks: 20 events dispatched in %llu ms\n",
+                     data->ncallbacks, end - start);
+
+    if (counter.startEvents != 10 || counter.stopEvents != 10 ||
+        counter.unexpectedEvents > 0)
+        goto cleanup;
+
+    if (otherCounter.startEvents || otherCounter.stopEvents ||
+        otherCounter.defineEvents || otherCounter.undefineEvents)
+        goto cleanup;
+
+    for (i = 0; i < data->ncallbacks; i++) {
+        if (unexpected[i] != 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (id >= 0)
+        virConnectDomainEventDeregisterAny(test->conn, id);
+    if (otherID >= 0)
+        virConnectDomainEventDeregisterAny(test->conn, otherID);
+    for (i = 0; i < nids; i++)
+        virConnectDomainEventDeregisterAny(conns[i / TEST_CALLBACKS_PER_CONN],
+                                           ids[i]);
+    for (i = 0; i < nconns; i++) {
+        if (doms[i])
+            virDomainFree(doms[i]);
+        virConnectClose(conns[i]);
+    }
+    if (other) {
+        virDomainUndefine(other);
+        virDomainFree(other);
+    }
+    if (dom)
+        virDomainFree(dom);
+    VIR_FREE(unexpected);
+    VIR_FREE(ids);
+    VIR_FREE(doms);
+    VIR_FREE(conns);
+
+    return ret;
+}
+
+#undef TEST_CALLBACKS_PER_CONN
+
 static int
 testNetworkCreateXML(const void *data)
 {
@@ -798,6 +952,19 @@ mymain(void)
     if (virTestRun("Domain start stop events", testDomainStartStopEvent, &test) < 0)
         ret = EXIT_FAILURE;
 
+#define DO_TEST_MANY_CALLBACKS(n)                                       \
+    do {                                                                \
+        struct testManyCallbacksData data = { &test, n };               \
+        if (virTestRun("Domain events with " #n " callbacks",           \
+                       testDomainManyCallbacks, &data) < 0)             \
+            ret = EXIT_FAILURE;                                         \
+    } while (0)
+
+    DO_TEST_MANY_CALLBACKS(2000);
+    /* Registering 10k callbacks takes a while */
+    if (virTestGetExpensive())
+        DO_TEST_MANY_CALLBACKS(10000);
+
     /* Network event tests */
     /* Tests requiring the test network not to be set up*/
     if (virTestRun("Network createXML start event ", testNetworkCreateXML, &test) < 0)
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "qemu/qemu_capabilities.h"
+#define __QEMU_CAPSRIV_H_ALLOW__
+#include "qemu/qemu_capspriv.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define MAX_BINARIES 8
+
+/* How long the first probe waits for another one to start */
+#define OVERLAP_TIMEOUT 10000
+
+struct testPrefetchData {
+    const char *binaries[MAX_BINARIES];   /* passed to the prefetch */
+    const char *cached[MAX_BINARIES];     /* valid in the cache already */
+    const char *lookedUp;                 /* looked up while probed */
+    const char *probed[MAX_BINARIES];     /* expected to be probed */
+};
+
+/* Probes of binaries named "fail..." fail */
+struct testProbeState {
+    virMutex lock;
+    virCond cond;
+    const struct testPrefetchData *data;
+
+    const char *started[MAX_BINARIES];
+    virQEMUCapsPtr results[MAX_BINARIES];
+    size_t nstarted;
+    size_t active;
+    size_t maxActive;
+
+    virQEMUCapsPtr lookedUpCaps;
+};
+
+
+static virQEMUCapsPtr
+testProbe(virQEMUCapsCachePtr cache,
+          const char *binary,
+          void *opaque)
+{
+    struct testProbeState *state = opaque;
+    virQEMUCapsPtr qemuCaps = NULL;
+    unsigned long long deadline = 0;
+    size_t idx;
+
+    ignore_value(virTimeMillisNow(&deadline));
+    deadline += OVERLAP_TIMEOUT;
+
+    virMutexLock(&state->lock);
+    idx = state->nstarted++;
+    if (idx < MAX_BINARIES)
+        state->started[idx] = binary;
+    state->active++;
+    state->maxActive = MAX(state->maxActive, state->active);
+    virCondBroadcast(&state->cond);
+
+    /* Make sure the probes really run in parallel */
+    while (idx == 0 && state->nstarted < 2) {
+        if (virCondWaitUntil(&state->cond, &state->lock, deadline) < 0)
+            break;
+    }
+    virMutexUnlock(&state->lock);
+
+    /* Later probes finish first */
+    usleep((MAX_BINARIES - MIN(idx, MAX_BINARIES)) * 2000);
+
+    if (STRPREFIX(binary, "fail")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "simulated probe failure of %s", binary);
+    } else {
+        if (!(qemuCaps = virQEMUCapsNew()))
+            goto cleanup;
+
+        if (STREQ_NULLABLE(binary, state->data->lookedUp)) {
+            virMutexLock(&cache->lock);
+            if ((state->lookedUpCaps = virQEMUCapsNew()))
+                ignore_value(virHashAddEntry(cache->binaries, binary,
+                                             state->lookedUpCaps));
+            virMutexUnlock(&cache->lock);
+        }
+    }
+
+ cleanup:
+    virMutexLock(&state->lock);
+    if (idx < MAX_BINARIES)
+        state->results[idx] = qemuCaps;
+    state->active--;
+    virMutexUnlock(&state->lock);
+
+    return qemuCaps;
+}
+
+
+static bool
+testInList(const char *const *list,
+           const char *binary)
+{
+    size_t i;
+
+    for (i = 0; i < MAX_BINARIES && list[i]; i++) {
+        if (STREQ(list[i], binary))
+            return true;
+    }
+
+    return false;
+}
+
+
+static int
+testPrefetch(const void *opaque)
+{
+    const struct testPrefetchData *data = opaque;
+    struct testProbeState state;
+    virQEMUCapsCachePtr cache = NULL;
+    virQEMUCapsPtr cached[MAX_BINARIES] = { NULL };
+    char *binaries[MAX_BINARIES];
+    size_t nbinaries = 0;
+    size_t nprobed = 0;
+    size_t i;
+    int ret = -1;
+
+    memset(&state, 0, sizeof(state));
+    state.data = data;
+
+    if (virMutexInit(&state.lock) < 0)
+        return -1;
+    if (virCondInit(&state.cond) < 0) {
+        virMutexDestroy(&state.lock);
+        return -1;
+    }
+
+    if (!(cache = virQEMUCapsCacheNew("/nonexistent", "/nonexistent",
+                                      getuid(), getgid())))
+        goto cleanup;
+
+    /* Capabilities not tied to a binary never get outdated */
+    for (i = 0; data->cached[i]; i++) {
+        if (!(cached[i] = virQEMUCapsNew()) ||
+            virHashAddEntry(cache->binaries, data->cached[i], cached[i]) < 0)
+            goto cleanup;
+    }
+
+    for (; data->binaries[nbinaries]; nbinaries++)
+        binaries[nbinaries] = (char *) data->binaries[nbinaries];
+    for (; data->probed[nprobed]; nprobed++)
+        ;
+
+    virQEMUCapsCacheProbe(cache, binaries, nbinaries, testProbe, &state);
+
+    if (virGetLastError()) {
+        fprintf(stderr, "probe error leaked: %s\n", virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    if (state.nstarted != nprobed) {
+        fprintf(stderr, "%zu binaries probed, expected %zu\n",
+                state.nstarted, nprobed);
+        goto cleanup;
+    }
+
+    /* Each binary is probed exactly once */
+    for (i = 0; i < nprobed; i++) {
+        size_t j;
+
+        if (!testInList(data->probed, state.started[i])) {
+            fprintf(stderr, "%s was probed\n", state.started[i]);
+            goto cleanup;
+        }
+
+        for (j = 0; j < i; j++) {
+            if (STREQ(state.started[j], state.started[i])) {
+                fprintf(stderr, "%s was probed twice\n", state.started[i]);
+                goto cleanup;
+            }
+        }
+    }
+
+    if (nprobed &&
+        (state.maxActive < 2 ||
+         state.maxActive > VIR_QEMU_CAPS_PROBE_WORKERS)) {
+        fprintf(stderr, "%zu probes ran at the same time\n",
+                state.maxActive);
+        goto cleanup;
+    }
+
+    for (i = 0; i < nbinaries; i++) {
+        const char *binary = binaries[i];
+        virQEMUCapsPtr got = virHashLookup(cache->binaries, binary);
+        virQEMUCapsPtr expect = NULL;
+        size_t j;
+
+        if (testInList(data->cached, binary)) {
+            for (j = 0; !expect && data->cached[j]; j++) {
+                if (STREQ(data->cached[j], binary))
+                    expect = cached[j];
+            }
+        } else if (STREQ_NULLABLE(binary, data->lookedUp)) {
+            expect = state.lookedUpCaps;
+        } else {
+            for (j = 0; !expect && j < nprobed; j++) {
+                if (STREQ(state.started[j], binary))
+                    expect = state.results[j];
+            }
+        }
+
+        if (got != expect) {
+            fprintf(stderr, "%s has capabilities %p, expected %p\n",
+                    binary, got, expect);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virQEMUCapsCacheFree(cache);
+    ignore_value(virCondDestroy(&state.cond));
+    virMutexDestroy(&state.lock);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(desc, ...)                                              \
+    do {                                                                \
+        static const struct testPrefetchData data = { __VA_ARGS__ };   \
+        if (virTestRun(desc, testPrefetch, &data) < 0)                  \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("Parallel",
+            .binaries = { "qemu0", "qemu1", "qemu2", "qemu3", "qemu4",
+                          "qemu5", "qemu6" },
+            .probed = { "qemu0", "qemu1", "qemu2", "qemu3", "qemu4",
+                        "qemu5", "qemu6" });
+
+    DO_TEST("Failure",
+            .binaries = { "fail0", "qemu1", "fail2", "qemu3" },
+            .probed = { "fail0", "qemu1", "fail2", "qemu3" });
+
+    DO_TEST("All failed",
+            .binaries = { "fail0", "fail1" },
+            .probed = { "fail0", "fail1" });
+
+    DO_TEST("Cached",
+            .binaries = { "qemu0", "qemu1", "qemu2", "qemu3", "qemu4" },
+            .cached = { "qemu1", "qemu3" },
+            .probed = { "qemu0", "qemu2", "qemu4" });
+
+    /* A single binary is probed by the lookup */
+    DO_TEST("Single",
+            .binaries = { "qemu0", "qemu1" },
+            .cached = { "qemu0" });
+
+    DO_TEST("Looked up meanwhile",
+            .binaries = { "qemu0", "qemu1", "qemu2" },
+            .lookedUp = "qemu1",
+            .probed = { "qemu0", "qemu1", "qemu2" });
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "datatypes.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virthread.h"
+#include "virtime.h"
+#include "qemu/qemu_migration_tunnel.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Packet size accepted by servers without large stream packets */
+#define LEGACY_PACKET_SIZE 262120
+
+#define WRITE_SIZE (1024 * 1024)
+
+struct testTunnelData {
+    const char *name;
+    unsigned long long len;     /* bytes QEMU writes */
+    size_t maxPacket;           /* bytes the stream accepts at once */
+    bool closeSock;             /* whether QEMU closes its socket */
+    bool abort;                 /* whether migration is cancelled */
+    unsigned long long failAt;  /* fail sending after this many bytes */
+};
+
+/* Fake destination, checks everything arrives in order */
+struct testStream {
+    size_t maxPacket;
+    unsigned long long failAt;
+    unsigned long long received;
+    size_t packets;
+    bool corrupted;
+    bool finished;
+    bool aborted;
+};
+
+struct testWriter {
+    int fd;
+    unsigned long long len;
+    bool closeSock;
+    int gate;                   /* blocks until closed, -1 if unused */
+};
+
+
+static inline char
+testPattern(unsigned long long off)
+{
+    return (off ^ (off >> 8) ^ (off >> 16)) & 0xff;
+}
+
+
+static int
+testStreamSend(virStreamPtr st,
+               const char *data,
+               size_t nbytes)
+{
+    struct testStream *ts = st->privateData;
+    size_t i;
+
+    if (ts->failAt && ts->received >= ts->failAt) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s",
+                       "simulated stream failure");
+        return -1;
+    }
+
+    if (ts->maxPacket && nbytes > ts->maxPacket)
+        nbytes = ts->maxPacket;
+
+    for (i = 0; i < nbytes; i++) {
+        if (data[i] != testPattern(ts->received + i)) {
+            ts->corrupted = true;
+            break;
+        }
+    }
+
+    ts->received += nbytes;
+    ts->packets++;
+    return nbytes;
+}
+
+
+static int
+testStreamFinish(virStreamPtr st)
+{
+    struct testStream *ts = st->privateData;
+
+    ts->finished = true;
+    return 0;
+}
+
+
+static int
+testStreamAbort(virStreamPtr st)
+{
+    struct testStream *ts = st->privateData;
+
+    ts->aborted = true;
+    return 0;
+}
+
+
+static virStreamDriver testStreamDriver = {
+    .streamSend = testStreamSend,
+    .streamFinish = testStreamFinish,
+    .streamAbort = testStreamAbort,
+};
+
+
+/* Plays the role of QEMU writing migration data */
+static void
+testWriterFunc(void *opaque)
+{
+    struct testWriter *writer = opaque;
+    char *buf = NULL;
+    unsigned long long off = 0;
+    size_t i;
+
+    if (VIR_ALLOC_N(buf, WRITE_SIZE) < 0)
+        goto cleanup;
+
+    while (off < writer->len) {
+        size_t len = MIN(WRITE_SIZE, writer->len - off);
+
+        for (i = 0; i < len; i++)
+            buf[i] = testPattern(off + i);
+
+        /* The tunnel closes its end when sending fails */
+        if (safewrite(writer->fd, buf, len) != len)
+            break;
+        off += len;
+
+        /* Keep the socket open until the test is done with the tunnel */
+        if (writer->gate >= 0) {
+            char c;
+
+            ignore_value(saferead(writer->gate, &c, 1));
+            VIR_FORCE_CLOSE(writer->gate);
+        }
+    }
+
+ cleanup:
+    if (writer->closeSock)
+        VIR_FORCE_CLOSE(writer->fd);
+    VIR_FREE(buf);
+}
+
+
+static int
+testTunnel(const void *opaque)
+{
+    const struct testTunnelData *data = opaque;
+    struct testStream ts = {
+        .maxPacket = data->maxPacket,
+        .failAt = data->failAt,
+    };
+    struct testWriter writer = {
+        .fd = -1,
+        .len = data->len,
+        .closeSock = data->closeSock,
+        .gate = -1,
+    };
+    virConnectPtr conn = NULL;
+    virStreamPtr st = NULL;
+    qemuMigrationTunnelPtr tunnel = NULL;
+    virThread thread;
+    unsigned long long start;
+    unsigned long long end;
+    int sv[2] = { -1, -1 };
+    int gate[2] = { -1, -1 };
+    int rc;
+    int ret = -1;
+
+    if (!(conn = virGetConnect()) ||
+        !(st = virGetStream(conn)))
+        goto cleanup;
+
+    st->driver = &testStreamDriver;
+    st->privateData = &ts;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        goto cleanup;
+
+    if (!(tunnel = qemuMigrationTunnelStart(st, sv[0])))
+        goto cleanup;
+    sv[0] = -1;
+
+    writer.fd = sv[1];
+    sv[1] = -1;
+
+    /* Without the gate QEMU could write everything and close the socket
+     * before the tunnel is stopped, letting the stream finish instead */
+    if (data->abort) {
+        if (pipe(gate) < 0) {
+            ignore_value(qemuMigrationTunnelStop(tunnel, true));
+            goto cleanup;
+        }
+        writer.gate = gate[0];
+        gate[0] = -1;
+    }
+
+    if (virTimeMillisNow(&start) < 0 ||
+        virThreadCreate(&thread, true, testWriterFunc, &writer) < 0) {
+        ignore_value(qemuMigrationTunnelStop(tunnel, true));
+        goto cleanup;
+    }
+
+    /* Migration is cancelled while QEMU may still be writing */
+    if (data->abort) {
+        rc = qemuMigrationTunnelStop(tunnel, true);
+        VIR_FORCE_CLOSE(gate[1]);
+        virThreadJoin(&thread);
+    } else {
+        virThreadJoin(&thread);
+        rc = qemuMigrationTunnelStop(tunnel, false);
+    }
+    ignore_value(virTimeMillisNow(&end));
+
+    VIR_TEST_VERBOSE("\n%s: %llu MiB in %zu packets, %llu ms",
+                     data->name, ts.received >> 20, ts.packets, end - start);
+    if (end > start)
+        VIR_TEST_VERBOSE(", %llu MiB/s",
+                         (ts.received >> 20) * 1000 / (end - start));
+    VIR_TEST_VERBOSE("\n");
+
+    if (ts.corrupted) {
+        fprintf(stderr, "data corrupted in the tunnel\n");
+        goto cleanup;
+    }
+
+    if (data->abort) {
+        if (rc < 0 || !ts.aborted || ts.finished) {
+            fprintf(stderr, "stream was not aborted\n");
+            goto cleanup;
+        }
+    } else if (data->failAt) {
+        if (rc == 0 || ts.finished) {
+            fprintf(stderr, "stream failure was not reported\n");
+            goto cleanup;
+        }
+        virResetLastError();
+    } else {
+        if (rc < 0 || !ts.finished || ts.aborted ||
+            ts.received != data->len) {
+            fprintf(stderr, "received %llu bytes, expected %llu\n",
+                    ts.received, data->len);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(sv[0]);
+    VIR_FORCE_CLOSE(sv[1]);
+    VIR_FORCE_CLOSE(gate[0]);
+    VIR_FORCE_CLOSE(gate[1]);
+    VIR_FORCE_CLOSE(writer.fd);
+    VIR_FORCE_CLOSE(writer.gate);
+    virObjectUnref(st);
+    virObjectUnref(conn);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    /* QEMU side of the socket is written after the tunnel closes it */
+    signal(SIGPIPE, SIG_IGN);
+
+#define DO_TEST_FULL(desc, l, p, c, a, f)                               \
+    do {                                                                \
+        struct testTunnelData data = {                                  \
+            .name = desc, .len = l, .maxPacket = p, .closeSock = c,     \
+            .abort = a, .failAt = f,                                    \
+        };                                                              \
+        if (virTestRun(desc, testTunnel, &data) < 0)                    \
+            ret = -1;                                                   \
+    } while (0)
+
+#define DO_TEST(desc, l, p) \
+    DO_TEST_FULL(desc, l, p, true, false, 0)
+
+    DO_TEST("Empty", 0, 0);
+    DO_TEST("Small", 12345, 0);
+    DO_TEST("Large packets", 64ULL << 20, 0);
+    DO_TEST("Legacy packets", 64ULL << 20, LEGACY_PACKET_SIZE);
+    DO_TEST_FULL("Socket left open", 16ULL << 20, 0, false, false, 0);
+    DO_TEST_FULL("Abort", 16ULL << 20, 0, true, true, 0);
+    DO_TEST_FULL("Send failure", 64ULL << 20, 0, true, false, 8ULL << 20);
+
+    if (virTestGetExpensive()) {
+        DO_TEST("Benchmark large packets", 4ULL << 30, 0);
+        DO_TEST("Benchmark legacy packets", 4ULL << 30, LEGACY_PACKET_SIZE);
+    }
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -27,6 +27,9 @@
 #include "virthread.h"
 #include "virerror.h"
 #include "virstring.h"
+#include "virbuffer.h"
+#include "virfile.h"
+#include "virtime.h"
 #include "cpu/cpu.h"
 #include "qemu/qemu_monitor.h"
 
@@ -1771,6 +1774,151 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
     return ret;
 }
 
+static const char *testBlockStatsReply =
+    "{"
+    "    \"return\": ["
+    "        {"
+    "            \"device\": \"drive-virtio-disk0\","
+    "            \"stats\": {"
+    "                \"flush_total_time_ns\": 0,"
+    "                \"wr_highest_offset\": 10406001664,"
+    "                \"wr_total_time_ns\": 530699221,"
+    "                \"wr_bytes\": 2845696,"
+    "                \"rd_total_time_ns\": 640616474,"
+    "                \"flush_operations\": 0,"
+    "                \"wr_operations\": 174,"
+    "                \"rd_bytes\": 28505088,"
+    "                \"rd_operations\": 1279"
+    "            }"
+    "        }"
+    "    ]"
+    "}";
+
+static const char *testBlockReply =
+    "{"
+    "    \"return\": ["
+    "        {"
+    "            \"device\": \"drive-virtio-disk0\","
+    "            \"inserted\": {"
+    "                \"image\": {"
+    "                    \"virtual-size\": 21474836480,"
+    "                    \"actual-size\": 5256018944"
+    "                }"
+    "            }"
+    "        }"
+    "    ]"
+    "}";
+
+
+static int
+testQemuMonitorJSONCheckAllBlockStatsCapacity(qemuMonitorTestPtr test)
+{
+    virHashTablePtr blockstats = NULL;
+    qemuBlockStatsPtr stats;
+    int ret = -1;
+
+    if (qemuMonitorGetAllBlockStatsCapacity(qemuMonitorTestGetMonitor(test),
+                                            &blockstats, false) < 0)
+        goto cleanup;
+
+    if (!blockstats ||
+        !(stats = virHashLookup(blockstats, "virtio-disk0"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "block stats for 'virtio-disk0' are missing");
+        goto cleanup;
+    }
+
+    if (stats->rd_req != 1279 || stats->wr_bytes != 2845696 ||
+        stats->capacity != 21474836480ULL ||
+        stats->physical != 5256018944ULL) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "unexpected stats: rd_req=%lld wr_bytes=%lld "
+                       "capacity=%llu physical=%llu",
+                       stats->rd_req, stats->wr_bytes,
+                       stats->capacity, stats->physical);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(blockstats);
+    return ret;
+}
+
+static int
+testQemuMonitorJSONqemuMonitorJSONGetAllBlockStatsCapacity(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    int ret = -1;
+
+    if (!test)
+        return -1;
+
+    /* Both commands are written to the monitor before any reply is read */
+    if (qemuMonitorTestAddItem(test, "query-blockstats",
+                               testBlockStatsReply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-block", testBlockReply) < 0)
+        goto cleanup;
+
+    ret = testQemuMonitorJSONCheckAllBlockStatsCapacity(test);
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+static int
+testQemuMonitorJSONDelayedReplyHandler(qemuMonitorTestPtr test ATTRIBUTE_UNUSED,
+                                       qemuMonitorTestItemPtr item ATTRIBUTE_UNUSED,
+                                       const char *message ATTRIBUTE_UNUSED)
+{
+    return 0;
+}
+
+static int
+testQemuMonitorJSONBothRepliesHandler(qemuMonitorTestPtr test,
+                                      qemuMonitorTestItemPtr item ATTRIBUTE_UNUSED,
+                                      const char *message ATTRIBUTE_UNUSED)
+{
+    char *replies = NULL;
+    int ret;
+
+    if (virAsprintf(&replies, "%s\r\n%s",
+                    testBlockStatsReply, testBlockReply) < 0)
+        return -1;
+
+    ret = qemuMonitorTestAddResponse(test, replies);
+    VIR_FREE(replies);
+    return ret;
+}
+
+static int
+testQemuMonitorJSONqemuMonitorJSONGetAllBlockStatsCapacityNoID(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    int ret = -1;
+
+    if (!test)
+        return -1;
+
+    /* Replies without an ID arrive in a single buffer and have to be
+     * matched with the commands in the order they were sent */
+    if (qemuMonitorTestAddHandler(test, testQemuMonitorJSONDelayedReplyHandler,
+                                  NULL, NULL) < 0 ||
+        qemuMonitorTestAddHandler(test, testQemuMonitorJSONBothRepliesHandler,
+                                  NULL, NULL) < 0)
+        goto cleanup;
+
+    ret = testQemuMonitorJSONCheckAllBlockStatsCapacity(test);
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONqemuMonitorJSONGetMigrationParams(const void *data)
 {
@@ -2659,6 +2807,148 @@ testQemuMonitorCPUInfo(const void *opaque)
 }
 
 
+#define TEST_IO_PROCESS_ROUNDS 1000
+
+/* Replays the replies captured in qemumonitorjsondata through the QMP
+ * framing and parsing code, the same way they arrive from QEMU, i.e. one
+ * line per reply terminated by CRLF. */
+static int
+testQemuMonitorJSONIOProcess(const void *opaque)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)opaque;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    qemuMonitorMessage msg;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *dirPath = NULL;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    char *path = NULL;
+    char *content = NULL;
+    virJSONValuePtr reply = NULL;
+    char *line = NULL;
+    char *wire = NULL;
+    char *scratch = NULL;
+    size_t *lens = NULL;
+    size_t nlens = 0;
+    size_t wireLen;
+    size_t off;
+    size_t i;
+    size_t j;
+    unsigned long long start;
+    unsigned long long end;
+    int rc;
+    int ret = -1;
+
+    memset(&msg, 0, sizeof(msg));
+
+    if (!test)
+        return -1;
+
+    if (virAsprintf(&dirPath, "%s/qemumonitorjsondata", abs_srcdir) < 0 ||
+        virDirOpen(&dir, dirPath) < 0)
+        goto cleanup;
+
+    while ((rc = virDirRead(dir, &ent, dirPath)) > 0) {
+        size_t len;
+
+        if (!virFileHasSuffix(ent->d_name, ".json"))
+            continue;
+
+        if (virAsprintf(&path, "%s/%s", dirPath, ent->d_name) < 0 ||
+            virTestLoadFile(path, &content) < 0)
+            goto cleanup;
+
+        /* QEMU sends each reply on a single line */
+        if (!(reply = virJSONValueFromString(content)) ||
+            !(line = virJSONValueToString(reply, false)))
+            goto cleanup;
+
+        len = strlen(line) + strlen("\r\n");
+        virBufferAsprintf(&buf, "%s\r\n", line);
+        if (VIR_APPEND_ELEMENT(lens, nlens, len) < 0)
+            goto cleanup;
+
+        VIR_FREE(path);
+        VIR_FREE(content);
+        VIR_FREE(line);
+        virJSONValueFree(reply);
+        reply = NULL;
+    }
+    if (rc < 0)
+        goto cleanup;
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    if (!nlens) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "no replies found in qemumonitorjsondata");
+        goto cleanup;
+    }
+
+    wireLen = virBufferUse(&buf);
+    wire = virBufferContentAndReset(&buf);
+    if (VIR_ALLOC_N(scratch, wireLen + 1) < 0)
+        goto cleanup;
+
+    /* An incomplete reply must not be consumed */
+    memcpy(scratch, wire, wireLen + 1);
+    if (qemuMonitorJSONIOProcess(qemuMonitorTestGetMonitor(test),
+                                 scratch, lens[0] - 1, &msg) != 0 ||
+        msg.rxObject) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "incomplete reply was processed");
+        goto cleanup;
+    }
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_IO_PROCESS_ROUNDS; i++) {
+        /* The replies are parsed in place, so start with a fresh copy */
+        memcpy(scratch, wire, wireLen + 1);
+
+        for (off = 0, j = 0; j < nlens; off += lens[j], j++) {
+            if (qemuMonitorJSONIOProcess(qemuMonitorTestGetMonitor(test),
+                                         scratch + off, lens[j],
+                                         &msg) != (int) lens[j] ||
+                !msg.rxObject) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               "failed to process reply %zu", j);
+                goto cleanup;
+            }
+
+            virJSONValueFree(msg.rxObject);
+            msg.rxObject = NULL;
+            msg.finished = false;
+        }
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    VIR_TEST_VERBOSE("\n%d rounds of %zu replies (%zu bytes) took %llu ms\n",
+                     TEST_IO_PROCESS_ROUNDS, nlens, wireLen, end - start);
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    virJSONValueFree(msg.rxObject);
+    virJSONValueFree(reply);
+    VIR_DIR_CLOSE(dir);
+    VIR_FREE(dirPath);
+    VIR_FREE(path);
+    VIR_FREE(content);
+    VIR_FREE(line);
+    VIR_FREE(wire);
+    VIR_FREE(scratch);
+    VIR_FREE(lens);
+    qemuMonitorTestFree(test);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -2726,6 +3016,7 @@ mymain(void)
     DO_TEST(CPU);
     DO_TEST(GetNonExistingCPUData);
     DO_TEST(GetIOThreads);
+    DO_TEST(IOProcess);
     DO_TEST_SIMPLE("qmp_capabilities", qemuMonitorJSONSetCapabilities);
     DO_TEST_SIMPLE("system_powerdown", qemuMonitorJSONSystemPowerdown);
     DO_TEST_SIMPLE("system_reset", qemuMonitorJSONSystemReset);
@@ -2766,6 +3057,8 @@ mymain(void)
     DO_TEST(qemuMonitorJSONGetBalloonInfo);
     DO_TEST(qemuMonitorJSONGetBlockInfo);
     DO_TEST(qemuMonitorJSONGetBlockStatsInfo);
+    DO_TEST(qemuMonitorJSONGetAllBlockStatsCapacity);
+    DO_TEST(qemuMonitorJSONGetAllBlockStatsCapacityNoID);
     DO_TEST(qemuMonitorJSONGetMigrationCacheSize);
     DO_TEST(qemuMonitorJSONGetMigrationParams);
     DO_TEST(qemuMonitorJSONGetMigrationStats);
@@ -64,6 +64,9 @@ struct _qemuMonitorTest {
     size_t outgoingLength;
     size_t outgoingCapacity;
 
+    /* ID of the command being processed, QEMU puts it into replies */
+    char *cmdid;
+
     virNetSocketPtr server;
     virNetSocketPtr client;
 
@@ -92,6 +95,37 @@ qemuMonitorTestItemFree(qemuMonitorTestItemPtr item)
 }
 
 
+/*
+ * Returns @response with the ID of the command being processed added,
+ * or NULL if @response is not a single reply lacking an ID.
+ */
+static char *
+qemuMonitorTestAddResponseID(qemuMonitorTestPtr test,
+                             const char *response)
+{
+    virJSONValuePtr val = NULL;
+    char *ret = NULL;
+
+    if (!test->cmdid || strchr(response, '\n'))
+        return NULL;
+
+    if (!(val = virJSONValueFromString(response))) {
+        virResetLastError();
+        return NULL;
+    }
+
+    if (val->type == VIR_JSON_TYPE_OBJECT &&
+        !virJSONValueObjectHasKey(val, "id") &&
+        (virJSONValueObjectHasKey(val, "return") ||
+         virJSONValueObjectHasKey(val, "error")) &&
+        virJSONValueObjectAppendString(val, "id", test->cmdid) == 0)
+        ret = virJSONValueToString(val, false);
+
+    virJSONValueFree(val);
+    return ret;
+}
+
+
 /*
  * Appends data for a reply to the outgoing buffer
  */
@@ -99,21 +133,29 @@ int
 qemuMonitorTestAddResponse(qemuMonitorTestPtr test,
                            const char *response)
 {
-    size_t want = strlen(response) + 2;
+    char *withid = qemuMonitorTestAddResponseID(test, response);
+    size_t want;
     size_t have = test->outgoingCapacity - test->outgoingLength;
 
+    if (withid)
+        response = withid;
+    want = strlen(response) + 2;
+
     VIR_DEBUG("Adding response to monitor command: '%s", response);
 
     if (have < want) {
         size_t need = want - have;
-        if (VIR_EXPAND_N(test->outgoing, test->outgoingCapacity, need) < 0)
+        if (VIR_EXPAND_N(test->outgoing, test->outgoingCapacity, need) < 0) {
+            VIR_FREE(withid);
             return -1;
+        }
     }
 
     want -= 2;
     memcpy(test->outgoing + test->outgoingLength, response, want);
     memcpy(test->outgoing + test->outgoingLength + want, "\r\n", 2);
     test->outgoingLength += want + 2;
+    VIR_FREE(withid);
     return 0;
 }
 
@@ -252,16 +294,28 @@ qemuMonitorTestProcessCommand(qemuMonitorTestPtr test,
 
     VIR_DEBUG("Processing string from monitor handler: '%s", cmdstr);
 
+    /* Replies to a QMP command carry its ID, like QEMU does it */
+    if (test->json && !test->agent) {
+        virJSONValuePtr val = virJSONValueFromString(cmdstr);
+        const char *id;
+
+        if (val && (id = virJSONValueObjectGetString(val, "id")))
+            ignore_value(VIR_STRDUP(test->cmdid, id));
+        virJSONValueFree(val);
+        virResetLastError();
+    }
+
     if (test->nitems == 0) {
-        return qemuMonitorTestAddUnexpectedErrorResponse(test, cmdstr);
+        ret = qemuMonitorTestAddUnexpectedErrorResponse(test, cmdstr);
     } else {
         qemuMonitorTestItemPtr item = test->items[0];
         ret = (item->cb)(test, item, cmdstr);
         qemuMonitorTestItemFree(item);
         if (VIR_DELETE_ELEMENT(test->items, 0, test->nitems) < 0)
-            return -1;
+            ret = -1;
     }
 
+    VIR_FREE(test->cmdid);
     return ret;
 }
 
@@ -445,6 +499,7 @@ qemuMonitorTestFree(qemuMonitorTestPtr test)
 
     VIR_FREE(test->incoming);
     VIR_FREE(test->outgoing);
+    VIR_FREE(test->cmdid);
 
     for (i = 0; i < test->nitems; i++)
         qemuMonitorTestItemFree(test->items[i]);
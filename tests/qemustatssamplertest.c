@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "virbuffer.h"
+#include "virstring.h"
+#include "virtypedparam.h"
+#include "qemu/qemu_stats_sampler.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define TEST_INTERVAL 1000
+
+static const unsigned int testGroups[] = {
+    VIR_DOMAIN_STATS_STATE,
+    VIR_DOMAIN_STATS_CPU_TOTAL,
+    VIR_DOMAIN_STATS_BALLOON,
+};
+
+struct testDomain {
+    const char *name;
+    bool present;
+    int state;
+    unsigned long long cpu;
+    unsigned long long balloon;
+};
+
+struct testData {
+    struct testDomain doms[2];
+    size_t ncollect;
+    unsigned int stats;     /* groups of the last sample */
+    bool failEmit;
+    char *events[2];        /* last event for each callback ID */
+};
+
+
+static size_t
+testCollect(unsigned int stats,
+            qemuStatsSamplePtr *samples,
+            void *opaque)
+{
+    struct testData *data = opaque;
+    size_t nsamples = 0;
+    size_t i;
+
+    data->ncollect++;
+    data->stats = stats;
+
+    if (VIR_ALLOC_N(*samples, ARRAY_CARDINALITY(data->doms)) < 0)
+        return 0;
+
+    for (i = 0; i < ARRAY_CARDINALITY(data->doms); i++) {
+        struct testDomain *dom = &data->doms[i];
+        qemuStatsSamplePtr sample = *samples + nsamples;
+        virDomainStatsEventRecordPtr record = &sample->record;
+        int maxparams = 0;
+
+        if (!dom->present)
+            continue;
+        nsamples++;
+
+        if (VIR_ALLOC_N(sample->ends, ARRAY_CARDINALITY(testGroups)) < 0 ||
+            VIR_STRDUP(record->name, dom->name) < 0)
+            goto error;
+        record->id = i + 1;
+        memset(record->uuid, i + 1, VIR_UUID_BUFLEN);
+
+        if (stats & VIR_DOMAIN_STATS_STATE &&
+            virTypedParamsAddInt(&record->params, &record->nparams,
+                                 &maxparams, "state.state", dom->state) < 0)
+            goto error;
+        sample->ends[0] = record->nparams;
+
+        if (stats & VIR_DOMAIN_STATS_CPU_TOTAL &&
+            virTypedParamsAddULLong(&record->params, &record->nparams,
+                                    &maxparams, "cpu.time", dom->cpu) < 0)
+            goto error;
+        sample->ends[1] = record->nparams;
+
+        if (stats & VIR_DOMAIN_STATS_BALLOON &&
+            virTypedParamsAddULLong(&record->params, &record->nparams,
+                                    &maxparams, "balloon.current",
+                                    dom->balloon) < 0)
+            goto error;
+        sample->ends[2] = record->nparams;
+    }
+
+    return nsamples;
+
+ error:
+    qemuStatsSamplesFree(*samples, nsamples);
+    *samples = NULL;
+    return 0;
+}
+
+
+/* Formats the records as "name: field=value ...; name: ..." */
+static int
+testEmit(int callbackID,
+         virDomainStatsEventRecordPtr *records,
+         size_t *nrecords,
+         void *opaque)
+{
+    struct testData *data = opaque;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+    int j;
+
+    if (data->failEmit) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "simulated emit failure");
+        return -1;
+    }
+
+    for (i = 0; i < *nrecords; i++) {
+        virDomainStatsEventRecordPtr record = &(*records)[i];
+
+        if (i)
+            virBufferAddLit(&buf, "; ");
+        virBufferAsprintf(&buf, "%s:", record->name);
+
+        for (j = 0; j < record->nparams; j++) {
+            char *value = virTypedParameterToString(&record->params[j]);
+
+            virBufferAsprintf(&buf, " %s=%s",
+                              record->params[j].field, NULLSTR(value));
+            VIR_FREE(value);
+        }
+        virDomainStatsEventRecordClear(record);
+    }
+    VIR_FREE(*records);
+    *nrecords = 0;
+
+    VIR_FREE(data->events[callbackID]);
+    if (virBufferCheckError(&buf) < 0)
+        return -1;
+    data->events[callbackID] = virBufferContentAndReset(&buf);
+    if (!data->events[callbackID] &&
+        VIR_STRDUP(data->events[callbackID], "") < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static qemuStatsSamplerPtr
+testSamplerNew(struct testData *data)
+{
+    data->doms[0].name = "dom1";
+    data->doms[0].present = true;
+    data->doms[0].state = 1;
+    data->doms[0].cpu = 100;
+    data->doms[0].balloon = 1024;
+    data->doms[1].name = "dom2";
+    data->doms[1].present = true;
+    data->doms[1].state = 1;
+    data->doms[1].cpu = 200;
+    data->doms[1].balloon = 2048;
+
+    return qemuStatsSamplerNew(testGroups, ARRAY_CARDINALITY(testGroups),
+                               TEST_INTERVAL, testCollect, testEmit, data);
+}
+
+
+static void
+testDataClear(struct testData *data)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(data->events); i++)
+        VIR_FREE(data->events[i]);
+}
+
+
+/* Takes a sample at @now and checks whether it was taken and what each
+ * subscriber got, NULL meaning no event */
+static int
+testSample(qemuStatsSamplerPtr sampler,
+           struct testData *data,
+           unsigned long long now,
+           bool sampled,
+           const char *expect0,
+           const char *expect1)
+{
+    const char *expect[] = { expect0, expect1 };
+    int ret = 0;
+    size_t i;
+
+    testDataClear(data);
+
+    if (qemuStatsSamplerRun(sampler, now) != sampled) {
+        fprintf(stderr, "at %llu ms: sample %s\n", now,
+                sampled ? "not taken" : "taken too early");
+        return -1;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(expect); i++) {
+        if (STRNEQ_NULLABLE(data->events[i], expect[i])) {
+            fprintf(stderr, "at %llu ms: callback %zu expected '%s', got '%s'\n",
+                    now, i, NULLSTR(expect[i]), NULLSTR(data->events[i]));
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+
+static int
+testInterval(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testData data = { 0 };
+    qemuStatsSamplerPtr sampler;
+    int ret = -1;
+
+    if (!(sampler = testSamplerNew(&data)))
+        return -1;
+
+    /* Nothing is sampled without subscribers */
+    if (testSample(sampler, &data, 5000, false, NULL, NULL) < 0 ||
+        data.ncollect != 0)
+        goto cleanup;
+
+    if (qemuStatsSamplerSubscribe(sampler, 0, VIR_DOMAIN_STATS_CPU_TOTAL,
+                                  0) < 0)
+        goto cleanup;
+
+    if (testSample(sampler, &data, 5000, true,
+                   "dom1: cpu.time=100; dom2: cpu.time=200", NULL) < 0 ||
+        testSample(sampler, &data, 5000 + TEST_INTERVAL / 2, false,
+                   NULL, NULL) < 0 ||
+        testSample(sampler, &data, 5000 + TEST_INTERVAL - 1, false,
+                   NULL, NULL) < 0 ||
+        testSample(sampler, &data, 5000 + TEST_INTERVAL, true,
+                   "dom1: cpu.time=100; dom2: cpu.time=200", NULL) < 0)
+        goto cleanup;
+
+    /* A late sample delays the next one */
+    if (testSample(sampler, &data, 8200, true,
+                   "dom1: cpu.time=100; dom2: cpu.time=200", NULL) < 0 ||
+        testSample(sampler, &data, 9000, false, NULL, NULL) < 0 ||
+        testSample(sampler, &data, 9200, true,
+                   "dom1: cpu.time=100; dom2: cpu.time=200", NULL) < 0)
+        goto cleanup;
+
+    if (data.ncollect != 4 || data.stats != VIR_DOMAIN_STATS_CPU_TOTAL) {
+        fprintf(stderr, "collected %zu samples of 0x%x\n",
+                data.ncollect, data.stats);
+        goto cleanup;
+    }
+
+    qemuStatsSamplerUnsubscribe(sampler, 0);
+    if (qemuStatsSamplerHasSubscriber(sampler, 0) ||
+        testSample(sampler, &data, 20000, false, NULL, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    qemuStatsSamplerFree(sampler);
+    testDataClear(&data);
+    return ret;
+}
+
+
+static int
+testDelta(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testData data = { 0 };
+    qemuStatsSamplerPtr sampler;
+    unsigned int stats = VIR_DOMAIN_STATS_STATE | VIR_DOMAIN_STATS_CPU_TOTAL;
+    const char *full = "dom1: state.state=1 cpu.time=100; "
+                       "dom2: state.state=1 cpu.time=200";
+    int ret = -1;
+
+    if (!(sampler = testSamplerNew(&data)))
+        return -1;
+
+    if (qemuStatsSamplerSubscribe(sampler, 0, stats,
+                                  VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA) < 0 ||
+        qemuStatsSamplerSubscribe(sampler, 1, stats, 0) < 0)
+        goto cleanup;
+
+    /* The first sample is complete even for deltas */
+    if (testSample(sampler, &data, 0, true, full, full) < 0)
+        goto cleanup;
+
+    /* Only the changed parameter of the changed domain */
+    data.doms[0].cpu = 150;
+    if (testSample(sampler, &data, 1000, true,
+                   "dom1: cpu.time=150",
+                   "dom1: state.state=1 cpu.time=150; "
+                   "dom2: state.state=1 cpu.time=200") < 0)
+        goto cleanup;
+
+    /* No event at all without changes */
+    if (testSample(sampler, &data, 2000, true, NULL,
+                   "dom1: state.state=1 cpu.time=150; "
+                   "dom2: state.state=1 cpu.time=200") < 0)
+        goto cleanup;
+
+    data.doms[0].cpu = 300;
+    data.doms[1].state = 5;
+    if (testSample(sampler, &data, 3000, true,
+                   "dom1: cpu.time=300; dom2: state.state=5",
+                   "dom1: state.state=1 cpu.time=300; "
+                   "dom2: state.state=5 cpu.time=200") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    qemuStatsSamplerFree(sampler);
+    testDataClear(&data);
+    return ret;
+}
+
+
+static int
+testSubscriberGroups(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testData data = { 0 };
+    qemuStatsSamplerPtr sampler;
+    int ret = -1;
+
+    if (!(sampler = testSamplerNew(&data)))
+        return -1;
+
+    if (qemuStatsSamplerSubscribe(sampler, 0, VIR_DOMAIN_STATS_CPU_TOTAL,
+                                  VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA) < 0)
+        goto cleanup;
+
+    if (testSample(sampler, &data, 0, true,
+                   "dom1: cpu.time=100; dom2: cpu.time=200", NULL) < 0)
+        goto cleanup;
+
+    /* A new subscriber widens the sample and gets all of its groups,
+     * the others still get only what changed in theirs */
+    if (qemuStatsSamplerSubscribe(sampler, 1, VIR_DOMAIN_STATS_BALLOON,
+                                  VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA) < 0)
+        goto cleanup;
+
+    data.doms[1].cpu = 250;
+    if (testSample(sampler, &data, 1000, true,
+                   "dom2: cpu.time=250",
+                   "dom1: balloon.current=1024; "
+                   "dom2: balloon.current=2048") < 0)
+        goto cleanup;
+
+    if (data.stats != (VIR_DOMAIN_STATS_CPU_TOTAL |
+                       VIR_DOMAIN_STATS_BALLOON)) {
+        fprintf(stderr, "collected 0x%x\n", data.stats);
+        goto cleanup;
+    }
+
+    data.doms[0].balloon = 512;
+    if (testSample(sampler, &data, 2000, true,
+                   NULL, "dom1: balloon.current=512") < 0)
+        goto cleanup;
+
+    /* The sample shrinks once the subscriber is gone */
+    qemuStatsSamplerUnsubscribe(sampler, 1);
+    if (testSample(sampler, &data, 3000, true, NULL, NULL) < 0 ||
+        data.stats != VIR_DOMAIN_STATS_CPU_TOTAL)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    qemuStatsSamplerFree(sampler);
+    testDataClear(&data);
+    return ret;
+}
+
+
+static int
+testEmitFailure(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testData data = { 0 };
+    qemuStatsSamplerPtr sampler;
+    const char *full = "dom1: cpu.time=100; dom2: cpu.time=200";
+    int ret = -1;
+
+    if (!(sampler = testSamplerNew(&data)))
+        return -1;
+
+    if (qemuStatsSamplerSubscribe(sampler, 0, VIR_DOMAIN_STATS_CPU_TOTAL,
+                                  VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA) < 0)
+        goto cleanup;
+
+    data.failEmit = true;
+    if (testSample(sampler, &data, 0, true, NULL, NULL) < 0)
+        goto cleanup;
+
+    /* The complete sample never arrived, so deltas can't start yet */
+    data.failEmit = false;
+    if (testSample(sampler, &data, 1000, true, full, NULL) < 0 ||
+        testSample(sampler, &data, 2000, true, NULL, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    qemuStatsSamplerFree(sampler);
+    testDataClear(&data);
+    return ret;
+}
+
+
+static int
+testDomains(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testData data = { 0 };
+    qemuStatsSamplerPtr sampler;
+    int ret = -1;
+
+    if (!(sampler = testSamplerNew(&data)))
+        return -1;
+
+    data.doms[1].present = false;
+
+    if (qemuStatsSamplerSubscribe(sampler, 0, VIR_DOMAIN_STATS_CPU_TOTAL,
+                                  VIR_CONNECT_DOMAIN_STATS_EVENT_DELTA) < 0)
+        goto cleanup;
+
+    if (testSample(sampler, &data, 0, true, "dom1: cpu.time=100", NULL) < 0)
+        goto cleanup;
+
+    /* A domain missing from the previous sample is reported in full */
+    data.doms[1].present = true;
+    if (testSample(sampler, &data, 1000, true,
+                   "dom2: cpu.time=200", NULL) < 0)
+        goto cleanup;
+
+    data.doms[0].present = false;
+    if (testSample(sampler, &data, 2000, true, NULL, NULL) < 0)
+        goto cleanup;
+
+    data.doms[0].present = true;
+    if (testSample(sampler, &data, 3000, true,
+                   "dom1: cpu.time=100", NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    qemuStatsSamplerFree(sampler);
+    testDataClear(&data);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(desc, func)                                             \
+    do {                                                                \
+        if (virTestRun(desc, func, NULL) < 0)                           \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("Interval", testInterval);
+    DO_TEST("Delta", testDelta);
+    DO_TEST("Groups", testSubscriberGroups);
+    DO_TEST("Emit failure", testEmitFailure);
+    DO_TEST("Domains", testDomains);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "virtime.h"
+#include "storage/storage_util.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Size of a single data or hole section of the test files */
+#define EXTENT (1024 * 1024)
+
+struct testCopyData {
+    const char *name;
+    unsigned int flags;
+    const unsigned int *sections; /* section lengths in EXTENTs, data
+                                   * first, 0 terminated */
+    unsigned long long extra;     /* bytes asked for beyond the input */
+};
+
+
+/* Fills the @i-th extent of the input, so that misplaced data is noticed */
+static void
+fillExtent(char *buf, size_t i)
+{
+    size_t j;
+
+    for (j = 0; j < EXTENT; j += sizeof(size_t)) {
+        size_t val = i * EXTENT + j + 1;
+        memcpy(buf + j, &val, sizeof(val));
+    }
+}
+
+
+static int
+makeInputFile(const char *path,
+              const unsigned int *sections,
+              unsigned long long *len)
+{
+    int fd = -1;
+    char *buf = NULL;
+    bool inData = true;
+    size_t ext = 0;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, EXTENT) < 0)
+        return -1;
+
+    if ((fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0)
+        goto cleanup;
+
+    for (i = 0; sections[i]; i++) {
+        size_t j;
+
+        for (j = 0; j < sections[i]; j++, ext++) {
+            if (!inData)
+                continue;
+
+            fillExtent(buf, ext);
+            if (pwrite(fd, buf, EXTENT, (off_t) ext * EXTENT) != EXTENT)
+                goto cleanup;
+        }
+        inData = !inData;
+    }
+
+    *len = (unsigned long long) ext * EXTENT;
+    if (ftruncate(fd, *len) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+static int
+checkOutputFile(const char *path,
+                const unsigned int *sections)
+{
+    int fd = -1;
+    char *expect = NULL;
+    char *buf = NULL;
+    bool inData = true;
+    size_t ext = 0;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(expect, EXTENT) < 0 ||
+        VIR_ALLOC_N(buf, EXTENT) < 0)
+        goto cleanup;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        goto cleanup;
+
+    for (i = 0; sections[i]; i++) {
+        size_t j;
+
+        for (j = 0; j < sections[i]; j++, ext++) {
+            if (inData)
+                fillExtent(expect, ext);
+            else
+                memset(expect, 0, EXTENT);
+
+            if (pread(fd, buf, EXTENT, (off_t) ext * EXTENT) != EXTENT) {
+                fprintf(stderr, "short read of extent %zu\n", ext);
+                goto cleanup;
+            }
+            if (memcmp(buf, expect, EXTENT) != 0) {
+                fprintf(stderr, "extent %zu differs\n", ext);
+                goto cleanup;
+            }
+        }
+        inData = !inData;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(expect);
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+static int
+testCopy(const void *opaque)
+{
+    const struct testCopyData *data = opaque;
+    char *input = NULL;
+    char *output = NULL;
+    int inputfd = -1;
+    int fd = -1;
+    unsigned long long len;
+    unsigned long long total;
+    unsigned long long start;
+    unsigned long long end;
+    int ret = -1;
+
+    if (virAsprintf(&input, "%s/copyin-%d.img", abs_builddir, getpid()) < 0 ||
+        virAsprintf(&output, "%s/copyout-%d.img", abs_builddir, getpid()) < 0)
+        goto cleanup;
+
+    if (makeInputFile(input, data->sections, &len) < 0) {
+        fprintf(stderr, "cannot create '%s'\n", input);
+        goto cleanup;
+    }
+
+    if ((inputfd = open(input, O_RDONLY)) < 0 ||
+        (fd = open(output, O_CREAT | O_TRUNC | O_RDWR, 0600)) < 0 ||
+        ftruncate(fd, len) < 0)
+        goto cleanup;
+
+    total = len + data->extra;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    if (virStorageBackendCopyFD(inputfd, input, fd, output,
+                                &total, data->flags) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    VIR_TEST_VERBOSE("\n%s: copied %llu MiB in %llu ms\n",
+                     data->name, len / EXTENT, end - start);
+
+    if (total != data->extra) {
+        fprintf(stderr, "expected %llu bytes left, got %llu\n",
+                data->extra, total);
+        goto cleanup;
+    }
+
+    if (checkOutputFile(output, data->sections) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(inputfd);
+    VIR_FORCE_CLOSE(fd);
+    if (input)
+        unlink(input);
+    if (output)
+        unlink(output);
+    VIR_FREE(input);
+    VIR_FREE(output);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    /* Data scattered over several chunks of the copier */
+    const unsigned int scattered[] = {1, 70, 2, 60, 1, 0};
+    const unsigned int dense[] = {1, 1, 1, 0};
+    /* Half data, half holes */
+    unsigned int bench[65];
+    size_t i;
+
+#define DO_TEST(desc, f, s, e)                                          \
+    do {                                                                \
+        struct testCopyData data = {                                    \
+            .name = desc, .flags = f, .sections = s, .extra = e,        \
+        };                                                              \
+        if (virTestRun(desc, testCopy, &data) < 0)                      \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("Copy dense", 0, dense, 0);
+    DO_TEST("Copy dense beyond input", 0, dense, 4096);
+    DO_TEST("Copy sparse", VIR_STORAGE_BACKEND_COPY_SPARSE, dense, 0);
+    DO_TEST("Copy scattered sparse", VIR_STORAGE_BACKEND_COPY_SPARSE,
+            scattered, 0);
+    DO_TEST("Copy scattered shared",
+            VIR_STORAGE_BACKEND_COPY_SPARSE | VIR_STORAGE_BACKEND_COPY_SHARE,
+            scattered, 0);
+
+    if (virTestGetExpensive()) {
+        for (i = 0; i < ARRAY_CARDINALITY(bench) - 1; i++)
+            bench[i] = 16;
+        bench[i] = 0;
+
+        /* Compare the copy paths on a 1 GiB file */
+        DO_TEST("Benchmark dense", 0, bench, 0);
+        DO_TEST("Benchmark sparse", VIR_STORAGE_BACKEND_COPY_SPARSE,
+                bench, 0);
+        DO_TEST("Benchmark shared",
+                VIR_STORAGE_BACKEND_COPY_SPARSE |
+                VIR_STORAGE_BACKEND_COPY_SHARE,
+                bench, 0);
+    }
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
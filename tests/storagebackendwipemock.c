@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#ifdef __linux__
+# include <errno.h>
+# include <fcntl.h>
+# include <stdlib.h>
+# include <sys/param.h>
+# include <unistd.h>
+
+# include "internal.h"
+# include "virmock.h"
+
+/*
+ * STORAGE_WIPE_MOCK picks what the file system can do:
+ *
+ *  "offload": every fallocate mode works, writing data fails
+ *  "punch":   only holes can be punched, writing data fails
+ *  "write":   fallocate is not supported
+ *
+ * The file system operations are emulated by writing zeroes, so the
+ * test doesn't depend on the file system it runs on.
+ */
+
+static int (*real_fallocate)(int fd, int mode, off_t offset, off_t len);
+static ssize_t (*real_pwrite)(int fd, const void *buf, size_t count,
+                              off_t offset);
+
+static const char *
+getMode(void)
+{
+    return getenv("STORAGE_WIPE_MOCK");
+}
+
+
+static int
+writeZeroes(int fd,
+            off_t offset,
+            off_t len)
+{
+    char buf[65536] = { 0 };
+
+    while (len > 0) {
+        ssize_t rc = real_pwrite(fd, buf, MIN(sizeof(buf), len), offset);
+
+        if (rc <= 0)
+            return -1;
+        offset += rc;
+        len -= rc;
+    }
+
+    return 0;
+}
+
+
+int
+fallocate(int fd,
+          int mode,
+          off_t offset,
+          off_t len)
+{
+    const char *mock = getMode();
+
+    VIR_MOCK_REAL_INIT(fallocate);
+    VIR_MOCK_REAL_INIT(pwrite);
+
+    if (!mock)
+        return real_fallocate(fd, mode, offset, len);
+
+    if (STREQ(mock, "write")) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    /* Just keeping the blocks allocated */
+    if (mode == FALLOC_FL_KEEP_SIZE)
+        return 0;
+
+# ifdef FALLOC_FL_ZERO_RANGE
+    if (mode & FALLOC_FL_ZERO_RANGE && STREQ(mock, "punch")) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+# endif
+
+    return writeZeroes(fd, offset, len);
+}
+
+
+ssize_t
+pwrite(int fd,
+       const void *buf,
+       size_t count,
+       off_t offset)
+{
+    const char *mock = getMode();
+
+    VIR_MOCK_REAL_INIT(pwrite);
+
+    if (mock && STRNEQ(mock, "write")) {
+        errno = EIO;
+        return -1;
+    }
+
+    return real_pwrite(fd, buf, count, offset);
+}
+#else
+/* Nothing to override on other platforms */
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#ifdef __linux__
+
+# include "viralloc.h"
+# include "virfile.h"
+# include "virstring.h"
+# include "storage/storage_util.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+# define MiB (1024 * 1024)
+
+struct testWipeData {
+    const char *name;
+    const char *mock;           /* see storagebackendwipemock.c */
+    unsigned long long len;     /* size of the volume */
+    unsigned long long alloc;   /* allocation in the volume XML */
+    bool sparse;                /* only the first MiB is written */
+};
+
+
+static int
+testMakeVolume(const char *path,
+               const struct testWipeData *data)
+{
+    char buf[4096];
+    unsigned long long off;
+    int fd = -1;
+    int ret = -1;
+
+    memset(buf, 0xaa, sizeof(buf));
+
+    if ((fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0)
+        return -1;
+
+    for (off = 0; off < (data->sparse ? MiB : data->len); off += sizeof(buf)) {
+        size_t len = MIN(sizeof(buf), data->len - off);
+
+        if (safewrite(fd, buf, len) != len)
+            goto cleanup;
+    }
+
+    if (ftruncate(fd, data->len) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+
+static int
+testCheckVolume(const char *path,
+                unsigned long long len)
+{
+    char buf[4096];
+    unsigned long long off = 0;
+    struct stat st;
+    int fd = -1;
+    int ret = -1;
+    size_t i;
+
+    if ((fd = open(path, O_RDONLY)) < 0 ||
+        fstat(fd, &st) < 0)
+        goto cleanup;
+
+    if (st.st_size != len) {
+        fprintf(stderr, "volume size changed to %llu\n",
+                (unsigned long long) st.st_size);
+        goto cleanup;
+    }
+
+    while (off < len) {
+        ssize_t got = saferead(fd, buf, sizeof(buf));
+
+        if (got <= 0) {
+            fprintf(stderr, "short read at %llu\n", off);
+            goto cleanup;
+        }
+
+        for (i = 0; i < got; i++) {
+            if (buf[i]) {
+                fprintf(stderr, "byte %llu was not zeroed\n", off + i);
+                goto cleanup;
+            }
+        }
+        off += got;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+
+static int
+testWipe(const void *opaque)
+{
+    const struct testWipeData *data = opaque;
+    virStoragePoolObj pool;
+    virStorageVolDef vol;
+    char *path = NULL;
+    int rc;
+    int ret = -1;
+
+    memset(&pool, 0, sizeof(pool));
+    memset(&vol, 0, sizeof(vol));
+
+    if (virMutexInit(&pool.lock) < 0)
+        return -1;
+
+    if (virAsprintf(&path, "%s/wipe-%d.img", abs_builddir, getpid()) < 0)
+        goto cleanup;
+
+    if (testMakeVolume(path, data) < 0) {
+        fprintf(stderr, "cannot create '%s'\n", path);
+        goto cleanup;
+    }
+
+    vol.target.path = path;
+    vol.target.allocation = data->alloc ? data->alloc : data->len;
+
+    if (data->mock)
+        setenv("STORAGE_WIPE_MOCK", data->mock, 1);
+    rc = virStorageBackendVolWipeLocal(NULL, &pool, &vol,
+                                       VIR_STORAGE_VOL_WIPE_ALG_ZERO, 0);
+    unsetenv("STORAGE_WIPE_MOCK");
+
+    if (rc < 0)
+        goto cleanup;
+
+    if (testCheckVolume(path, data->len) < 0)
+        goto cleanup;
+
+    /* Sparse files are truncated instead, without any progress */
+    if (!data->sparse &&
+        (vol.wipeDone != data->len || vol.wipeTotal != data->len)) {
+        fprintf(stderr, "progress %llu/%llu, expected %llu\n",
+                vol.wipeDone, vol.wipeTotal, data->len);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    virMutexDestroy(&pool.lock);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+# define DO_TEST_FULL(desc, m, l, a, s)                                 \
+    do {                                                                \
+        struct testWipeData data = {                                    \
+            .name = desc, .mock = m, .len = l, .alloc = a, .sparse = s, \
+        };                                                              \
+        if (virTestRun(desc, testWipe, &data) < 0)                      \
+            ret = -1;                                                   \
+    } while (0)
+
+# define DO_TEST(desc, m, l) \
+    DO_TEST_FULL(desc, m, l, 0, false)
+
+    /* Zeroing is left to the file system, no data is written */
+    DO_TEST("Zero range", "offload", 8 * MiB);
+    DO_TEST("Punch holes", "punch", 8 * MiB);
+    DO_TEST_FULL("Sparse", "offload", 8 * MiB, 0, true);
+
+    /* The zeroes have to be written */
+    DO_TEST("Write", "write", 8 * MiB);
+    DO_TEST("Write unaligned", "write", 8 * MiB + 1000);
+    DO_TEST("Write small", "write", 1000);
+    DO_TEST_FULL("Write beyond size", "write", 8 * MiB, 16 * MiB, false);
+
+    /* Whatever the file system we run on supports */
+    DO_TEST("Host file system", NULL, 8 * MiB + 1000);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/storagebackendwipemock.so")
+#else
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+#endif
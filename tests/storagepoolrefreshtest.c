@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "storage/storage_util.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define VOL_SIZE (1024 * 1024)
+
+/* Capacity no probed volume has, written into the cache */
+#define FAKE_CAPACITY 7340032ULL
+
+struct testRefreshData {
+    char *dir;
+    char *cacheFile;
+    virStoragePoolObjPtr pool;
+};
+
+
+static int
+testMakeVolume(const char *dir,
+               const char *name,
+               size_t len)
+{
+    char *path = NULL;
+    char *buf = NULL;
+    int fd = -1;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/%s", dir, name) < 0 ||
+        VIR_ALLOC_N(buf, len) < 0)
+        goto cleanup;
+
+    if ((fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0 ||
+        safewrite(fd, buf, len) != len ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(path);
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+/* Checks that the pool holds exactly the volumes @names, @name[i]
+ * having the capacity @capacities[i] */
+static int
+testCheckVolumes(virStoragePoolObjPtr pool,
+                 const char **names,
+                 const unsigned long long *capacities,
+                 size_t nnames)
+{
+    size_t i;
+
+    if (pool->volumes.count != nnames) {
+        fprintf(stderr, "expected %zu volumes, got %zu\n",
+                nnames, pool->volumes.count);
+        return -1;
+    }
+
+    for (i = 0; i < nnames; i++) {
+        virStorageVolDefPtr vol = virStorageVolDefFindByName(pool, names[i]);
+
+        if (!vol) {
+            fprintf(stderr, "volume '%s' is missing\n", names[i]);
+            return -1;
+        }
+
+        if (vol->target.capacity != capacities[i]) {
+            fprintf(stderr, "volume '%s' has capacity %llu, expected %llu\n",
+                    names[i], vol->target.capacity, capacities[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+testRefresh(struct testRefreshData *data)
+{
+    virStoragePoolObjClearVols(data->pool);
+    return virStorageBackendRefreshLocalWithCache(data->pool,
+                                                  data->cacheFile);
+}
+
+
+/* Replaces the capacity of volumes of @size bytes in the cache */
+static int
+testTamperCache(const char *cacheFile,
+                unsigned long long size)
+{
+    char *xml = NULL;
+    char *match = NULL;
+    char *replacement = NULL;
+    char *tampered = NULL;
+    int ret = -1;
+
+    if (virFileReadAll(cacheFile, 1024 * 1024, &xml) < 0 ||
+        virAsprintf(&match, "<capacity unit='bytes'>%llu<", size) < 0 ||
+        virAsprintf(&replacement, "<capacity unit='bytes'>%llu<",
+                    FAKE_CAPACITY) < 0)
+        goto cleanup;
+
+    if (!strstr(xml, match)) {
+        fprintf(stderr, "volume not found in the cache\n");
+        goto cleanup;
+    }
+
+    if (!(tampered = virStringReplace(xml, match, replacement)) ||
+        virFileRewriteStr(cacheFile, 0600, tampered) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(xml);
+    VIR_FREE(match);
+    VIR_FREE(replacement);
+    VIR_FREE(tampered);
+    return ret;
+}
+
+
+static int
+testCacheUsed(const void *opaque)
+{
+    struct testRefreshData *data = (struct testRefreshData *) opaque;
+    const char *names[] = { "a.img", "b.img" };
+    const unsigned long long probed[] = { VOL_SIZE, 2 * VOL_SIZE };
+    const unsigned long long cached[] = { FAKE_CAPACITY, FAKE_CAPACITY };
+
+    if (testMakeVolume(data->dir, "a.img", VOL_SIZE) < 0 ||
+        testMakeVolume(data->dir, "b.img", 2 * VOL_SIZE) < 0)
+        return -1;
+
+    if (testRefresh(data) < 0 ||
+        testCheckVolumes(data->pool, names, probed, 2) < 0)
+        return -1;
+
+    if (!virFileExists(data->cacheFile)) {
+        fprintf(stderr, "volume cache was not written\n");
+        return -1;
+    }
+
+    /* Unchanged volumes must come from the cache */
+    if (testTamperCache(data->cacheFile, VOL_SIZE) < 0 ||
+        testTamperCache(data->cacheFile, 2 * VOL_SIZE) < 0)
+        return -1;
+
+    if (testRefresh(data) < 0 ||
+        testCheckVolumes(data->pool, names, cached, 2) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testCacheChanged(const void *opaque)
+{
+    struct testRefreshData *data = (struct testRefreshData *) opaque;
+    const char *names[] = { "a.img", "b.img", "c.img" };
+    const unsigned long long capacities[] = {
+        3 * VOL_SIZE, FAKE_CAPACITY, VOL_SIZE
+    };
+
+    /* A rewritten volume and a new one are probed */
+    if (testMakeVolume(data->dir, "a.img", 3 * VOL_SIZE) < 0 ||
+        testMakeVolume(data->dir, "c.img", VOL_SIZE) < 0)
+        return -1;
+
+    if (testRefresh(data) < 0 ||
+        testCheckVolumes(data->pool, names, capacities, 3) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testCacheRemoved(const void *opaque)
+{
+    struct testRefreshData *data = (struct testRefreshData *) opaque;
+    const char *names[] = { "a.img", "c.img" };
+    const unsigned long long capacities[] = { 3 * VOL_SIZE, VOL_SIZE };
+    char *path = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/b.img", data->dir) < 0 ||
+        unlink(path) < 0)
+        goto cleanup;
+
+    if (testRefresh(data) < 0 ||
+        testCheckVolumes(data->pool, names, capacities, 2) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+testCacheCorrupt(const void *opaque)
+{
+    struct testRefreshData *data = (struct testRefreshData *) opaque;
+    const char *names[] = { "a.img", "c.img" };
+    const unsigned long long capacities[] = { 3 * VOL_SIZE, VOL_SIZE };
+
+    if (virFileRewriteStr(data->cacheFile, 0600, "<volcache><entry") < 0)
+        return -1;
+
+    if (testRefresh(data) < 0 ||
+        testCheckVolumes(data->pool, names, capacities, 2) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/* Writes a qcow2 image of VOL_SIZE bytes, backed by @backing unless NULL */
+static int
+testMakeQcow2(const char *dir,
+              const char *name,
+              const char *backing)
+{
+    unsigned char header[72] = {
+        'Q', 'F', 'I', 0xfb,            /* magic */
+        0, 0, 0, 2,                     /* version */
+    };
+    char *path = NULL;
+    size_t backingLen = backing ? strlen(backing) : 0;
+    int fd = -1;
+    int ret = -1;
+
+    if (backing) {
+        header[15] = sizeof(header);    /* backing_file_offset */
+        header[19] = backingLen;        /* backing_file_size */
+    }
+    header[23] = 16;                    /* cluster_bits */
+    header[29] = VOL_SIZE >> 16;        /* size */
+
+    if (virAsprintf(&path, "%s/%s", dir, name) < 0)
+        goto cleanup;
+
+    if ((fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0 ||
+        safewrite(fd, header, sizeof(header)) != sizeof(header) ||
+        (backing && safewrite(fd, backing, backingLen) != backingLen) ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+testCacheBackingMissing(const void *opaque)
+{
+    struct testRefreshData *data = (struct testRefreshData *) opaque;
+    virStorageVolDefPtr vol;
+    char *xml = NULL;
+    int ret = -1;
+
+    if (testMakeQcow2(data->dir, "overlay.qcow2", "base.qcow2") < 0)
+        goto cleanup;
+
+    /* The format of the missing backing file is made up, which must
+     * not end up in the cache */
+    if (testRefresh(data) < 0)
+        goto cleanup;
+    virResetLastError();
+
+    if (virFileReadAll(data->cacheFile, 1024 * 1024, &xml) < 0)
+        goto cleanup;
+
+    if (strstr(xml, "overlay.qcow2")) {
+        fprintf(stderr, "volume with unknown backing format was cached\n");
+        goto cleanup;
+    }
+
+    if (testMakeQcow2(data->dir, "base.qcow2", NULL) < 0 ||
+        testRefresh(data) < 0)
+        goto cleanup;
+
+    if (!(vol = virStorageVolDefFindByName(data->pool, "overlay.qcow2")) ||
+        !vol->target.backingStore ||
+        vol->target.backingStore->format != VIR_STORAGE_FILE_QCOW2) {
+        fprintf(stderr, "backing store of 'overlay.qcow2' not probed\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+testEntry(const void *opaque)
+{
+    struct testRefreshData *data = (struct testRefreshData *) opaque;
+    const char *names[] = { "a.img", "c.img", "d.img" };
+    unsigned long long capacities[] = { 3 * VOL_SIZE, VOL_SIZE, VOL_SIZE };
+    virStorageVolDefPtr vol;
+    char *path = NULL;
+    int ret = -1;
+
+    if (virFileDeleteTree(data->dir) < 0 ||
+        virFileMakePath(data->dir) < 0 ||
+        testMakeVolume(data->dir, "a.img", 3 * VOL_SIZE) < 0 ||
+        testMakeVolume(data->dir, "c.img", VOL_SIZE) < 0 ||
+        testRefresh(data) < 0)
+        goto cleanup;
+
+    /* A new file */
+    if (testMakeVolume(data->dir, "d.img", VOL_SIZE) < 0)
+        goto cleanup;
+    if (virStorageBackendRefreshLocalEntry(data->pool, "d.img") != 1 ||
+        testCheckVolumes(data->pool, names, capacities, 3) < 0)
+        goto cleanup;
+
+    /* A changed one */
+    capacities[2] = 2 * VOL_SIZE;
+    if (testMakeVolume(data->dir, "d.img", 2 * VOL_SIZE) < 0)
+        goto cleanup;
+    if (virStorageBackendRefreshLocalEntry(data->pool, "d.img") != 1 ||
+        testCheckVolumes(data->pool, names, capacities, 3) < 0)
+        goto cleanup;
+
+    /* One in use is left alone */
+    if (!(vol = virStorageVolDefFindByName(data->pool, "d.img")))
+        goto cleanup;
+    vol->in_use++;
+    if (testMakeVolume(data->dir, "d.img", VOL_SIZE) < 0)
+        goto cleanup;
+    if (virStorageBackendRefreshLocalEntry(data->pool, "d.img") != 0 ||
+        testCheckVolumes(data->pool, names, capacities, 3) < 0)
+        goto cleanup;
+    vol->in_use--;
+
+    /* A removed one, and one that never was a volume */
+    if (virAsprintf(&path, "%s/d.img", data->dir) < 0 ||
+        unlink(path) < 0)
+        goto cleanup;
+    if (virStorageBackendRefreshLocalEntry(data->pool, "d.img") != 1 ||
+        virStorageBackendRefreshLocalEntry(data->pool, "e.img") != 0 ||
+        testCheckVolumes(data->pool, names, capacities, 2) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    struct testRefreshData data = { NULL };
+    char *tmpl = NULL;
+    int ret = 0;
+
+    if (VIR_STRDUP(tmpl, abs_builddir "/storagepoolrefreshdata-XXXXXX") < 0 ||
+        !(data.dir = mkdtemp(tmpl))) {
+        VIR_FREE(tmpl);
+        return EXIT_FAILURE;
+    }
+
+    if (virAsprintf(&data.cacheFile, "%s.volcache", data.dir) < 0 ||
+        VIR_ALLOC(data.pool) < 0 ||
+        VIR_ALLOC(data.pool->def) < 0 ||
+        VIR_STRDUP(data.pool->def->name, "test") < 0 ||
+        VIR_STRDUP(data.pool->def->target.path, data.dir) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    data.pool->def->type = VIR_STORAGE_POOL_DIR;
+
+#define DO_TEST(desc, func)                                             \
+    do {                                                                \
+        if (virTestRun(desc, func, &data) < 0)                          \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("Cache used", testCacheUsed);
+    DO_TEST("Cache changed", testCacheChanged);
+    DO_TEST("Cache removed", testCacheRemoved);
+    DO_TEST("Cache corrupt", testCacheCorrupt);
+    DO_TEST("Cache backing missing", testCacheBackingMissing);
+    DO_TEST("Entry", testEntry);
+
+ cleanup:
+    if (data.pool) {
+        virStoragePoolObjClearVols(data.pool);
+        virStoragePoolDefFree(data.pool->def);
+        VIR_FREE(data.pool);
+    }
+    if (data.cacheFile)
+        unlink(data.cacheFile);
+    virFileDeleteTree(data.dir);
+    VIR_FREE(data.cacheFile);
+    VIR_FREE(tmpl);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "storage_conf.h"
+#include "viralloc.h"
+#include "virstring.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+struct testBenchmarkData {
+    size_t nvols;
+    size_t nlookups;
+};
+
+
+static virStorageVolDefPtr
+testNewVol(const char *name,
+           const char *key,
+           const char *path)
+{
+    virStorageVolDefPtr vol;
+
+    if (VIR_ALLOC(vol) < 0)
+        return NULL;
+
+    if (VIR_STRDUP(vol->name, name) < 0 ||
+        VIR_STRDUP(vol->key, key) < 0 ||
+        VIR_STRDUP(vol->target.path, path) < 0) {
+        virStorageVolDefFree(vol);
+        return NULL;
+    }
+
+    return vol;
+}
+
+
+static virStorageVolDefPtr
+testAddVol(virStoragePoolObjPtr pool,
+           const char *name,
+           const char *key,
+           const char *path)
+{
+    virStorageVolDefPtr vol;
+
+    if (!(vol = testNewVol(name, key, path)))
+        return NULL;
+
+    if (virStoragePoolObjAddVol(pool, vol) < 0) {
+        virStorageVolDefFree(vol);
+        return NULL;
+    }
+
+    return vol;
+}
+
+
+/* Checks that @name, @key and @path refer to @expect, if not NULL */
+static bool
+testFindVol(virStoragePoolObjPtr pool,
+            const char *name,
+            const char *key,
+            const char *path,
+            virStorageVolDefPtr expect)
+{
+    return (!name || virStorageVolDefFindByName(pool, name) == expect) &&
+        (!key || virStorageVolDefFindByKey(pool, key) == expect) &&
+        (!path || virStorageVolDefFindByPath(pool, path) == expect);
+}
+
+
+/* A removed volume is no longer found, the others still are */
+static int
+testRemove(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObj pool;
+    virStorageVolDefPtr a;
+    virStorageVolDefPtr b;
+    virStorageVolDefPtr c;
+    int ret = -1;
+
+    memset(&pool, 0, sizeof(pool));
+
+    if (!(a = testAddVol(&pool, "a", "key-a", "/pool/a")) ||
+        !(b = testAddVol(&pool, "b", "key-b", "/pool/b")) ||
+        !(c = testAddVol(&pool, "c", "key-c", "/pool/c")))
+        goto cleanup;
+
+    virStoragePoolObjRemoveVol(&pool, b);
+    virStorageVolDefFree(b);
+
+    if (!testFindVol(&pool, "b", "key-b", "/pool/b", NULL) ||
+        !testFindVol(&pool, "a", "key-a", "/pool/a", a) ||
+        !testFindVol(&pool, "c", "key-c", "/pool/c", c)) {
+        fprintf(stderr, "wrong volumes found after removal\n");
+        goto cleanup;
+    }
+
+    if (pool.volumes.count != 2 ||
+        pool.volumes.objs[0] != a || pool.volumes.objs[1] != c) {
+        fprintf(stderr, "volume list out of order after removal\n");
+        goto cleanup;
+    }
+
+    /* Removing a volume which isn't in the pool does nothing */
+    if (!(b = testNewVol("a", "key-a", "/pool/a")))
+        goto cleanup;
+    virStoragePoolObjRemoveVol(&pool, b);
+    virStorageVolDefFree(b);
+
+    if (pool.volumes.count != 2 ||
+        !testFindVol(&pool, "a", "key-a", "/pool/a", a)) {
+        fprintf(stderr, "foreign volume removed a volume of the pool\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjClearVols(&pool);
+    return ret;
+}
+
+
+/* A key or path shared by several volumes refers to the first one
+ * still in the pool */
+static int
+testDuplicates(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObj pool;
+    virStorageVolDefPtr first;
+    virStorageVolDefPtr second;
+    virStorageVolDefPtr third;
+    int ret = -1;
+
+    memset(&pool, 0, sizeof(pool));
+
+    if (!(first = testAddVol(&pool, "first", "key", "/pool/dev")) ||
+        !(second = testAddVol(&pool, "second", "key", "/pool/dev")) ||
+        !(third = testAddVol(&pool, "third", "key", "/pool/dev")))
+        goto cleanup;
+
+    if (!testFindVol(&pool, NULL, "key", "/pool/dev", first)) {
+        fprintf(stderr, "first volume not found\n");
+        goto cleanup;
+    }
+
+    /* Removing one which is shadowed changes nothing */
+    virStoragePoolObjRemoveVol(&pool, second);
+    virStorageVolDefFree(second);
+
+    if (!testFindVol(&pool, "second", NULL, NULL, NULL) ||
+        !testFindVol(&pool, NULL, "key", "/pool/dev", first)) {
+        fprintf(stderr, "first volume not found after removing second\n");
+        goto cleanup;
+    }
+
+    virStoragePoolObjRemoveVol(&pool, first);
+    virStorageVolDefFree(first);
+
+    if (!testFindVol(&pool, "first", NULL, NULL, NULL) ||
+        !testFindVol(&pool, "third", "key", "/pool/dev", third)) {
+        fprintf(stderr, "third volume not found\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjClearVols(&pool);
+    return ret;
+}
+
+
+/* Volumes without a key or path are found by their name, and the
+ * pool can be filled again after being cleared */
+static int
+testClear(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObj pool;
+    virStorageVolDefPtr vol;
+    int ret = -1;
+
+    memset(&pool, 0, sizeof(pool));
+
+    if (!(vol = testAddVol(&pool, "vol", NULL, NULL)))
+        goto cleanup;
+
+    if (!testFindVol(&pool, "vol", NULL, NULL, vol)) {
+        fprintf(stderr, "volume without key and path not found\n");
+        goto cleanup;
+    }
+
+    virStoragePoolObjClearVols(&pool);
+
+    if (pool.volumes.count != 0 ||
+        !testFindVol(&pool, "vol", NULL, NULL, NULL)) {
+        fprintf(stderr, "volume found after clearing the pool\n");
+        goto cleanup;
+    }
+
+    if (!(vol = testAddVol(&pool, "vol", "key", "/pool/vol")) ||
+        !testFindVol(&pool, "vol", "key", "/pool/vol", vol)) {
+        fprintf(stderr, "volume not found after refilling the pool\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjClearVols(&pool);
+    return ret;
+}
+
+
+/* Adds many volumes to a pool and looks them up, reporting the time it
+ * takes in verbose mode */
+static int
+testBenchmark(const void *opaque)
+{
+    const struct testBenchmarkData *data = opaque;
+    virStoragePoolObj pool;
+    virStorageVolDefPtr *vols = NULL;
+    char name[64];
+    char key[64];
+    char path[64];
+    unsigned long long start;
+    unsigned long long end;
+    size_t i;
+    int ret = -1;
+
+    memset(&pool, 0, sizeof(pool));
+
+    if (VIR_ALLOC_N(vols, data->nvols) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < data->nvols; i++) {
+        snprintf(name, sizeof(name), "vol%zu", i);
+        snprintf(key, sizeof(key), "key%zu", i);
+        snprintf(path, sizeof(path), "/pool/%zu", i);
+
+        if (!(vols[i] = testAddVol(&pool, name, key, path)))
+            goto cleanup;
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    VIR_TEST_VERBOSE("\nadded %zu volumes in %llu ms\n",
+                     data->nvols, end - start);
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < data->nlookups; i++) {
+        size_t n = (i * 7919) % data->nvols;
+
+        snprintf(name, sizeof(name), "vol%zu", n);
+        snprintf(key, sizeof(key), "key%zu", n);
+        snprintf(path, sizeof(path), "/pool/%zu", n);
+
+        if (!testFindVol(&pool, name, key, path, vols[n])) {
+            fprintf(stderr, "volume %zu not found\n", n);
+            goto cleanup;
+        }
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    VIR_TEST_VERBOSE("%zu lookups by name, key and path in %llu ms\n",
+                     data->nlookups, end - start);
+
+    ret = 0;
+
+ cleanup:
+    virStoragePoolObjClearVols(&pool);
+    VIR_FREE(vols);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virTestRun("Remove", testRemove, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Duplicates", testDuplicates, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Clear", testClear, NULL) < 0)
+        ret = -1;
+
+    if (virTestGetExpensive()) {
+        struct testBenchmarkData data = { 100000, 1000000 };
+
+        if (virTestRun("Benchmark", testBenchmark, &data) < 0)
+            ret = -1;
+    }
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
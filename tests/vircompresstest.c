@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "vircompress.h"
+#include "vircommand.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Small chunks, so that even the short tests use many of them */
+#define CHUNK_SIZE (64 * 1024)
+
+struct testCompressData {
+    const char *name;
+    const char *prog;
+    size_t len;
+    size_t nworkers;
+    size_t chunkSize;
+    unsigned int flags;
+};
+
+
+static void
+fillInput(char *buf, size_t len)
+{
+    size_t i;
+
+    /* Compressible, but not trivially so */
+    for (i = 0; i < len; i++)
+        buf[i] = (i / 7) ^ (i >> 13);
+}
+
+
+/* Runs @stream until its input, written from @in, is exhausted */
+static int
+runStream(const char *const *args,
+          const char *in,
+          size_t inlen,
+          const char *outpath,
+          size_t nworkers,
+          size_t chunkSize,
+          unsigned int flags,
+          virCompressStatsPtr stats)
+{
+    virCompressStreamPtr stream = NULL;
+    int pipefd[2] = { -1, -1 };
+    int outfd = -1;
+    int ret = -1;
+
+    if (pipe(pipefd) < 0 ||
+        (outfd = open(outpath, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0)
+        goto cleanup;
+
+    if (!(stream = virCompressStreamNew(args, pipefd[0], outfd, nworkers,
+                                        chunkSize, flags)))
+        goto cleanup;
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(outfd);
+
+    if (safewrite(pipefd[1], in, inlen) != inlen)
+        goto cleanup;
+    VIR_FORCE_CLOSE(pipefd[1]);
+
+    if (virCompressStreamWait(stream) < 0)
+        goto cleanup;
+
+    virCompressStreamGetStats(stream, stats);
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    VIR_FORCE_CLOSE(outfd);
+    virCompressStreamFree(stream);
+    return ret;
+}
+
+
+static int
+decompressFile(const char *const *args,
+               const char *inpath,
+               const char *outpath)
+{
+    virCommandPtr cmd = virCommandNewArgs(args);
+    int infd = -1;
+    int outfd = -1;
+    int ret = -1;
+
+    if ((infd = open(inpath, O_RDONLY)) < 0 ||
+        (outfd = open(outpath, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0)
+        goto cleanup;
+
+    virCommandSetInputFD(cmd, infd);
+    virCommandSetOutputFD(cmd, &outfd);
+    ret = virCommandRun(cmd, NULL);
+
+ cleanup:
+    VIR_FORCE_CLOSE(infd);
+    VIR_FORCE_CLOSE(outfd);
+    virCommandFree(cmd);
+    return ret;
+}
+
+
+static int
+testCompress(const void *opaque)
+{
+    const struct testCompressData *data = opaque;
+    const char *compress[] = { data->prog, "-c", NULL };
+    const char *decompress[] = { data->prog, "-dc", NULL };
+    char *prog = NULL;
+    char *compressed = NULL;
+    char *output = NULL;
+    char *in = NULL;
+    char *out = NULL;
+    char *packed = NULL;
+    virCompressStats stats;
+    unsigned long long start;
+    unsigned long long end;
+    int len;
+    int ret = -1;
+
+    if (!(prog = virFindFileInPath(data->prog))) {
+        ret = EXIT_AM_SKIP;
+        goto cleanup;
+    }
+
+    if (virAsprintf(&compressed, "%s/compress-%d.z", abs_builddir,
+                    getpid()) < 0 ||
+        virAsprintf(&output, "%s/compress-%d.out", abs_builddir,
+                    getpid()) < 0 ||
+        VIR_ALLOC_N(in, data->len) < 0)
+        goto cleanup;
+
+    fillInput(in, data->len);
+
+    if (virTimeMillisNow(&start) < 0 ||
+        runStream(compress, in, data->len, compressed, data->nworkers,
+                  data->chunkSize, data->flags, &stats) < 0 ||
+        virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    VIR_TEST_VERBOSE("\n%s: compressed %zu MiB to %llu KiB in %llu ms\n",
+                     data->name, data->len >> 20, stats.writeBytes >> 10,
+                     end - start);
+
+    if (stats.readBytes != data->len) {
+        fprintf(stderr, "read %llu bytes, expected %zu\n",
+                stats.readBytes, data->len);
+        goto cleanup;
+    }
+
+    if ((len = virFileReadAll(compressed, INT_MAX, &packed)) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    if (data->flags & VIR_COMPRESS_STREAM_CHUNKED) {
+        if (runStream(decompress, packed, len, output, data->nworkers, 0,
+                      VIR_COMPRESS_STREAM_CHUNKED |
+                      VIR_COMPRESS_STREAM_DECOMPRESS, &stats) < 0)
+            goto cleanup;
+    } else {
+        /* Concatenated chunks are decompressed by the program itself */
+        if (decompressFile(decompress, compressed, output) < 0)
+            goto cleanup;
+    }
+    ignore_value(virTimeMillisNow(&end));
+
+    VIR_TEST_VERBOSE("%s: decompressed in %llu ms\n",
+                     data->name, end - start);
+
+    if (virFileReadAll(output, INT_MAX, &out) != data->len ||
+        memcmp(in, out, data->len) != 0) {
+        fprintf(stderr, "decompressed data differ\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (compressed)
+        unlink(compressed);
+    if (output)
+        unlink(output);
+    VIR_FREE(compressed);
+    VIR_FREE(output);
+    VIR_FREE(prog);
+    VIR_FREE(packed);
+    VIR_FREE(in);
+    VIR_FREE(out);
+    return ret;
+}
+
+
+/* A chunked stream missing its end must not decompress */
+static int
+testTruncated(const void *opaque ATTRIBUTE_UNUSED)
+{
+    const char *compress[] = { "gzip", "-c", NULL };
+    const char *decompress[] = { "gzip", "-dc", NULL };
+    char *prog = NULL;
+    char *path = NULL;
+    char *in = NULL;
+    char *packed = NULL;
+    virCompressStats stats;
+    size_t len = 4 * CHUNK_SIZE;
+    int packedlen;
+    int ret = -1;
+
+    if (!(prog = virFindFileInPath("gzip"))) {
+        ret = EXIT_AM_SKIP;
+        goto cleanup;
+    }
+
+    if (virAsprintf(&path, "%s/compress-%d.z", abs_builddir, getpid()) < 0 ||
+        VIR_ALLOC_N(in, len) < 0)
+        goto cleanup;
+
+    fillInput(in, len);
+
+    if (runStream(compress, in, len, path, 2, CHUNK_SIZE,
+                  VIR_COMPRESS_STREAM_CHUNKED, &stats) < 0 ||
+        (packedlen = virFileReadAll(path, INT_MAX, &packed)) < 0)
+        goto cleanup;
+
+    /* Drop the index trailer */
+    if (runStream(decompress, packed, packedlen - 16, path, 2, 0,
+                  VIR_COMPRESS_STREAM_CHUNKED |
+                  VIR_COMPRESS_STREAM_DECOMPRESS, &stats) == 0) {
+        fprintf(stderr, "truncated stream was accepted\n");
+        goto cleanup;
+    }
+
+    virResetLastError();
+    ret = 0;
+
+ cleanup:
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    VIR_FREE(prog);
+    VIR_FREE(in);
+    VIR_FREE(packed);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    /* The input pipe is closed early on failure */
+    signal(SIGPIPE, SIG_IGN);
+
+#define DO_TEST(desc, p, l, n, c, f)                                    \
+    do {                                                                \
+        struct testCompressData data = {                                \
+            .name = desc, .prog = p, .len = l, .nworkers = n,           \
+            .chunkSize = c, .flags = f,                                 \
+        };                                                              \
+        if (virTestRun(desc, testCompress, &data) < 0)                  \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("Concatenated gzip", "gzip", 10 * CHUNK_SIZE + 3, 3,
+            CHUNK_SIZE, 0);
+    DO_TEST("Chunked gzip", "gzip", 10 * CHUNK_SIZE + 3, 3,
+            CHUNK_SIZE, VIR_COMPRESS_STREAM_CHUNKED);
+    DO_TEST("Chunked gzip single worker", "gzip", 3 * CHUNK_SIZE, 1,
+            CHUNK_SIZE, VIR_COMPRESS_STREAM_CHUNKED);
+    DO_TEST("Chunked empty", "gzip", 0, 2, CHUNK_SIZE,
+            VIR_COMPRESS_STREAM_CHUNKED);
+    DO_TEST("Chunked bzip2", "bzip2", 5 * CHUNK_SIZE, 2,
+            CHUNK_SIZE, VIR_COMPRESS_STREAM_CHUNKED);
+    DO_TEST("Chunked xz", "xz", 5 * CHUNK_SIZE, 2,
+            CHUNK_SIZE, VIR_COMPRESS_STREAM_CHUNKED);
+
+    if (virTestRun("Truncated stream", testTruncated, NULL) < 0)
+        ret = -1;
+
+    if (virTestGetExpensive()) {
+        /* Compare one and four workers on 256 MiB */
+        DO_TEST("Benchmark xz 1 worker", "xz", 256 << 20, 1, 0,
+                VIR_COMPRESS_STREAM_CHUNKED);
+        DO_TEST("Benchmark xz 4 workers", "xz", 256 << 20, 4, 0,
+                VIR_COMPRESS_STREAM_CHUNKED);
+    }
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
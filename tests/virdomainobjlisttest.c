@@ -0,0 +1,513 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "virerror.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virtime.h"
+
+#include "virdomainobjlist.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.virdomainobjlisttest");
+
+#define TEST_LOOKUPS 100000
+
+static virDomainXMLOptionPtr xmlopt;
+static virDomainXMLOptionPtr xmloptJournal;
+static virCapsPtr caps;
+
+struct testLookupData {
+    size_t ndomains;
+};
+
+struct testLoadData {
+    size_t nconfigs;
+};
+
+
+static virDomainObjListPtr
+testDomainObjListNew(size_t ndomains)
+{
+    virDomainObjListPtr doms;
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr vm;
+    size_t i;
+
+    if (!(doms = virDomainObjListNew()))
+        return NULL;
+
+    for (i = 0; i < ndomains; i++) {
+        if (!(def = virDomainDefNew()))
+            goto error;
+
+        def->id = -1;
+        def->virtType = VIR_DOMAIN_VIRT_QEMU;
+        if (virAsprintf(&def->name, "dom%zu", i) < 0)
+            goto error;
+        memset(def->uuid, 0, VIR_UUID_BUFLEN);
+        memcpy(def->uuid, &i, sizeof(i));
+
+        if (!(vm = virDomainObjListAdd(doms, def, xmlopt, 0, NULL)))
+            goto error;
+        def = NULL;
+
+        /* Start every other domain so that inactive ones are
+         * mixed in the list as well */
+        if (i % 2 == 0)
+            virDomainObjListSetID(doms, vm, i + 1);
+        virObjectUnlock(vm);
+    }
+
+    return doms;
+
+ error:
+    virDomainDefFree(def);
+    virObjectUnref(doms);
+    return NULL;
+}
+
+
+static int
+testLookupByID(const void *opaque)
+{
+    const struct testLookupData *data = opaque;
+    virDomainObjListPtr doms;
+    virDomainObjPtr vm;
+    unsigned long long start;
+    unsigned long long end;
+    size_t i;
+    int ret = -1;
+
+    if (!(doms = testDomainObjListNew(data->ndomains)))
+        return -1;
+
+    /* Every started domain must be found ... */
+    for (i = 0; i < data->ndomains; i += 2) {
+        if (!(vm = virDomainObjListFindByID(doms, i + 1))) {
+            fprintf(stderr, "domain with id %zu not found\n", i + 1);
+            goto cleanup;
+        }
+        if (vm->def->id != (int) i + 1) {
+            fprintf(stderr, "expected id %zu got %d\n", i + 1, vm->def->id);
+            virObjectUnlock(vm);
+            goto cleanup;
+        }
+        virObjectUnlock(vm);
+    }
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_LOOKUPS; i++) {
+        if ((vm = virDomainObjListFindByIDRef(doms,
+                                              (i * 2) % data->ndomains + 1)))
+            virDomainObjEndAPI(&vm);
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    VIR_TEST_VERBOSE("\n%zu domains: %d lookups by ID took %llu ms\n",
+                     data->ndomains, TEST_LOOKUPS, end - start);
+
+    /* A stopped domain must not be found anymore */
+    if (!(vm = virDomainObjListFindByIDRef(doms, 1)))
+        goto cleanup;
+    virDomainObjListSetID(doms, vm, -1);
+    virDomainObjEndAPI(&vm);
+
+    if ((vm = virDomainObjListFindByID(doms, 1))) {
+        fprintf(stderr, "stopped domain still found by id\n");
+        virObjectUnlock(vm);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(doms);
+    return ret;
+}
+
+
+static int
+testLoadAllConfigs(const void *opaque)
+{
+    const struct testLoadData *data = opaque;
+    virDomainObjListPtr doms = NULL;
+    virDomainObjPtr vm;
+    char template[] = "/tmp/libvirt_XXXXXX";
+    char *dir = NULL;
+    char *path = NULL;
+    char *xml = NULL;
+    unsigned long long start;
+    unsigned long long end;
+    size_t i;
+    int n;
+    int ret = -1;
+
+    if (!(dir = mkdtemp(template))) {
+        fprintf(stderr, "Cannot create temporary directory: %d\n", errno);
+        return -1;
+    }
+
+    for (i = 0; i < data->nconfigs; i++) {
+        if (virAsprintf(&path, "%s/dom%zu.xml", dir, i) < 0 ||
+            virAsprintf(&xml,
+                        "<domain type='test'>\n"
+                        "  <name>dom%zu</name>\n"
+                        "  <uuid>c7a5fdbd-edaf-9455-926a-d65c%08zx</uuid>\n"
+                        "  <memory unit='KiB'>219136</memory>\n"
+                        "  <vcpu>1</vcpu>\n"
+                        "  <os>\n"
+                        "    <type arch='i686'>hvm</type>\n"
+                        "  </os>\n"
+                        "</domain>\n", i, i) < 0)
+            goto cleanup;
+
+        if (virFileWriteStr(path, xml, 0600) < 0) {
+            fprintf(stderr, "Cannot write %s: %d\n", path, errno);
+            goto cleanup;
+        }
+        VIR_FREE(path);
+        VIR_FREE(xml);
+    }
+
+    if (!(doms = virDomainObjListNew()))
+        goto cleanup;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    if (virDomainObjListLoadAllConfigs(doms, dir, dir, 0, caps, xmlopt,
+                                       NULL, NULL) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    VIR_TEST_VERBOSE("\n%zu configs loaded in %llu ms\n",
+                     data->nconfigs, end - start);
+
+    if ((n = virDomainObjListNumOfDomains(doms, false, NULL, NULL)) !=
+        data->nconfigs) {
+        fprintf(stderr, "expected %zu domains, got %d\n", data->nconfigs, n);
+        goto cleanup;
+    }
+
+    /* Every config must end up under its own name */
+    for (i = 0; i < data->nconfigs; i++) {
+        if (virAsprintf(&path, "dom%zu", i) < 0)
+            goto cleanup;
+
+        if (!(vm = virDomainObjListFindByName(doms, path))) {
+            fprintf(stderr, "domain %s not loaded\n", path);
+            goto cleanup;
+        }
+        if (!vm->persistent || vm->autostart) {
+            fprintf(stderr, "domain %s loaded with wrong flags\n", path);
+            virDomainObjEndAPI(&vm);
+            goto cleanup;
+        }
+        virDomainObjEndAPI(&vm);
+        VIR_FREE(path);
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(doms);
+    ignore_value(virFileDeleteTree(dir));
+    VIR_FREE(path);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static virDomainObjPtr
+testStatusLoad(const char *dir)
+{
+    virDomainObjListPtr doms;
+    virDomainObjPtr vm = NULL;
+
+    if (!(doms = virDomainObjListNew()))
+        return NULL;
+
+    if (virDomainObjListLoadAllConfigs(doms, dir, NULL, 1, caps, xmloptJournal,
+                                       NULL, NULL) < 0)
+        goto cleanup;
+
+    if (!(vm = virDomainObjListFindByName(doms, "journal")))
+        fprintf(stderr, "domain not loaded from status\n");
+
+ cleanup:
+    virObjectUnref(doms);
+    return vm;
+}
+
+
+static int
+testStatusCheck(const char *dir,
+                unsigned long long balloon,
+                size_t nrecords)
+{
+    virDomainObjPtr vm;
+    int ret = -1;
+
+    if (!(vm = testStatusLoad(dir)))
+        return -1;
+
+    if (vm->def->mem.cur_balloon != balloon) {
+        fprintf(stderr, "expected balloon %llu got %llu\n",
+                balloon, vm->def->mem.cur_balloon);
+        goto cleanup;
+    }
+
+    if (vm->statusJournalRecords != nrecords) {
+        fprintf(stderr, "expected %zu journal records got %zu\n",
+                nrecords, vm->statusJournalRecords);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virDomainObjEndAPI(&vm);
+    return ret;
+}
+
+
+static int
+testStatusJournal(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjListPtr doms = NULL;
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr vm = NULL;
+    char template[] = "/tmp/libvirt_XXXXXX";
+    char *dir = NULL;
+    char *statusFile = NULL;
+    char *journalFile = NULL;
+    char *status = NULL;
+    char *newStatus = NULL;
+    off_t size;
+    int ret = -1;
+
+    if (!(dir = mkdtemp(template))) {
+        fprintf(stderr, "Cannot create temporary directory: %d\n", errno);
+        return -1;
+    }
+
+    if (!(statusFile = virDomainConfigFile(dir, "journal")) ||
+        !(journalFile = virDomainStatusJournalFile(dir, "journal")))
+        goto cleanup;
+
+    if (!(def = virDomainDefParseString("<domain type='test'>\n"
+                                        "  <name>journal</name>\n"
+                                        "  <uuid>c7a5fdbd-edaf-9455-926a-d65c16db1809</uuid>\n"
+                                        "  <memory unit='KiB'>219136</memory>\n"
+                                        "  <vcpu>1</vcpu>\n"
+                                        "  <os>\n"
+                                        "    <type arch='i686'>hvm</type>\n"
+                                        "  </os>\n"
+                                        "</domain>\n",
+                                        caps, xmloptJournal, NULL, 0)))
+        goto cleanup;
+
+    if (!(doms = virDomainObjListNew()) ||
+        !(vm = virDomainObjListAdd(doms, def, xmloptJournal, 0, NULL)))
+        goto cleanup;
+    def = NULL;
+
+    vm->def->id = 1;
+    vm->pid = getpid();
+    virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_BOOTED);
+
+    /* The first save writes the complete status */
+    if (virDomainSaveStatus(xmloptJournal, dir, vm, caps) < 0)
+        goto cleanup;
+
+    if (virFileExists(journalFile)) {
+        fprintf(stderr, "journal written by initial save\n");
+        goto cleanup;
+    }
+
+    if (virFileReadAll(statusFile, 1024 * 1024, &status) < 0)
+        goto cleanup;
+
+    /* Further changes only go to the journal */
+    vm->def->mem.cur_balloon = 1024;
+    if (virDomainSaveStatus(xmloptJournal, dir, vm, caps) < 0)
+        goto cleanup;
+
+    vm->def->mem.cur_balloon = 2048;
+    if (virDomainSaveStatus(xmloptJournal, dir, vm, caps) < 0)
+        goto cleanup;
+
+    if (virFileReadAll(statusFile, 1024 * 1024, &newStatus) < 0)
+        goto cleanup;
+
+    if (STRNEQ(status, newStatus)) {
+        fprintf(stderr, "status file rewritten despite journal\n");
+        goto cleanup;
+    }
+
+    if ((size = virFileLength(journalFile, -1)) <= 0) {
+        fprintf(stderr, "journal not written\n");
+        goto cleanup;
+    }
+
+    /* Saving an unchanged status must not record anything */
+    if (virDomainSaveStatus(xmloptJournal, dir, vm, caps) < 0)
+        goto cleanup;
+
+    if (virFileLength(journalFile, -1) != size) {
+        fprintf(stderr, "unchanged status recorded in journal\n");
+        goto cleanup;
+    }
+
+    if (testStatusCheck(dir, 2048, 2) < 0)
+        goto cleanup;
+
+    /* A torn last record is dropped, the one before it still applies */
+    if (truncate(journalFile, size - 2) < 0) {
+        fprintf(stderr, "Cannot truncate %s: %d\n", journalFile, errno);
+        goto cleanup;
+    }
+
+    if (testStatusCheck(dir, 1024, 0) < 0)
+        goto cleanup;
+
+    /* Compacting folds the journal into the status file */
+    vm->def->mem.cur_balloon = 4096;
+    if (virDomainSaveStatus(xmloptJournal, dir, vm, caps) < 0 ||
+        virDomainCompactStatus(dir, vm) < 0)
+        goto cleanup;
+
+    if (virFileExists(journalFile)) {
+        fprintf(stderr, "journal left behind by compaction\n");
+        goto cleanup;
+    }
+
+    if (testStatusCheck(dir, 4096, 0) < 0)
+        goto cleanup;
+
+    /* Deferred saves are not written until the deferral ends */
+    virDomainObjDeferStatus(vm);
+    vm->def->mem.cur_balloon = 8192;
+    if (virDomainSaveStatus(xmloptJournal, dir, vm, caps) < 0)
+        goto cleanup;
+
+    if (virFileExists(journalFile)) {
+        fprintf(stderr, "deferred save written\n");
+        goto cleanup;
+    }
+
+    if (!virDomainObjEndDeferStatus(vm)) {
+        fprintf(stderr, "deferred save not reported\n");
+        goto cleanup;
+    }
+
+    if (virDomainObjEndDeferStatus(vm)) {
+        fprintf(stderr, "deferred save reported twice\n");
+        goto cleanup;
+    }
+
+    if (virDomainSaveStatus(xmloptJournal, dir, vm, caps) < 0 ||
+        testStatusCheck(dir, 8192, 1) < 0)
+        goto cleanup;
+
+    virDomainRemoveStatusJournal(dir, vm);
+    if (vm->statusXML) {
+        fprintf(stderr, "status document kept after removal\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(def);
+    if (vm)
+        virObjectUnlock(vm);
+    virObjectUnref(doms);
+    ignore_value(virFileDeleteTree(dir));
+    VIR_FREE(statusFile);
+    VIR_FREE(journalFile);
+    VIR_FREE(status);
+    VIR_FREE(newStatus);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    virDomainDefParserConfig journalConfig = {
+        .features = VIR_DOMAIN_DEF_FEATURE_STATUS_JOURNAL,
+    };
+
+    if (!(xmlopt = virTestGenericDomainXMLConfInit()) ||
+        !(xmloptJournal = virDomainXMLOptionNew(&journalConfig, NULL, NULL)) ||
+        !(caps = virTestGenericCapsInit()))
+        return EXIT_FAILURE;
+
+#define DO_TEST_LOOKUP(n)                                               \
+    do {                                                                \
+        struct testLookupData data = { .ndomains = n };                 \
+        if (virTestRun("Lookup by ID in " #n " domains",                \
+                       testLookupByID, &data) < 0)                      \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_LOOKUP(10);
+    DO_TEST_LOOKUP(100);
+    DO_TEST_LOOKUP(1000);
+
+    if (virTestGetExpensive())
+        DO_TEST_LOOKUP(10000);
+
+#define DO_TEST_LOAD(n)                                                 \
+    do {                                                                \
+        struct testLoadData data = { .nconfigs = n };                   \
+        if (virTestRun("Load " #n " configs",                           \
+                       testLoadAllConfigs, &data) < 0)                  \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_LOAD(1);
+    DO_TEST_LOAD(50);
+
+    if (virTestRun("Status journal", testStatusJournal, NULL) < 0)
+        ret = -1;
+
+    virObjectUnref(caps);
+    virObjectUnref(xmloptJournal);
+    virObjectUnref(xmlopt);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
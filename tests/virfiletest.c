@@ -21,6 +21,7 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <fcntl.h>
 
 #include "testutils.h"
 #include "virfile.h"
@@ -118,6 +119,169 @@ testFileSanitizePath(const void *opaque)
 }
 
 
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+
+/* Size of a single data or hole section of the test file. It has to be
+ * large enough to span whole file system blocks. */
+# define EXTENT (1024 * 1024)
+
+struct testFileInData {
+    bool startData;         /* whether the file starts with data */
+    const off_t *sections;  /* section lengths in EXTENTs, 0 terminated */
+};
+
+
+static int
+makeSparseFile(const off_t sections[],
+               bool startData)
+{
+    int fd = -1;
+    char path[] = abs_builddir "/fileInData.XXXXXX";
+    char *buf = NULL;
+    off_t len = 0;
+    bool inData = startData;
+    size_t i;
+
+    if (VIR_ALLOC_N(buf, EXTENT) < 0)
+        return -1;
+    memset(buf, 'x', EXTENT);
+
+    if ((fd = mkostemp(path, O_CLOEXEC | O_RDWR)) < 0)
+        goto error;
+
+    if (unlink(path) < 0)
+        goto error;
+
+    for (i = 0; sections[i]; i++) {
+        off_t j;
+
+        for (j = 0; j < sections[i]; j++) {
+            if (inData) {
+                if (safewrite(fd, buf, EXTENT) < 0)
+                    goto error;
+            } else if (lseek(fd, EXTENT, SEEK_CUR) == (off_t) -1) {
+                goto error;
+            }
+        }
+
+        len += sections[i] * EXTENT;
+        inData = !inData;
+    }
+
+    /* Make sure a trailing hole is part of the file */
+    if (ftruncate(fd, len) < 0 ||
+        lseek(fd, 0, SEEK_SET) == (off_t) -1)
+        goto error;
+
+    VIR_FREE(buf);
+    return fd;
+
+ error:
+    VIR_FREE(buf);
+    VIR_FORCE_CLOSE(fd);
+    return -1;
+}
+
+
+/* Checks whether the file system backing the build directory is able
+ * to create holes in files at all */
+static bool
+holesSupported(void)
+{
+    const off_t sections[] = {1, 1, 1, 0};
+    int fd;
+    int inData;
+    long long len;
+    bool ret = false;
+
+    if ((fd = makeSparseFile(sections, true)) < 0)
+        return false;
+
+    if (lseek(fd, EXTENT, SEEK_SET) == (off_t) -1 ||
+        virFileInData(fd, &inData, &len) < 0)
+        goto cleanup;
+
+    ret = !inData && len == EXTENT;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    virResetLastError();
+    return ret;
+}
+
+
+static int
+testFileInDataCheck(int fd,
+                    off_t pos,
+                    int expectInData,
+                    long long expectLen)
+{
+    int inData;
+    long long len;
+
+    if (lseek(fd, pos, SEEK_SET) == (off_t) -1) {
+        fprintf(stderr, "Unable to seek to %lld\n", (long long) pos);
+        return -1;
+    }
+
+    if (virFileInData(fd, &inData, &len) < 0)
+        return -1;
+
+    if (!!inData != expectInData || len != expectLen) {
+        fprintf(stderr,
+                "At %lld: expected inData=%d len=%lld, got inData=%d len=%lld\n",
+                (long long) pos, expectInData, expectLen, !!inData, len);
+        return -1;
+    }
+
+    if (lseek(fd, 0, SEEK_CUR) != pos) {
+        fprintf(stderr, "Position in file was not restored\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testFileInData(const void *opaque)
+{
+    const struct testFileInData *data = opaque;
+    int fd;
+    off_t cur = 0;
+    bool inData = data->startData;
+    size_t i;
+    int ret = -1;
+
+    if ((fd = makeSparseFile(data->sections, data->startData)) < 0)
+        return -1;
+
+    for (i = 0; data->sections[i]; i++) {
+        long long len = data->sections[i] * EXTENT;
+
+        /* Check both the beginning and the middle of the section */
+        if (testFileInDataCheck(fd, cur, inData, len) < 0 ||
+            testFileInDataCheck(fd, cur + len / 2, inData, len - len / 2) < 0)
+            goto cleanup;
+
+        cur += len;
+        inData = !inData;
+    }
+
+    /* There's an implicit hole at EOF */
+    if (testFileInDataCheck(fd, cur, false, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+#endif /* defined(SEEK_DATA) && defined(SEEK_HOLE) */
+
+
 static int
 mymain(void)
 {
@@ -186,6 +350,28 @@ mymain(void)
     DO_TEST_SANITIZE_PATH_SAME("gluster://bar.baz/fooo//hoo");
     DO_TEST_SANITIZE_PATH_SAME("gluster://bar.baz/fooo///////hoo");
 
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+# define DO_TEST_IN_DATA(inData, ...)                                          \
+    do {                                                                       \
+        const off_t sections[] = {__VA_ARGS__, 0};                             \
+        struct testFileInData data = {                                         \
+            .startData = inData, .sections = sections,                         \
+        };                                                                     \
+        if (virTestRun(virTestCounterNext(), testFileInData, &data) < 0)       \
+            ret = -1;                                                          \
+    } while (0)
+
+    if (holesSupported()) {
+        virTestCounterReset("testFileInData ");
+        DO_TEST_IN_DATA(true, 1, 1, 1);
+        DO_TEST_IN_DATA(false, 1, 1, 1);
+        DO_TEST_IN_DATA(true, 2, 2, 2);
+        DO_TEST_IN_DATA(false, 2, 2, 2);
+        DO_TEST_IN_DATA(true, 1, 2, 3, 4, 5, 6);
+        DO_TEST_IN_DATA(false, 1, 2, 3, 4, 5, 6);
+    }
+#endif /* defined(SEEK_DATA) && defined(SEEK_HOLE) */
+
     return ret != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
@@ -597,6 +597,69 @@ testHashEqual(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+static int
+testHashMulti(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashMultiPtr hash;
+    int objs[4];
+    int ret = -1;
+
+    if (!(hash = virHashMultiNew(0)))
+        return -1;
+
+    if (virHashMultiAddEntry(hash, "shared", &objs[0]) < 0 ||
+        virHashMultiAddEntry(hash, "shared", &objs[1]) < 0 ||
+        virHashMultiAddEntry(hash, "shared", &objs[2]) < 0 ||
+        virHashMultiAddEntry(hash, "single", &objs[3]) < 0)
+        goto cleanup;
+
+    if (virHashMultiLookup(hash, "shared") != &objs[0] ||
+        virHashMultiLookup(hash, "single") != &objs[3] ||
+        virHashMultiLookup(hash, "missing")) {
+        VIR_TEST_VERBOSE("\nwrong objects found\n");
+        goto cleanup;
+    }
+
+    /* Removing an object not indexed by the name does nothing */
+    virHashMultiRemoveEntry(hash, "shared", &objs[3]);
+    virHashMultiRemoveEntry(hash, "missing", &objs[0]);
+
+    /* The one added first is found until it's removed */
+    virHashMultiRemoveEntry(hash, "shared", &objs[1]);
+    if (virHashMultiLookup(hash, "shared") != &objs[0]) {
+        VIR_TEST_VERBOSE("\nfirst object not found\n");
+        goto cleanup;
+    }
+
+    virHashMultiRemoveEntry(hash, "shared", &objs[0]);
+    if (virHashMultiLookup(hash, "shared") != &objs[2]) {
+        VIR_TEST_VERBOSE("\nlast object not found\n");
+        goto cleanup;
+    }
+
+    virHashMultiRemoveEntry(hash, "shared", &objs[2]);
+    virHashMultiRemoveEntry(hash, "single", &objs[3]);
+    if (virHashMultiLookup(hash, "shared") ||
+        virHashMultiLookup(hash, "single")) {
+        VIR_TEST_VERBOSE("\nremoved object found\n");
+        goto cleanup;
+    }
+
+    /* A name can be used again once all its objects are gone */
+    if (virHashMultiAddEntry(hash, "shared", &objs[1]) < 0 ||
+        virHashMultiLookup(hash, "shared") != &objs[1]) {
+        VIR_TEST_VERBOSE("\nre-added object not found\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virHashMultiFree(hash);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -635,6 +698,7 @@ mymain(void)
     DO_TEST("Search", Search);
     DO_TEST("GetItems", GetItems);
     DO_TEST("Equal", Equal);
+    DO_TEST("Multi", Multi);
 
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
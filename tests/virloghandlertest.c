@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "testutils.h"
+#include "viralloc.h"
+#include "virevent.h"
+#include "virfile.h"
+#include "virobject.h"
+#include "virstring.h"
+#include "virtime.h"
+#include "logging/log_handler.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define LINE "The quick brown fox jumps over the lazy dog\n"
+
+/* Output is written out 100 ms after it was read, give it way more */
+#define FLUSH_TIMEOUT 2000
+
+struct testLog {
+    virLogHandlerPtr handler;
+    char *path;
+    int fd;     /* the guest's end of the pipe */
+    int tick;   /* wakes the event loop up regularly */
+};
+
+
+static void
+testInhibitor(bool inhibit ATTRIBUTE_UNUSED,
+              void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+
+static void
+testTick(int timer ATTRIBUTE_UNUSED,
+         void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+
+static void
+testLogClose(struct testLog *log)
+{
+    if (log->tick >= 0)
+        virEventRemoveTimeout(log->tick);
+    virObjectUnref(log->handler);
+    VIR_FORCE_CLOSE(log->fd);
+    if (log->path)
+        unlink(log->path);
+    VIR_FREE(log->path);
+}
+
+
+static int
+testLogOpen(struct testLog *log,
+            const char *name)
+{
+    unsigned char uuid[VIR_UUID_BUFLEN] = { 0 };
+    ino_t inode;
+    off_t offset;
+
+    memset(log, 0, sizeof(*log));
+    log->fd = -1;
+    log->tick = -1;
+
+    if (virAsprintf(&log->path, "%s/%s-%d.log",
+                    abs_builddir, name, (int) getpid()) < 0 ||
+        !(log->handler = virLogHandlerNew(false, 1024 * 1024, 2,
+                                          testInhibitor, NULL)) ||
+        (log->fd = virLogHandlerDomainOpenLogFile(log->handler, "test",
+                                                  uuid, name, log->path,
+                                                  true, &inode,
+                                                  &offset)) < 0 ||
+        (log->tick = virEventAddTimeout(10, testTick, NULL, NULL)) < 0) {
+        testLogClose(log);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static off_t
+testLogSize(struct testLog *log)
+{
+    struct stat sb;
+
+    if (stat(log->path, &sb) < 0)
+        return -1;
+
+    return sb.st_size;
+}
+
+
+static int
+testLogWrite(struct testLog *log)
+{
+    if (safewrite(log->fd, LINE, strlen(LINE)) != strlen(LINE)) {
+        fprintf(stderr, "cannot write to the log pipe\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Runs the event loop until virtlogd read @bytes from the pipe */
+static int
+testLogRead(struct testLog *log,
+            unsigned long long bytes)
+{
+    unsigned long long now;
+    unsigned long long deadline;
+    unsigned long long got = 0;
+    unsigned long long dropped = 0;
+
+    if (virTimeMillisNow(&deadline) < 0)
+        return -1;
+    deadline += FLUSH_TIMEOUT;
+
+    do {
+        if (virEventRunDefaultImpl() < 0 ||
+            virLogHandlerDomainGetLogFileStats(log->handler, log->path, 0,
+                                               &got, &dropped) < 0 ||
+            virTimeMillisNow(&now) < 0)
+            return -1;
+    } while (got < bytes && now < deadline);
+
+    if (got != bytes || dropped) {
+        fprintf(stderr, "read %llu bytes and dropped %llu, expected %llu\n",
+                got, dropped, bytes);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Output is kept in memory for a while and written out in one go */
+static int
+testBuffered(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testLog log;
+    unsigned long long now;
+    unsigned long long deadline;
+    int ret = -1;
+
+    if (testLogOpen(&log, "buffered") < 0)
+        return -1;
+
+    if (testLogWrite(&log) < 0 ||
+        testLogWrite(&log) < 0 ||
+        testLogRead(&log, 2 * strlen(LINE)) < 0)
+        goto cleanup;
+
+    if (testLogSize(&log) != 0) {
+        fprintf(stderr, "output was written out right away\n");
+        goto cleanup;
+    }
+
+    if (virTimeMillisNow(&deadline) < 0)
+        goto cleanup;
+    deadline += FLUSH_TIMEOUT;
+
+    do {
+        if (virEventRunDefaultImpl() < 0 ||
+            virTimeMillisNow(&now) < 0)
+            goto cleanup;
+    } while (testLogSize(&log) == 0 && now < deadline);
+
+    if (testLogSize(&log) != 2 * strlen(LINE)) {
+        fprintf(stderr, "log file holds %lld bytes, expected %zu\n",
+                (long long) testLogSize(&log), 2 * strlen(LINE));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    testLogClose(&log);
+    return ret;
+}
+
+
+/* Output coming in steadily is written out in time anyway */
+static int
+testSteady(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testLog log;
+    unsigned long long now;
+    unsigned long long deadline;
+    size_t lines = 0;
+    int ret = -1;
+
+    if (testLogOpen(&log, "steady") < 0)
+        return -1;
+
+    if (virTimeMillisNow(&deadline) < 0)
+        goto cleanup;
+    deadline += FLUSH_TIMEOUT;
+
+    /* A line roughly every 10 ms, a lot less than fills the buffer */
+    do {
+        if (testLogWrite(&log) < 0 ||
+            testLogRead(&log, ++lines * strlen(LINE)) < 0 ||
+            virEventRunDefaultImpl() < 0 ||
+            virTimeMillisNow(&now) < 0)
+            goto cleanup;
+    } while (testLogSize(&log) == 0 && now < deadline);
+
+    if (testLogSize(&log) == 0) {
+        fprintf(stderr, "none of %zu lines were written out\n", lines);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    testLogClose(&log);
+    return ret;
+}
+
+
+/* Clients asking for the position see all output read so far */
+static int
+testPosition(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testLog log;
+    ino_t inode;
+    off_t offset;
+    int ret = -1;
+
+    if (testLogOpen(&log, "position") < 0)
+        return -1;
+
+    if (testLogWrite(&log) < 0 ||
+        testLogRead(&log, strlen(LINE)) < 0)
+        goto cleanup;
+
+    if (virLogHandlerDomainGetLogFilePosition(log.handler, log.path, 0,
+                                              &inode, &offset) < 0)
+        goto cleanup;
+
+    if (offset != strlen(LINE) || testLogSize(&log) != strlen(LINE)) {
+        fprintf(stderr, "position %lld, log file holds %lld bytes, "
+                "expected %zu\n", (long long) offset,
+                (long long) testLogSize(&log), strlen(LINE));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    testLogClose(&log);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    virEventRegisterDefaultImpl();
+
+    if (virTestRun("Buffered output", testBuffered, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Steady output", testSteady, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Position flushes output", testPosition, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -28,6 +28,7 @@
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virobject.h"
 #include "rpc/virnetmessage.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
@@ -522,6 +523,150 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int testMessagePayloadStreamReuse(const void *args ATTRIBUTE_UNUSED)
+{
+    char stream[] = "The quick brown fox jumps over the lazy dog";
+    virNetMessagePtr msg = virNetMessageNew(true);
+    size_t bufferLength = VIR_NET_MESSAGE_LEN_MAX +
+        VIR_NET_MESSAGE_HEADER_MAX + VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+    char *buffer;
+    int ret = -1;
+
+    if (!msg)
+        return -1;
+
+    /* A preallocated buffer larger than the initial size
+     * must be used for encoding as it is */
+    if (VIR_ALLOC_N(msg->buffer, bufferLength) < 0)
+        goto cleanup;
+    msg->bufferLength = msg->bufferCapacity = bufferLength;
+    buffer = msg->buffer;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (msg->buffer != buffer || msg->bufferLength != bufferLength) {
+        VIR_DEBUG("Expect message buffer %p length %zu got %p length %zu",
+                  buffer, bufferLength, msg->buffer, msg->bufferLength);
+        goto cleanup;
+    }
+
+    if (virNetMessageEncodePayloadRaw(msg, stream, strlen(stream)) < 0)
+        goto cleanup;
+
+    if (msg->buffer != buffer) {
+        VIR_DEBUG("Expect message buffer %p got %p", buffer, msg->buffer);
+        goto cleanup;
+    }
+
+    if (msg->bufferLength != VIR_NET_MESSAGE_LEN_MAX +
+        VIR_NET_MESSAGE_HEADER_MAX + strlen(stream)) {
+        VIR_DEBUG("Expect message length %zu got %zu",
+                  VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX +
+                  strlen(stream), msg->bufferLength);
+        goto cleanup;
+    }
+
+    if (memcmp(stream, msg->buffer + VIR_NET_MESSAGE_LEN_MAX +
+               VIR_NET_MESSAGE_HEADER_MAX, strlen(stream)) != 0) {
+        VIR_DEBUG("Unexpected stream payload");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+static int testMessagePool(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePoolPtr pool = NULL;
+    virNetMessagePtr msg = NULL;
+    virNetMessagePtr small = NULL;
+    virNetMessagePoolStats stats;
+    char *buffer;
+    int ret = -1;
+
+    if (!(pool = virNetMessagePoolNew(1)))
+        return -1;
+
+    /* Nothing to recycle yet */
+    if (!(msg = virNetMessagePoolGet(pool, true, VIR_NET_MESSAGE_LEN_MAX)))
+        goto cleanup;
+
+    if (msg->bufferLength != VIR_NET_MESSAGE_LEN_MAX || !msg->tracked) {
+        VIR_DEBUG("Unexpected message length %zu tracked %d",
+                  msg->bufferLength, msg->tracked);
+        goto cleanup;
+    }
+
+    msg->header.type = VIR_NET_REPLY;
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+    buffer = msg->buffer;
+
+    /* A message with a tiny buffer is not worth keeping */
+    if (!(small = virNetMessagePoolGet(pool, false, VIR_NET_MESSAGE_LEN_MAX)))
+        goto cleanup;
+    virNetMessagePoolPut(pool, small);
+    small = NULL;
+
+    virNetMessagePoolPut(pool, msg);
+    msg = NULL;
+
+    /* The message and its buffer are handed out again */
+    if (!(msg = virNetMessagePoolGet(pool, false, VIR_NET_MESSAGE_LEN_MAX)))
+        goto cleanup;
+
+    if (msg->buffer != buffer || msg->tracked ||
+        msg->header.type != 0 || msg->bufferOffset != 0 ||
+        msg->bufferLength != VIR_NET_MESSAGE_LEN_MAX) {
+        VIR_DEBUG("Message was not recycled properly");
+        goto cleanup;
+    }
+
+    virNetMessagePoolGetStats(pool, &stats);
+    if (stats.hits != 1 || stats.misses != 2 ||
+        stats.discards != 1 || stats.nfree != 0) {
+        VIR_DEBUG("Unexpected pool stats hits=%llu misses=%llu "
+                  "discards=%llu nfree=%zu",
+                  stats.hits, stats.misses, stats.discards, stats.nfree);
+        goto cleanup;
+    }
+
+    /* Nor is one whose buffer is larger than its class */
+    if (!(small = virNetMessagePoolGet(pool, false,
+                                       VIR_NET_MESSAGE_INITIAL +
+                                       VIR_NET_MESSAGE_LEN_MAX + 1)))
+        goto cleanup;
+    virNetMessagePoolPut(pool, small);
+    small = NULL;
+
+    virNetMessagePoolGetStats(pool, &stats);
+    if (stats.misses != 3 || stats.discards != 2 || stats.nfree != 0) {
+        VIR_DEBUG("Unexpected pool stats misses=%llu discards=%llu nfree=%zu",
+                  stats.misses, stats.discards, stats.nfree);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    virNetMessageFree(small);
+    virObjectUnref(pool);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -544,6 +689,12 @@ mymain(void)
     if (virTestRun("Message Payload Stream Encode", testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Message Payload Stream Reuse", testMessagePayloadStreamReuse, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Message Pool", testMessagePool, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
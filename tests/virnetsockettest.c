@@ -315,6 +315,55 @@ static int testSocketUNIXAddrs(const void *data ATTRIBUTE_UNUSED)
     return ret;
 }
 
+static int testSocketWritev(const void *data ATTRIBUTE_UNUSED)
+{
+    virNetSocketPtr sock = NULL;
+    int fds[2] = { -1, -1 };
+    const char *chunks[] = { "first ", "second ", "", "third" };
+    const char *expect = "first second third";
+    struct iovec iov[ARRAY_CARDINALITY(chunks)];
+    char buf[100];
+    size_t len = strlen(expect);
+    size_t i;
+    ssize_t rv;
+    int ret = -1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        virReportSystemError(errno, "%s", "Cannot create socket pair");
+        goto cleanup;
+    }
+
+    if (virNetSocketNewConnectSockFD(fds[0], &sock) < 0)
+        goto cleanup;
+    fds[0] = -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(chunks); i++) {
+        iov[i].iov_base = (char *) chunks[i];
+        iov[i].iov_len = strlen(chunks[i]);
+    }
+
+    if ((rv = virNetSocketWritev(sock, iov, ARRAY_CARDINALITY(iov))) != len) {
+        VIR_DEBUG("Expected %zu bytes written at once, got %zd", len, rv);
+        goto cleanup;
+    }
+
+    /* saferead() only returns early on EOF, so ask for no more than
+     * was written as the socket is still open */
+    if ((rv = saferead(fds[1], buf, len)) != len ||
+        memcmp(buf, expect, len) != 0) {
+        VIR_DEBUG("Unexpected data read back");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(sock);
+    VIR_FORCE_CLOSE(fds[0]);
+    VIR_FORCE_CLOSE(fds[1]);
+    return ret;
+}
+
 static int testSocketCommandNormal(const void *data ATTRIBUTE_UNUSED)
 {
     virNetSocketPtr csock = NULL; /* Client socket */
@@ -483,6 +532,9 @@ mymain(void)
     if (virTestRun("Socket UNIX Addrs", testSocketUNIXAddrs, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Socket UNIX Writev", testSocketWritev, NULL) < 0)
+        ret = -1;
+
     if (virTestRun("Socket External Command /dev/zero", testSocketCommandNormal, NULL) < 0)
         ret = -1;
     if (virTestRun("Socket External Command /dev/does-not-exist", testSocketCommandFail, NULL) < 0)
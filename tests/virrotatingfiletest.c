@@ -19,6 +19,7 @@
  */
 
 #include <config.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -557,6 +558,174 @@ static int testRotatingFileWriterLargeFile(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+/* Makes opening files fail until @orig is restored */
+static int testRotatingFileNoMoreFiles(struct rlimit *orig)
+{
+    struct rlimit rl;
+    int fd;
+
+    if (getrlimit(RLIMIT_NOFILE, orig) < 0 ||
+        (fd = open("/dev/null", O_RDONLY)) < 0) {
+        fprintf(stderr, "Cannot limit open files\n");
+        return -1;
+    }
+
+    /* No file descriptor from the lowest free one on */
+    rl = *orig;
+    rl.rlim_cur = fd;
+    VIR_FORCE_CLOSE(fd);
+
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        fprintf(stderr, "Cannot limit open files\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int testRotatingFileWriterRolloverReopen(const void *data ATTRIBUTE_UNUSED)
+{
+    virRotatingFileWriterPtr file;
+    struct rlimit rl;
+    bool limited = false;
+    int ret = -1;
+    char buf[512];
+
+    if (testRotatingFileInitFiles((off_t)-1,
+                                  (off_t)-1,
+                                  (off_t)-1) < 0)
+        return -1;
+
+    file = virRotatingFileWriterNew(FILENAME,
+                                    1024,
+                                    2,
+                                    false,
+                                    0700);
+    if (!file)
+        goto cleanup;
+
+    memset(buf, 0x5e, sizeof(buf));
+
+    virRotatingFileWriterAppend(file, buf, sizeof(buf));
+    virRotatingFileWriterAppend(file, buf, sizeof(buf));
+
+    if (testRotatingFileNoMoreFiles(&rl) < 0)
+        goto cleanup;
+    limited = true;
+
+    /* The file is rolled over, but the new one can't be opened */
+    if (virRotatingFileWriterAppend(file, buf, sizeof(buf)) != -1) {
+        fprintf(stderr, "Append should have failed\n");
+        goto cleanup;
+    }
+
+    if (testRotatingFileWriterAssertFileSizes((off_t)-1,
+                                              1024,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    /* Only opening the new file is retried */
+    if (virRotatingFileWriterAppend(file, buf, sizeof(buf)) != -1) {
+        fprintf(stderr, "Append should have failed\n");
+        goto cleanup;
+    }
+
+    if (testRotatingFileWriterAssertFileSizes((off_t)-1,
+                                              1024,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+        goto cleanup;
+    limited = false;
+    virResetLastError();
+
+    if (virRotatingFileWriterAppend(file, buf, sizeof(buf)) != sizeof(buf)) {
+        fprintf(stderr, "Append should have succeeded\n");
+        goto cleanup;
+    }
+
+    if (testRotatingFileWriterAssertFileSizes(512,
+                                              1024,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    if (limited)
+        ignore_value(setrlimit(RLIMIT_NOFILE, &rl));
+    virRotatingFileWriterFree(file);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    return ret;
+}
+
+
+static int testRotatingFileWriterRolloverPartial(const void *data ATTRIBUTE_UNUSED)
+{
+    virRotatingFileWriterPtr file;
+    struct rlimit rl;
+    bool limited = false;
+    int ret = -1;
+    ssize_t written;
+    char buf[512];
+
+    if (testRotatingFileInitFiles((off_t)768,
+                                  (off_t)-1,
+                                  (off_t)-1) < 0)
+        return -1;
+
+    file = virRotatingFileWriterNew(FILENAME,
+                                    1024,
+                                    2,
+                                    false,
+                                    0700);
+    if (!file)
+        goto cleanup;
+
+    memset(buf, 0x5e, sizeof(buf));
+
+    if (testRotatingFileNoMoreFiles(&rl) < 0)
+        goto cleanup;
+    limited = true;
+
+    /* What fits into the old file is written before the rollover fails */
+    if ((written = virRotatingFileWriterAppend(file, buf,
+                                               sizeof(buf))) != 256) {
+        fprintf(stderr, "Append wrote %zd bytes, expected 256\n", written);
+        goto cleanup;
+    }
+
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+        goto cleanup;
+    limited = false;
+    virResetLastError();
+
+    if (virRotatingFileWriterAppend(file, buf + written,
+                                    sizeof(buf) - written) != 256) {
+        fprintf(stderr, "Append should have succeeded\n");
+        goto cleanup;
+    }
+
+    if (testRotatingFileWriterAssertFileSizes(256,
+                                              1024,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    if (limited)
+        ignore_value(setrlimit(RLIMIT_NOFILE, &rl));
+    virRotatingFileWriterFree(file);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    return ret;
+}
+
+
 static int testRotatingFileReaderOne(const void *data ATTRIBUTE_UNUSED)
 {
     virRotatingFileReaderPtr file;
@@ -726,6 +895,12 @@ mymain(void)
     if (virTestRun("Rotating file write to file larger then maxlen", testRotatingFileWriterLargeFile, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Rotating file write rollover reopen", testRotatingFileWriterRolloverReopen, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Rotating file write rollover partial", testRotatingFileWriterRolloverPartial, NULL) < 0)
+        ret = -1;
+
     if (virTestRun("Rotating file read one", testRotatingFileReaderOne, NULL) < 0)
         ret = -1;
 
@@ -25,6 +25,8 @@
 #include <virtypedparam.h>
 
 #include "testutils.h"
+#include "viralloc.h"
+#include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -285,6 +287,219 @@ testTypedParamsValidator(void)
     return rv;
 }
 
+static int
+testTypedParamsRecordsAdd(virDomainStatsRecordPtr *records,
+                          size_t i)
+{
+    int maxparams = 0;
+    virDomainStatsRecordPtr record;
+
+    if (VIR_ALLOC(record) < 0)
+        return -1;
+    records[i] = record;
+
+    /* The second domain has a field the others lack in the middle, the
+     * last one has most values negative and no strings */
+    if (virTypedParamsAddInt(&record->params, &record->nparams, &maxparams,
+                             "state.state", i == 2 ? -1 : i) < 0 ||
+        virTypedParamsAddULLong(&record->params, &record->nparams, &maxparams,
+                                "cpu.time", 123456789012345ULL * i) < 0 ||
+        (i == 1 &&
+         virTypedParamsAddUInt(&record->params, &record->nparams, &maxparams,
+                               "balloon.current", 1 << 20) < 0) ||
+        virTypedParamsAddLLong(&record->params, &record->nparams, &maxparams,
+                               "vcpu.0.wait", i == 2 ? LLONG_MIN : 64) < 0 ||
+        virTypedParamsAddDouble(&record->params, &record->nparams, &maxparams,
+                                "perf.ratio", i == 2 ? -0.5 : 3.25 * i) < 0 ||
+        virTypedParamsAddBoolean(&record->params, &record->nparams, &maxparams,
+                                 "block.0.rd.ok", i != 1) < 0 ||
+        (i != 2 &&
+         virTypedParamsAddString(&record->params, &record->nparams, &maxparams,
+                                 "block.0.name", i ? "sda" : "vda") < 0))
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testTypedParamsRecordsEqual(virDomainStatsRecordPtr a,
+                            virDomainStatsRecordPtr b)
+{
+    size_t i;
+
+    if (a->nparams != b->nparams) {
+        fprintf(stderr, "expected %d params, got %d\n",
+                a->nparams, b->nparams);
+        return -1;
+    }
+
+    for (i = 0; i < a->nparams; i++) {
+        virTypedParameterPtr pa = a->params + i;
+        virTypedParameterPtr pb = b->params + i;
+        bool equal;
+
+        if (STRNEQ(pa->field, pb->field) || pa->type != pb->type) {
+            fprintf(stderr, "expected param '%s' of type %d, "
+                    "got '%s' of type %d\n",
+                    pa->field, pa->type, pb->field, pb->type);
+            return -1;
+        }
+
+        switch ((virTypedParameterType) pa->type) {
+        case VIR_TYPED_PARAM_INT:
+            equal = pa->value.i == pb->value.i;
+            break;
+        case VIR_TYPED_PARAM_UINT:
+            equal = pa->value.ui == pb->value.ui;
+            break;
+        case VIR_TYPED_PARAM_LLONG:
+            equal = pa->value.l == pb->value.l;
+            break;
+        case VIR_TYPED_PARAM_ULLONG:
+            equal = pa->value.ul == pb->value.ul;
+            break;
+        case VIR_TYPED_PARAM_DOUBLE:
+            equal = pa->value.d == pb->value.d;
+            break;
+        case VIR_TYPED_PARAM_BOOLEAN:
+            equal = pa->value.b == pb->value.b;
+            break;
+        case VIR_TYPED_PARAM_STRING:
+            equal = STREQ(pa->value.s, pb->value.s);
+            break;
+        case VIR_TYPED_PARAM_LAST:
+        default:
+            equal = false;
+            break;
+        }
+
+        if (!equal) {
+            fprintf(stderr, "value of param '%s' differs\n", pa->field);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+testTypedParamsColumns(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainStatsRecordPtr records[4] = { NULL };
+    virDomainStatsRecordPtr *result = NULL;
+    virDomainStatsColumnsPtr columns = NULL;
+    virDomainStatsColumnsPtr unpacked = NULL;
+    size_t nrecords = ARRAY_CARDINALITY(records) - 1;
+    size_t i;
+    int rv = -1;
+
+    for (i = 0; i < nrecords; i++) {
+        if (testTypedParamsRecordsAdd(records, i) < 0)
+            goto cleanup;
+    }
+
+    if (!(columns = virTypedParamsRecordsToColumns(records, nrecords)))
+        goto cleanup;
+
+    if (columns->ncolumns != 7) {
+        fprintf(stderr, "expected 7 columns, got %d\n", columns->ncolumns);
+        goto cleanup;
+    }
+
+    /* Transfer the columns the way the remote driver does */
+    if (VIR_ALLOC(unpacked) < 0 ||
+        VIR_ALLOC_N(unpacked->doms, nrecords) < 0)
+        goto cleanup;
+    unpacked->ndoms = nrecords;
+
+    for (i = 0; i < columns->ncolumns; i++) {
+        virDomainStatsColumnPtr column = columns->columns + i;
+        char *present = NULL;
+        char *values = NULL;
+        char **strings = NULL;
+        unsigned int npresent;
+        unsigned int nvalues;
+        unsigned int nstrings;
+        int rc;
+
+        if (virTypedParamsColumnPack(column, columns->ndoms,
+                                     &present, &npresent,
+                                     &values, &nvalues,
+                                     &strings, &nstrings) < 0)
+            goto cleanup;
+
+        rc = virTypedParamsColumnNew(unpacked, i, column->field,
+                                     column->type);
+        if (rc == 0)
+            rc = virTypedParamsColumnUnpack(unpacked->columns + i,
+                                            unpacked->ndoms,
+                                            present, npresent,
+                                            values, nvalues,
+                                            strings, nstrings);
+
+        VIR_FREE(present);
+        VIR_FREE(values);
+        virStringListFreeCount(strings, nstrings);
+        if (rc < 0)
+            goto cleanup;
+    }
+
+    if (virTypedParamsColumnsToRecords(unpacked, &result) != nrecords)
+        goto cleanup;
+
+    for (i = 0; i < nrecords; i++) {
+        if (testTypedParamsRecordsEqual(records[i], result[i]) < 0)
+            goto cleanup;
+    }
+
+    rv = 0;
+ cleanup:
+    for (i = 0; i < nrecords; i++) {
+        if (records[i])
+            virTypedParamsFree(records[i]->params, records[i]->nparams);
+        VIR_FREE(records[i]);
+    }
+    virDomainStatsRecordListFree(result);
+    virTypedParamsColumnsFree(columns);
+    virTypedParamsColumnsFree(unpacked);
+    return rv;
+}
+
+
+static int
+testTypedParamsColumnsMalformed(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainStatsColumnsPtr columns = NULL;
+    /* Both domains present, but the second varint is truncated */
+    char present[] = { 0x03 };
+    char values[] = { 0x02, 0x80 };
+    int rv = -1;
+
+    if (VIR_ALLOC(columns) < 0 ||
+        VIR_ALLOC_N(columns->doms, 2) < 0)
+        goto cleanup;
+    columns->ndoms = 2;
+
+    if (virTypedParamsColumnNew(columns, 0, "state.state",
+                                VIR_TYPED_PARAM_INT) < 0)
+        goto cleanup;
+
+    if (virTypedParamsColumnUnpack(columns->columns, columns->ndoms,
+                                   present, sizeof(present),
+                                   values, sizeof(values),
+                                   NULL, 0) == 0) {
+        fprintf(stderr, "truncated values were accepted\n");
+        goto cleanup;
+    }
+
+    rv = 0;
+ cleanup:
+    virTypedParamsColumnsFree(columns);
+    return rv;
+}
+
 static int
 mymain(void)
 {
@@ -302,6 +517,13 @@ mymain(void)
     if (virTestRun("Add string list", testTypedParamsAddStringList, NULL) < 0)
         rv = -1;
 
+    if (virTestRun("Columns", testTypedParamsColumns, NULL) < 0)
+        rv = -1;
+
+    if (virTestRun("Malformed columns", testTypedParamsColumnsMalformed,
+                   NULL) < 0)
+        rv = -1;
+
     if (rv < 0)
         return EXIT_FAILURE;
     return EXIT_SUCCESS;
@@ -265,6 +265,44 @@ int virshStreamSink(virStreamPtr st ATTRIBUTE_UNUSED,
     return safewrite(*fd, bytes, nbytes);
 }
 
+
+int virshStreamSkip(virStreamPtr st ATTRIBUTE_UNUSED,
+                    long long offset, void *opaque)
+{
+    int *fd = opaque;
+
+    if (lseek(*fd, offset, SEEK_CUR) == (off_t) -1)
+        return -1;
+
+    return 0;
+}
+
+
+int virshStreamHole(virStreamPtr st ATTRIBUTE_UNUSED,
+                    long long length, void *opaque)
+{
+    int *fd = opaque;
+    off_t cur;
+
+    if ((cur = lseek(*fd, length, SEEK_CUR)) == (off_t) -1)
+        return -1;
+
+    /* Make sure a hole at the very end of the file is not lost */
+    if (ftruncate(*fd, cur) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+int virshStreamInData(virStreamPtr st ATTRIBUTE_UNUSED,
+                      int *inData, long long *offset, void *opaque)
+{
+    int *fd = opaque;
+
+    return virFileInData(*fd, inData, offset);
+}
+
 /* ---------------
  * Command Connect
  * ---------------
@@ -150,4 +150,11 @@ int virshDomainState(vshControl *ctl, virDomainPtr dom, int *reason);
 int virshStreamSink(virStreamPtr st, const char *bytes, size_t nbytes,
                     void *opaque);
 
+int virshStreamSkip(virStreamPtr st, long long offset, void *opaque);
+
+int virshStreamHole(virStreamPtr st, long long length, void *opaque);
+
+int virshStreamInData(virStreamPtr st, int *inData, long long *offset,
+                      void *opaque);
+
 #endif /* VIRSH_H */
@@ -503,6 +503,10 @@ static const vshCmdOptDef opts_srv_threadpool_set[] = {
      .type = VSH_OT_INT,
      .help = N_("Change the current number of priority workers"),
     },
+    {.name = "io-threads",
+     .type = VSH_OT_INT,
+     .help = N_("Change the number of event loop threads for client I/O"),
+    },
     {.name = NULL}
 };
 
@@ -535,13 +539,14 @@ cmdSrvThreadpoolSet(vshControl *ctl, const vshCmd *cmd)
     PARSE_CMD_TYPED_PARAM("max-workers", VIR_THREADPOOL_WORKERS_MAX);
     PARSE_CMD_TYPED_PARAM("min-workers", VIR_THREADPOOL_WORKERS_MIN);
     PARSE_CMD_TYPED_PARAM("priority-workers", VIR_THREADPOOL_WORKERS_PRIORITY);
+    PARSE_CMD_TYPED_PARAM("io-threads", VIR_THREADPOOL_IO_THREADS);
 
 #undef PARSE_CMD_TYPED_PARAM
 
     if (!nparams) {
         vshError(ctl, "%s",
                  _("At least one of options --min-workers, --max-workers, "
-                   "--priority-workers is mandatory "));
+                   "--priority-workers, --io-threads is mandatory "));
             goto cleanup;
     }
 
@@ -867,6 +872,68 @@ cmdSrvClientsInfo(vshControl *ctl, const vshCmd *cmd)
     return ret;
 }
 
+/* --------------------------
+ * Command server-msgpool-info
+ * --------------------------
+ */
+
+static const vshCmdInfo info_srv_msgpool_info[] = {
+    {.name = "help",
+     .data = N_("get server's RPC message pool statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve statistics of the pool of RPC messages the server "
+                "recycles across calls.")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_srv_msgpool_info[] = {
+    {.name = "server",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("Server to retrieve the message pool statistics from."),
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdSrvMsgpoolInfo(vshControl *ctl, const vshCmd *cmd)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    const char *srvname = NULL;
+    virAdmServerPtr srv = NULL;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (vshCommandOptStringReq(ctl, cmd, "server", &srvname) < 0)
+        return false;
+
+    if (!(srv = virAdmConnectLookupServer(priv->conn, srvname, 0)))
+        goto cleanup;
+
+    if (virAdmServerGetMessagePoolStats(srv, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to retrieve message pool statistics "
+                              "from server"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++) {
+        char *str = vshGetTypedParamValue(ctl, &params[i]);
+        vshPrint(ctl, "%-20s: %s\n", params[i].field, str);
+        VIR_FREE(str);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    virAdmServerFree(srv);
+    return ret;
+}
+
 /* -----------------------
  * Command srv-clients-set
  * -----------------------
@@ -1419,6 +1486,12 @@ static const vshCmdDef monitoringCmds[] = {
      .info = info_srv_clients_info,
      .flags = 0
     },
+    {.name = "server-msgpool-info",
+     .handler = cmdSrvMsgpoolInfo,
+     .opts = opts_srv_msgpool_info,
+     .info = info_srv_msgpool_info,
+     .flags = 0
+    },
     {.name = NULL}
 };
 